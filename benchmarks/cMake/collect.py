@@ -0,0 +1,117 @@
+#! /usr/bin/env python
+#########################################################################
+#                                                                       #
+#            #    ##   #  #   #                           #             #
+#           # #  #  #  #  #  # #                          #             #
+#          ##### #  #  #  # #####  ##  ###  #  #  ## ###  ###           #
+#          #   # #  #  #  # #   # #  # #  # #  # #   #  # #  #          #
+#          #   # #  #  #  # #   # #  # #  # #  #   # #  # #  #          #
+#          #   #  ## #  ##  #   #  ### ###   ### ##  ###  #  #          #
+#                                    # #             #                  #
+#                                  ##  #             #                  #
+#                                                                       #
+#########################################################################
+#
+#  This file is part of AQUA-gpusph, a free CFD program based on SPH.
+#  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+#
+#  AQUA-gpusph is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  AQUA-gpusph is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with AQUA-gpusph.  If not, see <http://www.gnu.org/licenses/>.
+#
+#########################################################################
+
+# Collect the results of the benchmark runs in a JSON document, printed on
+# the standard output. Usage:
+#     collect.py RUN_FOLDER1 [RUN_FOLDER2 ...]
+
+import sys
+import os.path as path
+import json
+import platform
+import time
+
+
+def readPerformance(fname):
+    """Read the last line of the performance report file, as a dictionary
+    with the column names of the header"""
+    header = None
+    last = None
+    with open(fname, 'r') as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            if line.startswith('#'):
+                words = line[1:].split()
+                # Skip the memory breakdown comments
+                if header is None and words and words[0] == 't':
+                    header = words
+                continue
+            last = line.split()
+    if header is None or last is None:
+        return {}
+    return {k: float(v) for k, v in zip(header, last)}
+
+
+def readMetrics(fname):
+    """Read the Prometheus text file written by the metrics report"""
+    scalars = {}
+    tools = {}
+    with open(fname, 'r') as f:
+        for line in f:
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            name, value = line.rsplit(' ', 1)
+            labels = {}
+            if '{' in name:
+                name, lbl = name[:-1].split('{', 1)
+                for item in lbl.split('",'):
+                    k, v = item.split('=', 1)
+                    labels[k] = v.strip('"')
+            name = name.replace('aquagpusph_', '', 1)
+            if 'tool' in labels:
+                tool = tools.setdefault(labels['tool'], {})
+                tool[name.replace('tool_', '', 1)] = float(value)
+            else:
+                scalars[name] = float(value)
+    return scalars, tools
+
+
+runs = []
+for folder in sys.argv[1:]:
+    perf = readPerformance(path.join(folder, 'Performance.dat'))
+    scalars, tools = readMetrics(path.join(folder, 'metrics.prom'))
+    n = int(scalars.get('particles', 0))
+    elapsed = perf.get('average(elapsed)', 0.0)
+    run = {
+        'folder': folder,
+        'particles': n,
+        'steps': int(scalars.get('iterations_total', 0)),
+        'seconds_per_step': elapsed,
+        'particle_updates_per_second': n / elapsed if elapsed > 0 else 0.0,
+        'memory_bytes': int(perf.get('memory', 0)),
+        'peak_memory_bytes': int(perf.get('peak(memory)', 0)),
+        'tools': tools,
+    }
+    runs.append(run)
+
+results = {
+    'benchmark': '@BENCHMARK_NAME@',
+    'dimensions': @BENCHMARK_DIM@,
+    'version': '@PACKAGE_VERSION@',
+    'host': platform.node(),
+    'date': time.strftime('%Y-%m-%dT%H:%M:%S'),
+    'runs': runs,
+}
+print(json.dumps(results, indent=4, sort_keys=True))
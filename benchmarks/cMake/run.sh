@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Run the @BENCHMARK_NAME@ benchmark, scaled to several numbers of fluid
+# particles. Each run is carried out in its own folder, and the results of all
+# of them are collected in results.json
+#
+# Usage: run.sh [N1 N2 ...]
+
+set -e
+
+SIZES="$*"
+if [[ -z "${SIZES}" ]]; then
+    SIZES="@BENCHMARK_SIZES@"
+fi
+
+cd @BENCHMARK_DEST_DIR@
+RUNS=""
+for N in ${SIZES}; do
+    echo "@BENCHMARK_NAME@ with ${N} fluid particles..."
+    RUN_DIR=@BENCHMARK_DEST_DIR@/n${N}
+    rm -rf ${RUN_DIR}
+    mkdir -p ${RUN_DIR}
+    cd ${RUN_DIR}
+    # Scale the example, replacing the first "n = ..." line of the generator
+    sed -e "0,/^n = [0-9]*$/s//n = ${N}/" @EXAMPLE_DEST_DIR@/Create.py > Create.py
+    python Create.py > Create.log
+    cp @BENCHMARK_DEST_DIR@/Bench.xml Bench.xml
+    @BINARY_DIR@/@BENCHMARK_BINARY@ -i Bench.xml
+    RUNS="${RUNS} ${RUN_DIR}"
+    cd @BENCHMARK_DEST_DIR@
+done
+
+python @BENCHMARK_DEST_DIR@/collect.py ${RUNS} > results.json
+echo "Results written in @BENCHMARK_DEST_DIR@/results.json"
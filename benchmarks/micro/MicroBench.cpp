@@ -0,0 +1,560 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file
+ * @brief Micro-benchmarks of the pipeline building blocks.
+ * (See main(int argc, char *argv[]) for details)
+ */
+
+#include <sphPrerequisites.h>
+#include <getopt.h>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <numeric>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <InputOutput/Logger.h>
+#include <ProblemSetup.h>
+#include <CalcServer.h>
+#include <CalcServer/Copy.h>
+#include <CalcServer/LinkList.h>
+#include <CalcServer/RadixSort.h>
+#include <CalcServer/Reduction.h>
+#include <CalcServer/UnSort.h>
+#include <AuxiliarMethods.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+
+using namespace Aqua;
+
+// Short and long runtime options (see
+// http://www.gnu.org/software/libc/manual/html_node/Getopt.html#Getopt)
+static const char *opts = "p:d:n:r:t:b:I:G:S:o:h";
+static const struct option longOpts[] = {
+    { "platform", required_argument, NULL, 'p' },
+    { "device", required_argument, NULL, 'd' },
+    { "sizes", required_argument, NULL, 'n' },
+    { "reps", required_argument, NULL, 'r' },
+    { "tools", required_argument, NULL, 't' },
+    { "bits", required_argument, NULL, 'b' },
+    { "items", required_argument, NULL, 'I' },
+    { "groups", required_argument, NULL, 'G' },
+    { "splits", required_argument, NULL, 'S' },
+    { "output", required_argument, NULL, 'o' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, no_argument, NULL, 0 }
+};
+extern char *optarg;
+
+/// Micro-benchmarks options
+typedef struct {
+    /// OpenCL platform index
+    unsigned int platform;
+    /// OpenCL device index
+    unsigned int device;
+    /// Numbers of elements
+    std::vector<unsigned int> sizes;
+    /// Number of timed executions of each tool
+    unsigned int reps;
+    /// Tools to be benchmarked
+    std::vector<std::string> tools;
+    /// Radix-sort bits per pass
+    std::vector<unsigned int> bits;
+    /// Radix-sort items per group
+    std::vector<unsigned int> items;
+    /// Radix-sort number of groups
+    std::vector<unsigned int> groups;
+    /// Radix-sort histogram splits
+    std::vector<unsigned int> splits;
+    /// Output file
+    std::string output;
+} MicroBenchOptions;
+
+/** @brief Display the program usage.
+ */
+static void displayUsage()
+{
+    std::cout << "Usage:\tAQUAgpusphMicroBench [Option]..." << std::endl;
+    std::cout << "   or:\tAQUAgpusphMicroBench2D [Option]..." << std::endl;
+    std::cout << "Times the radix-sort, reduction, link-list, unsort and copy "
+              << "tools on synthetic data" << std::endl;
+    std::cout << std::endl;
+    std::cout << "The lists are comma separated values." << std::endl;
+    std::cout << "  -p, --platform=INDEX         OpenCL platform (0 by default)"
+              << std::endl;
+    std::cout << "  -d, --device=INDEX           OpenCL device (0 by default)"
+              << std::endl;
+    std::cout << "  -n, --sizes=LIST             Numbers of elements "
+              << "(1e4,1e5,1e6,1e7,1e8 by default)" << std::endl;
+    std::cout << "  -r, --reps=N                 Timed executions of each tool "
+              << "(10 by default)" << std::endl;
+    std::cout << "  -t, --tools=LIST             Tools to be benchmarked "
+              << "(radix-sort,reduction,link-list,unsort,copy by default)"
+              << std::endl;
+    std::cout << "  -b, --bits=LIST              Radix-sort bits per pass ("
+              << _STEPBITS << " by default)" << std::endl;
+    std::cout << "  -I, --items=LIST             Radix-sort items per group ("
+              << _ITEMS << " by default)" << std::endl;
+    std::cout << "  -G, --groups=LIST            Radix-sort groups ("
+              << _GROUPS << " by default)" << std::endl;
+    std::cout << "  -S, --splits=LIST            Radix-sort histogram splits ("
+              << _HISTOSPLIT << " by default)" << std::endl;
+    std::cout << "  -o, --output=FILE            Results file "
+              << "(MicroBench.dat by default)" << std::endl;
+    std::cout << "  -h, --help                   Show this help page" << std::endl;
+}
+
+/** @brief Parse a comma separated list of numbers.
+ *
+ * The numbers may be given in scientific notation, e.g. 1e6
+ * @param str List
+ * @return Numbers
+ */
+static std::vector<unsigned int> parseList(const std::string str)
+{
+    std::vector<unsigned int> values;
+    for(auto value : split(replaceAllCopy(str, " ", ""), ',')){
+        if(value.empty())
+            continue;
+        values.push_back((unsigned int)std::stod(value));
+    }
+    return values;
+}
+
+/** @brief Parse the command line arguments
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @param options Options to be filled
+ */
+static void parse(int argc, char **argv, MicroBenchOptions &options)
+{
+    int index;
+
+    int opt = getopt_long(argc, argv, opts, longOpts, &index);
+    while( opt != -1 ) {
+        switch( opt ) {
+            case 'p':
+                options.platform = std::stoi(optarg);
+                break;
+            case 'd':
+                options.device = std::stoi(optarg);
+                break;
+            case 'n':
+                options.sizes = parseList(optarg);
+                break;
+            case 'r':
+                options.reps = std::stoi(optarg);
+                break;
+            case 't':
+                options.tools = split(replaceAllCopy(optarg, " ", ""), ',');
+                break;
+            case 'b':
+                options.bits = parseList(optarg);
+                break;
+            case 'I':
+                options.items = parseList(optarg);
+                break;
+            case 'G':
+                options.groups = parseList(optarg);
+                break;
+            case 'S':
+                options.splits = parseList(optarg);
+                break;
+            case 'o':
+                options.output = optarg;
+                break;
+            case 'h':
+                displayUsage();
+                exit(EXIT_SUCCESS);
+            default:
+                LOG(L_ERROR, "Error parsing the runtime args\n\n");
+                displayUsage();
+                throw std::invalid_argument("Invalid command line argument");
+        }
+        opt = getopt_long(argc, argv, opts, longOpts, &index);
+    }
+}
+
+/** @brief Wait for all the work enqueued in the calculation server
+ */
+static void finish()
+{
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    cl_int err_code = clFinish(C->command_queue());
+    err_code |= clFinish(C->command_queue(true));
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Failure waiting for the command queues.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+}
+
+/** @brief Send data to an array variable
+ * @param name Variable name
+ * @param data Data, which length shall match the variable size
+ */
+static void upload(const std::string name, const void *data)
+{
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    InputOutput::Variable *var = C->variables()->get(name);
+    cl_event event = var->getEvent();
+    cl_int err_code = C->writeBuffer(C->command_queue(),
+                                     *(cl_mem*)var->get(),
+                                     CL_TRUE,
+                                     0,
+                                     var->size(),
+                                     data,
+                                     event ? 1 : 0,
+                                     event ? &event : NULL,
+                                     NULL);
+    if(err_code != CL_SUCCESS) {
+        std::ostringstream msg;
+        msg << "Failure sending variable \"" << name
+            << "\" to the server." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+}
+
+/** @brief Fill an array variable with random values
+ *
+ * The integer arrays are filled with random keys, while the real ones are
+ * filled with values in the [0, 1) interval, i.e. the positions are randomly
+ * placed in a unit box.
+ * @param name Variable name
+ * @param gen Random numbers generator
+ */
+static void randomize(const std::string name, std::mt19937 &gen)
+{
+    InputOutput::Variable *var =
+        CalcServer::CalcServer::singleton()->variables()->get(name);
+    const size_t n = var->size() / sizeof(cl_uint);
+    if(var->type().find("unsigned int") != std::string::npos){
+        std::uniform_int_distribution<cl_uint> dist;
+        std::vector<cl_uint> data(n);
+        for(auto &d : data)
+            d = dist(gen);
+        upload(name, data.data());
+        return;
+    }
+    std::uniform_real_distribution<float> dist(0.f, 1.f);
+    std::vector<float> data(n);
+    for(auto &d : data)
+        d = dist(gen);
+    upload(name, data.data());
+}
+
+/** @brief Time a tool
+ * @param tool Tool, already set up
+ * @param reps Number of timed executions
+ * @param reset Function to be called before each execution, out of the timed
+ * region. It can be used to restore the input data
+ * @param t_mean Average execution time
+ * @param t_min Minimum execution time
+ */
+static void run(CalcServer::Tool *tool,
+                unsigned int reps,
+                std::function<void()> reset,
+                double &t_mean,
+                double &t_min)
+{
+    // Warm up, which is also compiling the lazy stuff
+    reset();
+    tool->execute();
+    finish();
+
+    t_mean = 0.0;
+    t_min = std::numeric_limits<double>::max();
+    for(unsigned int i = 0; i < reps; i++){
+        reset();
+        finish();
+        auto tic = std::chrono::steady_clock::now();
+        tool->execute();
+        finish();
+        auto tac = std::chrono::steady_clock::now();
+        const double t = std::chrono::duration<double>(tac - tic).count();
+        t_mean += t / reps;
+        t_min = min(t_min, t);
+    }
+}
+
+/** @brief Write a results line
+ * @param f Output file
+ * @param tool Tool type
+ * @param n Number of elements
+ * @param sort Radix-sort, NULL for the other tools
+ * @param t_mean Average execution time
+ * @param t_min Minimum execution time
+ * @param bytes Memory traffic model, 0 if it is not known
+ */
+static void writeResult(std::ofstream &f,
+                        const std::string tool,
+                        unsigned int n,
+                        CalcServer::RadixSort *sort,
+                        double t_mean,
+                        double t_min,
+                        double bytes)
+{
+    std::ostringstream line;
+    line << tool << "\t" << n << "\t";
+    if(sort){
+        line << sort->bits() << "\t" << sort->items() << "\t"
+             << sort->groups() << "\t" << sort->splits() << "\t";
+    }
+    else{
+        line << "-\t-\t-\t-\t";
+    }
+    line << std::setprecision(6) << t_mean << "\t" << t_min << "\t";
+    if(bytes > 0.0)
+        line << bytes / t_mean * 1.e-9 << "\t";
+    else
+        line << "-\t";
+    line << n / t_mean * 1.e-6;
+    f << line.str() << std::endl;
+
+    std::ostringstream msg;
+    msg << line.str() << std::endl;
+    LOG(L_INFO, msg.str());
+}
+
+/** @brief Run the micro-benchmarks for a number of elements
+ * @param options Options
+ * @param n Number of elements
+ * @param f Output file
+ */
+static void benchmark(const MicroBenchOptions &options,
+                      unsigned int n,
+                      std::ofstream &f)
+{
+    std::ostringstream msg;
+    msg << "Benchmarking with N = " << n << "..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    // Build a simulation with a single particles set, which is not loaded
+    // from a file, but filled with synthetic data
+    InputOutput::ProblemSetup sim_data;
+    sim_data.settings.devices.push_back(
+        InputOutput::ProblemSetup::sphSettings::device(options.platform,
+                                                       options.device));
+    sim_data.settings.n_queues = 1;
+    InputOutput::ProblemSetup::sphParticlesSet *set =
+        new InputOutput::ProblemSetup::sphParticlesSet();
+    set->n(n);
+    sim_data.sets.push_back(set);
+
+    // The cells length is 2h, so there are roughly 2^dims particles per cell
+    #ifdef HAVE_3D
+        const float h = 1.f / std::cbrt((float)n);
+    #else
+        const float h = 1.f / std::sqrt((float)n);
+    #endif
+    std::ostringstream valstr;
+    valstr << h;
+    sim_data.variables.registerVariable("h", "float", "", valstr.str());
+    sim_data.variables.registerVariable("r_min", "vec", "", "");
+    sim_data.variables.registerVariable("r_max", "vec", "", "");
+    sim_data.variables.registerVariable("bench_keys", "unsigned int*", "n_radix", "");
+    sim_data.variables.registerVariable("bench_perms", "unsigned int*", "n_radix", "");
+    sim_data.variables.registerVariable("bench_inv_perms", "unsigned int*", "n_radix", "");
+    sim_data.variables.registerVariable("bench_in", "float*", "N", "");
+    sim_data.variables.registerVariable("bench_out", "float*", "N", "");
+    sim_data.variables.registerVariable("bench_sum", "float", "", "0");
+
+    CalcServer::CalcServer *C = new CalcServer::CalcServer(sim_data);
+    std::mt19937 gen(n);
+    try {
+        C->setup();
+
+        // Random input data, and a random permutation to be unsorted
+        randomize("r", gen);
+        randomize("bench_in", gen);
+        std::vector<cl_uint> id(n);
+        std::iota(id.begin(), id.end(), 0);
+        std::shuffle(id.begin(), id.end(), gen);
+        upload("id", id.data());
+        id.clear();
+
+        const unsigned int n_radix =
+            *(unsigned int*)C->variables()->get("n_radix")->get();
+        const std::function<void()> nothing = [](){};
+        for(auto type : options.tools){
+            CalcServer::Tool *tool = NULL;
+            double t_mean, t_min;
+            if(!type.compare("radix-sort")){
+                for(auto bits : options.bits){
+                for(auto items : options.items){
+                for(auto groups : options.groups){
+                for(auto splits : options.splits){
+                    CalcServer::RadixSort *sort = new CalcServer::RadixSort(
+                        type, "bench_keys", "bench_perms", "bench_inv_perms",
+                        false, bits, items, groups, splits);
+                    try {
+                        sort->setup();
+                        // The keys are sorted in place, so they shall be
+                        // randomized again before each execution
+                        run(sort, options.reps,
+                            [&](){randomize("bench_keys", gen);},
+                            t_mean, t_min);
+                    } catch(...) {
+                        msg.str("");
+                        msg << "Skipping the radix-sort with bits=" << bits
+                            << ", items=" << items << ", groups=" << groups
+                            << " and splits=" << splits << std::endl;
+                        LOG(L_WARNING, msg.str());
+                        delete sort;
+                        continue;
+                    }
+                    // Each pass reads the keys to build the histograms, and
+                    // then reads and writes both the keys and the
+                    // permutations. The inverse permutations are built at
+                    // the end
+                    const double bytes = (double)n_radix * sizeof(cl_uint) *
+                                         (5.0 * sort->passes() + 2.0);
+                    writeResult(f, type, n, sort, t_mean, t_min, bytes);
+                    delete sort;
+                }}}}
+                continue;
+            }
+            else if(!type.compare("reduction")){
+                tool = new CalcServer::Reduction(
+                    type, "bench_in", "bench_sum", "c = a + b;", "0.f");
+            }
+            else if(!type.compare("link-list")){
+                tool = new CalcServer::LinkList(type, "r");
+            }
+            else if(!type.compare("unsort")){
+                tool = new CalcServer::UnSort(type, "bench_in", "id");
+            }
+            else if(!type.compare("copy")){
+                tool = new CalcServer::Copy(type, "bench_in", "bench_out");
+            }
+            else{
+                msg.str("");
+                msg << "Unknown tool \"" << type << "\"" << std::endl;
+                LOG(L_ERROR, msg.str());
+                throw std::invalid_argument("Invalid tool");
+            }
+            try {
+                tool->setup();
+                run(tool, options.reps, nothing, t_mean, t_min);
+            } catch(...) {
+                delete tool;
+                throw;
+            }
+            // Just the unavoidable traffic is considered, i.e. the link-list
+            // is not modelled, since it depends on the cells
+            double bytes = 0.0;
+            if(!type.compare("reduction"))
+                bytes = n * sizeof(float);
+            else if(!type.compare("unsort"))
+                bytes = n * (sizeof(cl_uint) + 2 * sizeof(float));
+            else if(!type.compare("copy"))
+                bytes = 2.0 * n * sizeof(float);
+            writeResult(f, type, n, NULL, t_mean, t_min, bytes);
+            delete tool;
+        }
+    } catch(...) {
+        delete C;
+        throw;
+    }
+    delete C;
+}
+
+/** Micro-benchmarks starting point.
+ *
+ * The radix-sort, reduction, link-list, unsort and copy tools are isolated
+ * from the pipeline, and timed on synthetic data for several numbers of
+ * elements, sweeping the radix-sort dimensions (see
+ * Aqua::CalcServer::RadixSort). The results are written in a tabulated file,
+ * with the following columns:
+ *   -# Tool
+ *   -# Number of elements
+ *   -# Radix-sort bits, items, groups and splits, after the device corrections
+ *   -# Average and minimum execution times [s]
+ *   -# Effective bandwidth [GB/s], according to a minimum memory traffic model
+ *   -# Throughput [Melements/s]
+ *
+ * @param argc Number of arguments parsed by terminal.
+ * @param argv Array of arguments parsed by terminal.
+ */
+int main(int argc, char *argv[])
+{
+#ifdef HAVE_MPI
+    MPI::Init(argc, argv);
+#endif
+    InputOutput::Logger *logger = new InputOutput::Logger();
+
+    MicroBenchOptions options;
+    options.platform = 0;
+    options.device = 0;
+    options.sizes = parseList("1e4,1e5,1e6,1e7,1e8");
+    options.reps = 10;
+    options.tools = {"radix-sort", "reduction", "link-list", "unsort", "copy"};
+    options.bits = {_STEPBITS};
+    options.items = {_ITEMS};
+    options.groups = {_GROUPS};
+    options.splits = {_HISTOSPLIT};
+    options.output = "MicroBench.dat";
+    int result = EXIT_SUCCESS;
+    try {
+        parse(argc, argv, options);
+        std::ofstream f(options.output, std::ios::out | std::ios::trunc);
+        if(!f.is_open()){
+            std::ostringstream msg;
+            msg << "Failure writing on '" << options.output << "'" << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::ofstream::failure(msg.str());
+        }
+        f << "# tool\tn\tbits\titems\tgroups\tsplits\tmean [s]\tmin [s]\t"
+          << "bandwidth [GB/s]\tthroughput [Melements/s]" << std::endl;
+        for(auto n : options.sizes){
+            try {
+                benchmark(options, n, f);
+            } catch(std::bad_alloc &e) {
+                std::ostringstream msg;
+                msg << "Insufficient memory for N = " << n << std::endl;
+                LOG(L_ERROR, msg.str());
+                result = EXIT_FAILURE;
+            } catch(std::runtime_error &e) {
+                // Typically the device memory is exhausted for the largest
+                // numbers of elements, so the rest of results are kept
+                std::ostringstream msg;
+                msg << "Benchmark failed for N = " << n << std::endl;
+                LOG(L_ERROR, msg.str());
+                result = EXIT_FAILURE;
+            }
+        }
+        f.close();
+    } catch(...) {
+        result = EXIT_FAILURE;
+    }
+
+    delete logger;
+#ifdef HAVE_MPI
+    MPI::Finalize();
+#endif
+    return result;
+}
@@ -129,5 +129,8 @@
 /* VTK */
 #cmakedefine HAVE_VTK
 
+/* HDF5 */
+#cmakedefine HAVE_HDF5
+
 
 #endif
@@ -162,3 +162,6 @@
 
 /* VTK */
 #cmakedefine HAVE_VTK
+
+/* HDF5 */
+#cmakedefine HAVE_HDF5
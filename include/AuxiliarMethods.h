@@ -130,6 +130,17 @@ std::string trimCopy(std::string s);
  */
 std::string xxd2string(unsigned char* arr, unsigned int len);
 
+/** @brief 64 bits FNV-1a hash of a string.
+ *
+ * Differently to std::hash, the result does not depend on the standard
+ * library implementation, so it can be used to name files which are reused
+ * in later executions, like the programs cache.
+ *
+ * @param str String to hash
+ * @return Hash, as a hexadecimal string of 16 digits
+ */
+std::string hashString(const std::string &str);
+
 /** @brief Convert a string to lower case
  */
 void toLower(std::string &str);
@@ -236,6 +247,21 @@ unsigned int roundUp(unsigned int x, unsigned int divisor);
  */
 int round(float n);
 
+/** @brief Convert a float value to half precision.
+ *
+ * The value is rounded to the nearest representable one, in the same way
+ * than vstore_half() is doing in the computational device.
+ * @param f Value to convert.
+ * @return Half precision value.
+ */
+cl_half floatToHalf(float f);
+
+/** @brief Convert a half precision value to float.
+ * @param h Half precision value.
+ * @return Float value.
+ */
+float halfToFloat(cl_half h);
+
 /// Gets the folder path which contains the file @paramname{file_path}.
 /**
  * @param file_path The file path.
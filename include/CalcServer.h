@@ -26,6 +26,7 @@
 
 #include <vector>
 #include <map>
+#include <mutex>
 #include <string>
 #include <iterator>
 
@@ -61,6 +62,7 @@ namespace Aqua{
 namespace CalcServer{
 
 class UnSort;
+class UnSortBatch;
 
 /** @class CalcServer CalcServer.h CalcServer.h
  * @brief Exception raised when the user manually interrupts the simulation.
@@ -76,6 +78,19 @@ public:
     user_interruption(const std::string msg) : std::runtime_error(msg) {};
 };
 
+/** @class termination_request CalcServer.h CalcServer.h
+ * @brief Exception raised when the simulation is terminated by SIGTERM, and a
+ * checkpoint shall be written before exiting.
+ *
+ * @see Aqua::InputOutput::ProblemSetup::sphSettings::checkpoint_on_term
+ */
+class termination_request : public user_interruption
+{
+public:
+    /// Constructor
+    termination_request(const std::string msg) : user_interruption(msg) {};
+};
+
 /** @class CalcServer CalcServer.h CalcServer.h
  * @brief Entity that perform the main work of the simulation.
  *
@@ -102,7 +117,8 @@ public:
     /** @brief Internal time loop.
      * 
      * Calculation server will be iterating while no output files should be
-     * updated (or even the simulation is finished).
+     * updated (or even the simulation is finished, or a checkpoint should be
+     * written).
      * @param t_manager Time manager to let the calculation server when shall
      * stop the internal loop.
      */
@@ -156,6 +172,11 @@ public:
      * a subsequent one. Therefore, parallel tasks shall use a different queue
      * to ensure the correct order within each queue
      *
+     * When a pool of in-order command queues is requested (see
+     * Aqua::InputOutput::ProblemSetup::sphSettings::n_queues), the main
+     * command queue is replaced by the one selected by
+     * select_command_queue() for the tool currently executed.
+     *
      * @param parallel true if the command queue for task executed in parallel
      * is queried, false otherwise
      * @return The command queue
@@ -163,9 +184,61 @@ public:
     cl_command_queue command_queue(bool parallel=false) const {
         if(parallel)
             return _command_queue_parallel;
-        return _command_queue;
+        return _command_queue_current;
     }
 
+    /** @brief Select the command queue where the next tool shall be enqueued
+     *
+     * If just a single command queue has been requested, this method is doing
+     * nothing. Otherwise, the queue is selected from the pool of in-order
+     * command queues as follows:
+     *   - If some of the events that shall be waited are still pending, the
+     *     queue where most of them were enqueued is selected, so the implicit
+     *     order of the queue is exploited.
+     *   - Otherwise, the tool is independent of the already enqueued work, and
+     *     the next queue in the pool is selected (round robin).
+     *
+     * The previously selected queue is flushed when the selection changes, so
+     * the cross-queue dependencies cannot be stalled.
+     *
+     * @param events Events that the tool shall wait for
+     * @return The selected command queue
+     * @see command_queue()
+     */
+    cl_command_queue select_command_queue(const std::vector<cl_event> events);
+
+    /** Unsort a variable in the device.
+     * @param var_name Variable to unsort.
+     * @return The unsorting tool, where the unsorted data can be found
+     * (UnSort::output()), NULL if errors are detected.
+     * @note The unsorted data shall be accessed after the event of the input
+     * variable (UnSort::input()).
+     */
+    UnSort* getUnsorter(const std::string var_name);
+
+    /** Unsort several variables in the device.
+     *
+     * All the variables which are not already unsorted are unsorted with a
+     * single kernel launch. The unsorted data is reused while neither the
+     * variables nor the permutations are changed, so the savers and reports
+     * asking for the same variables in the same time step are not repeating
+     * the work (see UnSort::upToDate()).
+     *
+     * The unsorting can be restricted to a range of particles, such that just
+     * the data of those particles is moved (see UnSortBatch::range()).
+     * @param var_names Variables to unsort.
+     * @param first First particle to unsort (unsorted index).
+     * @param n Number of particles to unsort, 0 to unsort up to the last one.
+     * @return The unsorting tools of each variable, an empty list if errors
+     * are detected.
+     * @note The unsorted data shall be accessed after the event of the input
+     * variable (UnSort::input()).
+     * @warning Out of the range the unsorted data is undefined.
+     */
+    std::vector<UnSort*> getUnsorters(const std::vector<std::string> var_names,
+                                      unsigned int first=0,
+                                      unsigned int n=0);
+
     /** Download a unsorted variable from the device.
      * @param var_name Variable to unsort and download.
      * @param offset The offset in bytes in the memory object to read from.
@@ -182,10 +255,128 @@ public:
                             size_t cb,
                             void *ptr);
 
+    /** @brief Get a pinned host buffer, to download data from the device.
+     *
+     * The buffer is taken from the pool of the previously released ones, if
+     * there is any large enough. Otherwise a new buffer is allocated with
+     * CL_MEM_ALLOC_HOST_PTR and mapped, such that the transfers are not
+     * staged through pageable memory. If the pinned memory cannot be
+     * allocated, pageable memory is returned instead.
+     * @param size Size of the buffer in bytes.
+     * @return Host memory, NULL if the memory cannot be allocated.
+     * @note This method shall be called from the main thread.
+     * @see releasePinned()
+     */
+    void* allocatePinned(size_t size);
+
+    /** @brief Release a host buffer returned by allocatePinned().
+     *
+     * The buffer is kept in the pool to be reused later. This method can be
+     * called from any thread, e.g. the files writing ones.
+     * @param ptr Host memory returned by allocatePinned().
+     */
+    void releasePinned(void *ptr);
+
+    /** @brief Get the range of particles of a set, in the unsorted space.
+     *
+     * The particles sets are stored one after the other, so in the unsorted
+     * space each set is a contiguous range, while the sorting is mixing them.
+     * @param iset Particles set index.
+     * @return The first particle of the set, and the first particle of the
+     * next set.
+     * @see Aqua::InputOutput::Particles::bounds()
+     */
+    uivec2 setBounds(unsigned int iset) const;
+
+    /** Get the unsorters created by getUnsortedMem().
+     * @return List of unsorting tools, one per downloaded variable.
+     */
+    std::vector<Tool*> unsorterTools() const;
+
+    /** @brief Time spent in the MPI barriers between time steps.
+     * @return Accumulated waiting time since the simulation start, in seconds.
+     * It is always 0 if MPI is not available.
+     * @see Aqua::InputOutput::ProblemSetup::sphSettings::barrier_steps
+     */
+    double barrierTime() const{return _barrier_time;}
+
     /** @brief Get the AQUAgpusph root path.
      * @return AQUAgpusph root path
      */
     const std::string base_path() const{return _base_path.c_str();}
+
+    /** @brief Get the folder where the compiled OpenCL programs are cached.
+     * @return Cache folder, empty if the cache is disabled
+     * @see Aqua::InputOutput::ProblemSetup::sphSettings::cache_path
+     */
+    const std::string cache_path() const{return _cache_path;}
+
+    /** @brief Get whether the work group sizes of the kernels shall be
+     * autotuned.
+     * @return true if the autotuning is enabled, false otherwise
+     * @see Aqua::InputOutput::ProblemSetup::sphSettings::autotune
+     */
+    bool autotune() const{return _sim_data.settings.autotune;}
+
+    /** @brief Get the file where the autotuned work group sizes are recorded.
+     * @return Autotuning records file, empty if they shall not be recorded
+     * @see Aqua::InputOutput::ProblemSetup::sphSettings::autotune_file
+     */
+    const std::string autotune_file() const{return _autotune_file;}
+
+    /** @brief Get whether the zero-copy mode is active.
+     * @return true if the arrays are allocated in host accessible memory,
+     * false otherwise
+     * @see Aqua::InputOutput::ProblemSetup::sphSettings::zero_copy
+     */
+    bool zeroCopy() const{return _zero_copy;}
+
+    /** @brief Get the flags to allocate the arrays.
+     * @return CL_MEM_READ_WRITE, plus CL_MEM_ALLOC_HOST_PTR if the zero-copy
+     * mode is active.
+     * @see zeroCopy()
+     */
+    cl_mem_flags memFlags() const{
+        if(_zero_copy)
+            return CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR;
+        return CL_MEM_READ_WRITE;
+    }
+
+    /** @brief Download data from a memory object.
+     *
+     * This method has the same arguments than clEnqueueReadBuffer(). If the
+     * zero-copy mode is active the memory object is mapped instead, copying
+     * the data to @p ptr as soon as the map is completed, and unmapping it
+     * afterwards. The returned event is the unmapping one.
+     * @see zeroCopy()
+     */
+    cl_int readBuffer(cl_command_queue queue,
+                      cl_mem mem,
+                      cl_bool blocking,
+                      size_t offset,
+                      size_t cb,
+                      void *ptr,
+                      cl_uint num_events_in_wait_list,
+                      const cl_event *event_wait_list,
+                      cl_event *event);
+
+    /** @brief Upload data to a memory object.
+     *
+     * This method has the same arguments than clEnqueueWriteBuffer(). If the
+     * zero-copy mode is active the memory object is mapped instead, copying
+     * the data from @p ptr as soon as the map is completed, and unmapping it
+     * afterwards. The returned event is the unmapping one.
+     * @see zeroCopy()
+     */
+    cl_int writeBuffer(cl_command_queue queue,
+                       cl_mem mem,
+                       cl_bool blocking,
+                       size_t offset,
+                       size_t cb,
+                       const void *ptr,
+                       cl_uint num_events_in_wait_list,
+                       const cl_event *event_wait_list,
+                       cl_event *event);
 private:
     /** Setup the OpenCL stuff.
      */
@@ -199,6 +390,79 @@ private:
     /** Get the available devices in the selected platform.
      */
     void setupDevices();
+    /** @brief Share the device memory of the scratch arrays.
+     *
+     * The live range of each scratch array (see
+     * Aqua::InputOutput::ProblemSetup::sphVariables) is computed from the
+     * first and last tools of the pipeline depending on it, extended to the
+     * whole scope (see Aqua::CalcServer::Tool::scope_modifier()) when it is
+     * crossing the scope boundaries. Then the arrays with non overlapping
+     * live ranges are aliased by Aqua::InputOutput::Variables::alias().
+     *
+     * Just the arrays exclusively used by kernels can be aliased, since they
+     * are resetting their arguments when the memory object is replaced.
+     * @warning The Python tools are not declaring their dependencies, so
+     * they shall not access the scratch arrays.
+     */
+    void aliasScratchArrays();
+
+    /** @brief Static analysis of the pipeline, skipping the dead tools.
+     *
+     * The kernels and the "set"/"copy" tools are skipped if none of the
+     * arrays they are writing (see Aqua::CalcServer::Kernel::outputs()) is
+     * read by the rest of tools, nor loaded or saved by the particles sets.
+     * Since skipping a tool may kill the arrays it was reading, the analysis
+     * is iterated until no more tools are skipped.
+     *
+     * Also the "set"/"copy" tools whose output is overwritten by the next
+     * tool using it, and the "copy" tools undoing the previous one, are
+     * reported.
+     * @see Aqua::InputOutput::ProblemSetup::sphSettings::pipeline_analysis
+     */
+    void analyzePipeline();
+
+    /** @brief Tabulate the kernel function and its gradient factor.
+     *
+     * If the KERNEL_TABULATED definition is registered, its value is taken
+     * as the number of samples (1024 if no value is provided). Then the
+     * kernel function and the gradient factor selected by KERNEL_NAME are
+     * sampled in the device, and stored in the KERNEL_TABLE_W and
+     * KERNEL_TABLE_F definitions, as initializer lists. Hence the kernels
+     * can switch to the tables (see
+     * resources/Scripts/KernelFunctions/Kernel.h), which are linearly
+     * interpolated.
+     *
+     * It shall be called before building the tools.
+     */
+    void tabulateKernel();
+
+    /** @brief Transfer data mapping a memory object.
+     * @param queue Command queue
+     * @param mem Memory object
+     * @param write true if @p ptr shall be copied to the memory object, false
+     * if the memory object shall be copied to @p ptr
+     * @param blocking Blocking transfer
+     * @param offset Offset in bytes in the memory object
+     * @param cb Size in bytes of the data to transfer
+     * @param ptr Host memory
+     * @param num_events_in_wait_list Number of events to wait for
+     * @param event_wait_list Events to wait for
+     * @param event Unmapping event
+     * @return CL_SUCCESS if the transfer is correctly enqueued, an error code
+     * otherwise
+     * @see readBuffer()
+     * @see writeBuffer()
+     */
+    cl_int mapTransfer(cl_command_queue queue,
+                       cl_mem mem,
+                       bool write,
+                       cl_bool blocking,
+                       size_t offset,
+                       size_t cb,
+                       void *ptr,
+                       cl_uint num_events_in_wait_list,
+                       const cl_event *event_wait_list,
+                       cl_event *event);
 
     /// Number of available OpenCL platforms
     cl_uint _num_platforms;
@@ -220,6 +484,16 @@ private:
      * callbacks).
      */
     cl_command_queue _command_queue_parallel;
+    /** Pool of in-order command queues where the tools are dispatched. It is
+     * empty if just a single command queue has been requested
+     */
+    std::vector<cl_command_queue> _command_queues;
+    /// Last command queue selected from #_command_queues
+    unsigned int _command_queue_id;
+    /// Currently selected command queue
+    cl_command_queue _command_queue_current;
+    /// true if the zero-copy mode is active
+    bool _zero_copy;
 
     /// User registered variables
     InputOutput::Variables _vars;
@@ -236,6 +510,12 @@ private:
      */
     std::string _base_path;
 
+    /// Folder where the compiled OpenCL programs are cached
+    std::string _cache_path;
+
+    /// File where the autotuned work group sizes are recorded
+    std::string _autotune_file;
+
     /** @brief Currently executed tool/report.
      * 
      * Useful to can report runtime OpenCL implementation errors (see
@@ -250,6 +530,25 @@ private:
      * dramatically reduce the saving files overhead in some platforms
      */
     std::map<std::string, UnSort*> unsorters;
+
+    /// Batched unsorters, mapped by the list of variables names
+    std::map<std::string, UnSortBatch*> unsort_batches;
+
+    /// Permutations event after the last batched unsorting
+    cl_event _unsort_event;
+
+    /// Permutations version, increased each time they are changed
+    unsigned int _unsort_version;
+
+    /// Accumulated time waiting in the MPI barriers, in seconds
+    double _barrier_time;
+
+    /// Pinned buffers, and their sizes, mapped on each host pointer
+    std::map<void*, std::pair<cl_mem, size_t>> _pinned_mems;
+    /// Pinned buffers released to be reused
+    std::vector<void*> _pinned_released;
+    /// Pinned buffers pool mutex
+    std::mutex _pinned_mutex;
 private:
     /// Simulation data read from XML files
     Aqua::InputOutput::ProblemSetup _sim_data;
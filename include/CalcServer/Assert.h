@@ -24,6 +24,8 @@
 #ifndef ASSERT_H_INCLUDED
 #define ASSERT_H_INCLUDED
 
+#include <deque>
+#include <mutex>
 #include <CalcServer/Tool.h>
 
 namespace Aqua{ namespace CalcServer{
@@ -35,6 +37,20 @@ namespace Aqua{ namespace CalcServer{
  * result will be considered false, and therefore a fatal error will be raised.
  * Any other value will be considered as true, letting the simulation to
  * normally continue.
+ *
+ * Evaluating the condition requires the values of the involved variables, so
+ * the host shall wait for the reductions computing them. To avoid that sync,
+ * the condition can be checked just every some time steps, and/or in a
+ * deferred way:
+ * @code{.xml}
+    <Tool action="add" name="check" type="assert" condition="nbuffer > 0"
+          period="10" deferred="true"/>
+ * @endcode
+ * In the deferred mode the condition is evaluated by an OpenCL callback,
+ * as soon as the involved variables are available, while the following
+ * tools writing them are waiting for the evaluation. The failure is then
+ * reported the next time the tool is executed, with the time step when the
+ * condition was false.
  */
 class Assert : public Aqua::CalcServer::Tool
 {
@@ -45,10 +61,14 @@ public:
      * considered, and fatal error will be raised, otherwise the simulation will
      * continue.
      * @param once Run this tool just once. Useful to make initializations.
+     * @param period Number of time steps between checks.
+     * @param deferred Check the condition asynchronously.
      */
     Assert(const std::string name,
            const std::string condition,
-           bool once=false);
+           bool once=false,
+           unsigned int period=1,
+           bool deferred=false);
 
     /// Destructor.
     ~Assert();
@@ -65,8 +85,50 @@ protected:
     cl_event _execute(const std::vector<cl_event> events);
 
 private:
+    /** @brief Enqueue the deferred evaluation of the condition
+     * @param events Events to be waited before evaluating
+     * @return Event to be waited by the tools writing the involved variables
+     */
+    cl_event defer(const std::vector<cl_event> events);
+
+    /** @brief Evaluate the condition, recording the failures
+     * @param step Time step
+     * @note This function is thread safe
+     */
+    void evaluate(unsigned int step);
+
+    /** @brief Throw a fatal error if the condition was false in any past
+     * deferred evaluation
+     */
+    void check();
+
+    /** @brief Callback evaluating the condition
+     * @param event The event
+     * @param event_command_status The event status
+     * @param user_data The deferred evaluation data
+     */
+    static void CL_CALLBACK cbEvaluate(cl_event event,
+                                       cl_int event_command_status,
+                                       void *user_data);
+
     /// Condition expression to evaluate
     std::string _condition;
+    /// Compiled condition expression
+    Expression *_expr;
+
+    /// Number of time steps between checks
+    unsigned int _period;
+    /// Check the condition asynchronously
+    bool _deferred;
+    /// Time step variable
+    InputOutput::Variable *_iter;
+
+    /// Mutex to protect the expression and the failures
+    std::mutex _mutex;
+    /// Time steps where the deferred evaluation failed
+    std::deque<unsigned int> _failures;
+    /// Deferred evaluations not completed yet
+    std::deque<cl_event> _pending;
 };
 
 }}  // namespace
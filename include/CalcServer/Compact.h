@@ -0,0 +1,161 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file
+ * @brief Stream compaction of the particles indexes.
+ * (See Aqua::CalcServer::Compact for details)
+ * @note Hardcoded versions of the files CalcServer/Compact.cl.in and
+ * CalcServer/Compact.hcl.in are internally included as a text array.
+ */
+
+#ifndef COMPACT_H_INCLUDED
+#define COMPACT_H_INCLUDED
+
+#include <CalcServer.h>
+#include <CalcServer/Tool.h>
+
+namespace Aqua{ namespace CalcServer{
+
+/** @class Compact Compact.h CalcServer/Compact.h
+ * @brief Stream compaction of the particles indexes.
+ *
+ * The indexes of the elements of an array fulfilling a condition are stored,
+ * keeping their order, in an output array, while the number of selected
+ * elements is stored in a scalar variable. For instance, the fluid particles
+ * can be listed after the sorting stage:
+ * @code{.xml}
+    <Variable name="N_fluid" type="unsigned int" value="0" />
+    <Variable name="ids_fluid" type="unsigned int*" length="N" />
+
+    <Tool action="insert" after="Sort" type="compact" name="fluid list"
+          in="imove" out="ids_fluid" n="N_fluid" condition="c == 1"/>
+ * @endcode
+ * where the condition is an OpenCL expression, and the element is called c.
+ *
+ * Then the kernels can be launched just over the selected particles, with
+ * `n="N_fluid"`, getting the particle index with the LIST_ID() macro:
+ * @code{.c}
+    __kernel void entry(const __global uint *ids_fluid, ..., uint N_fluid)
+    {
+        const uint i = LIST_ID(ids_fluid, N_fluid);
+        if(i == LIST_END)
+            return;
+        ...
+    }
+ * @endcode
+ *
+ * The number of selected elements is downloaded without blocking, so the host
+ * is just waiting for it when it is actually required, e.g. to compute the
+ * number of threads of the kernels launched over the list.
+ */
+class Compact : public Aqua::CalcServer::Tool
+{
+public:
+    /** Constructor.
+     * @param name Tool name.
+     * @param input_name Input array to be checked.
+     * @param output_name Output array, where the indexes are stored.
+     * @param n_name Output scalar, where the number of selected elements is
+     * stored.
+     * @param condition OpenCL condition to select the elements.
+     * @param once Run this tool just once. Useful to make initializations.
+     */
+    Compact(const std::string name,
+            const std::string input_name,
+            const std::string output_name,
+            const std::string n_name,
+            const std::string condition,
+            bool once=false);
+
+    /** Destructor.
+     */
+    ~Compact();
+
+    /** Initialize the tool.
+     */
+    void setup();
+
+protected:
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accessing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /** Get the input and output variables
+     */
+    void variables();
+
+    /** Setup the OpenCL stuff
+     */
+    void setupOpenCL();
+
+    /** Allocate the work groups counts and offsets
+     */
+    void setupMem();
+
+    /** Set the arguments of the kernels
+     */
+    void setVariables();
+
+    /// Input variable name
+    std::string _input_name;
+    /// Output variable name
+    std::string _output_name;
+    /// Number of selected elements variable name
+    std::string _n_name;
+    /// Selection condition
+    std::string _condition;
+
+    /// Input variable
+    InputOutput::ArrayVariable *_input_var;
+    /// Output variable
+    InputOutput::ArrayVariable *_output_var;
+    /// Number of selected elements variable
+    InputOutput::Variable *_n_var;
+    /// Host memory of the number of selected elements variable
+    void *_n_ptr;
+
+    /// Number of elements of the input array
+    unsigned int _n;
+
+    /// Number of selected elements of each work group
+    cl_mem _counts;
+    /// Offsets of each work group, followed by the number of selected elements
+    cl_mem _offsets;
+
+    /// Counting kernel
+    cl_kernel _count;
+    /// Offsets scanning kernel
+    cl_kernel _scan;
+    /// Compaction kernel
+    cl_kernel _compact;
+
+    /// Local work size
+    size_t _local_work_size;
+    /// Global work size
+    size_t _global_work_size;
+    /// Number of work groups
+    unsigned int _n_groups;
+};
+
+}}  // namespace
+
+#endif // COMPACT_H_INCLUDED
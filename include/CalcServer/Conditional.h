@@ -80,6 +80,8 @@ protected:
 private:
     /// Condition expression to evaluate
     std::string _condition;
+    /// Compiled condition expression
+    Expression *_expr;
     /// The next tool in the pipeline when the condition is not fulfilled
     Tool* _ending_tool;
 
@@ -91,6 +93,20 @@ protected:
 /** @class While Conditional.h CalcServer/Conditional.h
  * @brief Execute all the tools in its scope until the condition becomes
  * unfulfilled
+ *
+ * Evaluating the condition requires the host to wait for the variables it
+ * depends on, e.g. the residual computed by a reduction, stalling the
+ * pipeline at each iteration. To avoid that, the loop can be executed in
+ * batches of iterations, such that the condition is evaluated just once per
+ * batch:
+ * @code{.xml}
+    <Tool action="add" name="Fixed point" type="while" batch="4"
+          condition="(residual > 1e-4) and (iters < 100)"/>
+ * @endcode
+ * Hence the tools of the scope are enqueued several times without waiting
+ * for the device. The loop may run up to batch - 1 extra iterations, so it is
+ * meant for loops where iterating beyond the convergence is harmless, like
+ * fixed point solvers.
  * @see Aqua::CalcServer::Conditional
  */
 class While : public Aqua::CalcServer::Conditional
@@ -102,10 +118,13 @@ public:
      * considered and all the subsequent tools will be disabled until an End
      * tool is reached.
      * @param once Run this tool just once. Useful to make initializations.
+     * @param batch Number of iterations executed for each condition
+     * evaluation.
      */
     While(const std::string name,
        const std::string condition,
-       bool once=false);
+       bool once=false,
+       unsigned int batch=1);
 
     /// Destructor.
     ~While();
@@ -113,6 +132,19 @@ public:
     /** @brief Initialize the tool.
      */
     void setup();
+
+protected:
+    /** Check the condition, just at the start of each batch of iterations
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accessing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /// Number of iterations executed for each condition evaluation
+    unsigned int _batch;
+    /// Iterations executed since the loop started
+    unsigned int _iter;
 };
 
 /** @class If Conditional.h CalcServer/Conditional.h
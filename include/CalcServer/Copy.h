@@ -53,6 +53,16 @@ public:
      */
     void setup();
 
+    /** Get the variable to copy
+     * @return Input variable
+     */
+    InputOutput::ArrayVariable* input() const {return _input_var;}
+
+    /** Get the variable to set
+     * @return Output variable
+     */
+    InputOutput::ArrayVariable* output() const {return _output_var;}
+
 protected:
     /** Execute the tool
      * @param events List of events that shall be waited before safe execution
@@ -0,0 +1,146 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Several OpenCL kernels fused in a single launch.
+ * (see Aqua::CalcServer::FusedKernel for details)
+ */
+
+#ifndef FUSEDKERNEL_H_INCLUDED
+#define FUSEDKERNEL_H_INCLUDED
+
+#include <CalcServer/Kernel.h>
+
+namespace Aqua{ namespace CalcServer{
+
+/** @class FusedKernel FusedKernel.h CalcServer/FusedKernel.h
+ * @brief A tool consisting in several consecutive OpenCL kernels, executed in
+ * a single launch.
+ *
+ * The kernel tools sharing the same `fuse` attribute, which are consecutive
+ * in the pipeline, are merged in this tool, named as the `fuse` attribute.
+ * For instance:
+ * @code{.xml}
+    <Tool action="add" name="EOS" type="kernel" fuse="Fused EOS"
+          path="resources/Scripts/basic/EOS.cl"/>
+    <Tool action="add" name="Clamp" type="kernel" fuse="Fused EOS"
+          path="resources/Scripts/basic/DensityClamp.cl"/>
+ * @endcode
+ *
+ * A single OpenCL program is generated, where the entry point of each kernel
+ * is renamed, and called in order by a new entry point, which is receiving
+ * the union of the arguments of all the kernels. The shared headers are
+ * included just once, provided they have include guards. The arrays are
+ * received as restrict pointers, keeping the const qualifier if no fused
+ * kernel is writing them.
+ *
+ * Hence the launch overhead is paid just once, and the compiler may reuse
+ * the values loaded or stored by a kernel in the following ones. However,
+ * each kernel still stores its results in the global memory, since they may
+ * be read by the tools afterwards.
+ *
+ * @warning Since the kernels are executed one after the other by the same
+ * thread, just kernels where each thread reads the data written by itself
+ * (i.e. per particle kernels without neighbours loop) can be safely fused.
+ * Moreover, the same variable should be declared in the same address space
+ * by all the fused kernels, and the helper functions defined by the kernels
+ * sources, out of the guarded headers, shall have different names.
+ */
+class FusedKernel : public Aqua::CalcServer::Kernel
+{
+public:
+    /** Constructor.
+     * @param tool_name Tool name.
+     * @param kernel_path First fused kernel path.
+     * @param entry_point First fused kernel entry point.
+     * @param n Number of threads to launch.
+     * @param once Run this tool just once. Useful to make initializations.
+     */
+    FusedKernel(const std::string tool_name,
+                const std::string kernel_path,
+                const std::string entry_point="entry",
+                const std::string n="N",
+                bool once=false);
+
+    /** Destructor
+     */
+    ~FusedKernel();
+
+    /** @brief Append a kernel to the fused ones.
+     * @param kernel_path Kernel path.
+     * @param entry_point Entry point.
+     * @param n Number of threads to launch, which shall match the one of the
+     * first fused kernel.
+     * @param once Run this tool just once, which shall match the one of the
+     * first fused kernel.
+     */
+    void add(const std::string kernel_path,
+             const std::string entry_point="entry",
+             const std::string n="N",
+             bool once=false);
+
+protected:
+    /** @brief Get the arguments names of the generated entry point.
+     * @param entry_point Program entry point method.
+     * @return Union of the arguments of the fused kernels.
+     */
+    std::vector<std::string> arguments(const std::string entry_point="main");
+
+    /** @brief Get the generated OpenCL source code.
+     * @return The fused kernels source code.
+     */
+    std::string readSource();
+
+    /** @brief Get the folders to be added to the OpenCL include paths.
+     * @return The folders of all the fused kernels files.
+     */
+    std::vector<std::string> includeFolders();
+
+private:
+    /** @brief Parse the entry points of the fused kernels.
+     *
+     * The arguments declarations of each entry point are extracted, and its
+     * union is built.
+     */
+    void parse();
+
+    /// Fused kernels paths
+    std::vector<std::string> _paths;
+
+    /// Fused kernels entry points
+    std::vector<std::string> _entry_points;
+
+    /// Number of threads expression of the first fused kernel
+    std::string _fused_n;
+
+    /// Run once flag of the first fused kernel
+    bool _fused_once;
+
+    /// Arguments names of each fused kernel
+    std::vector<std::vector<std::string>> _args;
+
+    /// Union of the arguments names
+    std::vector<std::string> _arg_names;
+
+    /// Union of the arguments declarations
+    std::vector<std::string> _arg_decls;
+};
+
+}}  // namespace
+
+#endif // FUSEDKERNEL_H_INCLUDED
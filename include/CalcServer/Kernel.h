@@ -39,6 +39,17 @@ namespace Aqua{ namespace CalcServer{
 /** @class Kernel Kernel.h CalcServer/Kernel.h
  * @brief A tool consisting in an OpenCL kernel execution. The variables used
  * in the OpenCL kernel are automatically detected.
+ *
+ * The scalar arguments which are constant along the simulation can be
+ * specialized at compile time, listing them in the `constants` attribute:
+ * @code{.xml}
+    <Tool action="add" name="interactions" type="kernel"
+          path="interactions.cl" constants="N, n_cells, h"/>
+ * @endcode
+ * Such arguments are renamed in the entry point signature, and declared as
+ * constants, with their current values, at the start of the entry point body,
+ * so the compiler can fold them. If any of those variables is modified later,
+ * the kernel is compiled again (hopefully hitting the programs cache).
  */
 class Kernel : public Aqua::CalcServer::Tool
 {
@@ -64,6 +75,42 @@ public:
      */
     void setup();
 
+    /** @brief Compile the kernel and collect its arguments.
+     *
+     * This is the most time consuming part of setup(), which is not depending
+     * on the rest of tools. Hence it can be called in parallel for several
+     * kernels before calling setup(), which is not building the kernel again.
+     *
+     * @note This method is thread safe, as far as the variables are not
+     * registered/modified while it is running.
+     */
+    void build();
+
+    /** @brief Set the scalar arguments to be specialized at compile time.
+     *
+     * The names are appended to the already set ones. This method shall be
+     * called before build().
+     * @param names Variables names, separated by commas or spaces.
+     */
+    void setConstants(const std::string names);
+
+    /** @brief Launch the kernel just over the particles of a set.
+     *
+     * The threads are launched over the range of the set in the unsorted
+     * space (see CalcServer::setBounds()), with a global work offset, so
+     * get_global_id(0) is the unsorted index of the particle. The kernel can
+     * get the sorted index with the SET_ID() macro. The number of threads
+     * expression is ignored.
+     *
+     * This method shall be called before setup().
+     * @param iset Particles set index expression, e.g. "motion_iset". An
+     * empty string to launch the kernel over all the particles.
+     * @note Since the global work size is rounded up, some threads past the
+     * last particle of the set, but below N, are still launched. Hence the
+     * kernels shall keep checking the set of the particle.
+     */
+    void setParticlesSet(const std::string iset) {_set = iset;}
+
     /** Get the kernel file path.
      * @return Tool kernel file path.
      */
@@ -79,6 +126,45 @@ public:
      */
     size_t globalWorkSize() const {return _global_work_size;}
 
+    /** @brief Estimated global memory read by each launch.
+     *
+     * Each array read by the kernel is considered to be accessed just once
+     * per thread, so the result is the compulsory memory traffic, i.e. a lower
+     * bound. The arrays read and written are detected in the source code of
+     * the kernel.
+     * @return Bytes read
+     */
+    size_t bytesRead() const {return traffic(_var_read);}
+
+    /** @brief Estimated global memory written by each launch.
+     * @return Bytes written
+     * @see bytesRead()
+     */
+    size_t bytesWritten() const {return traffic(_var_written);}
+
+    /** @brief Floating point operations carried out by each launch.
+     *
+     * The number of operations per thread shall be declared in the kernel
+     * source code, with a `@flops` tag in a comment, e.g.
+     * @code{.c}
+        /// @flops 42
+        __kernel void entry(...)
+     * @endcode
+     * @return Floating point operations, 0 if they are not declared
+     */
+    double flops() const {return _flops * _n_threads;}
+
+    /** @brief Arrays which may be written by the kernel.
+     *
+     * The arrays whose data is const qualified in the entry point signature,
+     * e.g. `const __global float* p` or `__constant float* p`, are never
+     * written, so they are excluded. The rest of them are conservatively
+     * considered to be written, even if they are just read.
+     * @return Array variables
+     * @note The kernel shall be already built
+     */
+    std::vector<InputOutput::Variable*> outputs() const;
+
 protected:
     /** Execute the tool
      * @param events List of events that shall be waited before safe execution
@@ -103,16 +189,117 @@ protected:
      */
     void variables(const std::string entry_point="main");
 
+    /** @brief Get the arguments names of the program entry point.
+     *
+     * The source code is parsed with libclang. Since that is a rather
+     * expensive operation, the results are memoized by the hash of the
+     * source code and the entry point. If the programs cache is enabled (see
+     * Aqua::InputOutput::ProblemSetup::sphSettings::cache_path), they are
+     * stored in the disk as well.
+     *
+     * @param entry_point Program entry point method.
+     * @return Arguments names.
+     * @note This method is thread safe.
+     */
+    virtual std::vector<std::string> arguments(
+        const std::string entry_point="main");
+
+    /** @brief Get the arguments names of an OpenCL program entry point.
+     *
+     * This is the actual implementation of arguments(), which can be applied
+     * to any OpenCL source code file.
+     *
+     * @param path OpenCL source code file path.
+     * @param entry_point Program entry point method.
+     * @return Arguments names.
+     * @note This method is thread safe.
+     */
+    static std::vector<std::string> parseArguments(
+        const std::string path,
+        const std::string entry_point="main");
+
+    /** @brief Get the OpenCL source code to be compiled.
+     * @return The content of the kernel file, path().
+     */
+    virtual std::string readSource();
+
+    /** @brief Get the folders to be added to the OpenCL include paths.
+     * @return The folder of the kernel file, path().
+     */
+    virtual std::vector<std::string> includeFolders();
+
     /** @brief Set the variables to the OpenCL kernel.
      * 
-     * The method detects if a variable should be updated or if it already set either.
+     * The method detects if a variable should be updated or if it already set
+     * either, comparing the variables versions (see
+     * Aqua::InputOutput::Variable::version()).
      */
     void setVariables();
 
-    /** Compute the global work size
+    /** @brief Compute the global work size
+     *
+     * The number of threads expression is evaluated just if the variables
+     * involved on it have changed since the last evaluation (see
+     * Aqua::InputOutput::Variable::version()), so the launch configuration is
+     * kept bound from one time step to the next one.
      */
     void computeGlobalWorkSize();
 
+    /** @brief Setup the work group size autotuning.
+     *
+     * If the work group size of this tool has been already recorded for the
+     * same device (see
+     * Aqua::InputOutput::ProblemSetup::sphSettings::autotune_file), it is
+     * just reused. Otherwise the candidates are collected, as the powers of 2
+     * between the preferred work group size multiple and the maximum work
+     * group size.
+     */
+    void setupAutotune();
+
+    /** @brief Sample the device time of the last autotuning execution.
+     *
+     * The profiling data is collected just if the execution is already
+     * finished, such that the host is not blocked. After enough samples are
+     * collected, the next candidate is selected. When all the candidates are
+     * tested, the fastest one is locked in and recorded.
+     */
+    void sampleAutotune();
+
+    /** @brief Detect the arrays read and written by the kernel, and the
+     * declared floating point operations.
+     *
+     * The arrays not found in the source code, e.g. the ones used just by
+     * macros, are considered to be read. The const qualified arguments are detected
+     * as well (see outputs()).
+     * @see bytesRead()
+     * @see flops()
+     */
+    void setupTraffic();
+
+    /** @brief Declare the specialized arguments as constants in the source
+     * code.
+     *
+     * The specialized arguments are renamed in the signature of the last
+     * @p entry_point found, and declared as constants in the same line of the
+     * body opening brace, so the lines numbering is preserved.
+     * @param source OpenCL source code.
+     * @param entry_point Program entry point method.
+     * @return The specialized source code.
+     */
+    std::string specialize(const std::string source,
+                           const std::string entry_point);
+
+    /** @brief Compile again the kernel if any specialized argument has
+     * changed its value.
+     */
+    void respecialize();
+
+    /** @brief Memory traffic of a subset of the array arguments
+     * @param mask Arguments to be considered
+     * @return Bytes accessed by a launch
+     */
+    size_t traffic(const std::vector<bool> &mask) const;
+
 private:
     /// Kernel path
     std::string _path;
@@ -126,16 +313,65 @@ private:
     /// OpenCL kernel
     cl_kernel _kernel;
 
+    /// true if the kernel has been already built, false otherwise
+    bool _built;
+
     /// work group size
     size_t _work_group_size;
 
     /// global work size
     size_t _global_work_size;
 
+    /// Particles set index expression, empty to launch over all the particles
+    std::string _set;
+
+    /// global work offset, i.e. the first particle of the set
+    size_t _global_work_offset;
+
+    /// Work group sizes to be tested by the autotuning
+    std::vector<size_t> _autotune_sizes;
+    /// Minimum device time measured for each autotuning candidate
+    std::vector<cl_ulong> _autotune_times;
+    /// Candidate currently tested
+    unsigned int _autotune_id;
+    /// Number of samples collected for the candidate currently tested
+    unsigned int _autotune_samples;
+    /// Event of the last execution to be sampled by the autotuning
+    cl_event _autotune_event;
+
     /// List of required variables
     std::vector<std::string> _var_names;
-    /// List of variable values
-    std::vector<void*> _var_values;
+    /// List of required variables
+    std::vector<InputOutput::Variable*> _vars;
+    /// Versions of the variables when they were set as kernel arguments
+    std::vector<unsigned long> _var_versions;
+
+    /// Variables involved in the number of threads expression
+    std::vector<InputOutput::Variable*> _n_vars;
+    /// Versions of the variables when the number of threads was evaluated
+    std::vector<unsigned long> _n_versions;
+    /// Last evaluated number of threads
+    unsigned int _n_threads;
+
+    /// Names of the arguments to be specialized
+    std::vector<std::string> _const_names;
+    /// Indexes of the specialized arguments
+    std::vector<unsigned int> _const_ids;
+    /// Types of the specialized arguments, as declared in the signature
+    std::vector<std::string> _const_types;
+    /// Values of the specialized arguments, as OpenCL literals
+    std::vector<std::string> _const_values;
+    /// Versions of the specialized variables when the kernel was compiled
+    std::vector<unsigned long> _const_versions;
+
+    /// Arguments read by the kernel
+    std::vector<bool> _var_read;
+    /// Arguments written by the kernel
+    std::vector<bool> _var_written;
+    /// Arguments whose data is const qualified in the signature
+    std::vector<bool> _var_const;
+    /// Floating point operations per thread
+    double _flops;
 };
 
 }}  // namespace
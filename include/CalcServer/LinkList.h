@@ -32,6 +32,14 @@
 #include <CalcServer/Reduction.h>
 #include <CalcServer/RadixSort.h>
 
+/** @def _HASHED_CELLS_FACTOR Number of buckets per particle of the hashed
+ * cells
+ * @see Aqua::CalcServer::LinkList
+ */
+#ifndef _HASHED_CELLS_FACTOR
+    #define _HASHED_CELLS_FACTOR 2
+#endif
+
 namespace Aqua{ namespace CalcServer{
 
 /** @class LinkList LinkList.h CalcServer/LinkList.h
@@ -42,6 +50,52 @@ namespace Aqua{ namespace CalcServer{
  *   -# "ihoc" array allocation
  *   -# "ihoc" and "icell" calculations
  *   -# Radix sort of "icell", computing permutation array "id_sorted" and "id_unsorted" as well.
+ *
+ * Since the particles are sorted at each time step, most of the particles
+ * are usually in the same order than in the previous one. In the incremental
+ * mode the tool is checking whether the cells are already sorted, in which
+ * case the radix sort is replaced by identity permutations:
+ * @code{.xml}
+    <Tool action="add" name="link-list" type="link-list" in="r_in"
+          incremental="true"/>
+ * @endcode
+ * Such check requires reading back a flag, so it is worth when the particles
+ * are moving slowly with respect to the cells size.
+ *
+ * Computing the bounds and the number of cells requires a couple of syncs
+ * each time step. Alternatively, a padded box can be built once, and just
+ * checked on the device afterwards:
+ * @code{.xml}
+    <Tool action="add" name="link-list" type="link-list" in="r_in"
+          margin="10 * h"/>
+ * @endcode
+ * The box is rebuilt when some particle goes further than half of the margin,
+ * which is asynchronously reported back to the host, so it is detected one
+ * or two time steps later. While the box is valid, "r_min" and "r_max" are
+ * the box corners, instead of the actual bounds.
+ *
+ * By default the cells are indexed in row-major order. If the MORTON_CELLS
+ * definition is set, the cells are indexed along a Morton (Z-order) curve,
+ * so the neighbour cells are closer in memory:
+ * @code{.xml}
+    <Definitions>
+        <Define name="MORTON_CELLS"/>
+    </Definitions>
+ * @endcode
+ * The BEGIN_LOOP_OVER_NEIGHS() macro is considering the definition as well,
+ * so the interactions kernels are not affected. In such case "n_cells.w" is
+ * the number of Morton indexes, which can be up to 4 times (8 times in 3D)
+ * the number of cells.
+ *
+ * Large and mostly empty domains can be instead handled with the HASHED_CELLS
+ * definition. Then the cells are stored in a hash table of a size
+ * proportional to the number of particles, i.e. the "ihoc" array is not
+ * growing with the domain volume. "n_cells.w" is the number of buckets in
+ * such case, and the far cells sharing a bucket are traversed by
+ * BEGIN_LOOP_OVER_NEIGHS() as well, being discarded by the distance.
+ * @warning The kernels computing the cells by themselves, like the mirroring
+ * boundary conditions, are not compatible with the Morton ordering or the
+ * hashed cells.
  * @note Hardcoded versions of the files CalcServer/LinkList.cl.in and
  * CalcServer/LinkList.hcl.in are internally included as a text array.
  */
@@ -52,10 +106,18 @@ public:
      * @param tool_name Tool name.
      * @param input Input array to be used as the particles positions.
      * @param once Run this tool just once. Useful to make initializations.
+     * @param incremental Skip the radix sort if the cells are already sorted.
+     * @param sort_bits Bits sorted in each radix sort pass.
+     * @param margin Margin expression of the padded box. If it is null, the
+     * bounds are recomputed each time step.
+     * @see RadixSort::RadixSort()
      */
     LinkList(const std::string tool_name,
              const std::string input="pos",
-             bool once=false);
+             bool once=false,
+             bool incremental=false,
+             unsigned int sort_bits=_STEPBITS,
+             const std::string margin="0");
 
     /** Destructor
      */
@@ -81,14 +143,41 @@ private:
      */
     void nCells();
 
+    /** Compute the number of buckets of the hashed cells
+     */
+    void hashedCells();
+
     /** Allocate the "ihoc" array
      */
     void allocate();
 
+    /** Build the padded box from the bounds, setting "r_min" and "r_max"
+     */
+    void box();
+
+    /** Check whether some particle has left the padded box.
+     *
+     * The flag is asynchronously read, so this method is never waiting.
+     * @return true if the flag has been already read, and some particle has
+     * left the box, false otherwise.
+     */
+    bool outOfBox();
+
     /** Update the input and output looking for changed values.
      */
     void setVariables();
 
+    /** Check whether the cells are already sorted.
+     * @param event Event to be waited before checking
+     * @return true if the cells are sorted, false otherwise
+     */
+    bool isSorted(cl_event event);
+
+    /** Set the identity permutations, instead of sorting
+     * @param event Event to be waited before starting
+     */
+    void identity(cl_event event);
+
     /// Input variable name
     std::string _input_name;
 
@@ -98,11 +187,8 @@ private:
     /// Number of cells
     uivec4 _n_cells;
 
-    /// Minimum position computation tool
-    Reduction *_min_pos;
-
-    /// Maximum position computation tool
-    Reduction *_max_pos;
+    /// Minimum and maximum positions computation tool
+    Reduction *_bounds;
 
     /// Sorting by cells computation tool
     RadixSort *_sort;
@@ -133,6 +219,43 @@ private:
     size_t _ll_gws;
     /// "ihoc" array computation sent arguments
     std::vector<void*> _ll_args;
+
+    /// Skip the sort if the cells are already sorted
+    bool _incremental;
+
+    /// true if the cells are Morton ordered
+    bool _morton;
+
+    /// true if the cells are stored in a hash table
+    bool _hashed;
+
+    /// Margin expression of the padded box
+    std::string _margin_expr;
+    /// Margin of the padded box, 0 if the bounds are computed each time step
+    float _margin;
+    /// true if the padded box has been already built
+    bool _box_built;
+    /// Warning box lower corner
+    vec _box_min;
+    /// Warning box upper corner
+    vec _box_max;
+    /// Out of box flag
+    cl_mem _out_of_box;
+    /// Out of box flag, read back
+    unsigned int _out_of_box_flag;
+    /// Out of box flag reading event, NULL if it is not pending
+    cl_event _out_of_box_event;
+
+    /// Unsorted cells flag
+    cl_mem _unsorted;
+    /// Sorted cells check
+    cl_kernel _is_sorted;
+    /// Identity permutations
+    cl_kernel _identity;
+    /// Sorted cells check and identity permutations local work size
+    size_t _identity_lws;
+    /// Sorted cells check and identity permutations global work size
+    size_t _identity_gws;
 };
 
 }}  // namespace
@@ -0,0 +1,133 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Dynamic load balancing of the MPI planes decomposition.
+ * (See Aqua::CalcServer::MPIBalance for details)
+ */
+
+#ifndef MPIBALANCE_H_INCLUDED
+#define MPIBALANCE_H_INCLUDED
+
+#ifndef HAVE_MPI
+#error MPI not available
+#endif
+
+#include <sphPrerequisites.h>
+#include <vector>
+#include <CalcServer/Tool.h>
+#include <Tokenizer/Expression.h>
+
+namespace Aqua{ namespace CalcServer{
+
+/** @class MPIBalance MPIBalance.h CalcServer/MPIBalance.h
+ * @brief Move the interface planes between processes to balance the load.
+ *
+ * The planes decomposition (see resources/Presets/basic/MPI_planes.xml) is
+ * splitting the domain in slabs of the same width, which is not suitable when
+ * the fluid is moving a lot. This tool is gathering a load measure of each
+ * process, e.g. the number of fluid particles, and moving each interface plane
+ * towards the most loaded process of both sides. The plane displacement is
+ * proportional to the load difference, and to the width of the slab to be
+ * shrunk.
+ *
+ * The plane positions are stored in units of the nominal planes distance, and
+ * every process is computing the same positions out of the same gathered loads,
+ * so no further communications are required. The tool is just writing the
+ * displacement of the two planes bounding the current process, with respect to
+ * their nominal positions, in a "vec2" variable. The particles are migrated by
+ * the mpi-sync tool, as usual.
+ *
+ * @code{.xml}
+    <Tool action="insert" before="mpi mask reset" name="mpi balance"
+          type="mpi-balance" load="mpi_n_fluid" shift="mpi_planes_shift"
+          period="100" relax="0.5" min_width="0.1"/>
+ * @endcode
+ *
+ * @see resources/Presets/basic/MPI_balance.xml
+ * @warning The slabs shall not be narrower than the kernel support, so
+ * min_width shall be set accordingly.
+ */
+class MPIBalance : public Aqua::CalcServer::Tool
+{
+public:
+    /** Constructor.
+     * @param name Tool name.
+     * @param load Expression to measure the load of the process.
+     * @param shift Variable where the planes displacements are stored.
+     * @param period Number of time steps between balancing operations.
+     * @param relax Relaxation factor, in the interval (0, 1].
+     * @param min_width Minimum slab width, in nominal planes distance units.
+     * @param once Run this tool just once. Useful to make initializations.
+     */
+    MPIBalance(const std::string name,
+               const std::string load,
+               const std::string shift,
+               unsigned int period=1,
+               float relax=0.5f,
+               float min_width=0.1f,
+               bool once=false);
+
+    /** Destructor
+     */
+    ~MPIBalance();
+
+    /** Initialize the tool.
+     */
+    void setup();
+
+protected:
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accesing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /** Get the variables
+     */
+    void variables();
+
+    /// Load expression
+    std::string _load;
+    /// Compiled load expression
+    Expression *_expr;
+    /// Planes displacement variable name
+    std::string _shift_name;
+    /// Planes displacement variable
+    InputOutput::Variable *_shift;
+    /// Time step variable
+    InputOutput::UIntVariable *_iter;
+    /// Number of time steps between balancing operations
+    unsigned int _period;
+    /// Relaxation factor
+    float _relax;
+    /// Minimum slab width
+    float _min_width;
+
+    /// MPI process index
+    unsigned int _mpi_rank;
+    /// Number of MPI processes
+    unsigned int _mpi_size;
+    /// Positions of all the planes, in nominal planes distance units
+    std::vector<float> _planes;
+};
+
+}}  // namespace
+
+#endif // MPIBALANCE_H_INCLUDED
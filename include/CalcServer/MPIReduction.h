@@ -0,0 +1,137 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Non-blocking reduction of scalar variables across processes.
+ * (See Aqua::CalcServer::MPIReduction for details)
+ */
+
+#ifndef MPIREDUCTION_H_INCLUDED
+#define MPIREDUCTION_H_INCLUDED
+
+#ifndef HAVE_MPI
+#error MPI not available
+#endif
+
+#include <mpi.h>
+#include <thread>
+#include <vector>
+#include <CalcServer/Tool.h>
+
+namespace Aqua{ namespace CalcServer{
+
+/** @class MPIReduction MPIReduction.h CalcServer/MPIReduction.h
+ * @brief Reduce a scalar variable across all the processes.
+ *
+ * The minimum, the maximum or the sum of a scalar variable, either a number or
+ * a vector, is computed by all the processes, and stored in the output
+ * variable:
+ * @code{.xml}
+    <Tool action="insert" after="dt reduction" name="dt global"
+          type="mpi-reduction" in="dt" out="dt" operation="min"/>
+ * @endcode
+ *
+ * The reduction is carried out by an auxiliar thread, using MPI_Iallreduce()
+ * on a communicator duplicated for this tool, so the host is not blocked.
+ * Instead, an user event is associated to the output variable, which is
+ * completed when the result is available. Hence just the tools consuming the
+ * result are waiting for it, and the rest of the time step can be overlapped
+ * with the communication.
+ *
+ * @note MPI should provide MPI_THREAD_MULTIPLE support.
+ */
+class MPIReduction : public Aqua::CalcServer::Tool
+{
+public:
+    /** Constructor.
+     * @param name Tool name.
+     * @param input Input scalar variable name.
+     * @param output Output scalar variable name. It can be the same than the
+     * input one.
+     * @param operation Reduction operation, either "min", "max" or "sum".
+     * @param once Run this tool just once. Useful to make initializations.
+     */
+    MPIReduction(const std::string name,
+                 const std::string input,
+                 const std::string output,
+                 const std::string operation="sum",
+                 bool once=false);
+
+    /** Destructor
+     */
+    ~MPIReduction();
+
+    /** Initialize the tool.
+     */
+    void setup();
+
+protected:
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accesing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /** Get the input and output variables
+     */
+    void variables();
+
+    /** Reduce the variable, in the auxiliar thread
+     * @param trigger Event to be waited before reading the input variable.
+     * @param user_event Event to be completed when the result is available.
+     */
+    void reduce(cl_event trigger, cl_event user_event);
+
+    /// Input variable name
+    std::string _input_name;
+    /// Output variable name
+    std::string _output_name;
+    /// Reduction operation name
+    std::string _operation;
+
+    /// Input variable
+    InputOutput::Variable *_input;
+    /// Output variable
+    InputOutput::Variable *_output;
+    /// Input variable value, to be read by the auxiliar thread
+    void *_input_ptr;
+    /// Output variable value, to be written by the auxiliar thread
+    void *_output_ptr;
+
+    /// MPI data type
+    MPI_Datatype _mpi_type;
+    /// Number of components
+    unsigned int _mpi_n;
+    /// MPI reduction operation
+    MPI_Op _mpi_op;
+    /// Communicator of this tool
+    MPI_Comm _comm;
+
+    /// Input value to be reduced
+    std::vector<char> _send;
+    /// Reduced value
+    std::vector<char> _recv;
+
+    /// Auxiliar thread
+    std::thread _thread;
+};
+
+}}  // namespace
+
+#endif // MPIREDUCTION_H_INCLUDED
@@ -67,6 +67,22 @@ namespace Aqua{ namespace CalcServer{
  * To reduce the computational cost and avoid aside effects, it is strongly
  * recommended to copy the actual data into helper arrays before synchronizing.
  *
+ * Just the listed processes are exchanging data, such that a halo exchange
+ * with the neighbour processes can be carried out, without messages to the
+ * rest of processes. The neighbours are given by the decomposition, e.g.
+ * resources/Presets/basic/MPI_planes.xml is considering just the previous
+ * and the next processes. The lists are automatically made symmetric.
+ *
+ * All the fields to be sent to each process are packed on the device in a
+ * single buffer, which is downloaded to pinned host memory at once and sent
+ * in a single message. The receiver is unpacking the message on the device
+ * as well.
+ *
+ * The tool is not splitting the interaction kernels into interior and
+ * boundary passes. The received particles are restored into the regular
+ * arrays before being sorted, so the tools consuming them shall wait for the
+ * whole exchange (see resources/Presets/basic/MPI_planes.xml).
+ *
  * @note Since the mask array shall be sorted, power of 2 arrays are required.
  */
 class MPISync : public Aqua::CalcServer::Tool
@@ -100,6 +116,14 @@ public:
      */
     void setup();
 
+    /** @brief Time spent by the receivers waiting for the messages.
+     *
+     * The time blocked in the MPI probing and receiving calls of all the
+     * mpi-sync tools is accumulated since the simulation start.
+     * @return Accumulated waiting time, in seconds
+     */
+    static double waitTime();
+
 protected:
     /** Execute the tool
      * @param events List of events that shall be waited before safe execution
@@ -129,6 +153,14 @@ private:
      */
     void setupFieldSort(InputOutput::ArrayVariable* field);
 
+    /** @brief Make the list of processes symmetric
+     *
+     * Every process which is sending data to this one has to be considered,
+     * even if it is not listed, so the lists of all the processes are gathered
+     * and merged.
+     */
+    void setupNeighbours();
+
     /** @brief Create the senders to each process
      */
     void setupSenders();
@@ -137,6 +169,13 @@ private:
      */
     void setupReceivers();
 
+    /** @brief Allocate the memory to pack the fields
+     * @param host Pinned host memory, with room for all the elements
+     * @param mem Device memory, with room for all the elements
+     * @param kind Either "send" or "recv", just for reporting purposes
+     */
+    void setupPackMems(void **host, cl_mem *mem, const std::string kind);
+
     /// Mask name
     std::string _mask_name;
     /// Mask variable
@@ -152,6 +191,9 @@ private:
     /// List of processes to be considered at the time of sending data
     std::vector<unsigned int> _procs;
 
+    /// Size of the fields of a single element, in bytes
+    size_t _elem_size;
+
     /** Auxiliar variable to store the original index of each sorted component
      * of the mask.
      */
@@ -186,15 +228,17 @@ public:
          * Aqua::CalcServer::MPISync)
          * @param mask Already sorted mask
          * @param fields Already sorted fields
-         * @param field_hosts Allocated host memory to temporary copy the data,
-         * while it is sent to another process or it is uploaded to the
+         * @param host Allocated host memory to temporary copy the packed
+         * data, while it is sent to another process or it is uploaded to the
          * computational device either
+         * @param buffer Device memory where the fields are packed
          * @param proc Process to which the data shall be sent
          */
         Exchanger(const std::string name,
                   InputOutput::ArrayVariable *mask,
                   const std::vector<InputOutput::ArrayVariable*> fields,
-                  const std::vector<void*> field_hosts,
+                  void *host,
+                  cl_mem buffer,
                   const unsigned int proc);
 
         /** Destructor.
@@ -240,8 +284,14 @@ public:
         /// Total number of elements
         unsigned int _n;
 
-        /// Host memory arrays to download, send, receive and upload the data
-        std::vector<void*> _fields_host;
+        /// Size of the fields of a single element, in bytes
+        size_t _elem_size;
+
+        /// Host memory to download, send, receive and upload the packed data
+        void *_host;
+
+        /// Device memory where the fields are packed
+        cl_mem _buffer;
     private:
         /// Owner tool name
         std::string _name;
@@ -260,19 +310,16 @@ public:
          * Aqua::CalcServer::MPISync)
          * @param mask Already sorted mask
          * @param fields Already sorted fields
-         * @param field_hosts Allocated host memory to temporary copy the data,
-         * while it is sent to another process or it is uploaded to the
-         * computational device either
+         * @param host Allocated host memory to temporary copy the packed
+         * data, while it is sent to another process
+         * @param buffer Device memory where the fields are packed
          * @param proc Process to which the data shall be sent
-         * @param n_offset Variable where the number of already sent particles
-         * should be stored. Sending instances will use this variable to both,
-         * know when they can proceed, and which is the offset to read from
-         * fields
          */
         Sender(const std::string name,
                InputOutput::ArrayVariable *mask,
                const std::vector<InputOutput::ArrayVariable*> fields,
-               const std::vector<void*> field_hosts,
+               void *host,
+               cl_mem buffer,
                const unsigned int proc);
 
         /** Destructor.
@@ -322,6 +369,10 @@ public:
         /// Reduction to compute the number of elements to send
         Reduction *_n_send_reduction;
 
+        /// Last send request, which shall be completed before reusing the
+        /// host memory
+        MPI::Request _request;
+
         /// Global work sizes in each step
         size_t _global_work_size;
         /// Local work sizes in each step
@@ -341,9 +392,10 @@ public:
          * Aqua::CalcServer::MPISync)
          * @param mask Incoming data process mask
          * @param fields Fields to store the incoming data
-         * @param field_hosts Allocated host memory to temporary copy the
-         * incoming data, which will be uploaded to the computational device
+         * @param host Allocated host memory to temporary copy the incoming
+         * packed data, which will be uploaded to the computational device
          * afterwards
+         * @param buffer Device memory where the incoming data is unpacked from
          * @param proc Process from which the data shall be received
          * @param n_offset Variable where the number of already received
          * particles should be stored.
@@ -351,7 +403,8 @@ public:
         Receiver(const std::string name,
                  InputOutput::ArrayVariable *mask,
                  const std::vector<InputOutput::ArrayVariable*> fields,
-                 const std::vector<void*> field_hosts,
+                 void *host,
+                 cl_mem buffer,
                  const unsigned int proc,
                  InputOutput::UIntVariable *n_offset);
 
@@ -379,8 +432,11 @@ public:
 
 
 private:
-    /// Host memory arrays to download and send data to other processes
-    std::vector<void*> _fields_send;
+    /// Host memory to download and send data to other processes
+    void *_send_host;
+
+    /// Device memory to pack the data to be sent to other processes
+    cl_mem _send_mem;
 
     /// Set of information senders
     std::vector<Sender*> _senders;
@@ -394,8 +450,11 @@ private:
     /// Offset reinitialization tool
     SetScalar *_n_offset_recv_reinit;
 
-    /// Host memory arrays to download and send data to other processes
-    std::vector<void*> _fields_recv;
+    /// Host memory to receive and upload data from other processes
+    void *_recv_host;
+
+    /// Device memory to unpack the data received from other processes
+    cl_mem _recv_mem;
 
     /// Set of information senders
     std::vector<Receiver*> _receivers;
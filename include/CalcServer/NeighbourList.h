@@ -0,0 +1,192 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Verlet neighbours list.
+ * (See Aqua::CalcServer::NeighbourList for details)
+ * @note Hardcoded versions of the files CalcServer/NeighbourList.cl.in and
+ * CalcServer/NeighbourList.hcl.in are internally included as a text array.
+ */
+
+#ifndef NEIGHBOURLIST_H_INCLUDED
+#define NEIGHBOURLIST_H_INCLUDED
+
+#include <sphPrerequisites.h>
+#include <vector>
+#include <CalcServer/Tool.h>
+
+namespace Aqua{ namespace CalcServer{
+
+/** @class NeighbourList NeighbourList.h CalcServer/NeighbourList.h
+ * @brief Verlet neighbours list, built from the link-list.
+ *
+ * The neighbours of each particle closer than the kernel support plus a skin
+ * distance are stored in the "neighs" array, while their number is stored in
+ * the "n_neighs" array. Both arrays are registered by the tool if they are
+ * not already declared.
+ *
+ * The list is built from the link-list, so this tool shall be placed after
+ * the link-list and the sorting stages of the pipeline:
+ * @code{.xml}
+    <Tool action="insert" after="Sort" name="neighbour-list"
+          type="neighbour-list" in="r" skin="0.1 * h" max_neighs="64"/>
+ * @endcode
+ *
+ * Then, the list is just moved to the new sorted space each time step, and it
+ * is rebuilt only when the displacement of any particle exceeds half of the
+ * skin distance. The interactions kernels can traverse the list with the
+ * BEGIN_LOOP_OVER_NEIGHS_LIST() and END_LOOP_OVER_NEIGHS_LIST() macros,
+ * instead of checking all the particles in the neighbour cells.
+ *
+ * @warning The skin distance shall be smaller than the cells length, i.e.
+ * the kernel support.
+ */
+class NeighbourList : public Aqua::CalcServer::Tool
+{
+public:
+    /** Constructor.
+     * @param tool_name Tool name.
+     * @param input Input array to be used as the particles positions.
+     * @param skin Skin distance expression.
+     * @param max_neighs Maximum number of neighbours per particle.
+     * @param once Run this tool just once. Useful to make initializations.
+     */
+    NeighbourList(const std::string tool_name,
+                  const std::string input="r",
+                  const std::string skin="0",
+                  unsigned int max_neighs=128,
+                  bool once=false);
+
+    /** Destructor
+     */
+    ~NeighbourList();
+
+    /** Initialize the tool.
+     */
+    void setup();
+
+protected:
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accesing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /** Register the neighbours list arrays, and get the variables
+     */
+    void variables();
+
+    /** Setup the OpenCL stuff
+     */
+    void setupOpenCL();
+
+    /** Build the neighbours list
+     * @param events Events to be waited before starting
+     * @return The building event
+     */
+    cl_event build(const std::vector<cl_event> events);
+
+    /** Move the neighbours list to the new sorted space
+     * @param events Events to be waited before starting
+     * @return The remapping event
+     */
+    cl_event remap(const std::vector<cl_event> events);
+
+    /** Check whether the list should be rebuilt
+     * @param event Event to be waited before starting
+     * @return true if any particle has moved more than half of the skin
+     */
+    bool displaced(cl_event event);
+
+    /** Reset the flag
+     */
+    void resetFlag();
+
+    /** Read the flag back
+     * @param event Event to be waited before reading
+     * @return The flag value
+     */
+    unsigned int readFlag(cl_event event);
+
+    /** Set the kernel arguments
+     * @param kernel Kernel
+     * @param kernel_name Kernel name, just for reporting purposes
+     * @param sizes Arguments sizes
+     * @param values Arguments values
+     */
+    void setArgs(cl_kernel kernel,
+                 const std::string kernel_name,
+                 const std::vector<size_t> sizes,
+                 const std::vector<const void*> values);
+
+    /// Input variable name
+    std::string _input_name;
+
+    /// Skin distance expression
+    std::string _skin_expr;
+
+    /// Skin distance
+    float _skin;
+
+    /// Interaction distance
+    float _support;
+
+    /// Maximum number of neighbours per particle
+    unsigned int _max_neighs;
+
+    /// Number of particles
+    unsigned int _n;
+
+    /// true if the list has been already built
+    bool _built;
+
+    /// Positions variable
+    InputOutput::ArrayVariable *_r;
+    /// Number of neighbours variable
+    InputOutput::ArrayVariable *_n_neighs;
+    /// Neighbours variable
+    InputOutput::ArrayVariable *_neighs;
+
+    /// Spare number of neighbours array, to remap the list
+    cl_mem _n_neighs_in;
+    /// Spare neighbours array, to remap the list
+    cl_mem _neighs_in;
+    /// Positions when the list was built
+    cl_mem _r0;
+    /// Spare positions array, to remap the list
+    cl_mem _r0_in;
+    /// Overflow/rebuild flag
+    cl_mem _flag;
+
+    /// List building kernel
+    cl_kernel _build;
+    /// List remapping kernel
+    cl_kernel _remap;
+    /// Displacement check kernel
+    cl_kernel _displacement;
+
+    /// Kernels local work size
+    size_t _lws;
+    /// Kernels global work size
+    size_t _gws;
+};
+
+}}  // namespace
+
+#endif // NEIGHBOURLIST_H_INCLUDED
@@ -0,0 +1,195 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Selection of the particles to be saved.
+ * (See Aqua::CalcServer::OutputFilter for details)
+ * @note Hardcoded versions of the files CalcServer/OutputFilter.cl.in and
+ * CalcServer/OutputFilter.hcl.in are internally included as a text array.
+ */
+
+#ifndef OUTPUTFILTER_H_INCLUDED
+#define OUTPUTFILTER_H_INCLUDED
+
+#include <CalcServer.h>
+#include <CalcServer/Tool.h>
+
+namespace Aqua{ namespace CalcServer{
+
+/** @class OutputFilter OutputFilter.h CalcServer/OutputFilter.h
+ * @brief Selection of the particles to be saved.
+ *
+ * The particles of a set are selected in the device, in the unsorted space,
+ * such that just the selected ones are downloaded and saved. The particles
+ * can be selected by:
+ *   - A stride, i.e. every k-th particle of the set.
+ *   - A bounding box, where the particles positions, "r", shall be.
+ *   - A range of values of a scalar field, e.g. "imove".
+ *
+ * The selection is compacted keeping the order of the particles. Then each
+ * downloaded field is gathered in one of two staging buffers, such that a
+ * field can be gathered while the previous one is still being transferred.
+ *
+ * This tool is not designed for the common usage but as an auxiliar tool for
+ * the savers, therefore it will not be selectable for the users (see
+ * Aqua::InputOutput::Particles).
+ */
+class OutputFilter : public Aqua::CalcServer::Tool
+{
+public:
+    /** Constructor
+     * @param name Tool name
+     * @param first First particle of the set (unsorted index)
+     * @param n Number of particles of the set
+     * @param stride Stride. 1 to select all the particles.
+     * @param box_min Bounding box lower corner expression. An empty string to
+     * not consider the bounding box.
+     * @param box_max Bounding box upper corner expression.
+     * @param select_name Scalar field to select the particles. An empty
+     * string to not consider it.
+     * @param select_min Minimum value of the field expression.
+     * @param select_max Maximum value of the field expression.
+     */
+    OutputFilter(const std::string name,
+                 unsigned int first,
+                 unsigned int n,
+                 unsigned int stride=1,
+                 const std::string box_min="",
+                 const std::string box_max="",
+                 const std::string select_name="",
+                 const std::string select_min="-INFINITY",
+                 const std::string select_max="INFINITY");
+
+    /** Destructor.
+     */
+    ~OutputFilter();
+
+    /** Initialize the tool.
+     */
+    void setup();
+
+    /** Get the number of particles selected in the last execution.
+     * @return Number of selected particles.
+     */
+    unsigned int n() const {return _n_selected;}
+
+    /** Download the selected particles of an unsorted variable.
+     * @param var_name Variable to download.
+     * @param ptr The host memory where the data should be copied. It shall
+     * have room for n() components.
+     * @return The data download event, NULL if errors are detected.
+     * @note The caller must wait for the event (clWaitForEvents) before
+     * accessing the downloaded data.
+     * @remarks The caller must call clReleaseEvent to destroy the event.
+     */
+    cl_event download(const std::string var_name, void *ptr);
+
+protected:
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accessing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /** Get the input variables
+     */
+    void variables();
+
+    /** Create the memory objects
+     */
+    void setupMem();
+
+    /** Setup the OpenCL stuff
+     */
+    void setupOpenCL();
+
+    /** Set the arguments of the selection kernels
+     * @param kernel The kernel
+     * @param r Unsorted positions memory object
+     * @param sel Unsorted selection field memory object
+     */
+    void setSelectionArgs(cl_kernel kernel, cl_mem r, cl_mem sel);
+
+    /// First particle
+    unsigned int _first;
+    /// Number of particles of the set
+    unsigned int _n;
+    /// Stride
+    unsigned int _stride;
+    /// Bounding box lower corner expression
+    std::string _box_min_expr;
+    /// Bounding box upper corner expression
+    std::string _box_max_expr;
+    /// Selection field name
+    std::string _select_name;
+    /// Selection field minimum value expression
+    std::string _select_min_expr;
+    /// Selection field maximum value expression
+    std::string _select_max_expr;
+
+    /// Bounding box lower corner
+    vec _box_min;
+    /// Bounding box upper corner
+    vec _box_max;
+    /// Selection field minimum value
+    float _select_min;
+    /// Selection field maximum value
+    float _select_max;
+
+    /// Number of selected particles
+    unsigned int _n_selected;
+
+    /// Number of selected particles in each work group
+    cl_mem _counts;
+    /// Offset of the selected particles of each work group
+    cl_mem _offsets;
+    /// Unsorted indexes of the selected particles
+    cl_mem _ids;
+    /// Staging buffers, where the compacted data is downloaded from
+    cl_mem _scratch[2];
+    /// Size of each staging buffer
+    size_t _scratch_size[2];
+    /// Staging buffer to be used by the next download
+    unsigned int _scratch_id;
+
+    /// Event of the last selection
+    cl_event _event;
+    /// Event of the last download from each staging buffer
+    cl_event _scratch_event[2];
+
+    /// Selected particles counting kernel
+    cl_kernel _count;
+    /// Selected particles indexes compaction kernel
+    cl_kernel _compact;
+    /// Compacted data gathering kernel
+    cl_kernel _gather;
+
+    /// Local work size
+    size_t _local_work_size;
+    /// Global work size
+    size_t _global_work_size;
+    /// Number of work groups
+    unsigned int _n_groups;
+    /// Number of selected particles of each work group, and their offsets
+    std::vector<unsigned int> _host_counts;
+};
+
+}}  // namespace
+
+#endif // OUTPUTFILTER_H_INCLUDED
@@ -0,0 +1,151 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Permutation of several arrays at once.
+ * (See Aqua::CalcServer::Permute for details)
+ * @note Hardcoded versions of the files CalcServer/Permute.cl.in and
+ * CalcServer/Permute.hcl.in are internally included as a text array.
+ */
+
+#ifndef PERMUTE_H_INCLUDED
+#define PERMUTE_H_INCLUDED
+
+#include <sphPrerequisites.h>
+#include <vector>
+#include <CalcServer.h>
+#include <CalcServer/Tool.h>
+
+/** @def _PERMUTE_FIELDS Maximum number of arrays permuted by each kernel
+ * @note Must be in the range [1, 8]
+ */
+#ifndef _PERMUTE_FIELDS
+    #define _PERMUTE_FIELDS 8
+#endif
+
+namespace Aqua{ namespace CalcServer{
+
+/** @class Permute Permute.h CalcServer/Permute.h
+ * @brief Permute several arrays, e.g. to sort the particles after the
+ * link-list computation.
+ *
+ * The arrays are grouped by their element and total sizes, and each group is
+ * permuted by a batch of kernels, each one processing up to _PERMUTE_FIELDS
+ * arrays. The results are written in a set of spare buffers, which are
+ * afterwards swapped with the arrays memory objects. Hence neither the
+ * backup copies nor the copying back of the permuted data are required, and
+ * just _PERMUTE_FIELDS spare buffers are allocated per group.
+ *
+ * The hand-written sorting kernels of the presets, with their backup copies,
+ * can be replaced by a single tool:
+ * @code{.xml}
+    <Tool action="add" name="sort" type="permute" perm="id_sorted"
+          fields="id,iset,imove,r,normal,tangent,m,u,rho"/>
+ * @endcode
+ *
+ * The permutation, which is id_sorted by default, is read as the new index
+ * of each element, i.e. out[perm[i]] = in[i].
+ *
+ * Any type can be permuted, including the half precision ones, since just
+ * the element size is relevant.
+ *
+ * @warning Since the memory objects are swapped, the permuted arrays shall
+ * not share their memory objects with other variables.
+ * @note Hardcoded versions of the files CalcServer/Permute.cl.in and
+ * CalcServer/Permute.hcl.in are internally included as a text array.
+ */
+class Permute : public Aqua::CalcServer::Tool
+{
+public:
+    /** Constructor.
+     * @param name Tool name.
+     * @param fields Arrays to permute.
+     * @param permutations Permutations, from the current space to the new
+     * one.
+     * @param once Run this tool just once. Useful to make initializations.
+     */
+    Permute(const std::string name,
+            const std::vector<std::string> fields,
+            const std::string permutations="id_sorted",
+            bool once=false);
+
+    /** Destructor.
+     */
+    ~Permute();
+
+    /** Initialize the tool.
+     */
+    void setup();
+
+protected:
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accessing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /** Get the variables, grouping the arrays
+     */
+    void variables();
+
+    /** Create the spare memory objects
+     */
+    void setupMems();
+
+    /** Setup the OpenCL stuff
+     */
+    void setupOpenCL();
+
+    /// Arrays names
+    std::vector<std::string> _fields_names;
+
+    /// Permutations name
+    std::string _perms_name;
+
+    /// Permutations variable
+    InputOutput::ArrayVariable *_perms;
+
+    /// Arrays to permute, sorted by groups
+    std::vector<InputOutput::ArrayVariable*> _fields;
+
+    /// Element size of each group
+    std::vector<size_t> _groups_elem_size;
+    /// Spare memory objects of each group
+    std::vector<std::vector<cl_mem>> _groups_spares;
+
+    /// Group of each batch
+    std::vector<unsigned int> _batches_group;
+    /// First array of each batch (see _fields)
+    std::vector<unsigned int> _batches_first;
+    /// Number of arrays of each batch
+    std::vector<unsigned int> _batches_size;
+    /// Kernel of each batch
+    std::vector<cl_kernel> _kernels;
+
+    /// Global work size
+    size_t _global_work_size;
+    /// Local work size
+    size_t _local_work_size;
+    /// Number of elements to permute
+    unsigned int _n;
+};
+
+}}  // namespace
+
+#endif // PERMUTE_H_INCLUDED
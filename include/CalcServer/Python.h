@@ -25,6 +25,7 @@
 #define PYTHON_H_INCLUDED
 
 #include <Python.h>
+#include <thread>
 #include <CalcServer.h>
 #include <CalcServer/Tool.h>
 
@@ -38,6 +39,21 @@ namespace Aqua{ namespace CalcServer{
  *
  * AQUAgpusph is providing a module called aquagpusph which allows the Python
  * script to get and set variable values.
+ *
+ * The asynchronous tools are not blocking the simulation while main() is
+ * executed. Instead, a snapshot of the input variables is taken, and then the
+ * script is executed in a worker thread, concurrently with the next tools and
+ * time steps. In the script, aquagpusph.get() is returning the snapshot
+ * values, while the variables set by aquagpusph.set() are applied the next
+ * time the tool is executed, just before taking the new snapshot. Hence these
+ * tools are mostly useful for monitoring and postprocessing purposes:
+ * @code{.xml}
+    <Tool action="add" name="monitor" type="python" path="Monitor.py"
+          async="true" in="t, p_sensors"/>
+ * @endcode
+ *
+ * @note The asynchronous scripts cannot use aquagpusph.view(),
+ * aquagpusph.map() and aquagpusph.unmap().
  */
 class Python : public Aqua::CalcServer::Tool
 {
@@ -45,10 +61,16 @@ public:
     /** @brief Constructor.
      * @param tool_name Tool name.
      * @param script Python script path.
+     * @param async true if the script shall be executed in a worker thread,
+     * false otherwise.
+     * @param inputs Variables to be passed to the asynchronous script. It
+     * is ignored if @p async is false.
      * @param once Run this tool just once. Useful to make initializations.
      */
     Python(const std::string tool_name,
            const std::string script,
+           bool async=false,
+           const std::vector<std::string> inputs=std::vector<std::string>(),
            bool once=false);
 
     /// Destructor.
@@ -77,6 +99,32 @@ protected:
      */
     void load();
 
+    /** @brief Call main(), checking the returned value.
+     *
+     * It is not throwing exceptions, so it can be called from the worker
+     * thread.
+     * @return Error message, empty if all gone right.
+     */
+    std::string call();
+
+    /** @brief Execute the script in the worker thread.
+     *
+     * The Python global interpreter lock is acquired by the worker itself.
+     */
+    void run();
+
+    /** @brief Wait for the worker thread, applying the variables set by the
+     * script.
+     *
+     * It shall be called from the main thread, holding the Python global
+     * interpreter lock.
+     */
+    void join();
+
+    /** @brief Take the snapshot of the input variables for the worker thread.
+     */
+    void snapshot();
+
 private:
     /// Script path
     std::string _script;
@@ -85,6 +133,19 @@ private:
     PyObject *_module;
     /// Python function to be called
     PyObject *_func;
+
+    /// true if the script is executed in a worker thread
+    bool _async;
+    /// Input variables names for the asynchronous script
+    std::vector<std::string> _input_names;
+    /// Snapshot of the input variables, a dictionary
+    PyObject *_inputs;
+    /// Variables set by the asynchronous script, a list of tuples
+    PyObject *_outputs;
+    /// Error reported by the worker thread, empty if all gone right
+    std::string _error;
+    /// Worker thread
+    std::thread _thread;
 };
 
 }}  // namespace
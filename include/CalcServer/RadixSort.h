@@ -47,7 +47,9 @@
 #ifndef __UINTBITS__
     #define __UINTBITS__ 32
 #endif
-/// @def _STEPBITS Bits that be sorted in each pass
+/** @def _STEPBITS Default bits that be sorted in each pass
+ * @see Aqua::CalcServer::RadixSort::RadixSort()
+ */
 #ifndef _STEPBITS
     #define _STEPBITS 4
 #endif
@@ -87,6 +89,30 @@ namespace Aqua{ namespace CalcServer{
  *   -# Create the histogram.
  *   -# Scan the histogram to create the accumulated one.
  *   -# Permut the variables.
+ * Just the passes required to sort the actual keys are carried out. If the
+ * sorted variable is "icell", the maximum key is n_cells.w, i.e. the cell
+ * where the particles out of the domain are placed. Otherwise the full
+ * __UINTBITS__ bits are sorted.
+ *
+ * The number of bits sorted in each pass can be set with the `bits`
+ * attribute. Likewise, the number of items per group, the number of groups and
+ * the number of histogram splits, which are _ITEMS, _GROUPS and _HISTOSPLIT
+ * by default, can be set with the `items`, `groups` and `splits` attributes:
+ * @code{.xml}
+    <Tool action="add" name="sort" type="radix-sort" in="icell"
+          perm="id_unsorted" inv_perm="id_sorted" bits="8"
+          items="256" groups="64" splits="256"/>
+ * @endcode
+ * All of them shall be powers of 2. The values are anyway corrected to fit in
+ * the device limits, in the same way the default ones are.
+ *
+ * If the autotuning is enabled (see
+ * Aqua::InputOutput::ProblemSetup::sphSettings::autotune), a small set of
+ * bits, items and groups around the values above is timed during the setup,
+ * sorting random keys of the actual length, and the fastest one is selected.
+ * The choice is recorded per device and number of keys in the
+ * Aqua::InputOutput::ProblemSetup::sphSettings::autotune_file file, so the
+ * candidates are not tested again in later executions.
  * To learn more about this code, please see also
  * http://code.google.com/p/ocl-radix-sort/updates/list.
  * @note Hardcoded versions of the files CalcServer/RadixSort.cl.in and
@@ -102,12 +128,21 @@ public:
      * @param inv_permutations Variable where the inverse permutations will be
      * stored.
      * @param once Run this tool just once. Useful to make initializations.
+     * @param bits Bits sorted in each pass, in the range [1, 8]. Larger values
+     * imply less passes, at the cost of larger histograms.
+     * @param items Number of items in a group.
+     * @param groups Number of groups.
+     * @param histo_split Number of splits of the histogram.
      */
     RadixSort(const std::string tool_name,
               const std::string variable="icell",
               const std::string permutations="id_unsorted",
               const std::string inv_permutations="id_sorted",
-              bool once=false);
+              bool once=false,
+              unsigned int bits=_STEPBITS,
+              unsigned int items=_ITEMS,
+              unsigned int groups=_GROUPS,
+              unsigned int histo_split=_HISTOSPLIT);
 
     /** Destructor
      */
@@ -117,6 +152,31 @@ public:
      */
     void setup();
 
+    /** Get the number of items in a group, after the device corrections
+     * @return Number of items
+     */
+    unsigned int items() const {return _items;}
+
+    /** Get the number of groups, after the device corrections
+     * @return Number of groups
+     */
+    unsigned int groups() const {return _groups;}
+
+    /** Get the number of histogram splits, after the device corrections
+     * @return Number of splits
+     */
+    unsigned int splits() const {return _histo_split;}
+
+    /** Get the number of bits sorted in each pass
+     * @return Number of bits
+     */
+    unsigned int bits() const {return _bits;}
+
+    /** Get the number of passes required to sort the keys
+     * @return Number of passes
+     */
+    unsigned int passes() const {return _n_pass;}
+
 protected:
     /** Execute the tool
      * @param events List of events that shall be waited before safe execution
@@ -156,6 +216,13 @@ private:
      */
     cl_event inversePermutations();
 
+    /** Compute the number of passes required to sort the keys.
+     *
+     * The maximum key is n_cells.w for the "icell" variable, and UINT_MAX
+     * otherwise.
+     */
+    void keyBits();
+
     /** Get the variables to compute.
      */
     void variables();
@@ -164,6 +231,22 @@ private:
      */
     void setupOpenCL();
 
+    /** Compile the kernels for the current number of bits, if they are not
+     * already compiled.
+     */
+    void setupKernels();
+
+    /** Select the fastest dimensions, i.e. _bits, _items and _groups, for the
+     * actual number of keys.
+     */
+    void autotune();
+
+    /** Time a single pass with the current dimensions
+     * @param keys Keys to be sorted
+     * @return Elapsed time, the fastest of #AUTOTUNE_SAMPLES samples
+     */
+    double autotuneSample(const std::vector<cl_uint> &keys);
+
     /** Setup the main computing dimensions _items, _groups and _histo_split
      * from the valid local work sizes per each kernel.
      */
@@ -239,10 +322,12 @@ private:
 
     /// Key bits (maximum)
     unsigned int _key_bits;
-    /// Needed radix pass (_key_bits / _STEPBITS)
+    /// Needed radix pass (_key_bits / _bits)
     unsigned int _n_pass;
     /// Pass of the radix decomposition
     unsigned int _pass;
+    /// Bits the kernels have been compiled for, 0 if they are not compiled
+    unsigned int _kernels_bits;
 
     /// Maximum local work size allowed by the device
     size_t _local_work_size;
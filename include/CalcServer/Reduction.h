@@ -34,6 +34,21 @@ namespace Aqua{ namespace CalcServer{
 
 /** @class Reduction Reduction.h CalcServer/Reduction.h
  * @brief Reductions, like scans, prefix sums, maximum or minimum, etc...
+ *
+ * Several reductions over the same input array can be computed in a single
+ * pass (see add()). In the XML definition, the consecutive reductions sharing
+ * the same `fuse` attribute and the same input variable are merged in a
+ * single tool, named as the `fuse` attribute:
+ * @code{.xml}
+    <Tool action="add" name="dt min" type="reduction" fuse="dt bounds"
+          in="dt_var" out="dt_min" null="INFINITY">
+        c = min(a, b);
+    </Tool>
+    <Tool action="add" name="dt max" type="reduction" fuse="dt bounds"
+          in="dt_var" out="dt_max" null="-INFINITY">
+        c = max(a, b);
+    </Tool>
+ * @endcode
  * @see Reduction.cl
  * @note Hardcoded versions of the files CalcServer/Reduction.cl.in and
  * CalcServer/Reduction.hcl.in are internally included as a text array.
@@ -71,6 +86,27 @@ public:
     /// Destructor.
     ~Reduction();
 
+    /** @brief Add another reduction over the same input variable.
+     *
+     * All the reductions are computed in a single pass over the input array,
+     * storing the result of each one in its own output variable. Hence the
+     * memory transfers are shared.
+     *
+     * @param output_name Variable where the reduced value will be stored.
+     * @param operation The reduction operation.
+     * @param null_val The value considered as the null one.
+     * @note This method shall be called before setup()
+     * @see Reduction()
+     */
+    void add(const std::string output_name,
+             const std::string operation,
+             const std::string null_val);
+
+    /** @brief Get the input variable name.
+     * @return Input variable name.
+     */
+    const std::string input() const {return _input_name;}
+
     /** @brief Initialize the tool.
      *
      * This method should be called after the constructor, such that it could
@@ -102,6 +138,11 @@ private:
      */
     void variables();
 
+    /** @brief Extract an output variable
+     * @param output_name Output variable name
+     */
+    void variable(const std::string output_name);
+
     /** @brief Setup the OpenCL stuff
      */
     void setupOpenCL();
@@ -118,23 +159,28 @@ private:
      * The compilation flags depends on the intended work group size
      *
      * @param local_size Work group size
+     * @param first_step true if the flags are for the first step, which is
+     * reading the input array, false otherwise
      * @return Flags string
      */
-    const std::string flags(const size_t local_size);
+    const std::string flags(const size_t local_size,
+                            const bool first_step=false);
 
     /// Input variable name
     std::string _input_name;
-    /// Output variable name
-    std::string _output_name;
-    /// Operation to be computed
-    std::string _operation;
-    /// Considered null val
-    std::string _null_val;
+    /// Output variables names
+    std::vector<std::string> _output_names;
+    /// Operations to be computed
+    std::vector<std::string> _operations;
+    /// Considered null vals
+    std::vector<std::string> _null_vals;
 
     /// Input variable
     InputOutput::ArrayVariable *_input_var;
-    /// Output variable
-    InputOutput::Variable *_output_var;
+    /// Output variables
+    std::vector<InputOutput::Variable*> _output_vars;
+    /// Host memory of the output variables, where the results are read
+    std::vector<void*> _output_ptrs;
 
     /// Input array
     cl_mem _input;
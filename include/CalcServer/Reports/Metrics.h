@@ -0,0 +1,123 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Live metrics exporter.
+ * (See Aqua::CalcServer::Reports::Metrics for details)
+ */
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include <sys/time.h>
+#include <CalcServer/Reports/Report.h>
+
+namespace Aqua{ namespace CalcServer{ namespace Reports{
+
+/** @class Metrics Metrics.h CalcServer/Metrics.h
+ * @brief Periodically rewritten file of metrics, to monitor long simulations.
+ *
+ * The file follows the Prometheus text exposition format, such that it can be
+ * directly served by the node exporter textfile collector, or just parsed by
+ * any monitoring script:
+ * @code
+    # TYPE aquagpusph_iterations_total counter
+    aquagpusph_iterations_total{rank="0"} 12000
+    aquagpusph_tool_device_seconds{rank="0",tool="Rates"} 0.0021
+ * @endcode
+ * The following metrics are exported:
+ *    -# The simulation time, iterations and number of particles
+ *    -# The time steps per second, and the particles updated per second
+ *    -# The average elapsed time, and device time, of each tool
+ *    -# The allocated memory in the computational device
+ *    -# The number of pending output tasks, the host memory they are
+ *    retaining and the time the simulation has been blocked by them (see
+ *    Aqua::InputOutput::Writers)
+ *    -# The time spent by the process waiting for the other MPI processes
+ *    (see Aqua::CalcServer::MPISync::waitTime() and
+ *    Aqua::CalcServer::CalcServer::barrierTime())
+ *
+ * All the metrics are labelled with the MPI process, such that the
+ * imbalance between the processes can be queried from the waiting time.
+ *
+ * This report is never blocking the simulation: the metrics are only
+ * collected when the period has elapsed, and if the simulation time, the
+ * iterations or the number of particles are still being computed, the
+ * collection is postponed to the next time step. The file is written by
+ * Aqua::InputOutput::Writers in a temporary file, which is then renamed, so
+ * the readers are never getting a partially written file.
+ */
+class Metrics : public Aqua::CalcServer::Reports::Report
+{
+public:
+    /** @brief Constructor.
+     * @param tool_name Tool name
+     * @param output_file Path of the output file. The "{mpi_rank}" scape
+     * string should be used in MPI simulations (see Aqua::setStrConstants())
+     * @param period Minimum wall clock time, in seconds, between updates
+     */
+    Metrics(const std::string tool_name,
+            const std::string output_file,
+            float period=5.f);
+
+    /** @brief Destructor
+     */
+    ~Metrics();
+
+    /** @brief Initialize the tool.
+     */
+    void setup();
+
+    /** @brief Launch _execute() without measuring the elapsed time
+     *
+     * This tool is not part of the simulation, so it shall not be accounted
+     * on the performance reports.
+     */
+    void execute(){std::vector<cl_event> null; _execute(null);}
+
+protected:
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accessing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /** @brief Check whether a variable can be read without blocking
+     * @param var Variable
+     * @return true if the variable has no pending events, false otherwise
+     */
+    static bool ready(InputOutput::Variable *var);
+
+    /// Output file name
+    std::string _output_file;
+    /// Minimum time between updates
+    float _period;
+    /// Rank of the process, as a label
+    std::string _rank;
+    /// Time mark of the last update
+    timeval _tic;
+    /// Iterations at the last update
+    unsigned int _iter;
+    /// true until the first update is carried out
+    bool _first;
+};
+
+}}} // namespace
+
+#endif // METRICS_H_INCLUDED
@@ -34,10 +34,58 @@ namespace Aqua{ namespace CalcServer{ namespace Reports{
  * @brief On screen performance output.
  *
  * Performance will print the following data:
- *    -# Allocated memory in the computational device
+ *    -# Allocated memory in the computational device, and its peak value
+ *    along the simulation
+ *    -# Memory saved by the aliased scratch arrays, if any (see
+ *    Aqua::CalcServer::CalcServer::aliasScratchArrays())
  *    -# The average CPU time consumend of each tool (GPU time can be taken
  *    with the profiling tools of each vendor)
+ *    -# The average time per step the host has been blocked syncing the
+ *    variables, and the top stall sources, i.e. the variables and the tools
+ *    requesting them (see Aqua::InputOutput::Variable::stalls())
  *
+ * Each time the allocated memory changes, its breakdown in arrays and tools
+ * internal buffers is logged as well, sorted from the largest to the
+ * smallest one. If an output file is set, the breakdown is also written in
+ * it as commented lines.
+ *
+ * In MPI simulations each process is reporting its own data. If the
+ * aggregated mode is enabled, the root process is additionally gathering the
+ * data of all the processes, and reporting the minimum, average and maximum
+ * values of:
+ *    -# The time step elapsed time
+ *    -# The number of particles, "N"
+ *    -# The time spent waiting for the mpi-sync messages and the barriers
+ *    (see Aqua::CalcServer::MPISync::waitTime() and
+ *    Aqua::CalcServer::CalcServer::barrierTime())
+ *    -# The average elapsed time of each tool
+ *
+ * together with the imbalance factor, i.e. the maximum value divided by the
+ * average one. The 5 tools with the largest maximum elapsed times are printed
+ * on screen, while all of them are written in the output file, if any.
+ *
+ * If a roofline file is set, and AQUAgpusph has been compiled with
+ * the GPU profiling support, a table of the Aqua::CalcServer::Kernel tools,
+ * sorted by their device elapsed time, is periodically written in it, with
+ * the following columns:
+ *    -# The tool name
+ *    -# The average device elapsed time
+ *    -# The bytes read and written by each launch (see
+ *    Aqua::CalcServer::Kernel::bytesRead() and
+ *    Aqua::CalcServer::Kernel::bytesWritten())
+ *    -# The effective bandwidth, and its ratio with the device peak bandwidth
+ *    -# The floating point operations per second, and the arithmetic
+ *    intensity, i.e. the operations per byte (see
+ *    Aqua::CalcServer::Kernel::flops())
+ *
+ * OpenCL is not providing the peak bandwidth of the device, so it is
+ * measured with a buffers copy benchmark during the setup. The traffic of
+ * each kernel is just an estimation of the compulsory one, so the caches
+ * and the neighbours accesses may cause effective bandwidths larger than
+ * the peak one.
+ *
+ * @warning In the aggregated mode the report shall be executed by all the
+ * processes at the same time steps.
  * @see Aqua::InputOutput::Logger
  */
 class Performance : public Aqua::CalcServer::Reports::Report
@@ -57,11 +105,19 @@ public:
      * font, true otherwise
      * @param output_file Path of the output file. Several scape strings can be
      * used, as described in Aqua::newFilePath()
+     * @param mpi true if the data of all the MPI processes shall be
+     * aggregated by the root process, false otherwise. It is ignored if MPI
+     * is not available.
+     * @param roofline_file Path of the kernels roofline table file. Several
+     * scape strings can be used, as described in Aqua::newFilePath(). If it
+     * is empty, no roofline table is written.
      */
     Performance(const std::string tool_name,
                 const std::string color="white",
                 bool bold=false,
-                const std::string output_file="");
+                const std::string output_file="",
+                bool mpi=false,
+                const std::string roofline_file="");
 
     /** @brief Destructor
      */
@@ -86,6 +142,46 @@ protected:
      */
     size_t computeAllocatedMemory();
 
+    /** @brief Get the allocated memory breakdown.
+     *
+     * The memory allocated by each array and by each tool internal buffer
+     * (including the host buffers) is reported.
+     * @return Name and allocated memory of each buffer, sorted from the
+     * largest to the smallest one
+     */
+    std::vector<std::pair<std::string, size_t>> computeMemoryBreakdown();
+
+    /** @brief Log the allocated memory breakdown.
+     *
+     * It is also written in the output file, if any
+     * @see computeMemoryBreakdown()
+     */
+    void reportMemoryBreakdown();
+
+    /** @brief Gather the data of all the MPI processes in the root one.
+     *
+     * The root process is adding the aggregated data to the report, and to
+     * the output file, if any.
+     * @param data Report to be printed on screen
+     * @param file_data Line to be written in the output file
+     */
+    void gatherMPI(std::stringstream &data, std::stringstream &file_data);
+
+    /** @brief Measure the device peak bandwidth.
+     *
+     * A large buffer is copied several times in the device.
+     * @return The bandwidth in bytes per second, 0 if it cannot be measured
+     */
+    double measurePeakBandwidth();
+
+    /** @brief Write the kernels roofline table.
+     *
+     * The file is overwritten each time.
+     * @return The aggregated effective bandwidth of the kernels, in bytes
+     * per second
+     */
+    double writeRoofline();
+
     /** Execute the tool
      * @param events List of events that shall be waited before safe execution
      * @return OpenCL event to be waited before accessing the dependencies
@@ -112,6 +208,20 @@ private:
     bool _first_execution;
     /// Output file handler
     std::ofstream _f;
+    /// Allocated memory when the breakdown was reported
+    size_t _reported_memory;
+    /// Peak allocated memory
+    size_t _peak_memory;
+    /// true if the MPI processes data shall be aggregated
+    bool _mpi;
+    /// Roofline table file name
+    std::string _roofline_file;
+    /// Device peak bandwidth, in bytes per second
+    double _peak_bandwidth;
+    /// Last computed aggregated bandwidth of the kernels, in bytes per second
+    double _bandwidth;
+    /// Time mark when the roofline table was written
+    timeval _roofline_tic;
 };
 
 }}} // namespace
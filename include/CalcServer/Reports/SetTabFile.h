@@ -57,6 +57,9 @@ namespace Aqua{ namespace CalcServer{ namespace Reports{
  * And therefore \f$ n_{prop} \cdot n_{parts} \f$ fields should be doownloaded
  * and printed in plain text. Please, be extremely careful about the considered
  * particles set and fields
+ *
+ * Just the tracked particles are gathered in the device, and downloaded,
+ * so the cost does not depend on the total number of particles.
  */
 class SetTabFile : public Aqua::CalcServer::Reports::Report
 {
@@ -112,6 +115,15 @@ protected:
     std::vector<void*> download(std::vector<InputOutput::Variable*> vars);
 
 private:
+    /** Print a new line in the file, in a parallel thread.
+     * @param t Time instant.
+     * @param types Type of each field.
+     * @param data Downloaded data. It is released afterwards.
+     */
+    void print(const std::string t,
+               const std::vector<std::string> types,
+               std::vector<void*> data);
+
     /** Remove the content of the data list.
      * @param data List of memory allocated arrays to be cleared.
      */
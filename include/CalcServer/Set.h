@@ -33,6 +33,7 @@ namespace Aqua{ namespace CalcServer{
 
 /** @class Set Set.h CalcServer/Set.h
  * @brief Set all the components of an array with the desired value.
+ * @see Aqua::CalcServer::SetBatch to set several arrays at once.
  */
 class Set : public Aqua::CalcServer::Tool
 {
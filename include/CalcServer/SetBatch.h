@@ -0,0 +1,136 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file
+ * @brief Set several arrays with the desired values in a single launch.
+ * (See Aqua::CalcServer::SetBatch for details)
+ * @note The types header CalcServer/Set.hcl.in is internally included as a
+ * text array.
+ */
+
+#ifndef SETBATCH_H_INCLUDED
+#define SETBATCH_H_INCLUDED
+
+#include <vector>
+#include <CalcServer.h>
+#include <CalcServer/Tool.h>
+
+namespace Aqua{ namespace CalcServer{
+
+/** @class SetBatch SetBatch.h CalcServer/SetBatch.h
+ * @brief Set several arrays with the desired values in a single launch.
+ *
+ * This is the multiple assignment form of Aqua::CalcServer::Set, which is
+ * selected when several arrays are listed, separated by commas, e.g.
+ * @code{.xml}
+    <Tool action="insert" after="Sort" type="set" name="cfd Reinit"
+          in="shepard, grad_p, div_u, lap_u"
+          value="0.f; VEC_ZERO; 0.f; VEC_ZERO"/>
+ * @endcode
+ * The values are separated by semicolons, since they may contain commas
+ * themselves. A single value can be provided as well, to be set in all the
+ * arrays. All the arrays shall have the same length.
+ *
+ * The arrays whose value can be evaluated are filled with
+ * clEnqueueFillBuffer(). The rest of them, e.g. the ones set with helpers
+ * like VEC_ZERO, are written by a single kernel generated for them.
+ */
+class SetBatch : public Aqua::CalcServer::Tool
+{
+public:
+    /** Constructor.
+     * @param name Tool name.
+     * @param var_names Variables to set.
+     * @param values Values to set, either one per variable or a single value
+     * for all of them.
+     * @param once Run this tool just once. Useful to make initializations.
+     */
+    SetBatch(const std::string name,
+             const std::vector<std::string> var_names,
+             const std::vector<std::string> values,
+             bool once=false);
+
+    /** Destructor.
+     */
+    ~SetBatch();
+
+    /** Initialize the tool.
+     */
+    void setup();
+
+protected:
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accessing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /** Get the input variables
+     */
+    void variables();
+
+    /** Setup the OpenCL stuff
+     */
+    void setupOpenCL();
+
+    /** Solve the equations.
+     *
+     * The values which cannot be solved are set by means of a define.
+     */
+    void solve();
+
+    /** Update the kernel arguments looking for changed values.
+     */
+    void setVariables();
+
+    /// Input variables names
+    std::vector<std::string> _var_names;
+    /// Values to set
+    std::vector<std::string> _values;
+
+    /// Input variables
+    std::vector<InputOutput::ArrayVariable*> _vars;
+
+    /// Memory objects sent
+    std::vector<cl_mem> _inputs;
+
+    /// Memory storage for the values, NULL for the defined ones
+    std::vector<void*> _data;
+
+    /// true for the arrays filled with clEnqueueFillBuffer()
+    std::vector<bool> _fill;
+
+    /// Index of the array argument of each variable, 0 if it is filled
+    std::vector<cl_uint> _arg_ids;
+
+    /// OpenCL kernel, NULL if all the arrays are filled
+    cl_kernel _kernel;
+
+    /// Global work sizes in each step
+    size_t _global_work_size;
+    /// Local work sizes in each step
+    size_t _local_work_size;
+    /// Number of elements
+    unsigned int _n;
+};
+
+}}  // namespace
+
+#endif // SETBATCH_H_INCLUDED
@@ -31,14 +31,24 @@ namespace Aqua{ namespace CalcServer{
 
 /** @class SetScalar SetScalar.h CalcServer/SetScalar.h
  * @brief Set a scalar variable.
+ *
+ * Several variables can be set by the same tool, listing them separated by
+ * commas, and their values separated by semicolons, e.g.
+ * @code{.xml}
+    <Tool action="add" type="set_scalar" name="init" in="t, dt"
+          value="0; courant * h / cs"/>
+ * @endcode
+ * The variables are set in order, such that each value can depend on the
+ * previously set variables.
  */
 class SetScalar : public Aqua::CalcServer::Tool
 {
 public:
     /** @brief Constructor.
      * @param name Tool name.
-     * @param var_name Variable to set.
-     * @param value Value to set.
+     * @param var_name Variable to set, or variables separated by commas.
+     * @param value Value to set, or values separated by semicolons, one per
+     * variable.
      * @param once Run this tool just once. Useful to make initializations.
      */
     SetScalar(const std::string name,
@@ -61,17 +71,19 @@ protected:
     cl_event _execute(const std::vector<cl_event> events);
 
 private:
-    /** @brief Get the input variable
+    /** @brief Get the input variables
      */
     void variable();
 
-    /// Input variable name
-    std::string _var_name;
-    /// Value to set
-    std::string _value;
+    /// Input variables names
+    std::vector<std::string> _var_names;
+    /// Values to set
+    std::vector<std::string> _values;
+    /// Compiled values expressions
+    std::vector<Expression*> _exprs;
 
-    /// Input variable
-    InputOutput::Variable *_var;
+    /// Input variables
+    std::vector<InputOutput::Variable*> _vars;
 };
 
 }}  // namespace
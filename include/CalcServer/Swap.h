@@ -0,0 +1,96 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Array swap tool.
+ * (see Aqua::CalcServer::Swap for details)
+ */
+
+#ifndef SWAP_H_INCLUDED
+#define SWAP_H_INCLUDED
+
+#include <CalcServer/Tool.h>
+
+namespace Aqua{ namespace CalcServer{
+
+/** @class Swap Swap.h CalcServer/Swap.h
+ * @brief Exchange the memory objects of two arrays.
+ *
+ * Differently to Aqua::CalcServer::Copy, no data is moved at all, but the
+ * variables are just pointing each one to the memory object of the other.
+ * Hence, this tool can replace a copy whenever the data of the output array
+ * is not required anymore, and the input array is fully overwritten later.
+ * That is the case of the backups of the particles fields before sorting
+ * them:
+ * @code{.xml}
+    <Tool action="add" name="Backup id" type="swap" in="id" out="id_in"/>
+ * @endcode
+ *
+ * The tools are detecting that the memory objects have changed, sending the
+ * new kernel arguments again.
+ *
+ * @note Both arrays shall have the same type and length.
+ */
+class Swap : public Aqua::CalcServer::Tool
+{
+public:
+    /** Constructor.
+     * @param name Tool name.
+     * @param input_name First variable to swap.
+     * @param output_name Second variable to swap.
+     * @param once Run this tool just once. Useful to make initializations.
+     */
+    Swap(const std::string name,
+         const std::string input_name,
+         const std::string output_name,
+         bool once=false);
+
+    /** Destructor.
+     */
+    ~Swap();
+
+    /** Initialize the tool.
+     */
+    void setup();
+
+protected:
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accessing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /** Get the input and output variables
+     */
+    void variables();
+
+    /// Input variable name
+    std::string _input_name;
+    /// Output variable name
+    std::string _output_name;
+
+    /// Input variable
+    InputOutput::ArrayVariable *_input_var;
+    /// Output variable
+    InputOutput::ArrayVariable *_output_var;
+};
+
+}}  // namespace
+
+#endif // SWAP_H_INCLUDED
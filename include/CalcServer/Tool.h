@@ -28,8 +28,12 @@
 #include <sphPrerequisites.h>
 #include <Variable.h>
 #include <math.h>
+#include <map>
 #include <vector>
 
+/// Number of time samples collected for each autotuning candidate
+#define AUTOTUNE_SAMPLES 3
+
 namespace Aqua{ namespace CalcServer{
 
 /** @class Tool Tool.h CalcServer/Tool.h
@@ -89,11 +93,47 @@ public:
      * pipeline
      */
     virtual Tool* next_tool() {return _next_tool;}
+
+    /** @brief Check whether the tool is run just once
+     * @return true if the tool is run just once, false otherwise
+     */
+    bool once() const {return _once;}
+
+    /** @brief Skip the tool, which will not be executed anymore.
+     *
+     * The tool remains in the pipeline, so the scopes and the conditional
+     * jumps are not affected.
+     * @param skipped true if the tool shall be skipped, false otherwise
+     * @see Aqua::InputOutput::ProblemSetup::sphSettings::pipeline_analysis
+     */
+    void skip(bool skipped=true){_skipped = skipped;}
+
+    /** @brief Check whether the tool is skipped
+     * @return true if the tool is not executed, false otherwise
+     */
+    bool skipped() const {return _skipped;}
     
     /** Get the allocated memory for this tool.
-     * @return allocated memory by this tool.
+     * @return allocated memory by this tool, including the named internal
+     * buffers (see allocatedBuffers()).
      */
-    size_t allocatedMemory() const {return _allocated_memory;}
+    size_t allocatedMemory() const;
+
+    /** Get the device memory allocated for each internal buffer.
+     * @return Allocated memory by each named internal buffer.
+     * @see allocatedMemory(const std::string, size_t)
+     */
+    const std::map<std::string, size_t> allocatedBuffers() const {
+        return _allocated_buffers;
+    }
+
+    /** Get the host memory allocated for each internal buffer.
+     * @return Allocated host memory by each named internal buffer.
+     * @note This memory is not accounted by allocatedMemory()
+     */
+    const std::map<std::string, size_t> allocatedHostBuffers() const {
+        return _allocated_host_buffers;
+    }
 
     /** Get the number of times that this tool has been called.
      * @return Number of times this tool has been called.
@@ -123,6 +163,46 @@ public:
      */
     float elapsedTimeDeviation() const {return sqrt(elapsedTimeVariance());}
 
+    /** @brief Get the time consumed by the tool in the device.
+     *
+     * The device time is measured from the OpenCL profiling information of
+     * the event returned by _execute(), so it is only available if
+     * AQUAgpusph has been compiled with AQUAGPUSPH_GPU_PROFILE=ON.
+     * Otherwise 0 is returned.
+     *
+     * @param averaged true if the avergaed time step is required, false
+     * otherwise.
+     * @return time consumed in the device.
+     * @note Tools enqueueing several commands are just reporting the time
+     * consumed by the command associated to the returned event.
+     * @note Since the profiling information can be only collected once the
+     * event is completed, it is actually collected at the next execution of
+     * the tool, i.e. the device time is reported with a delay of one
+     * execution.
+     */
+    float deviceElapsedTime(bool averaged=true) const {
+        if(!averaged)
+            return _device_elapsed_time;
+        return _average_device_elapsed_time;
+    }
+
+    /** Get the time consumed in the device variance.
+     * @return Time consumed in the device variance.
+     * @see deviceElapsedTime()
+     */
+    float deviceElapsedTimeVariance() const {
+        return _squared_device_elapsed_time -
+               pow(_average_device_elapsed_time, 2);
+    }
+
+    /** Get the time consumed in the device standard deviation.
+     * @return Time consumed in the device standard deviation.
+     * @see deviceElapsedTime()
+     */
+    float deviceElapsedTimeDeviation() const {
+        return sqrt(deviceElapsedTimeVariance());
+    }
+
     /** Get the scope modifier
      *
      * Scopes can be used to create groups of tools that can be eventually
@@ -134,33 +214,6 @@ public:
      * @note scopes shall be always balanced
      */
     virtual const int scope_modifier(){return 0;}
-protected:
-    /** Get the tool index in the pipeline
-     * @return Index of the tool in the pipeline. -1 if the tool cannot be find
-     */
-    int id_in_pipeline();
-
-    /** Set the next tool to be executed in the pipeline.
-     * @param tool Next tool to be executed. NULL if this is the last tool of
-     * the pipeline
-     */
-    void next_tool(Tool* tool){_next_tool = tool;}
-
-    /** Set the allocated memory for this tool.
-     * @param mem_size allocated memory by this tool.
-     */
-    void allocatedMemory(size_t mem_size){_allocated_memory = mem_size;}
-
-    /** Execute the tool
-     * @param events List of events that shall be waited before safe execution
-     * @return OpenCL event to be waited before accessing the dependencies
-     */
-    virtual cl_event _execute(const std::vector<cl_event> events){return NULL;}
-
-    /** @brief Add new data to the average and squared elapsed times
-     * @param elapsed_time Elapsed time
-     */
-    void addElapsedTime(float elapsed_time);
 
     /** @brief Set the depedencies of the tool
      *
@@ -186,6 +239,14 @@ protected:
      */
     const std::vector<InputOutput::Variable*> getDependencies();
 
+    /** @brief Get the tool being executed by the calling thread
+     *
+     * It is used to attribute the host work, e.g. the variables syncing (see
+     * Aqua::InputOutput::Variable::stalls()), to the tools.
+     * @return The tool whose execute() is running, NULL if none
+     */
+    static Tool* current();
+
     /** @brief Compile an OpenCL source code and generate the corresponding
      * kernel
      *
@@ -201,6 +262,9 @@ protected:
      *   - -cl-mad-enable -cl-fast-relaxed-math
      *   - -DHAVE_2D/-DHAVE_3D depending on whether 2D or 3D is considered
      * @return Kernel instances
+     * @note If the programs cache is enabled (see
+     * Aqua::InputOutput::ProblemSetup::sphSettings::cache_path), the program
+     * binary is reloaded from the cache when available, and stored otherwise
      */
     static std::vector<cl_kernel> compile(const std::string source,
                                           const std::vector<std::string> names,
@@ -225,6 +289,73 @@ protected:
     static cl_kernel compile_kernel(const std::string source,
                                     const std::string kernel_name,
                                     const std::string flags="");
+protected:
+    /** Get the tool index in the pipeline
+     * @return Index of the tool in the pipeline. -1 if the tool cannot be find
+     */
+    int id_in_pipeline();
+
+    /** Set the next tool to be executed in the pipeline.
+     * @param tool Next tool to be executed. NULL if this is the last tool of
+     * the pipeline
+     */
+    void next_tool(Tool* tool){_next_tool = tool;}
+
+    /** Set the allocated memory for this tool.
+     * @param mem_size allocated memory by this tool.
+     */
+    void allocatedMemory(size_t mem_size){_allocated_memory = mem_size;}
+
+    /** Set the device memory allocated for an internal buffer of this tool.
+     *
+     * The named buffers are listed separately by the performance report.
+     * @param buffer Name of the buffer.
+     * @param mem_size allocated memory for the buffer.
+     */
+    void allocatedMemory(const std::string buffer, size_t mem_size){
+        _allocated_buffers[buffer] = mem_size;
+    }
+
+    /** Set the host memory allocated for an internal buffer of this tool.
+     * @param buffer Name of the buffer.
+     * @param mem_size allocated memory for the buffer.
+     */
+    void allocatedHostMemory(const std::string buffer, size_t mem_size){
+        _allocated_host_buffers[buffer] = mem_size;
+    }
+
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accessing the dependencies
+     */
+    virtual cl_event _execute(const std::vector<cl_event> events){return NULL;}
+
+    /** @brief Add new data to the average and squared elapsed times
+     * @param elapsed_time Elapsed time
+     */
+    void addElapsedTime(float elapsed_time);
+
+    /** @brief Add new data to the average and squared device elapsed times
+     * @param elapsed_time Elapsed time in the device
+     */
+    void addDeviceElapsedTime(float elapsed_time);
+
+    /** @brief Get a value selected by a previous autotuning of this tool
+     *
+     * The values are recorded per device and tool in the
+     * Aqua::InputOutput::ProblemSetup::sphSettings::autotune_file file.
+     * @param param Name of the tuned parameter, appended to the tool name in
+     * the record key. It can be empty if the tool is tuning a single value
+     * @param value Recorded value
+     * @return true if the value has been recorded, false otherwise
+     */
+    bool getAutotuned(const std::string param, size_t &value);
+
+    /** @brief Record a value selected by the autotuning of this tool
+     * @param param Name of the tuned parameter (see getAutotuned())
+     * @param value Selected value
+     */
+    void setAutotuned(const std::string param, size_t value);
 private:
     /** @brief Get the list of events that this tool shall wait for
      *
@@ -234,18 +365,38 @@ private:
      */
     const std::vector<cl_event> getEvents();
 
+    /** @brief Collect the device elapsed time of the last execution
+     *
+     * The profiling information of the event stored in #_profiling_event is
+     * collected if the event is already completed. Otherwise the sample is
+     * discarded. In both cases the event is released afterwards.
+     *
+     * If the execution was traced, the device span is also recorded (see
+     * Aqua::InputOutput::Trace)
+     */
+    void sampleDeviceElapsedTime();
+
     /// Kernel name
     std::string _name;
 
     /// true if the tool shall be run just once, false otherwise
     bool _once;
 
+    /// true if the tool shall not be executed, false otherwise
+    bool _skipped;
+
     /// Next tool in the execution pipeline
     Tool* _next_tool;
 
     /// Total auxiliar memory allocated in the device
     size_t _allocated_memory;
 
+    /// Auxiliar memory allocated in the device by each named buffer
+    std::map<std::string, size_t> _allocated_buffers;
+
+    /// Auxiliar memory allocated in the host by each named buffer
+    std::map<std::string, size_t> _allocated_host_buffers;
+
     /// Times that this tool has been called
     unsigned int _n_iters;
 
@@ -258,6 +409,26 @@ private:
     /// Average squared elapsed time
     float _squared_elapsed_time;
 
+    /// Times that the device elapsed time has been sampled
+    unsigned int _n_device_iters;
+
+    /// Device elapsed time
+    float _device_elapsed_time;
+
+    /// Average device elapsed time
+    float _average_device_elapsed_time;
+
+    /// Average squared device elapsed time
+    float _squared_device_elapsed_time;
+
+    /// Event of the last execution, to be profiled
+    cl_event _profiling_event;
+
+    /** @brief Trace time when the last execution was enqueued, negative if
+     * it was not traced
+     */
+    double _profiling_trace_time;
+
     /// List of dependencies
     std::vector<InputOutput::Variable*> _vars;
 
@@ -65,11 +65,60 @@ public:
      */
     InputOutput::ArrayVariable* input(){return _var;}
 
+    /** Get the permutations variable.
+     * @return The variable with the original id of each particle.
+     */
+    InputOutput::ArrayVariable* permutations(){return _id_var;}
+
     /** Get the memory object where the unsorted data is stored.
      * @return The memory object where the unsorted data is stored.
      */
     cl_mem output(){return _output;}
 
+    /** Register a command reading the output memory object.
+     *
+     * The downloads of the unsorted data are not waited by the host,
+     * therefore the next execution shall wait for them before overwriting the
+     * output memory object.
+     * @param event Reading command event. It is retained until the next
+     * execution.
+     */
+    void addReader(cl_event event);
+
+    /** Get the commands reading the output memory object, which are not
+     * tracked anymore by this tool.
+     * @return Reading commands events. The caller shall release them.
+     * @see addReader()
+     */
+    std::vector<cl_event> takeReaders();
+
+    /** Check whether the output memory object is up to date.
+     *
+     * The output is considered up to date if neither the input variable nor
+     * the permutations have changed since the last time the output was
+     * updated (see updated()).
+     * @param version Version of the permutations, which shall match the one
+     * registered with updated().
+     * @param first First required particle (unsorted index).
+     * @param n Number of required particles.
+     * @return true if the output can be reused, false otherwise.
+     */
+    bool upToDate(unsigned int version,
+                  unsigned int first,
+                  unsigned int n) const;
+
+    /** Register that the output memory object has been updated.
+     * @param event Updating event, which has been set to the input variable.
+     * It is retained until the next update.
+     * @param version Version of the permutations used.
+     * @param first First updated particle (unsorted index).
+     * @param n Number of updated particles.
+     */
+    void updated(cl_event event,
+                 unsigned int version,
+                 unsigned int first,
+                 unsigned int n);
+
 protected:
     /** Execute the tool
      * @param events List of events that shall be waited before safe execution
@@ -124,6 +173,16 @@ private:
     size_t _local_work_size;
     /// Number of elements
     unsigned int _n;
+
+    /// Commands reading the output memory object
+    std::vector<cl_event> _readers;
+
+    /// Event of the last output update
+    cl_event _updated_event;
+    /// Version of the permutations in the last output update
+    unsigned int _updated_version;
+    /// Particles updated in the last output update
+    uivec2 _updated_bounds;
 };
 
 }}  // namespace
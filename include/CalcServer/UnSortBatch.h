@@ -0,0 +1,120 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Unsort several arrays in a single kernel launch.
+ * (See Aqua::CalcServer::UnSortBatch for details)
+ */
+
+#ifndef UNSORTBATCH_H_INCLUDED
+#define UNSORTBATCH_H_INCLUDED
+
+#include <vector>
+#include <CalcServer.h>
+#include <CalcServer/Tool.h>
+#include <CalcServer/UnSort.h>
+
+namespace Aqua{ namespace CalcServer{
+
+/** @class UnSortBatch UnSortBatch.h CalcServer/UnSortBatch.h
+ * @brief Unsort several arrays in a single kernel launch.
+ *
+ * The data is unsorted in the output memory objects of a set of
+ * Aqua::CalcServer::UnSort tools, which are sharing the same permutations. The
+ * kernel is generated for the given arrays, copying each particle component
+ * as a set of words.
+ *
+ * The unsorting can be restricted to a range of particles (see range()), in
+ * which case just the data of those particles is read and written. This way
+ * the reports tracking a few particles can gather them without moving the
+ * whole arrays.
+ *
+ * This tool is not designed for the common usage but as an auxiliar tool for
+ * the savers, therefore it will not be selectable for the users (see
+ * Aqua::CalcServer::CalcServer::getUnsorters()).
+ */
+class UnSortBatch : public Aqua::CalcServer::Tool
+{
+public:
+    /** Constructor
+     * @param name Tool name
+     * @param unsorters Unsorting tools, where the output memory objects are
+     * taken from. They shall be already set up.
+     */
+    UnSortBatch(const std::string name, std::vector<UnSort*> unsorters);
+
+    /** Destructor.
+     */
+    ~UnSortBatch();
+
+    /** Initialize the tool.
+     */
+    void setup();
+
+    /** Set the range of particles to be unsorted in the next executions.
+     * @param first First particle (unsorted index).
+     * @param n Number of particles.
+     */
+    void range(unsigned int first, unsigned int n);
+
+protected:
+    /** Execute the tool
+     * @param events List of events that shall be waited before safe execution
+     * @return OpenCL event to be waited before accessing the dependencies
+     */
+    cl_event _execute(const std::vector<cl_event> events);
+
+private:
+    /** Setup the OpenCL stuff
+     */
+    void setupOpenCL();
+
+    /** Update the input looking for changed value.
+     */
+    void setVariables();
+
+    /// Unsorting tools
+    std::vector<UnSort*> _unsorters;
+
+    /// ID variable
+    InputOutput::ArrayVariable *_id_var;
+
+    /// ID Memory object sent
+    cl_mem _id_input;
+
+    /// Memory objects sent
+    std::vector<cl_mem> _inputs;
+
+    /// OpenCL kernel
+    cl_kernel _kernel;
+
+    /// Global work size
+    size_t _global_work_size;
+    /// Local work size
+    size_t _local_work_size;
+    /// Number of elements
+    unsigned int _n;
+    /// First particle to unsort
+    unsigned int _first;
+    /// Number of particles to unsort
+    unsigned int _n_range;
+};
+
+}}  // namespace
+
+#endif // UNSORTBATCH_H_INCLUDED
@@ -32,6 +32,9 @@
 #include <CalcServer.h>
 #include <InputOutput/State.h>
 #include <InputOutput/Particles.h>
+#include <InputOutput/Writers.h>
+#include <InputOutput/Trace.h>
+#include <InputOutput/Checkpoint.h>
 
 namespace Aqua{
 /// @namespace Aqua::InputOutput Input/Output data interfaces.
@@ -75,6 +78,15 @@ public:
      */
     std::string inputFile(){return _in_file;}
 
+    /** @brief Resume the simulation from the latest checkpoint.
+     *
+     * The latest checkpoint is looked for using
+     * Aqua::InputOutput::ProblemSetup::sphSettings::checkpoint_path. If no
+     * checkpoint is found, the simulation starts from the particles files.
+     * @param restart true to resume from the latest checkpoint.
+     */
+    void restart(bool restart){_restart = restart;}
+
     /** @brief Get the simulation setup, extracted from the XML definition files
      *
      * AQUAgpusph simulations are built on top of a XML definition file. Such
@@ -97,6 +109,8 @@ public:
      *       the data in Aqua::InputOutput::ProblemSetup.
      *    -# Aqua::InputOutput::Particles to load the particles fields data,
      *       storing it in Aqua::CalcServer::CalcServer.
+     *    -# Aqua::InputOutput::Checkpoint to restore all the variables
+     *       instead, if a restart checkpoint has been set.
      *
      * @return The built Calculation server, NULL if errors happened.
      */
@@ -115,16 +129,34 @@ public:
      */
     void save(float t);
 
+    /** @brief Write a checkpoint, and the XML definition file to resume the
+     * simulation from it.
+     *
+     * @param t Simulation time
+     * @see Aqua::InputOutput::Checkpoint
+     */
+    void checkpoint(float t);
+
     /** @brief Wait for the parallel saving threads.
      *
-     * Some savers may optionally launch parallel threads to save the data, in
-     * an asynchronous way, in order to improve the performance. In such a case,
+     * The savers and the reports are writing the files in a pool of parallel
+     * threads, in an asynchronous way, in order to improve the performance.
      * AQUAgpusph shall wait them to finish before proceeding to destroy the
      * data
-     * @see Aqua::InputOutput::VTK::waitForSavers()
+     * @see Aqua::InputOutput::Writers
      */
     void waitForSavers();
 private:
+    /** @brief Execute the loaders of all the sets.
+     *
+     * The loaders which are thread safe (see
+     * Aqua::InputOutput::Particles::concurrentLoad()) are executed in a pool
+     * of threads, such that the startup is bounded by the largest set, instead
+     * of by the sum of all of them. Each loader is sending its data with
+     * non-blocking writes into its own range of the arrays.
+     */
+    void loadSets();
+
     /// The XML simulation definition loader/saver
     State _state;
 
@@ -134,11 +166,23 @@ private:
     /// Name of the main XML input file
     std::string _in_file;
 
+    /// Shall the simulation be resumed from the latest checkpoint?
+    bool _restart;
+
     /// The fluid loaders
     std::vector<Particles*> _loaders;
 
     /// The fluid savers
     std::vector<Particles*> _savers;
+
+    /// The writing threads pool
+    Writers *_writers;
+
+    /// The timeline trace, NULL if it is disabled
+    Trace *_trace;
+
+    /// The checkpoints writer/reader
+    Checkpoint *_checkpoint;
 };  // class FileManager
 
 }}  // namespaces
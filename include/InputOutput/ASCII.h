@@ -84,6 +84,26 @@ public:
      */
     void load();
 
+protected:
+    /** @brief Check the fields to be read, allocating the host memory where
+     * they shall be stored.
+     * @param fields Fields to be read.
+     * @param n_fields Number of components of all the fields together, i.e.
+     * the number of columns of the file.
+     * @return Host memory of each field, with room for all the particles.
+     */
+    std::vector<void*> allocFields(const std::vector<std::string> fields,
+                                   unsigned int &n_fields);
+
+    /** @brief Send the read data to the device.
+     *
+     * The host memory is released afterwards.
+     * @param fields Read fields.
+     * @param data Host memory of each field, as returned by allocFields().
+     */
+    void uploadFields(const std::vector<std::string> fields,
+                      std::vector<void*> &data);
+
 private:
     /** @brief Compute the number of particles handled by this instance
      * @return Number of particles
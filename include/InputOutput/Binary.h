@@ -0,0 +1,139 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Particles binary data files loader/saver.
+ * (See Aqua::InputOutput::Binary for details)
+ */
+
+#ifndef BINARY_H_INCLUDED
+#define BINARY_H_INCLUDED
+
+#include <sphPrerequisites.h>
+#include <InputOutput/Particles.h>
+
+#ifndef BINARY_ALIGNMENT
+    /// Alignment in bytes of the header and the fields blocks
+    #define BINARY_ALIGNMENT 64
+#endif // BINARY_ALIGNMENT
+
+namespace Aqua{
+namespace InputOutput{
+
+/** @class Binary Binary.h InputOutput/Binary.h
+ * @brief Binary particles data files loader/saver.
+ *
+ * The file starts with a plain text header, with the following lines:
+ * @code
+    AQUAgpusph binary
+    n 1000
+    t 0.5
+    field r 4 16 0000000000000128 <f4 vec*
+    field imove 1 4 0000000000016128 <i4 int*
+    end
+ * @endcode
+ * where the first line is the signature, the second one the number of
+ * particles and the third one the simulation time. Then each field is
+ * described by its name, the number of components, the size in bytes of
+ * each particle, the offset in bytes of the data block from the file start,
+ * the numpy data type of the components, and the AQUAgpusph type. The header
+ * is padded with spaces, such that the block of the first field starts at a
+ * multiple of #BINARY_ALIGNMENT bytes.
+ *
+ * Then the data blocks of the fields come, in the same order, each one
+ * storing the values of all the particles contiguously, as they are stored
+ * in the device, and padded to #BINARY_ALIGNMENT bytes as well.
+ * Hence the files are directly written from the downloaded arrays, and
+ * loaded without parsing. They can also be easily read with numpy:
+ * @code{.py}
+    import numpy as np
+    fields = {}
+    with open(path, 'rb') as f:
+        for line in f:
+            words = line.decode().split()
+            if words[0] == 'n':
+                n = int(words[1])
+            elif words[0] == 'field':
+                fields[words[1]] = np.memmap(path, dtype=words[5], mode='r',
+                    offset=int(words[4]), shape=(n, int(words[2])))
+            elif words[0] == 'end':
+                break
+ * @endcode
+ *
+ * @warning The data is stored with the host endianness, which is reported
+ * in the numpy data types.
+ */
+class Binary : public Particles
+{
+public:
+    /** @brief Constructor
+     * @param sim_data Simulation data
+     * @param iset Particles set index.
+     * @param offset First particle managed by this saver/loader.
+     * @param n Number of particles managed by this saver/loader. If 0,
+     * the number of particles will be obtained from the input file (thus only
+     * valid for loaders)
+     */
+    Binary(ProblemSetup& sim_data,
+           unsigned int iset,
+           unsigned int offset,
+           unsigned int n=0);
+
+    /// Destructor
+    ~Binary();
+
+    /** @brief Save the data.
+     *
+     * @param t Simulation time
+     */
+    void save(float t);
+
+    /** @brief Load the data.
+     *
+     * The file is mapped in memory, and each field block is directly sent to
+     * the device.
+     */
+    void load();
+
+    /** @brief The files are parsed without shared state, so several sets can
+     * be simultaneously loaded.
+     * @return true
+     */
+    bool concurrentLoad() const {return true;}
+
+private:
+    /** @brief Compute the number of particles handled by this instance
+     * @return Number of particles
+     */
+    const unsigned int compute_n();
+
+    /** @brief Create a new file to write.
+     * @return The file handler, NULL if errors happened.
+     * @see Aqua::InputOutput::Particles::file(const char* basename,
+     *                                         unsigned int start_index,
+     *                                         unsigned int digits=5)
+     */
+    FILE* create();
+
+    /// Next output file index
+    unsigned int _next_file_index;
+};  // class InputOutput
+
+}}  // namespaces
+
+#endif // BINARY_H_INCLUDED
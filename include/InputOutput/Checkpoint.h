@@ -0,0 +1,105 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Simulation checkpoints writer/reader.
+ * (See Aqua::InputOutput::Checkpoint for details)
+ */
+
+#ifndef CHECKPOINT_H_INCLUDED
+#define CHECKPOINT_H_INCLUDED
+
+#include <sphPrerequisites.h>
+#include <string>
+#include <ProblemSetup.h>
+
+namespace Aqua{
+namespace InputOutput{
+
+/** @class Checkpoint Checkpoint.h InputOutput/Checkpoint.h
+ * @brief Binary snapshot of all the simulation variables.
+ *
+ * Differently to the particles savers, which are writing just the selected
+ * fields of each set, unsorted, the checkpoints are storing verbatim all the
+ * registered variables, including the scalars and the arrays in the sorted
+ * space of the device, e.g. "id_sorted" and "id_unsorted". Hence the
+ * simulation can be resumed right at the same state, without parsing the
+ * particles files nor rebuilding the sorting permutations.
+ *
+ * The file follows the same layout than the Aqua::InputOutput::Binary files:
+ * @code
+    AQUAgpusph checkpoint
+    t 0.5
+    var r 0000000000000128 16000 vec*
+    var dt 0000000000016128 4 float
+    end
+ * @endcode
+ * where each variable is described by its name, the offset in bytes of its
+ * data block from the file start, the size of the block in bytes, and the
+ * AQUAgpusph type. The header and the blocks are padded to
+ * #BINARY_ALIGNMENT bytes.
+ *
+ * The arrays are asynchronously downloaded to pinned memory, and the file is
+ * written by Aqua::InputOutput::Writers, so the simulation is just blocked
+ * while the downloads are enqueued.
+ *
+ * @see Aqua::InputOutput::ProblemSetup::sphSettings::checkpoint_interval
+ * @warning The checkpoints are not portable between different platforms,
+ * since the data is stored with the host endianness.
+ */
+class Checkpoint
+{
+public:
+    /** @brief Constructor
+     * @param sim_data Simulation data
+     */
+    Checkpoint(ProblemSetup& sim_data);
+
+    /// Destructor
+    ~Checkpoint();
+
+    /** @brief Write a checkpoint.
+     *
+     * The file path is built from
+     * Aqua::InputOutput::ProblemSetup::sphSettings::checkpoint_path
+     * (see Aqua::newFilePath()).
+     * @param t Simulation time
+     * @return The checkpoint file path
+     * @warning The file is not complete until the writers are done.
+     */
+    std::string save(float t);
+
+    /** @brief Restore the variables from a checkpoint.
+     *
+     * The variables which are not registered, or whose type or size does not
+     * match, are skipped with a warning.
+     * @param path Checkpoint file path
+     */
+    void load(const std::string path);
+
+private:
+    /// Simulation data
+    ProblemSetup &_sim_data;
+
+    /// Next checkpoint file index
+    unsigned int _next_file_index;
+};  // class Checkpoint
+
+}}  // namespaces
+
+#endif // CHECKPOINT_H_INCLUDED
@@ -52,6 +52,8 @@ namespace InputOutput{
  * @remarks In the case of integer numbers (signed or unsigned) this class does
  * not care about decimal points, just truncating the value, i.e. 1.5 will be
  * interpreted as 1, and -1.5 will be interpreted as -1.
+ * @remarks Differently to Aqua::InputOutput::ASCII, math expressions are not
+ * accepted, but just plain numbers.
  * @warning Saving the particles data in plain text format may be heavily hard
  * disk demanding, and therefore it is strongly recommended to consider binary
  * formats like Aqua::InputOutput::VTK.
@@ -75,18 +77,19 @@ public:
     /// Destructor
     ~FastASCII();
 
-private:
-    /** @brief Extract the field value from a line.
-     * @param field Field name.
-     * @param line Text line,
-     * @param index Index of the particle to read.
-     * @param data Data array.
-     * @return Remaining text after extracting the field values.
+    /** @brief Load the data.
+     *
+     * The file is mapped in memory, and split in chunks of whole lines which
+     * are parsed in parallel threads, writing the values straight on the
+     * fields host memory.
      */
-    std::string readField(const std::string field,
-                          const std::string line,
-                          unsigned int index,
-                          void* data);
+    void load();
+
+    /** @brief The files are parsed without shared state, so several sets can
+     * be simultaneously loaded.
+     * @return true
+     */
+    bool concurrentLoad() const {return true;}
 };  // class InputOutput
 
 }}  // namespaces
@@ -0,0 +1,131 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Particles HDF5 data files loader/saver.
+ * (See Aqua::InputOutput::HDF5 for details)
+ */
+
+#ifndef HDF5_H_INCLUDED
+#define HDF5_H_INCLUDED
+
+#include <sphPrerequisites.h>
+
+#include <hdf5.h>
+
+#include <InputOutput/Particles.h>
+
+namespace Aqua{
+namespace InputOutput{
+
+/** @class HDF5 HDF5.h InputOutput/HDF5.h
+ * @brief HDF5 particles data files loader/saver.
+ *
+ * HDF5 is a hierarchical data format, to learn more about it please visit the
+ * following web page:
+ *
+ * https://www.hdfgroup.org
+ *
+ * Each field selected by
+ * Aqua::InputOutput::ProblemSetup::sphParticlesSet::outputFields() is stored
+ * as a dataset, named as the field, with one row per particle and one column
+ * per component. The AQUAgpusph type of the field is stored in the `type`
+ * attribute of the dataset. The half precision fields are stored as 16 bits
+ * unsigned integers, with the same bits. The simulation time is stored in the
+ * `t` attribute of the file root.
+ *
+ * In MPI runs all the processes are writing the same file, using collective
+ * I/O, instead of a file per process, each one in its own slab of rows.
+ * The number of particles written by each process is stored in the `ranks`
+ * attribute of the file root, such that each process can load back its own
+ * particles. If the file was written with a different number of processes,
+ * the particles are evenly distributed. Thus, the output path shall not
+ * depend on the process index, e.g.:
+ * @code{.xml}
+    <Save format="HDF5" file="output.{index}.h5" fields="r,u,p" />
+ * @endcode
+ *
+ * Since the collective writing needs all the processes, the files are
+ * written in the main thread in MPI runs. Otherwise they are written in
+ * parallel (see Aqua::InputOutput::Writers).
+ */
+class HDF5 : public Particles
+{
+public:
+    /** @brief Constructor
+     * @param sim_data Simulation data
+     * @param iset Particles set index.
+     * @param offset First particle managed by this saver/loader.
+     * @param n Number of particles managed by this saver/loader. If 0,
+     * the number of particles will be obtained from the input file (thus only
+     * valid for loaders)
+     */
+    HDF5(ProblemSetup& sim_data,
+         unsigned int iset,
+         unsigned int offset,
+         unsigned int n=0);
+
+    /// Destructor
+    ~HDF5();
+
+    /** @brief Save the data.
+     *
+     * @param t Simulation time
+     */
+    void save(float t);
+
+    /** @brief Load the data.
+     */
+    void load();
+
+private:
+    /** @brief Compute the number of particles handled by this instance
+     * @return Number of particles
+     */
+    const unsigned int compute_n();
+
+    /** @brief Get the slab of rows of this process in a file
+     * @param file HDF5 file
+     * @param offset First row
+     * @param n Number of rows
+     */
+    void slab(hid_t file, hsize_t &offset, hsize_t &n);
+
+    /** @brief Open a file to read
+     * @param path File path
+     * @return HDF5 file
+     */
+    hid_t open(const std::string path);
+
+    /** @brief Create a new file path to write.
+     *
+     * In MPI runs the path is selected by the first process, and shared with
+     * the others.
+     * @see Aqua::InputOutput::Particles::file(const char* basename,
+     *                                         unsigned int start_index,
+     *                                         unsigned int digits=5)
+     */
+    void create();
+
+    /// Next output file index
+    unsigned int _next_file_index;
+};  // class InputOutput
+
+}}  // namespaces
+
+#endif // HDF5_H_INCLUDED
@@ -29,6 +29,10 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 #if __APPLE__
     #include <OpenCL/cl.h>
 #else
@@ -67,6 +71,14 @@
     #define LOG0(level, log) Aqua::InputOutput::Logger::singleton()->addMessage(level, log)
 #endif
 
+#ifndef LOGGER_REFRESH_PERIOD
+    /** @def LOGGER_REFRESH_PERIOD
+     * Minimum time, in seconds, between consecutive ncurses terminal
+     * refreshes.
+     */
+    #define LOGGER_REFRESH_PERIOD 0.1
+#endif
+
 namespace Aqua{
 
 enum TLogLevel {L_DEBUG, L_INFO, L_WARNING, L_ERROR};
@@ -79,6 +91,17 @@ namespace InputOutput{
  * AQUAgpusph is generating, during runtime, an HTML log file, placed in the
  * execution folder, and named log.X.html, where X is replaced by the first
  * unsigned integer which generates a non-existing file.
+ *
+ * The messages and the reports are not formatted nor printed by the calling
+ * thread. Instead, they are pushed to a lock-free queue, which is consumed by
+ * a background thread. Such thread is also the only one calling ncurses,
+ * and it is refreshing the screen at most each #LOGGER_REFRESH_PERIOD
+ * seconds, showing the last complete frame, i.e. the reports written
+ * between the last initFrame() and endFrame() calls. Hence the simulation
+ * is not slowed down by the terminal at high time step rates.
+ *
+ * The error messages are flushed before returning, so they are already in
+ * the log file if the simulation is aborted afterwards.
  */
 struct Logger : public Aqua::Singleton<Aqua::InputOutput::Logger>
               , public Aqua::InputOutput::Report
@@ -169,6 +192,10 @@ public:
      * @param t Simulation time
      */
     void save(float t) {};
+
+    /** @brief Wait until all the queued messages and reports are printed.
+     */
+    void flush();
 protected:
     /** @brief Print the log record
      *
@@ -187,6 +214,110 @@ protected:
     /// Close the log file
     void close();
 private:
+    /// Kind of queued records
+    typedef enum {
+        /// Log message, see addMessage()
+        RECORD_MESSAGE,
+        /// Report, see writeReport()
+        RECORD_REPORT,
+        /// Frame start, see initFrame()
+        RECORD_INIT_FRAME,
+        /// Frame end, see endFrame()
+        RECORD_END_FRAME,
+        /// Terminal initialization, see initNCurses()
+        RECORD_INIT_NCURSES,
+        /// Terminal restoration, see endNCurses()
+        RECORD_END_NCURSES,
+    } record_kind;
+
+    /// A queued record
+    struct record {
+        /// Kind of record
+        record_kind kind;
+        /// Message level
+        TLogLevel level;
+        /// Message or report text
+        std::string text;
+        /// Function name for the messages, color for the reports
+        std::string extra;
+        /// Bold reports, or messages to be printed on screen
+        bool bold;
+        /// Next record in the queue
+        record *next;
+    };
+
+    /** @brief Push a record to the queue
+     * @param kind Kind of record
+     * @param level Message level
+     * @param text Message or report text
+     * @param extra Function name for the messages, color for the reports
+     * @param bold Bold reports, or messages to be printed on screen
+     */
+    void push(record_kind kind,
+              TLogLevel level=L_DEBUG,
+              std::string text="",
+              std::string extra="",
+              bool bold=false);
+
+    /** @brief Background thread main loop
+     */
+    void worker();
+
+    /** @brief Process a record popped from the queue
+     * @param r Record. The reports are moved to the frames
+     */
+    void process(record *r);
+
+    /** @brief Write a message in the log file and in the log registry
+     * @param level Message classification (L_DEBUG, L_INFO, L_WARNING, L_ERROR)
+     * @param log Log message.
+     * @param func Function name to print, empty if it should not be printed.
+     * @param screen false if the message shall be just written in the log
+     * file
+     */
+    void printMessage(TLogLevel level,
+                      std::string log,
+                      std::string func,
+                      bool screen=true);
+
+    /** @brief Print a report in the ncurses terminal
+     * @param msg Report text
+     * @param color Color name
+     * @param bold true if bold font should be used, false otherwise
+     * @see writeReport()
+     */
+    void printReport(std::string msg, std::string color, bool bold);
+
+    /** @brief Redraw the ncurses terminal with the last complete frame
+     */
+    void printFrame();
+
+    /// Top of the queue of records, in reverse order
+    std::atomic<record*> _queue;
+    /// Number of records pushed to the queue
+    std::atomic<unsigned long> _n_pushed;
+    /// Number of records already processed
+    unsigned long _n_processed;
+    /// true when the background thread shall exit
+    std::atomic<bool> _stop;
+    /// Background thread
+    std::thread _thread;
+    /// Mutex for the conditions
+    std::mutex _cv_mutex;
+    /// Condition to wake up the background thread
+    std::condition_variable _cv_queue;
+    /// Condition to wake up the threads waiting on flush()
+    std::condition_variable _cv_processed;
+
+    /// Reports of the frame being built
+    std::vector<record> _frame;
+    /// Reports of the last complete frame
+    std::vector<record> _last_frame;
+    /// true if the terminal shall be redrawn
+    bool _dirty;
+    /// Time of the last terminal refresh
+    struct timeval _refresh_time;
+
     /// Last row where datas was printed (used to locate the registry position)
     int _last_row;
 
@@ -30,6 +30,11 @@
 #include <InputOutput/InputOutput.h>
 
 namespace Aqua{
+
+namespace CalcServer{
+    class OutputFilter;
+}
+
 namespace InputOutput{
 
 /** \class Particles Particles.h InputOutput/Particles.h
@@ -44,6 +49,23 @@ namespace InputOutput{
  *   -# Particles data loading at the start of simulations.
  *   -# Visualization of the simulation results.
  *
+ * The saved particles can be decimated, or restricted to a region of interest,
+ * with the following output options (see
+ * Aqua::InputOutput::ProblemSetup::sphParticlesSet::outputOption()):
+ *   - `stride`: Just every k-th particle of the set is saved.
+ *   - `box_min`, `box_max`: Just the particles inside the box are saved.
+ *   - `select`: Just the particles where this scalar field is in the range
+ *     [`select_min`, `select_max`] are saved.
+ *
+ * The particles are selected in the computational device (see
+ * Aqua::CalcServer::OutputFilter), such that just the selected particles are
+ * downloaded. For instance:
+ * @code{.xml}
+    <Save format="VTK" file="output" fields="r,u,p" stride="4"
+          box_min="-0.5, -0.5" box_max="0.5, 0.5"
+          select="imove" select_min="1" select_max="1" />
+ * @endcode
+ *
  * @see Aqua::InputOutput::InputOutput
  * @see Aqua::InputOutput::Report
  * @see Aqua::InputOutput::State
@@ -77,14 +99,32 @@ public:
      */
     unsigned int n() {return _bounds.y - _bounds.x;}
 
-    /** @brief Wait for the eventual parallel saving threads.
+    /** @brief Wait for the parallel saving threads.
+     *
+     * The savers are downloading the data, and then they are queueing the
+     * writing tasks in Aqua::InputOutput::Writers, such that the files are
+     * written in an asynchronous way. Therefore, AQUAgpusph shall wait them to
+     * finish before proceeding to destroy the data
+     */
+    virtual void waitForSavers();
+
+    /** Wait for a field download, releasing the event afterwards.
+     *
+     * It can be called from the writing threads.
+     * @param event Download event, as returned by
+     * download(std::vector<std::string>, std::vector<cl_event>&)
+     * @return false if errors happened, true otherwise
+     */
+    static bool waitForDownload(cl_event event);
+
+    /** @brief Can this loader be executed in parallel with other ones?
      *
-     * Some savers may optionally launch parallel threads to save the data, in
-     * an asynchronous way, in order to improve the performance. In such a case,
-     * AQUAgpusph shall wait them to finish before proceeding to destroy the
-     * data
+     * The loaders of the sets are concurrently executed on startup, except
+     * the ones which are not thread safe, which are sequentially executed.
+     * @return false by default
+     * @see Aqua::InputOutput::FileManager::load()
      */
-    virtual void waitForSavers() {return;}
+    virtual bool concurrentLoad() const {return false;}
 protected:
     /** @brief Get the simulation data structure
      *
@@ -115,6 +155,14 @@ protected:
      */
     void loadDefault();
 
+    /** @brief Wait for the fields uploads, releasing the events afterwards.
+     *
+     * The loaders are sending the data with non-blocking writes, such that
+     * several fields can be simultaneously transferred.
+     * @param events Upload events. The list is cleared afterwards.
+     */
+    static void waitForUploads(std::vector<cl_event> &events);
+
     /** @brief Set the file name.
      * @param filename The new file to save/load. Optionally a null parameter
      * can be passed in order to clear the stored file name.
@@ -139,13 +187,50 @@ protected:
      * @param fields Fields to download
      * @return host allocated memory
      * @note The returned data must be manually cleared.
+     * @note Just nDownloaded() particles are downloaded if an output filter
+     * has been set.
      */
     std::vector<void*> download(std::vector<std::string> fields);
+
+    /** Start downloading the data from the device, without waiting for it.
+     *
+     * This way the simulation can be resumed while the data is being
+     * transferred, and the writers can start encoding a field while the next
+     * ones are still being downloaded.
+     * @param fields Fields to download
+     * @param events Download event of each field, to be waited by
+     * waitForDownload() before accessing the field data. NULL events are
+     * appended if nothing has been selected to be downloaded.
+     * @return host allocated memory
+     * @note The returned data must be manually cleared, after waiting for all
+     * the events.
+     */
+    std::vector<void*> download(std::vector<std::string> fields,
+                                std::vector<cl_event> &events);
+
+    /** @brief Get the number of particles downloaded by the last download()
+     * @return Number of downloaded particles, which is n() unless an output
+     * filter has been set.
+     */
+    unsigned int nDownloaded() const {return _n_download;}
+
+    /// Number of particles downloaded by the last download()
+    unsigned int _n_download;
 private:
     /** Remove the content of the data list.
      * @param data List of memory allocated arrays to be cleared.
+     * @param events Pending download events, which are waited before
+     * releasing the memory.
      */
-    void clearList(std::vector<void*> *data);
+    void clearList(std::vector<void*> *data,
+                   std::vector<cl_event> *events=NULL);
+
+    /** Get the output filter, which is built the first time this method is
+     * called
+     * @return The output filter, NULL if no filtering output options have
+     * been set.
+     */
+    CalcServer::OutputFilter* outputFilter();
 
     /// Simulation data
     ProblemSetup _sim_data;
@@ -158,6 +243,11 @@ private:
 
     /// Last file printed
     std::string _output_file;
+
+    /// Output filter
+    CalcServer::OutputFilter *_filter;
+    /// true if the output options have been already checked
+    bool _filter_checked;
 };  // class InputOutput
 
 }}  // namespaces
@@ -0,0 +1,227 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file
+ * @brief Timeline traces of the simulation.
+ * (See Aqua::InputOutput::Trace for details)
+ */
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <sphPrerequisites.h>
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#include <Singleton.h>
+
+namespace Aqua{
+namespace InputOutput{
+
+/** @class Trace Trace.h InputOutput/Trace.h
+ * @brief Timeline of the host and device activity, in Chrome trace format.
+ *
+ * The time averages of Aqua::CalcServer::Tool cannot tell when the tools,
+ * the device, the MPI messages and the writers are overlapping. Hence, along
+ * a window of time steps, the spans of the following activities are recorded:
+ *    -# The host execution of each tool, i.e. Aqua::CalcServer::Tool::execute()
+ *    -# The device execution of each tool, if AQUAgpusph is compiled with
+ *    GPU profiling (see Aqua::CalcServer::Tool::sampleDeviceElapsedTime())
+ *    -# The MPI barriers and the Aqua::CalcServer::MPISync messages
+ *    -# The writing tasks of Aqua::InputOutput::Writers
+ *    -# The asynchronous Python tools
+ *    -# The host blocked syncing the variables, named after the variable and
+ *    the tool requesting it (see Aqua::InputOutput::Variable::stalls())
+ *
+ * Each thread is storing its spans in its own ring buffer, so there is no
+ * locking while recording. At the end of the window the spans are written in
+ * a Chrome trace JSON file, which can be loaded in chrome://tracing or
+ * https://ui.perfetto.dev. The metadata of the file lists the top host
+ * stall sources since the simulation start.
+ *
+ * @see Aqua::InputOutput::ProblemSetup::sphSettings::trace_path
+ */
+class Trace : public Aqua::Singleton<Aqua::InputOutput::Trace>
+{
+public:
+    /** @brief Constructor
+     * @param path Output file path. Several scape strings can be used, as
+     * described in Aqua::setStrConstants()
+     * @param start First time step to be traced
+     * @param iters Number of time steps to be traced
+     * @param capacity Number of spans stored per thread
+     */
+    Trace(const std::string path,
+          unsigned int start=0,
+          unsigned int iters=10,
+          unsigned int capacity=65536);
+
+    /** @brief Destructor
+     *
+     * If the window is not finished yet, the trace is written anyway.
+     */
+    ~Trace();
+
+    /** @brief Start or stop the recording.
+     *
+     * It shall be called by the main thread at the start of each time step.
+     * @param iter Time step index
+     */
+    void step(unsigned int iter);
+
+    /** @brief Check whether the spans are currently recorded
+     * @return true if the time step is within the window, false otherwise
+     */
+    bool recording() const {return _recording.load(std::memory_order_relaxed);}
+
+    /** @brief Get the time since the trace creation
+     * @return Time, in microseconds
+     */
+    double now() const;
+
+    /** @brief Record a span in the ring buffer of the calling thread
+     * @param category Span category. It shall be a string literal
+     * @param name Span name, which is truncated if it is too long
+     * @param t0 Starting time, in microseconds (see now())
+     * @param t1 Ending time, in microseconds (see now())
+     * @param device true if the span is the device execution of a command,
+     * false if it is an activity of the calling thread
+     */
+    void span(const char *category,
+              const char *name,
+              double t0,
+              double t1,
+              bool device=false);
+
+    /** @brief Set the name of the calling thread on the timeline
+     * @param name Thread name
+     */
+    void threadName(const std::string name);
+
+private:
+    /// A recorded span
+    typedef struct {
+        /// Name
+        char name[48];
+        /// Category
+        const char *category;
+        /// Starting time
+        double t0;
+        /// Ending time
+        double t1;
+        /// Device span
+        bool device;
+    } Span;
+
+    /// Ring buffer of a thread
+    typedef struct {
+        /// Spans
+        std::vector<Span> spans;
+        /// Number of recorded spans, which may exceed the capacity
+        std::atomic<size_t> head;
+        /// Thread identifier on the timeline
+        unsigned int tid;
+        /// Thread name
+        std::string name;
+    } Ring;
+
+    /** @brief Get the ring buffer of the calling thread, creating it the
+     * first time
+     * @return Ring buffer
+     */
+    Ring* ring();
+
+    /** @brief Write the trace file
+     */
+    void dump();
+
+    /// Output file path
+    std::string _path;
+    /// First time step to be traced
+    unsigned int _start;
+    /// Number of time steps to be traced
+    unsigned int _iters;
+    /// Number of spans stored per thread
+    unsigned int _capacity;
+    /// Process identifier on the timeline, i.e. the MPI rank
+    unsigned int _pid;
+    /// true if the spans are currently recorded
+    std::atomic<bool> _recording;
+    /// true if the trace has been already written
+    bool _dumped;
+    /// Time origin
+    std::chrono::steady_clock::time_point _t0;
+
+    /// Ring buffers of all the threads
+    std::vector<Ring*> _rings;
+    /// Ring buffers registration guard
+    std::mutex _mutex;
+};  // class Trace
+
+/** @class TraceSpan Trace.h InputOutput/Trace.h
+ * @brief Record the span of a scope, if the trace is recording.
+ *
+ * @code{.cpp}
+    {
+        TraceSpan span("writer", "write");
+        ...
+    }
+ * @endcode
+ */
+class TraceSpan
+{
+public:
+    /** @brief Constructor
+     * @param category Span category. It shall be a string literal
+     * @param name Span name. It shall be alive until the span is destroyed
+     */
+    TraceSpan(const char *category, const char *name)
+        : _category(category)
+        , _name(name)
+        , _t0(-1.0)
+    {
+        Trace *trace = Trace::singleton();
+        if(trace && trace->recording())
+            _t0 = trace->now();
+    }
+
+    /// Destructor
+    ~TraceSpan()
+    {
+        Trace *trace = Trace::singleton();
+        if(trace && (_t0 >= 0.0))
+            trace->span(_category, _name, _t0, trace->now());
+    }
+
+private:
+    /// Category
+    const char *_category;
+    /// Name
+    const char *_name;
+    /// Starting time, negative if it is not recorded
+    double _t0;
+};  // class TraceSpan
+
+}}  // namespaces
+
+#endif // TRACE_H_INCLUDED
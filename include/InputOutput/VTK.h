@@ -24,11 +24,10 @@
 #ifndef VTK_H_INCLUDED
 #define VTK_H_INCLUDED
 
-#include <pthread.h>
-
 #include <vtkVersion.h>
 #include <vtkSmartPointer.h>
 #include <vtkXMLUnstructuredGridWriter.h>
+#include <vtkXMLWriter.h>
 #include <vtkXMLUnstructuredGridReader.h>
 #include <vtkUnstructuredGrid.h>
 #include <vtkFloatArray.h>
@@ -88,6 +87,24 @@ namespace InputOutput{
  *   -# \f$ \frac{d \rho}{dt} \f$
  *   -# \f$ m \f$
  *   -# moving flag (see Aqua::InputOutput::Fluid::imove)
+ *
+ * The following output options can be set as attributes of the `Save` tag
+ * (see Aqua::InputOutput::ProblemSetup::sphParticlesSet::outputOption()):
+ *   - `mode`: Data mode, either "appended" (raw binary data appended at the
+ *     end of the file), "binary" (base64 encoded data inline) or "ascii".
+ *   - `compressor`: Compressor, either "none", "zlib" or "lz4".
+ *   - `level`: Compression level, from 1 (fastest) to 9 (smallest).
+ *   - `pvtu`: In MPI runs, path of the `.pvtu` files written by the first
+ *     process, which are referencing the pieces of all the processes at each
+ *     frame (see newFilePath()). By default, the path of the first process
+ *     piece with the `.pvtu` extension is considered.
+ *
+ * For instance:
+ * @code{.xml}
+    <Save format="VTK" file="output.proc{mpi_rank}" fields="r,u,p"
+          mode="appended" compressor="lz4" level="3" />
+ * @endcode
+ * The VTK defaults are kept for the non specified options.
  */
 class VTK : public Particles
 {
@@ -118,15 +135,6 @@ public:
      */
     void load();
 
-    /** @brief Wait for the parallel saving threads.
-     *
-     * VTK saver is launching parallel threads to save the data in an
-     * asynchronous way, significantly improving the performance. Therefore,
-     * AQUAgpusph shall wait them to finish before proceeding to destroy the
-     * data
-     */
-    void waitForSavers();
-
 private:
     /** @brief Compute the number of particles handled by this instance
      * @return Number of particles
@@ -164,14 +172,30 @@ private:
      */
     const std::string filenamePVD();
 
+#ifdef HAVE_MPI
+    /** @brief Write the `.pvtu` file referencing the pieces written by all
+     * the processes.
+     *
+     * This method shall be called by all the processes, although just the
+     * first one is writing the file.
+     * @param fields Saved fields
+     */
+    void updatePVTU(const std::vector<std::string> fields);
+#endif
+
+    /** @brief Setup the writer according to the output options
+     * @param f Writer
+     */
+    void setupWriter(vtkXMLUnstructuredGridWriter *f);
+
     /// Next output file index
     unsigned int _next_file_index;
 
     /// PVD file name
     std::string _namePVD;
 
-    /// Launched threads ids
-    std::vector<pthread_t> _tids;
+    /// Last written `.pvtu` file, empty if it has not been written
+    std::string _pvtu_file;
 
 };  // class InputOutput
 
@@ -0,0 +1,170 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Asynchronous output files writers.
+ * (See Aqua::InputOutput::Writers for details)
+ */
+
+#ifndef WRITERS_H_INCLUDED
+#define WRITERS_H_INCLUDED
+
+#include <sphPrerequisites.h>
+
+#include <deque>
+#include <vector>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include <Singleton.h>
+
+namespace Aqua{
+namespace InputOutput{
+
+/** @class Writers Writers.h InputOutput/Writers.h
+ * @brief Pool of threads writing the output files.
+ *
+ * The savers (see Aqua::InputOutput::Particles) and the reports (see
+ * Aqua::CalcServer::Reports::SetTabFile) are downloading the data from the
+ * computational device, and then they are queueing a writing task, in such a
+ * way the simulation can continue while the files are written.
+ *
+ * The number of pending tasks, and optionally the host memory they are
+ * retaining, are limited. When such limits are exceeded, enqueue() is blocking
+ * the simulation until some tasks are done. The time spent waiting is reported
+ * on stats().
+ *
+ * The tasks sharing the same key are executed in the same order they are
+ * queued, one after the other, such that several frames can be appended to the
+ * same file.
+ *
+ * @see Aqua::InputOutput::ProblemSetup::sphSettings::writers_threads
+ */
+class Writers : public Aqua::Singleton<Aqua::InputOutput::Writers>
+{
+public:
+    /** @brief Constructor
+     * @param n_threads Number of writing threads.
+     * @param max_queue Maximum number of pending tasks, including the ones
+     * already running.
+     * @param max_memory Maximum host memory retained by the pending tasks, in
+     * bytes. 0 for unlimited.
+     */
+    Writers(unsigned int n_threads=1,
+            unsigned int max_queue=2,
+            size_t max_memory=0);
+
+    /** @brief Destructor
+     *
+     * The pending tasks are finished before destroying the threads.
+     */
+    ~Writers();
+
+    /** @brief Queue a writing task.
+     *
+     * This method is blocking until there is room enough for the task.
+     * @param task Writing task. It is responsible of releasing its own data.
+     * @param memory Host memory retained by the task, in bytes.
+     * @param key Tasks with the same key are sequentially executed. NULL to
+     * let the task run in parallel with any other one.
+     */
+    void enqueue(std::function<void()> task,
+                 size_t memory=0,
+                 const void *key=NULL);
+
+    /** @brief Wait until all the queued tasks are done.
+     */
+    void wait();
+
+    /** @brief Log the backpressure statistics.
+     */
+    void stats();
+
+    /** @brief Get the number of tasks, either pending or running
+     * @return Number of tasks
+     */
+    unsigned int queued();
+
+    /** @brief Get the host memory retained by the tasks
+     * @return Retained memory, in bytes
+     */
+    size_t queuedMemory();
+
+    /** @brief Get the time spent blocked on enqueue()
+     * @return Time in seconds
+     */
+    double stallTime();
+
+private:
+    /// A pending task
+    typedef struct {
+        /// Function to execute
+        std::function<void()> f;
+        /// Retained memory
+        size_t memory;
+        /// Serialization key
+        const void *key;
+    } task;
+
+    /** @brief Threads main loop
+     */
+    void worker();
+
+    /// Maximum number of tasks
+    unsigned int _max_queue;
+    /// Maximum retained memory
+    size_t _max_memory;
+
+    /// Threads
+    std::vector<std::thread> _threads;
+    /// Pending tasks, not started yet
+    std::deque<task> _tasks;
+    /// Keys of the running tasks
+    std::set<const void*> _running_keys;
+    /// Number of tasks, either pending or running
+    unsigned int _n_tasks;
+    /// Memory retained by the tasks, either pending or running
+    size_t _memory;
+    /// true when the threads shall exit
+    bool _stop;
+
+    /// Mutual exclusion guard
+    std::mutex _mutex;
+    /// Condition to wake up the threads
+    std::condition_variable _cv_task;
+    /// Condition to wake up the producers, when a task is done
+    std::condition_variable _cv_done;
+
+    /// Number of queued tasks
+    unsigned long _n_queued;
+    /// Number of times that enqueue() has been blocked
+    unsigned long _n_stalls;
+    /// Time spent blocked on enqueue()
+    double _stall_time;
+    /// Maximum number of tasks simultaneously queued
+    unsigned int _peak_tasks;
+    /// Maximum memory simultaneously retained
+    size_t _peak_memory;
+};  // class Writers
+
+}}  // namespaces
+
+#endif // WRITERS_H_INCLUDED
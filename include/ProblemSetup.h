@@ -138,6 +138,255 @@ public:
          */
         std::string base_path;
 
+        /** @brief Number of command queues used to dispatch the tools.
+         *
+         * If a single command queue is considered (default value), all the
+         * tools are enqueued in the same out of order command queue.
+         * Otherwise a pool of in-order command queues is created, and the
+         * tools are dispatched among them according to their dependencies, so
+         * the independent tools may overlap on the device.
+         *
+         * This option can be set with the tag `CommandQueues`, for instance:
+         * `<CommandQueues value="4" />`
+         */
+        unsigned int n_queues;
+
+        /** @brief Synchronization of the MPI processes at the start of the
+         * time steps.
+         *
+         * The data exchanged between processes is already synchronized by the
+         * "mpi-sync" tools, so a global barrier is not required for
+         * correctness. However, it can be useful to keep the processes in step
+         * for debugging or profiling purposes. This option can take the
+         * following values:
+         *   - 1 or greater: A barrier is set every barrier_steps time steps.
+         *   - 0: No barriers are set.
+         *   - -1: A barrier is set just at the first time step after each
+         *     output.
+         *
+         * By default, a barrier is set at each time step (barrier_steps = 1).
+         * This option can be set with the tag `StepBarrier`, being the value
+         * either a number of steps, "none" or "output", for instance:
+         * `<StepBarrier value="output" />`
+         *
+         * @note This option is ignored if MPI is not enabled
+         */
+        int barrier_steps;
+
+        /** @brief Folder where the compiled OpenCL programs are cached.
+         *
+         * If it is not empty, the binaries of the compiled OpenCL programs
+         * are stored in this folder, and reloaded in later executions, as
+         * far as the source code, the included files, the compilation flags,
+         * the AQUAgpusph version, the device and the driver are not
+         * changing. Hence the start of the simulation is
+         * significantly accelerated.
+         *
+         * The cache is disabled by default, and it can be enabled with the tag
+         * `ProgramsCache`, for instance:
+         * `<ProgramsCache path="./cl_cache" />`
+         *
+         * Several constants can be used in the path. See
+         * Aqua::setStrConstants()
+         */
+        std::string cache_path;
+
+        /** @brief Automatic tuning of the kernels work group sizes.
+         *
+         * If true, several local work sizes are tested during the first
+         * executions of each Aqua::CalcServer::Kernel tool, measuring the
+         * device time with profiling events. Then the fastest one is locked
+         * in for the rest of the simulation. Similarly, the dimensions of the
+         * Aqua::CalcServer::RadixSort tools, including the ones used by the
+         * link-lists, are tuned during their setup.
+         *
+         * The autotuning is disabled by default, and it can be enabled with
+         * the tag `WorkGroupsAutotune`, for instance:
+         * `<WorkGroupsAutotune value="true" file="./work_groups.dat" />`
+         *
+         * @see autotune_file
+         */
+        bool autotune;
+
+        /** @brief File where the autotuned work group sizes are recorded.
+         *
+         * If it is not empty, the work group sizes selected by the autotuning
+         * are stored in this file, and reused in later executions with the
+         * same device, so the tools are not tested again.
+         *
+         * This file can be set with the `file` attribute of the tag
+         * `WorkGroupsAutotune`. Several constants can be used in the path. See
+         * Aqua::setStrConstants()
+         *
+         * @see autotune
+         */
+        std::string autotune_file;
+
+        /** @brief Zero-copy arrays.
+         *
+         * If true, the arrays are allocated in host accessible memory
+         * (CL_MEM_ALLOC_HOST_PTR), and the transfers between the host and the
+         * device are carried out mapping the buffers, instead of reading and
+         * writing them. Such mode avoids the staging copies of the OpenCL
+         * runtime in the devices sharing the memory with the host, like the
+         * CPUs and the integrated GPUs. It is automatically disabled if the
+         * selected device is not sharing the memory with the host.
+         *
+         * The zero-copy mode is disabled by default, and it can be enabled
+         * with the tag `ZeroCopy`, for instance:
+         * `<ZeroCopy value="true" />`
+         */
+        bool zero_copy;
+
+        /** @brief Static analysis of the tools pipeline.
+         *
+         * If true, the arrays read and written by each tool are collected
+         * during the setup, from the dependencies of the tools and the const
+         * qualifiers of the kernels arguments (see
+         * Aqua::CalcServer::Kernel::outputs()). Then the kernels and the
+         * "set"/"copy" tools whose written arrays are never read, nor loaded
+         * or saved by the particles sets, are skipped (see
+         * Aqua::CalcServer::Tool::skip()). That is the case, for instance, of
+         * the energy terms when no report is using them. The "set" and
+         * "copy" tools overwritten or undone by the next ones are reported as
+         * well.
+         *
+         * The analysis is disabled by default, and it can be enabled with the
+         * tag `PipelineAnalysis`, for instance:
+         * `<PipelineAnalysis value="true" />`
+         *
+         * @note The Python tools are not declaring their dependencies, so no
+         * tools are skipped if any of them is found in the pipeline.
+         */
+        bool pipeline_analysis;
+
+        /** @brief Number of output writer threads.
+         *
+         * The particles and report files are written by a pool of threads
+         * (see Aqua::InputOutput::Writers), in such a way the simulation can
+         * continue while the data is written. The pool can be tuned with the
+         * tag `Writers`, for instance:
+         * `<Writers threads="2" queue="4" memory="512" />`
+         *
+         * 1 thread is considered by default.
+         * @see writers_queue
+         * @see writers_memory
+         */
+        unsigned int writers_threads;
+
+        /** @brief Maximum number of pending writing tasks.
+         *
+         * When exceeded, the simulation is blocked until some tasks are done.
+         * 2 tasks are allowed by default.
+         * @see writers_threads
+         */
+        unsigned int writers_queue;
+
+        /** @brief Maximum host memory retained by the pending writing tasks.
+         *
+         * When exceeded, the simulation is blocked until some tasks are done.
+         * It is set in MB in the `memory` attribute of the `Writers` tag. 0, the
+         * default value, means unlimited.
+         * @see writers_threads
+         */
+        size_t writers_memory;
+
+        /** @brief Checkpoint files path.
+         *
+         * The checkpoints are binary snapshots of all the variables (see
+         * Aqua::InputOutput::Checkpoint), written in the background, such
+         * that the simulation can be resumed without parsing the particles
+         * files. They are set with the tag `Checkpoint`, for instance:
+         * `<Checkpoint file="checkpoint.{mpi_rank}.bin" interval="3600" />`
+         *
+         * If the path has no `{index}` scape string, the last checkpoint is
+         * overwritten. "AQUAgpusph.checkpoint.{mpi_rank}.bin" is considered
+         * by default.
+         * @see checkpoint_interval
+         * @see Aqua::newFilePath()
+         */
+        std::string checkpoint_path;
+
+        /** @brief Wall clock time in seconds between checkpoints.
+         *
+         * The checkpoints are written at the first time step boundary after
+         * the interval is elapsed. In MPI runs, the decision is taken by the
+         * first process, so all the processes are writing the checkpoint at
+         * the same time step. 0, the default value, disables the checkpoints.
+         * @see checkpoint_path
+         */
+        float checkpoint_interval;
+
+        /** @brief Write a checkpoint when SIGTERM is received.
+         *
+         * Instead of just stopping the simulation, the first SIGTERM is
+         * making all the processes write a checkpoint at the same time step,
+         * as fast as possible, before exiting. Hence the preempted jobs can be
+         * resumed later (see the `--restart` command line option). It is
+         * enabled with the `on_term` attribute of the `Checkpoint` tag:
+         * `<Checkpoint on_term="true" />`
+         *
+         * It is disabled by default.
+         * @note In MPI runs the processes are synchronizing the signal
+         * reception each time step.
+         */
+        bool checkpoint_on_term;
+
+        /** @brief Checkpoint to restart the simulation from.
+         *
+         * If it is set, the particles files are not loaded, but all the
+         * variables are restored from the checkpoint. It is set on the
+         * `restart` attribute of the `Checkpoint` tag, for instance:
+         * `<Checkpoint restart="checkpoint.{mpi_rank}.bin" />`
+         *
+         * The XML definition file saved with each checkpoint is already
+         * pointing to it, so it can be directly used to resume the simulation.
+         * @see checkpoint_path
+         */
+        std::string restart_path;
+
+        /** @brief Timeline trace file path.
+         *
+         * If it is not empty, the host side execution of the tools, their
+         * device execution (if AQUAgpusph is compiled with GPU profiling),
+         * the MPI messages, and the writers and Python worker threads are
+         * recorded for some time steps, and written in Chrome trace JSON
+         * format (see Aqua::InputOutput::Trace), which can be loaded in
+         * chrome://tracing or https://ui.perfetto.dev. It is set with the tag
+         * `Trace`, for instance:
+         * `<Trace file="trace.{mpi_rank}.json" start="100" iters="10" />`
+         *
+         * Several constants can be used in the path. See
+         * Aqua::setStrConstants(). The trace is disabled by default.
+         * @see trace_start
+         * @see trace_iters
+         * @see trace_buffer
+         */
+        std::string trace_path;
+
+        /** @brief First time step to be traced.
+         *
+         * 0 by default.
+         * @see trace_path
+         */
+        unsigned int trace_start;
+
+        /** @brief Number of time steps to be traced.
+         *
+         * 10 by default.
+         * @see trace_path
+         */
+        unsigned int trace_iters;
+
+        /** @brief Number of spans stored per thread.
+         *
+         * Each thread is storing its spans in a ring buffer, so the oldest
+         * ones are lost if it is exceeded. It is set in the `buffer`
+         * attribute of the `Trace` tag. 65536 by default.
+         * @see trace_path
+         */
+        unsigned int trace_buffer;
+
         /** @brief General program settings.
         *
         * These setting are set between the following XML tags:
@@ -189,6 +438,9 @@ public:
             *
             * @remarks The index of the device is refered to the available ones
             * compatibles with the selected type #device_type.
+            * @remarks Each process is driving a single device. To work with
+            * several devices launch one MPI process per device, with a
+            * `Device` tag for each process.
             */
             unsigned int device_id;
 
@@ -242,6 +494,15 @@ public:
         </Variables>
      * @endcode
      *
+     * The arrays which are just storing temporary data between the tools of
+     * the pipeline can be marked as scratch ones:
+     * @code{.xml}
+        <Variable name="tmp" type="vec*" length="N" scratch="true" />
+     * @endcode
+     * Then the scratch arrays with non overlapping live ranges along the
+     * pipeline may share the same device memory (see
+     * Aqua::CalcServer::CalcServer::aliasScratchArrays()).
+     *
      * @see Aqua::InputOutput::Variables
      * @see Aqua::InputOutput::ProblemSetup
      */
@@ -261,6 +522,8 @@ public:
         std::vector<std::string> lengths;
         /// Values
         std::vector<std::string> values;
+        /// Scratch arrays flags
+        std::vector<bool> scratches;
 
         /** @brief Add a new variable.
          *
@@ -274,11 +537,14 @@ public:
          * which requires the number of cells).
          * @param value Variable value, NULL for arrays. It is optional for
          * scalar variables.
+         * @param scratch true if the array is just storing temporary data,
+         * false otherwise.
          */
         void registerVariable(std::string name,
                               std::string type,
                               std::string length,
-                              std::string value);
+                              std::string value,
+                              bool scratch=false);
     };
 
     /// Variables storage
@@ -583,6 +849,13 @@ public:
      * Where @paramname{n} is the number of particles for this set of
      * particles.
      *
+     * Optionally, the @paramname{replicas} attribute can be set to create
+     * several identical sets of particles, running an ensemble of independent
+     * cases in the same simulation. In such case, "{replica}" is replaced by
+     * the replica index in the scalar values and in the file paths, which
+     * shall be different for each replica when saving (see
+     * basic/ensemble.xml preset).
+     *
      * @see Aqua::InputOutput::Particles
      */
     class sphParticlesSet
@@ -659,6 +932,10 @@ public:
          * This field can be set with the tag `Save`, for instance:
          * `<Save format="VTK" file="output.proc{mpi_rank}.{index}.vtk" fields="r,normal" />`
          *
+         * The available formats are "ASCII", "FastASCII" (which is saved as
+         * "ASCII"), "VTK", "Binary" (see Aqua::InputOutput::Binary) and
+         * "HDF5" (see Aqua::InputOutput::HDF5).
+         *
          * Several scaper strings can be used to let AQUAgpusph compute the
          * file path, at the appropriate Aqua::InputOutput::Particles instance.
          * See Aqua::newFilePath()
@@ -690,6 +967,41 @@ public:
          * @see output()
          */
         std::vector<std::string> outputFields() const {return _out_fields;}
+
+        /** @brief Set an output option, specific of the output file format.
+         *
+         * All the attributes of the tag `Save` but `file`, `format` and
+         * `fields` are considered output options, for instance:
+         * `<Save format="VTK" file="output" fields="r,normal" compressor="lz4" />`
+         *
+         * Some options, like the output filters, are common to all the
+         * formats (see Aqua::InputOutput::Particles).
+         *
+         * @param name Option name.
+         * @param value Option value.
+         * @see output()
+         */
+        void outputOption(const std::string name, const std::string value){
+            _out_options[name] = value;
+        }
+
+        /** @brief Get an output option
+         * @param name Option name.
+         * @return Option value, an empty string if it has not been set.
+         * @see outputOption(const std::string, const std::string)
+         */
+        const std::string outputOption(const std::string name) const {
+            auto it = _out_options.find(name);
+            return (it == _out_options.end()) ? "" : it->second;
+        }
+
+        /** @brief Get all the output options
+         * @return Output options, mapped by their names.
+         * @see outputOption(const std::string, const std::string)
+         */
+        std::map<std::string, std::string> outputOptions() const {
+            return _out_options;
+        }
     private:
         /// Number of particles
         unsigned int _n;
@@ -716,6 +1028,9 @@ public:
 
         /// Fields to write in the file
         std::vector<std::string> _out_fields;
+
+        /// Format specific output options
+        std::map<std::string, std::string> _out_options;
     };
 
     /// Array of particles sets
@@ -25,7 +25,9 @@
 #define TIMEMANAGER_H_INCLUDED
 
 #include <sphPrerequisites.h>
+#include <chrono>
 #include <ProblemSetup.h>
+#include <Variable.h>
 
 namespace Aqua{ namespace InputOutput{
 
@@ -67,44 +69,62 @@ public:
      */
     bool mustPrintOutput();
 
+    /** @brief Check if a checkpoint must be written.
+     *
+     * The checkpoints are triggered by the wall clock time elapsed since the
+     * last one. In MPI runs the first process is taking the decision, such
+     * that all the processes write the checkpoint at the same time step.
+     * @return true if a checkpoint should be written, false otherwise.
+     * @note The result is kept until the next time step, or until
+     * checkpointed() is called.
+     * @see Aqua::InputOutput::ProblemSetup::sphSettings::checkpoint_interval
+     */
+    bool mustCheckpoint();
+
+    /** @brief Notify that a checkpoint has been written.
+     *
+     * The wall clock time of the next checkpoint is counted from now.
+     */
+    void checkpointed();
+
     /** @brief Set the simulation time step index.
      * @param s Simulation time step index.
      */
-    void step(unsigned int s){*_step = s;}
+    void step(unsigned int s){_step->set(&s);}
     /** @brief Get the simulation time step index.
      * @return Simulation time step index.
      */
-    unsigned int step(){return *_step;}
+    unsigned int step(){return *(unsigned int*)_step->get();}
     /** @brief Set the simulation time instant.
      * @param t Simulation time instant.
      */
-    void time(float t){*_time = t;}
+    void time(float t){_time->set(&t);}
     /** @brief Get the simulation time instant.
      * @return Simulation time instant.
      */
-    float time(){return *_time;}
+    float time(){return *(float*)_time->get();}
     /** @brief Set the simulation frame.
      *
      * The frame is the index of the current particles output.
      *
      * @param frame Simulation frame.
      */
-    void frame(unsigned int frame){*_frame = frame;}
+    void frame(unsigned int frame){_frame->set(&frame);}
     /** @brief Get the simulation frame.
      *
      * The frame is the index of the current particles output.
      *
      * @return Simulation frame.
      */
-    unsigned int frame(){return *_frame;}
+    unsigned int frame(){return *(unsigned int*)_frame->get();}
     /** @brief Set the simulation time step \f$ \Delta t \f$.
      * @param dt Simulation time step \f$ \Delta t \f$.
      */
-    void dt(float dt){*_dt = dt;}
+    void dt(float dt){_dt->set(&dt);}
     /** @brief Get the simulation time step \f$ \Delta t \f$.
      * @return Simulation time step \f$ \Delta t \f$.
      */
-    float dt(){return *_dt;}
+    float dt(){return *(float*)_dt->get();}
 
     /** @brief Set the last output event time step index.
      * @param s last output event time step index.
@@ -134,31 +154,31 @@ public:
     /** @brief Get the total simulation time to compute.
      * @return Total simulation time to compute.
      */
-    float maxTime(){return *_time_max;}
+    float maxTime(){return *(float*)_time_max->get();}
     /** @brief Get the number of frames to compute.
      * @return Number of frames to compute.
      */
-    unsigned int maxStep(){return *_steps_max;}
+    unsigned int maxStep(){return *(unsigned int*)_steps_max->get();}
     /** @brief Get the number of frames to compute.
      * @return Number of frames to compute.
      */
-    unsigned int maxFrame(){return *_frames_max;}
+    unsigned int maxFrame(){return *(unsigned int*)_frames_max->get();}
 
 private:
     /// Actual step
-    unsigned int *_step;
+    Variable *_step;
     /// Actual time
-    float *_time;
+    Variable *_time;
     /// Time step
-    float *_dt;
+    Variable *_dt;
     /// Actual frame
-    unsigned int *_frame;
+    Variable *_frame;
     /// Maximum time into simulation (-1 if simulation don't stop by time criteria)
-    float *_time_max;
+    Variable *_time_max;
     /// Maximum number of steps into simulation (-1 if simulation don't stop by steps criteria)
-    unsigned int *_steps_max;
+    Variable *_steps_max;
     /// Maximum number of frames into simulation (-1 if simulation don't stop by frames criteria)
-    unsigned int *_frames_max;
+    Variable *_frames_max;
 
     /// Time when last Output file printed
     float _output_time;
@@ -168,6 +188,15 @@ private:
     int _output_step;
     /// IPF for Output files (-1 if Output file must not be printed)
     int _output_ipf;
+
+    /// Wall clock time between checkpoints (0 if they are disabled)
+    float _checkpoint_interval;
+    /// Wall clock time of the last checkpoint
+    std::chrono::steady_clock::time_point _checkpoint_time;
+    /// Step when mustCheckpoint() was last evaluated
+    int _checkpoint_step;
+    /// Last result of mustCheckpoint()
+    bool _checkpoint_due;
 };
 
 }}  // namespace
@@ -0,0 +1,138 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Compiled math expression.
+ * (See Aqua::Expression for details)
+ */
+
+#ifndef EXPRESSION_H_INCLUDED
+#define EXPRESSION_H_INCLUDED
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <muParser.h>
+
+namespace Aqua{
+
+namespace InputOutput{
+    class Variable;
+    class Variables;
+}
+
+/** \class Expression Expression.h Tokenizer/Expression.h
+ * @brief Math expression parsed just once, to be evaluated several times.
+ *
+ * Differently to Aqua::Tokenizer::solve(), where the expression is parsed
+ * each time it is evaluated, and the variables values shall be previously
+ * registered (see Aqua::InputOutput::Variables::populate()), the expression
+ * is parsed on construction, and the identifiers are bound to the
+ * Aqua::InputOutput::Variable objects. Hence each evaluation is just reading
+ * the variables values and running the muParser bytecode.
+ *
+ * The expression may have several comma separated components, e.g.
+ * "dt * u_x, dt * u_y".
+ *
+ * @note Just the variables already registered when the expression is built
+ * can be used.
+ */
+class Expression
+{
+public:
+    /** @brief Constructor
+     * @param eq Math expression
+     * @param vars Variables manager, where the identifiers are looked for
+     */
+    Expression(const std::string eq, InputOutput::Variables *vars);
+
+    /// Destructor
+    ~Expression();
+
+    /** @brief Get the expression string
+     * @return Math expression
+     */
+    const std::string expression() const {return _eq;}
+
+    /** @brief Evaluate the expression
+     * @param n Number of components to read
+     * @param v Allocated array where the components should be stored
+     * @param sync Wait for the variables events before reading their values.
+     * It can be disabled when the events are already known to be complete,
+     * e.g. from an OpenCL callback
+     * @return Number of components actually read, which may be lower than n
+     */
+    unsigned int solve(unsigned int n, float *v, bool sync=true);
+
+    /** @brief Get the variables bound to the expression identifiers
+     * @return Bound variables. The same variable may appear several times,
+     * once per component
+     */
+    const std::vector<InputOutput::Variable*> variables() const
+    {
+        return _bound_vars;
+    }
+
+private:
+    /** @brief Bind an identifier to a variable component.
+     * @param name Identifier name
+     * @param slot Value where muParser is reading the identifier
+     * @param vars Variables manager
+     */
+    void bind(const std::string name,
+              mu::value_type *slot,
+              InputOutput::Variables *vars);
+
+    /** @brief muParser variables factory.
+     *
+     * It is called each time an undefined identifier is found.
+     * @param name Identifier name
+     * @param data The expression itself
+     * @return Value where muParser shall read the identifier
+     */
+    static mu::value_type* factory(const mu::char_type *name, void *data);
+
+    /// Type of a variable component
+    typedef enum {
+        FLOAT_COMPONENT,
+        INT_COMPONENT,
+        UINT_COMPONENT,
+    } component_type;
+
+    /// Math expression
+    std::string _eq;
+
+    /// Mathematical expressions parser
+    mu::Parser _p;
+
+    /// Values read by muParser (a deque is not invalidating the pointers)
+    std::deque<mu::value_type> _slots;
+
+    /// Values read by muParser, for each binding
+    std::vector<mu::value_type*> _bound_slots;
+    /// Bound variables
+    std::vector<InputOutput::Variable*> _bound_vars;
+    /// Bound variables components
+    std::vector<unsigned int> _bound_components;
+    /// Bound variables components types
+    std::vector<component_type> _bound_types;
+};   // class Expression
+
+}   // namespaces
+
+#endif // EXPRESSION_H_INCLUDED
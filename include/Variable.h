@@ -30,6 +30,7 @@
 #include <vector>
 #include <sphPrerequisites.h>
 #include <Tokenizer/Tokenizer.h>
+#include <Tokenizer/Expression.h>
 
 #ifdef HAVE_3D
     #define VecVariable Vec4Variable
@@ -41,8 +42,29 @@
     #define UIVecVariable UIVec2Variable
 #endif
 
+/** @def _ARRAYS_GROWTH_FACTOR Capacity growth factor of the resized arrays
+ * @see Aqua::InputOutput::ArrayVariable::resize()
+ */
+#ifndef _ARRAYS_GROWTH_FACTOR
+    #define _ARRAYS_GROWTH_FACTOR 1.5f
+#endif
+
 namespace Aqua{ namespace InputOutput{
 
+/** @brief Host time blocked syncing a variable
+ * @see Aqua::InputOutput::Variable::stalls()
+ */
+typedef struct {
+    /// Variable name
+    std::string variable;
+    /// Tool requesting the sync, "host" if it was requested out of the tools
+    std::string tool;
+    /// Number of blocking syncs
+    unsigned int count;
+    /// Blocked time, in seconds
+    double time;
+} SyncStall;
+
 /** @class Variable Variable.h Variable.h
  * @brief A generic variable. Almost useless, use the overloaded classes
  * instead of this one.
@@ -99,6 +121,12 @@ public:
      */
     virtual void* get(){return NULL;}
 
+    /** @brief Get variable pointer basis pointer, without waiting for the
+     * underlying event
+     * @return Implementation pointer, the same than get() for this class.
+     */
+    virtual void* get_async(){return get();}
+
     /** @brief Set variable from memory
      * @param ptr Memory to copy.
      */
@@ -146,7 +174,39 @@ public:
      */
     cl_event getEvent(){return _event;}
 
+    /** @brief Get the variable version
+     *
+     * The version is a counter increased each time the variable value is
+     * changed by set(), set_async(), setFromPythonObject() or, for scalar
+     * variables, setEvent(). Hence the tools can cache the variable, and
+     * update the associated OpenCL kernel arguments just when the version
+     * changes.
+     *
+     * @return Variable version. The first version is 1
+     * @warning Modifying the variable value through the pointer returned by
+     * get() is not increasing the version. Use set() instead
+     */
+    unsigned long version() const {return _version;}
+
+    /** @brief Get the host stalls caused by the variables syncing
+     *
+     * Each time sync() is actually blocking the host, i.e. the variable
+     * event is not complete yet, the waiting time is accumulated for the
+     * variable and the tool requesting it (see
+     * Aqua::CalcServer::Tool::current()). If the trace is recording, the
+     * wait is also added to the timeline (see Aqua::InputOutput::Trace).
+     *
+     * @return The stalls since the simulation start, sorted from the longest
+     * to the shortest one
+     */
+    static std::vector<SyncStall> stalls();
+
 protected:
+    /** @brief Increase the variable version
+     * @see version()
+     */
+    void increaseVersion(){_version++;}
+
     /** @brief Wait for variable underlying event to be complete
      * 
      * This function is tracking the syncing state, avoiding calling
@@ -168,6 +228,9 @@ private:
 
     /// Shortcut to avoid calling the expensive OpenCL API
     bool _synced;
+
+    /// Version of the variable value
+    unsigned long _version;
 };
 
 /** @class ScalarVariable Variable.h Variable.h
@@ -225,7 +288,11 @@ public:
      *
      * @param ptr Memory to copy
      */
-    inline void set(void* ptr){sync(); memcpy(&_value, ptr, sizeof(T));}
+    inline void set(void* ptr){
+        sync();
+        memcpy(&_value, ptr, sizeof(T));
+        this->increaseVersion();
+    }
 
     /** @brief Set variable from memory
      *
@@ -235,7 +302,10 @@ public:
      *
      * @param ptr Memory to copy
      */
-    inline void set_async(void* ptr){memcpy(&_value, ptr, sizeof(T));}
+    inline void set_async(void* ptr){
+        memcpy(&_value, ptr, sizeof(T));
+        this->increaseVersion();
+    }
     
     /** @brief Get the variable text representation
      * @return The variable represented as a string, NULL in case of errors.
@@ -714,9 +784,28 @@ public:
      * @return Array allocated memory (in bytes)
      * @note In order to get the length of the array the command
      * size() / Variables::typeToBytes(type()) can be used
+     * @note The device buffer may be larger after resize(), see capacity()
      */
     size_t size() const;
 
+    /** Get the array capacity.
+     * @return Memory allocated for the device buffer (in bytes)
+     */
+    size_t capacity() const;
+
+    /** @brief Resize the array.
+     *
+     * While the new size fits in the device buffer, just the size of the
+     * array is changed. Otherwise a buffer which is at least
+     * #_ARRAYS_GROWTH_FACTOR times larger is taken from the pool of released
+     * buffers (see Aqua::InputOutput::Variables::acquireBuffer()), and the
+     * old one is returned to the pool. Hence the steady state resizes are not
+     * allocating/releasing device memory.
+     * @param size New size of the array (in bytes)
+     * @warning The array values are not preserved when the buffer is replaced
+     */
+    void resize(size_t size);
+
     /** Get variable pointer basis pointer
      * @return Implementation pointer.
      */
@@ -725,7 +814,7 @@ public:
     /** Set variable from memory
      * @param ptr Memory to copy.
      */
-    void set(void* ptr){_value = *(cl_mem*)ptr;}
+    void set(void* ptr){_value = *(cl_mem*)ptr; _size = 0; increaseVersion();}
 
     /** Get a PyArrayObject interpretation of the variable
      * @param i0 First component to be read.
@@ -743,6 +832,32 @@ public:
      */
     bool setFromPythonObject(PyObject* obj, int i0=0, int n=0);
 
+    /** @brief Get a PyArrayObject view of the whole array
+     *
+     * Differently to getPythonObject(), the data is not copied in a new
+     * memory array each time. Instead, the same Python object is returned,
+     * which is viewing a persistent host mirror of the array, allocated in
+     * pinned memory (see Aqua::CalcServer::CalcServer::allocatePinned()).
+     * The mirror is just downloaded again when the event of the variable has
+     * changed since the last time, i.e. when it may have been modified.
+     *
+     * The view is read-only, unless it is mapped. In that case the mirror is
+     * not downloaded anymore, until the modifications are uploaded with
+     * unmapPythonView().
+     * @param map true to map the view for writing, false otherwise.
+     * @return PyArrayObject Python object. NULL if the memory cannot be read.
+     * @warning The views are outdated when the array is resized, so they shall
+     * be requested again instead of being stored between calls.
+     */
+    PyObject* getPythonView(bool map=false);
+
+    /** @brief Upload the view mapped with getPythonView()
+     *
+     * The upload is asynchronous, and the view becomes read-only again.
+     * @return false if all gone right, true otherwise.
+     */
+    bool unmapPythonView();
+
     /** Get the variable text representation
      * @return The variable represented as a string, NULL in case of errors.
      */
@@ -754,11 +869,20 @@ public:
      */
     const std::string asString(size_t i);
 private:
+    /** @brief Set the event of the last sync between the device buffer and
+     * its host mirror
+     * @param event Synchronization event
+     * @see getPythonView()
+     */
+    void setViewEvent(cl_event event);
+
     /// Check for abandoned python objects to destroy them.
     void cleanMem();
 
     /// Variable value
     cl_mem _value;
+    /// Size of the array (in bytes), 0 if the whole buffer is used
+    size_t _size;
     /** @brief List of helpers data array storages for the Python objects
      *
      * The memory array inside numpy objects must be dynamically allocated and
@@ -778,6 +902,34 @@ private:
      * @see _data
      */
     std::vector<PyObject*> _objects;
+
+    /** @brief Host mirror of the array, viewed by the Python object _view
+     *
+     * It is allocated in pinned memory, which is owned by the calculation
+     * server.
+     * @see getPythonView()
+     */
+    void *_view_host;
+    /// Python view of the host mirror
+    PyObject *_view;
+    /// Device buffer mirrored
+    cl_mem _view_mem;
+    /// Size of the host mirror (in bytes)
+    size_t _view_size;
+    /** @brief Event of the last sync between the device buffer and its host
+     * mirror.
+     *
+     * It is retained, so its handler cannot be reused by a new OpenCL event.
+     */
+    cl_event _view_event;
+    /// true if the view is mapped for writing
+    bool _view_mapped;
+    /** @brief Outdated views, released when Python is not using them anymore
+     * @see cleanMem()
+     */
+    std::vector<PyObject*> _old_views;
+    /// Host mirrors of the outdated views
+    std::vector<void*> _old_view_hosts;
 };
 
 // ---------------------------------------------------------------------------
@@ -836,9 +988,47 @@ public:
 
     /** Get the allocated memory.
      * @return Allocated memory on device. Just the arrays can contribute to this value.
+     * @note The memory saved by alias() is discounted.
      */
     size_t allocatedMemory();
 
+    /** @brief Make several arrays share the same device memory.
+     *
+     * A buffer as large as the largest array is allocated, and each array
+     * is replaced by a sub-buffer of it, starting at the origin. Hence the
+     * arrays keep their sizes, but the values are not preserved.
+     * @param vars Arrays to be aliased.
+     * @warning The arrays shall not be simultaneously alive, i.e. the data
+     * stored in any of them is overwritten when the others are written.
+     */
+    void alias(std::vector<ArrayVariable*> vars);
+
+    /** Get the memory saved by alias().
+     * @return Device memory saved, in bytes.
+     */
+    size_t aliasedMemory() const {return _aliased_memory;}
+
+    /** Get the memory retained by the pool of released buffers.
+     * @return Device memory in the pool, in bytes.
+     * @see releaseBuffer()
+     */
+    size_t pooledMemory();
+
+    /** @brief Get a device buffer from the pool of released buffers.
+     *
+     * The smallest released buffer large enough is taken. If there is no
+     * one, a new buffer is allocated.
+     * @param size Minimum size of the buffer (in bytes).
+     * @return Device buffer, which may be larger than requested.
+     */
+    cl_mem acquireBuffer(size_t size);
+
+    /** @brief Return a device buffer to the pool, to be reused later.
+     * @param mem Device buffer, which shall not be used anymore.
+     * @see acquireBuffer()
+     */
+    void releaseBuffer(cl_mem mem);
+
     /** Convert a type name to bytes.
      * @param type Type name.
      * @return Type size in bytes, 0 if the type is not recognized.
@@ -851,6 +1041,17 @@ public:
      */
     static unsigned int typeToN(const std::string type);
 
+    /** Check whether a type name is a half precision one.
+     *
+     * The half precision types ("half", "hvec", "hvec2", "hvec3" and
+     * "hvec4") can be just used for arrays, which are read and written with
+     * vload_half() and vstore_half() in the computational device.
+     * @param type Type name.
+     * @return true if the components are stored as half precision values,
+     * false otherwise.
+     */
+    static bool isHalfType(const std::string type);
+
     /** Get if two types strings are the same one.
      * @param type_a First type name.
      * @param type_b Second type name.
@@ -873,6 +1074,28 @@ public:
                void *data,
                const std::string name="NULL");
 
+    /** Evaluate an already compiled expression.
+     *
+     * It is significantly faster than solving the expression string, so it is
+     * the preferred way to evaluate expressions several times per time step.
+     * @param type_name Type of the output desired value.
+     * @param expr Compiled expression (see compile()).
+     * @param data Allocated memory where the result should be stored.
+     * @note typeToBytes(type) bytes should be allocated in data.
+     */
+    void solve(const std::string type_name,
+               Expression *expr,
+               void *data);
+
+    /** Compile an expression, to be evaluated later.
+     * @param value Expression to compile.
+     * @return The compiled expression, which shall be destroyed by the
+     * caller.
+     * @note Just the variables already registered can be used in the
+     * expression.
+     */
+    Expression* compile(const std::string value);
+
     /** @brief Populate variables in order that the tokenizer may get the
      * updated value.
      * @param name Name of the variable to be populated, "" if all the
@@ -885,7 +1108,36 @@ public:
      * @param var Variable to be populated.
      */
     void populate(Variable* var);
+
+    /** @brief Populate a variable in order that the tokenizer may know the
+     * updated value, as soon as it is required.
+     *
+     * Differently to populate(), this method is not blocking until the
+     * variable event is complete. The variable is actually populated the next
+     * time that an expression is evaluated (see solve()), so the tools
+     * eventually writing the value in an asynchronous way (e.g.
+     * Aqua::CalcServer::Reduction) are not stalling the pipeline.
+     *
+     * @param var Variable to be populated.
+     */
+    void populate_async(Variable* var);
 private:
+    /** @brief Populate the variables queued by populate_async()
+     */
+    void populatePending();
+
+    /** Solve a string, or a compiled expression, interpreting the variables.
+     * @param type_name Type of the output desired value.
+     * @param value Expression to evaluate.
+     * @param expr Compiled expression, NULL if the string shall be parsed.
+     * @param data Allocated memory where the result should be stored.
+     * @param name Variable name to register in the tokenizer.
+     */
+    void solve(const std::string type_name,
+               const std::string value,
+               Expression *expr,
+               void *data,
+               const std::string name);
 
     /** Register a scalar variable
      * @param name Name of the variable.
@@ -911,17 +1163,28 @@ private:
      * @param name Name of the variable. It is used to register variables in
      * the tokenizer and to report errors.
      * @param value Value string where the components are extracted from.
+     * @param expr Compiled expression, NULL if the value string shall be
+     * parsed.
      * @param n Number of components to read.
      * @param v Allocated array where the components should be stored
      */
     void readComponents(const std::string name,
                         const std::string value,
+                        Expression *expr,
                         unsigned int n,
                         float* v);
 
 
     /// Set of available variables
     std::vector<Variable*> _vars;
+    /// Variables queued to be populated, see populate_async()
+    std::vector<Variable*> _pending_vars;
+    /// Buffers shared by the aliased arrays, see alias()
+    std::vector<cl_mem> _aliased_mems;
+    /// Memory saved by the aliased arrays
+    size_t _aliased_memory;
+    /// Pool of released buffers, see releaseBuffer()
+    std::vector<cl_mem> _pool;
     /// Tokenizer to evaluate variables
     Tokenizer tok;
 };
@@ -22,6 +22,12 @@
  * This file will read the definitions HAVE_3D and KERNEL_NAME, setting up and
  * including the appropiate file. In this way the user may easily select the
  * kernel to become applied using the modules at basic/kernels presets folder
+ *
+ * If KERNEL_TABULATED is defined, kernelW() and kernelF() are linearly
+ * interpolated from tables in constant memory, sampled in the setup by
+ * Aqua::CalcServer::CalcServer::tabulateKernel(), so the expensive kernels
+ * are not evaluated in the neighbours loops. The rest of functions, like the
+ * boundary integrals ones, are not affected.
  */
 
 // Macro for adding quotes
@@ -39,6 +45,63 @@
     #define KERNEL_SUFIX 2D
 #endif
 
+// Tabulated kernel, except for the kernel which is sampling it
+#if defined(KERNEL_TABULATED) && !defined(_KERNEL_TABULATING_)
+    #define _KERNEL_TABLE_
+#endif
+
 // Include the file
 #define KERNEL_NAME_SUFIX KERNEL_CAT(KERNEL_NAME,KERNEL_SUFIX)
-#include KERNEL_STRINGIFY(resources/Scripts/KernelFunctions/KERNEL_NAME_SUFIX.hcl)
\ No newline at end of file
+#ifdef _KERNEL_TABLE_
+    #define kernelW kernelW_analytic
+    #define kernelF kernelF_analytic
+#endif
+#include KERNEL_STRINGIFY(resources/Scripts/KernelFunctions/KERNEL_NAME_SUFIX.hcl)
+#ifdef _KERNEL_TABLE_
+    #undef kernelW
+    #undef kernelF
+#endif
+
+#if defined(_KERNEL_TABLE_) && !defined(_KERNEL_TABLE_INCLUDED_)
+#define _KERNEL_TABLE_INCLUDED_
+
+/// Kernel function samples, from q = 0 to q = SUPPORT
+__constant float _kernel_table_w[KERNEL_TABULATED] = KERNEL_TABLE_W;
+/// Kernel gradient factor samples, from q = 0 to q = SUPPORT
+__constant float _kernel_table_f[KERNEL_TABULATED] = KERNEL_TABLE_F;
+
+/** @brief Linearly interpolate a kernel table.
+ * @param table Kernel table.
+ * @param q Normalized distance \f$ \frac{\mathbf{r_j} - \mathbf{r_i}}{h} \f$.
+ * @return Interpolated value.
+ */
+inline const float kernelTable(__constant float *table, const float q)
+{
+    const float x = clamp(q * ((KERNEL_TABULATED - 1) / SUPPORT),
+                          0.f,
+                          (float)(KERNEL_TABULATED - 1));
+    const int k = min((int)x, KERNEL_TABULATED - 2);
+    return mix(table[k], table[k + 1], x - k);
+}
+
+/** @brief The kernel value
+ * \f$ W \left(\mathbf{r_j} - \mathbf{r_i}; h\right) \f$.
+ * @param q Normalized distance \f$ \frac{\mathbf{r_j} - \mathbf{r_i}}{h} \f$.
+ * @return Kernel value.
+ */
+inline const float kernelW(const float q)
+{
+    return kernelTable(_kernel_table_w, q);
+}
+
+/** @brief The kernel gradient factor
+ * \f$ F \left(\mathbf{r_j} - \mathbf{r_i}; h\right) \f$
+ * @param q Normalized distance \f$ \frac{\mathbf{r_j} - \mathbf{r_i}}{h} \f$.
+ * @return Kernel amount
+ */
+inline const float kernelF(const float q)
+{
+    return kernelTable(_kernel_table_f, q);
+}
+
+#endif  // _KERNEL_TABLE_INCLUDED_
@@ -0,0 +1,57 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @addtogroup basic
+ * @{
+ */
+
+/** @file
+ * @brief Ensemble of independent replicas of the same case.
+ */
+
+#include "resources/Scripts/types/types.h"
+
+/** @brief Translate each replica, such that they are not interacting.
+ *
+ * The replica k is moved \f$ k \, \mathbf{\Delta r} \f$, where
+ * \f$ \mathbf{\Delta r} \f$ is the ensemble offset, which shall be larger
+ * than the computational domain plus the kernel support.
+ *
+ * @param iset Set of particles index.
+ * @param replica Replica index of each set of particles.
+ * @param r Position \f$ \mathbf{r} \f$.
+ * @param N Number of particles.
+ * @param ensemble_offset Translation between consecutive replicas
+ * \f$ \mathbf{\Delta r} \f$.
+ */
+__kernel void entry(const __global uint* iset,
+                    const __global uint* replica,
+                    __global vec* r,
+                    uint N,
+                    vec ensemble_offset)
+{
+    unsigned int i = get_global_id(0);
+    if(i >= N)
+        return;
+
+    r[i] += (float)replica[iset[i]] * ensemble_offset;
+}
+
+/*
+ * @}
+ */
@@ -44,6 +44,8 @@
  * @param mpi_rank MPI process index
  * @param mpi_planes_orig Center of the first interface (between procs) plane
  * @param mpi_planes_dist Distance between interface planes
+ * @param mpi_planes_shift Displacement of the lower and upper planes of this
+ * process, in mpi_planes_dist units (see the mpi-balance tool)
  * @param N Number of particles
  */
 __kernel void mask_planes(__global unsigned int* mpi_mask,
@@ -52,6 +54,7 @@ __kernel void mask_planes(__global unsigned int* mpi_mask,
                           unsigned int mpi_rank,
                           vec mpi_planes_orig,
                           vec mpi_planes_dist,
+                          vec2 mpi_planes_shift,
                           unsigned int N)
 {
     unsigned int i = get_global_id(0);
@@ -67,8 +70,9 @@ __kernel void mask_planes(__global unsigned int* mpi_mask,
     __attribute__((opencl_unroll_hint(2)))
 #endif
     for (unsigned int j=0; j < 2; j++) {
+        const float shift = j ? mpi_planes_shift.y : mpi_planes_shift.x;
         const vec_xyz orig = mpi_planes_orig.XYZ +
-                             (mpi_rank + j) * mpi_planes_dist.XYZ;
+                             (mpi_rank + j + shift) * mpi_planes_dist.XYZ;
         const float normal_sign = 2.f * (float)(j) - 1.f;
         const float dist = dot(r_in[i].XYZ - orig, normal_sign * normal);
         if(dist > -SUPPORT * H) {
@@ -230,6 +234,8 @@ __kernel void sort(const __global unsigned int* mpi_mask_in,
  * @param mpi_rank MPI process index
  * @param mpi_planes_orig Center of the first interface (between procs) plane
  * @param mpi_planes_dist Distance between interface planes
+ * @param mpi_planes_shift Displacement of the lower and upper planes of this
+ * process, in mpi_planes_dist units (see the mpi-balance tool)
  * @param domain_max Top-left-frontal corner of the computational domain
  * @param N Number of particles
  */
@@ -238,6 +244,7 @@ __kernel void drop_planes(__global int* imove,
                           unsigned int mpi_rank,
                           vec mpi_planes_orig,
                           vec mpi_planes_dist,
+                          vec2 mpi_planes_shift,
                           vec domain_max,
                           unsigned int N)
 {
@@ -254,8 +261,9 @@ __kernel void drop_planes(__global int* imove,
     __attribute__((opencl_unroll_hint(2)))
 #endif
     for (unsigned int j=0; j < 2; j++) {
+        const float shift = j ? mpi_planes_shift.y : mpi_planes_shift.x;
         const vec_xyz orig = mpi_planes_orig.XYZ +
-                             (mpi_rank + j) * mpi_planes_dist.XYZ;
+                             (mpi_rank + j + shift) * mpi_planes_dist.XYZ;
         const float normal_sign = 2.f * (float)(j) - 1.f;
         if(dot(r[i].XYZ - orig, normal_sign * normal) > 0) {
             r[i] = domain_max;
@@ -263,3 +271,23 @@ __kernel void drop_planes(__global int* imove,
         }
     }
 }
+
+/** @brief Flag the fluid particles, to measure the process load
+ *
+ * @param mpi_fluid 1 for the fluid particles, 0 otherwise
+ * @param imove Moving flags
+ *   - imove > 0 for regular fluid particles
+ *   - imove = 0 for sensors
+ *   - imove < 0 for boundary elements/particles
+ * @param N Number of particles
+ */
+__kernel void fluid_mask(__global unsigned int* mpi_fluid,
+                         const __global int* imove,
+                         unsigned int N)
+{
+    unsigned int i = get_global_id(0);
+    if(i >= N)
+        return;
+
+    mpi_fluid[i] = (imove[i] > 0) ? 1 : 0;
+}
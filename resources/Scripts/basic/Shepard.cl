@@ -85,12 +85,13 @@ __kernel void entry(const __global int* imove,
                     uint N,
                     uivec4 n_cells)
 {
-    const uint i = get_global_id(0);
+    const uint i = TILED_ID(N);
     const uint it = get_local_id(0);
     if(i >= N)
         return;
-    if((imove[i] < -3) || ((imove[i] > 0) && (EXCLUDED_PARTICLE(i))))
-        return;
+    const bool skip_i = (imove[i] < -3) ||
+                        ((imove[i] > 0) && (EXCLUDED_PARTICLE(i)));
+    TILED_SKIP(skip_i);
 
     const vec_xyz r_i = r[i].XYZ;
 
@@ -103,24 +104,33 @@ __kernel void entry(const __global int* imove,
         _SHEPARD_ = 0.f;
     #endif
 
-    BEGIN_LOOP_OVER_NEIGHS(){
+    TILE_DECLARE(vec, r);
+    TILE_DECLARE(float, rho);
+    TILE_DECLARE(float, m);
+
+    BEGIN_TILED_LOOP_OVER_NEIGHS(skip_i){
+        TILE_LOAD(r);
+        TILE_LOAD(rho);
+        TILE_LOAD(m);
+    }TILED_LOOP_OVER_NEIGHS(){
         if(EXCLUDED_PARTICLE(j)){
-            j++;
             continue;
         }
 
-        const vec_xyz r_ij = r[j].XYZ - r_i;
+        const vec_xyz r_ij = TILE(r).XYZ - r_i;
         const float q = length(r_ij) / H;
         if(q >= SUPPORT)
         {
-            j++;
             continue;
         }
 
         {
-            _SHEPARD_ += kernelW(q) * CONW * m[j] / rho[j];
+            _SHEPARD_ += kernelW(q) * CONW * TILE(m) / TILE(rho);
         }
-    }END_LOOP_OVER_NEIGHS()
+    }END_TILED_LOOP_OVER_NEIGHS()
+
+    if(skip_i)
+        return;
 
     #ifdef LOCAL_MEM_SIZE
         shepard[i] = _SHEPARD_;
@@ -102,13 +102,12 @@ __kernel void full(const __global int* imove,
                    uint N,
                    uivec4 n_cells)
 {
-    const uint i = get_global_id(0);
+    const uint i = TILED_ID(N);
     const uint it = get_local_id(0);
     if(i >= N)
         return;
-    if(EXCLUDED_PARTICLE(i)){
-        return;
-    }
+    const bool skip_i = EXCLUDED_PARTICLE(i);
+    TILED_SKIP(skip_i);
 
     const vec_xyz r_i = r[i].XYZ;
     const float p_i = p[i];
@@ -122,23 +121,34 @@ __kernel void full(const __global int* imove,
         _GRADP_ = VEC_ZERO.XYZ;
     #endif
 
-    BEGIN_LOOP_OVER_NEIGHS(){
+    TILE_DECLARE(vec, r);
+    TILE_DECLARE(float, rho);
+    TILE_DECLARE(float, m);
+    TILE_DECLARE(float, p);
+
+    BEGIN_TILED_LOOP_OVER_NEIGHS(skip_i){
+        TILE_LOAD(r);
+        TILE_LOAD(rho);
+        TILE_LOAD(m);
+        TILE_LOAD(p);
+    }TILED_LOOP_OVER_NEIGHS(){
         if( (i == j) || (EXCLUDED_PARTICLE(j))){
-            j++;
             continue;
         }
-        const vec_xyz r_ij = r[j].XYZ - r_i;
+        const vec_xyz r_ij = TILE(r).XYZ - r_i;
         const float q = length(r_ij) / H;
         if(q >= SUPPORT)
         {
-            j++;
             continue;
         }
         {
-            const float f_ij = kernelF(q) * CONF * m[j] / rho[j];
-            _GRADP_ += (p[j] - p_i) * f_ij * r_ij;
+            const float f_ij = kernelF(q) * CONF * TILE(m) / TILE(rho);
+            _GRADP_ += (TILE(p) - p_i) * f_ij * r_ij;
         }
-    }END_LOOP_OVER_NEIGHS()
+    }END_TILED_LOOP_OVER_NEIGHS()
+
+    if(skip_i)
+        return;
 
     #ifdef LOCAL_MEM_SIZE
         lap_p_corr[i].XYZ = _GRADP_;
@@ -200,13 +210,12 @@ __kernel void lapp(const __global int* imove,
                    uint N,
                    uivec4 n_cells)
 {
-    const uint i = get_global_id(0);
+    const uint i = TILED_ID(N);
     const uint it = get_local_id(0);
     if(i >= N)
         return;
-    if(EXCLUDED_PARTICLE(i)){
-        return;
-    }
+    const bool skip_i = EXCLUDED_PARTICLE(i);
+    TILED_SKIP(skip_i);
 
     const vec_xyz r_i = r[i].XYZ;
     const float p_i = p[i];
@@ -220,23 +229,34 @@ __kernel void lapp(const __global int* imove,
         _LAPP_ = 0.f;
     #endif
 
-    BEGIN_LOOP_OVER_NEIGHS(){
+    TILE_DECLARE(vec, r);
+    TILE_DECLARE(float, rho);
+    TILE_DECLARE(float, m);
+    TILE_DECLARE(float, p);
+
+    BEGIN_TILED_LOOP_OVER_NEIGHS(skip_i){
+        TILE_LOAD(r);
+        TILE_LOAD(rho);
+        TILE_LOAD(m);
+        TILE_LOAD(p);
+    }TILED_LOOP_OVER_NEIGHS(){
         if( (i == j) || (EXCLUDED_PARTICLE(j))){
-            j++;
             continue;
         }
-        const vec_xyz r_ij = r[j].XYZ - r_i;
+        const vec_xyz r_ij = TILE(r).XYZ - r_i;
         const float q = length(r_ij) / H;
         if(q >= SUPPORT)
         {
-            j++;
             continue;
         }
         {
-            const float f_ij = kernelF(q) * CONF * m[j] / rho[j];
-            _LAPP_ += (p[j] - p_i) * f_ij;
+            const float f_ij = kernelF(q) * CONF * TILE(m) / TILE(rho);
+            _LAPP_ += (TILE(p) - p_i) * f_ij;
         }
-    }END_LOOP_OVER_NEIGHS()
+    }END_TILED_LOOP_OVER_NEIGHS()
+
+    if(skip_i)
+        return;
 
     #ifdef LOCAL_MEM_SIZE
         lap_p[i] = _LAPP_;
@@ -271,13 +291,12 @@ __kernel void lapp_corr(const __global int* imove,
                         uint N,
                         uivec4 n_cells)
 {
-    const uint i = get_global_id(0);
+    const uint i = TILED_ID(N);
     const uint it = get_local_id(0);
     if(i >= N)
         return;
-    if(EXCLUDED_PARTICLE(i)){
-        return;
-    }
+    const bool skip_i = EXCLUDED_PARTICLE(i);
+    TILED_SKIP(skip_i);
 
     const vec_xyz r_i = r[i].XYZ;
     const vec_xyz gradp_i = lap_p_corr[i].XYZ;
@@ -291,24 +310,35 @@ __kernel void lapp_corr(const __global int* imove,
         _LAPP_ = lap_p[i];
     #endif
 
-    BEGIN_LOOP_OVER_NEIGHS(){
+    TILE_DECLARE(vec, r);
+    TILE_DECLARE(vec, lap_p_corr);
+    TILE_DECLARE(float, rho);
+    TILE_DECLARE(float, m);
+
+    BEGIN_TILED_LOOP_OVER_NEIGHS(skip_i){
+        TILE_LOAD(r);
+        TILE_LOAD(lap_p_corr);
+        TILE_LOAD(rho);
+        TILE_LOAD(m);
+    }TILED_LOOP_OVER_NEIGHS(){
         if( (i == j) || (EXCLUDED_PARTICLE(j))){
-            j++;
             continue;
         }
-        const vec_xyz r_ij = r[j].XYZ - r_i;
+        const vec_xyz r_ij = TILE(r).XYZ - r_i;
         const float q = length(r_ij) / H;
         if(q >= SUPPORT)
         {
-            j++;
             continue;
         }
         {
-            const vec_xyz gradp_ij = lap_p_corr[j].XYZ + gradp_i;
-            const float f_ij = kernelF(q) * CONF * m[j] / rho[j];
+            const vec_xyz gradp_ij = TILE(lap_p_corr).XYZ + gradp_i;
+            const float f_ij = kernelF(q) * CONF * TILE(m) / TILE(rho);
             _LAPP_ -= 0.5f * dot(gradp_ij, r_ij) * f_ij;
         }
-    }END_LOOP_OVER_NEIGHS()
+    }END_TILED_LOOP_OVER_NEIGHS()
+
+    if(skip_i)
+        return;
 
     #ifdef LOCAL_MEM_SIZE
         lap_p[i] = _LAPP_;
@@ -354,8 +354,7 @@ __kernel void weights(__global const unsigned int* iset,
  * @param iset Index of the set of particles.
  * @param isplit 0 if the particle should not become coalesced, 1 for the
  * coalescing particles, 2 for the seeds.
- * @param split_invperm Permutation to find the index of the particle in the
- * list of particles to become split.
+ * @param buffer_top Number of buffer particles already consumed.
  * @param mybuffer Index of the partner buffer particle.
  * @param ilevel Current refinement level of the particle.
  * @param level Target refinement level of the particle.
@@ -368,7 +367,7 @@ __kernel void weights(__global const unsigned int* iset,
 __kernel void generate(__global int* imove,
                        __global int* iset,
                        __global const unsigned int* isplit,
-                       __global unsigned int* split_invperm,
+                       __global unsigned int* buffer_top,
                        __global unsigned int* ilevel,
                        __global unsigned int* level,
                        __global int* miter,
@@ -386,20 +385,19 @@ __kernel void generate(__global int* imove,
         return;
 
     // Check whether the particle is a seed or not
-    const unsigned int j = split_invperm[i];
-    if(isplit[j] != 2){
+    if(isplit[i] != 2){
         return;
     }
 
-    // Compute the index of the buffer particle to steal. Take care, the radix
-    // sort is storing the particles to become split at the end of the list
-    const unsigned int i0 = N - nbuffer;
-    unsigned int ii = i0 + (N - j - 1);
+    // Pop the buffer particle to steal. They are taken in order from the front
+    // of the buffer, so the remaining ones are still at the end of the list
+    const unsigned int k = atomic_inc(buffer_top);
     // Check that there are buffer particles enough
-    if(ii >= N){
+    if(k >= nbuffer){
         // PROBLEMS! This seed cannot generate a partner
         return;
     }
+    const unsigned int ii = N - nbuffer + k;
     mybuffer[i] = ii;
 
     // Set the already known variables
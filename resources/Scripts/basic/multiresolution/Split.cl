@@ -92,12 +92,6 @@ __kernel void check_split(__global const int* imove,
  * 0, instead of 2. Such array can be used to count the number of new particles
  * to become generated.
  *
- * Since isplit is used to sort the particles, it should have "n_radix" items,
- * which is bigger than "N". But in order to conveniently sort isplit, you must
- * ensure that the values "out of bounds" are bigger than the other ones (and
- * therefore kept at the end of the list). in this case a value of 2 is
- * selected.
- *
  * @param isplit 0 if the particle should not become split, 1 otherwise
  * @param isplit_in 0 if the particle should not become split, 1 otherwise
  * @param N Number of particles.
@@ -125,8 +119,7 @@ __kernel void set_isplit_in(__global const unsigned int* isplit,
  *   - imove < 0 for boundary elements/particles.
  * @param iset Index of the set of particles.
  * @param isplit 0 if the particle should not become split, 1 otherwise.
- * @param split_invperm Permutation to find the index of the particle in the
- * list of particles to become split.
+ * @param buffer_top Number of buffer particles already consumed.
  * @param ilevel Current refinement level of the particle.
  * @param level Target refinement level of the particle.
  * @param m0 Target mass, \f$ m_0 \f$.
@@ -144,7 +137,7 @@ __kernel void set_isplit_in(__global const unsigned int* isplit,
 __kernel void generate(__global int* imove,
                        __global int* iset,
                        __global unsigned int* isplit,
-                       __global unsigned int* split_invperm,
+                       __global unsigned int* buffer_top,
                        __global unsigned int* ilevel,
                        __global unsigned int* level,
                        __global float* m0,
@@ -167,22 +160,21 @@ __kernel void generate(__global int* imove,
         return;
 
     // Check whether the particle should become split or not
-    const unsigned int j = split_invperm[i];
-    if(isplit[j] != 1){
+    if(isplit[i] != 1){
         return;
     }
 
-    // Compute the index of the first buffer particle to steal. Take care, the
-    // radix sort is storing the particles to become split at the end of the
+    // Pop the buffer particles to steal. They are taken in order from the
+    // front of the buffer, so the remaining ones are still at the end of the
     // list
-    const unsigned int i0 = N - nbuffer;
-    unsigned int ii = i0 + N_DAUGHTER * (N - j - 1);
+    const unsigned int k = atomic_add(buffer_top, N_DAUGHTER);
     // Check that there are buffer particles enough
-    if(ii + N_DAUGHTER >= N){
+    if(k + N_DAUGHTER > nbuffer){
         // PROBLEMS! This particle cannot be split because we have not buffer
         // particles enough to create the children
         return;
     }
+    unsigned int ii = N - nbuffer + k;
 
     // Insert the daughters
     miter[i] = -1;
@@ -0,0 +1,111 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @addtogroup basic
+ * @{
+ */
+
+/** @file
+ * @brief delta-SPH pressure Laplacian, visiting each pair of particles just
+ * once.
+ */
+
+#ifndef EXCLUDED_PARTICLE
+    /** @brief Condition to exclude a particle from the delta-SPH model
+     * 
+     * By default all the boundary elements are excluded. Even though it is
+     * enough for simulation where fluid and solid mechanics are not combined,
+     * it is strongly recommended to conveniently overload this macro. 
+     * @note Redefining this macro this OpenCL script can be recicled
+     */
+    #define EXCLUDED_PARTICLE(index) imove[index] <= 0
+#endif
+
+#include "resources/Scripts/types/types.h"
+#include "resources/Scripts/KernelFunctions/Kernel.h"
+
+/** @brief Laplacian of the pressure computation.
+ *
+ * Same than the lapp() kernel of basic/deltaSPH.cl, but just the forward half
+ * of the neighbours is traversed (see BEGIN_LOOP_OVER_HALF_NEIGHS()), and
+ * the contribution of each pair is atomically added to both particles (see
+ * atomic_add_f()). Hence the Laplacian shall be initialized before launching
+ * this kernel.
+ *
+ * @param imove Moving flags.
+ *   - imove > 0 for regular fluid particles.
+ *   - imove = 0 for sensors.
+ *   - imove < 0 for boundary elements/particles.
+ * @param r Position \f$ \mathbf{r} \f$.
+ * @param rho Density \f$ \rho \f$.
+ * @param m Mass \f$ m \f$.
+ * @param p Pressure \f$ p \f$.
+ * @param lap_p Pressure laplacian \f$ \Delta p \f$.
+ * @param icell Cell where each particle is located.
+ * @param ihoc Head of chain for each cell (first particle found).
+ * @param N Number of particles.
+ * @param n_cells Number of cells in each direction
+ */
+__kernel void lapp(const __global int* imove,
+                   const __global vec* r,
+                   const __global float* rho,
+                   const __global float* m,
+                   const __global float* p,
+                   __global float* lap_p,
+                   const __global uint *icell,
+                   const __global uint *ihoc,
+                   uint N,
+                   uivec4 n_cells)
+{
+    const uint i = get_global_id(0);
+    if(i >= N)
+        return;
+    if(EXCLUDED_PARTICLE(i))
+        return;
+
+    const vec_xyz r_i = r[i].XYZ;
+    const float p_i = p[i];
+    const float v_i = m[i] / rho[i];
+
+    float lap_p_i = 0.f;
+
+    BEGIN_LOOP_OVER_HALF_NEIGHS(){
+        if(EXCLUDED_PARTICLE(j)){
+            j++;
+            continue;
+        }
+        const vec_xyz r_ij = r[j].XYZ - r_i;
+        const float q = length(r_ij) / H;
+        if(q >= SUPPORT)
+        {
+            j++;
+            continue;
+        }
+        {
+            const float f_ij = kernelF(q) * CONF * (p[j] - p_i);
+            lap_p_i += f_ij * m[j] / rho[j];
+            atomic_add_f(lap_p + j, -f_ij * v_i);
+        }
+    }END_LOOP_OVER_HALF_NEIGHS()
+
+    atomic_add_f(lap_p + i, lap_p_i);
+}
+
+/*
+ * @}
+ */
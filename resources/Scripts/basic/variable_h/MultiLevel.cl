@@ -0,0 +1,98 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @addtogroup basic
+ * @{
+ */
+
+/** @file
+ * @brief Multi-level link-list, for the variable kernel length.
+ *
+ * Each particle is stored in the grid of a level, whose cells are as large as
+ * its kernel support. The cells of all the levels are hashed in a single
+ * table, which can be traversed by BEGIN_LOOP_OVER_LEVELS().
+ */
+
+#include "resources/Scripts/types/types.h"
+
+/** @brief Compute the bucket of each particle.
+ *
+ * The particle is placed at the level l, whose cells length, SUPPORT * h / 2^l
+ * is the smallest one not shorter than the particle kernel support.
+ *
+ * @param imove Moving flags.
+ *   - imove > 0 for regular fluid/solid particles.
+ *   - imove = 0 for sensors.
+ *   - imove < 0 for boundary elements/particles.
+ * @param r Position \f$ \mathbf{r} \f$.
+ * @param h_var Variable kernel length \f$ h \f$.
+ * @param ml_key Bucket of each particle. The buffer particles, as well as the
+ * padding up to n_radix, are sent to the end of the list.
+ * @param N Number of particles.
+ * @param n_radix Number of buckets of each level.
+ * @param ml_levels Number of levels.
+ * @param h Maximum kernel length.
+ */
+__kernel void keys(const __global int* imove,
+                   const __global vec* r,
+                   const __global float* h_var,
+                   __global uint* ml_key,
+                   uint N,
+                   uint n_radix,
+                   uint ml_levels,
+                   float h)
+{
+    const uint i = get_global_id(0);
+    if(i >= n_radix)
+        return;
+    if((i >= N) || (imove[i] <= -255)){
+        ml_key[i] = LIST_END;
+        return;
+    }
+
+    const float level_f = max(0.f, floor(log2(h / h_var[i])));
+    const uint level = min((uint)level_f, ml_levels - 1);
+    const float l = SUPPORT * h / (float)(1u << level);
+    ml_key[i] = ml_bucket(level, ml_cell(r[i], l), n_radix);
+}
+
+/** @brief Compute the head of each bucket.
+ *
+ * @param ml_key Bucket of each particle, sorted.
+ * @param ml_ihoc Head of each bucket, i.e. the first particle of the bucket
+ * in the sorted list, N for the empty buckets.
+ * @param N Number of particles.
+ */
+__kernel void ihoc(const __global uint* ml_key,
+                   __global uint* ml_ihoc,
+                   uint N)
+{
+    const uint i = get_global_id(0);
+    if(i >= N)
+        return;
+
+    const uint key = ml_key[i];
+    if(key == LIST_END)
+        return;
+    if((i == 0) || (ml_key[i - 1] != key))
+        ml_ihoc[key] = i;
+}
+
+/*
+ * @}
+ */
@@ -0,0 +1,269 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @addtogroup cfd
+ * @{
+ */
+
+/** @file
+ * @brief Inlet fed with the particles removed by the outlet, through a queue
+ * of recyclable particles.
+ *
+ * The queue is a ring of sorted particles indexes. Since id_sorted is just
+ * the permutation carried out by the last sorting, the queued indexes are
+ * remapped after each sorting, the same way GP/Sort.cl is remapping the
+ * associations.
+ */
+
+#include "resources/Scripts/types/types.h"
+
+/** @brief Queue all the buffer particles, at the simulation start.
+ *
+ * @param imove Moving flags (imove = -255 for buffer particles).
+ * @param recycle_ids Queue of recyclable particles (sorted indexes).
+ * @param recycle_head First slot of the queue.
+ * @param recycle_n Number of queued particles.
+ * @param N Number of particles.
+ */
+__kernel void init(__global const int* imove,
+                   __global unsigned int* recycle_ids,
+                   __global const unsigned int* recycle_head,
+                   __global unsigned int* recycle_n,
+                   unsigned int N)
+{
+    const unsigned int i = get_global_id(0);
+    if(i >= N)
+        return;
+    if(imove[i] != -255)
+        return;
+
+    const unsigned int k = atomic_inc(recycle_n);
+    recycle_ids[(recycle_head[0] + k) % N] = i;
+}
+
+/** @brief Remap the queued particles after sorting.
+ *
+ * @param recycle_ids Queue of recyclable particles (sorted indexes).
+ * @param recycle_head First slot of the queue.
+ * @param recycle_n Number of queued particles.
+ * @param id_sorted Permutations list from the unsorted space to the sorted
+ * one.
+ * @param N Number of particles.
+ */
+__kernel void remap(__global unsigned int* recycle_ids,
+                    __global const unsigned int* recycle_head,
+                    __global const unsigned int* recycle_n,
+                    __global const unsigned int* id_sorted,
+                    unsigned int N)
+{
+    const unsigned int k = get_global_id(0);
+    if(k >= N)
+        return;
+    // Only the slots currently in the queue hold meaningful indexes
+    if((k + N - recycle_head[0]) % N >= recycle_n[0])
+        return;
+
+    recycle_ids[k] = id_sorted[recycle_ids[k]];
+}
+
+/** @brief Remove the particles far away from the outlet plane, queueing them
+ * to be recycled by the inlet.
+ *
+ * It is the same than the feed kernel of Outlet.cl, but pushing the removed
+ * particles in the queue.
+ *
+ * @param imove Moving flags.
+ *   - imove > 0 for regular fluid particles.
+ *   - imove = 0 for sensors.
+ *   - imove < 0 for boundary elements/particles.
+ * @param r Position \f$ \mathbf{r} \f$.
+ * @param recycle_ids Queue of recyclable particles (sorted indexes).
+ * @param recycle_head First slot of the queue.
+ * @param recycle_n Number of queued particles.
+ * @param N Number of particles.
+ * @param domain_max Maximum point of the computational domain.
+ * @param outlet_r Lower corner of the outlet square.
+ * @param outlet_n = Velocity direction of the generated particles.
+ */
+__kernel void push(__global int* imove,
+                   __global vec* r,
+                   __global unsigned int* recycle_ids,
+                   __global const unsigned int* recycle_head,
+                   __global unsigned int* recycle_n,
+                   unsigned int N,
+                   vec domain_max,
+                   vec outlet_r,
+                   vec outlet_n)
+{
+    // find position in global arrays
+    unsigned int i = get_global_id(0);
+    if(i >= N)
+        return;
+    if(imove[i] != 1)
+        return;
+
+    // Compute the distance to the outlet plane
+    const float dist = dot(r[i] - outlet_r, outlet_n);
+    if(dist < 0.f)
+        return;
+
+    // Destroy the particles far away from the outlet plane
+    if(dist > SUPPORT * H){
+        r[i] = domain_max + VEC_ONE;
+        imove[i] = -256;
+        const unsigned int k = atomic_inc(recycle_n);
+        recycle_ids[(recycle_head[0] + k) % N] = i;
+    }
+}
+
+/** @brief Particles generation at the inlet (i.e. inflow) boundary condition.
+ *
+ * It is the same than the feed kernel of Inlet.cl, but the particles are
+ * taken from the front of the queue, instead of the end of the sorted list.
+ * Hence this kernel should be launched with just one thread per generated
+ * particle, i.e. inlet_N.x * inlet_N.y threads.
+ *
+ * @param imove Moving flags.
+ *   - imove > 0 for regular fluid particles.
+ *   - imove = 0 for sensors.
+ *   - imove < 0 for boundary elements/particles.
+ * @param iset Set of particles index.
+ * @param r Position \f$ \mathbf{r} \f$.
+ * @param u Velocity \f$ \mathbf{u} \f$.
+ * @param dudt Velocity rate of change \f$ \frac{d \mathbf{u}}{d t} \f$.
+ * @param rho Density \f$ \rho \f$.
+ * @param drhodt Density rate of change \f$ \frac{d \rho}{d t} \f$.
+ * @param m Mass \f$ m \f$.
+ * @param p Pressure \f$ p \f$.
+ * @param refd Density of reference of the fluid \f$ \rho_0 \f$.
+ * @param recycle_ids Queue of recyclable particles (sorted indexes).
+ * @param recycle_head First slot of the queue.
+ * @param recycle_n Number of queued particles.
+ * @param N Number of particles.
+ * @param cs Speed of sound \f$ c_s \f$.
+ * @param p0 Background pressure \f$ p_0 \f$.
+ * @param g Gravity acceleration \f$ \mathbf{g} \f$.
+ * @param dr Distance between particles \f$ \Delta r \f$.
+ * @param inlet_r Lower corner of the inlet square.
+ * @param inlet_ru Square U vector.
+ * @param inlet_rv Square V vector.
+ * @param inlet_N Number of particles to be generated in each direction.
+ * @param inlet_n = Velocity direction of the generated particles.
+ * @param inlet_U = Constant inlet velocity magnitude
+ * @param inlet_rFS The point where the pressure is the reference one (0 Pa).
+ * @param inlet_R Accumulated displacement (to be added to the generation point)
+ * @param inlet_starving Is the inlet starving, so we need to feed it?
+ */
+__kernel void feed(__global int* imove,
+                   __global unsigned int* iset,
+                   __global vec* r,
+                   __global vec* u,
+                   __global vec* dudt,
+                   __global float* rho,
+                   __global float* drhodt,
+                   __global float* m,
+                   __global float* p,
+                   __constant float* refd,
+                   __global const unsigned int* recycle_ids,
+                   __global const unsigned int* recycle_head,
+                   __global const unsigned int* recycle_n,
+                   unsigned int N,
+                   float cs,
+                   float p0,
+                   vec g,
+                   float dr,
+                   vec inlet_r,
+                   vec inlet_ru,
+                   vec inlet_rv,
+                   uivec2 inlet_N,
+                   vec inlet_n,
+                   float inlet_U,
+                   vec inlet_rFS,
+                   float inlet_R,
+                   int inlet_starving)
+{
+    // find position in global arrays
+    const unsigned int i = get_global_id(0);
+    if(inlet_starving == 0)
+        return;
+    if((i >= recycle_n[0]) || (i >= (inlet_N.x * inlet_N.y))){
+        // Either the thread has not a queued particle to consume or such
+        // particle is not required
+        return;
+    }
+    const unsigned int ii = recycle_ids[(recycle_head[0] + i) % N];
+
+    // Compute the generation point
+    #ifndef HAVE_3D
+        const float u_fac = ((float)i + 0.5f) / inlet_N.x;
+        const float v_fac = 0.f;
+    #else
+        const unsigned int u_id = i % inlet_N.x;
+        const unsigned int v_id = i / inlet_N.x;
+        const float u_fac = ((float)u_id + 0.5f) / inlet_N.x;
+        const float v_fac = ((float)v_id + 0.5f) / inlet_N.y;
+    #endif
+    r[ii] = inlet_r + u_fac * inlet_ru + v_fac * inlet_rv
+            + (inlet_R - SUPPORT * H - 0.5f * dr) * inlet_n;
+
+    // Set the particle data
+    imove[ii] = 1;
+    dudt[ii] = VEC_ZERO;
+    drhodt[ii] = 0.f;
+    u[ii] = inlet_U * inlet_n;
+    p[ii] = refd[iset[ii]] * dot(g, r[ii] - inlet_rFS);
+    #ifdef HAVE_3D
+        m[ii] = refd[iset[ii]] * dr * dr * dr;
+    #else
+        m[ii] = refd[iset[ii]] * dr * dr;
+    #endif
+    // reversed EOS
+    rho[ii] = refd[iset[ii]] + p[ii] / (cs * cs);
+    p[ii] += p0;
+}
+
+/** @brief Pop the particles consumed by the feed kernel from the queue.
+ *
+ * This kernel should be launched with just one thread.
+ *
+ * @param recycle_head First slot of the queue.
+ * @param recycle_n Number of queued particles.
+ * @param N Number of particles.
+ * @param inlet_N Number of particles to be generated in each direction.
+ * @param inlet_starving Is the inlet starving, so we need to feed it?
+ */
+__kernel void pop(__global unsigned int* recycle_head,
+                  __global unsigned int* recycle_n,
+                  unsigned int N,
+                  uivec2 inlet_N,
+                  int inlet_starving)
+{
+    if(get_global_id(0) > 0)
+        return;
+    if(inlet_starving == 0)
+        return;
+
+    const unsigned int n = min(recycle_n[0], inlet_N.x * inlet_N.y);
+    recycle_head[0] = (recycle_head[0] + n) % N;
+    recycle_n[0] -= n;
+}
+
+/*
+ * @}
+ */
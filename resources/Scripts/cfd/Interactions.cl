@@ -73,13 +73,12 @@ __kernel void entry(const __global int* imove,
                     uint N,
                     uivec4 n_cells)
 {
-    const uint i = get_global_id(0);
+    const uint i = TILED_ID(N);
     const uint it = get_local_id(0);
     if(i >= N)
         return;
-    if(imove[i] != 1){
-        return;
-    }
+    const bool skip_i = imove[i] != 1;
+    TILED_SKIP(skip_i);
 
     const vec_xyz r_i = r[i].XYZ;
     const vec_xyz u_i = u[i].XYZ;
@@ -103,27 +102,39 @@ __kernel void entry(const __global int* imove,
         _DIVU_ = 0.f;
     #endif
 
-    BEGIN_LOOP_OVER_NEIGHS(){
+    TILE_DECLARE(int, imove);
+    TILE_DECLARE(vec, r);
+    TILE_DECLARE(vec, u);
+    TILE_DECLARE(float, rho);
+    TILE_DECLARE(float, m);
+    TILE_DECLARE(float, p);
+
+    BEGIN_TILED_LOOP_OVER_NEIGHS(skip_i){
+        TILE_LOAD(imove);
+        TILE_LOAD(r);
+        TILE_LOAD(u);
+        TILE_LOAD(rho);
+        TILE_LOAD(m);
+        TILE_LOAD(p);
+    }TILED_LOOP_OVER_NEIGHS(){
         if(i == j){
-            j++;
             continue;
         }
-        if(imove[j] != 1){
-            j++;
+        if(TILE(imove) != 1){
             continue;
         }
-        const vec_xyz r_ij = r[j].XYZ - r_i;
+        const vec_xyz r_ij = TILE(r).XYZ - r_i;
         const float q = length(r_ij) / H;
         if(q >= SUPPORT)
         {
-            j++;
             continue;
         }
         {
-            const float rho_j = rho[j];
-            const float p_j = p[j];
-            const float udr = dot(u[j].XYZ - u_i, r_ij);
-            const float f_ij = kernelF(q) * CONF * m[j];
+            const float rho_j = TILE(rho);
+            const float p_j = TILE(p);
+            const vec_xyz u_j = TILE(u).XYZ;
+            const float udr = dot(u_j - u_i, r_ij);
+            const float f_ij = kernelF(q) * CONF * TILE(m);
 
             _GRADP_ += (p_i + p_j) / (rho_i * rho_j) * f_ij * r_ij;
 
@@ -131,14 +142,17 @@ __kernel void entry(const __global int* imove,
                 const float r2 = (q * q + 0.01f) * H * H;
                 _LAPU_ += f_ij * __CLEARY__ * udr / (r2 * rho_i * rho_j) * r_ij;
             #elif __LAP_FORMULATION__ == __LAP_MORRIS__
-                _LAPU_ += f_ij * 2.f / (rho_i * rho_j) * (u[j].XYZ - u_i);
+                _LAPU_ += f_ij * 2.f / (rho_i * rho_j) * (u_j - u_i);
             #else
                 #error Unknown Laplacian formulation: __LAP_FORMULATION__
             #endif
 
             _DIVU_ += udr * f_ij * rho_i / rho_j;
         }
-    }END_LOOP_OVER_NEIGHS()
+    }END_TILED_LOOP_OVER_NEIGHS()
+
+    if(skip_i)
+        return;
 
     #ifdef LOCAL_MEM_SIZE
         grad_p[i].XYZ = _GRADP_;
@@ -48,6 +48,7 @@
    \end{matrix} \right]. \f]
  *
  * @param iset Set of particles index.
+ * @param id_sorted Permutation from the unsorted space to the sorted one.
  * @param imove Moving flags.
  *   - imove > 0 for regular fluid particles.
  *   - imove = 0 for sensors.
@@ -64,6 +65,7 @@
  * @see MotionAcceleration.cl
  */
 __kernel void entry(const __global uint* iset,
+                    const __global uint* id_sorted,
                     const __global int* imove,
                     __global vec* r,
                     __global vec* normal,
@@ -73,9 +75,9 @@ __kernel void entry(const __global uint* iset,
                     vec motion_r,
                     vec4 motion_a)
 {
-    // find position in global arrays
-    int i = get_global_id(0);
-    if(i >= N)
+    // The kernel is launched just over the affected set of particles
+    const uint i = SET_ID(N);
+    if(i == LIST_END)
         return;
     if((iset[i] != motion_iset) || (imove[i] == 1)){
         return;
@@ -55,6 +55,7 @@
  * \f$ -\phi, -\theta, -\psi \f$ angles.
  *
  * @param iset Set of particles index.
+ * @param id_sorted Permutation from the unsorted space to the sorted one.
  * @param imove Moving flags.
  *   - imove > 0 for regular fluid particles.
  *   - imove = 0 for sensors.
@@ -68,6 +69,7 @@
  * @see MotionTransform.cl
  */
 __kernel void entry(const __global uint* iset,
+                    const __global uint* id_sorted,
                     const __global int* imove,
                     __global vec* r,
                     __global vec* normal,
@@ -77,9 +79,9 @@ __kernel void entry(const __global uint* iset,
                     vec motion_r_in,
                     vec4 motion_a_in)
 {
-    // find position in global arrays
-    int i = get_global_id(0);
-    if(i >= N)
+    // The kernel is launched just over the affected set of particles
+    const uint i = SET_ID(N);
+    if(i == LIST_END)
         return;
     if((iset[i] != motion_iset) || (imove[i] == 1)){
         return;
@@ -0,0 +1,125 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief 1st order Euler time integration scheme corrector stage, fused with
+ * the variable time step computation.
+ */
+
+#include "resources/Scripts/types/types.h"
+
+#ifndef DT_BLOCK
+    /** @def DT_BLOCK
+     * @brief Number of particles reduced together to a single time step
+     * candidate.
+     *
+     * It shall be a power of 2, and a divisor of the work group size. The
+     * length of the dt_block array on cfd/fusedTimeStep.xml shall be changed
+     * accordingly.
+     */
+    #define DT_BLOCK 32
+#endif
+
+/** @brief 1st order Euler time integration scheme corrector stage, which is
+ * additionally computing the maximum time step of each block of #DT_BLOCK
+ * particles.
+ *
+ * The integration is carried out in the same way than in
+ * basic/time_scheme/euler.cl, while the time step of each particle is
+ * computed in the same way than in TimeStep.cl, with the updated velocity
+ * still in the registers. Then, the minimum of each block of particles is
+ * written in the dt_block array, so avoiding to read again the velocity and
+ * its rate of change to compute the next time step.
+ *
+ * @param imove Moving flags.
+ *   - imove > 0 for regular fluid particles.
+ *   - imove = 0 for sensors.
+ *   - imove < 0 for boundary elements/particles.
+ * @param r Position \f$ \mathbf{r}_{n+1/2} \f$.
+ * @param u Velocity \f$ \mathbf{u}_{n+1/2} \f$.
+ * @param dudt Velocity rate of change
+ * \f$ \left. \frac{d \mathbf{u}}{d t} \right\vert_{n+1/2} \f$.
+ * @param rho Density \f$ \rho_{n+1/2} \f$.
+ * @param drhodt Density rate of change
+ * \f$ \left. \frac{d \rho}{d t} \right\vert_{n+1/2} \f$.
+ * @param dt_block Minimum time step of each block of #DT_BLOCK particles.
+ * @param N Number of particles.
+ * @param dt Time step \f$ \Delta t \f$.
+ * @param dt_min Minimum time step \f$ \Delta t_{\mathrm{min}} \f$.
+ * @param courant Courant factor \f$ C_f \f$.
+ * @param h Kernel characteristic length \f$ h \f$.
+ * @param cs Speed of sound \f$ c_s \f$.
+ */
+__kernel void entry(const __global int* imove,
+                    __global vec* r,
+                    __global vec* u,
+                    const __global vec* dudt,
+                    __global float* rho,
+                    const __global float* drhodt,
+                    __global float* dt_block,
+                    unsigned int N,
+                    float dt,
+                    float dt_min,
+                    float courant,
+                    float h,
+                    float cs)
+{
+    const unsigned int i = get_global_id(0);
+    const unsigned int it = get_local_id(0);
+    // The threads out of bounds cannot return, since they should reach the
+    // barriers below
+    float dt_i = INFINITY;
+    if(i < N){
+        vec u_i = u[i];
+        const vec dudt_i = dudt[i];
+        if(imove[i] > 0) {
+            r[i] += dt * u_i + 0.5f * dt * dt * dudt_i;
+            u_i += dt * dudt_i;
+            u[i] = u_i;
+            rho[i] += dt * drhodt[i];
+        }
+
+        const float dr_max = 0.1f * h;
+        const float dt_u = courant * min(dr_max / length(u_i),
+                                         sqrt(dr_max / (0.5f * length(dudt_i))));
+        dt_i = max(min(courant * h / cs, dt_u), dt_min);
+    }
+
+    // Reduce the block
+    #ifdef LOCAL_MEM_SIZE
+        __local float dt_l[LOCAL_MEM_SIZE];
+        dt_l[it] = dt_i;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for(unsigned int s = DT_BLOCK / 2; s > 0; s >>= 1){
+            if((it % DT_BLOCK) < s)
+                dt_l[it] = min(dt_l[it], dt_l[it + s]);
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        if((i < N) && !(it % DT_BLOCK))
+            dt_block[i / DT_BLOCK] = dt_l[it];
+    #else
+        // Without local memory, the scratch is the first particle of the
+        // block slot
+        __global float *dt_g = dt_block + i / DT_BLOCK;
+        for(unsigned int s = 0; s < DT_BLOCK; s++){
+            if((i < N) && ((it % DT_BLOCK) == s))
+                *dt_g = s ? min(*dt_g, dt_i) : dt_i;
+            barrier(CLK_GLOBAL_MEM_FENCE);
+        }
+    #endif
+}
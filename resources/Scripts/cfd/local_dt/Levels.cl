@@ -0,0 +1,77 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Local time stepping levels computation.
+ */
+
+#include "resources/Scripts/types/types.h"
+
+/** @brief Compute the time step level of each particle.
+ *
+ * The maximum time step of each particle is estimated in the same way than in
+ * TimeStep.cl, using the variation rates of the last time the particle was
+ * active (the sorted dudt_in array). Then, the particle is binned in the
+ * power-of-two level \f$ l \f$ such that:
+ *
+ * \f$ 2^l \Delta t \leq \Delta t_i < 2^{l + 1} \Delta t \f$
+ *
+ * where \f$ \Delta t \f$ is the global time step, i.e. the one of the finest
+ * level.
+ *
+ * @param imove Moving flags.
+ *   - imove > 0 for regular fluid particles.
+ *   - imove = 0 for sensors.
+ *   - imove < 0 for boundary elements/particles.
+ * @param u Velocity \f$ \mathbf{u} \f$.
+ * @param dudt_in Velocity rate of change \f$ \frac{d \mathbf{u}}{d t} \f$ at
+ * the last time the particle was active.
+ * @param dt_level Time step level of each particle.
+ * @param N Number of particles.
+ * @param dt Global time step \f$ \Delta t \f$.
+ * @param courant Courant factor \f$ C_f \f$.
+ * @param h Kernel characteristic length \f$ h \f$.
+ * @param cs Speed of sound \f$ c_s \f$.
+ * @param lts_levels Maximum time step level.
+ */
+__kernel void entry(const __global int* imove,
+                    const __global vec* u,
+                    const __global vec* dudt_in,
+                    __global unsigned int* dt_level,
+                    unsigned int N,
+                    float dt,
+                    float courant,
+                    float h,
+                    float cs,
+                    unsigned int lts_levels)
+{
+    unsigned int i = get_global_id(0);
+    if(i >= N)
+        return;
+    if((imove[i] != 1) || (dt <= 0.f)){
+        dt_level[i] = 0;
+        return;
+    }
+
+    const float dr_max = 0.1f * h;
+    const float dt_u = courant * min(dr_max / length(u[i]),
+                                     sqrt(dr_max / (0.5f * length(dudt_in[i]))));
+    const float dt_i = min(courant * h / cs, dt_u);
+    const float level = floor(log2(dt_i / dt));
+    dt_level[i] = (uint)clamp(level, 0.f, (float)lts_levels);
+}
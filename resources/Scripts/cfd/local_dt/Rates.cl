@@ -0,0 +1,105 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Velocity and density variation rates computation, for the local
+ * time stepping.
+ */
+
+#include "resources/Scripts/types/types.h"
+
+/** @brief Velocity and density variation rates computation.
+ *
+ * Just the particles active on this sub-step are computing their rates, while
+ * the inactive ones are restoring the ones computed the last time they were
+ * active (see Levels.cl). Such rates are saved in their own arrays, since the
+ * backups of the time integration scheme also contain the terms added by the
+ * tools executed after this one, which would be otherwise added again on each
+ * sub-step.
+ *
+ * The mass conservation and momentum equations are applied from the already
+ * computed differential operators:
+ *
+ *   - \f$ \frac{\mathrm{d} \mathbf{u}}{\mathrm{d} t} =
+ *     - \frac{\nabla p}{rho}
+ *     + \frac{\mu}{rho} \Delta \mathbf{u}
+ *     + \mathbf{g}\f$
+ *   - \f$ \frac{\mathrm{d} \rho}{\mathrm{d} t} =
+ *     - \rho \nabla \cdot \mathbf{u}
+ *     + \delta \Delta t \frac{\rho_a}{\rho_0} \Delta p\f$
+ *
+ * @param iset Set of particles index.
+ * @param imove Moving flags.
+ *   - imove > 0 for regular fluid particles.
+ *   - imove = 0 for sensors.
+ *   - imove < 0 for boundary elements/particles.
+ * @param rho Density \f$ \rho_{n+1} \f$.
+ * @param grad_p Pressure gradient \f$ \frac{\nabla p}{rho} \f$.
+ * @param lap_u Velocity laplacian \f$ \frac{\Delta \mathbf{u}}{rho} \f$.
+ * @param div_u Velocity divergence \f$ \rho \nabla \cdot \mathbf{u} \f$.
+ * @param lts_dudt Velocity rate of change computed by this kernel the last
+ * time the particle was active.
+ * @param lts_drhodt Density rate of change computed by this kernel the last
+ * time the particle was active.
+ * @param dudt Velocity rate of change
+ * \f$ \left. \frac{d \mathbf{u}}{d t} \right\vert_{n+1} \f$.
+ * @param drhodt Density rate of change
+ * \f$ \left. \frac{d \rho}{d t} \right\vert_{n+1} \f$.
+ * @param dt_level Time step level of each particle.
+ * @param visc_dyn Dynamic viscosity \f$ \mu \f$.
+ * @param N Number of particles.
+ * @param iter Sub-step index.
+ * @param g Gravity acceleration \f$ \mathbf{g} \f$.
+ */
+__kernel void entry(const __global uint* iset,
+                    const __global int* imove,
+                    const __global float* rho,
+                    const __global vec* grad_p,
+                    const __global vec* lap_u,
+                    const __global float* div_u,
+                    __global vec* lts_dudt,
+                    __global float* lts_drhodt,
+                    __global vec* dudt,
+                    __global float* drhodt,
+                    const __global unsigned int* dt_level,
+                    __constant float* visc_dyn,
+                    unsigned int N,
+                    unsigned int iter,
+                    vec g)
+{
+    unsigned int i = get_global_id(0);
+    if(i >= N)
+        return;
+    if(imove[i] != 1)
+        return;
+
+    if(iter & ((1u << dt_level[i]) - 1u)){
+        // Inactive particle, just restore the last rates
+        dudt[i] = lts_dudt[i];
+        drhodt[i] = lts_drhodt[i];
+        return;
+    }
+
+    // Momentum equation
+    dudt[i] = -grad_p[i] + visc_dyn[iset[i]] * lap_u[i] + g;
+    // Conservation of mass equation
+    drhodt[i] = -div_u[i];
+
+    lts_dudt[i] = dudt[i];
+    lts_drhodt[i] = drhodt[i];
+}
\ No newline at end of file
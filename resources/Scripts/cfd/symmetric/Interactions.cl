@@ -0,0 +1,151 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @addtogroup cfd
+ * @{
+ */
+
+/** @file
+ * @brief Fluid particles interactions computation, visiting each pair of
+ * particles just once.
+ */
+
+#include "resources/Scripts/types/types.h"
+#include "resources/Scripts/KernelFunctions/Kernel.h"
+
+#if __LAP_FORMULATION__ == __LAP_MONAGHAN__
+    #ifndef HAVE_3D
+        #define __CLEARY__ 8.f
+    #else
+        #define __CLEARY__ 10.f
+    #endif
+#endif
+
+/** @brief Fluid particles interactions computation.
+ *
+ * Same than cfd/Interactions.cl, but just the forward half of the neighbours
+ * is traversed (see BEGIN_LOOP_OVER_HALF_NEIGHS()), and the contribution of
+ * each pair is added to both particles. Hence the distance, the kernel
+ * function and the shared terms are computed just once per pair.
+ *
+ * The contributions of the particle i are accumulated in private memory and
+ * atomically added at the end, while the contributions to the particles j are
+ * atomically added as soon as they are computed (see atomic_add_f()), so the
+ * outputs shall be initialized before launching this kernel.
+ *
+ * @param imove Moving flags.
+ *   - imove > 0 for regular fluid particles.
+ *   - imove = 0 for sensors.
+ *   - imove < 0 for boundary elements/particles.
+ * @param r Position \f$ \mathbf{r} \f$.
+ * @param u Velocity \f$ \mathbf{u} \f$.
+ * @param rho Density \f$ \rho \f$.
+ * @param m Mass \f$ m \f$.
+ * @param p Pressure \f$ p \f$.
+ * @param grad_p Pressure gradient \f$ \frac{\nabla p}{rho} \f$.
+ * @param lap_u Velocity laplacian \f$ \frac{\Delta \mathbf{u}}{rho} \f$.
+ * @param div_u Velocity divergence \f$ \rho \nabla \cdot \mathbf{u} \f$.
+ * @param icell Cell where each particle is located.
+ * @param ihoc Head of chain for each cell (first particle found).
+ * @param N Number of particles.
+ * @param n_cells Number of cells in each direction
+ */
+__kernel void entry(const __global int* imove,
+                    const __global vec* r,
+                    const __global vec* u,
+                    const __global float* rho,
+                    const __global float* m,
+                    const __global float* p,
+                    __global vec* grad_p,
+                    __global vec* lap_u,
+                    __global float* div_u,
+                    // Link-list data
+                    const __global uint *icell,
+                    const __global uint *ihoc,
+                    // Simulation data
+                    uint N,
+                    uivec4 n_cells)
+{
+    const uint i = get_global_id(0);
+    if(i >= N)
+        return;
+    if(imove[i] != 1)
+        return;
+
+    const vec_xyz r_i = r[i].XYZ;
+    const vec_xyz u_i = u[i].XYZ;
+    const float p_i = p[i];
+    const float rho_i = rho[i];
+    const float m_i = m[i];
+
+    vec_xyz grad_p_i = VEC_ZERO.XYZ;
+    vec_xyz lap_u_i = VEC_ZERO.XYZ;
+    float div_u_i = 0.f;
+
+    BEGIN_LOOP_OVER_HALF_NEIGHS(){
+        if(imove[j] != 1){
+            j++;
+            continue;
+        }
+        const vec_xyz r_ij = r[j].XYZ - r_i;
+        const float q = length(r_ij) / H;
+        if(q >= SUPPORT)
+        {
+            j++;
+            continue;
+        }
+        {
+            const float rho_j = rho[j];
+            const float p_j = p[j];
+            const float m_j = m[j];
+            const vec_xyz u_j = u[j].XYZ;
+            const float udr = dot(u_j - u_i, r_ij);
+            const float f = kernelF(q) * CONF;
+            const float rho_ij = rho_i * rho_j;
+
+            const vec_xyz grad_p_ij = (p_i + p_j) / rho_ij * f * r_ij;
+            grad_p_i += m_j * grad_p_ij;
+            atomic_add_vec(grad_p + j, -m_i * grad_p_ij);
+
+            #if __LAP_FORMULATION__ == __LAP_MONAGHAN__
+                const float r2 = (q * q + 0.01f) * H * H;
+                const vec_xyz lap_u_ij =
+                    f * __CLEARY__ * udr / (r2 * rho_ij) * r_ij;
+                lap_u_i += m_j * lap_u_ij;
+                atomic_add_vec(lap_u + j, -m_i * lap_u_ij);
+            #elif __LAP_FORMULATION__ == __LAP_MORRIS__
+                const vec_xyz lap_u_ij = f * 2.f / rho_ij * (u_j - u_i);
+                lap_u_i += m_j * lap_u_ij;
+                atomic_add_vec(lap_u + j, -m_i * lap_u_ij);
+            #else
+                #error Unknown Laplacian formulation: __LAP_FORMULATION__
+            #endif
+
+            div_u_i += udr * f * m_j * rho_i / rho_j;
+            atomic_add_f(div_u + j, udr * f * m_i * rho_j / rho_i);
+        }
+    }END_LOOP_OVER_HALF_NEIGHS()
+
+    atomic_add_vec(grad_p + i, grad_p_i);
+    atomic_add_vec(lap_u + i, lap_u_i);
+    atomic_add_f(div_u + i, div_u_i);
+}
+
+/*
+ * @}
+ */
@@ -0,0 +1,35 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @addtogroup lela
+ * @{
+ */
+
+/** @file
+ * @brief Symmetric delta-SPH for the linear elasticity module.
+ */
+
+/** @brief Restrict the aplication to the solid particles (imove=2)
+ */
+#define EXCLUDED_PARTICLE(index) imove[index] != 2
+
+/*
+ * @}
+ */
+
+#include "../../basic/symmetric/deltaSPH.cl"
\ No newline at end of file
@@ -20,6 +20,9 @@
  * @brief Type definitions for the OpenCL kernels (2D version).
  */
 
+#ifndef _TYPES_2D_H_INCLUDED_
+#define _TYPES_2D_H_INCLUDED_
+
 #ifndef INFINITY
     #define INFINITY FLT_MAX
 #endif
@@ -146,6 +149,8 @@
  */
 #define XYZ xy
 
+#include "resources/Scripts/types/cells.h"
+
 /** @brief Utility to can redefine the cell of the particle to be  computed.
  * 
  * It can be used for mirrrored particles, which are temporary associated to a
@@ -175,8 +180,33 @@
  *   - c_j: Index of the cell of the neighbour particle j
  *   - j: Index of the neighbour particle.
  *
+ * If MORTON_CELLS is defined, the cells are assumed to be Morton ordered,
+ * while if HASHED_CELLS is defined, the cells are assumed to be stored in a
+ * hash table (see Aqua::CalcServer::LinkList). In the latter case, the
+ * particles of far cells sharing the bucket are traversed as well, so they
+ * shall be discarded by the distance.
+ *
  * @see END_LOOP_OVER_NEIGHS
  */
+#ifdef MORTON_CELLS
+#define BEGIN_LOOP_OVER_NEIGHS()                                               \
+    C_I();                                                                     \
+    const uivec4 _masks = morton_masks(n_cells);                               \
+    for(int ci = -1; ci <= 1; ci++) {                                          \
+        const uint _c_x = morton_offset(c_i, ci, _masks.x);                    \
+        for(int cj = -1; cj <= 1; cj++) {                                      \
+            const uint c_j = morton_offset(_c_x, cj, _masks.y);                \
+            uint j = ihoc[c_j];                                                \
+            while((j < N) && (icell[j] == c_j)) {
+#elif defined(HASHED_CELLS)
+#define BEGIN_LOOP_OVER_NEIGHS()                                               \
+    C_I();                                                                     \
+    for(int ci = -1; ci <= 1; ci++) {                                          \
+        for(int cj = -1; cj <= 1; cj++) {                                      \
+            const uint c_j = hashed_offset(c_i, ci, cj, n_cells);              \
+            uint j = ihoc[c_j];                                                \
+            while((j < N) && (icell[j] == c_j)) {
+#else
 #define BEGIN_LOOP_OVER_NEIGHS()                                               \
     C_I();                                                                     \
     for(int ci = -1; ci <= 1; ci++) {                                          \
@@ -186,6 +216,7 @@
                              cj * n_cells.x;                                   \
             uint j = ihoc[c_j];                                                \
             while((j < N) && (icell[j] == c_j)) {
+#endif
 
 /** @brief End of the loop over the neighs to compute the interactions.
  * 
@@ -197,6 +228,314 @@
         }                                                                      \
     }
 
+/** @brief Loop over the neighs stored in the Verlet neighbours list.
+ *
+ * All the code between this macro and END_LOOP_OVER_NEIGHS_LIST will be
+ * executed for all the neighbours listed by the neighbour-list tool (see
+ * Aqua::CalcServer::NeighbourList), which is a faster alternative to
+ * BEGIN_LOOP_OVER_NEIGHS.
+ *
+ * To use this macro, the main particle should be identified by an unsigned
+ * integer variable i, and the kernel should receive the arrays n_neighs and
+ * neighs, as well as the number of particles N. The resulting neighs will be
+ * automatically identified by the unsigned integer variable j. To discard a
+ * neighbour particle, just call \code{.c}continue\endcode (the
+ * \code{.c}j++\endcode call is harmless).
+ *
+ * The following variables will be declared, and therefore cannot be used
+ * elsewhere:
+ *   - _k: Index of the neighbour in the list
+ *   - j: Index of the neighbour particle.
+ *
+ * @see END_LOOP_OVER_NEIGHS_LIST
+ */
+#define BEGIN_LOOP_OVER_NEIGHS_LIST()                                          \
+    for(uint _k = 0; _k < n_neighs[i]; _k++) {                                 \
+        uint j = neighs[_k * N + i];
+
+/** @brief End of the loop over the Verlet neighbours list.
+ *
+ * @see BEGIN_LOOP_OVER_NEIGHS_LIST
+ */
+#define END_LOOP_OVER_NEIGHS_LIST()                                            \
+    }
+
+/** @brief Loop over the neighs using the multi-level link-list.
+ *
+ * All the code between this macro and END_LOOP_OVER_LEVELS will be executed
+ * for all the neighbours found in the grids of each level of the multi-level
+ * link-list (see cfd/variable_h/multilevel.xml preset). The cells of the
+ * level l have a length SUPPORT * h / 2^l, where h is the maximum kernel
+ * length, and each particle is stored in the finest level whose cells are
+ * not shorter than its kernel support. Then just the cells intersecting
+ * the support of the particle i, or the support of the particles of the
+ * level, whichever is larger, are traversed.
+ *
+ * To use this macro, the main particle should be identified by an unsigned
+ * integer variable i, and the kernel should receive the arrays r, ml_key,
+ * ml_perm and ml_ihoc, as well as the number of particles N, the number of
+ * buckets per level n_radix, the number of levels ml_levels and the maximum
+ * kernel length h. The resulting neighs will be automatically identified by
+ * the unsigned integer variable j. To discard a neighbour particle, just
+ * call \code{.c}continue\endcode (the \code{.c}j++\endcode call is
+ * harmless).
+ *
+ * The following variables will be declared, and therefore cannot be used
+ * elsewhere:
+ *   - _level: Level of the grid
+ *   - _h_l: Kernel length of the level
+ *   - _l: Length of the cells of the level
+ *   - _n: Number of cells to traverse at each side
+ *   - _c_i: The cell where the particle i is placed
+ *   - ci, cj: Cell offsets of the neighbour cell
+ *   - _c_j: Neighbour cell
+ *   - _key: Bucket of the neighbour cell
+ *   - _k: Index of the neighbour in the sorted list
+ *   - j: Index of the neighbour particle.
+ *
+ * @param _h_i Kernel length of the particle i.
+ * @see END_LOOP_OVER_LEVELS
+ */
+#define BEGIN_LOOP_OVER_LEVELS(_h_i)                                           \
+    for(uint _level = 0; _level < ml_levels; _level++) {                       \
+        const float _h_l = h / (float)(1u << _level);                          \
+        const float _l = SUPPORT * _h_l;                                       \
+        const int _n = max(1, (int)ceil((_h_i) / _h_l));                       \
+        const ivec _c_i = ml_cell(r[i], _l);                                   \
+        for(int ci = -_n; ci <= _n; ci++) {                                    \
+            for(int cj = -_n; cj <= _n; cj++) {                                \
+                ivec _c_j = _c_i;                                              \
+                _c_j.x += ci;                                                  \
+                _c_j.y += cj;                                                  \
+                const uint _key = ml_bucket(_level, _c_j, n_radix);            \
+                for(uint _k = ml_ihoc[_key];                                   \
+                    (_k < N) && (ml_key[_k] == _key);                          \
+                    _k++) {                                                    \
+                    uint j = ml_perm[_k];                                      \
+                    if(any(ml_cell(r[j], _l) != _c_j))                         \
+                        continue;
+
+/** @brief End of the loop over the neighs using the multi-level link-list.
+ *
+ * @see BEGIN_LOOP_OVER_LEVELS
+ */
+#define END_LOOP_OVER_LEVELS()                                                 \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+    }
+/** @brief Loop over the forward half of the neighs, to compute each pair of
+ * particles just once.
+ *
+ * Same than BEGIN_LOOP_OVER_NEIGHS, but just the neighbour cells located
+ * "forward" of the cell of the particle i, i.e. the ones with a positive
+ * offset in the y, x lexicographic order, are visited. The particles in
+ * the cell of i are visited just if j > i. Hence each pair of neighbours is
+ * found just by one of the particles, which shall accumulate the
+ * contributions to both of them (see atomic_add_f()).
+ *
+ * The same variables than in BEGIN_LOOP_OVER_NEIGHS will be declared.
+ *
+ * @see END_LOOP_OVER_HALF_NEIGHS
+ */
+#ifdef MORTON_CELLS
+#define BEGIN_LOOP_OVER_HALF_NEIGHS()                                          \
+    C_I();                                                                     \
+    const uivec4 _masks = morton_masks(n_cells);                               \
+    for(int ci = -1; ci <= 1; ci++) {                                          \
+        for(int cj = -1; cj <= 1; cj++) {                                      \
+            if((cj < 0) || ((cj == 0) && (ci < 0)))                            \
+                continue;                                                      \
+            const uint c_j = morton_offset(                                    \
+                morton_offset(c_i, ci, _masks.x), cj, _masks.y);               \
+            uint j = (ci || cj) ? ihoc[c_j] : i + 1;                           \
+            while((j < N) && (icell[j] == c_j)) {
+#elif defined(HASHED_CELLS)
+#define BEGIN_LOOP_OVER_HALF_NEIGHS()                                          \
+    C_I();                                                                     \
+    for(int ci = -1; ci <= 1; ci++) {                                          \
+        for(int cj = -1; cj <= 1; cj++) {                                      \
+            if((cj < 0) || ((cj == 0) && (ci < 0)))                            \
+                continue;                                                      \
+            const uint c_j = hashed_offset(c_i, ci, cj, n_cells);              \
+            uint j = (ci || cj) ? ihoc[c_j] : i + 1;                           \
+            while((j < N) && (icell[j] == c_j)) {
+#else
+#define BEGIN_LOOP_OVER_HALF_NEIGHS()                                          \
+    C_I();                                                                     \
+    for(int ci = -1; ci <= 1; ci++) {                                          \
+        for(int cj = -1; cj <= 1; cj++) {                                      \
+            if((cj < 0) || ((cj == 0) && (ci < 0)))                            \
+                continue;                                                      \
+            const uint c_j = c_i +                                             \
+                             ci +                                              \
+                             cj * n_cells.x;                                   \
+            uint j = (ci || cj) ? ihoc[c_j] : i + 1;                           \
+            while((j < N) && (icell[j] == c_j)) {
+#endif
+
+/** @brief End of the loop over the forward half of the neighs.
+ *
+ * @see BEGIN_LOOP_OVER_HALF_NEIGHS
+ */
+#define END_LOOP_OVER_HALF_NEIGHS() END_LOOP_OVER_NEIGHS()
+
+/** @def _TILED_NEIGHS_
+ * @brief Defined if the tiled neighbours loops are staging the neighbours data
+ * into local memory.
+ *
+ * It requires the TILED_NEIGHS definition, as well as the local memory (see
+ * LOCAL_MEM_SIZE) and the row-major ordered cells.
+ */
+#if defined(TILED_NEIGHS) && defined(LOCAL_MEM_SIZE) && \
+    !defined(MORTON_CELLS) && !defined(HASHED_CELLS)
+    #define _TILED_NEIGHS_
+#endif
+
+#ifdef _TILED_NEIGHS_
+
+/** @brief First sorted particle whose cell is not lower than a given one.
+ *
+ * @param icell Cell where each particle is located, sorted.
+ * @param N Number of particles.
+ * @param c Cell to look for.
+ * @return Index of the particle, N if all the cells are lower.
+ */
+uint tiled_lower_bound(const __global uint *icell, const uint N, const uint c)
+{
+    uint a = 0, b = N;
+    while(a < b) {
+        const uint mid = (a + b) / 2;
+        if(icell[mid] < c)
+            a = mid + 1;
+        else
+            b = mid;
+    }
+    return a;
+}
+
+/** @brief Index of the particle to be computed by the tiled loops.
+ *
+ * All the work items shall take part in the tiles staging, so the ones out of
+ * bounds are redundantly computing the last particle.
+ */
+#define TILED_ID(_N) min((uint)get_global_id(0), (uint)(_N) - 1u)
+
+/** @brief Exit the work items excluded from the tiled loop.
+ *
+ * The work items are still required to stage the tiles, so they are never
+ * exiting here, but just skipped by TILED_LOOP_OVER_NEIGHS().
+ */
+#define TILED_SKIP(_SKIP)
+
+/** @brief Declare the local memory tile of an array.
+ */
+#define TILE_DECLARE(_T, _NAME) __local _T _NAME ## _tile[LOCAL_MEM_SIZE]
+
+/** @brief Stage the neighbour j of an array into its tile.
+ */
+#define TILE_LOAD(_NAME) _NAME ## _tile[_t] = _NAME[j]
+
+/** @brief Neighbour j of an array, read from its tile.
+ */
+#define TILE(_NAME) _NAME ## _tile[_t]
+
+/** @brief Loop over the neighs, staged into local memory by tiles.
+ *
+ * The work group is cooperatively loading the particles of the 3 rows of
+ * neighbour cells of all the work items, which are contiguous in memory after
+ * the sorting, into local memory tiles. Hence each neighbour is read from the
+ * global memory just once per work group, instead of once per particle.
+ *
+ * The code between this macro and TILED_LOOP_OVER_NEIGHS() is staging the
+ * neighbour j with TILE_LOAD(), while the code between
+ * TILED_LOOP_OVER_NEIGHS() and END_TILED_LOOP_OVER_NEIGHS() is executed for
+ * all the neighbours, reading them with TILE():
+ * @code{.c}
+    TILE_DECLARE(vec, r);
+    BEGIN_TILED_LOOP_OVER_NEIGHS(imove[i] != 1){
+        TILE_LOAD(r);
+    }TILED_LOOP_OVER_NEIGHS(){
+        const vec_xyz r_ij = TILE(r).XYZ - r_i;
+        ...
+    }END_TILED_LOOP_OVER_NEIGHS()
+ * @endcode
+ *
+ * The work items cannot return before the end of the loop, so the particle i
+ * shall be identified with TILED_ID(), and excluded by the _SKIP argument
+ * (see TILED_SKIP()). To discard a neighbour particle just call
+ * \code{.c}continue\endcode
+ *
+ * The following variables will be declared, and therefore cannot be used
+ * elsewhere:
+ *   - c_i: The cell where the particle i is placed
+ *   - cj: Index of the row of neighbour cells, in the y direction
+ *   - j: Index of the neighbour particle.
+ *
+ * If the tiles cannot be used (see _TILED_NEIGHS_), BEGIN_LOOP_OVER_NEIGHS()
+ * is used instead.
+ *
+ * @param _SKIP Condition to skip the particle i.
+ * @see TILED_LOOP_OVER_NEIGHS
+ * @see END_TILED_LOOP_OVER_NEIGHS
+ */
+#define BEGIN_TILED_LOOP_OVER_NEIGHS(_SKIP)                                    \
+    C_I();                                                                     \
+    const bool _skip_i = (_SKIP);                                              \
+    __local uint _c_tile[LOCAL_MEM_SIZE];                                      \
+    const uint _i0 = get_group_id(0) * get_local_size(0);                      \
+    const uint _c0 = icell[min(_i0, N - 1u)];                                  \
+    const uint _c1 = icell[min(_i0 + (uint)get_local_size(0), N) - 1u];        \
+    for(int cj = -1; cj <= 1; cj++) {                                          \
+        const uint _c_off = cj * n_cells.x;                                    \
+        const uint _j0 = tiled_lower_bound(icell, N, _c0 - 1u + _c_off);       \
+        const uint _j1 = tiled_lower_bound(icell, N, _c1 + 2u + _c_off);       \
+        for(uint _j = _j0; _j < _j1; _j += get_local_size(0)) {                \
+            const uint _n = min((uint)get_local_size(0), _j1 - _j);            \
+            barrier(CLK_LOCAL_MEM_FENCE);                                      \
+            if(get_local_id(0) < _n) {                                         \
+                const uint _t = get_local_id(0);                               \
+                const uint j = _j + _t;                                        \
+                _c_tile[_t] = icell[j];
+
+/** @brief Start of the tiled loop body.
+ *
+ * @see BEGIN_TILED_LOOP_OVER_NEIGHS
+ */
+#define TILED_LOOP_OVER_NEIGHS()                                               \
+            }                                                                  \
+            barrier(CLK_LOCAL_MEM_FENCE);                                      \
+            for(uint _t = 0; !_skip_i && (_t < _n); _t++) {                    \
+                const uint j = _j + _t;                                        \
+                if(_c_tile[_t] + 1u - (c_i + _c_off) > 2u)                     \
+                    continue;
+
+/** @brief End of the tiled loop over the neighs.
+ *
+ * @see BEGIN_TILED_LOOP_OVER_NEIGHS
+ */
+#define END_TILED_LOOP_OVER_NEIGHS()                                           \
+            }                                                                  \
+        }                                                                      \
+    }
+
+#else
+
+#define TILED_ID(_N) get_global_id(0)
+#define TILED_SKIP(_SKIP) if(_SKIP) return
+#define TILE_DECLARE(_T, _NAME)
+#define TILE_LOAD(_NAME)
+#define TILE(_NAME) _NAME[j]
+#define BEGIN_TILED_LOOP_OVER_NEIGHS(_SKIP)                                    \
+    BEGIN_LOOP_OVER_NEIGHS() do {                                              \
+    if(0)
+#define TILED_LOOP_OVER_NEIGHS()
+#define END_TILED_LOOP_OVER_NEIGHS()                                           \
+    } while(0);                                                                \
+    END_LOOP_OVER_NEIGHS()
+
+#endif  // _TILED_NEIGHS_
+
 /** @brief Multiply a matrix by a vector (inner product)
  */
 #define MATRIX_DOT(_M, _V)                                                     \
@@ -285,3 +624,5 @@ matrix inv(const matrix m)
  */
 #define MATRIX_INV(_M)                                                         \
     MATRIX_MUL(inv(MATRIX_MUL(_M.TRANSPOSE, _M)), _M.TRANSPOSE)
+
+#endif  // _TYPES_2D_H_INCLUDED_
@@ -0,0 +1,306 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Cells helpers shared by the link-list, neighbours list and
+ * interaction kernels.
+ *
+ * The Morton ordered cells helpers are defined if MORTON_CELLS is defined,
+ * and the hashed cells ones if HASHED_CELLS is defined. The multi-level
+ * link-list helpers are always defined.
+ *
+ * The types uint, vec, ivec, uivec and uivec4 shall be already defined.
+ */
+
+#ifndef _TYPES_CELLS_H_INCLUDED_
+#define _TYPES_CELLS_H_INCLUDED_
+
+#ifdef MORTON_CELLS
+
+/** @brief Spread the bits of an integer over the bits of a Morton mask.
+ *
+ * @param v Integer to dilate.
+ * @param mask Morton mask of the axis (see morton_masks()).
+ * @return Dilated integer.
+ */
+uint morton_dilate(uint v, const uint mask)
+{
+    uint r = 0;
+    for(uint m = mask; v && m; m &= m - 1u, v >>= 1) {
+        if(v & 1u)
+            r |= m & (~m + 1u);
+    }
+    return r;
+}
+
+/** @brief Move a Morton ordered cell along an axis.
+ *
+ * The dilated integers arithmetic is applied, such that the cell is never
+ * decoded.
+ *
+ * @param c Morton index of the cell.
+ * @param d Number of cells to move.
+ * @param mask Morton mask of the axis (see morton_masks()).
+ * @return Morton index of the resulting cell.
+ */
+uint morton_offset(const uint c, const int d, const uint mask)
+{
+    const uint dd = morton_dilate(abs(d), mask);
+    const uint part = c & mask;
+    const uint moved = (d >= 0) ? ((part | ~mask) + dd) & mask :
+                                  (part - dd) & mask;
+    return (c & ~mask) | moved;
+}
+
+#ifdef HAVE_3D
+
+/** @brief Bits of the Morton index associated with each axis.
+ *
+ * The bits of each axis are interleaved while the number of cells in such
+ * direction requires them, so the Morton indexes are not much larger than
+ * the number of cells even in elongated domains.
+ *
+ * @param n_cells Number of cells at each direction.
+ * @return Masks of the x, y and z axes.
+ */
+uivec4 morton_masks(const uivec4 n_cells)
+{
+    const uint bx = (n_cells.x > 1) ? 32 - clz(n_cells.x - 1) : 0;
+    const uint by = (n_cells.y > 1) ? 32 - clz(n_cells.y - 1) : 0;
+    const uint bz = (n_cells.z > 1) ? 32 - clz(n_cells.z - 1) : 0;
+    uivec4 masks = (uivec4)(0, 0, 0, 0);
+    uint p = 0;
+    for(uint l = 0; (l < bx) || (l < by) || (l < bz); l++) {
+        if(l < bx)
+            masks.x |= 1u << p++;
+        if(l < by)
+            masks.y |= 1u << p++;
+        if(l < bz)
+            masks.z |= 1u << p++;
+    }
+    return masks;
+}
+
+/** @brief Morton index of a cell.
+ *
+ * @param cell Cell coordinates.
+ * @param masks Morton masks (see morton_masks()).
+ * @return Morton index of the cell.
+ */
+uint morton_cell(const uivec cell, const uivec4 masks)
+{
+    return morton_dilate(cell.x, masks.x) |
+           morton_dilate(cell.y, masks.y) |
+           morton_dilate(cell.z, masks.z);
+}
+
+#else
+
+/** @brief Bits of the Morton index associated with each axis.
+ *
+ * The bits of each axis are interleaved while the number of cells in such
+ * direction requires them, so the Morton indexes are not much larger than
+ * the number of cells even in elongated domains.
+ *
+ * @param n_cells Number of cells at each direction.
+ * @return Masks of the x and y axes.
+ */
+uivec4 morton_masks(const uivec4 n_cells)
+{
+    const uint bx = (n_cells.x > 1) ? 32 - clz(n_cells.x - 1) : 0;
+    const uint by = (n_cells.y > 1) ? 32 - clz(n_cells.y - 1) : 0;
+    uivec4 masks = (uivec4)(0, 0, 0, 0);
+    uint p = 0;
+    for(uint l = 0; (l < bx) || (l < by); l++) {
+        if(l < bx)
+            masks.x |= 1u << p++;
+        if(l < by)
+            masks.y |= 1u << p++;
+    }
+    return masks;
+}
+
+/** @brief Morton index of a cell.
+ *
+ * @param cell Cell coordinates.
+ * @param masks Morton masks (see morton_masks()).
+ * @return Morton index of the cell.
+ */
+uint morton_cell(const uivec cell, const uivec4 masks)
+{
+    return morton_dilate(cell.x, masks.x) |
+           morton_dilate(cell.y, masks.y);
+}
+
+#endif
+
+#endif  // MORTON_CELLS
+
+#ifdef HASHED_CELLS
+
+#ifdef HAVE_3D
+
+/** @brief Bucket of the hash table where a cell is stored.
+ *
+ * The row-major index of the cell in the virtual grid is folded over the
+ * table, so the neighbour buckets can be computed without decoding the cell
+ * (see hashed_offset()).
+ *
+ * @param cell Cell coordinates.
+ * @param n_cells Number of cells at each direction, and the number of
+ * buckets.
+ * @return Bucket of the cell.
+ */
+uint hashed_cell(const uivec cell, const uivec4 n_cells)
+{
+    const ulong c = (ulong)cell.x +
+                    (ulong)cell.y * n_cells.x +
+                    (ulong)cell.z * n_cells.x * n_cells.y;
+    return (uint)(c % n_cells.w);
+}
+
+/** @brief Bucket of a neighbour cell.
+ *
+ * @param c Bucket of the cell.
+ * @param ci Number of cells to move in the x direction.
+ * @param cj Number of cells to move in the y direction.
+ * @param ck Number of cells to move in the z direction.
+ * @param n_cells Number of cells at each direction, and the number of
+ * buckets.
+ * @return Bucket of the neighbour cell.
+ */
+uint hashed_offset(const uint c, const int ci, const int cj, const int ck,
+                   const uivec4 n_cells)
+{
+    const long d = (long)ci +
+                   (long)cj * n_cells.x +
+                   (long)ck * n_cells.x * n_cells.y;
+    return (uint)(((long)c + d + n_cells.w) % n_cells.w);
+}
+
+#else
+
+/** @brief Bucket of the hash table where a cell is stored.
+ *
+ * The row-major index of the cell in the virtual grid is folded over the
+ * table, so the neighbour buckets can be computed without decoding the cell
+ * (see hashed_offset()).
+ *
+ * @param cell Cell coordinates.
+ * @param n_cells Number of cells at each direction, and the number of
+ * buckets.
+ * @return Bucket of the cell.
+ */
+uint hashed_cell(const uivec cell, const uivec4 n_cells)
+{
+    const ulong c = (ulong)cell.x +
+                    (ulong)cell.y * n_cells.x;
+    return (uint)(c % n_cells.w);
+}
+
+/** @brief Bucket of a neighbour cell.
+ *
+ * @param c Bucket of the cell.
+ * @param ci Number of cells to move in the x direction.
+ * @param cj Number of cells to move in the y direction.
+ * @param n_cells Number of cells at each direction, and the number of
+ * buckets.
+ * @return Bucket of the neighbour cell.
+ */
+uint hashed_offset(const uint c, const int ci, const int cj,
+                   const uivec4 n_cells)
+{
+    const long d = (long)ci +
+                   (long)cj * n_cells.x;
+    return (uint)(((long)c + d + n_cells.w) % n_cells.w);
+}
+
+#endif
+
+#endif  // HASHED_CELLS
+
+#ifdef HAVE_3D
+
+/** @brief Cell of a point in a level of the multi-level link-list.
+ *
+ * @param r Point.
+ * @param l Length of the cells of the level.
+ * @return Cell coordinates.
+ * @see BEGIN_LOOP_OVER_LEVELS
+ */
+ivec ml_cell(const vec r, const float l)
+{
+    return convert_int4(floor(r / l));
+}
+
+/** @brief Bucket of the multi-level link-list where a cell is stored.
+ *
+ * Differently to hashed_cell(), the cells are not bounded by a virtual grid,
+ * so several cells of the stencil may share a bucket. Hence the particles
+ * shall be discarded by their actual cell, not by the distance.
+ *
+ * @param level Level of the cell.
+ * @param c Cell coordinates.
+ * @param n_radix Number of buckets of each level.
+ * @return Bucket of the cell.
+ * @see BEGIN_LOOP_OVER_LEVELS
+ */
+uint ml_bucket(const uint level, const ivec c, const uint n_radix)
+{
+    const uint hash = ((uint)c.x * 73856093u) ^
+                      ((uint)c.y * 19349663u) ^
+                      ((uint)c.z * 83492791u);
+    return level * n_radix + hash % n_radix;
+}
+
+#else
+
+/** @brief Cell of a point in a level of the multi-level link-list.
+ *
+ * @param r Point.
+ * @param l Length of the cells of the level.
+ * @return Cell coordinates.
+ * @see BEGIN_LOOP_OVER_LEVELS
+ */
+ivec ml_cell(const vec r, const float l)
+{
+    return convert_int2(floor(r / l));
+}
+
+/** @brief Bucket of the multi-level link-list where a cell is stored.
+ *
+ * Differently to hashed_cell(), the cells are not bounded by a virtual grid,
+ * so several cells of the stencil may share a bucket. Hence the particles
+ * shall be discarded by their actual cell, not by the distance.
+ *
+ * @param level Level of the cell.
+ * @param c Cell coordinates.
+ * @param n_radix Number of buckets of each level.
+ * @return Bucket of the cell.
+ * @see BEGIN_LOOP_OVER_LEVELS
+ */
+uint ml_bucket(const uint level, const ivec c, const uint n_radix)
+{
+    const uint hash = ((uint)c.x * 73856093u) ^
+                      ((uint)c.y * 19349663u);
+    return level * n_radix + hash % n_radix;
+}
+
+#endif
+
+#endif  // _TYPES_CELLS_H_INCLUDED_
@@ -23,8 +23,181 @@
  * on HAVE_3D
  */
 
+#ifndef _TYPES_H_INCLUDED_
+#define _TYPES_H_INCLUDED_
+
 #ifdef HAVE_3D
     #include "resources/Scripts/types/3D.h"
 #else
     #include "resources/Scripts/types/2D.h"
-#endif
\ No newline at end of file
+#endif
+
+/** @brief Half precision arrays.
+ *
+ * The arrays declared as "half*", "hvec*", "hvec2*", "hvec3*" or "hvec4*"
+ * in the XML files are stored with half precision components, e.g.
+ * @code{.xml}
+    <Variable name="p" type="half*" length="N" />
+    <Variable name="grad_p" type="hvec*" length="N" />
+ * @endcode
+ * Such arrays shall be received as pointers to half, and just accessed by
+ * HALF_LOAD(), HALF_STORE(), HVEC_LOAD() and HVEC_STORE(), which are
+ * converting the components from/to float.
+ */
+#define hvec half
+#define hvec2 half
+#define hvec3 half
+#define hvec4 half
+
+/** @brief Read a component of a half precision array as float.
+ * @param _P Half precision array.
+ * @param _I Index of the component.
+ */
+#define HALF_LOAD(_P, _I) vload_half(_I, _P)
+
+/** @brief Store a float into a component of a half precision array.
+ * @param _P Half precision array.
+ * @param _I Index of the component.
+ * @param _V Value to store.
+ */
+#define HALF_STORE(_P, _I, _V) vstore_half(_V, _I, _P)
+
+/** @brief Read an element of a half precision vectors array as #vec.
+ * @param _P Half precision vectors array ("hvec*").
+ * @param _I Index of the vector.
+ */
+#ifdef HAVE_3D
+    #define HVEC_LOAD(_P, _I) vload_half4(_I, _P)
+#else
+    #define HVEC_LOAD(_P, _I) vload_half2(_I, _P)
+#endif
+
+/** @brief Store a #vec into an element of a half precision vectors array.
+ * @param _P Half precision vectors array ("hvec*").
+ * @param _I Index of the vector.
+ * @param _V Vector to store.
+ */
+#ifdef HAVE_3D
+    #define HVEC_STORE(_P, _I, _V) vstore_half4(_V, _I, _P)
+#else
+    #define HVEC_STORE(_P, _I, _V) vstore_half2(_V, _I, _P)
+#endif
+
+/** @brief Packed vectors arrays.
+ *
+ * In 3D the #vec type has 4 components, such that the arrays declared as
+ * "vec*" are wasting the memory and bandwidth of the fourth one. The arrays
+ * declared as "pvec*" in the XML files are instead storing just 3 packed
+ * components, e.g.
+ * @code{.xml}
+    <Variable name="grad_p" type="pvec*" length="N" />
+ * @endcode
+ * Such arrays shall be received as pointers to #pvec, and just accessed by
+ * PVEC_LOAD() and PVEC_STORE(). In 2D they are just regular #vec arrays.
+ */
+#ifdef HAVE_3D
+    #define pvec float
+#else
+    #define pvec vec
+#endif
+
+/** @brief Read an element of a packed vectors array as #vec.
+ *
+ * The fourth component is set to 0.
+ * @param _P Packed vectors array ("pvec*").
+ * @param _I Index of the vector.
+ */
+#ifdef HAVE_3D
+    #define PVEC_LOAD(_P, _I) ((vec)(vload3(_I, _P), 0.f))
+#else
+    #define PVEC_LOAD(_P, _I) (_P)[_I]
+#endif
+
+/** @brief Store a #vec into an element of a packed vectors array.
+ *
+ * The fourth component is discarded.
+ * @param _P Packed vectors array ("pvec*").
+ * @param _I Index of the vector.
+ * @param _V Vector to store.
+ */
+#ifdef HAVE_3D
+    #define PVEC_STORE(_P, _I, _V) vstore3((_V).XYZ, _I, _P)
+#else
+    #define PVEC_STORE(_P, _I, _V) (_P)[_I] = (_V)
+#endif
+/** @brief Atomically add a value to a float stored in global memory.
+ *
+ * It is used to accumulate the contributions to a particle from several
+ * threads, e.g. in the symmetric interactions (see
+ * BEGIN_LOOP_OVER_HALF_NEIGHS()). OpenCL 1.2 has no float atomics, so a
+ * compare and exchange loop is used, unless the device has the native
+ * float atomic addition (cl_ext_float_atomics extension).
+ * @param p Pointer to the float.
+ * @param v Value to add.
+ */
+void atomic_add_f(volatile __global float *p, const float v)
+{
+#ifdef __opencl_c_ext_fp32_global_atomic_add
+    atomic_fetch_add_explicit((volatile __global atomic_float*)p,
+                              v,
+                              memory_order_relaxed);
+#else
+    union {
+        uint u;
+        float f;
+    } old_v, new_v;
+    do {
+        old_v.f = *p;
+        new_v.f = old_v.f + v;
+    } while(atomic_cmpxchg((volatile __global uint*)p,
+                           old_v.u,
+                           new_v.u) != old_v.u);
+#endif
+}
+
+/** @brief Atomically add a vector to a #vec stored in global memory.
+ *
+ * Each component is atomically added (see atomic_add_f()), so the vector
+ * itself is not updated at once.
+ * @param p Pointer to the vector.
+ * @param v Vector to add.
+ */
+void atomic_add_vec(volatile __global vec *p, const vec_xyz v)
+{
+    volatile __global float *c = (volatile __global float*)p;
+    atomic_add_f(c, v.x);
+    atomic_add_f(c + 1, v.y);
+#ifdef HAVE_3D
+    atomic_add_f(c + 2, v.z);
+#endif
+}
+
+/** @brief Index returned by LIST_ID() to the threads out of the list.
+ */
+#define LIST_END 0xFFFFFFFFu
+
+/** @brief Particle index of the thread, when the kernel is launched over a
+ * compacted list of particles (see Aqua::CalcServer::Compact), e.g. with
+ * n="N_fluid".
+ *
+ * The threads out of the list are getting #LIST_END.
+ * @param _IDS Indexes of the listed particles, e.g. "ids_fluid".
+ * @param _N Number of listed particles, e.g. "N_fluid".
+ */
+#define LIST_ID(_IDS, _N) \
+    ((get_global_id(0) < (_N)) ? (_IDS)[get_global_id(0)] : LIST_END)
+
+/** @brief Particle index of the thread, when the kernel is launched over a
+ * particles set (see Aqua::CalcServer::Kernel::setParticlesSet()), e.g. with
+ * set="motion_iset".
+ *
+ * The threads are launched over the unsorted indexes of the set, which are
+ * mapped to the sorted space through the "id_sorted" permutation, so the
+ * kernel shall have an argument with such name. The threads out of the
+ * particles are getting #LIST_END. If the kernel is launched over all the
+ * particles, it is just visiting them in the unsorted order.
+ * @param _N Number of particles, "N".
+ */
+#define SET_ID(_N) LIST_ID(id_sorted, _N)
+
+#endif  // _TYPES_H_INCLUDED_
@@ -26,6 +26,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <string.h>
 #include <termios.h>
@@ -143,6 +144,18 @@ std::string xxd2string(unsigned char* arr, unsigned int len)
     return xxd_str;
 }
 
+std::string hashString(const std::string &str)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(auto c : str) {
+        hash ^= (unsigned char)c;
+        hash *= 0x100000001b3ULL;
+    }
+    std::ostringstream hex;
+    hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return hex.str();
+}
+
 void toLower(std::string &str)
 {
     std::transform(str.begin(), str.end(), str.begin(), ::tolower);
@@ -293,6 +306,76 @@ int round(float n)
     return (int)(n + 0.5f);
 }
 
+cl_half floatToHalf(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(uint32_t));
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const uint32_t abs_x = x & 0x7fffffff;
+
+    if(abs_x >= 0x7f800000){
+        // Infinity or NaN (keeping it quiet)
+        return (cl_half)(sign | 0x7c00 | ((abs_x > 0x7f800000) ? 0x200 : 0));
+    }
+    if(abs_x >= 0x477ff000){
+        // Overflow
+        return (cl_half)(sign | 0x7c00);
+    }
+    if(abs_x < 0x38800000){
+        // Subnormal half, or underflow
+        if(abs_x < 0x33000000)
+            return (cl_half)sign;
+        const uint32_t e = abs_x >> 23;
+        const uint32_t m = (abs_x & 0x7fffff) | 0x800000;
+        const uint32_t shift = 126 - e;
+        uint32_t h = m >> shift;
+        const uint32_t rest = m & ((1u << shift) - 1);
+        const uint32_t half_way = 1u << (shift - 1);
+        // Round to nearest even
+        if((rest > half_way) || ((rest == half_way) && (h & 1)))
+            h++;
+        return (cl_half)(sign | h);
+    }
+    uint32_t h = (abs_x - 0x38000000) >> 13;
+    const uint32_t rest = abs_x & 0x1fff;
+    // Round to nearest even
+    if((rest > 0x1000) || ((rest == 0x1000) && (h & 1)))
+        h++;
+    return (cl_half)(sign | h);
+}
+
+float halfToFloat(cl_half h)
+{
+    const uint32_t sign = ((uint32_t)h & 0x8000) << 16;
+    uint32_t e = ((uint32_t)h >> 10) & 0x1f;
+    uint32_t m = (uint32_t)h & 0x3ff;
+    uint32_t x;
+
+    if(e == 0x1f){
+        // Infinity or NaN
+        x = sign | 0x7f800000 | (m << 13);
+    }
+    else if(e){
+        x = sign | ((e + 112) << 23) | (m << 13);
+    }
+    else if(m){
+        // Subnormal half, which is a normal float
+        e = 113;
+        while(!(m & 0x400)){
+            m <<= 1;
+            e--;
+        }
+        x = sign | (e << 23) | ((m & 0x3ff) << 13);
+    }
+    else{
+        x = sign;
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(float));
+    return f;
+}
+
 static std::string folder;
 
 const std::string getFolderFromFilePath(const std::string file_path)
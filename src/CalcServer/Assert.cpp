@@ -22,6 +22,7 @@
  */
 
 #include <math.h>
+#include <algorithm>
 
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
@@ -30,14 +31,46 @@
 
 namespace Aqua{ namespace CalcServer{
 
-Assert::Assert(const std::string name, const std::string condition, bool once)
+/// Deferred evaluation data, see Assert::cbEvaluate()
+typedef struct {
+    /// The tool
+    Assert *tool;
+    /// User event to be completed after the evaluation
+    cl_event user_event;
+    /// Time step
+    unsigned int step;
+} DeferredAssert;
+
+Assert::Assert(const std::string name,
+               const std::string condition,
+               bool once,
+               unsigned int period,
+               bool deferred)
     : Tool(name, once)
     , _condition(condition)
+    , _expr(NULL)
+    , _period(period)
+    , _deferred(deferred)
+    , _iter(NULL)
 {
 }
 
 Assert::~Assert()
 {
+    // Wait for the deferred evaluations, so the failures are not lost
+    for(auto event : _pending){
+        clWaitForEvents(1, &event);
+        clReleaseEvent(event);
+    }
+    _pending.clear();
+    for(auto step : _failures){
+        std::stringstream msg;
+        msg << "Assertion error. The expression \"" <<
+               std::string(_condition) << "\" was false at time step "
+            << step << std::endl;
+        LOG(L_ERROR, msg.str());
+    }
+    if(_expr) delete _expr; _expr=NULL;
 }
 
 void Assert::setup()
@@ -46,6 +79,26 @@ void Assert::setup()
     msg << "Loading the tool \"" << name() << "\"..." << std::endl;
     LOG(L_INFO, msg.str());
     Tool::setup();
+    if(!_period){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" cannot be executed with a null period" << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid period");
+    }
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+    _expr = vars->compile(_condition);
+    _iter = vars->get("iter");
+
+    if(_deferred){
+        // The variables shall be locked until the condition is evaluated
+        std::vector<InputOutput::Variable*> deps;
+        for(auto var : _expr->variables()){
+            if(std::find(deps.begin(), deps.end(), var) == deps.end())
+                deps.push_back(var);
+        }
+        setDependencies(deps);
+    }
 }
 
 cl_event Assert::_execute(const std::vector<cl_event> events)
@@ -53,6 +106,15 @@ cl_event Assert::_execute(const std::vector<cl_event> events)
     int result;
     InputOutput::Variables *vars = CalcServer::singleton()->variables();
 
+    if(_deferred)
+        check();
+
+    if(*(unsigned int*)_iter->get() % _period)
+        return NULL;
+
+    if(_deferred)
+        return defer(events);
+
     void *data = malloc(sizeof(int));
     if(!data){
         std::stringstream msg;
@@ -61,7 +123,7 @@ cl_event Assert::_execute(const std::vector<cl_event> events)
         throw std::bad_alloc();
     }
 
-    vars->solve("int", _condition, data, "assert_result");
+    vars->solve("int", _expr, data);
 
     // Check the result
     memcpy(&result, data, sizeof(int));
@@ -77,4 +139,134 @@ cl_event Assert::_execute(const std::vector<cl_event> events)
     return NULL;
 }
 
+cl_event Assert::defer(const std::vector<cl_event> events)
+{
+    cl_int err_code;
+    cl_event event, user_event;
+    CalcServer *C = CalcServer::singleton();
+
+    // Forget the already evaluated conditions
+    while(_pending.size()){
+        cl_int status;
+        err_code = clGetEventInfo(_pending.front(),
+                                  CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                  sizeof(cl_int),
+                                  &status,
+                                  NULL);
+        if((err_code != CL_SUCCESS) || (status != CL_COMPLETE))
+            break;
+        clReleaseEvent(_pending.front());
+        _pending.pop_front();
+    }
+
+    cl_uint num_events_in_wait_list = events.size();
+    const cl_event *event_wait_list = events.size() ? events.data() : NULL;
+    err_code = clEnqueueMarkerWithWaitList(C->command_queue(),
+                                           num_events_in_wait_list,
+                                           event_wait_list,
+                                           &event);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure setting the marker for the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    user_event = clCreateUserEvent(C->context(), &err_code);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure creating the user event for the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    // The user event is released by Tool::execute(), by the callback and
+    // when the evaluation is forgotten
+    clRetainEvent(user_event);
+    clRetainEvent(user_event);
+    _pending.push_back(user_event);
+
+    DeferredAssert *user_data = new DeferredAssert;
+    user_data->tool = this;
+    user_data->user_event = user_event;
+    user_data->step = *(unsigned int*)_iter->get();
+    err_code = clSetEventCallback(event,
+                                  CL_COMPLETE,
+                                  &cbEvaluate,
+                                  (void*)(user_data));
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure setting the callback for the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    err_code = clReleaseEvent(event);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure releasing the marker for the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    // The marker shall be submitted, since the host may wait for the user
+    // event later on
+    err_code = clFlush(C->command_queue());
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure flushing the command queue in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    return user_event;
+}
+
+void Assert::evaluate(unsigned int step)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    float result = 0.f;
+    try {
+        // The variables are locked by the user event, so they can be read
+        // without syncing
+        _expr->solve(1, &result, false);
+    } catch(...) {
+        result = 0.f;
+    }
+    if((int)result == 0)
+        _failures.push_back(step);
+}
+
+void Assert::check()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_failures.empty())
+        return;
+    std::stringstream msg;
+    msg << "Assertion error. The expression \"" <<
+           std::string(_condition) << "\" was false at time step "
+        << _failures.front() << std::endl;
+    LOG(L_ERROR, msg.str());
+    _failures.clear();
+    throw std::runtime_error("Assertion error");
+}
+
+void CL_CALLBACK Assert::cbEvaluate(cl_event event,
+                                    cl_int event_command_status,
+                                    void *user_data)
+{
+    DeferredAssert *data = (DeferredAssert*)user_data;
+    data->tool->evaluate(data->step);
+    clSetUserEventStatus(data->user_event, CL_COMPLETE);
+    clReleaseEvent(data->user_event);
+    delete data;
+}
+
 }}  // namespaces
@@ -26,23 +26,41 @@
 #include <limits>
 #include <string>
 #include <stack>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <exception>
 #include <assert.h>
 #include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include <CalcServer.h>
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
+#include <InputOutput/Trace.h>
 #include <CalcServer/Assert.h>
+#include <CalcServer/Compact.h>
 #include <CalcServer/Conditional.h>
 #include <CalcServer/Copy.h>
+#include <CalcServer/FusedKernel.h>
 #include <CalcServer/Kernel.h>
 #include <CalcServer/LinkList.h>
+#include <CalcServer/NeighbourList.h>
+#include <CalcServer/Permute.h>
 #include <CalcServer/Python.h>
 #include <CalcServer/RadixSort.h>
 #include <CalcServer/Reduction.h>
 #include <CalcServer/Set.h>
+#include <CalcServer/SetBatch.h>
 #include <CalcServer/SetScalar.h>
+#include <CalcServer/Swap.h>
 #include <CalcServer/UnSort.h>
+#include <CalcServer/UnSortBatch.h>
+#include <CalcServer/Reports/Metrics.h>
 #include <CalcServer/Reports/Performance.h>
 #include <CalcServer/Reports/Screen.h>
 #include <CalcServer/Reports/TabFile.h>
@@ -51,12 +69,46 @@
 #ifdef HAVE_MPI
 #include <mpi.h>
 #include <CalcServer/MPISync.h>
+#include <CalcServer/MPIBalance.h>
+#include <CalcServer/MPIReduction.h>
 #endif
 
 namespace Aqua{ namespace CalcServer{
 
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#include "CalcServer/KernelTable.hcl"
+#include "CalcServer/KernelTable.cl"
+#endif
+std::string KERNELTABLE_INC = xxd2string(KernelTable_hcl_in,
+                                         KernelTable_hcl_in_len);
+std::string KERNELTABLE_SRC = xxd2string(KernelTable_cl_in,
+                                         KernelTable_cl_in_len);
+
+/// Default number of samples of the tabulated kernel function
+#define KERNEL_TABLE_DEFAULT_SAMPLES 1024
+
 /// @brief Have been a SIGINT already registered?
-static bool sigint_received = false;
+static volatile sig_atomic_t sigint_received = 0;
+
+/// @brief Shall SIGTERM be handled writing a checkpoint?
+static volatile sig_atomic_t sigterm_checkpoint = 0;
+
+/// @brief Have been a SIGTERM already registered, to write a checkpoint?
+static volatile sig_atomic_t sigterm_received = 0;
+
+/** @brief Print a message from a signal handler
+ *
+ * The logger is allocating memory and locking mutexes, which cannot be done
+ * inside a signal handler, so the message is directly written in the
+ * standard error.
+ *
+ * @param msg Message to print
+ */
+static void sigint_message(const char *msg)
+{
+    ssize_t written = write(STDERR_FILENO, msg, strlen(msg));
+    (void)written;
+}
 
 /** @brief Handle SIGINT signals
  *
@@ -68,19 +120,72 @@ static bool sigint_received = false;
  * If SIGINT is received twice, then this handler will enforce the inmediate
  * program exit.
  *
- * @param s Recevied signal, SIGINT
+ * If Aqua::InputOutput::ProblemSetup::sphSettings::checkpoint_on_term is
+ * enabled, SIGTERM is instead setting Aqua::CalcServer::sigterm_received, such
+ * that a checkpoint is written at the end of the current time step.
+ *
+ * The handler is just setting the flags, which are logged by the time loop,
+ * and printing the reception with sigint_message().
+ *
+ * @param s Recevied signal, SIGINT or SIGTERM
  */
 void sigint_handler(int s){
-    // Log the reception, and afterwards the processing. That way, in case of
-    // MPI jobs we can know if some uncoordinated processes have failed to
+    if ((s == SIGTERM) && sigterm_checkpoint) {
+        sigint_message("SIGTERM received\n");
+        if (sigterm_received) {
+            // There is no time for the checkpoint
+            sigint_message("Forced program exit (SIGTERM received twice)\n");
+            _exit(EXIT_FAILURE);
+        }
+        sigterm_received = 1;
+        return;
+    }
+    // Print the reception, and afterwards the processing. That way, in case
+    // of MPI jobs we can know if some uncoordinated processes have failed to
     // correctly finish the job
-    LOG(L_WARNING, "SIGINT/SIGTERM received\n");
+    sigint_message("SIGINT/SIGTERM received\n");
     if (sigint_received) {
         // The user asked more than once to stop the simulation, force it
-        LOG(L_ERROR, "Forced program exit (SIGINT/SIGTERM received twice)\n");
-        exit(EXIT_FAILURE);
+        sigint_message("Forced program exit (SIGINT/SIGTERM received twice)\n");
+        _exit(EXIT_FAILURE);
     }
-    sigint_received = true;
+    sigint_received = 1;
+}
+
+/// Data required to complete a zero-copy transfer
+typedef struct {
+    /// Destination of the copy
+    void *dst;
+    /// Source of the copy
+    const void *src;
+    /// Size of the copy in bytes
+    size_t cb;
+    /// User event to be completed after the copy
+    cl_event user_event;
+} MapTransferUserData;
+
+/** @brief Copy the data of a zero-copy transfer, as soon as the memory object
+ * is mapped.
+ *
+ * The user event which the unmapping command is waiting for is marked as
+ * completed afterwards.
+ * @param event Mapping event
+ * @param event_command_exec_status Mapping command status
+ * @param user_data A MapTransferUserData structure
+ * @see Aqua::CalcServer::CalcServer::readBuffer()
+ * @see Aqua::CalcServer::CalcServer::writeBuffer()
+ */
+void CL_CALLBACK cbMapTransfer(cl_event event,
+                               cl_int event_command_exec_status,
+                               void *user_data)
+{
+    MapTransferUserData *data = (MapTransferUserData*)user_data;
+    if(event_command_exec_status == CL_COMPLETE)
+        memcpy(data->dst, data->src, data->cb);
+    clSetUserEventStatus(data->user_event,
+                         (event_command_exec_status < 0) ?
+                         event_command_exec_status : CL_COMPLETE);
+    free(data);
 }
     
 CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
@@ -93,7 +198,13 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
     , _device(NULL)
     , _command_queue(NULL)
     , _command_queue_parallel(NULL)
+    , _command_queue_id(0)
+    , _command_queue_current(NULL)
+    , _zero_copy(false)
     , _current_tool_name(NULL)
+    , _unsort_event(NULL)
+    , _unsort_version(0)
+    , _barrier_time(0.0)
     , _sim_data(sim_data)
 {
     unsigned int i, j;
@@ -101,6 +212,17 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
     setupOpenCL();
 
     _base_path = _sim_data.settings.base_path;
+    _cache_path = setStrConstantsCopy(_sim_data.settings.cache_path);
+    if(_cache_path != "") {
+        if(mkdir(_cache_path.c_str(), 0755) && (errno != EEXIST)) {
+            std::ostringstream msg;
+            msg << "Failure creating the programs cache folder \""
+                << _cache_path << "\". The cache is disabled" << std::endl;
+            LOG(L_WARNING, msg.str());
+            _cache_path = "";
+        }
+    }
+    _autotune_file = setStrConstantsCopy(_sim_data.settings.autotune_file);
     _current_tool_name = new char[256];
     strcpy(_current_tool_name, "");
 
@@ -216,12 +338,39 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
             if (!isFile(tool_path) && isFile(_base_path + "/" + tool_path)) {
                 tool_path = _base_path + "/" + tool_path;
             }
-            Kernel *tool = new Kernel(t->get("name"),
-                                      tool_path,
-                                      t->get("entry_point"),
-                                      t->get("n"),
-                                      once);
-            _tools.push_back(tool);
+            if(t->get("fuse").compare("")){
+                // Append the kernel to the previous fused one, or start a new
+                // fused kernel
+                FusedKernel *tool = NULL;
+                if(_tools.size())
+                    tool = dynamic_cast<FusedKernel*>(_tools.back());
+                if(tool && !tool->name().compare(t->get("fuse"))) {
+                    tool->add(tool_path,
+                              t->get("entry_point"),
+                              t->get("n"),
+                              once);
+                    tool->setConstants(t->get("constants"));
+                }
+                else {
+                    tool = new FusedKernel(t->get("fuse"),
+                                           tool_path,
+                                           t->get("entry_point"),
+                                           t->get("n"),
+                                           once);
+                    tool->setConstants(t->get("constants"));
+                    _tools.push_back(tool);
+                }
+            }
+            else {
+                Kernel *tool = new Kernel(t->get("name"),
+                                          tool_path,
+                                          t->get("entry_point"),
+                                          t->get("n"),
+                                          once);
+                tool->setConstants(t->get("constants"));
+                tool->setParticlesSet(t->get("set"));
+                _tools.push_back(tool);
+            }
         }
         else if(!t->get("type").compare("copy")){
             Copy *tool = new Copy(t->get("name"),
@@ -230,12 +379,43 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
                                   once);
             _tools.push_back(tool);
         }
+        else if(!t->get("type").compare("swap")){
+            Swap *tool = new Swap(t->get("name"),
+                                  t->get("in"),
+                                  t->get("out"),
+                                  once);
+            _tools.push_back(tool);
+        }
         else if(!t->get("type").compare("python")){
+            bool async = false;
+            if(!t->get("async").compare("true") ||
+               !t->get("async").compare("True")){
+                async = true;
+            }
+            std::vector<std::string> inputs;
+            if(t->get("in").compare("")) {
+                inputs = split(replaceAllCopy(t->get("in"), " ", ""), ',');
+            }
             Python *tool = new Python(t->get("name"),
                                       t->get("path"),
+                                      async,
+                                      inputs,
                                       once);
             _tools.push_back(tool);
         }
+        else if(!t->get("type").compare("set") &&
+                (t->get("in").find(',') != std::string::npos)){
+            std::vector<std::string> var_names, values;
+            for(auto var_name : split(t->get("in"), ','))
+                var_names.push_back(trimCopy(var_name));
+            for(auto value : split(t->get("value"), ';'))
+                values.push_back(trimCopy(value));
+            SetBatch *tool = new SetBatch(t->get("name"),
+                                          var_names,
+                                          values,
+                                          once);
+            _tools.push_back(tool);
+        }
         else if(!t->get("type").compare("set")){
             Set *tool = new Set(t->get("name"),
                                 t->get("in"),
@@ -243,6 +423,15 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
                                 once);
             _tools.push_back(tool);
         }
+        else if(!t->get("type").compare("compact")){
+            Compact *tool = new Compact(t->get("name"),
+                                        t->get("in"),
+                                        t->get("out"),
+                                        t->get("n"),
+                                        t->get("condition"),
+                                        once);
+            _tools.push_back(tool);
+        }
         else if(!t->get("type").compare("set_scalar")){
             SetScalar *tool = new SetScalar(t->get("name"),
                                             t->get("in"),
@@ -251,31 +440,98 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
             _tools.push_back(tool);
         }
         else if(!t->get("type").compare("reduction")){
-            Reduction *tool = new Reduction(t->get("name"),
-                                            t->get("in"),
-                                            t->get("out"),
-                                            t->get("operation"),
-                                            t->get("null"),
-                                            once);
-            _tools.push_back(tool);
+            // Consecutive reductions over the same array can be computed in a
+            // single pass
+            Reduction *tool = NULL;
+            if(t->get("fuse").compare("") && _tools.size())
+                tool = dynamic_cast<Reduction*>(_tools.back());
+            if(tool && !tool->name().compare(t->get("fuse")) &&
+               !tool->input().compare(t->get("in"))) {
+                tool->add(t->get("out"),
+                          t->get("operation"),
+                          t->get("null"));
+            }
+            else {
+                std::string tool_name = t->get("fuse").compare("") ?
+                    t->get("fuse") : t->get("name");
+                tool = new Reduction(tool_name,
+                                     t->get("in"),
+                                     t->get("out"),
+                                     t->get("operation"),
+                                     t->get("null"),
+                                     once);
+                _tools.push_back(tool);
+            }
         }
         else if(!t->get("type").compare("link-list")){
+            unsigned int sort_bits = _STEPBITS;
+            if(t->get("sort_bits").compare(""))
+                sort_bits = std::stoi(t->get("sort_bits"));
+            std::string margin = "0";
+            if(t->get("margin").compare(""))
+                margin = t->get("margin");
             LinkList *tool = new LinkList(t->get("name"),
-                                          t->get("in"));
+                                          t->get("in"),
+                                          once,
+                                          !t->get("incremental").compare("true"),
+                                          sort_bits,
+                                          margin);
+            _tools.push_back(tool);
+        }
+        else if(!t->get("type").compare("neighbour-list")){
+            unsigned int max_neighs = 128;
+            if(t->get("max_neighs").compare(""))
+                max_neighs = std::stoi(t->get("max_neighs"));
+            NeighbourList *tool = new NeighbourList(t->get("name"),
+                                                    t->get("in"),
+                                                    t->get("skin"),
+                                                    max_neighs,
+                                                    once);
+            _tools.push_back(tool);
+        }
+        else if(!t->get("type").compare("permute")){
+            std::vector<std::string> fields = split(
+                replaceAllCopy(t->get("fields"), " ", ""),
+                ',');
+            Permute *tool = new Permute(t->get("name"),
+                                        fields,
+                                        t->get("perm"),
+                                        once);
             _tools.push_back(tool);
         }
         else if(!t->get("type").compare("radix-sort")){
+            unsigned int bits = _STEPBITS;
+            if(t->get("bits").compare(""))
+                bits = std::stoi(t->get("bits"));
+            unsigned int items = _ITEMS, groups = _GROUPS;
+            unsigned int splits = _HISTOSPLIT;
+            if(t->get("items").compare(""))
+                items = std::stoi(t->get("items"));
+            if(t->get("groups").compare(""))
+                groups = std::stoi(t->get("groups"));
+            if(t->get("splits").compare(""))
+                splits = std::stoi(t->get("splits"));
             RadixSort *tool = new RadixSort(t->get("name"),
                                             t->get("in"),
                                             t->get("perm"),
                                             t->get("inv_perm"),
-                                            once);
+                                            once,
+                                            bits,
+                                            items,
+                                            groups,
+                                            splits);
             _tools.push_back(tool);
         }
         else if(!t->get("type").compare("assert")){
+            unsigned int period = 1;
+            if(t->get("period").compare(""))
+                period = std::stoi(t->get("period"));
+            bool deferred = !t->get("deferred").compare("true");
             Assert *tool = new Assert(t->get("name"),
                                       t->get("condition"),
-                                      once);
+                                      once,
+                                      period,
+                                      deferred);
             _tools.push_back(tool);
         }
         else if(!t->get("type").compare("if")){
@@ -285,9 +541,13 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
             _tools.push_back(tool);
         }
         else if(!t->get("type").compare("while")){
+            unsigned int batch = 1;
+            if(t->get("batch").compare(""))
+                batch = std::stoi(t->get("batch"));
             While *tool = new While(t->get("name"),
                                     t->get("condition"),
-                                    once);
+                                    once,
+                                    batch);
             _tools.push_back(tool);
         }
         else if(!t->get("type").compare("endif") ||
@@ -297,6 +557,7 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
                                 once);
             _tools.push_back(tool);
         }
+#ifdef HAVE_MPI
         else if(!t->get("type").compare("mpi-sync")){
             std::vector<std::string> fields = split(
                 replaceAllCopy(t->get("fields"), " ", ""),
@@ -320,6 +581,34 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
                                         once);
             _tools.push_back(tool);
         }
+        else if(!t->get("type").compare("mpi-balance")){
+            unsigned int period = 1;
+            if(t->get("period").compare(""))
+                period = std::stoi(t->get("period"));
+            float relax = 0.5f;
+            if(t->get("relax").compare(""))
+                relax = std::stof(t->get("relax"));
+            float min_width = 0.1f;
+            if(t->get("min_width").compare(""))
+                min_width = std::stof(t->get("min_width"));
+            MPIBalance *tool = new MPIBalance(t->get("name"),
+                                              t->get("load"),
+                                              t->get("shift"),
+                                              period,
+                                              relax,
+                                              min_width,
+                                              once);
+            _tools.push_back(tool);
+        }
+        else if(!t->get("type").compare("mpi-reduction")){
+            MPIReduction *tool = new MPIReduction(t->get("name"),
+                                                  t->get("in"),
+                                                  t->get("out"),
+                                                  t->get("operation"),
+                                                  once);
+            _tools.push_back(tool);
+        }
+#endif
         else if(!t->get("type").compare("installable")){
             void* handle = dlopen(t->get("path").c_str(), RTLD_LAZY);
             if (!handle) {
@@ -407,11 +696,18 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
                !t->get("bold").compare("True")){
                bold = true;
             }
+            bool mpi = false;
+            if(!t->get("mpi").compare("true") ||
+               !t->get("mpi").compare("True")){
+               mpi = true;
+            }
             Reports::Performance *tool = new Reports::Performance(
                 t->get("name"),
                 t->get("color"),
                 bold,
-                t->get("path"));
+                t->get("path"),
+                mpi,
+                t->get("roofline"));
             _tools.push_back(tool);
         }
         // Error
@@ -485,11 +781,25 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
                !r->get("bold").compare("True")){
                bold = true;
             }
+            bool mpi = false;
+            if(!r->get("mpi").compare("true") ||
+               !r->get("mpi").compare("True")){
+               mpi = true;
+            }
             Reports::Performance *tool = new Reports::Performance(
                 r->get("name"),
                 r->get("color"),
                 bold,
-                r->get("path"));
+                r->get("path"),
+                mpi,
+                r->get("roofline"));
+            _tools.push_back(tool);
+        }
+        else if(!r->get("type").compare("metrics")){
+            Reports::Metrics *tool = new Reports::Metrics(
+                r->get("name"),
+                r->get("path"),
+                std::stof(r->get("period")));
             _tools.push_back(tool);
         }
         else{
@@ -509,6 +819,7 @@ CalcServer::CalcServer(const Aqua::InputOutput::ProblemSetup& sim_data)
 
     setup();
 
+    sigterm_checkpoint = _sim_data.settings.checkpoint_on_term;
     signal(SIGINT, sigint_handler);
     signal(SIGTERM, sigint_handler);
 }
@@ -518,8 +829,25 @@ CalcServer::~CalcServer()
     unsigned int i;
     delete[] _current_tool_name;
 
+    for(auto pinned : _pinned_mems){
+        clEnqueueUnmapMemObject(_command_queue,
+                                pinned.second.first,
+                                pinned.first,
+                                0, NULL, NULL);
+    }
+    if(_command_queue) clFinish(_command_queue);
+    for(auto pinned : _pinned_mems){
+        clReleaseMemObject(pinned.second.first);
+    }
+    _pinned_mems.clear();
+    _pinned_released.clear();
+
     if(_command_queue) clReleaseCommandQueue(_command_queue);
     if(_command_queue_parallel) clReleaseCommandQueue(_command_queue_parallel);
+    for(auto queue : _command_queues){
+        clReleaseCommandQueue(queue);
+    }
+    _command_queues.clear();
     if(_context) clReleaseContext(_context); _context = NULL;
 
     if(_platforms) delete[] _platforms; _platforms=NULL;
@@ -530,28 +858,48 @@ CalcServer::~CalcServer()
     }
     _tools.clear();
 
+    for (auto& batch : unsort_batches) {
+        delete batch.second;
+    }
     for (auto& unsorter : unsorters) {
         delete unsorter.second;
     }
+    if(_unsort_event) clReleaseEvent(_unsort_event); _unsort_event = NULL;
 }
 
 void CalcServer::update(InputOutput::TimeManager& t_manager)
 {
     unsigned int i;
-    while(!t_manager.mustPrintOutput() && !t_manager.mustStop()){
+    bool first_step = true;
+    while(!t_manager.mustPrintOutput() &&
+          !t_manager.mustStop() &&
+          !t_manager.mustCheckpoint()){
+        if(InputOutput::Trace::singleton())
+            InputOutput::Trace::singleton()->step(t_manager.step());
 #ifdef HAVE_MPI
-        try {
-            MPI::COMM_WORLD.Barrier();
-        } 
-        catch(MPI::Exception e){
-            LOG(L_INFO, "MPI error while syncing at the beggining\n");
-            std::ostringstream msg;
-            msg << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
-            LOG0(L_DEBUG, msg.str());
-            MPI::COMM_WORLD.Abort(-1);
-            throw;
+        // The data dependencies are already synced by the mpi-sync tools, so
+        // the barrier is just set when requested
+        const int barrier_steps = _sim_data.settings.barrier_steps;
+        if(((barrier_steps > 0) && !(t_manager.step() % barrier_steps)) ||
+           ((barrier_steps < 0) && first_step)) {
+            try {
+                const auto tic = std::chrono::steady_clock::now();
+                InputOutput::TraceSpan span("mpi", "barrier");
+                MPI::COMM_WORLD.Barrier();
+                _barrier_time += std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - tic).count();
+            } 
+            catch(MPI::Exception e){
+                LOG(L_INFO, "MPI error while syncing at the beggining\n");
+                std::ostringstream msg;
+                msg << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
+                LOG0(L_DEBUG, msg.str());
+                MPI::COMM_WORLD.Abort(-1);
+                throw;
+            }
         }
 #endif
+        first_step = false;
         InputOutput::Logger::singleton()->initFrame();
 
         // Execute the tools
@@ -568,6 +916,18 @@ void CalcServer::update(InputOutput::TimeManager& t_manager)
         strcpy(_current_tool_name, "__post execution__");
 
         // Key events
+        if(sigterm_checkpoint){
+            // All the processes shall write the checkpoint at the same step
+            int term = sigterm_received;
+#ifdef HAVE_MPI
+            MPI::COMM_WORLD.Allreduce(MPI::IN_PLACE, &term, 1, MPI::INT,
+                                      MPI::MAX);
+#endif
+            if(term){
+                LOG(L_WARNING, "Termination request (SIGTERM) detected\n");
+                throw termination_request("Simulation terminated by SIGTERM");
+            }
+        }
         if(sigint_received){
             LOG(L_WARNING, "Interrumption request (SIGINT/SIGTERM) detected\n");
             sleep(__ERROR_SHOW_TIME__);
@@ -578,43 +938,340 @@ void CalcServer::update(InputOutput::TimeManager& t_manager)
     }
 }
 
-cl_event CalcServer::getUnsortedMem(const std::string var_name,
-                                    size_t offset,
-                                    size_t cb,
-                                    void *ptr)
+void* CalcServer::allocatePinned(size_t size)
 {
     cl_int err_code;
+    std::lock_guard<std::mutex> lock(_pinned_mutex);
+
+    // Look for the smallest released buffer large enough
+    auto best = _pinned_released.end();
+    for(auto it = _pinned_released.begin(); it != _pinned_released.end(); it++){
+        const size_t buffer_size = _pinned_mems[*it].second;
+        if(buffer_size < size)
+            continue;
+        if((best == _pinned_released.end()) ||
+           (buffer_size < _pinned_mems[*best].second))
+            best = it;
+    }
+    if(best != _pinned_released.end()){
+        void *ptr = *best;
+        _pinned_released.erase(best);
+        return ptr;
+    }
+
+    // Allocate a new pinned buffer, falling back to pageable memory
+    cl_mem mem = clCreateBuffer(_context,
+                                CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                size,
+                                NULL,
+                                &err_code);
+    if(err_code != CL_SUCCESS){
+        LOG(L_WARNING, "Failure allocating pinned memory.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        return malloc(size);
+    }
+    void *ptr = clEnqueueMapBuffer(_command_queue,
+                                   mem,
+                                   CL_TRUE,
+                                   CL_MAP_READ | CL_MAP_WRITE,
+                                   0,
+                                   size,
+                                   0,
+                                   NULL,
+                                   NULL,
+                                   &err_code);
+    if(err_code != CL_SUCCESS){
+        LOG(L_WARNING, "Failure mapping pinned memory.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        clReleaseMemObject(mem);
+        return malloc(size);
+    }
+    _pinned_mems[ptr] = std::make_pair(mem, size);
+    return ptr;
+}
+
+void CalcServer::releasePinned(void *ptr)
+{
+    if(!ptr)
+        return;
+    std::lock_guard<std::mutex> lock(_pinned_mutex);
+    if(_pinned_mems.find(ptr) == _pinned_mems.end()){
+        // Pageable memory fallback
+        free(ptr);
+        return;
+    }
+    _pinned_released.push_back(ptr);
+}
+
+cl_int CalcServer::readBuffer(cl_command_queue queue,
+                              cl_mem mem,
+                              cl_bool blocking,
+                              size_t offset,
+                              size_t cb,
+                              void *ptr,
+                              cl_uint num_events_in_wait_list,
+                              const cl_event *event_wait_list,
+                              cl_event *event)
+{
+    if(!_zero_copy){
+        return clEnqueueReadBuffer(queue, mem, blocking, offset, cb, ptr,
+                                   num_events_in_wait_list, event_wait_list,
+                                   event);
+    }
+    return mapTransfer(queue, mem, false, blocking, offset, cb, ptr,
+                       num_events_in_wait_list, event_wait_list, event);
+}
+
+cl_int CalcServer::writeBuffer(cl_command_queue queue,
+                               cl_mem mem,
+                               cl_bool blocking,
+                               size_t offset,
+                               size_t cb,
+                               const void *ptr,
+                               cl_uint num_events_in_wait_list,
+                               const cl_event *event_wait_list,
+                               cl_event *event)
+{
+    if(!_zero_copy){
+        return clEnqueueWriteBuffer(queue, mem, blocking, offset, cb, ptr,
+                                    num_events_in_wait_list, event_wait_list,
+                                    event);
+    }
+    return mapTransfer(queue, mem, true, blocking, offset, cb, (void*)ptr,
+                       num_events_in_wait_list, event_wait_list, event);
+}
+
+cl_int CalcServer::mapTransfer(cl_command_queue queue,
+                               cl_mem mem,
+                               bool write,
+                               cl_bool blocking,
+                               size_t offset,
+                               size_t cb,
+                               void *ptr,
+                               cl_uint num_events_in_wait_list,
+                               const cl_event *event_wait_list,
+                               cl_event *event)
+{
+    cl_int err_code;
+    cl_event map_event = NULL, user_event = NULL, unmap_event = NULL;
+
+    void *mapped = clEnqueueMapBuffer(queue,
+                                      mem,
+                                      blocking,
+                                      write ? CL_MAP_WRITE : CL_MAP_READ,
+                                      offset,
+                                      cb,
+                                      num_events_in_wait_list,
+                                      event_wait_list,
+                                      blocking ? NULL : &map_event,
+                                      &err_code);
+    if(err_code != CL_SUCCESS)
+        return err_code;
+
+    if(blocking){
+        // The memory object is already mapped
+        if(write)
+            memcpy(mapped, ptr, cb);
+        else
+            memcpy(ptr, mapped, cb);
+    }
+    else{
+        // Copy the data as soon as the memory object is mapped, making the
+        // unmapping wait for it
+        user_event = clCreateUserEvent(_context, &err_code);
+        if(err_code != CL_SUCCESS){
+            clWaitForEvents(1, &map_event);
+            clReleaseEvent(map_event);
+            clEnqueueUnmapMemObject(queue, mem, mapped, 0, NULL, NULL);
+            return err_code;
+        }
+        MapTransferUserData *data = (MapTransferUserData*)malloc(
+            sizeof(MapTransferUserData));
+        if(!data){
+            clSetUserEventStatus(user_event, CL_COMPLETE);
+            clReleaseEvent(user_event);
+            clWaitForEvents(1, &map_event);
+            clReleaseEvent(map_event);
+            clEnqueueUnmapMemObject(queue, mem, mapped, 0, NULL, NULL);
+            return CL_OUT_OF_HOST_MEMORY;
+        }
+        data->dst = write ? mapped : ptr;
+        data->src = write ? ptr : mapped;
+        data->cb = cb;
+        data->user_event = user_event;
+        err_code = clSetEventCallback(map_event,
+                                      CL_COMPLETE,
+                                      cbMapTransfer,
+                                      (void*)data);
+        clReleaseEvent(map_event);
+        if(err_code != CL_SUCCESS){
+            free(data);
+            clSetUserEventStatus(user_event, CL_COMPLETE);
+            clReleaseEvent(user_event);
+            return err_code;
+        }
+    }
+
+    err_code = clEnqueueUnmapMemObject(queue,
+                                       mem,
+                                       mapped,
+                                       user_event ? 1 : 0,
+                                       user_event ? &user_event : NULL,
+                                       &unmap_event);
+    if(user_event)
+        clReleaseEvent(user_event);
+    if(err_code != CL_SUCCESS)
+        return err_code;
+    if(event)
+        *event = unmap_event;
+    else
+        clReleaseEvent(unmap_event);
+    return CL_SUCCESS;
+}
+
+uivec2 CalcServer::setBounds(unsigned int iset) const
+{
+    if(iset >= _sim_data.sets.size()){
+        std::ostringstream msg;
+        msg << "Invalid particles set " << iset << " (just "
+            << _sim_data.sets.size() << " sets are available)." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::out_of_range("Invalid particles set");
+    }
+    uivec2 bounds;
+    bounds.x = 0;
+    for(unsigned int i = 0; i < iset; i++){
+        bounds.x += _sim_data.sets.at(i)->n();
+    }
+    bounds.y = bounds.x + _sim_data.sets.at(iset)->n();
+    return bounds;
+}
+
+std::vector<Tool*> CalcServer::unsorterTools() const
+{
+    std::vector<Tool*> tools;
+    for(auto& unsorter : unsorters){
+        tools.push_back(unsorter.second);
+    }
+    for(auto& batch : unsort_batches){
+        tools.push_back(batch.second);
+    }
+    return tools;
+}
+
+UnSort* CalcServer::getUnsorter(const std::string var_name)
+{
+    std::vector<UnSort*> unsorter = getUnsorters({var_name});
+    return unsorter.size() ? unsorter.front() : NULL;
+}
+
+std::vector<UnSort*> CalcServer::getUnsorters(
+    const std::vector<std::string> var_names,
+    unsigned int first,
+    unsigned int n)
+{
+    std::vector<UnSort*> result, outdated;
+    for(auto var_name : var_names){
+        // Generate the unsorter if it does not exist yet
+        UnSort *unsorter = NULL;
+        if(unsorters.find(var_name) == unsorters.end()){
+            unsorter = new UnSort(var_name.c_str(), var_name.c_str());
+            try {
+                unsorter->setup();
+            } catch(std::runtime_error &e) {
+                delete unsorter;
+                return std::vector<UnSort*>();
+            }
+            unsorters.insert(std::make_pair(var_name, unsorter));
+        }
+        result.push_back(unsorters[var_name]);
+    }
+    if(!result.size())
+        return result;
+    InputOutput::ArrayVariable *perms = result.front()->permutations();
+    const unsigned int n_all = perms->size() /
+        InputOutput::Variables::typeToBytes(perms->type());
+    if(first > n_all)
+        first = n_all;
+    if(!n || (first + n > n_all))
+        n = n_all - first;
+
+    // Any tool using the permutations since the last unsorting is
+    // invalidating all the unsorted data
+    if(result.front()->permutations()->getEvent() != _unsort_event)
+        _unsort_version++;
 
-    // Generate the unsorted if it does not exist yet
-    UnSort *unsorter = NULL;
-    if(unsorters.find(var_name) == unsorters.end()){
-        unsorter = new UnSort(var_name.c_str(), var_name.c_str());
+    // Look for the outdated variables, which are unsorted at once
+    std::ostringstream key;
+    for(auto unsorter : result){
+        if(unsorter->upToDate(_unsort_version, first, n) ||
+           (std::find(outdated.begin(), outdated.end(), unsorter) !=
+            outdated.end()))
+            continue;
+        outdated.push_back(unsorter);
+        key << unsorter->input()->name() << ",";
+    }
+    if(!outdated.size())
+        return result;
+
+    UnSortBatch *batch = NULL;
+    if(unsort_batches.find(key.str()) == unsort_batches.end()){
+        batch = new UnSortBatch(key.str(), outdated);
         try {
-            unsorter->setup();
+            batch->setup();
         } catch(std::runtime_error &e) {
-            delete unsorter;
-            return NULL;
+            delete batch;
+            return std::vector<UnSort*>();
         }
-        unsorters.insert(std::make_pair(var_name, unsorter));
+        unsort_batches.insert(std::make_pair(key.str(), batch));
     }
-    // Get the unsorter
-    unsorter = unsorters[var_name];
+    batch = unsort_batches[key.str()];
     try {
-        unsorter->execute();
+        batch->range(first, n);
+        batch->execute();
+        // The event of the batch has been set to all its dependencies
+        cl_event event = result.front()->permutations()->getEvent();
+        for(auto unsorter : outdated){
+            unsorter->updated(event, _unsort_version, first, n);
+        }
+        if(clRetainEvent(event) != CL_SUCCESS)
+            throw std::runtime_error("OpenCL error");
+        if(_unsort_event) clReleaseEvent(_unsort_event);
+        _unsort_event = event;
     } catch (std::runtime_error &e) {
-        return NULL;
+        return std::vector<UnSort*>();
     }
+    return result;
+}
+
+cl_event CalcServer::getUnsortedMem(const std::string var_name,
+                                    size_t offset,
+                                    size_t cb,
+                                    void *ptr)
+{
+    cl_int err_code;
+
+    // Just the downloaded particles are unsorted
+    InputOutput::Variable *var = _vars.get(var_name);
+    const size_t typesize = var ?
+        InputOutput::Variables::typeToBytes(var->type()) : 1;
+    std::vector<UnSort*> unsorters = getUnsorters({var_name},
+                                                  offset / typesize,
+                                                  cb / typesize);
+    if(!unsorters.size())
+        return NULL;
+    UnSort *unsorter = unsorters.front();
     cl_mem mem = unsorter->output();
     cl_event event = NULL, event_wait = unsorter->input()->getEvent();
-    err_code = clEnqueueReadBuffer(command_queue(),
-                                   mem,
-                                   CL_FALSE,
-                                   offset,
-                                   cb,
-                                   ptr,
-                                   1,
-                                   &event_wait,
-                                   &event);
+    err_code = readBuffer(command_queue(),
+                          mem,
+                          CL_FALSE,
+                          offset,
+                          cb,
+                          ptr,
+                          1,
+                          &event_wait,
+                          &event);
     if(err_code != CL_SUCCESS){
         std::ostringstream msg;
         msg << "Failure receiving the variable \"" << var_name
@@ -623,6 +1280,7 @@ cl_event CalcServer::getUnsortedMem(const std::string var_name,
         InputOutput::Logger::singleton()->printOpenCLError(err_code);
         return NULL;
     }
+    unsorter->addReader(event);
 
     return event;
 }
@@ -813,26 +1471,39 @@ void CalcServer::setupPlatform()
  * @param context OpenCL context
  * @param device OpenCL device
  * @param errcode_ret Returning error code
+ * @param out_of_order true if an out of order command queue shall be created,
+ * false otherwise
+ * @param profiling true if the profiling shall be enabled in the command
+ * queue, false otherwise
+ * @note If AQUAgpusph has been compiled with AQUAGPUSPH_GPU_PROFILE=ON, the
+ * profiling is always enabled in the command queue
  * @see https://www.khronos.org/registry/OpenCL/sdk/2.0/docs/man/xhtml/deprecated.html
  * @see https://www.khronos.org/registry/OpenCL/sdk/2.0/docs/man/xhtml/clCreateCommandQueueWithProperties.html
  */
 cl_command_queue create_command_queue(cl_context context,
                                       cl_device_id device,
-                                      cl_int *errcode_ret)
+                                      cl_int *errcode_ret,
+                                      bool out_of_order=true,
+                                      bool profiling=false)
 {
+    cl_command_queue_properties flags =
+        out_of_order ? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0;
+#ifdef HAVE_GPUPROFILE
+    profiling = true;
+#endif
+    if(profiling)
+        flags |= CL_QUEUE_PROFILING_ENABLE;
 #if (OPENCL_PLATFORM_MAJOR > 1)
     const cl_queue_properties properties[3] = {
-        CL_QUEUE_PROPERTIES, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, 0};
+        CL_QUEUE_PROPERTIES, flags, 0};
     return clCreateCommandQueueWithProperties(context,
                                               device,
                                               properties,
                                               errcode_ret);
 #else
-    cl_command_queue_properties properties = 
-        CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
     return clCreateCommandQueue(context,
                                 device,
-                                properties,
+                                flags,
                                 errcode_ret);
 #endif
 }
@@ -964,10 +1635,32 @@ void CalcServer::setupDevices()
     // Select the appropriate device
     _device = _devices[device_id];
 
+    // Check whether the device is sharing the memory with the host, such that
+    // the zero-copy mode is worth
+    if(_sim_data.settings.zero_copy){
+        cl_bool unified_memory = CL_FALSE;
+        err_code = clGetDeviceInfo(_device,
+                                   CL_DEVICE_HOST_UNIFIED_MEMORY,
+                                   sizeof(cl_bool),
+                                   &unified_memory,
+                                   NULL);
+        if((err_code != CL_SUCCESS) || (unified_memory != CL_TRUE)) {
+            LOG(L_WARNING, "The device is not sharing the memory with the host. Zero-copy mode disabled\n");
+        }
+        else{
+            LOG(L_INFO, "Zero-copy mode enabled\n");
+            _zero_copy = true;
+        }
+    }
+
     // Create the command queues
     cl_command_queue_properties properties = 
         CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
-    _command_queue = create_command_queue(_context, _device, &err_code);
+    _command_queue = create_command_queue(_context,
+                                          _device,
+                                          &err_code,
+                                          true,
+                                          _sim_data.settings.autotune);
     if(err_code != CL_SUCCESS) {
         LOG(L_ERROR, "Failure generating the main command queue\n");
         InputOutput::Logger::singleton()->printOpenCLError(err_code);
@@ -979,6 +1672,91 @@ void CalcServer::setupDevices()
         InputOutput::Logger::singleton()->printOpenCLError(err_code);
         throw std::runtime_error("OpenCL error");
     }
+    _command_queue_current = _command_queue;
+
+    // Create the pool of in-order command queues to dispatch the tools
+    if(_sim_data.settings.n_queues < 2)
+        return;
+    for(i = 0; i < _sim_data.settings.n_queues; i++){
+        cl_command_queue queue = create_command_queue(
+            _context, _device, &err_code, false, _sim_data.settings.autotune);
+        if(err_code != CL_SUCCESS) {
+            std::ostringstream msg;
+            msg << "Failure generating the command queue " << i
+                << " of the pool" << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        _command_queues.push_back(queue);
+    }
+    std::ostringstream msg;
+    msg << _command_queues.size()
+        << " in-order command queues will be used to dispatch the tools"
+        << std::endl;
+    LOG(L_INFO, msg.str());
+}
+
+cl_command_queue CalcServer::select_command_queue(
+    const std::vector<cl_event> events)
+{
+    cl_int err_code;
+    if(!_command_queues.size())
+        return _command_queue_current;
+
+    // Count the pending events on each queue of the pool
+    std::vector<unsigned int> pending(_command_queues.size(), 0);
+    for(auto event : events){
+        cl_int status;
+        err_code = clGetEventInfo(event,
+                                  CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                  sizeof(cl_int),
+                                  &status,
+                                  NULL);
+        if(err_code != CL_SUCCESS){
+            LOG(L_ERROR, "Failure querying the event execution status\n");
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        if(status == CL_COMPLETE)
+            continue;
+        cl_command_queue queue;
+        err_code = clGetEventInfo(event,
+                                  CL_EVENT_COMMAND_QUEUE,
+                                  sizeof(cl_command_queue),
+                                  &queue,
+                                  NULL);
+        if(err_code != CL_SUCCESS){
+            LOG(L_ERROR, "Failure querying the event command queue\n");
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        auto it = std::find(_command_queues.begin(),
+                            _command_queues.end(),
+                            queue);
+        if(it == _command_queues.end())
+            continue;
+        pending.at(std::distance(_command_queues.begin(), it))++;
+    }
+
+    unsigned int queue_id;
+    auto it = std::max_element(pending.begin(), pending.end());
+    if(*it)
+        queue_id = std::distance(pending.begin(), it);
+    else
+        queue_id = (_command_queue_id + 1) % _command_queues.size();
+
+    if(_command_queues.at(queue_id) != _command_queue_current) {
+        err_code = clFlush(_command_queue_current);
+        if(err_code != CL_SUCCESS){
+            LOG(L_ERROR, "Failure flushing the command queue\n");
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+    }
+    _command_queue_id = queue_id;
+    _command_queue_current = _command_queues.at(queue_id);
+    return _command_queue_current;
 }
 
 void CalcServer::setup()
@@ -1074,10 +1852,485 @@ void CalcServer::setup()
         }
     }
 
+    // The kernel function tables shall be available before building
+    tabulateKernel();
+
+    // Build the kernels in parallel, which is by far the most time consuming
+    // part of the tools setup
+    std::vector<Kernel*> kernels;
+    for(auto tool : _tools){
+        Kernel *kernel = dynamic_cast<Kernel*>(tool);
+        if(kernel)
+            kernels.push_back(kernel);
+    }
+    unsigned int n_threads = std::thread::hardware_concurrency();
+    n_threads = min(max(n_threads, 1u), (unsigned int)kernels.size());
+    if(n_threads > 1){
+        std::ostringstream msg;
+        msg << "Building " << kernels.size() << " kernels with "
+            << n_threads << " threads..." << std::endl;
+        LOG(L_INFO, msg.str());
+    }
+    std::atomic<unsigned int> next_kernel(0);
+    std::vector<std::exception_ptr> errors(n_threads);
+    std::vector<std::thread> threads;
+    for(i = 0; i < n_threads; i++){
+        threads.push_back(std::thread([&, i]() {
+            unsigned int k;
+            while((k = next_kernel++) < kernels.size()){
+                try {
+                    kernels.at(k)->build();
+                } catch(...) {
+                    errors.at(i) = std::current_exception();
+                    // Stop the rest of threads as soon as possible
+                    next_kernel = kernels.size();
+                    return;
+                }
+            }
+        }));
+    }
+    for(auto &thread : threads){
+        thread.join();
+    }
+    for(auto error : errors){
+        if(error)
+            std::rethrow_exception(error);
+    }
+
     // Setup the tools
     for(auto tool : _tools){
         tool->setup();
     }
+
+    if(_sim_data.settings.pipeline_analysis)
+        analyzePipeline();
+    aliasScratchArrays();
+}
+
+void CalcServer::tabulateKernel()
+{
+    cl_int err_code;
+    const std::string key = "-DKERNEL_TABULATED";
+    unsigned int n = 0;
+    for(auto &def : _definitions){
+        if(def.compare(0, key.size(), key))
+            continue;
+        if(def.size() == key.size()){
+            std::ostringstream valstr;
+            valstr << key << "=" << KERNEL_TABLE_DEFAULT_SAMPLES;
+            def = valstr.str();
+            n = KERNEL_TABLE_DEFAULT_SAMPLES;
+        }
+        else if(def.at(key.size()) == '='){
+            try {
+                n = std::stoi(def.substr(key.size() + 1));
+            } catch(...) {
+                n = 0;
+            }
+            if(n < 2){
+                std::ostringstream msg;
+                msg << "Invalid number of kernel function samples, \""
+                    << def.substr(key.size() + 1) << "\"" << std::endl;
+                LOG(L_ERROR, msg.str());
+                throw std::runtime_error("Invalid definition");
+            }
+        }
+    }
+    if(!n)
+        return;
+
+    std::ostringstream msg;
+    msg << "Tabulating the kernel function with " << n << " samples..."
+        << std::endl;
+    LOG(L_INFO, msg.str());
+
+    std::ostringstream source;
+    source << KERNELTABLE_INC << KERNELTABLE_SRC;
+    std::ostringstream flags;
+    if(_base_path.compare(""))
+        flags << "-I" << _base_path << " ";
+    for(auto def : _definitions)
+        flags << def << " ";
+    flags << "-D_KERNEL_TABULATING_";
+    cl_kernel kernel = Tool::compile_kernel(source.str(),
+                                            "tabulate",
+                                            flags.str());
+
+    std::vector<float> w(n), f(n);
+    cl_mem w_mem = clCreateBuffer(_context, CL_MEM_WRITE_ONLY,
+                                  n * sizeof(float), NULL, &err_code);
+    cl_mem f_mem = NULL;
+    if(err_code == CL_SUCCESS)
+        f_mem = clCreateBuffer(_context, CL_MEM_WRITE_ONLY,
+                               n * sizeof(float), NULL, &err_code);
+    if(err_code != CL_SUCCESS){
+        LOG(L_ERROR, "Failure allocating the kernel function tables.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        if(w_mem) clReleaseMemObject(w_mem);
+        clReleaseKernel(kernel);
+        throw std::runtime_error("OpenCL allocation error");
+    }
+    err_code = clSetKernelArg(kernel, 0, sizeof(cl_mem), &w_mem);
+    err_code |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &f_mem);
+    err_code |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &n);
+    if(err_code == CL_SUCCESS){
+        const size_t global_size = n;
+        err_code = clEnqueueNDRangeKernel(_command_queue, kernel, 1, NULL,
+                                          &global_size, NULL, 0, NULL, NULL);
+    }
+    if(err_code == CL_SUCCESS)
+        err_code = clEnqueueReadBuffer(_command_queue, w_mem, CL_FALSE, 0,
+                                       n * sizeof(float), w.data(),
+                                       0, NULL, NULL);
+    if(err_code == CL_SUCCESS)
+        err_code = clEnqueueReadBuffer(_command_queue, f_mem, CL_TRUE, 0,
+                                       n * sizeof(float), f.data(),
+                                       0, NULL, NULL);
+    clReleaseMemObject(w_mem);
+    clReleaseMemObject(f_mem);
+    clReleaseKernel(kernel);
+    if(err_code != CL_SUCCESS){
+        LOG(L_ERROR, "Failure sampling the kernel function.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    // Register the tables as initializer lists, with enough digits to
+    // recover the same float values
+    std::ostringstream w_def, f_def;
+    w_def << "-DKERNEL_TABLE_W={";
+    f_def << "-DKERNEL_TABLE_F={";
+    for(unsigned int i = 0; i < n; i++){
+        char valstr[32];
+        snprintf(valstr, sizeof(valstr), "%s%.9ef", i ? "," : "", w.at(i));
+        w_def << valstr;
+        snprintf(valstr, sizeof(valstr), "%s%.9ef", i ? "," : "", f.at(i));
+        f_def << valstr;
+    }
+    w_def << "}";
+    f_def << "}";
+    _definitions.push_back(w_def.str());
+    _definitions.push_back(f_def.str());
+}
+
+void CalcServer::analyzePipeline()
+{
+    unsigned int i, j, k;
+
+    // Arrays read and written by each tool. Just the kernels and the
+    // "set"/"copy" tools, which have no other side effects, can be skipped.
+    // The kernels may be reading all their arguments, even the written ones
+    std::vector<std::vector<InputOutput::Variable*>> reads, writes;
+    std::vector<bool> removable;
+    bool python = false;
+    for(auto tool : _tools){
+        std::vector<InputOutput::Variable*> deps = tool->getDependencies();
+        std::vector<InputOutput::Variable*> in, out;
+        bool pure = true;
+        if(dynamic_cast<Kernel*>(tool)){
+            in = deps;
+            out = ((Kernel*)tool)->outputs();
+        }
+        else if(dynamic_cast<Set*>(tool) || dynamic_cast<SetBatch*>(tool)){
+            out = deps;
+        }
+        else if(dynamic_cast<Copy*>(tool)){
+            in.push_back(((Copy*)tool)->input());
+            out.push_back(((Copy*)tool)->output());
+        }
+        else{
+            if(dynamic_cast<Python*>(tool))
+                python = true;
+            in = deps;
+            out = deps;
+            pure = false;
+        }
+        reads.push_back(in);
+        writes.push_back(out);
+        removable.push_back(pure && !tool->scope_modifier() && out.size());
+    }
+
+    // The arrays loaded or saved by the particles sets are always alive
+    std::vector<std::string> persistent;
+    for(auto set : _sim_data.sets){
+        std::vector<std::string> in = set->inputFields();
+        std::vector<std::string> out = set->outputFields();
+        persistent.insert(persistent.end(), in.begin(), in.end());
+        persistent.insert(persistent.end(), out.begin(), out.end());
+    }
+
+    // Skip the tools whose outputs are not read by any other tool. The
+    // pipeline is executed several times, so the tools placed before are
+    // reading them as well
+    std::vector<Tool*> skipped;
+    size_t skipped_bytes = 0;
+    if(python){
+        LOG(L_WARNING, "The Python tools are not declaring their "
+                       "dependencies, so no tools are skipped\n");
+    }
+    bool changed = !python;
+    while(changed){
+        changed = false;
+        for(i = 0; i < _tools.size(); i++){
+            Tool *tool = _tools.at(i);
+            if(!removable.at(i) || tool->skipped())
+                continue;
+            bool dead = true;
+            for(auto var : writes.at(i)){
+                if(std::find(persistent.begin(), persistent.end(),
+                             var->name()) != persistent.end()){
+                    dead = false;
+                    break;
+                }
+                for(j = 0; j < _tools.size(); j++){
+                    if((j == i) || _tools.at(j)->skipped())
+                        continue;
+                    if(std::find(reads.at(j).begin(), reads.at(j).end(),
+                                 var) != reads.at(j).end()){
+                        dead = false;
+                        break;
+                    }
+                }
+                if(!dead)
+                    break;
+            }
+            if(!dead)
+                continue;
+
+            std::ostringstream msg;
+            msg << "Skipping the tool \"" << tool->name()
+                << "\", since nothing is reading";
+            for(auto var : writes.at(i)){
+                msg << " \"" << var->name() << "\"";
+                skipped_bytes += var->size();
+            }
+            msg << std::endl;
+            LOG(L_INFO, msg.str());
+            tool->skip();
+            skipped.push_back(tool);
+            changed = true;
+        }
+    }
+
+    // Look for the "set"/"copy" tools cancelled by the next tool using the
+    // same array, within the same scope
+    unsigned int n_redundant = 0;
+    for(i = 0; i < _tools.size(); i++){
+        Tool *tool = _tools.at(i);
+        Copy *copy = dynamic_cast<Copy*>(tool);
+        if(tool->skipped() ||
+           (!copy && !dynamic_cast<Set*>(tool) &&
+            !dynamic_cast<SetBatch*>(tool)))
+            continue;
+        for(auto var : writes.at(i)){
+            for(j = i + 1; j < _tools.size(); j++){
+                if(_tools.at(j)->scope_modifier()){
+                    j = _tools.size();
+                    break;
+                }
+                if(_tools.at(j)->skipped())
+                    continue;
+                std::vector<InputOutput::Variable*> deps =
+                    _tools.at(j)->getDependencies();
+                if(std::find(deps.begin(), deps.end(), var) != deps.end())
+                    break;
+            }
+            if(j >= _tools.size())
+                continue;
+            Tool *next = _tools.at(j);
+            if(next->once() && !tool->once())
+                continue;
+            if(std::find(reads.at(j).begin(), reads.at(j).end(),
+                         var) == reads.at(j).end()){
+                std::ostringstream msg;
+                msg << "The tool \"" << next->name()
+                    << "\" is overwriting \"" << var->name()
+                    << "\", set by \"" << tool->name()
+                    << "\", before reading it" << std::endl;
+                LOG(L_WARNING, msg.str());
+                n_redundant++;
+                continue;
+            }
+            Copy *next_copy = dynamic_cast<Copy*>(next);
+            if(!copy || !next_copy || (next_copy->input() != var) ||
+               (next_copy->output() != copy->input()))
+                continue;
+            // The copied array shall be untouched in between
+            for(k = i + 1; k < j; k++){
+                if(_tools.at(k)->skipped())
+                    continue;
+                std::vector<InputOutput::Variable*> deps =
+                    _tools.at(k)->getDependencies();
+                if(std::find(deps.begin(), deps.end(),
+                             copy->input()) != deps.end())
+                    break;
+            }
+            if(k < j)
+                continue;
+            std::ostringstream msg;
+            msg << "The tool \"" << next->name()
+                << "\" is copying back \"" << var->name()
+                << "\" into \"" << copy->input()->name()
+                << "\", undoing \"" << tool->name() << "\"" << std::endl;
+            LOG(L_WARNING, msg.str());
+            n_redundant++;
+        }
+    }
+
+    std::ostringstream msg;
+    msg << skipped.size() << " tools skipped, writing " << skipped_bytes
+        << " bytes each time step, and " << n_redundant
+        << " redundant set/copy tools found" << std::endl;
+    LOG(L_INFO, msg.str());
+}
+
+void CalcServer::aliasScratchArrays()
+{
+    unsigned int i, j;
+
+    // Collect the scratch arrays. The ones loaded or saved by the particles
+    // sets should persist, and are therefore discarded
+    std::vector<InputOutput::ArrayVariable*> vars;
+    for(i = 0; i < _sim_data.variables.names.size(); i++){
+        if(!_sim_data.variables.scratches.at(i))
+            continue;
+        const std::string name = _sim_data.variables.names.at(i);
+        InputOutput::Variable *var = _vars.get(name);
+        if(!var || !var->isArray())
+            continue;
+        if(std::find(vars.begin(), vars.end(), var) != vars.end())
+            continue;
+        bool persistent = false;
+        for(auto set : _sim_data.sets){
+            std::vector<std::string> in = set->inputFields();
+            std::vector<std::string> out = set->outputFields();
+            if((std::find(in.begin(), in.end(), name) != in.end()) ||
+               (std::find(out.begin(), out.end(), name) != out.end())){
+                persistent = true;
+                break;
+            }
+        }
+        if(persistent){
+            std::ostringstream msg;
+            msg << "Scratch array \"" << name
+                << "\" is loaded/saved by a particles set, so it is not aliased"
+                << std::endl;
+            LOG(L_WARNING, msg.str());
+            continue;
+        }
+        vars.push_back((InputOutput::ArrayVariable*)var);
+    }
+    if(vars.size() < 2)
+        return;
+
+    // The scopes (loops and conditionals) of the pipeline
+    std::vector<std::pair<unsigned int, unsigned int>> scopes;
+    std::vector<unsigned int> opened;
+    for(i = 0; i < _tools.size(); i++){
+        const int modifier = _tools.at(i)->scope_modifier();
+        if(modifier > 0){
+            opened.push_back(i);
+        }
+        else if((modifier < 0) && opened.size()){
+            scopes.push_back(std::make_pair(opened.back(), i));
+            opened.pop_back();
+        }
+    }
+
+    // Live range of each array along the pipeline. Just the kernels are
+    // resetting their arguments when the memory object is replaced
+    std::vector<InputOutput::ArrayVariable*> candidates;
+    std::vector<std::pair<unsigned int, unsigned int>> ranges;
+    for(auto var : vars){
+        bool valid = true, used = false;
+        unsigned int first = 0, last = 0;
+        for(i = 0; i < _tools.size(); i++){
+            if(_tools.at(i)->skipped())
+                continue;
+            std::vector<InputOutput::Variable*> deps =
+                _tools.at(i)->getDependencies();
+            if(std::find(deps.begin(), deps.end(), var) == deps.end())
+                continue;
+            if(!dynamic_cast<Kernel*>(_tools.at(i))){
+                std::ostringstream msg;
+                msg << "Scratch array \"" << var->name()
+                    << "\" is used by the tool \"" << _tools.at(i)->name()
+                    << "\", so it is not aliased" << std::endl;
+                LOG(L_WARNING, msg.str());
+                valid = false;
+                break;
+            }
+            if(!used)
+                first = i;
+            last = i;
+            used = true;
+        }
+        if(!valid || !used)
+            continue;
+        // The arrays used across the boundaries of a scope shall be alive
+        // during the whole scope, which may be executed several times
+        bool extended = true;
+        while(extended){
+            extended = false;
+            for(auto scope : scopes){
+                if((last < scope.first) || (first > scope.second))
+                    continue;
+                if((first >= scope.first) && (last <= scope.second))
+                    continue;
+                first = min(first, scope.first);
+                last = max(last, scope.second);
+                extended = true;
+            }
+        }
+        candidates.push_back(var);
+        ranges.push_back(std::make_pair(first, last));
+    }
+
+    // Greedy assignment of the arrays, sorted by their first use, to the
+    // first group already dead at that point
+    std::vector<unsigned int> order(candidates.size());
+    for(i = 0; i < order.size(); i++)
+        order.at(i) = i;
+    std::sort(order.begin(), order.end(),
+              [&](unsigned int a, unsigned int b){
+                  return ranges.at(a).first < ranges.at(b).first;
+              });
+    std::vector<std::vector<unsigned int>> groups;
+    for(auto k : order){
+        for(j = 0; j < groups.size(); j++){
+            if(ranges.at(groups.at(j).back()).second < ranges.at(k).first)
+                break;
+        }
+        if(j == groups.size())
+            groups.push_back(std::vector<unsigned int>());
+        groups.at(j).push_back(k);
+    }
+
+    unsigned int n_aliased = 0;
+    for(auto group : groups){
+        if(group.size() < 2)
+            continue;
+        std::vector<InputOutput::ArrayVariable*> group_vars;
+        for(j = 0; j < group.size(); j++){
+            InputOutput::ArrayVariable *var = candidates.at(group.at(j));
+            group_vars.push_back(var);
+            if(!j)
+                continue;
+            // The first tool using the array shall wait for the previous
+            // array in the same memory, which may be alive in another queue
+            Tool *tool = _tools.at(ranges.at(group.at(j)).first);
+            std::vector<InputOutput::Variable*> deps = tool->getDependencies();
+            deps.push_back(candidates.at(group.at(j - 1)));
+            tool->setDependencies(deps);
+        }
+        _vars.alias(group_vars);
+        n_aliased += group.size();
+    }
+
+    std::ostringstream msg;
+    msg << n_aliased << " scratch arrays aliased, saving "
+        << _vars.aliasedMemory() << " bytes" << std::endl;
+    LOG(L_INFO, msg.str());
 }
 
 }}  // namespace
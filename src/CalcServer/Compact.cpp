@@ -0,0 +1,362 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file
+ * @brief Stream compaction of the particles indexes.
+ * (See Aqua::CalcServer::Compact for details)
+ * @note Hardcoded versions of the files CalcServer/Compact.cl.in and
+ * CalcServer/Compact.hcl.in are internally included as a text array.
+ */
+
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <CalcServer/Compact.h>
+#include <CalcServer.h>
+
+#ifndef COMPACT_LOCAL_SIZE
+    /// Preferred work group size of the compaction kernels
+    #define COMPACT_LOCAL_SIZE 256
+#endif
+
+namespace Aqua{ namespace CalcServer{
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#include "CalcServer/Compact.hcl"
+#include "CalcServer/Compact.cl"
+#endif
+std::string COMPACT_INC = xxd2string(Compact_hcl_in, Compact_hcl_in_len);
+std::string COMPACT_SRC = xxd2string(Compact_cl_in, Compact_cl_in_len);
+
+Compact::Compact(const std::string name,
+                 const std::string input_name,
+                 const std::string output_name,
+                 const std::string n_name,
+                 const std::string condition,
+                 bool once)
+    : Tool(name, once)
+    , _input_name(input_name)
+    , _output_name(output_name)
+    , _n_name(n_name)
+    , _condition(condition)
+    , _input_var(NULL)
+    , _output_var(NULL)
+    , _n_var(NULL)
+    , _n_ptr(NULL)
+    , _n(0)
+    , _counts(NULL)
+    , _offsets(NULL)
+    , _count(NULL)
+    , _scan(NULL)
+    , _compact(NULL)
+    , _local_work_size(0)
+    , _global_work_size(0)
+    , _n_groups(0)
+{
+}
+
+Compact::~Compact()
+{
+    if(_counts) clReleaseMemObject(_counts); _counts=NULL;
+    if(_offsets) clReleaseMemObject(_offsets); _offsets=NULL;
+    if(_count) clReleaseKernel(_count); _count=NULL;
+    if(_scan) clReleaseKernel(_scan); _scan=NULL;
+    if(_compact) clReleaseKernel(_compact); _compact=NULL;
+}
+
+void Compact::setup()
+{
+    std::ostringstream msg;
+    msg << "Loading the tool \"" << name() << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    Tool::setup();
+    variables();
+    setupOpenCL();
+    setupMem();
+}
+
+cl_event Compact::_execute(const std::vector<cl_event> events)
+{
+    unsigned int i;
+    cl_int err_code;
+    cl_event event;
+    CalcServer *C = CalcServer::singleton();
+
+    setVariables();
+
+    // The kernels are executed sequentially
+    std::vector<cl_event> wait_events(events);
+    cl_kernel kernels[3] = {_count, _scan, _compact};
+    const size_t global_sizes[3] = {_global_work_size,
+                                    _local_work_size,
+                                    _global_work_size};
+    std::vector<cl_event> kernel_events;
+    for(i = 0; i < 3; i++){
+        cl_uint num_events_in_wait_list = wait_events.size();
+        const cl_event *event_wait_list = wait_events.size() ?
+            wait_events.data() : NULL;
+        err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                          kernels[i],
+                                          1,
+                                          NULL,
+                                          &global_sizes[i],
+                                          &_local_work_size,
+                                          num_events_in_wait_list,
+                                          event_wait_list,
+                                          &event);
+        if(err_code != CL_SUCCESS) {
+            std::ostringstream msg;
+            msg << "Failure executing the step " << i << " within the tool \""
+                << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        kernel_events.push_back(event);
+        wait_events = {event};
+    }
+
+    // Get back the number of selected elements, without blocking. The
+    // previous value shall be already read before overwriting it though
+    cl_event read_event;
+    wait_events = {kernel_events.at(1)};
+    if(_n_var->getEvent())
+        wait_events.push_back(_n_var->getEvent());
+    err_code = C->readBuffer(C->command_queue(),
+                             _offsets,
+                             CL_FALSE,
+                             _n_groups * sizeof(unsigned int),
+                             sizeof(unsigned int),
+                             _n_ptr,
+                             wait_events.size(),
+                             wait_events.data(),
+                             &read_event);
+    if(err_code != CL_SUCCESS) {
+        std::ostringstream msg;
+        msg << "Failure reading back the number of selected elements within "
+            << "the tool \"" << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    _n_var->setEvent(read_event);
+    C->variables()->populate_async(_n_var);
+    err_code = clReleaseEvent(read_event);
+    err_code |= clReleaseEvent(kernel_events.at(0));
+    err_code |= clReleaseEvent(kernel_events.at(1));
+    if(err_code != CL_SUCCESS) {
+        std::ostringstream msg;
+        msg << "Failure releasing transactional events in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+
+    return kernel_events.at(2);
+}
+
+void Compact::variables()
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+    const std::string names[3] = {_input_name, _output_name, _n_name};
+    for(unsigned int i = 0; i < 3; i++){
+        if(!vars->get(names[i])){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" is asking the undeclared variable \""
+                << names[i] << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+    }
+
+    const std::string input_type = trimCopy(vars->get(_input_name)->type());
+    if(input_type.compare("int*") && input_type.compare("unsigned int*") &&
+       input_type.compare("float*")){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking the input variable \"" << _input_name
+            << "\", of type \"" << input_type << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        LOG0(L_DEBUG, "\t\"int*\", \"unsigned int*\" or \"float*\" are required\n");
+        throw std::runtime_error("Invalid variable type");
+    }
+    _input_var = (InputOutput::ArrayVariable *)vars->get(_input_name);
+    _n = _input_var->size() / vars->typeToBytes(_input_var->type());
+
+    if(trimCopy(vars->get(_output_name)->type()).compare("unsigned int*")){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking the output variable \"" << _output_name
+            << "\", which is not of type \"unsigned int*\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable type");
+    }
+    _output_var = (InputOutput::ArrayVariable *)vars->get(_output_name);
+    if(_output_var->size() < _n * sizeof(unsigned int)){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking the output variable \"" << _output_name
+            << "\", which is shorter than \"" << _input_name << "\"."
+            << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable length");
+    }
+
+    if(trimCopy(vars->get(_n_name)->type()).compare("unsigned int")){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking the output variable \"" << _n_name
+            << "\", which is not of type \"unsigned int\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable type");
+    }
+    _n_var = vars->get(_n_name);
+    // The host memory of the scalar variables is never reallocated
+    _n_ptr = _n_var->get();
+
+    // The scalar variable event is internally handled by the tool
+    std::vector<InputOutput::Variable*> deps = {_input_var, _output_var};
+    setDependencies(deps);
+}
+
+void Compact::setupOpenCL()
+{
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    // The scans are carried out in local memory, with a power of two work
+    // group size
+    size_t max_local_size;
+    err_code = clGetDeviceInfo(C->device(),
+                               CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                               sizeof(size_t),
+                               &max_local_size,
+                               NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Failure querying the maximum work group size.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    _local_work_size = COMPACT_LOCAL_SIZE;
+    while(_local_work_size > max_local_size)
+        _local_work_size /= 2;
+
+    std::string t = trimCopy(_input_var->type());
+    t.pop_back();  // Remove the asterisk
+    if(!t.compare("unsigned int"))
+        t = "uint";
+    std::ostringstream flags;
+    flags << "-DLOCAL_WORK_SIZE=" << _local_work_size << "u -DT=" << t;
+
+    std::ostringstream source;
+    source << COMPACT_INC << "#define CONDITION (" << _condition << ")"
+           << std::endl << COMPACT_SRC;
+    std::vector<cl_kernel> kernels = compile(source.str(),
+                                             {"count", "scan", "compact"},
+                                             flags.str());
+    _count = kernels.at(0);
+    _scan = kernels.at(1);
+    _compact = kernels.at(2);
+
+    for(auto kernel : kernels){
+        size_t local_size;
+        err_code = clGetKernelWorkGroupInfo(kernel,
+                                            C->device(),
+                                            CL_KERNEL_WORK_GROUP_SIZE,
+                                            sizeof(size_t),
+                                            &local_size,
+                                            NULL);
+        if(err_code != CL_SUCCESS) {
+            LOG(L_ERROR, "Failure querying the work group size.\n");
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        if(local_size < _local_work_size){
+            std::stringstream msg;
+            msg << "The compaction \"" << name()
+                << "\" cannot be performed." << std::endl;
+            LOG(L_ERROR, msg.str());
+            msg.str("");
+            msg << "\t" << local_size
+                << " elements can be executed, but " << _local_work_size
+                << " are required" << std::endl;
+            LOG0(L_DEBUG, msg.str());
+            throw std::runtime_error("OpenCL error");
+        }
+    }
+    _global_work_size = roundUp(_n, _local_work_size);
+    _n_groups = _global_work_size / _local_work_size;
+}
+
+void Compact::setupMem()
+{
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    cl_mem *mems[2] = {&_counts, &_offsets};
+    const std::string names[2] = {"counts", "offsets"};
+    const size_t sizes[2] = {_n_groups * sizeof(unsigned int),
+                             (_n_groups + 1) * sizeof(unsigned int)};
+    for(unsigned int i = 0; i < 2; i++){
+        *mems[i] = clCreateBuffer(C->context(),
+                                  CL_MEM_READ_WRITE,
+                                  sizes[i],
+                                  NULL,
+                                  &err_code);
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure allocating device memory in the tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL allocation error");
+        }
+        allocatedMemory(names[i], sizes[i]);
+    }
+}
+
+void Compact::setVariables()
+{
+    cl_int err_code;
+
+    // The arrays may be swapped by other tools, so they are set every time
+    err_code = clSetKernelArg(_count, 0, sizeof(cl_mem), _input_var->get());
+    err_code |= clSetKernelArg(_count, 1, sizeof(cl_mem), (void*)&_counts);
+    err_code |= clSetKernelArg(_count, 2, sizeof(unsigned int), (void*)&_n);
+    err_code |= clSetKernelArg(_scan, 0, sizeof(cl_mem), (void*)&_counts);
+    err_code |= clSetKernelArg(_scan, 1, sizeof(cl_mem), (void*)&_offsets);
+    err_code |= clSetKernelArg(_scan, 2, sizeof(unsigned int),
+                               (void*)&_n_groups);
+    err_code |= clSetKernelArg(_compact, 0, sizeof(cl_mem), _input_var->get());
+    err_code |= clSetKernelArg(_compact, 1, sizeof(cl_mem), (void*)&_offsets);
+    err_code |= clSetKernelArg(_compact, 2, sizeof(cl_mem), _output_var->get());
+    err_code |= clSetKernelArg(_compact, 3, sizeof(unsigned int), (void*)&_n);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure setting the arguments of the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+}
+
+}}  // namespaces
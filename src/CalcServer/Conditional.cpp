@@ -33,6 +33,7 @@ namespace Aqua{ namespace CalcServer{
 Conditional::Conditional(const std::string name, const std::string condition, bool once)
     : Tool(name, once)
     , _condition(condition)
+    , _expr(NULL)
     , _ending_tool(NULL)
     , _result(true)
 {
@@ -40,6 +41,7 @@ Conditional::Conditional(const std::string name, const std::string condition, bo
 
 Conditional::~Conditional()
 {
+    if(_expr) delete _expr; _expr=NULL;
 }
 
 void Conditional::setup()
@@ -77,6 +79,10 @@ void Conditional::setup()
     else
         _ending_tool = tools.at(i + 1);
 
+    // Parse the condition just once, since loops may evaluate it a lot of
+    // times per time step
+    _expr = CalcServer::singleton()->variables()->compile(_condition);
+
     // Get the next tool in case the condition is fulfilled
     Tool::setup();
 }
@@ -101,7 +107,7 @@ cl_event Conditional::_execute(const std::vector<cl_event> events)
         throw std::bad_alloc();
     }
 
-    vars->solve("int", _condition, data, "if_result");
+    vars->solve("int", _expr, data);
 
     // Check the result
     memcpy(&result, data, sizeof(int));
@@ -111,8 +117,13 @@ cl_event Conditional::_execute(const std::vector<cl_event> events)
     return NULL;
 }
 
-While::While(const std::string name, const std::string condition, bool once)
+While::While(const std::string name,
+             const std::string condition,
+             bool once,
+             unsigned int batch)
     : Conditional(name, condition, once)
+    , _batch(batch ? batch : 1)
+    , _iter(0)
 {
 }
 
@@ -125,9 +136,30 @@ void While::setup()
     std::ostringstream msg;
     msg << "Loading the tool \"" << name() << "\"..." << std::endl;
     LOG(L_INFO, msg.str());
+    if(_batch > 1){
+        msg.str("");
+        msg << "\tThe condition is evaluated each " << _batch
+            << " iterations" << std::endl;
+        LOG0(L_DEBUG, msg.str());
+    }
     Conditional::setup();
 }
 
+cl_event While::_execute(const std::vector<cl_event> events)
+{
+    // Keep iterating without evaluating the condition until the batch is
+    // finished, so the host is not waiting for the device
+    if(_iter++ % _batch){
+        _result = true;
+        return NULL;
+    }
+
+    cl_event event = Conditional::_execute(events);
+    if(!_result)
+        _iter = 0;
+    return event;
+}
+
 If::If(const std::string name, const std::string condition, bool once)
     : Conditional(name, condition, once)
 {
@@ -0,0 +1,351 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Several OpenCL kernels fused in a single launch.
+ * (see Aqua::CalcServer::FusedKernel for details)
+ */
+
+#include <fstream>
+#include <regex>
+#include <algorithm>
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <CalcServer.h>
+#include <CalcServer/FusedKernel.h>
+
+namespace Aqua{ namespace CalcServer{
+
+/** @brief Read an OpenCL source code file
+ * @param path File path
+ * @return File content
+ */
+static std::string readFile(const std::string path)
+{
+    std::ifstream script(path);
+    if(!script) {
+        std::stringstream msg;
+        msg << "Failure reading the file \"" <<
+               path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::ifstream::failure(msg.str());
+    }
+    std::ostringstream source;
+    source << script.rdbuf();
+    return source.str();
+}
+
+/** @brief Remove the comments of an OpenCL source code
+ * @param source Source code
+ * @return Source code without comments
+ */
+static std::string stripComments(const std::string source)
+{
+    std::string stripped;
+    size_t i = 0;
+    while(i < source.size()) {
+        if(!source.compare(i, 2, "//")) {
+            i = source.find('\n', i);
+            if(i == std::string::npos)
+                break;
+        }
+        else if(!source.compare(i, 2, "/*")) {
+            i = source.find("*/", i + 2);
+            if(i == std::string::npos)
+                break;
+            i += 2;
+            stripped += ' ';
+        }
+        else {
+            stripped += source[i++];
+        }
+    }
+    return stripped;
+}
+
+/** @brief Get the arguments declarations of an OpenCL entry point
+ * @param path Source code file path, just for reporting purposes
+ * @param source Source code
+ * @param entry_point Entry point
+ * @return Arguments declarations
+ */
+static std::vector<std::string> entryPointDeclarations(
+    const std::string path,
+    const std::string source,
+    const std::string entry_point)
+{
+    std::string code = stripComments(source);
+    std::smatch match;
+    std::regex signature("(__kernel|kernel)\\s+void\\s+" + entry_point +
+                         "\\s*\\(");
+    if(!std::regex_search(code, match, signature)) {
+        std::stringstream msg;
+        msg << "The entry point \"" << entry_point
+            << "\" cannot be found in \"" << path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid entry point");
+    }
+
+    std::vector<std::string> decls;
+    std::string decl;
+    unsigned int depth = 1;
+    for(size_t i = match.position(0) + match.length(0); i < code.size(); i++) {
+        const char c = code[i];
+        if(c == '(')
+            depth++;
+        else if(c == ')')
+            depth--;
+        if(!depth || ((depth == 1) && (c == ','))) {
+            trim(decl);
+            if(decl != "")
+                decls.push_back(decl);
+            decl = "";
+            if(!depth)
+                return decls;
+            continue;
+        }
+        decl += c;
+    }
+
+    std::stringstream msg;
+    msg << "The entry point \"" << entry_point
+        << "\" arguments cannot be parsed in \"" << path << "\"." << std::endl;
+    LOG(L_ERROR, msg.str());
+    throw std::runtime_error("Invalid entry point");
+    return decls;
+}
+
+/** @brief Get the name of the argument declared
+ * @param decl Argument declaration
+ * @return Argument name
+ */
+static std::string declarationName(const std::string decl)
+{
+    std::smatch match;
+    std::regex name("([A-Za-z_][A-Za-z0-9_]*)\\s*$");
+    if(!std::regex_search(decl, match, name)) {
+        std::stringstream msg;
+        msg << "Cannot get the argument name of \"" << decl
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid argument");
+    }
+    return match.str(1);
+}
+
+/** @brief Get the macros defined in an OpenCL source code
+ *
+ * The include guards, i.e. the macros defined without value just after being
+ * checked by a "#ifndef", are not reported, so the guarded code is never
+ * pasted twice.
+ * @param source Source code
+ * @return Macros names
+ */
+static std::vector<std::string> definedMacros(const std::string source)
+{
+    std::vector<std::string> macros;
+    std::istringstream lines(source);
+    std::string line, guard = "";
+    std::smatch match;
+    std::regex ifndef("^\\s*#\\s*ifndef\\s+([A-Za-z_][A-Za-z0-9_]*)");
+    std::regex define("^\\s*#\\s*define\\s+([A-Za-z_][A-Za-z0-9_]*)(.*)");
+    while(std::getline(lines, line)) {
+        if(std::regex_search(line, match, ifndef)) {
+            guard = match.str(1);
+            continue;
+        }
+        if(!std::regex_search(line, match, define)) {
+            if(trimCopy(line) != "")
+                guard = "";
+            continue;
+        }
+        if(!match.str(1).compare(guard) && (trimCopy(match.str(2)) == "")) {
+            guard = "";
+            continue;
+        }
+        guard = "";
+        if(std::find(macros.begin(), macros.end(), match.str(1)) ==
+           macros.end())
+            macros.push_back(match.str(1));
+    }
+    return macros;
+}
+
+/** @brief Check whether an argument declaration is a read only one
+ * @param decl Argument declaration
+ * @return true if the declaration has the const qualifier, false otherwise
+ */
+static bool isConstDeclaration(const std::string decl)
+{
+    return std::regex_search(decl, std::regex("\\bconst\\b"));
+}
+
+FusedKernel::FusedKernel(const std::string tool_name,
+                         const std::string kernel_path,
+                         const std::string entry_point,
+                         const std::string n,
+                         bool once)
+    : Kernel(tool_name, kernel_path, "entry", n, once)
+    , _fused_n(n)
+    , _fused_once(once)
+{
+    _paths.push_back(kernel_path);
+    _entry_points.push_back(entry_point);
+}
+
+FusedKernel::~FusedKernel()
+{
+}
+
+void FusedKernel::add(const std::string kernel_path,
+                      const std::string entry_point,
+                      const std::string n,
+                      bool once)
+{
+    if(n.compare(_fused_n) || (once != _fused_once)) {
+        std::stringstream msg;
+        msg << "The kernel \"" << kernel_path
+            << "\" cannot be fused in the tool \"" << name()
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        LOG0(L_DEBUG, "\tThe number of threads and the once flag shall match\n");
+        throw std::runtime_error("Invalid fused kernel");
+    }
+    _paths.push_back(kernel_path);
+    _entry_points.push_back(entry_point);
+}
+
+std::vector<std::string> FusedKernel::arguments(const std::string entry_point)
+{
+    parse();
+    return _arg_names;
+}
+
+std::string FusedKernel::readSource()
+{
+    unsigned int i;
+    parse();
+
+    // Get the user definitions, which shall be preserved
+    std::vector<std::string> definitions;
+    for(auto def : CalcServer::singleton()->definitions()) {
+        definitions.push_back(def.substr(2, def.find('=') - 2));
+    }
+
+    std::ostringstream source;
+    for(i = 0; i < _paths.size(); i++) {
+        std::string piece = readFile(_paths.at(i));
+        source << "#define " << _entry_points.at(i) << " _fused_entry_"
+               << i << std::endl;
+        source << "#line 1" << std::endl;
+        source << piece << std::endl;
+        source << "#undef " << _entry_points.at(i) << std::endl;
+        // Drop the macros defined by this kernel, so the following ones get
+        // their own default values
+        for(auto macro : definedMacros(piece)) {
+            if(std::find(definitions.begin(), definitions.end(), macro) !=
+               definitions.end())
+                continue;
+            source << "#undef " << macro << std::endl;
+        }
+    }
+
+    source << "__kernel void entry(";
+    for(i = 0; i < _arg_decls.size(); i++) {
+        source << _arg_decls.at(i);
+        if(i < _arg_decls.size() - 1)
+            source << ", ";
+    }
+    source << ")" << std::endl << "{" << std::endl;
+    for(i = 0; i < _paths.size(); i++) {
+        source << "    _fused_entry_" << i << "(";
+        for(unsigned int j = 0; j < _args.at(i).size(); j++) {
+            source << _args.at(i).at(j);
+            if(j < _args.at(i).size() - 1)
+                source << ", ";
+        }
+        source << ");" << std::endl;
+    }
+    source << "}" << std::endl;
+
+    return source.str();
+}
+
+std::vector<std::string> FusedKernel::includeFolders()
+{
+    std::vector<std::string> folders;
+    for(auto path : _paths) {
+        std::string folder = getFolderFromFilePath(path);
+        if(std::find(folders.begin(), folders.end(), folder) == folders.end())
+            folders.push_back(folder);
+    }
+    return folders;
+}
+
+void FusedKernel::parse()
+{
+    if(_args.size())
+        return;
+
+    // The same argument may be read only in a kernel, but written in other
+    // one. Just the arguments declared as const by all the kernels keep the
+    // qualifier
+    std::vector<bool> writable;
+    for(unsigned int i = 0; i < _paths.size(); i++) {
+        std::vector<std::string> decls = entryPointDeclarations(
+            _paths.at(i), readFile(_paths.at(i)), _entry_points.at(i));
+        std::vector<std::string> args;
+        for(auto decl : decls) {
+            std::string arg = declarationName(decl);
+            args.push_back(arg);
+            auto it = std::find(_arg_names.begin(), _arg_names.end(), arg);
+            if(it != _arg_names.end()) {
+                if(!isConstDeclaration(decl))
+                    writable.at(it - _arg_names.begin()) = true;
+                continue;
+            }
+            _arg_names.push_back(arg);
+            _arg_decls.push_back(decl);
+            writable.push_back(!isConstDeclaration(decl));
+        }
+        _args.push_back(args);
+    }
+    for(unsigned int i = 0; i < _arg_decls.size(); i++) {
+        if(writable.at(i)) {
+            _arg_decls.at(i) = trimCopy(std::regex_replace(
+                _arg_decls.at(i), std::regex("\\s*\\bconst\\b"), ""));
+        }
+        // Each array has its own memory object, so the compiler can forward
+        // the values stored by a kernel to the following ones, instead of
+        // loading them back from the global memory
+        if((_arg_decls.at(i).find('*') != std::string::npos) &&
+           !std::regex_search(_arg_decls.at(i), std::regex("\\brestrict\\b"))) {
+            _arg_decls.at(i) = std::regex_replace(
+                _arg_decls.at(i),
+                std::regex("\\*\\s*([A-Za-z_][A-Za-z0-9_]*)$"),
+                "* restrict $1");
+        }
+    }
+
+    std::stringstream msg;
+    msg << _paths.size() << " kernels fused in the tool \"" << name()
+        << "\", with " << _arg_names.size() << " arguments." << std::endl;
+    LOG(L_INFO, msg.str());
+}
+
+}}  // namespace
@@ -23,6 +23,17 @@
 
 #include <clang-c/Index.h>
 #include <clang-c/Platform.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <regex>
+#include <algorithm>
+#include <cmath>
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
 #include <CalcServer.h>
@@ -40,18 +51,22 @@ Kernel::Kernel(const std::string tool_name,
     , _entry_point(entry_point)
     , _n(n)
     , _kernel(NULL)
+    , _built(false)
     , _work_group_size(0)
     , _global_work_size(0)
+    , _global_work_offset(0)
+    , _autotune_id(0)
+    , _autotune_samples(0)
+    , _autotune_event(NULL)
+    , _n_threads(0)
+    , _flops(0.0)
 {
 }
 
 Kernel::~Kernel()
 {
     if(_kernel) clReleaseKernel(_kernel); _kernel=NULL;
-
-    for(auto it = _var_values.begin(); it < _var_values.end(); it++){
-        free(*it);
-    }
+    if(_autotune_event) clReleaseEvent(_autotune_event); _autotune_event=NULL;
 }
 
 void Kernel::setup()
@@ -62,28 +77,72 @@ void Kernel::setup()
     LOG(L_INFO, msg.str());
 
     Tool::setup();
-    make(_entry_point);
-    variables(_entry_point);
+    build();
+    if(CalcServer::singleton()->autotune())
+        setupAutotune();
     setVariables();
     computeGlobalWorkSize();
 }
 
+void Kernel::build()
+{
+    if(_built)
+        return;
+    // The arguments shall be known to specialize the kernel
+    variables(_entry_point);
+    make(_entry_point);
+    setupTraffic();
+    _built = true;
+}
+
+void Kernel::setConstants(const std::string names)
+{
+    std::istringstream words(replaceAllCopy(names, ",", " "));
+    std::string name;
+    while(words >> name) {
+        if(std::find(_const_names.begin(), _const_names.end(), name) ==
+           _const_names.end())
+            _const_names.push_back(name);
+    }
+}
+
 cl_event Kernel::_execute(const std::vector<cl_event> events)
 {
     cl_int err_code;
     cl_event event;
     CalcServer *C = CalcServer::singleton();
 
+    if(_autotune_sizes.size())
+        sampleAutotune();
+    if(_const_ids.size())
+        respecialize();
     setVariables();
     computeGlobalWorkSize();
 
     cl_uint num_events_in_wait_list = events.size();
     const cl_event *event_wait_list = events.size() ? events.data() : NULL;
 
+    if(!_global_work_size){
+        // Nothing to compute, e.g. an empty set of particles
+        err_code = clEnqueueMarkerWithWaitList(C->command_queue(),
+                                               num_events_in_wait_list,
+                                               event_wait_list,
+                                               &event);
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure executing the tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        return event;
+    }
+
     err_code = clEnqueueNDRangeKernel(C->command_queue(),
                                       _kernel,
                                       1,
-                                      NULL,
+                                      &_global_work_offset,
                                       &_global_work_size,
                                       &_work_group_size,
                                       num_events_in_wait_list,
@@ -98,6 +157,21 @@ cl_event Kernel::_execute(const std::vector<cl_event> events)
         throw std::runtime_error("OpenCL execution error");
     }
 
+    // Keep the event to be profiled by the autotuning, unless the previous
+    // one is not finished yet
+    if(_autotune_sizes.size() && !_autotune_event) {
+        err_code = clRetainEvent(event);
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure retaining the autotuning event in tool \"" <<
+                name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        _autotune_event = event;
+    }
+
     return event;
 }
 
@@ -116,18 +190,12 @@ void Kernel::make(const std::string entry_point,
     CalcServer *C = CalcServer::singleton();
 
     // Read the script file
-    std::ifstream script(path());
-    if(!script) {
-        std::stringstream msg;
-        msg << "Failure reading the file \"" <<
-               path() << "\"." << std::endl;
-        LOG(L_ERROR, msg.str());
-        throw std::ifstream::failure(msg.str());
-    }
-    source << header << script.rdbuf();
+    source << specialize(header + readSource(), entry_point);
 
     // Setup the default flags
-    flags << "-I" << getFolderFromFilePath(path()) << " ";
+    for(auto folder : includeFolders()) {
+        flags << "-I" << folder << " ";
+    }
     if(C->base_path().compare("")){
         flags << "-I" << C->base_path() << " ";
     }
@@ -262,9 +330,82 @@ struct clientData{
     std::vector<std::string> var_names;
 };
 
-void Kernel::variables(const std::string entry_point)
+/// Memoized entry points arguments, see Kernel::arguments()
+static std::map<std::string, std::vector<std::string>> memoized_arguments;
+/// Mutex to protect #memoized_arguments
+static std::mutex memoized_arguments_mutex;
+
+std::string Kernel::readSource()
 {
-    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+    std::ifstream script(path());
+    if(!script) {
+        std::stringstream msg;
+        msg << "Failure reading the file \"" <<
+               path() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::ifstream::failure(msg.str());
+    }
+    std::ostringstream source;
+    source << script.rdbuf();
+    return source.str();
+}
+
+std::vector<std::string> Kernel::includeFolders()
+{
+    std::vector<std::string> folders;
+    folders.push_back(getFolderFromFilePath(path()));
+    return folders;
+}
+
+std::vector<std::string> Kernel::arguments(const std::string entry_point)
+{
+    return parseArguments(path(), entry_point);
+}
+
+std::vector<std::string> Kernel::parseArguments(const std::string path,
+                                                const std::string entry_point)
+{
+    CalcServer *C = CalcServer::singleton();
+
+    // Get the key, based on the source code and the entry point
+    std::ifstream script(path);
+    if(!script) {
+        std::stringstream msg;
+        msg << "Failure reading the file \"" <<
+               path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::ifstream::failure(msg.str());
+    }
+    std::ostringstream source;
+    source << script.rdbuf() << '\0' << entry_point;
+    std::ostringstream key;
+    key << hashString(source.str());
+
+    // Look for the arguments in the process memory
+    {
+        std::lock_guard<std::mutex> lock(memoized_arguments_mutex);
+        auto it = memoized_arguments.find(key.str());
+        if(it != memoized_arguments.end())
+            return it->second;
+    }
+
+    // Look for the arguments in the disk cache
+    std::string cache_file = "";
+    if(C->cache_path() != "") {
+        cache_file = C->cache_path() + "/" + key.str() + ".args";
+        std::ifstream f(cache_file);
+        if(f.is_open()) {
+            std::vector<std::string> args;
+            std::string arg;
+            while(std::getline(f, arg)) {
+                if(arg != "")
+                    args.push_back(arg);
+            }
+            std::lock_guard<std::mutex> lock(memoized_arguments_mutex);
+            memoized_arguments[key.str()] = args;
+            return args;
+        }
+    }
 
     CXIndex index = clang_createIndex(0, 0);
     if(index == 0){
@@ -273,7 +414,7 @@ void Kernel::variables(const std::string entry_point)
     }
 
     int argc = 2;
-    const char* argv[2] = {"Kernel", _path.c_str()};
+    const char* argv[2] = {"Kernel", path.c_str()};
     CXTranslationUnit translation_unit = clang_parseTranslationUnit(
         index,
         0,
@@ -291,8 +432,9 @@ void Kernel::variables(const std::string entry_point)
     struct clientData client_data;
     client_data.entry_point = entry_point;
     client_data.entry_points = 0;
-    client_data.var_names = _var_names;
     clang_visitChildren(root_cursor, *cursorVisitor, &client_data);
+    clang_disposeTranslationUnit(translation_unit);
+    clang_disposeIndex(index);
     if(client_data.entry_points == 0){
         std::stringstream msg;
         msg << "The entry point \"" << entry_point
@@ -308,10 +450,45 @@ void Kernel::variables(const std::string entry_point)
         LOG(L_ERROR, msg.str());
         throw std::runtime_error("Invalid entry point");
     }
-    _var_names = client_data.var_names;
+
+    {
+        std::lock_guard<std::mutex> lock(memoized_arguments_mutex);
+        memoized_arguments[key.str()] = client_data.var_names;
+    }
+    if(cache_file != "") {
+        // Write in a temporary file first, to avoid partial reads from other
+        // instances
+        std::ostringstream tmp_file;
+        tmp_file << cache_file << "." << getpid() << "."
+                 << std::this_thread::get_id() << ".tmp";
+        std::ofstream f(tmp_file.str());
+        for(auto arg : client_data.var_names) {
+            f << arg << std::endl;
+        }
+        f.close();
+        if(f.fail() || rename(tmp_file.str().c_str(), cache_file.c_str())) {
+            std::stringstream msg;
+            msg << "Failure writing the cached arguments \"" << cache_file
+                << "\"" << std::endl;
+            LOG(L_WARNING, msg.str());
+            remove(tmp_file.str().c_str());
+        }
+    }
+
+    return client_data.var_names;
+}
+
+void Kernel::variables(const std::string entry_point)
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+
+    std::vector<std::string> args = arguments(entry_point);
+    _var_names.insert(_var_names.end(), args.begin(), args.end());
     // Retain just the array variables as dependencies, provided that scalar
     // variables are synced when passed using clSetKernelArg()
     std::vector<InputOutput::Variable*> deps;
+    _vars.clear();
+    _var_versions.clear();
     for(auto var_name : _var_names) {
         InputOutput::Variable *var = vars->get(var_name);
         if(!var){
@@ -324,15 +501,58 @@ void Kernel::variables(const std::string entry_point)
         }
         if(var->isArray())
             deps.push_back(var);
+        _vars.push_back(var);
+        // Force the argument to be set the first time
+        _var_versions.push_back(0);
     }
     setDependencies(deps);
-    
-    for(unsigned int i = 0; i < _var_names.size(); i++){
-        _var_values.push_back(NULL);
+
+    // Collect the arguments to be specialized
+    _const_ids.clear();
+    for(auto const_name : _const_names) {
+        auto it = std::find(_var_names.begin(), _var_names.end(), const_name);
+        if(it == _var_names.end()) {
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" cannot specialize \"" << const_name
+                << "\", which is not an argument. It is ignored." << std::endl;
+            LOG(L_WARNING, msg.str());
+            continue;
+        }
+        const unsigned int id = it - _var_names.begin();
+        if(!_vars.at(id)->isScalar()) {
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" cannot specialize the array \"" << const_name
+                << "\". It is ignored." << std::endl;
+            LOG(L_WARNING, msg.str());
+            continue;
+        }
+        _const_ids.push_back(id);
     }
 
-    clang_disposeTranslationUnit(translation_unit);
-    clang_disposeIndex(index);
+    // Collect the variables involved in the number of threads expression, or
+    // in the particles set one. The vectorial variables components are
+    // referred with a suffix, e.g. n_cells_w
+    _n_vars.clear();
+    _n_versions.clear();
+    const std::string n_expr = _set.empty() ? _n : _set;
+    std::regex identifier("[A-Za-z_][A-Za-z0-9_]*");
+    for(auto it = std::sregex_iterator(n_expr.begin(), n_expr.end(), identifier);
+        it != std::sregex_iterator(); it++) {
+        std::string var_name = it->str();
+        InputOutput::Variable *var = vars->get(var_name);
+        if(!var && (var_name.size() > 2) &&
+           (var_name[var_name.size() - 2] == '_')) {
+            var = vars->get(var_name.substr(0, var_name.size() - 2));
+        }
+        if(!var ||
+           (std::find(_n_vars.begin(), _n_vars.end(), var) != _n_vars.end()))
+            continue;
+        _n_vars.push_back(var);
+        // Force the expression to be evaluated the first time
+        _n_versions.push_back(0);
+    }
 }
 
 CXChildVisitResult cursorVisitor(CXCursor cursor,
@@ -371,22 +591,10 @@ void Kernel::setVariables()
 {
     unsigned int i;
     cl_int err_code;
-    InputOutput::Variables *vars = CalcServer::singleton()->variables();
 
-    for(i = 0; i < _var_names.size(); i++){
-        InputOutput::Variable *var = vars->get(_var_names.at(i));
-        if(!var){
-            std::stringstream msg;
-            msg << "The tool \"" << name()
-                << "\" is asking the undeclared variable \""
-                << _var_names.at(i) << "\"." << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::runtime_error("Invalid variable");
-        }
-        if(_var_values.at(i) == NULL){
-            _var_values.at(i) = malloc(var->typesize());
-        }
-        else if(!memcmp(_var_values.at(i), var->get(), var->typesize())){
+    for(i = 0; i < _vars.size(); i++){
+        InputOutput::Variable *var = _vars.at(i);
+        if(_var_versions.at(i) == var->version()){
             // The variable still being valid
             continue;
         }
@@ -402,26 +610,520 @@ void Kernel::setVariables()
             InputOutput::Logger::singleton()->printOpenCLError(err_code);
             throw std::runtime_error("OpenCL error");
         }
-        memcpy(_var_values.at(i), var->get(), var->typesize());
+        _var_versions.at(i) = var->version();
     }
 }
 
 void Kernel::computeGlobalWorkSize()
 {
-    unsigned int N;
+    unsigned int i, N;
     if(!_work_group_size){
         LOG(L_ERROR, "Work group size must be greater than 0.\n");
         throw std::runtime_error("Null work group size");
     }
-    InputOutput::Variables *vars = CalcServer::singleton()->variables();
-    try {
-        vars->solve("unsigned int", _n, &N);
-    } catch(...) {
-        LOG(L_ERROR, "Failure evaluating the number of threads.\n");
-        throw std::runtime_error("Invalid number of threads");
+
+    bool changed = !_global_work_size;
+    for(i = 0; i < _n_vars.size(); i++){
+        if(_n_versions.at(i) != _n_vars.at(i)->version()){
+            _n_versions.at(i) = _n_vars.at(i)->version();
+            changed = true;
+        }
+    }
+    if(changed && !_set.empty()){
+        CalcServer *C = CalcServer::singleton();
+        unsigned int iset;
+        try {
+            C->variables()->solve("unsigned int", _set, &iset);
+        } catch(...) {
+            LOG(L_ERROR, "Failure evaluating the particles set.\n");
+            throw std::runtime_error("Invalid particles set");
+        }
+        const uivec2 bounds = C->setBounds(iset);
+        _global_work_offset = bounds.x;
+        _n_threads = bounds.y - bounds.x;
+    }
+    else if(changed){
+        InputOutput::Variables *vars = CalcServer::singleton()->variables();
+        try {
+            vars->solve("unsigned int", _n, &N);
+        } catch(...) {
+            LOG(L_ERROR, "Failure evaluating the number of threads.\n");
+            throw std::runtime_error("Invalid number of threads");
+        }
+        _n_threads = N;
+    }
+
+    _global_work_size = (size_t)roundUp(_n_threads,
+                                        (unsigned int)_work_group_size);
+}
+
+/** @brief Mark the characters of a source code which are not comments
+ * @param source Source code
+ * @return true for the characters out of the comments, false otherwise
+ */
+static std::vector<bool> codeMask(const std::string &source)
+{
+    std::vector<bool> mask(source.size(), true);
+    size_t i = 0;
+    while(i < source.size()) {
+        size_t end;
+        if(!source.compare(i, 2, "//")) {
+            end = source.find('\n', i);
+        }
+        else if(!source.compare(i, 2, "/*")) {
+            end = source.find("*/", i + 2);
+            if(end != std::string::npos)
+                end += 2;
+        }
+        else {
+            i++;
+            continue;
+        }
+        if(end == std::string::npos)
+            end = source.size();
+        std::fill(mask.begin() + i, mask.begin() + end, false);
+        i = end;
+    }
+    return mask;
+}
+
+/** @brief Get the value of a scalar variable as an OpenCL literal
+ * @param var Variable
+ * @param type OpenCL type, as declared in the kernel signature
+ * @return The literal, an empty string if the value cannot be represented
+ */
+static std::string constantLiteral(InputOutput::Variable *var,
+                                   const std::string type)
+{
+    const std::string var_type = trimCopy(var->type());
+    const unsigned int n = InputOutput::Variables::typeToN(var_type);
+    std::ostringstream literal;
+    if(n > 1)
+        literal << "(" << type << ")(";
+    for(unsigned int i = 0; i < n; i++) {
+        if(i)
+            literal << ", ";
+        if(!var_type.find("unsigned") || !var_type.find("uivec")) {
+            literal << ((unsigned int*)var->get())[i] << "u";
+        }
+        else if(!var_type.find("int") || !var_type.find("ivec")) {
+            literal << ((int*)var->get())[i];
+        }
+        else {
+            // Hexadecimal, so the value is exactly the same
+            const float value = ((float*)var->get())[i];
+            if(!std::isfinite(value))
+                return "";
+            literal << std::hexfloat << value << std::defaultfloat << "f";
+        }
+    }
+    if(n > 1)
+        literal << ")";
+    return literal.str();
+}
+
+std::string Kernel::specialize(const std::string source,
+                               const std::string entry_point)
+{
+    _const_types.clear();
+    _const_values.clear();
+    _const_versions.clear();
+    if(!_const_ids.size())
+        return source;
+
+    // Look for the last signature of the entry point out of the comments
+    const std::vector<bool> mask = codeMask(source);
+    std::regex signature("(__kernel|kernel)\\s+void\\s+" + entry_point +
+                         "\\s*\\(");
+    size_t start = std::string::npos;
+    for(auto it = std::sregex_iterator(source.begin(), source.end(), signature);
+        it != std::sregex_iterator(); it++) {
+        if(mask.at(it->position(0)))
+            start = it->position(0) + it->length(0);
+    }
+
+    // Parse the arguments, getting the start of the name of each one
+    std::vector<size_t> decl_starts, name_starts, name_ends;
+    size_t decl_start = start, name_start = 0, name_end = 0, i;
+    unsigned int depth = 1;
+    for(i = start; (start != std::string::npos) && (i < source.size()); i++) {
+        if(!mask.at(i))
+            continue;
+        const char c = source[i];
+        if(c == '(')
+            depth++;
+        else if(c == ')')
+            depth--;
+        if(!depth || ((depth == 1) && (c == ','))) {
+            if(name_end > decl_start) {
+                decl_starts.push_back(decl_start);
+                name_starts.push_back(name_start);
+                name_ends.push_back(name_end);
+            }
+            decl_start = i + 1;
+            if(!depth)
+                break;
+            continue;
+        }
+        if(isalnum(c) || (c == '_')) {
+            if(name_end != i)
+                name_start = i;
+            name_end = i + 1;
+        }
+    }
+    size_t brace = std::string::npos;
+    for(i++; i < source.size(); i++) {
+        if(mask.at(i) && (source[i] == '{')) {
+            brace = i;
+            break;
+        }
+    }
+    if((brace == std::string::npos) || (name_starts.size() != _vars.size())) {
+        std::stringstream msg;
+        msg << "The entry point of the tool \"" << name()
+            << "\" cannot be parsed, so it is not specialized." << std::endl;
+        LOG(L_WARNING, msg.str());
+        return source;
+    }
+
+    // Declare the constants at the body opening line, and rename the
+    // arguments, from the last one, so the positions are still valid
+    std::ostringstream decls;
+    std::vector<unsigned int> renamed;
+    for(auto id : _const_ids) {
+        std::string type;
+        for(i = decl_starts.at(id); i < name_starts.at(id); i++) {
+            if(mask.at(i))
+                type += source[i];
+        }
+        type = trimCopy(std::regex_replace(type, std::regex("\\bconst\\b"),
+                                           ""));
+        InputOutput::Variable *var = _vars.at(id);
+        _const_types.push_back(type);
+        _const_values.push_back(constantLiteral(var, type));
+        _const_versions.push_back(var->version());
+        if(_const_values.back() == "")
+            continue;
+        decls << " const " << type << " " << _var_names.at(id) << " = "
+              << _const_values.back() << ";";
+        renamed.push_back(id);
+    }
+    std::string code = source;
+    code.insert(brace + 1, decls.str());
+    std::sort(renamed.begin(), renamed.end());
+    for(auto it = renamed.rbegin(); it != renamed.rend(); it++) {
+        code.replace(name_starts.at(*it),
+                     name_ends.at(*it) - name_starts.at(*it),
+                     "_const_" + _var_names.at(*it));
+    }
+    return code;
+}
+
+void Kernel::respecialize()
+{
+    bool changed = false;
+    for(unsigned int i = 0; i < _const_versions.size(); i++) {
+        InputOutput::Variable *var = _vars.at(_const_ids.at(i));
+        if(var->version() == _const_versions.at(i))
+            continue;
+        _const_versions.at(i) = var->version();
+        if(constantLiteral(var, _const_types.at(i)) != _const_values.at(i))
+            changed = true;
+    }
+    if(!changed)
+        return;
+
+    std::stringstream msg;
+    msg << "The constants of the tool \"" << name()
+        << "\" have changed. Compiling it again..." << std::endl;
+    LOG(L_INFO, msg.str());
+    const size_t work_group_size = _work_group_size;
+    clReleaseKernel(_kernel); _kernel = NULL;
+    make(_entry_point);
+    _work_group_size = std::min(work_group_size, _work_group_size);
+    // All the arguments shall be set again
+    std::fill(_var_versions.begin(), _var_versions.end(), 0);
+}
+
+/** @brief Remove the C comments from a source code
+ * @param source Source code
+ * @return The source code without comments
+ */
+static std::string stripComments(const std::string &source)
+{
+    std::string stripped;
+    stripped.reserve(source.size());
+    size_t i = 0;
+    while(i < source.size()) {
+        if(!source.compare(i, 2, "//")) {
+            i = source.find('\n', i);
+            if(i == std::string::npos)
+                break;
+        }
+        else if(!source.compare(i, 2, "/*")) {
+            i = source.find("*/", i + 2);
+            if(i == std::string::npos)
+                break;
+            i += 2;
+            stripped += ' ';
+        }
+        else {
+            stripped += source[i++];
+        }
+    }
+    return stripped;
+}
+
+void Kernel::setupTraffic()
+{
+    std::string source = readSource();
+
+    // The operations are declared in the comments
+    _flops = 0.0;
+    std::smatch match;
+    if(std::regex_search(source, match,
+                         std::regex("@flops\\s+([0-9.eE+-]+)"))) {
+        try {
+            _flops = std::stod(match[1].str());
+        } catch(...) {
+            std::stringstream msg;
+            msg << "Invalid @flops declaration in \"" << path() << "\""
+                << std::endl;
+            LOG(L_WARNING, msg.str());
+        }
+    }
+
+    // Strip the comments, which may mention the arrays
+    source = stripComments(source);
+
+    // The arrays pointed as const data are never written. If the signature
+    // cannot be parsed, all the arrays may be written
+    _var_const.clear();
+    std::regex signature("(__kernel|kernel)\\s+void\\s+" + _entry_point +
+                         "\\s*\\(");
+    size_t start = std::string::npos;
+    for(auto it = std::sregex_iterator(source.begin(), source.end(), signature);
+        it != std::sregex_iterator(); it++) {
+        start = it->position(0) + it->length(0);
+    }
+    const std::regex qualifier("\\b(const|__constant|constant)\\b");
+    std::string decl;
+    unsigned int depth = 1;
+    for(size_t i = start; (start != std::string::npos) && (i < source.size());
+        i++) {
+        const char c = source[i];
+        if(c == '(')
+            depth++;
+        else if(c == ')')
+            depth--;
+        if(!depth || ((depth == 1) && (c == ','))) {
+            // Just the qualifiers of the pointed data are relevant
+            const size_t ptr = decl.rfind('*');
+            const std::string data = decl.substr(
+                0, ptr == std::string::npos ? 0 : ptr);
+            _var_const.push_back((ptr == std::string::npos) ||
+                                 std::regex_search(data, qualifier));
+            decl = "";
+            if(!depth)
+                break;
+            continue;
+        }
+        decl += c;
+    }
+    if(_var_const.size() != _vars.size())
+        _var_const = std::vector<bool>(_vars.size(), false);
+
+    _var_read.clear();
+    _var_written.clear();
+    for(unsigned int i = 0; i < _vars.size(); i++) {
+        if(!_vars.at(i)->isArray()) {
+            _var_read.push_back(false);
+            _var_written.push_back(false);
+            continue;
+        }
+        const std::string var_name = _var_names.at(i);
+        std::regex usage("\\b" + var_name + "\\b");
+        std::regex assign("\\b" + var_name +
+                          "\\s*\\[[^\\]]*\\]\\s*(=[^=]|[-+*/%&|^]=|<<=|>>=)");
+        std::regex update("\\b" + var_name +
+                          "\\s*\\[[^\\]]*\\]\\s*([-+*/%&|^]=|<<=|>>=)");
+        const long n_usages = std::distance(
+            std::sregex_iterator(source.begin(), source.end(), usage),
+            std::sregex_iterator());
+        const long n_assigns = std::distance(
+            std::sregex_iterator(source.begin(), source.end(), assign),
+            std::sregex_iterator());
+        // Besides the argument declaration, the array is read if it is used
+        // anywhere else than in plain assignments, or if it is not used at all
+        // (i.e. it is used by macros)
+        const bool written = n_assigns > 0;
+        const bool read = (n_usages <= 1) ||
+                          (n_usages - 1 > n_assigns) ||
+                          std::regex_search(source, update);
+        _var_read.push_back(read);
+        _var_written.push_back(written);
+    }
+}
+
+std::vector<InputOutput::Variable*> Kernel::outputs() const
+{
+    std::vector<InputOutput::Variable*> vars;
+    for(unsigned int i = 0; i < _vars.size(); i++) {
+        if(!_vars.at(i)->isArray())
+            continue;
+        if((i < _var_const.size()) && _var_const.at(i))
+            continue;
+        if(std::find(vars.begin(), vars.end(), _vars.at(i)) == vars.end())
+            vars.push_back(_vars.at(i));
+    }
+    return vars;
+}
+
+size_t Kernel::traffic(const std::vector<bool> &mask) const
+{
+    size_t bytes = 0;
+    for(unsigned int i = 0; (i < _vars.size()) && (i < mask.size()); i++) {
+        if(!mask.at(i))
+            continue;
+        const size_t typesize = InputOutput::Variables::typeToBytes(
+            _vars.at(i)->type());
+        if(!typesize)
+            continue;
+        const size_t n = _vars.at(i)->size() / typesize;
+        bytes += typesize * std::min(n, (size_t)_n_threads);
+    }
+    return bytes;
+}
+
+void Kernel::setupAutotune()
+{
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    _autotune_sizes.clear();
+    _autotune_times.clear();
+    _autotune_id = 0;
+    _autotune_samples = 0;
+
+    // Look for an already recorded work group size
+    size_t recorded;
+    if(getAutotuned("", recorded) && recorded &&
+       (recorded <= _work_group_size)) {
+        _work_group_size = recorded;
+        std::stringstream msg;
+        msg << "Recorded work group size, " << _work_group_size
+            << ", is used in tool \"" << name() << "\"." << std::endl;
+        LOG(L_INFO, msg.str());
+        return;
+    }
+
+    // Collect the candidates
+    size_t multiple;
+    err_code = clGetKernelWorkGroupInfo(
+        _kernel,
+        C->device(),
+        CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+        sizeof(size_t),
+        &multiple,
+        NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_WARNING, "Failure querying the preferred work group size multiple.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        LOG0(L_DEBUG, "\tThe work group size will not be autotuned\n");
+        return;
+    }
+    for(size_t size = multiple; size && (size < _work_group_size); size *= 2) {
+        _autotune_sizes.push_back(size);
+    }
+    _autotune_sizes.push_back(_work_group_size);
+    if(_autotune_sizes.size() < 2) {
+        // Nothing to choose
+        _autotune_sizes.clear();
+        return;
+    }
+    _autotune_times.resize(_autotune_sizes.size(), 0);
+    _work_group_size = _autotune_sizes.front();
+}
+
+void Kernel::sampleAutotune()
+{
+    cl_int err_code, status;
+    cl_ulong start, end;
+
+    if(!_autotune_event)
+        return;
+
+    err_code = clGetEventInfo(_autotune_event,
+                              CL_EVENT_COMMAND_EXECUTION_STATUS,
+                              sizeof(cl_int),
+                              &status,
+                              NULL);
+    if((err_code == CL_SUCCESS) && (status != CL_COMPLETE)){
+        // Try again in the next execution
+        return;
+    }
+    if(err_code == CL_SUCCESS)
+        err_code = clGetEventProfilingInfo(_autotune_event,
+                                           CL_PROFILING_COMMAND_START,
+                                           sizeof(cl_ulong),
+                                           &start,
+                                           NULL);
+    if(err_code == CL_SUCCESS)
+        err_code = clGetEventProfilingInfo(_autotune_event,
+                                           CL_PROFILING_COMMAND_END,
+                                           sizeof(cl_ulong),
+                                           &end,
+                                           NULL);
+    clReleaseEvent(_autotune_event);
+    _autotune_event = NULL;
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure profiling the tool \"" << name()
+            << "\". The work group size will not be autotuned" << std::endl;
+        LOG(L_WARNING, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        _work_group_size = _autotune_sizes.back();
+        _autotune_sizes.clear();
+        _autotune_times.clear();
+        return;
+    }
+
+    // Keep the fastest sample, which is the less affected by the rest of
+    // device work
+    cl_ulong elapsed = end - start;
+    if(!_autotune_samples || (elapsed < _autotune_times.at(_autotune_id)))
+        _autotune_times.at(_autotune_id) = elapsed;
+    if(++_autotune_samples < AUTOTUNE_SAMPLES)
+        return;
+
+    // Test the next candidate
+    _autotune_samples = 0;
+    if(++_autotune_id < _autotune_sizes.size()) {
+        _work_group_size = _autotune_sizes.at(_autotune_id);
+        return;
+    }
+
+    // Lock in the fastest candidate
+    unsigned int best = 0;
+    for(unsigned int i = 1; i < _autotune_times.size(); i++) {
+        if(_autotune_times.at(i) < _autotune_times.at(best))
+            best = i;
+    }
+    _work_group_size = _autotune_sizes.at(best);
+    std::stringstream msg;
+    msg << "Work group size autotuned to " << _work_group_size
+        << " in tool \"" << name() << "\"." << std::endl;
+    LOG(L_INFO, msg.str());
+    for(unsigned int i = 0; i < _autotune_sizes.size(); i++) {
+        msg.str("");
+        msg << "\t" << _autotune_sizes.at(i) << " -> "
+            << _autotune_times.at(i) * 1E-9 << " s" << std::endl;
+        LOG0(L_DEBUG, msg.str());
     }
+    _autotune_sizes.clear();
+    _autotune_times.clear();
 
-    _global_work_size = (size_t)roundUp(N, (unsigned int)_work_group_size);
+    setAutotuned("", _work_group_size);
 }
 
 }}  // namespace
@@ -41,12 +41,14 @@ std::string LINKLIST_SRC = xxd2string(LinkList_cl_in, LinkList_cl_in_len);
 
 LinkList::LinkList(const std::string tool_name,
                    const std::string input,
-                   bool once)
+                   bool once,
+                   bool incremental,
+                   unsigned int sort_bits,
+                   const std::string margin)
     : Tool(tool_name, once)
     , _input_name(input)
     , _cell_length(0.f)
-    , _min_pos(NULL)
-    , _max_pos(NULL)
+    , _bounds(NULL)
     , _ihoc(NULL)
     , _ihoc_lws(0)
     , _ihoc_gws(0)
@@ -56,36 +58,54 @@ LinkList::LinkList(const std::string tool_name,
     , _ll(NULL)
     , _ll_lws(0)
     , _ll_gws(0)
+    , _incremental(incremental)
+    , _morton(false)
+    , _hashed(false)
+    , _margin_expr(margin)
+    , _margin(0.f)
+    , _box_built(false)
+    , _out_of_box(NULL)
+    , _out_of_box_flag(0)
+    , _out_of_box_event(NULL)
+    , _unsorted(NULL)
+    , _is_sorted(NULL)
+    , _identity(NULL)
+    , _identity_lws(0)
+    , _identity_gws(0)
 {
-    std::stringstream min_pos_name;
-    min_pos_name << tool_name << "->Min. Pos.";
+    // Both the minimum and maximum positions are computed in a single pass
+    std::stringstream bounds_name;
+    bounds_name << tool_name << "->Bounds";
     std::string min_pos_op = "c.x = (a.x < b.x) ? a.x : b.x;\nc.y = (a.y < b.y) ? a.y : b.y;\n#ifdef HAVE_3D\nc.z = (a.z < b.z) ? a.z : b.z;\nc.w = 0.f;\n#endif\n";
-    _min_pos = new Reduction(min_pos_name.str(),
-                             input,
-                             "r_min",
-                             min_pos_op,
-                             "VEC_INFINITY");
-    std::stringstream max_pos_name;
-    max_pos_name << tool_name << "->Max. Pos.";
+    _bounds = new Reduction(bounds_name.str(),
+                            input,
+                            "r_min",
+                            min_pos_op,
+                            "VEC_INFINITY");
     std::string max_pos_op = "c.x = (a.x > b.x) ? a.x : b.x;\nc.y = (a.y > b.y) ? a.y : b.y;\n#ifdef HAVE_3D\nc.z = (a.z > b.z) ? a.z : b.z;\nc.w = 0.f;\n#endif\n";
-    _max_pos = new Reduction(max_pos_name.str(),
-                             input,
-                             "r_max",
-                             max_pos_op,
-                             "-VEC_INFINITY");
+    _bounds->add("r_max", max_pos_op, "-VEC_INFINITY");
     std::stringstream sort_name;
     sort_name << tool_name << "->Radix-Sort";
-    _sort = new RadixSort(sort_name.str());
+    _sort = new RadixSort(sort_name.str(),
+                          "icell",
+                          "id_unsorted",
+                          "id_sorted",
+                          false,
+                          sort_bits);
 }
 
 LinkList::~LinkList()
 {
-    if(_min_pos) delete _min_pos; _min_pos=NULL;
-    if(_max_pos) delete _max_pos; _max_pos=NULL;
+    if(_bounds) delete _bounds; _bounds=NULL;
     if(_sort) delete _sort; _sort=NULL;
     if(_ihoc) clReleaseKernel(_ihoc); _ihoc=NULL;
     if(_icell) clReleaseKernel(_icell); _icell=NULL;
     if(_ll) clReleaseKernel(_ll); _ll=NULL;
+    if(_is_sorted) clReleaseKernel(_is_sorted); _is_sorted=NULL;
+    if(_identity) clReleaseKernel(_identity); _identity=NULL;
+    if(_unsorted) clReleaseMemObject(_unsorted); _unsorted=NULL;
+    if(_out_of_box_event) clReleaseEvent(_out_of_box_event); _out_of_box_event=NULL;
+    if(_out_of_box) clReleaseMemObject(_out_of_box); _out_of_box=NULL;
     for(auto arg : _ihoc_args){
         free(arg);
     }
@@ -111,14 +131,39 @@ void LinkList::setup()
     Tool::setup();
 
     // Setup the reduction tools
-    _min_pos->setup();
-    _max_pos->setup();
+    _bounds->setup();
 
     // Compute the cells length
     InputOutput::Variable *s = vars->get("support");
     InputOutput::Variable *h = vars->get("h");
     _cell_length = *(float*)s->get() * *(float*)h->get();
 
+    // The padded box margin
+    vars->solve("float", _margin_expr, &_margin);
+    if(_margin < 0.f){
+        std::stringstream msg;
+        msg << "Negative margin in the tool \"" << name()
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid margin");
+    }
+
+    // The cells may be Morton ordered, or hashed, which shall be known by
+    // the interactions kernels as well
+    for(auto def : CalcServer::singleton()->definitions()){
+        if(!def.compare("-DMORTON_CELLS"))
+            _morton = true;
+        if(!def.compare("-DHASHED_CELLS"))
+            _hashed = true;
+    }
+    if(_morton && _hashed){
+        std::stringstream msg;
+        msg << "MORTON_CELLS and HASHED_CELLS cannot be simultaneously used"
+            << " by the tool \"" << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid cells ordering");
+    }
+
     // Setup the kernels
     setupOpenCL();
 
@@ -137,26 +182,58 @@ cl_event LinkList::_execute(const std::vector<cl_event> events_prior)
     std::vector<cl_event> events;
     CalcServer *C = CalcServer::singleton();
 
-    // Reduction steps to find maximum and minimum position
-    _min_pos->execute();
-    _max_pos->execute();
-
-    // We should refresh the events adding the new one (we can just keep the
-    // outdated ones, which are already retained). The new events existence are
-    // granted while we don't set new events to those variables, which would not
-    // gonna happen until we returns the new event herein.
-    // The new event comes from the first dependency (see setup())
     std::copy(events_prior.begin(), events_prior.end(),
               std::back_inserter(events));
-    events.push_back(getDependencies().front()->getEvent());
 
-    // Compute the number of cells, and eventually allocate memory for ihoc
-    nCells();
-    allocate();
+    // With a padded box, the bounds are just computed when the box is built
+    // or the particles have left it
+    if(!_margin || !_box_built || outOfBox()){
+        // Reduction steps to find maximum and minimum position
+        _bounds->execute();
+
+        // We should refresh the events adding the new one (we can just keep
+        // the outdated ones, which are already retained). The new events
+        // existence are granted while we don't set new events to those
+        // variables, which would not gonna happen until we returns the new
+        // event herein.
+        // The new event comes from the first dependency (see setup())
+        events.push_back(getDependencies().front()->getEvent());
+
+        if(_margin)
+            box();
+
+        // Compute the number of cells, and eventually allocate memory for ihoc
+        nCells();
+        allocate();
+    }
 
     // Check the validity of the variables
     setVariables();
 
+    // Reset the out of box flag, unless the previous value is still pending
+    cl_event reset_event = NULL;
+    static const unsigned int zero = 0;
+    if(_margin && !_out_of_box_event){
+        err_code = clEnqueueWriteBuffer(C->command_queue(),
+                                        _out_of_box,
+                                        CL_FALSE,
+                                        0,
+                                        sizeof(unsigned int),
+                                        &zero,
+                                        0,
+                                        NULL,
+                                        &reset_event);
+        if(err_code != CL_SUCCESS) {
+            std::stringstream msg;
+            msg << "Failure resetting the out of box flag in tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        events.push_back(reset_event);
+    }
+
     // Compute the cell of each particle
     cl_uint num_events_in_wait_list = events.size();
     const cl_event *event_wait_list = events.size() ? events.data() : NULL;
@@ -178,6 +255,36 @@ cl_event LinkList::_execute(const std::vector<cl_event> events_prior)
         throw std::runtime_error("OpenCL execution error");
     }
 
+    if(reset_event){
+        err_code = clReleaseEvent(reset_event);
+        if(err_code != CL_SUCCESS) {
+            std::stringstream msg;
+            msg << "Failure releasing the out of box flag event from tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        // Read the flag back, without waiting for it
+        err_code = clEnqueueReadBuffer(C->command_queue(),
+                                       _out_of_box,
+                                       CL_FALSE,
+                                       0,
+                                       sizeof(unsigned int),
+                                       &_out_of_box_flag,
+                                       1,
+                                       &event,
+                                       &_out_of_box_event);
+        if(err_code != CL_SUCCESS) {
+            std::stringstream msg;
+            msg << "Failure reading the out of box flag in tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+    }
+
     getDependencies().front()->setEvent(event);
     getDependencies().back()->setEvent(event);
     err_code = clReleaseEvent(event);
@@ -190,8 +297,12 @@ cl_event LinkList::_execute(const std::vector<cl_event> events_prior)
         throw std::runtime_error("OpenCL execution error");
     }
 
-    // Sort the particles from the cells
-    _sort->execute();
+    // Sort the particles from the cells, unless they are already sorted
+    event_wait = getDependencies().back()->getEvent();
+    if(_incremental && isSorted(event_wait))
+        identity(event_wait);
+    else
+        _sort->execute();
 
     // Now our transactional event is the one coming from sorting algorithm
     // Such a new event can be taken from the last dependency (see setup())
@@ -262,12 +373,52 @@ void LinkList::setupOpenCL()
     std::ostringstream source;
     source << LINKLIST_INC << LINKLIST_SRC;
 
+    // The cells helpers are shared with the interaction kernels
+    std::ostringstream flags;
+    if(C->base_path().compare(""))
+        flags << "-I" << C->base_path() << " ";
+    if(_morton)
+        flags << "-DMORTON_CELLS";
+    else if(_hashed)
+        flags << "-DHASHED_CELLS";
+
     std::vector<cl_kernel> kernels = compile(
         source.str(),
-        {"iHoc", "iCell", "linkList"});
+        {"iHoc", "iCell", "linkList", "isSorted", "identity"},
+        flags.str());
     _ihoc = kernels.at(0);
     _icell = kernels.at(1);
     _ll = kernels.at(2);
+    _is_sorted = kernels.at(3);
+    _identity = kernels.at(4);
+
+    if(_incremental){
+        _unsorted = clCreateBuffer(C->context(),
+                                   CL_MEM_READ_WRITE,
+                                   sizeof(unsigned int),
+                                   NULL,
+                                   &err_code);
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure allocating device memory in the tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL allocation error");
+        }
+        allocatedMemory("unsorted flag", sizeof(unsigned int));
+        err_code = clGetKernelWorkGroupInfo(_identity,
+                                            C->device(),
+                                            CL_KERNEL_WORK_GROUP_SIZE,
+                                            sizeof(size_t),
+                                            &_identity_lws,
+                                            NULL);
+        if(err_code != CL_SUCCESS) {
+            LOG(L_ERROR, "Failure querying the work group size (\"identity\").\n");
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+    }
 
     err_code = clGetKernelWorkGroupInfo(_ihoc,
                                         C->device(),
@@ -331,6 +482,45 @@ void LinkList::setupOpenCL()
         LOG0(L_DEBUG, msg.str());
         throw std::runtime_error("OpenCL error");
     }
+    _out_of_box = clCreateBuffer(C->context(),
+                                 CL_MEM_READ_WRITE,
+                                 sizeof(unsigned int),
+                                 NULL,
+                                 &err_code);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure allocating device memory in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL allocation error");
+    }
+    allocatedMemory("out of box flag", sizeof(unsigned int));
+    // Without padded box the particles are never out of it
+    _box_min.x = -INFINITY; _box_min.y = -INFINITY;
+    _box_max.x = INFINITY;  _box_max.y = INFINITY;
+    #ifdef HAVE_3D
+        _box_min.z = -INFINITY; _box_min.w = 0.f;
+        _box_max.z = INFINITY;  _box_max.w = 0.f;
+    #endif
+    const std::vector<const void*> box_args = {&_out_of_box,
+                                               &_box_min,
+                                               &_box_max};
+    const std::vector<size_t> box_sizes = {sizeof(cl_mem),
+                                           sizeof(vec),
+                                           sizeof(vec)};
+    for(i = 0; i < 3; i++){
+        err_code = clSetKernelArg(_icell, 8 + i, box_sizes[i], box_args[i]);
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure sending the box argument " << 8 + i
+                << " to \"iCell\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+    }
+
     n_radix = *(unsigned int*)vars->get("n_radix")->get();
     _icell_gws = roundUp(n_radix, _icell_lws);
     const char *_icell_vars[8] = {"icell", _input_name.c_str(), "N", "n_radix",
@@ -397,6 +587,252 @@ void LinkList::setupOpenCL()
     }
 }
 
+bool LinkList::isSorted(cl_event event)
+{
+    unsigned int i;
+    cl_int err_code;
+    cl_event check_event;
+    CalcServer *C = CalcServer::singleton();
+    InputOutput::Variables *vars = C->variables();
+
+    unsigned int n_radix = *(unsigned int*)vars->get("n_radix")->get();
+    _identity_gws = roundUp(n_radix, _identity_lws);
+
+    // Reset the flag. The blocking writing is cheap, since the host is anyway
+    // waiting for the result below
+    unsigned int unsorted = 0;
+    err_code = clEnqueueWriteBuffer(C->command_queue(),
+                                    _unsorted,
+                                    CL_TRUE,
+                                    0,
+                                    sizeof(unsigned int),
+                                    &unsorted,
+                                    0,
+                                    NULL,
+                                    NULL);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure resetting the sorting flag in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    const void *args[3] = {vars->get("icell")->get(), &_unsorted, &n_radix};
+    const size_t args_size[3] = {sizeof(cl_mem), sizeof(cl_mem),
+                                 sizeof(unsigned int)};
+    for(i = 0; i < 3; i++){
+        err_code = clSetKernelArg(_is_sorted, i, args_size[i], args[i]);
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure sending the argument " << i
+                << " to \"isSorted\" in the tool \"" << name()
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+    }
+
+    err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                      _is_sorted,
+                                      1,
+                                      NULL,
+                                      &_identity_gws,
+                                      &_identity_lws,
+                                      1,
+                                      &event,
+                                      &check_event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure executing \"isSorted\" from tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    // We have no alternative, we must sync here
+    err_code = clEnqueueReadBuffer(C->command_queue(),
+                                   _unsorted,
+                                   CL_TRUE,
+                                   0,
+                                   sizeof(unsigned int),
+                                   &unsorted,
+                                   1,
+                                   &check_event,
+                                   NULL);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure reading the sorting flag in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    err_code = clReleaseEvent(check_event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure releasing transactional \"isSorted\" event from tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    return !unsorted;
+}
+
+void LinkList::identity(cl_event event)
+{
+    unsigned int i;
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+    InputOutput::Variables *vars = C->variables();
+    InputOutput::Variable *perms[2] = {vars->get("id_sorted"),
+                                       vars->get("id_unsorted")};
+
+    unsigned int n_radix = *(unsigned int*)vars->get("n_radix")->get();
+    const void *args[3] = {perms[0]->get(), perms[1]->get(), &n_radix};
+    const size_t args_size[3] = {sizeof(cl_mem), sizeof(cl_mem),
+                                 sizeof(unsigned int)};
+    for(i = 0; i < 3; i++){
+        err_code = clSetKernelArg(_identity, i, args_size[i], args[i]);
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure sending the argument " << i
+                << " to \"identity\" in the tool \"" << name()
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+    }
+
+    // The permutations may be still in use by other tools
+    std::vector<cl_event> events = {event};
+    for(auto perm : perms){
+        if(perm->getEvent())
+            events.push_back(perm->getEvent());
+    }
+    err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                      _identity,
+                                      1,
+                                      NULL,
+                                      &_identity_gws,
+                                      &_identity_lws,
+                                      events.size(),
+                                      events.data(),
+                                      &event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure executing \"identity\" from tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    perms[0]->setEvent(event);
+    perms[1]->setEvent(event);
+    getDependencies().back()->setEvent(event);
+    err_code = clReleaseEvent(event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure releasing transactional \"identity\" event from tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+}
+
+void LinkList::box()
+{
+    cl_int err_code;
+    vec pos_min, pos_max;
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+
+    pos_min = *(vec*)vars->get("r_min")->get();
+    pos_max = *(vec*)vars->get("r_max")->get();
+
+    // The particles are reported out of the box when they have moved half of
+    // the margin, so the grid is still valid until the box is rebuilt
+    const float warn = 0.5f * _margin;
+    _box_min = pos_min;
+    _box_max = pos_max;
+    _box_min.x -= warn; _box_min.y -= warn;
+    _box_max.x += warn; _box_max.y += warn;
+    pos_min.x -= _margin; pos_min.y -= _margin;
+    pos_max.x += _margin; pos_max.y += _margin;
+    #ifdef HAVE_3D
+        _box_min.z -= warn;
+        _box_max.z += warn;
+        pos_min.z -= _margin;
+        pos_max.z += _margin;
+    #endif
+    vars->get("r_min")->set(&pos_min);
+    vars->get("r_max")->set(&pos_max);
+
+    err_code = clSetKernelArg(_icell, 9, sizeof(vec), &_box_min);
+    if(err_code == CL_SUCCESS)
+        err_code = clSetKernelArg(_icell, 10, sizeof(vec), &_box_max);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure sending the box to \"iCell\" in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+
+    if(_box_built){
+        std::stringstream msg;
+        msg << "Particles have left the padded box of the tool \""
+            << name() << "\", which has been rebuilt." << std::endl;
+        LOG(L_INFO, msg.str());
+    }
+    _box_built = true;
+}
+
+bool LinkList::outOfBox()
+{
+    cl_int err_code, status;
+
+    if(!_out_of_box_event)
+        return false;
+    err_code = clGetEventInfo(_out_of_box_event,
+                              CL_EVENT_COMMAND_EXECUTION_STATUS,
+                              sizeof(cl_int),
+                              &status,
+                              NULL);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure querying the out of box flag event status in tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    if(status != CL_COMPLETE){
+        // Just keep going, the flag will be checked again later
+        return false;
+    }
+
+    err_code = clReleaseEvent(_out_of_box_event);
+    _out_of_box_event = NULL;
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure releasing the out of box flag event in tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    return _out_of_box_flag != 0;
+}
+
 void LinkList::nCells()
 {
     vec pos_min, pos_max;
@@ -420,14 +856,69 @@ void LinkList::nCells()
     #else
         _n_cells.z = 1;
     #endif
-    _n_cells.w = _n_cells.x * _n_cells.y * _n_cells.z;
+    if(_hashed){
+        hashedCells();
+        return;
+    }
+    if(!_morton){
+        _n_cells.w = _n_cells.x * _n_cells.y * _n_cells.z;
+        return;
+    }
+
+    // The Morton indexes are taking all the bits required for each direction
+    unsigned int bits = 0;
+    const unsigned int n[3] = {_n_cells.x, _n_cells.y, _n_cells.z};
+    for(auto n_dir : n){
+        for(unsigned int v = n_dir - 1; v; v >>= 1)
+            bits++;
+    }
+    if(bits > 31){
+        std::stringstream msg;
+        msg << "Too many cells for the Morton ordering in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\t" << bits << " bits are required, but just 31 are available"
+            << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid number of cells");
+    }
+    _n_cells.w = 1u << bits;
+}
+
+void LinkList::hashedCells()
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+    const unsigned int n = *(unsigned int*)vars->get("N")->get();
+
+    // The neighbour cells, up to 2 cells away (see NeighbourList), shall fall
+    // in different buckets, so the buckets shall not be less than such
+    // stencil width along the virtual grid
+    unsigned long long stencil = 1 + _n_cells.x;
+    #ifdef HAVE_3D
+        stencil += (unsigned long long)_n_cells.x * _n_cells.y;
+    #endif
+    stencil = 4 * stencil + 1;
+    unsigned long long n_buckets = std::max(
+        (unsigned long long)_HASHED_CELLS_FACTOR * n, stencil);
+    // The last value is reserved for the particles out of bounds
+    if(n_buckets >= UINT_MAX){
+        std::stringstream msg;
+        msg << "Too many buckets for the hashed cells in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\t" << n_buckets << " buckets are required to traverse "
+            << _n_cells.x << "x" << _n_cells.y << " cells" << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid number of cells");
+    }
+    _n_cells.w = (unsigned int)n_buckets;
 }
 
 void LinkList::allocate()
 {
     uivec4 n_cells;
-    cl_int err_code;
-    cl_event event;
     CalcServer *C = CalcServer::singleton();
     InputOutput::Variables *vars = C->variables();
 
@@ -453,29 +944,21 @@ void LinkList::allocate()
         return;
     }
 
-    // We have no alternative, we must sync here
-    InputOutput::Variable* ihoc_var = vars->get("ihoc");
-    event = ihoc_var->getEvent();
-    clWaitForEvents(1, &event);
-    cl_mem mem = *(cl_mem*)ihoc_var->get();
-    if(mem) clReleaseMemObject(mem); mem = NULL;
-
-    mem = clCreateBuffer(C->context(),
-                         CL_MEM_READ_WRITE,
-                         _n_cells.w * sizeof(unsigned int),
-                         NULL,
-                         &err_code);
-    if(err_code != CL_SUCCESS){
+    // The buffer is just replaced when it has not capacity enough, taking
+    // a larger one from the pool
+    InputOutput::ArrayVariable* ihoc_var =
+        (InputOutput::ArrayVariable*)vars->get("ihoc");
+    try {
+        ihoc_var->resize(_n_cells.w * sizeof(unsigned int));
+    } catch(...) {
         std::stringstream msg;
         msg << "Failure allocating device memory in the tool \"" <<
                name() << "\"." << std::endl;
         LOG(L_ERROR, msg.str());
-        InputOutput::Logger::singleton()->printOpenCLError(err_code);
         throw std::runtime_error("OpenCL allocation error");
     }
 
     vars->get("n_cells")->set(&_n_cells);
-    ihoc_var->set(&mem);
     _ihoc_gws = roundUp(_n_cells.w, _ihoc_lws);
 }
 
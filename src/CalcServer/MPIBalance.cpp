@@ -0,0 +1,209 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Dynamic load balancing of the MPI planes decomposition.
+ * (See Aqua::CalcServer::MPIBalance for details)
+ */
+
+#include <sphPrerequisites.h>
+
+#ifdef HAVE_MPI
+
+#include <mpi.h>
+#include <algorithm>
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <CalcServer.h>
+#include <CalcServer/MPIBalance.h>
+
+namespace Aqua{ namespace CalcServer{
+
+MPIBalance::MPIBalance(const std::string name,
+                       const std::string load,
+                       const std::string shift,
+                       unsigned int period,
+                       float relax,
+                       float min_width,
+                       bool once)
+    : Tool(name, once)
+    , _load(load)
+    , _expr(NULL)
+    , _shift_name(shift)
+    , _shift(NULL)
+    , _iter(NULL)
+    , _period(period)
+    , _relax(relax)
+    , _min_width(min_width)
+    , _mpi_rank(0)
+    , _mpi_size(1)
+{
+}
+
+MPIBalance::~MPIBalance()
+{
+    if(_expr) delete _expr; _expr=NULL;
+}
+
+void MPIBalance::setup()
+{
+    std::ostringstream msg;
+    msg << "Loading the tool \"" << name() << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    Tool::setup();
+
+    if(!_period || (_relax <= 0.f) || (_relax > 1.f)) {
+        std::ostringstream msg;
+        msg << "Invalid period or relaxation factor in the tool \"" << name()
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\tperiod > 0 and 0 < relax <= 1 are required, but period = "
+            << _period << " and relax = " << _relax << " were found."
+            << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid value");
+    }
+
+    try {
+        _mpi_rank = MPI::COMM_WORLD.Get_rank();
+        _mpi_size = MPI::COMM_WORLD.Get_size();
+    } catch(MPI::Exception e){
+        std::ostringstream msg;
+        msg << "Error getting MPI rank and size. " << std::endl
+            << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw;
+    }
+    if((_min_width < 0.f) || (_min_width >= 1.f)) {
+        std::ostringstream msg;
+        msg << "The minimum slab width of the tool \"" << name()
+            << "\" shall be in the interval [0, 1)." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid value");
+    }
+
+    // The planes start at their nominal positions
+    _planes.clear();
+    for(unsigned int k = 0; k <= _mpi_size; k++) {
+        _planes.push_back((float)k);
+    }
+
+    variables();
+    _expr = CalcServer::singleton()->variables()->compile(_load);
+}
+
+cl_event MPIBalance::_execute(const std::vector<cl_event> events)
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+
+    if(*(unsigned int*)_iter->get() % _period)
+        return NULL;
+
+    // Gather the load of all the processes
+    float load;
+    vars->solve("float", _expr, (void*)(&load));
+    std::vector<float> loads(_mpi_size);
+    try {
+        MPI::COMM_WORLD.Allgather(&load, 1, MPI::FLOAT,
+                                  loads.data(), 1, MPI::FLOAT);
+    } catch(MPI::Exception e){
+        std::ostringstream msg;
+        msg << "Error gathering the loads in the tool \"" << name() << "\". "
+            << std::endl
+            << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw;
+    }
+
+    // Move the inner planes towards the most loaded side. The outer planes,
+    // i.e. the domain bounds, are kept fixed
+    std::vector<float> planes(_planes);
+    for(unsigned int k = 1; k < _mpi_size; k++) {
+        const float l0 = loads.at(k - 1), l1 = loads.at(k);
+        if(l0 + l1 <= 0.f)
+            continue;
+        const float f = _relax * (l0 - l1) / (l0 + l1);
+        const float w = (f > 0.f) ? _planes.at(k) - _planes.at(k - 1) :
+                                    _planes.at(k + 1) - _planes.at(k);
+        // Both planes of a slab may move at once, so each one is moving at
+        // most half of the width
+        planes.at(k) -= 0.5f * f * w;
+    }
+    // Keep the minimum slabs width
+    for(unsigned int k = 1; k < _mpi_size; k++) {
+        planes.at(k) = std::max(planes.at(k), planes.at(k - 1) + _min_width);
+    }
+    for(unsigned int k = _mpi_size - 1; k > 0; k--) {
+        planes.at(k) = std::min(planes.at(k), planes.at(k + 1) - _min_width);
+    }
+    _planes = planes;
+
+    vec2 shift;
+    shift.s[0] = _planes.at(_mpi_rank) - _mpi_rank;
+    shift.s[1] = _planes.at(_mpi_rank + 1) - _mpi_rank - 1;
+    _shift->set((void*)(&shift));
+
+    if(!_mpi_rank) {
+        const float l_max = *std::max_element(loads.begin(), loads.end());
+        float l_avg = 0.f;
+        for(auto l : loads)
+            l_avg += l / _mpi_size;
+        std::ostringstream msg;
+        msg << "\"" << name() << "\" load imbalance (max / avg): "
+            << ((l_avg > 0.f) ? l_max / l_avg : 1.f) << std::endl;
+        LOG(L_DEBUG, msg.str());
+    }
+
+    return NULL;
+}
+
+void MPIBalance::variables()
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+
+    if(!vars->get(_shift_name)) {
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking the undeclared variable \"" <<
+            _shift_name << "\"" << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable");
+    }
+    if(vars->get(_shift_name)->type().compare("vec2")) {
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking the variable \"" << _shift_name
+            << "\", which has an invalid type" << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\t\"vec2\" was expected, but \""
+            << vars->get(_shift_name)->type() << "\" was found." << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid variable type");
+    }
+    _shift = vars->get(_shift_name);
+    _iter = (InputOutput::UIntVariable*)vars->get("iter");
+
+    setDependencies({_shift});
+}
+
+}}  // namespaces
+
+#endif
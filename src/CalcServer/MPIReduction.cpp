@@ -0,0 +1,276 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Non-blocking reduction of scalar variables across processes.
+ * (See Aqua::CalcServer::MPIReduction for details)
+ */
+
+#include <sphPrerequisites.h>
+
+#ifdef HAVE_MPI
+
+#include <string.h>
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <CalcServer.h>
+#include <CalcServer/MPIReduction.h>
+#include <CalcServer/MPISync.h>
+
+namespace Aqua{ namespace CalcServer{
+
+MPIReduction::MPIReduction(const std::string name,
+                           const std::string input,
+                           const std::string output,
+                           const std::string operation,
+                           bool once)
+    : Tool(name, once)
+    , _input_name(input)
+    , _output_name(output)
+    , _operation(operation)
+    , _input(NULL)
+    , _output(NULL)
+    , _input_ptr(NULL)
+    , _output_ptr(NULL)
+    , _mpi_type(MPI_DATATYPE_NULL)
+    , _mpi_n(0)
+    , _mpi_op(MPI_SUM)
+    , _comm(MPI_COMM_NULL)
+{
+}
+
+MPIReduction::~MPIReduction()
+{
+    if(_thread.joinable())
+        _thread.join();
+    int finalized = 1;
+    MPI_Finalized(&finalized);
+    if((_comm != MPI_COMM_NULL) && !finalized)
+        MPI_Comm_free(&_comm);
+}
+
+void MPIReduction::setup()
+{
+    std::ostringstream msg;
+    msg << "Loading the tool \"" << name() << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    Tool::setup();
+    variables();
+
+    if(!_operation.compare("min")) {
+        _mpi_op = MPI_MIN;
+    } else if(!_operation.compare("max")) {
+        _mpi_op = MPI_MAX;
+    } else if(!_operation.compare("sum")) {
+        _mpi_op = MPI_SUM;
+    } else {
+        std::stringstream msg;
+        msg << "Unknown operation \"" << _operation << "\" in the tool \""
+            << name() << "\"" << std::endl;
+        LOG(L_ERROR, msg.str());
+        LOG0(L_DEBUG, "\t\"min\", \"max\" or \"sum\" were expected.\n");
+        throw std::runtime_error("Invalid value");
+    }
+
+    const MPISync::Exchanger::MPIType mpi_t =
+        MPISync::Exchanger::typeToMPI(_input->type());
+    if((mpi_t.t == MPI::DATATYPE_NULL) ||
+       (mpi_t.t == MPI::UNSIGNED_SHORT)) {
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" cannot reduce variables of type \"" << _input->type()
+            << "\"" << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable type");
+    }
+    _mpi_type = mpi_t.t;
+    _mpi_n = mpi_t.n;
+
+    _send.resize(_input->typesize());
+    _recv.resize(_input->typesize());
+    _input_ptr = _input->get();
+    _output_ptr = _output->get();
+
+    // Each tool has its own communicator, so the reductions can be carried out
+    // in any order by the auxiliar threads
+    int err_code = MPI_Comm_dup(MPI_COMM_WORLD, &_comm);
+    if(err_code != MPI_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure duplicating the MPI communicator in the tool \""
+            << name() << "\"" << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("MPI error");
+    }
+}
+
+cl_event MPIReduction::_execute(const std::vector<cl_event> events)
+{
+    cl_int err_code;
+    cl_event trigger, user_event;
+    CalcServer *C = CalcServer::singleton();
+
+    // The previous reduction shall be finished, so the reductions are always
+    // carried out in the same order by all the processes
+    if(_thread.joinable())
+        _thread.join();
+
+    err_code = clEnqueueMarkerWithWaitList(C->command_queue(),
+                                           events.size(),
+                                           events.data(),
+                                           &trigger);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure creating the syncing point in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    err_code = clFlush(C->command_queue());
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure flushing the command queue in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    user_event = clCreateUserEvent(C->context(), &err_code);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure creating the user event in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    // The returned event is released by Tool::execute(), so the auxiliar
+    // thread shall keep its own reference
+    err_code = clRetainEvent(user_event);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure retaining the user event in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    _thread = std::thread(&MPIReduction::reduce, this, trigger, user_event);
+
+    return user_event;
+}
+
+void MPIReduction::reduce(cl_event trigger, cl_event user_event)
+{
+    cl_int status = CL_COMPLETE;
+
+    cl_int err_code = clWaitForEvents(1, &trigger);
+    clReleaseEvent(trigger);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure waiting for the input variable in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        status = err_code;
+    }
+    else {
+        // The input variable is already synced. Variable::get() cannot be
+        // used, since the variable is already associated to the user event
+        memcpy(_send.data(), _input_ptr, _send.size());
+        MPI_Request request;
+        int mpi_code = MPI_Iallreduce(_send.data(),
+                                      _recv.data(),
+                                      _mpi_n,
+                                      _mpi_type,
+                                      _mpi_op,
+                                      _comm,
+                                      &request);
+        if(mpi_code == MPI_SUCCESS)
+            mpi_code = MPI_Wait(&request, MPI_STATUS_IGNORE);
+        if(mpi_code != MPI_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure reducing \"" << _input->name()
+                << "\" in the tool \"" << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            status = -1;
+        }
+        else {
+            // The output version was already increased by Variable::setEvent()
+            memcpy(_output_ptr, _recv.data(), _recv.size());
+        }
+    }
+
+    err_code = clSetUserEventStatus(user_event, status);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure completing the user event in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+    }
+    clReleaseEvent(user_event);
+}
+
+void MPIReduction::variables()
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+
+    const std::string names[2] = {_input_name, _output_name};
+    for(auto var_name : names) {
+        if(!vars->get(var_name)) {
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" is asking the undeclared variable \""
+                << var_name << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+        if(vars->get(var_name)->isArray()) {
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" may not use an array variable (\""
+                << var_name << "\")." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable type");
+        }
+    }
+    _input = vars->get(_input_name);
+    _output = vars->get(_output_name);
+    if(_input->type().compare(_output->type())) {
+        std::stringstream msg;
+        msg << "The input and output variables of the tool \"" << name()
+            << "\" have different types." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\t\"" << _input->name() << "\" is of type \""
+            << _input->type() << "\", while \"" << _output->name()
+            << "\" is of type \"" << _output->type() << "\"." << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid variable type");
+    }
+
+    setDependencies(std::vector<InputOutput::Variable*>{_input, _output});
+}
+
+}}  // namespaces
+
+#endif
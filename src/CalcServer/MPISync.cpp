@@ -28,8 +28,12 @@
 
 #ifdef HAVE_MPI
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
+#include <InputOutput/Trace.h>
 #include <CalcServer/MPISync.h>
 #include <CalcServer.h>
 
@@ -42,6 +46,14 @@ namespace Aqua{ namespace CalcServer{
 std::string MPISYNC_INC = xxd2string(MPISync_hcl_in, MPISync_hcl_in_len);
 std::string MPISYNC_SRC = xxd2string(MPISync_cl_in, MPISync_cl_in_len);
 
+/// Time spent waiting in the receivers, in microseconds
+static std::atomic<unsigned long long> mpisync_wait_us(0);
+
+double MPISync::waitTime()
+{
+    return 1.0E-6 * mpisync_wait_us.load();
+}
+
 MPISync::MPISync(const std::string name,
                  const std::string mask,
                  const std::vector<std::string> fields,
@@ -52,11 +64,18 @@ MPISync::MPISync(const std::string name,
     , _mask(NULL)
     , _field_names(fields)
     , _procs(procs)
+    , _elem_size(0)
     , _unsorted_id(NULL)
     , _sorted_id(NULL)
     , _sort(NULL)
     , _n(0)
+    , _send_host(NULL)
+    , _send_mem(NULL)
+    , _mask_reinit(NULL)
     , _n_offset_recv(NULL)
+    , _n_offset_recv_reinit(NULL)
+    , _recv_host(NULL)
+    , _recv_mem(NULL)
 {
     int mpi_rank, mpi_size;
     try {
@@ -78,11 +97,16 @@ MPISync::MPISync(const std::string name,
             _procs.push_back(proc);
         }
     }
-    for(unsigned int i = 0; i < _procs.size(); i++) {
-        if((_procs.at(i) == mpi_rank) || (_procs.at(i) >= mpi_size)) {
-            _procs.erase(_procs.begin() + i);
-        }
-    }
+    std::vector<unsigned int> valid_procs;
+    for(auto proc : _procs) {
+        if((proc == mpi_rank) || (proc >= mpi_size))
+            continue;
+        if(std::find(valid_procs.begin(), valid_procs.end(), proc) !=
+           valid_procs.end())
+            continue;
+        valid_procs.push_back(proc);
+    }
+    _procs = valid_procs;
 }
 
 MPISync::~MPISync()
@@ -102,19 +126,18 @@ MPISync::~MPISync()
         delete sorter;
     }
     // And the senders
-    for(auto field : _fields_send) {
-        free(field);
-    }
+    CalcServer *C = CalcServer::singleton();
     for(auto sender : _senders) {
         delete sender;
     }    
+    if(_send_host) C->releasePinned(_send_host); _send_host=NULL;
+    if(_send_mem) clReleaseMemObject(_send_mem); _send_mem=NULL;
     // And the receivers
-    for(auto field : _fields_recv) {
-        free(field);
-    }
     for(auto receiver : _receivers) {
         delete receiver;
     }    
+    if(_recv_host) C->releasePinned(_recv_host); _recv_host=NULL;
+    if(_recv_mem) clReleaseMemObject(_recv_mem); _recv_mem=NULL;
 }
 
 void MPISync::setup()
@@ -142,6 +165,7 @@ void MPISync::setup()
         setupFieldSort(field);
     }
 
+    setupNeighbours();
     setupSenders();
     setupReceivers();
 }
@@ -256,6 +280,7 @@ void MPISync::variables()
             throw std::runtime_error("Invalid variable length");
         }
         _fields.push_back((InputOutput::ArrayVariable *)vars->get(var_name));
+        _elem_size += InputOutput::Variables::typeToBytes(var->type());
     }
 
     std::vector<InputOutput::Variable*> deps;
@@ -289,6 +314,7 @@ void MPISync::setupSort()
                           _unsorted_id->name(),
                           _sorted_id->name());
     _sort->setup();
+    allocatedMemory("sort", _sort->allocatedMemory());
 }
 
 void MPISync::setupFieldSort(InputOutput::ArrayVariable* field)
@@ -331,32 +357,73 @@ void MPISync::setupFieldSort(InputOutput::ArrayVariable* field)
     _fields_sorted.back()->set((void*)(&inner_mem));
 }
 
+void MPISync::setupNeighbours()
+{
+    int mpi_rank, mpi_size;
+    try {
+        mpi_rank = MPI::COMM_WORLD.Get_rank();
+        mpi_size = MPI::COMM_WORLD.Get_size();
+    } catch(MPI::Exception e){
+        std::ostringstream msg;
+        msg << "Error getting MPI rank and size. " << std::endl
+            << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw;
+    }
+
+    // Gather the processes considered by everyone. A process shall be
+    // receiving from every process which may send it data, so the lists are
+    // made symmetric, i.e. j is a neighbour of i if either i is considering j,
+    // or j is considering i
+    std::vector<char> local(mpi_size, 0), global(mpi_size * mpi_size, 0);
+    for(auto proc : _procs) {
+        local.at(proc) = 1;
+    }
+    try {
+        MPI::COMM_WORLD.Allgather(local.data(), mpi_size, MPI::CHAR,
+                                  global.data(), mpi_size, MPI::CHAR);
+    } catch(MPI::Exception e){
+        std::ostringstream msg;
+        msg << "Error gathering the neighbour processes in the tool \""
+            << name() << "\". " << std::endl
+            << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw;
+    }
+    _procs.clear();
+    for(int proc = 0; proc < mpi_size; proc++) {
+        if(proc == mpi_rank)
+            continue;
+        if(global.at(mpi_rank * mpi_size + proc) ||
+           global.at(proc * mpi_size + mpi_rank))
+            _procs.push_back(proc);
+    }
+
+    std::ostringstream msg;
+    msg << "\t" << _procs.size() << " neighbour processes:";
+    for(auto proc : _procs) {
+        msg << " " << proc;
+    }
+    msg << std::endl;
+    LOG0(L_DEBUG, msg.str());
+}
+
 void MPISync::setupSenders()
 {
     CalcServer *C = CalcServer::singleton();
     InputOutput::Variables *vars = C->variables();
 
-    // Allocate the host memory to download the fields and subsequently send
-    // them
-    for(auto field : _fields) {
-        void *data = malloc(field->size());
-        if(!data) {
-            std::stringstream msg;
-            msg << "Failure allocating \"" << field->size()
-                << "\" bytes for the array \"" << field->name() 
-                << "\" send in the tool \"" << name() << "\"" << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::bad_alloc();
-        }
-        _fields_send.push_back(data);
-    }
+    // Allocate the memory to pack the fields in the device, and the pinned
+    // host memory to download and subsequently send them
+    setupPackMems(&_send_host, &_send_mem, "send");
 
     // Create the senders
     for(auto proc : _procs) {
         Sender* sender = new Sender(name(),
                                     _mask,
                                     _fields_sorted,
-                                    _fields_send,
+                                    _send_host,
+                                    _send_mem,
                                     proc);
         if(!sender) {
             std::stringstream msg;
@@ -405,27 +472,17 @@ void MPISync::setupReceivers()
                            valstr.str());
     _mask_reinit->setup();
     
-    // Allocate the host memory to receive the fields and subsequently upload
-    // them
-    for(auto field : _fields) {
-        void *data = malloc(field->size());
-        if(!data) {
-            std::stringstream msg;
-            msg << "Failure allocating \"" << field->size()
-                << "\" bytes for the array \"" << field->name() 
-                << "\" in the tool \"" << name() << "\"" << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::bad_alloc();
-        }
-        _fields_recv.push_back(data);
-    }
+    // Allocate the pinned host memory to receive and subsequently upload the
+    // packed fields, and the memory to unpack them in the device
+    setupPackMems(&_recv_host, &_recv_mem, "recv");
 
     // Create the receivers
     for(auto proc : _procs) {
         Receiver* receiver = new Receiver(name(),
                                           _mask,
                                           _fields,
-                                          _fields_recv,
+                                          _recv_host,
+                                          _recv_mem,
                                           proc,
                                           _n_offset_recv);
         if(!receiver) {
@@ -440,6 +497,39 @@ void MPISync::setupReceivers()
     }
 }
 
+void MPISync::setupPackMems(void **host, cl_mem *mem, const std::string kind)
+{
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+    const size_t size = _n * _elem_size;
+
+    *host = C->allocatePinned(size);
+    if(!*host) {
+        std::stringstream msg;
+        msg << "Failure allocating \"" << size
+            << "\" bytes for the " << kind << " packed fields in the tool \""
+            << name() << "\"" << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::bad_alloc();
+    }
+    allocatedHostMemory(kind, size);
+
+    *mem = clCreateBuffer(C->context(),
+                          CL_MEM_READ_WRITE,
+                          size,
+                          NULL,
+                          &err_code);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure allocating device memory in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL allocation error");
+    }
+    allocatedMemory(kind, size);
+}
+
 
 
 
@@ -451,16 +541,22 @@ void MPISync::setupReceivers()
 MPISync::Exchanger::Exchanger(const std::string tool_name,
                               InputOutput::ArrayVariable *mask,
                               const std::vector<InputOutput::ArrayVariable*> fields,
-                              const std::vector<void*> field_hosts,
+                              void *host,
+                              cl_mem buffer,
                               const unsigned int proc)
     : _name(tool_name)
     , _mask(mask)
     , _fields(fields)
-    , _fields_host(field_hosts)
     , _proc(proc)
     , _n(0)
+    , _elem_size(0)
+    , _host(host)
+    , _buffer(buffer)
 {
     _n = _mask->size() / InputOutput::Variables::typeToBytes(_mask->type());
+    for(auto field : _fields) {
+        _elem_size += InputOutput::Variables::typeToBytes(field->type());
+    }
 }
 
 MPISync::Exchanger::~Exchanger()
@@ -477,7 +573,13 @@ const MPISync::Exchanger::MPIType MPISync::Exchanger::typeToMPI(std::string t)
     if(t.back() == '*'){
         t.pop_back();
     }
-    if(hasSuffix(t, "vec")) {
+    if(hasSuffix(t, "pvec")) {
+#ifdef HAVE_3D
+        mpi_t.n = 3;
+#else
+        mpi_t.n = 2;
+#endif
+    } else if(hasSuffix(t, "vec")) {
 #ifdef HAVE_3D
         mpi_t.n = 4;
 #else
@@ -498,8 +600,12 @@ const MPISync::Exchanger::MPIType MPISync::Exchanger::typeToMPI(std::string t)
         mpi_t.t = MPI::INT;
     } else if((!t.compare("unsigned int")) || (!t.compare("uivec"))) {
         mpi_t.t = MPI::UNSIGNED;
-    } else if((!t.compare("float")) || (!t.compare("vec"))) {
+    } else if((!t.compare("float")) || (!t.compare("vec")) ||
+               (!t.compare("pvec"))) {
         mpi_t.t = MPI::FLOAT;
+    } else if((!t.compare("half")) || (!t.compare("hvec"))) {
+        // Just the raw bits are exchanged
+        mpi_t.t = MPI::UNSIGNED_SHORT;
     }
 
     return mpi_t;
@@ -516,9 +622,10 @@ const MPISync::Exchanger::MPIType MPISync::Exchanger::typeToMPI(std::string t)
 MPISync::Sender::Sender(const std::string name,
                         InputOutput::ArrayVariable *mask,
                         const std::vector<InputOutput::ArrayVariable*> fields,
-                        const std::vector<void*> field_hosts,
+                        void *host,
+                        cl_mem buffer,
                         const unsigned int proc)
-    : MPISync::Exchanger(name, mask, fields, field_hosts, proc)
+    : MPISync::Exchanger(name, mask, fields, host, buffer, proc)
     , _n_offset(NULL)
     , _n_offset_mask(NULL)
     , _n_offset_kernel(NULL)
@@ -527,6 +634,7 @@ MPISync::Sender::Sender(const std::string name,
     , _n_send_mask(NULL)
     , _n_send_kernel(NULL)
     , _n_send_reduction(NULL)
+    , _request(MPI::REQUEST_NULL)
     , _global_work_size(0)
     , _local_work_size(0)
 {
@@ -547,69 +655,91 @@ MPISync::Sender::~Sender()
 
 typedef struct {
     CalcServer *C;
-    InputOutput::ArrayVariable* field;
+    size_t n_fields;
+    InputOutput::ArrayVariable** fields;
     void* ptr;
+    cl_mem buffer;
+    size_t elem_size;
     unsigned int proc;
     unsigned int *offset;
     unsigned int *n;
-    int tag;
+    MPI::Request *request;
 } MPISyncSendUserData;
 
 void CL_CALLBACK cbMPISend(cl_event n_event,
                            cl_int cmd_exec_status,
                            void *user_data)
 {
+    cl_int err_code;
+    InputOutput::TraceSpan span("mpi", "MPISync send");
     MPISyncSendUserData *data = (MPISyncSendUserData*)user_data;
     unsigned int offset = *(data->offset);
     unsigned int n = *(data->n);
+    cl_command_queue queue = data->C->command_queue(true);
+
+    // Each sender is packing its elements at its own region of the buffers,
+    // given by the offset
+    const size_t region = offset * data->elem_size;
+    const size_t packed = n * data->elem_size;
+    char *ptr = (char*)(data->ptr) + region;
+
+    // The previous message shall be already sent before overwriting the host
+    // memory
+    data->request->Wait();
+
+    if(n) {
+        // Pack the fields in the device. Since the fields are sorted by the
+        // mask, the elements to be sent are contiguous, so the packing is
+        // reduced to a copy per field
+        size_t field_offset = region;
+        for(unsigned int i = 0; i < data->n_fields; i++) {
+            InputOutput::ArrayVariable* field = data->fields[i];
+            const size_t tsize =
+                InputOutput::Variables::typeToBytes(field->type());
+            err_code = clEnqueueCopyBuffer(queue,
+                                           *(cl_mem*)field->get(),
+                                           data->buffer,
+                                           offset * tsize,
+                                           field_offset,
+                                           n * tsize,
+                                           0,
+                                           NULL,
+                                           NULL);
+            if(err_code != CL_SUCCESS){
+                std::ostringstream msg;
+                msg << "Failure packing the variable \""
+                    << field->name() << "\"" << std::endl;
+                LOG(L_ERROR, msg.str());
+                InputOutput::Logger::singleton()->printOpenCLError(err_code);
+                throw std::runtime_error("OpenCL execution error");
+            }
+            field_offset += n * tsize;
+        }
 
-    if(data->tag == 1) {
-        MPI::COMM_WORLD.Isend(&n, 1, MPI::UNSIGNED, data->proc, 0);
-    }
-
-    if(!n) {
-        free(data);
-        return;
-    }
-
-    InputOutput::ArrayVariable* field = data->field;
-    const size_t tsize = InputOutput::Variables::typeToBytes(field->type());
-    void *ptr = (void*)((char*)(data->ptr) + offset * tsize);
-
-    // Download the data
-    cl_int err_code;
-    err_code = clEnqueueReadBuffer(data->C->command_queue(true),
-                                   *(cl_mem*)field->get(),
-                                   CL_TRUE,
-                                   offset * tsize,
-                                   n * tsize,
-                                   ptr,
-                                   0,
-                                   NULL,
-                                   NULL);
-    if(err_code != CL_SUCCESS){
-        std::ostringstream msg;
-        msg << "Failure downloading the variable \""
-            << field->name() << "\"" << std::endl;
-        LOG(L_ERROR, msg.str());
-        InputOutput::Logger::singleton()->printOpenCLError(err_code);
-        throw std::runtime_error("OpenCL execution error");
-    }
-
-    // Select the appropriate datatype (MPI needs its own type decriptor), and
-    // addapt the array length (vectorial types)
-    const MPISync::Exchanger::MPIType mpi_t = 
-        MPISync::Exchanger::typeToMPI(field->type());
-    if(mpi_t.t == MPI::DATATYPE_NULL) {
-        std::ostringstream msg;
-        msg << "Unrecognized type \"" << field->type()
-            << "\" for variable \"" << field->name() << "\"" << std::endl;
-        LOG(L_ERROR, msg.str());
-        throw std::runtime_error("Invalid type");
+        // Download all the packed data at once (the queue is in order)
+        err_code = data->C->readBuffer(queue,
+                                       data->buffer,
+                                       CL_TRUE,
+                                       region,
+                                       packed,
+                                       ptr,
+                                       0,
+                                       NULL,
+                                       NULL);
+        if(err_code != CL_SUCCESS){
+            LOG(L_ERROR, "Failure downloading the packed variables\n");
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
     }
 
-    // Launch the missiles. Again we can proceed in synchronous mode
-    MPI::COMM_WORLD.Isend(ptr, n * mpi_t.n, mpi_t.t, data->proc, data->tag);
+    // Launch the missiles. A single message carries all the fields, and its
+    // length tells the receiver how many elements have been sent
+    *(data->request) = MPI::COMM_WORLD.Isend(ptr,
+                                             packed,
+                                             MPI::BYTE,
+                                             data->proc,
+                                             0);
 
     free(data);
 }
@@ -670,59 +800,58 @@ void MPISync::Sender::execute()
     _n_send_mask->setEvent(event);
     _n_send_reduction->execute();
 
-    for(unsigned int i = 0; i < _fields.size(); i++) {
-        // Setup a events syncing point to can register a callback to send the
-        // fields
-        event_wait_list = {_n_offset->getEvent(),
-                           _n_send->getEvent(),
-                           _fields.at(i)->getEvent()};
-
-        err_code = clEnqueueMarkerWithWaitList(C->command_queue(),
-                                               event_wait_list.size(),
-                                               event_wait_list.data(),
-                                               &event);
-        if(err_code != CL_SUCCESS) {
-            std::stringstream msg;
-            msg << "Failure creating send events syncing point in tool \""
-                << name() << "\" for variable \""
-                << _fields.at(i)->name() << "\"" << std::endl;
-            InputOutput::Logger::singleton()->printOpenCLError(err_code);
-            throw std::runtime_error("OpenCL execution error");
-        }
+    // Setup a events syncing point to can register a callback to pack and
+    // send the fields
+    event_wait_list = {_n_offset->getEvent(), _n_send->getEvent()};
+    for(auto field : _fields) {
+        event_wait_list.push_back(field->getEvent());
+    }
+    err_code = clEnqueueMarkerWithWaitList(C->command_queue(),
+                                           event_wait_list.size(),
+                                           event_wait_list.data(),
+                                           &event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure creating send events syncing point in tool \""
+            << name() << "\"" << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
 
-        // Setup the data to pass to the callback
-        MPISyncSendUserData *user_data = (MPISyncSendUserData*) malloc(
-            sizeof(MPISyncSendUserData));
-        if(!user_data) {
-            std::stringstream msg;
-            msg << "Failure allocating " << sizeof(MPISyncSendUserData)
-                << " bytes for the variable \""
-                << _fields.at(i)->name() << "\" user data" << std::endl;
-            InputOutput::Logger::singleton()->printOpenCLError(err_code);
-            throw std::bad_alloc();
-        }
-        user_data->C = C;
-        user_data->field = _fields.at(i);
-        user_data->ptr = _fields_host.at(i);
-        user_data->proc = _proc;
-        user_data->offset = (unsigned int*)(_n_offset->get_async());
-        user_data->n = (unsigned int*)(_n_send->get_async());
-        user_data->tag = i + 1;
-        
-        // So we can asynchronously ask to dispatch the data send
-        err_code = clSetEventCallback(event,
-                                      CL_COMPLETE,
-                                      &cbMPISend,
-                                      (void*)(user_data));
-        if(err_code != CL_SUCCESS) {
-            std::stringstream msg;
-            msg << "Failure setting the download & send callback for \""
-                << _fields.at(i)->name() << "\" in tool \"" << name() << "\""
-                << std::endl;
-            LOG(L_ERROR, msg.str());
-            InputOutput::Logger::singleton()->printOpenCLError(err_code);
-            throw std::runtime_error("OpenCL execution error");
-        }
+    // Setup the data to pass to the callback
+    MPISyncSendUserData *user_data = (MPISyncSendUserData*) malloc(
+        sizeof(MPISyncSendUserData));
+    if(!user_data) {
+        std::stringstream msg;
+        msg << "Failure allocating " << sizeof(MPISyncSendUserData)
+            << " bytes for the user data" << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::bad_alloc();
+    }
+    user_data->C = C;
+    user_data->n_fields = _fields.size();
+    user_data->fields = _fields.data();
+    user_data->ptr = _host;
+    user_data->buffer = _buffer;
+    user_data->elem_size = _elem_size;
+    user_data->proc = _proc;
+    user_data->offset = (unsigned int*)(_n_offset->get_async());
+    user_data->n = (unsigned int*)(_n_send->get_async());
+    user_data->request = &_request;
+
+    // So we can asynchronously ask to dispatch the data send
+    err_code = clSetEventCallback(event,
+                                  CL_COMPLETE,
+                                  &cbMPISend,
+                                  (void*)(user_data));
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure setting the pack & send callback in tool \""
+            << name() << "\"" << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
     }
 }
 
@@ -895,10 +1024,11 @@ void MPISync::Sender::setupReduction(const std::string var_name)
 MPISync::Receiver::Receiver(const std::string name,
                         InputOutput::ArrayVariable *mask,
                         const std::vector<InputOutput::ArrayVariable*> fields,
-                        const std::vector<void*> field_hosts,
+                        void *host,
+                        cl_mem buffer,
                         const unsigned int proc,
                         InputOutput::UIntVariable *n_offset)
-    : MPISync::Exchanger(name, mask, fields, field_hosts, proc)
+    : MPISync::Exchanger(name, mask, fields, host, buffer, proc)
     , _kernel(NULL)
     , _n_offset(n_offset)
     , _local_work_size(0)
@@ -992,7 +1122,9 @@ typedef struct {
     CalcServer *C;
     size_t n_fields;
     InputOutput::ArrayVariable** fields;
-    void** ptrs;
+    void* ptr;
+    cl_mem buffer;
+    size_t elem_size;
     unsigned int proc;
     InputOutput::UIntVariable *offset;
     // To set the mask
@@ -1011,17 +1143,30 @@ void CL_CALLBACK cbMPIRecv(cl_event n_event,
                            void *user_data)
 {
     cl_int err_code;
+    InputOutput::TraceSpan span("mpi", "MPISync recv");
     cl_event mask_event=NULL, field_event=NULL;
     MPISyncRecvUserData *data = (MPISyncRecvUserData*)user_data;
     unsigned int offset = *(unsigned int*)data->offset->get_async();
-    unsigned int n;
-
-    // We need to receive the number of transmitted elements
-    MPI::COMM_WORLD.Recv(&n, 1, MPI::UNSIGNED, data->proc, 0);
+    cl_command_queue queue = data->C->command_queue(true);
+
+    // The number of transmitted elements is given by the message length
+    MPI::Status status;
+    const auto tic = std::chrono::steady_clock::now();
+    MPI::COMM_WORLD.Probe(data->proc, 0, status);
+    const size_t packed = status.Get_count(MPI::BYTE);
+    unsigned int n = packed / data->elem_size;
+
+    // Each receiver is unpacking its elements from its own region of the
+    // buffers, given by the offset
+    const size_t region = offset * data->elem_size;
+    char *ptr = (char*)(data->ptr) + region;
+    MPI::COMM_WORLD.Recv(ptr, packed, MPI::BYTE, data->proc, 0);
+    mpisync_wait_us += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - tic).count();
 
     // So we can set the offset for the next receivers
     unsigned int next_offset = offset + n;
-    data->offset->set_async((void*)(&offset));
+    data->offset->set_async((void*)(&next_offset));
     err_code = clSetUserEventStatus(data->offset_event, CL_COMPLETE);
     if(err_code != CL_SUCCESS){
         std::stringstream msg;
@@ -1123,44 +1268,46 @@ void CL_CALLBACK cbMPIRecv(cl_event n_event,
     // Synchronize the mask writing event with the locking one
     sync_user_event(data->mask_event, mask_event);
 
+    // Upload all the packed data at once
+    err_code = data->C->writeBuffer(queue,
+                                    data->buffer,
+                                    CL_FALSE,
+                                    region,
+                                    packed,
+                                    ptr,
+                                    0,
+                                    NULL,
+                                    NULL);
+    if(err_code != CL_SUCCESS){
+        LOG(L_ERROR, "Failure uploading the packed variables\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    // And unpack it in the device (the queue is in order)
+    size_t field_offset = region;
     for(unsigned int i = 0; i < data->n_fields; i++) {
         InputOutput::ArrayVariable* field = data->fields[i];
         const size_t tsize = InputOutput::Variables::typeToBytes(field->type());
-        void *ptr = (void*)((char*)(data->ptrs[i]) + offset * tsize);
-
-        // Select the appropriate datatype (MPI needs its own type decriptor), and
-        // addapt the array length (vectorial types)
-        const MPISync::Exchanger::MPIType mpi_t = 
-            MPISync::Exchanger::typeToMPI(field->type());
-        if(mpi_t.t == MPI::DATATYPE_NULL) {
-            std::ostringstream msg;
-            msg << "Unrecognized type \"" << field->type()
-                << "\" for variable \"" << field->name() << "\"" << std::endl;
-            LOG(L_ERROR, msg.str());
-            return;
-        }
-
-        // Get the data in synchronous mode
-        MPI::COMM_WORLD.Recv(ptr, n * mpi_t.n, mpi_t.t, data->proc, i + 1);
-        // But upload it in asynchronous mode
-        err_code = clEnqueueWriteBuffer(data->C->command_queue(true),
-                                        *(cl_mem*)field->get(),
-                                        CL_FALSE,
-                                        offset * tsize,
-                                        n * tsize,
-                                        ptr,
-                                        0,
-                                        NULL,
-                                        &field_event);
+        err_code = clEnqueueCopyBuffer(queue,
+                                       data->buffer,
+                                       *(cl_mem*)field->get(),
+                                       field_offset,
+                                       offset * tsize,
+                                       n * tsize,
+                                       0,
+                                       NULL,
+                                       &field_event);
         if(err_code != CL_SUCCESS){
             std::ostringstream msg;
-            msg << "Failure uploading the variable \""
+            msg << "Failure unpacking the variable \""
                 << field->name() << "\"" << std::endl;
             LOG(L_ERROR, msg.str());
             InputOutput::Logger::singleton()->printOpenCLError(err_code);
             throw std::runtime_error("OpenCL execution error");
         }
         sync_user_event(data->field_events[i], field_event);
+        field_offset += n * tsize;
     }
     free(data->field_events);
     free(data);
@@ -1215,7 +1362,9 @@ void MPISync::Receiver::execute()
     user_data->C = C;
     user_data->n_fields = _fields.size();
     user_data->fields = _fields.data();
-    user_data->ptrs = _fields_host.data();
+    user_data->ptr = _host;
+    user_data->buffer = _buffer;
+    user_data->elem_size = _elem_size;
     user_data->proc = _proc;
     user_data->offset = _n_offset;
     user_data->mask = _mask;
@@ -0,0 +1,526 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Verlet neighbours list.
+ * (See Aqua::CalcServer::NeighbourList for details)
+ * @note Hardcoded versions of the files CalcServer/NeighbourList.cl.in and
+ * CalcServer/NeighbourList.hcl.in are internally included as a text array.
+ */
+
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <CalcServer.h>
+#include <CalcServer/NeighbourList.h>
+
+namespace Aqua{ namespace CalcServer{
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#include "CalcServer/NeighbourList.hcl"
+#include "CalcServer/NeighbourList.cl"
+#endif
+std::string NEIGHBOURLIST_INC = xxd2string(NeighbourList_hcl_in,
+                                           NeighbourList_hcl_in_len);
+std::string NEIGHBOURLIST_SRC = xxd2string(NeighbourList_cl_in,
+                                           NeighbourList_cl_in_len);
+
+
+NeighbourList::NeighbourList(const std::string tool_name,
+                             const std::string input,
+                             const std::string skin,
+                             unsigned int max_neighs,
+                             bool once)
+    : Tool(tool_name, once)
+    , _input_name(input)
+    , _skin_expr(skin)
+    , _skin(0.f)
+    , _support(0.f)
+    , _max_neighs(max_neighs)
+    , _n(0)
+    , _built(false)
+    , _r(NULL)
+    , _n_neighs(NULL)
+    , _neighs(NULL)
+    , _n_neighs_in(NULL)
+    , _neighs_in(NULL)
+    , _r0(NULL)
+    , _r0_in(NULL)
+    , _flag(NULL)
+    , _build(NULL)
+    , _remap(NULL)
+    , _displacement(NULL)
+    , _lws(0)
+    , _gws(0)
+{
+}
+
+NeighbourList::~NeighbourList()
+{
+    if(_n_neighs_in) clReleaseMemObject(_n_neighs_in); _n_neighs_in=NULL;
+    if(_neighs_in) clReleaseMemObject(_neighs_in); _neighs_in=NULL;
+    if(_r0) clReleaseMemObject(_r0); _r0=NULL;
+    if(_r0_in) clReleaseMemObject(_r0_in); _r0_in=NULL;
+    if(_flag) clReleaseMemObject(_flag); _flag=NULL;
+    if(_build) clReleaseKernel(_build); _build=NULL;
+    if(_remap) clReleaseKernel(_remap); _remap=NULL;
+    if(_displacement) clReleaseKernel(_displacement); _displacement=NULL;
+}
+
+void NeighbourList::setup()
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+
+    std::ostringstream msg;
+    msg << "Loading the tool \"" << name() << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    Tool::setup();
+
+    // Compute the interaction and skin distances
+    _support = *(float*)vars->get("support")->get() *
+               *(float*)vars->get("h")->get();
+    vars->solve("float", _skin_expr, &_skin, "neighs_skin");
+    if((_skin < 0.f) || (_skin >= _support)){
+        std::stringstream msg;
+        msg << "Invalid skin distance in the tool \"" << name()
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\tThe skin distance should be in the range [0, "
+            << _support << "), but " << _skin << " was found" << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid skin distance");
+    }
+    if(!_max_neighs){
+        std::stringstream msg;
+        msg << "Zero maximum number of neighbours in the tool \"" << name()
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid number of neighbours");
+    }
+
+    variables();
+    setupOpenCL();
+
+    std::vector<std::string> deps = {_input_name, "icell", "ihoc",
+                                     "id_sorted", "id_unsorted",
+                                     "n_neighs", "neighs"};
+    setDependencies(deps);
+}
+
+cl_event NeighbourList::_execute(const std::vector<cl_event> events)
+{
+    cl_int err_code;
+    cl_event event;
+
+    if(!_built){
+        _built = true;
+        return build(events);
+    }
+
+    // Follow the particles to their new sorted position, and check whether
+    // the list is still valid
+    event = remap(events);
+    if(!displaced(event))
+        return event;
+
+    std::vector<cl_event> build_events = {event};
+    cl_event build_event = build(build_events);
+    err_code = clReleaseEvent(event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure releasing transactional \"remap\" event from tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    return build_event;
+}
+
+void NeighbourList::variables()
+{
+    CalcServer *C = CalcServer::singleton();
+    InputOutput::Variables *vars = C->variables();
+    cl_int err_code;
+
+    const char *required[7] = {"N", "icell", "ihoc", "n_cells",
+                               "id_sorted", "id_unsorted",
+                               _input_name.c_str()};
+    for(auto var_name : required){
+        if(!vars->get(var_name)){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" is asking the undeclared variable \""
+                << var_name << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+    }
+    if(!vars->get(_input_name)->isArray()){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" may not use a scalar variable (\""
+            << _input_name << "\")." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable type");
+    }
+    _r = (InputOutput::ArrayVariable*)vars->get(_input_name);
+    _n = *(unsigned int*)vars->get("N")->get();
+
+    // Register the neighbours list arrays
+    std::ostringstream valstr;
+    if(!vars->get("n_neighs")){
+        valstr << _n;
+        vars->registerVariable("n_neighs", "unsigned int*", valstr.str(), "");
+    }
+    if(!vars->get("neighs")){
+        valstr.str("");
+        valstr << _n * _max_neighs;
+        vars->registerVariable("neighs", "unsigned int*", valstr.str(), "");
+    }
+    _n_neighs = (InputOutput::ArrayVariable*)vars->get("n_neighs");
+    _neighs = (InputOutput::ArrayVariable*)vars->get("neighs");
+    if((_n_neighs->size() < _n * sizeof(unsigned int)) ||
+       (_neighs->size() < _n * _max_neighs * sizeof(unsigned int))){
+        std::stringstream msg;
+        msg << "Too short neighbours list arrays in the tool \"" << name()
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\t\"n_neighs\" should have length N, and \"neighs\" length "
+            << "N * " << _max_neighs << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid variable length");
+    }
+
+    // The spare arrays to remap the list
+    const size_t vec_size = InputOutput::Variables::typeToBytes("vec");
+    cl_mem *mems[5] = {&_n_neighs_in, &_neighs_in, &_r0, &_r0_in, &_flag};
+    const char *names[5] = {"n_neighs spare", "neighs spare", "r0",
+                            "r0 spare", "flag"};
+    const size_t sizes[5] = {_n_neighs->size(),
+                             _neighs->size(),
+                             _n * vec_size,
+                             _n * vec_size,
+                             sizeof(unsigned int)};
+    for(unsigned int i = 0; i < 5; i++){
+        *mems[i] = clCreateBuffer(C->context(),
+                                  CL_MEM_READ_WRITE,
+                                  sizes[i],
+                                  NULL,
+                                  &err_code);
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure allocating device memory in the tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL allocation error");
+        }
+        allocatedMemory(names[i], sizes[i]);
+    }
+}
+
+void NeighbourList::setupOpenCL()
+{
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    // The cells may be Morton ordered, or hashed (see LinkList), with the
+    // helpers shared with the interaction kernels
+    std::string flags = "";
+    if(C->base_path().compare(""))
+        flags = "-I" + C->base_path() + " ";
+    for(auto def : C->definitions()){
+        if(!def.compare("-DMORTON_CELLS") || !def.compare("-DHASHED_CELLS"))
+            flags += def;
+    }
+
+    std::ostringstream source;
+    source << NEIGHBOURLIST_INC << NEIGHBOURLIST_SRC;
+    std::vector<cl_kernel> kernels = compile(
+        source.str(),
+        {"build", "remap", "displacement"},
+        flags);
+    _build = kernels.at(0);
+    _remap = kernels.at(1);
+    _displacement = kernels.at(2);
+
+    err_code = clGetKernelWorkGroupInfo(_build,
+                                        C->device(),
+                                        CL_KERNEL_WORK_GROUP_SIZE,
+                                        sizeof(size_t),
+                                        &_lws,
+                                        NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Failure querying the work group size (\"build\").\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    if(_lws < __CL_MIN_LOCALSIZE__){
+        LOG(L_ERROR, "insufficient local memory for \"build\".\n");
+        std::stringstream msg;
+        msg << "\t" << _lws
+            << " local work group size with __CL_MIN_LOCALSIZE__="
+            << __CL_MIN_LOCALSIZE__ << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("OpenCL error");
+    }
+    _gws = roundUp(_n, _lws);
+}
+
+cl_event NeighbourList::build(const std::vector<cl_event> events)
+{
+    cl_int err_code;
+    cl_event event;
+    CalcServer *C = CalcServer::singleton();
+    InputOutput::Variables *vars = C->variables();
+
+    resetFlag();
+
+    // The skin distance may reach particles beyond the neighbour cells
+    const float radius = _support + _skin;
+    const int n_range = _skin > 0.f ? 2 : 1;
+    uivec4 n_cells = *(uivec4*)vars->get("n_cells")->get();
+    setArgs(_build,
+            "build",
+            {sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem),
+             sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem),
+             sizeof(unsigned int), sizeof(uivec4), sizeof(float),
+             sizeof(int), sizeof(unsigned int)},
+            {vars->get("icell")->get(), vars->get("ihoc")->get(), _r->get(),
+             _n_neighs->get(), _neighs->get(), &_r0, &_flag,
+             &_n, &n_cells, &radius,
+             &n_range, &_max_neighs});
+
+    cl_uint num_events_in_wait_list = events.size();
+    const cl_event *event_wait_list = events.size() ? events.data() : NULL;
+    err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                      _build,
+                                      1,
+                                      NULL,
+                                      &_gws,
+                                      &_lws,
+                                      num_events_in_wait_list,
+                                      event_wait_list,
+                                      &event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure executing \"build\" from tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    // The list is rarely built, so we can afford checking it
+    if(readFlag(event)){
+        std::stringstream msg;
+        msg << "Too many neighbours in the tool \"" << name()
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\tSome particles have more than " << _max_neighs
+            << " neighbours. Increase \"max_neighs\"" << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Neighbours list overflow");
+    }
+
+    std::stringstream msg;
+    msg << "Neighbours list built by the tool \"" << name()
+        << "\"." << std::endl;
+    LOG(L_DEBUG, msg.str());
+
+    return event;
+}
+
+cl_event NeighbourList::remap(const std::vector<cl_event> events)
+{
+    cl_int err_code;
+    cl_event event;
+    CalcServer *C = CalcServer::singleton();
+    InputOutput::Variables *vars = C->variables();
+
+    setArgs(_remap,
+            "remap",
+            {sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem),
+             sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem),
+             sizeof(unsigned int)},
+            {vars->get("id_sorted")->get(), vars->get("id_unsorted")->get(),
+             _n_neighs->get(), _neighs->get(), &_r0,
+             &_n_neighs_in, &_neighs_in, &_r0_in,
+             &_n});
+
+    cl_uint num_events_in_wait_list = events.size();
+    const cl_event *event_wait_list = events.size() ? events.data() : NULL;
+    err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                      _remap,
+                                      1,
+                                      NULL,
+                                      &_gws,
+                                      &_lws,
+                                      num_events_in_wait_list,
+                                      event_wait_list,
+                                      &event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure executing \"remap\" from tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    // Swap the arrays, so the variables are pointing to the remapped ones.
+    // The old arrays can be overwritten in the next time step, since all the
+    // tools are waiting for the events of the variables
+    cl_mem mem;
+    mem = *(cl_mem*)_n_neighs->get();
+    _n_neighs->set(&_n_neighs_in);
+    _n_neighs_in = mem;
+    mem = *(cl_mem*)_neighs->get();
+    _neighs->set(&_neighs_in);
+    _neighs_in = mem;
+    mem = _r0;
+    _r0 = _r0_in;
+    _r0_in = mem;
+
+    return event;
+}
+
+bool NeighbourList::displaced(cl_event event)
+{
+    cl_int err_code;
+    cl_event check_event;
+    CalcServer *C = CalcServer::singleton();
+
+    resetFlag();
+
+    const float max_disp = 0.5f * _skin;
+    setArgs(_displacement,
+            "displacement",
+            {sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem),
+             sizeof(unsigned int), sizeof(float)},
+            {_r->get(), &_r0, &_flag, &_n, &max_disp});
+
+    err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                      _displacement,
+                                      1,
+                                      NULL,
+                                      &_gws,
+                                      &_lws,
+                                      1,
+                                      &event,
+                                      &check_event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure executing \"displacement\" from tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    const bool rebuild = readFlag(check_event) != 0;
+    err_code = clReleaseEvent(check_event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure releasing transactional \"displacement\" event from tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    return rebuild;
+}
+
+void NeighbourList::resetFlag()
+{
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    // The blocking writing is cheap, since the host is anyway waiting for the
+    // flag afterwards
+    unsigned int flag = 0;
+    err_code = clEnqueueWriteBuffer(C->command_queue(),
+                                    _flag,
+                                    CL_TRUE,
+                                    0,
+                                    sizeof(unsigned int),
+                                    &flag,
+                                    0,
+                                    NULL,
+                                    NULL);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure resetting the flag in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+}
+
+unsigned int NeighbourList::readFlag(cl_event event)
+{
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    unsigned int flag = 0;
+    err_code = clEnqueueReadBuffer(C->command_queue(),
+                                   _flag,
+                                   CL_TRUE,
+                                   0,
+                                   sizeof(unsigned int),
+                                   &flag,
+                                   1,
+                                   &event,
+                                   NULL);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure reading the flag in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    return flag;
+}
+
+void NeighbourList::setArgs(cl_kernel kernel,
+                            const std::string kernel_name,
+                            const std::vector<size_t> sizes,
+                            const std::vector<const void*> values)
+{
+    cl_int err_code;
+    for(unsigned int i = 0; i < sizes.size(); i++){
+        err_code = clSetKernelArg(kernel, i, sizes.at(i), values.at(i));
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure sending the argument " << i << " to \""
+                << kernel_name << "\" in the tool \"" << name()
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+    }
+}
+
+}}  // namespace
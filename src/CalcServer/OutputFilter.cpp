@@ -0,0 +1,543 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Selection of the particles to be saved.
+ * (See Aqua::CalcServer::OutputFilter for details)
+ * @note Hardcoded versions of the files CalcServer/OutputFilter.cl.in and
+ * CalcServer/OutputFilter.hcl.in are internally included as a text array.
+ */
+
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <CalcServer/OutputFilter.h>
+#include <CalcServer/UnSort.h>
+#include <CalcServer.h>
+
+#ifndef OUTPUT_FILTER_LOCAL_SIZE
+    /// Preferred work group size of the selection kernels
+    #define OUTPUT_FILTER_LOCAL_SIZE 256
+#endif
+
+namespace Aqua{ namespace CalcServer{
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#include "CalcServer/OutputFilter.hcl"
+#include "CalcServer/OutputFilter.cl"
+#endif
+std::string OUTPUTFILTER_INC = xxd2string(OutputFilter_hcl_in,
+                                          OutputFilter_hcl_in_len);
+std::string OUTPUTFILTER_SRC = xxd2string(OutputFilter_cl_in,
+                                          OutputFilter_cl_in_len);
+
+OutputFilter::OutputFilter(const std::string name,
+                           unsigned int first,
+                           unsigned int n,
+                           unsigned int stride,
+                           const std::string box_min,
+                           const std::string box_max,
+                           const std::string select_name,
+                           const std::string select_min,
+                           const std::string select_max)
+    : Tool(name, false)
+    , _first(first)
+    , _n(n)
+    , _stride(stride ? stride : 1)
+    , _box_min_expr(box_min)
+    , _box_max_expr(box_max)
+    , _select_name(select_name)
+    , _select_min_expr(select_min)
+    , _select_max_expr(select_max)
+    , _select_min(-INFINITY)
+    , _select_max(INFINITY)
+    , _n_selected(0)
+    , _counts(NULL)
+    , _offsets(NULL)
+    , _ids(NULL)
+    , _scratch{NULL, NULL}
+    , _scratch_size{0, 0}
+    , _scratch_id(0)
+    , _event(NULL)
+    , _scratch_event{NULL, NULL}
+    , _count(NULL)
+    , _compact(NULL)
+    , _gather(NULL)
+    , _local_work_size(0)
+    , _global_work_size(0)
+    , _n_groups(0)
+{
+}
+
+OutputFilter::~OutputFilter()
+{
+    if(_event) clReleaseEvent(_event); _event=NULL;
+    if(_counts) clReleaseMemObject(_counts); _counts=NULL;
+    if(_offsets) clReleaseMemObject(_offsets); _offsets=NULL;
+    if(_ids) clReleaseMemObject(_ids); _ids=NULL;
+    for(unsigned int i = 0; i < 2; i++){
+        if(_scratch_event[i]) clReleaseEvent(_scratch_event[i]);
+        _scratch_event[i] = NULL;
+        if(_scratch[i]) clReleaseMemObject(_scratch[i]);
+        _scratch[i] = NULL;
+    }
+    if(_count) clReleaseKernel(_count); _count=NULL;
+    if(_compact) clReleaseKernel(_compact); _compact=NULL;
+    if(_gather) clReleaseKernel(_gather); _gather=NULL;
+}
+
+void OutputFilter::setup()
+{
+    std::ostringstream msg;
+    msg << "Loading the output filter \"" << name() << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    Tool::setup();
+    variables();
+    setupOpenCL();
+    setupMem();
+}
+
+cl_event OutputFilter::_execute(const std::vector<cl_event> events)
+{
+    unsigned int i;
+    cl_int err_code;
+    cl_event event;
+    CalcServer *C = CalcServer::singleton();
+
+    // Get the unsorted data to select the particles
+    std::vector<cl_event> wait_events;
+    std::vector<std::string> names = {"r"};
+    if(!_select_name.empty())
+        names.push_back(_select_name);
+    std::vector<UnSort*> unsorters = C->getUnsorters(names, _first, _n);
+    if(!unsorters.size())
+        throw std::runtime_error("Failure unsorting the selection fields");
+    UnSort *r = unsorters.front();
+    for(auto unsorter : unsorters)
+        wait_events.push_back(unsorter->input()->getEvent());
+    cl_mem sel = unsorters.back()->output();
+    // The indexes shall not be overwritten while the previous downloads are
+    // still gathering the data
+    for(i = 0; i < 2; i++){
+        if(_scratch_event[i])
+            wait_events.push_back(_scratch_event[i]);
+    }
+
+    // Count the selected particles in each work group
+    setSelectionArgs(_count, r->output(), sel);
+    err_code = clSetKernelArg(_count, 2, sizeof(cl_mem), (void*)&_counts);
+    if(err_code != CL_SUCCESS){
+        LOG(L_ERROR, "Failure sending the counts argument\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                      _count,
+                                      1,
+                                      NULL,
+                                      &_global_work_size,
+                                      &_local_work_size,
+                                      wait_events.size(),
+                                      wait_events.data(),
+                                      &event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure executing \"count\" in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    // Compute the work groups offsets in the host, which is cheap since just
+    // a counter per work group is transferred
+    err_code = C->readBuffer(C->command_queue(),
+                             _counts,
+                             CL_TRUE,
+                             0,
+                             _n_groups * sizeof(unsigned int),
+                             _host_counts.data(),
+                             1,
+                             &event,
+                             NULL);
+    clReleaseEvent(event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure reading the counts in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    _n_selected = 0;
+    for(i = 0; i < _n_groups; i++){
+        const unsigned int count = _host_counts.at(i);
+        _host_counts.at(i) = _n_selected;
+        _n_selected += count;
+    }
+    err_code = C->writeBuffer(C->command_queue(),
+                              _offsets,
+                              CL_TRUE,
+                              0,
+                              _n_groups * sizeof(unsigned int),
+                              _host_counts.data(),
+                              0,
+                              NULL,
+                              NULL);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure sending the offsets in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    // Compact the indexes of the selected particles
+    setSelectionArgs(_compact, r->output(), sel);
+    err_code = clSetKernelArg(_compact, 2, sizeof(cl_mem), (void*)&_offsets);
+    if(err_code != CL_SUCCESS){
+        LOG(L_ERROR, "Failure sending the offsets argument\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    err_code = clSetKernelArg(_compact, 3, sizeof(cl_mem), (void*)&_ids);
+    if(err_code != CL_SUCCESS){
+        LOG(L_ERROR, "Failure sending the indexes argument\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                      _compact,
+                                      1,
+                                      NULL,
+                                      &_global_work_size,
+                                      &_local_work_size,
+                                      wait_events.size(),
+                                      wait_events.data(),
+                                      &event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure executing \"compact\" in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    // Keep the event, to be waited by the downloads
+    if(_event) clReleaseEvent(_event);
+    _event = event;
+    err_code = clRetainEvent(_event);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure retaining the event in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    return event;
+}
+
+cl_event OutputFilter::download(const std::string var_name, void *ptr)
+{
+    cl_int err_code;
+    cl_event event, gather_event;
+    CalcServer *C = CalcServer::singleton();
+
+    std::vector<UnSort*> unsorters = C->getUnsorters({var_name}, _first, _n);
+    if(!unsorters.size())
+        return NULL;
+    UnSort *unsorter = unsorters.front();
+    const size_t typesize = InputOutput::Variables::typeToBytes(
+        unsorter->input()->type());
+    if(!_n_selected)
+        return NULL;
+
+    // Alternate the staging buffers, growing them if required
+    const unsigned int id = _scratch_id;
+    _scratch_id = (_scratch_id + 1) % 2;
+    if(typesize * _n_selected > _scratch_size[id]){
+        if(_scratch_event[id]){
+            clWaitForEvents(1, &_scratch_event[id]);
+            clReleaseEvent(_scratch_event[id]);
+            _scratch_event[id] = NULL;
+        }
+        if(_scratch[id]) clReleaseMemObject(_scratch[id]);
+        _scratch_size[id] = typesize * _n;
+        _scratch[id] = clCreateBuffer(C->context(),
+                                      C->memFlags(),
+                                      _scratch_size[id],
+                                      NULL,
+                                      &err_code);
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure allocating device memory in the tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            _scratch[id] = NULL;
+            _scratch_size[id] = 0;
+            return NULL;
+        }
+        allocatedMemory(id ? "scratch1" : "scratch0", _scratch_size[id]);
+    }
+
+    // Gather the selected components. The previous download from the
+    // staging buffer shall be finished
+    cl_mem input = unsorter->output();
+    const unsigned int words = typesize / sizeof(cl_ushort);
+    const std::vector<size_t> sizes = {sizeof(cl_mem),
+                                       sizeof(cl_mem),
+                                       sizeof(cl_mem),
+                                       sizeof(unsigned int),
+                                       sizeof(unsigned int)};
+    const std::vector<const void*> values = {&input,
+                                             &_scratch[id],
+                                             &_ids,
+                                             &_n_selected,
+                                             &words};
+    for(unsigned int i = 0; i < sizes.size(); i++){
+        err_code = clSetKernelArg(_gather, i, sizes.at(i), values.at(i));
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure sending the argument " << i << " to \"gather\""
+                << " in the tool \"" << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            return NULL;
+        }
+    }
+    std::vector<cl_event> wait_events = {_event, unsorter->input()->getEvent()};
+    if(_scratch_event[id])
+        wait_events.push_back(_scratch_event[id]);
+    const size_t gws = roundUp(_n_selected * words, _local_work_size);
+    err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                      _gather,
+                                      1,
+                                      NULL,
+                                      &gws,
+                                      &_local_work_size,
+                                      wait_events.size(),
+                                      wait_events.data(),
+                                      &gather_event);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure executing \"gather\" in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        return NULL;
+    }
+    unsorter->addReader(gather_event);
+
+    err_code = C->readBuffer(C->command_queue(),
+                             _scratch[id],
+                             CL_FALSE,
+                             0,
+                             typesize * _n_selected,
+                             ptr,
+                             1,
+                             &gather_event,
+                             &event);
+    clReleaseEvent(gather_event);
+    if(err_code != CL_SUCCESS){
+        std::ostringstream msg;
+        msg << "Failure receiving the variable \"" << var_name
+            << "\" from server." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        return NULL;
+    }
+
+    if(_scratch_event[id]) clReleaseEvent(_scratch_event[id]);
+    _scratch_event[id] = event;
+    clRetainEvent(_scratch_event[id]);
+    return event;
+}
+
+void OutputFilter::variables()
+{
+    CalcServer *C = CalcServer::singleton();
+    InputOutput::Variables *vars = C->variables();
+
+    if(!_select_name.empty()){
+        InputOutput::Variable *var = vars->get(_select_name);
+        if(!var ||
+           !var->isArray() ||
+           (InputOutput::Variables::typeToN(var->type()) != 1) ||
+           InputOutput::Variables::isHalfType(var->type())){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" cannot select the particles by \"" << _select_name
+                << "\", which is not a scalar array." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+        vars->solve("float", _select_min_expr, &_select_min);
+        vars->solve("float", _select_max_expr, &_select_max);
+    }
+    if(!_box_min_expr.empty()){
+        vars->solve("vec", _box_min_expr, &_box_min);
+        vars->solve("vec", _box_max_expr, &_box_max);
+    }
+
+    setDependencies(std::vector<InputOutput::Variable*>());
+}
+
+void OutputFilter::setupMem()
+{
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    _n_groups = _global_work_size / _local_work_size;
+    _host_counts.resize(_n_groups);
+
+    cl_mem *mems[3] = {&_counts, &_offsets, &_ids};
+    const std::string names[3] = {"counts", "offsets", "ids"};
+    const size_t sizes[3] = {_n_groups * sizeof(unsigned int),
+                             _n_groups * sizeof(unsigned int),
+                             _n * sizeof(unsigned int)};
+    for(unsigned int i = 0; i < 3; i++){
+        *mems[i] = clCreateBuffer(C->context(),
+                                  CL_MEM_READ_WRITE,
+                                  sizes[i],
+                                  NULL,
+                                  &err_code);
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure allocating device memory in the tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL allocation error");
+        }
+        allocatedMemory(names[i], sizes[i]);
+    }
+}
+
+void OutputFilter::setupOpenCL()
+{
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+    InputOutput::Variables *vars = C->variables();
+
+    // The scans are carried out in local memory, with a power of two work
+    // group size
+    size_t max_local_size;
+    err_code = clGetDeviceInfo(C->device(),
+                               CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                               sizeof(size_t),
+                               &max_local_size,
+                               NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Failure querying the maximum work group size.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    _local_work_size = OUTPUT_FILTER_LOCAL_SIZE;
+    while(_local_work_size > max_local_size)
+        _local_work_size /= 2;
+
+    std::ostringstream flags;
+    flags << "-DLOCAL_WORK_SIZE=" << _local_work_size << "u";
+    if(!_box_min_expr.empty())
+        flags << " -DHAVE_BOX";
+    if(!_select_name.empty()){
+        std::string t = trimCopy(vars->get(_select_name)->type());
+        t.pop_back();  // Remove the asterisk
+        if(!t.compare("unsigned int"))
+            t = "uint";
+        flags << " -DHAVE_SELECT -DT_SEL=" << t;
+    }
+
+    std::ostringstream source;
+    source << OUTPUTFILTER_INC << OUTPUTFILTER_SRC;
+    std::vector<cl_kernel> kernels = compile(source.str(),
+                                             {"count", "compact", "gather"},
+                                             flags.str());
+    _count = kernels.at(0);
+    _compact = kernels.at(1);
+    _gather = kernels.at(2);
+
+    for(auto kernel : kernels){
+        size_t local_size;
+        err_code = clGetKernelWorkGroupInfo(kernel,
+                                            C->device(),
+                                            CL_KERNEL_WORK_GROUP_SIZE,
+                                            sizeof(size_t),
+                                            &local_size,
+                                            NULL);
+        if(err_code != CL_SUCCESS) {
+            LOG(L_ERROR, "Failure querying the work group size.\n");
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        if(local_size < _local_work_size){
+            std::stringstream msg;
+            LOG(L_ERROR, "The output filter cannot be performed.\n");
+            msg << "\t" << local_size
+                << " elements can be executed, but " << _local_work_size
+                << " are required" << std::endl;
+            LOG0(L_DEBUG, msg.str());
+            throw std::runtime_error("OpenCL error");
+        }
+    }
+    _global_work_size = roundUp(_n, _local_work_size);
+}
+
+void OutputFilter::setSelectionArgs(cl_kernel kernel, cl_mem r, cl_mem sel)
+{
+    cl_int err_code;
+    // The argument 2 (and 3 for the compaction) is set by the caller
+    const unsigned int offset = (kernel == _compact) ? 4 : 3;
+    const std::vector<size_t> sizes = {sizeof(unsigned int),
+                                       sizeof(unsigned int),
+                                       sizeof(unsigned int),
+                                       sizeof(vec),
+                                       sizeof(vec),
+                                       sizeof(float),
+                                       sizeof(float)};
+    const std::vector<const void*> values = {&_first,
+                                             &_n,
+                                             &_stride,
+                                             &_box_min,
+                                             &_box_max,
+                                             &_select_min,
+                                             &_select_max};
+    err_code = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)&r);
+    err_code |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)&sel);
+    for(unsigned int i = 0; i < sizes.size(); i++){
+        err_code |= clSetKernelArg(kernel,
+                                   offset + i,
+                                   sizes.at(i),
+                                   values.at(i));
+    }
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure sending the selection arguments in the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+}
+
+}}  // namespaces
@@ -0,0 +1,434 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Permutation of several arrays at once.
+ * (See Aqua::CalcServer::Permute for details)
+ * @note Hardcoded versions of the files CalcServer/Permute.cl.in and
+ * CalcServer/Permute.hcl.in are internally included as a text array.
+ */
+
+#include <algorithm>
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <CalcServer/Permute.h>
+
+namespace Aqua{ namespace CalcServer{
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#include "CalcServer/Permute.hcl"
+#include "CalcServer/Permute.cl"
+#endif
+std::string PERMUTE_INC = xxd2string(Permute_hcl_in, Permute_hcl_in_len);
+std::string PERMUTE_SRC = xxd2string(Permute_cl_in, Permute_cl_in_len);
+
+Permute::Permute(const std::string name,
+                 const std::vector<std::string> fields,
+                 const std::string permutations,
+                 bool once)
+    : Tool(name, once)
+    , _fields_names(fields)
+    , _perms_name(permutations)
+    , _perms(NULL)
+    , _global_work_size(0)
+    , _local_work_size(0)
+    , _n(0)
+{
+}
+
+Permute::~Permute()
+{
+    for(auto kernel : _kernels){
+        if(kernel) clReleaseKernel(kernel);
+    }
+    _kernels.clear();
+    for(auto spares : _groups_spares){
+        for(auto mem : spares){
+            if(mem) clReleaseMemObject(mem);
+        }
+    }
+    _groups_spares.clear();
+}
+
+void Permute::setup()
+{
+    std::ostringstream msg;
+    msg << "Loading the tool \"" << name() << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    Tool::setup();
+    variables();
+    setupMems();
+    setupOpenCL();
+}
+
+cl_event Permute::_execute(const std::vector<cl_event> events)
+{
+    unsigned int b, k;
+    cl_int err_code;
+    cl_event event, event_wait = NULL;
+    CalcServer *C = CalcServer::singleton();
+
+    for(b = 0; b < _kernels.size(); b++){
+        cl_kernel kernel = _kernels.at(b);
+        std::vector<cl_mem> &spares = _groups_spares.at(_batches_group.at(b));
+        const unsigned int first = _batches_first.at(b);
+        const unsigned int n_fields = _batches_size.at(b);
+
+        // The memory objects are changing each time step, so the arguments
+        // shall be sent again
+        err_code = clSetKernelArg(kernel, 0, sizeof(cl_mem), _perms->get());
+        if(err_code != CL_SUCCESS){
+            std::stringstream msg;
+            msg << "Failure sending the permutations to the tool \""
+                << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        for(k = 0; k < n_fields; k++){
+            err_code = clSetKernelArg(kernel,
+                                      2 + 2 * k,
+                                      sizeof(cl_mem),
+                                      _fields.at(first + k)->get());
+            if(err_code == CL_SUCCESS){
+                err_code = clSetKernelArg(kernel,
+                                          3 + 2 * k,
+                                          sizeof(cl_mem),
+                                          (void*)&(spares.at(k)));
+            }
+            if(err_code != CL_SUCCESS){
+                std::stringstream msg;
+                msg << "Failure sending the variable \""
+                    << _fields.at(first + k)->name() << "\" to the tool \""
+                    << name() << "\"." << std::endl;
+                LOG(L_ERROR, msg.str());
+                InputOutput::Logger::singleton()->printOpenCLError(err_code);
+                throw std::runtime_error("OpenCL error");
+            }
+        }
+
+        // The spare buffers of a batch are the input arrays of the previous
+        // batch of the same group, so they shall be waited
+        std::vector<cl_event> events_wait = events;
+        if(event_wait)
+            events_wait.push_back(event_wait);
+        err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                          kernel,
+                                          1,
+                                          NULL,
+                                          &_global_work_size,
+                                          &_local_work_size,
+                                          events_wait.size(),
+                                          events_wait.data(),
+                                          &event);
+        if(err_code != CL_SUCCESS) {
+            std::stringstream msg;
+            msg << "Failure executing the tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        if(event_wait){
+            err_code = clReleaseEvent(event_wait);
+            if(err_code != CL_SUCCESS) {
+                std::stringstream msg;
+                msg << "Failure releasing transactional event in the tool \""
+                    << name() << "\"." << std::endl;
+                LOG(L_ERROR, msg.str());
+                InputOutput::Logger::singleton()->printOpenCLError(err_code);
+                throw std::runtime_error("OpenCL execution error");
+            }
+        }
+        event_wait = event;
+
+        // Swap the memory objects, such that the variables are pointing to
+        // the permuted data, and the old ones become the spare buffers
+        for(k = 0; k < n_fields; k++){
+            InputOutput::ArrayVariable *var = _fields.at(first + k);
+            cl_mem mem = *(cl_mem*)var->get();
+            var->set((void*)&(spares.at(k)));
+            spares.at(k) = mem;
+        }
+    }
+
+    return event_wait;
+}
+
+void Permute::variables()
+{
+    unsigned int i, j;
+    CalcServer *C = CalcServer::singleton();
+    InputOutput::Variables *vars = C->variables();
+
+    if(!vars->get(_perms_name)){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking the undeclared variable \"" << _perms_name << "\""
+            << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable");
+    }
+    if(vars->get(_perms_name)->type().compare("unsigned int*")){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking the permutations variable \"" << _perms_name
+            << "\", which has an invalid type" << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\t\"unsigned int*\" was expected, but \""
+            << vars->get(_perms_name)->type() << "\" was found." << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid variable type");
+    }
+    _perms = (InputOutput::ArrayVariable *)vars->get(_perms_name);
+    _n = *(unsigned int *)vars->get("N")->get();
+    if(_perms->size() < _n * sizeof(unsigned int)){
+        std::stringstream msg;
+        msg << "Wrong variable length in the tool \"" << name()
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\t\"" << _perms_name << "\" should have, at least, length N="
+            << _n << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid variable length");
+    }
+
+    if(!_fields_names.size()){
+        std::stringstream msg;
+        msg << "No arrays to permute in the tool \"" << name()
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid number of fields");
+    }
+
+    // Group the arrays by their element and total sizes
+    std::vector<size_t> groups_size;
+    std::vector<std::vector<InputOutput::ArrayVariable*>> groups;
+    for(i = 0; i < _fields_names.size(); i++){
+        const std::string var_name = _fields_names.at(i);
+        if(!vars->get(var_name)){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" is asking the undeclared variable \""
+                << var_name << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+        if(!vars->get(var_name)->isArray()){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" may not use a scalar variable (\""
+                << var_name << "\")." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable type");
+        }
+        if((var_name == _perms_name) ||
+           (std::find(_fields_names.begin(), _fields_names.begin() + i,
+                      var_name) != _fields_names.begin() + i)){
+            std::stringstream msg;
+            msg << "The variable \"" << var_name
+                << "\" cannot be permuted twice by the tool \""
+                << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+        InputOutput::ArrayVariable *var =
+            (InputOutput::ArrayVariable *)vars->get(var_name);
+        const size_t elem_size = InputOutput::Variables::typeToBytes(
+            var->type());
+        if(var->size() < _n * elem_size){
+            std::stringstream msg;
+            msg << "Wrong variable length in the tool \"" << name()
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            msg.str("");
+            msg << "\t\"" << var_name << "\" should have, at least, length N="
+                << _n << std::endl;
+            LOG0(L_DEBUG, msg.str());
+            throw std::runtime_error("Invalid variable length");
+        }
+
+        for(j = 0; j < groups.size(); j++){
+            if((_groups_elem_size.at(j) == elem_size) &&
+               (groups_size.at(j) == var->size()))
+                break;
+        }
+        if(j == groups.size()){
+            _groups_elem_size.push_back(elem_size);
+            groups_size.push_back(var->size());
+            groups.push_back(std::vector<InputOutput::ArrayVariable*>());
+        }
+        groups.at(j).push_back(var);
+    }
+
+    // Split the groups in batches
+    for(i = 0; i < groups.size(); i++){
+        for(j = 0; j < groups.at(i).size(); j += _PERMUTE_FIELDS){
+            _batches_group.push_back(i);
+            _batches_first.push_back(_fields.size() + j);
+            _batches_size.push_back(
+                std::min((unsigned int)(groups.at(i).size() - j),
+                         (unsigned int)_PERMUTE_FIELDS));
+        }
+        _fields.insert(_fields.end(), groups.at(i).begin(), groups.at(i).end());
+    }
+
+    std::vector<InputOutput::Variable*> deps(_fields.begin(), _fields.end());
+    deps.push_back(_perms);
+    setDependencies(deps);
+}
+
+void Permute::setupMems()
+{
+    unsigned int b, k;
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    _groups_spares.resize(_groups_elem_size.size());
+    std::vector<size_t> allocated(_groups_elem_size.size(), 0);
+    for(b = 0; b < _batches_group.size(); b++){
+        std::vector<cl_mem> &spares = _groups_spares.at(_batches_group.at(b));
+        const size_t size = _fields.at(_batches_first.at(b))->size();
+        // The spare buffers are shared by all the batches of the group
+        for(k = spares.size(); k < _batches_size.at(b); k++){
+            cl_mem mem = clCreateBuffer(C->context(),
+                                        CL_MEM_READ_WRITE,
+                                        size,
+                                        NULL,
+                                        &err_code);
+            if(err_code != CL_SUCCESS){
+                std::stringstream msg;
+                msg << "Failure allocating device memory in the tool \"" <<
+                       name() << "\"." << std::endl;
+                LOG(L_ERROR, msg.str());
+                InputOutput::Logger::singleton()->printOpenCLError(err_code);
+                throw std::runtime_error("OpenCL allocation error");
+            }
+            spares.push_back(mem);
+            allocated.at(_batches_group.at(b)) += size;
+        }
+    }
+    for(k = 0; k < allocated.size(); k++){
+        std::ostringstream buffer;
+        buffer << "spares " << k << " (" << _groups_elem_size.at(k)
+               << " bytes elements)";
+        allocatedMemory(buffer.str(), allocated.at(k));
+    }
+}
+
+void Permute::setupOpenCL()
+{
+    unsigned int b;
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    std::ostringstream source;
+    source << PERMUTE_INC << PERMUTE_SRC;
+    _local_work_size = 0;
+    for(b = 0; b < _batches_group.size(); b++){
+        // Just the element size is relevant. The sizes which are not a power
+        // of two, like the 6 bytes of hvec3 or the 12 bytes of the 3D pvec,
+        // are permuted as a structure of words
+        std::ostringstream flags;
+        const size_t elem_size = _groups_elem_size.at(_batches_group.at(b));
+        switch(elem_size){
+            case 2:
+                flags << "-DT=ushort"; break;
+            case 4:
+                flags << "-DT=uint"; break;
+            case 8:
+                flags << "-DT=uint2"; break;
+            case 16:
+                flags << "-DT=uint4"; break;
+            case 32:
+                flags << "-DT=uint8"; break;
+            case 64:
+                flags << "-DT=uint16"; break;
+            default:
+                if(elem_size && !(elem_size % 4)){
+                    flags << "-DT_WORD=uint -DT_WORDS=" << elem_size / 4;
+                    break;
+                }
+                if(elem_size && !(elem_size % 2)){
+                    flags << "-DT_WORD=ushort -DT_WORDS=" << elem_size / 2;
+                    break;
+                }
+                std::stringstream msg;
+                msg << "The tool \"" << name()
+                    << "\" cannot permute the variable \""
+                    << _fields.at(_batches_first.at(b))->name()
+                    << "\"." << std::endl;
+                LOG(L_ERROR, msg.str());
+                msg.str("");
+                msg << "\tElements of " << elem_size
+                    << " bytes are not supported" << std::endl;
+                LOG0(L_DEBUG, msg.str());
+                throw std::runtime_error("Invalid variable type");
+        }
+        flags << " -DN_FIELDS=" << _batches_size.at(b);
+        cl_kernel kernel = compile_kernel(source.str(),
+                                          "permute",
+                                          flags.str());
+        _kernels.push_back(kernel);
+
+        err_code = clSetKernelArg(kernel,
+                                  1,
+                                  sizeof(unsigned int),
+                                  (void*)&_n);
+        if(err_code != CL_SUCCESS){
+            LOG(L_ERROR, "Failure sending the array size argument\n");
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+
+        size_t local_work_size;
+        err_code = clGetKernelWorkGroupInfo(kernel,
+                                            C->device(),
+                                            CL_KERNEL_WORK_GROUP_SIZE,
+                                            sizeof(size_t),
+                                            &local_work_size,
+                                            NULL);
+        if(err_code != CL_SUCCESS) {
+            LOG(L_ERROR, "Failure querying the work group size.\n");
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        if(!_local_work_size || (local_work_size < _local_work_size))
+            _local_work_size = local_work_size;
+    }
+    if(_local_work_size < __CL_MIN_LOCALSIZE__){
+        std::stringstream msg;
+        LOG(L_ERROR, "Permute cannot be performed.\n");
+        msg << "\t" << _local_work_size
+            << " elements can be executed, but __CL_MIN_LOCALSIZE__="
+            << __CL_MIN_LOCALSIZE__ << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("OpenCL error");
+    }
+    _global_work_size = roundUp(_n, _local_work_size);
+
+    std::stringstream msg;
+    msg << "\t" << _fields.size() << " arrays permuted in "
+        << _kernels.size() << " kernels" << std::endl;
+    LOG0(L_DEBUG, msg.str());
+}
+
+}}  // namespaces
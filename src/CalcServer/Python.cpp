@@ -23,6 +23,7 @@
 
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
+#include <InputOutput/Trace.h>
 #include <CalcServer/Python.h>
 
 /** @def PY_ARRAY_UNIQUE_SYMBOL
@@ -60,6 +61,53 @@ class stderrWriter(object):              \n\
         pass                             \n\
 \n";
 
+/// Snapshot of the inputs, if the thread is executing an asynchronous tool
+static thread_local PyObject *_async_inputs = NULL;
+/// Variables set by the asynchronous tool executed by the thread, if any
+static thread_local PyObject *_async_outputs = NULL;
+/// Main thread state, while it is not holding the global interpreter lock
+static PyThreadState *_main_thread_state = NULL;
+/// Number of asynchronous tools
+static unsigned int _n_async = 0;
+
+/** @brief Take back the Python global interpreter lock in the main thread.
+ * @see releaseGIL()
+ */
+static void acquireGIL()
+{
+    if(_main_thread_state){
+        PyEval_RestoreThread(_main_thread_state);
+        _main_thread_state = NULL;
+    }
+}
+
+/** @brief Release the Python global interpreter lock in the main thread, so
+ * the asynchronous tools can be executed in the meantime.
+ * @see acquireGIL()
+ */
+static void releaseGIL()
+{
+    if(_n_async && !_main_thread_state){
+        _main_thread_state = PyEval_SaveThread();
+    }
+}
+
+/** @brief Report that a method is not available in the asynchronous tools.
+ * @param method Method name.
+ * @return true if the thread is executing an asynchronous tool, false
+ * otherwise.
+ */
+static bool checkAsync(const char* method)
+{
+    if(!_async_inputs)
+        return false;
+    std::ostringstream errstr;
+    errstr << "aquagpusph." << method
+           << "() cannot be used by asynchronous tools";
+    PyErr_SetString(PyExc_RuntimeError, errstr.str().c_str());
+    return true;
+}
+
 /** @brief Get a variable by its name.
  * @param self Module.
  * @param args Positional arguments.
@@ -82,6 +130,23 @@ static PyObject* get(PyObject *self, PyObject *args, PyObject *keywds)
         return NULL;
     }
 
+    // Asynchronous tools are reading the snapshot
+    if(_async_inputs){
+        PyObject *value = PyDict_GetItemString(_async_inputs, varname);
+        if(!value){
+            std::ostringstream errstr;
+            errstr << "Variable \"" << varname
+                   << "\" is not an input of the asynchronous tool";
+            PyErr_SetString(PyExc_ValueError, errstr.str().c_str());
+            return NULL;
+        }
+        if(i0 || n){
+            return PySequence_GetSlice(value, i0, n ? i0 + n : PY_SSIZE_T_MAX);
+        }
+        Py_INCREF(value);
+        return value;
+    }
+
     Aqua::InputOutput::Variable *var = vars->get(varname);
     if(!var){
         std::ostringstream errstr;
@@ -125,6 +190,26 @@ static PyObject* set(PyObject *self, PyObject *args, PyObject *keywds)
         return NULL;
     }
 
+    // Asynchronous tools are deferring the writing, so the value is copied
+    if(_async_outputs){
+        PyObject *copy = value;
+        if(PyArray_Check(value))
+            copy = PyArray_NewCopy((PyArrayObject*)value, NPY_ANYORDER);
+        else
+            Py_INCREF(copy);
+        if(!copy){
+            return NULL;
+        }
+        PyObject *item = Py_BuildValue("(sOii)", varname, copy, i0, n);
+        Py_DECREF(copy);
+        if(!item || PyList_Append(_async_outputs, item)){
+            Py_XDECREF(item);
+            return NULL;
+        }
+        Py_DECREF(item);
+        Py_RETURN_NONE;
+    }
+
     if(var->setFromPythonObject(value, i0, n)){
         return NULL;
     }
@@ -141,6 +226,126 @@ static PyObject* set(PyObject *self, PyObject *args, PyObject *keywds)
     Py_RETURN_NONE;
 }
 
+/** @brief Get an array variable by its name.
+ * @param varname Name of the variable.
+ * @return Array variable, NULL if errors have been detected.
+ */
+static Aqua::InputOutput::ArrayVariable* getArray(const char* varname)
+{
+    Aqua::CalcServer::CalcServer *C = Aqua::CalcServer::CalcServer::singleton();
+    Aqua::InputOutput::Variables *vars = C->variables();
+
+    Aqua::InputOutput::Variable *var = vars->get(varname);
+    if(!var){
+        std::ostringstream errstr;
+        errstr << "Variable \"" << varname << "\" has not been declared";
+        PyErr_SetString(PyExc_ValueError, errstr.str().c_str());
+        return NULL;
+    }
+    if(!var->isArray()){
+        std::ostringstream errstr;
+        errstr << "Variable \"" << varname << "\" is not an array";
+        PyErr_SetString(PyExc_ValueError, errstr.str().c_str());
+        return NULL;
+    }
+    return (Aqua::InputOutput::ArrayVariable*)var;
+}
+
+/** @brief Get a read-only view of an array variable by its name.
+ *
+ * Differently to get(), the data is not copied each time.
+ * @param self Module.
+ * @param args Positional arguments.
+ * @param keywds Keyword arguments.
+ * @return Computed value, NULL if errors have been detected.
+ * @see Aqua::InputOutput::ArrayVariable::getPythonView()
+ */
+static PyObject* getView(PyObject *self, PyObject *args, PyObject *keywds)
+{
+    const char* varname;
+
+    static char *kwlist[] = {"varname", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "s", kwlist, &varname)){
+        return NULL;
+    }
+
+    if(checkAsync("view")){
+        return NULL;
+    }
+
+    Aqua::InputOutput::ArrayVariable *var = getArray(varname);
+    if(!var){
+        return NULL;
+    }
+
+    return var->getPythonView();
+}
+
+/** @brief Get a writable view of an array variable by its name.
+ *
+ * The modifications are not uploaded until unmapView() is called.
+ * @param self Module.
+ * @param args Positional arguments.
+ * @param keywds Keyword arguments.
+ * @return Computed value, NULL if errors have been detected.
+ * @see Aqua::InputOutput::ArrayVariable::getPythonView()
+ */
+static PyObject* mapView(PyObject *self, PyObject *args, PyObject *keywds)
+{
+    const char* varname;
+
+    static char *kwlist[] = {"varname", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "s", kwlist, &varname)){
+        return NULL;
+    }
+
+    if(checkAsync("map")){
+        return NULL;
+    }
+
+    Aqua::InputOutput::ArrayVariable *var = getArray(varname);
+    if(!var){
+        return NULL;
+    }
+
+    return var->getPythonView(true);
+}
+
+/** @brief Upload the writable view of an array variable.
+ * @param self Module.
+ * @param args Positional arguments.
+ * @param keywds Keyword arguments.
+ * @return Computed value, NULL if errors have been detected.
+ * @see Aqua::InputOutput::ArrayVariable::unmapPythonView()
+ */
+static PyObject* unmapView(PyObject *self, PyObject *args, PyObject *keywds)
+{
+    const char* varname;
+
+    static char *kwlist[] = {"varname", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "s", kwlist, &varname)){
+        return NULL;
+    }
+
+    if(checkAsync("unmap")){
+        return NULL;
+    }
+
+    Aqua::InputOutput::ArrayVariable *var = getArray(varname);
+    if(!var){
+        return NULL;
+    }
+
+    if(var->unmapPythonView()){
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
 /** @brief Log a message from the Python.
  *
  * In AQUAgpusph the Python stdout and stderr are redirected to this function,
@@ -182,6 +387,12 @@ static PyObject* logMsg(PyObject *self, PyObject *args, PyObject *keywds)
 static PyMethodDef methods[] = {
     {"get", (PyCFunction)get, METH_VARARGS | METH_KEYWORDS, "Get a variable"},
     {"set", (PyCFunction)set, METH_VARARGS | METH_KEYWORDS, "Set a variable"},
+    {"view", (PyCFunction)getView, METH_VARARGS | METH_KEYWORDS,
+     "Get a read-only view of an array"},
+    {"map", (PyCFunction)mapView, METH_VARARGS | METH_KEYWORDS,
+     "Get a writable view of an array"},
+    {"unmap", (PyCFunction)unmapView, METH_VARARGS | METH_KEYWORDS,
+     "Upload a writable view of an array"},
     {"log", (PyCFunction)logMsg, METH_VARARGS | METH_KEYWORDS, "Log a message"},
     {NULL, NULL, 0, NULL}
 };
@@ -239,11 +450,19 @@ PyMODINIT_FUNC PyInit_aquagpusph(void)
 
 namespace Aqua{ namespace CalcServer{
 
-Python::Python(const std::string tool_name, const std::string script, bool once)
+Python::Python(const std::string tool_name,
+               const std::string script,
+               bool async,
+               const std::vector<std::string> inputs,
+               bool once)
     : Tool(tool_name, once)
     , _script(script)
     , _module(NULL)
     , _func(NULL)
+    , _async(async)
+    , _input_names(inputs)
+    , _inputs(NULL)
+    , _outputs(NULL)
 {
     // Look for a .py extension to remove it
     std::size_t last_sep = _script.find_last_of(".");
@@ -255,6 +474,14 @@ Python::Python(const std::string tool_name, const std::string script, bool once)
 
 Python::~Python()
 {
+    acquireGIL();
+    if(_thread.joinable()){
+        Py_BEGIN_ALLOW_THREADS
+        _thread.join();
+        Py_END_ALLOW_THREADS
+    }
+    if(_inputs) Py_DECREF(_inputs); _inputs=0;
+    if(_outputs) Py_DECREF(_outputs); _outputs=0;
     if(_module) Py_DECREF(_module); _module=0;
     if(_func) Py_DECREF(_func); _func=0;
 }
@@ -266,36 +493,154 @@ void Python::setup()
     LOG(L_INFO, msg.str());
 
     Tool::setup();
+    acquireGIL();
     initPython();
     load();
+
+    if(_async){
+        InputOutput::Variables *vars = CalcServer::singleton()->variables();
+        for(auto var_name : _input_names){
+            if(!vars->get(var_name)){
+                std::ostringstream msg;
+                msg << "The tool \"" << name()
+                    << "\" is asking for the undeclared variable \""
+                    << var_name << "\"." << std::endl;
+                LOG(L_ERROR, msg.str());
+                throw std::runtime_error("Invalid variable");
+            }
+        }
+        _n_async++;
+    }
+    releaseGIL();
 }
 
 cl_event Python::_execute(const std::vector<cl_event> events)
+{
+    acquireGIL();
+
+    if(_async){
+        join();
+        snapshot();
+        _outputs = PyList_New(0);
+        _thread = std::thread(&Python::run, this);
+        releaseGIL();
+        return NULL;
+    }
+
+    const std::string error = call();
+    if(!error.empty()){
+        LOG(L_ERROR, error);
+        if(error == "main() function returned False.\n")
+            throw std::runtime_error("Python invoked simulation stop");
+        throw std::runtime_error("Python execution error");
+    }
+    releaseGIL();
+
+    // This function is not pruducing events by itself. This work is relayed
+    // to the setters
+    return NULL;
+}
+
+std::string Python::call()
 {
     PyObject *result;
 
     result = PyObject_CallObject(_func, NULL);
     if(!result) {
-        LOG(L_ERROR, "main() function execution failed.\n");
         LOG0(L_DEBUG, "\n--- Python report --------------------------\n\n");
         PyErr_Print();
         LOG0(L_DEBUG, "\n-------------------------- Python report ---\n\n");
-        throw std::runtime_error("Python execution error");
+        return "main() function execution failed.\n";
     }
 
-    if(!PyObject_TypeCheck(result, &PyBool_Type)){
-        LOG(L_ERROR, "main() function returned non boolean variable.\n");
+    std::string error = "";
+    if(!PyObject_TypeCheck(result, &PyBool_Type))
+        error = "main() function returned non boolean variable.\n";
+    else if(result == Py_False)
+        error = "main() function returned False.\n";
+    Py_DECREF(result);
+    return error;
+}
+
+void Python::run()
+{
+    const std::string tool_name = name();
+    InputOutput::TraceSpan span("python", tool_name.c_str());
+    PyGILState_STATE state = PyGILState_Ensure();
+    _async_inputs = _inputs;
+    _async_outputs = _outputs;
+    _error = call();
+    _async_inputs = NULL;
+    _async_outputs = NULL;
+    PyGILState_Release(state);
+}
+
+void Python::join()
+{
+    if(!_thread.joinable())
+        return;
+
+    // The worker requires the global interpreter lock to finish
+    Py_BEGIN_ALLOW_THREADS
+    _thread.join();
+    Py_END_ALLOW_THREADS
+
+    if(_inputs) Py_DECREF(_inputs); _inputs = NULL;
+    if(!_error.empty()){
+        LOG(L_ERROR, _error);
+        if(_error == "main() function returned False.\n")
+            throw std::runtime_error("Python invoked simulation stop");
         throw std::runtime_error("Python execution error");
     }
 
-    if(result == Py_False){
-        LOG(L_ERROR, "main() function returned False.\n");
-        throw std::runtime_error("Python invoked simulation stop");
+    // Apply the variables set by the script
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+    for(Py_ssize_t i = 0; i < PyList_Size(_outputs); i++){
+        const char *var_name;
+        PyObject *value;
+        int i0, n;
+        if(!PyArg_ParseTuple(PyList_GetItem(_outputs, i), "sOii",
+                             &var_name, &value, &i0, &n)){
+            PyErr_Print();
+            throw std::runtime_error("Python execution error");
+        }
+        InputOutput::Variable *var = vars->get(var_name);
+        if(var->setFromPythonObject(value, i0, n)){
+            std::ostringstream msg;
+            msg << "Failure setting the variable \"" << var_name
+                << "\" from the tool \"" << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            LOG0(L_DEBUG, "\n--- Python report --------------------------\n\n");
+            PyErr_Print();
+            LOG0(L_DEBUG, "\n-------------------------- Python report ---\n\n");
+            throw std::runtime_error("Python execution error");
+        }
+        // Populate the variable if it is a scalar one
+        if(!var->isArray())
+            vars->populate(var);
     }
+    Py_DECREF(_outputs); _outputs = NULL;
+}
 
-    // This function is not pruducing events by itself. This work is relayed
-    // to the setters
-    return NULL;
+void Python::snapshot()
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+    _inputs = PyDict_New();
+    for(auto var_name : _input_names){
+        PyObject *value = vars->get(var_name)->getPythonObject();
+        if(!value){
+            std::ostringstream msg;
+            msg << "Failure taking the snapshot of the variable \"" << var_name
+                << "\" in the tool \"" << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            LOG0(L_DEBUG, "\n--- Python report --------------------------\n\n");
+            PyErr_Print();
+            LOG0(L_DEBUG, "\n-------------------------- Python report ---\n\n");
+            throw std::runtime_error("Python execution error");
+        }
+        PyDict_SetItemString(_inputs, var_name.c_str(), value);
+        Py_DECREF(value);
+    }
 }
 
 void Python::initPython()
@@ -311,6 +656,10 @@ void Python::initPython()
         LOG(L_ERROR, "Failure calling Py_Initialize().\n");
         throw std::runtime_error("Python error");
     }
+#if PY_VERSION_HEX < 0x03070000
+    // Required by the asynchronous tools
+    PyEval_InitThreads();
+#endif
 
     PyRun_SimpleString("import sys");
     PyRun_SimpleString("import os");
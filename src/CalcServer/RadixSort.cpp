@@ -27,6 +27,10 @@
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
 #include <CalcServer/RadixSort.h>
+#include <sys/time.h>
+#include <random>
+#include <limits>
+#include <algorithm>
 
 namespace Aqua{ namespace CalcServer{
 
@@ -41,7 +45,11 @@ RadixSort::RadixSort(const std::string tool_name,
                      const std::string variable,
                      const std::string permutations,
                      const std::string inv_permutations,
-                     bool once)
+                     bool once,
+                     unsigned int bits,
+                     unsigned int items,
+                     unsigned int groups,
+                     unsigned int histo_split)
     : Tool(tool_name, once)
     , _var_name(variable)
     , _perms_name(permutations)
@@ -63,11 +71,15 @@ RadixSort::RadixSort(const std::string tool_name,
     , _histograms(NULL)
     , _global_sums(NULL)
     , _temp_mem(NULL)
-    , _items(_ITEMS)
-    , _groups(_GROUPS)
-    , _bits(_STEPBITS)
-    , _radix(_RADIX)
-    , _histo_split(_HISTOSPLIT)
+    , _items(items)
+    , _groups(groups)
+    , _bits(bits)
+    , _radix(0)
+    , _histo_split(histo_split)
+    , _key_bits(__UINTBITS__)
+    , _n_pass(0)
+    , _pass(0)
+    , _kernels_bits(0)
 {
 }
 
@@ -96,6 +108,19 @@ void RadixSort::setup()
 
     Tool::setup();
 
+    if((_bits < 1) || (_bits > 8)){
+        std::ostringstream msg;
+        msg << "Invalid number of bits per pass in the tool \"" << name()
+            << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\tThe bits should be in the range [1, 8], but "
+            << _bits << " was found" << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid number of bits");
+    }
+    _radix = 1 << _bits;
+
     // Get the variables
     variables();
 
@@ -106,28 +131,11 @@ void RadixSort::setup()
 cl_event RadixSort::_execute(const std::vector<cl_event> events)
 {
     cl_int err_code;
-    unsigned int i, max_val;
     cl_event event, event_wait, event_perms_in;
     CalcServer *C = CalcServer::singleton();
-    InputOutput::Variables *vars = C->variables();
 
     // Get maximum key bits, and needed pass
-    max_val = UINT_MAX;
-    if(!_var_name.compare("icell")){
-        uivec4 n_cells = *(uivec4 *)vars->get("n_cells")->get();
-        max_val = nextPowerOf2(n_cells.w);
-    }
-    else if(!isPowerOf2(max_val)){
-        max_val = nextPowerOf2(max_val / 2);
-    }
-    for(i=0; (max_val&1) == 0; max_val >>= 1, i++);
-    _key_bits = i;
-    _key_bits = roundUp(_key_bits, _bits);
-    if(_key_bits > __UINTBITS__){
-        LOG(L_ERROR, "Resultant keys overflows unsigned int type.\n");
-        throw std::runtime_error("Unsigned int overflow");
-    }
-    _n_pass = _key_bits / _bits;
+    keyBits();
 
     // Even though we are using Tool dependencies stuff, we are really
     // interested in following a more complex events chain, due to the large and
@@ -689,6 +697,27 @@ cl_event RadixSort::inversePermutations()
     return event;
 }
 
+void RadixSort::keyBits()
+{
+    unsigned int i, max_val;
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+
+    max_val = UINT_MAX;
+    if(!_var_name.compare("icell")){
+        // The particles out of the domain are placed at the n_cells.w cell,
+        // which should be therefore considered as well. It may change each
+        // time step
+        uivec4 n_cells = *(uivec4 *)vars->get("n_cells")->get();
+        max_val = n_cells.w;
+    }
+    for(i = 0; max_val; max_val >>= 1, i++);
+    if(!i)
+        i = 1;
+    _key_bits = roundUp(i, _bits);
+    // The last pass may consider some bits beyond __UINTBITS__, which are
+    // just null
+    _n_pass = _key_bits / _bits;
+}
 
 void RadixSort::variables()
 {
@@ -817,6 +846,40 @@ void RadixSort::variables()
 
 void RadixSort::setupOpenCL()
 {
+    if(CalcServer::singleton()->autotune())
+        autotune();
+    setupKernels();
+
+    // Check and correct _items, _groups and _histo_split
+    setupDims();
+
+    // Setup the memory objects
+    setupMems();
+    setupArgs();
+
+    std::ostringstream msg;
+    msg << "\tbits: " << _bits << std::endl;
+    LOG0(L_DEBUG, msg.str());
+    msg.str(""); msg << "\titems: " << _items << std::endl;
+    LOG0(L_DEBUG, msg.str());
+    msg.str(""); msg << "\tgroups: " << _groups << std::endl;
+    LOG0(L_DEBUG, msg.str());
+    msg.str(""); msg << "\tsplits: " << _histo_split << std::endl;
+    LOG0(L_DEBUG, msg.str());
+}
+
+void RadixSort::setupKernels()
+{
+    if(_kernels_bits == _bits)
+        return;
+
+    if(_init_kernel) clReleaseKernel(_init_kernel); _init_kernel=NULL;
+    if(_histograms_kernel) clReleaseKernel(_histograms_kernel); _histograms_kernel=NULL;
+    if(_scan_kernel) clReleaseKernel(_scan_kernel); _scan_kernel=NULL;
+    if(_paste_kernel) clReleaseKernel(_paste_kernel); _paste_kernel=NULL;
+    if(_sort_kernel) clReleaseKernel(_sort_kernel); _sort_kernel=NULL;
+    if(_inv_perms_kernel) clReleaseKernel(_inv_perms_kernel); _inv_perms_kernel=NULL;
+
     std::ostringstream source;
     source << RADIXSORT_INC << RADIXSORT_SRC;
     std::ostringstream flags;
@@ -831,21 +894,191 @@ void RadixSort::setupOpenCL()
     _paste_kernel = kernels.at(3);
     _sort_kernel = kernels.at(4);
     _inv_perms_kernel = kernels.at(5);
+    _kernels_bits = _bits;
+}
 
-    // Check and correct _items, _groups and _histo_split
-    setupDims();
+void RadixSort::autotune()
+{
+    unsigned int i;
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
 
-    // Setup the memory objects
-    setupMems();
-    setupArgs();
+    // The best dimensions depend on the number of keys, which is therefore
+    // part of the records keys
+    const std::string n_str = std::to_string(_n);
+    const char *params[4] = {"bits", "items", "groups", "splits"};
+    size_t recorded[4];
+    for(i = 0; i < 4; i++){
+        if(!getAutotuned(n_str + "\t" + params[i], recorded[i]))
+            break;
+    }
+    if((i == 4) && (recorded[0] >= 1) && (recorded[0] <= 8)){
+        _bits = recorded[0];
+        _radix = 1 << _bits;
+        _items = recorded[1];
+        _groups = recorded[2];
+        _histo_split = recorded[3];
+        std::ostringstream msg;
+        msg << "Recorded dimensions, bits=" << _bits << ", items=" << _items
+            << ", groups=" << _groups << " and splits=" << _histo_split
+            << ", are used in tool \"" << name() << "\"." << std::endl;
+        LOG(L_INFO, msg.str());
+        return;
+    }
 
     std::ostringstream msg;
-    msg << "\titems: " << _items << std::endl;
-    LOG0(L_DEBUG, msg.str());
-    msg.str(""); msg << "\tgroups: " << _groups << std::endl;
-    LOG0(L_DEBUG, msg.str());
-    msg.str(""); msg << "\tsplits: " << _histo_split << std::endl;
-    LOG0(L_DEBUG, msg.str());
+    msg << "Autotuning the dimensions of tool \"" << name() << "\"..."
+        << std::endl;
+    LOG(L_INFO, msg.str());
+
+    // The radices too large for the local memory are discarded in advance
+    cl_ulong local_mem_size;
+    err_code = clGetDeviceInfo(C->device(),
+                               CL_DEVICE_LOCAL_MEM_SIZE,
+                               sizeof(cl_ulong),
+                               &local_mem_size,
+                               NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Failure getting CL_DEVICE_LOCAL_MEM_SIZE.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    const unsigned int bits0 = _bits, items0 = _items, groups0 = _groups;
+    const unsigned int splits0 = _histo_split;
+    std::vector<unsigned int> bits_list = {bits0};
+    for(auto bits : {4u, 8u}){
+        if((bits != bits0) &&
+           ((1u << bits) * __CL_MIN_LOCALSIZE__ * sizeof(cl_uint) <= local_mem_size))
+            bits_list.push_back(bits);
+    }
+
+    // Random keys. The cells indexes take roughly log2(n) bits, which is
+    // also setting the number of passes
+    unsigned int key_bits = __UINTBITS__;
+    if(!_var_name.compare("icell")){
+        for(key_bits = 1;
+            (key_bits < __UINTBITS__) && ((1u << key_bits) < _n);
+            key_bits++);
+    }
+    std::mt19937 gen(_n);
+    std::uniform_int_distribution<cl_uint> dist(
+        0, (key_bits < __UINTBITS__) ? (1u << key_bits) - 1 : UINT_MAX);
+    std::vector<cl_uint> keys(_n);
+    for(auto &key : keys)
+        key = dist(gen);
+
+    double best_time = std::numeric_limits<double>::max();
+    std::vector<unsigned int> best = {bits0, items0, groups0, splits0};
+    std::vector<std::vector<unsigned int>> tested;
+    for(auto bits : bits_list){
+        _bits = bits;
+        _radix = 1 << bits;
+        setupKernels();
+        for(auto items : {items0 / 2, items0, 2 * items0}){
+            for(auto groups : {groups0 / 2, groups0, 2 * groups0}){
+                if(!items || !groups || (_n % (items * groups)))
+                    continue;
+                _items = items;
+                _groups = groups;
+                _histo_split = splits0;
+                try {
+                    setupDims();
+                } catch(...) {
+                    continue;
+                }
+                // The device corrections may result in an already tested
+                // candidate
+                std::vector<unsigned int> dims = {_bits, _items, _groups,
+                                                  _histo_split};
+                if(std::find(tested.begin(), tested.end(), dims) != tested.end())
+                    continue;
+                tested.push_back(dims);
+                setupMems();
+                setupArgs();
+                const double t = autotuneSample(keys) *
+                                 (roundUp(key_bits, _bits) / _bits);
+                msg.str("");
+                msg << "\tbits=" << _bits << ", items=" << _items
+                    << ", groups=" << _groups << ", splits=" << _histo_split
+                    << " -> " << t << " s" << std::endl;
+                LOG0(L_DEBUG, msg.str());
+                if(t < best_time){
+                    best_time = t;
+                    best = dims;
+                }
+            }
+        }
+    }
+
+    _bits = best.at(0);
+    _radix = 1 << _bits;
+    _items = best.at(1);
+    _groups = best.at(2);
+    _histo_split = best.at(3);
+    msg.str("");
+    msg << "Dimensions autotuned to bits=" << _bits << ", items=" << _items
+        << ", groups=" << _groups << " and splits=" << _histo_split
+        << " in tool \"" << name() << "\"." << std::endl;
+    LOG(L_INFO, msg.str());
+    for(i = 0; i < 4; i++){
+        setAutotuned(n_str + "\t" + params[i], best.at(i));
+    }
+}
+
+double RadixSort::autotuneSample(const std::vector<cl_uint> &keys)
+{
+    cl_int err_code;
+    cl_event keys_event, perms_event, event;
+    timeval tic, tac;
+    CalcServer *C = CalcServer::singleton();
+
+    double best = std::numeric_limits<double>::max();
+    for(unsigned int i = 0; i < AUTOTUNE_SAMPLES; i++){
+        err_code = clEnqueueWriteBuffer(C->command_queue(),
+                                        _in_keys,
+                                        CL_TRUE,
+                                        0,
+                                        _n * sizeof(cl_uint),
+                                        keys.data(),
+                                        0,
+                                        NULL,
+                                        &keys_event);
+        if(err_code != CL_SUCCESS){
+            std::ostringstream msg;
+            msg << "Failure sending the autotuning keys within the tool \""
+                << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        perms_event = init();
+        err_code = clWaitForEvents(1, &perms_event);
+
+        // Just a single pass is timed
+        gettimeofday(&tic, NULL);
+        if(err_code == CL_SUCCESS){
+            _pass = 0;
+            event = histograms(keys_event, NULL);
+            event = scan(event);
+            event = reorder(perms_event, event);
+            err_code = clWaitForEvents(1, &event);
+            clReleaseEvent(event);
+        }
+        gettimeofday(&tac, NULL);
+        clReleaseEvent(keys_event);
+        clReleaseEvent(perms_event);
+        if(err_code != CL_SUCCESS){
+            std::ostringstream msg;
+            msg << "Failure waiting for the autotuning pass within the tool \""
+                << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        best = min(best, (double)(tac.tv_sec - tic.tv_sec) +
+                         (tac.tv_usec - tic.tv_usec) * 1E-6);
+    }
+    return best;
 }
 
 void RadixSort::setupDims()
@@ -854,6 +1087,28 @@ void RadixSort::setupDims()
     size_t max_local_work_size, sort_local_work_size, scan_local_work_size;
     CalcServer *C = CalcServer::singleton();
 
+    if(!isPowerOf2(_items) || !isPowerOf2(_groups) ||
+       !isPowerOf2(_histo_split)){
+        std::ostringstream msg;
+        msg << "Invalid dimensions in the tool \"" << name() << "\"."
+            << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\titems=" << _items << ", groups=" << _groups
+            << " and splits=" << _histo_split
+            << " shall be powers of 2." << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid dimensions");
+    }
+    // The same corrections applied to the default values at compile time
+    if(_items < __CL_MIN_LOCALSIZE__)
+        _items = __CL_MIN_LOCALSIZE__;
+    if(_histo_split / 2 < __CL_MIN_LOCALSIZE__)
+        _histo_split = 2 * __CL_MIN_LOCALSIZE__;
+    if(_radix * _groups * _items / 2 / _histo_split < __CL_MIN_LOCALSIZE__)
+        _groups = max(2 * __CL_MIN_LOCALSIZE__ * _histo_split / (_radix * _items),
+                      1u);
+
     // For the _histograms_kernel and _sort_kernel _items can be used as the
     // upper bound
     err_code = clGetKernelWorkGroupInfo(_histograms_kernel,
@@ -885,6 +1140,32 @@ void RadixSort::setupDims()
     if(!isPowerOf2(_items))
         _items = nextPowerOf2(_items) / 2;
 
+    // The local histograms, of _radix * _items components, shall fit in the
+    // local memory, which becomes relevant for the large radices
+    cl_ulong local_mem_size;
+    err_code = clGetDeviceInfo(C->device(),
+                               CL_DEVICE_LOCAL_MEM_SIZE,
+                               sizeof(cl_ulong),
+                               &local_mem_size,
+                               NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Failure getting CL_DEVICE_LOCAL_MEM_SIZE.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    while(_radix * _items * sizeof(cl_uint) > local_mem_size){
+        _items /= 2;
+        if(_items < __CL_MIN_LOCALSIZE__){
+            std::ostringstream msg;
+            msg << "Insufficient local memory for " << _bits
+                << " bits per pass in the tool \"" << name() << "\"."
+                << std::endl;
+            LOG(L_ERROR, msg.str());
+            LOG0(L_DEBUG, "\tTry decreasing the number of bits\n");
+            throw std::runtime_error("OpenCL error");
+        }
+    }
+
     // The _scan_kernel can be used to set an upper bound to the number of
     // histogram splits
     err_code = clGetKernelWorkGroupInfo(_scan_kernel,
@@ -941,6 +1222,17 @@ void RadixSort::setupDims()
         LOG0(L_DEBUG, "\tYou can try to recompile the code decreasing __CL_MIN_LOCALSIZE__\n");
         throw std::runtime_error("OpenCL error");
     }
+    if(_n % (_items * _groups)){
+        std::ostringstream msg;
+        msg << "Tool \"" << name() << "\" cannot sort " << _n
+            << " keys." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\tThe number of keys shall be divisible by items*groups="
+            << _items * _groups << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Invalid dimensions");
+    }
 
     _local_work_size = getLocalWorkSize(_n, C->command_queue());
     _global_work_size = getGlobalWorkSize(_n, _local_work_size);
@@ -1053,10 +1345,12 @@ void RadixSort::setupMems()
         throw std::runtime_error("OpenCL allocation error");
     }
 
-    allocatedMemory(4 * _n * sizeof(unsigned int) +
-                    (_radix * _groups * _items) * sizeof(unsigned int) +
-                    _histo_split * sizeof(unsigned int) +
-                    sizeof(unsigned int));
+    allocatedMemory("keys", 2 * _n * sizeof(unsigned int));
+    allocatedMemory("permutations", 2 * _n * sizeof(unsigned int));
+    allocatedMemory("histograms",
+                    (_radix * _groups * _items) * sizeof(unsigned int));
+    allocatedMemory("global sums", _histo_split * sizeof(unsigned int));
+    allocatedMemory("temporal", sizeof(unsigned int));
 }
 
 void RadixSort::setupArgs()
@@ -23,6 +23,7 @@
  * CalcServer/Reduction.hcl.in are internally included as a text array.
  */
 
+#include <algorithm>
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
 #include <CalcServer/Reduction.h>
@@ -46,13 +47,10 @@ Reduction::Reduction(const std::string name,
                      bool once)
     : Tool(name, once)
     , _input_name(input_name)
-    , _output_name(output_name)
-    , _operation(operation)
-    , _null_val(null_val)
     , _input_var(NULL)
-    , _output_var(NULL)
     , _input(NULL)
 {
+    add(output_name, operation, null_val);
 }
 
 Reduction::~Reduction()
@@ -71,6 +69,15 @@ Reduction::~Reduction()
     _local_work_sizes.clear();
 }
 
+void Reduction::add(const std::string output_name,
+                    const std::string operation,
+                    const std::string null_val)
+{
+    _output_names.push_back(output_name);
+    _operations.push_back(operation);
+    _null_vals.push_back(null_val);
+}
+
 void Reduction::setup()
 {
     std::ostringstream msg;
@@ -127,25 +134,38 @@ cl_event Reduction::_execute(const std::vector<cl_event> events_src)
         events.push_back(event);
     }
 
-    // Get back the result
-    cl_uint num_events_in_wait_list = events.size();
-    const cl_event *event_wait_list = events.size() ? events.data() : NULL;
-    err_code = clEnqueueReadBuffer(C->command_queue(),
-                                   _mems.at(_mems.size()-1),
-                                   CL_TRUE,
-                                   0,
-                                   _output_var->typesize(),
-                                   _output_var->get(),
-                                   num_events_in_wait_list,
-                                   event_wait_list,
-                                   &event);
-    if(err_code != CL_SUCCESS) {
-        std::ostringstream msg;
-        msg << "Failure reading back the result within the tool \""
-            << name() << "\"." << std::endl;
-        LOG(L_ERROR, msg.str());
-        InputOutput::Logger::singleton()->printOpenCLError(err_code);
-        throw std::runtime_error("OpenCL error");
+    // Get back the results, without blocking. The host is waiting for them
+    // just when the output variables are actually read (see
+    // InputOutput::ScalarVariable::get()). The previous results shall be
+    // already read before overwriting them though
+    std::vector<cl_event> read_events;
+    const size_t data_size = vars->typeToBytes(_input_var->type());
+    for(i = 0; i < _output_vars.size(); i++){
+        std::vector<cl_event> wait_events(events);
+        if(_output_vars.at(i)->getEvent())
+            wait_events.push_back(_output_vars.at(i)->getEvent());
+        cl_uint num_events_in_wait_list = wait_events.size();
+        const cl_event *event_wait_list = wait_events.size() ?
+            wait_events.data() : NULL;
+        err_code = C->readBuffer(C->command_queue(),
+                                 _mems.at(_mems.size()-1),
+                                 CL_FALSE,
+                                 i * data_size,
+                                 _output_vars.at(i)->typesize(),
+                                 _output_ptrs.at(i),
+                                 num_events_in_wait_list,
+                                 event_wait_list,
+                                 &event);
+        if(err_code != CL_SUCCESS) {
+            std::ostringstream msg;
+            msg << "Failure reading back the result \""
+                << _output_vars.at(i)->name() << "\" within the tool \""
+                << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        read_events.push_back(event);
     }
 
     // Release useless transactional events
@@ -161,10 +181,23 @@ cl_event Reduction::_execute(const std::vector<cl_event> events_src)
         }
     }
 
-    // Ensure that the variable is populated, this is in fact a blocking
-    // operation
-    _output_var->setEvent(event);
-    vars->populate(_output_var);
+    // The variables will be populated as soon as the tokenizer requires them.
+    // Just the last event is kept, which is released by the caller
+    for(i = 0; i < _output_vars.size(); i++){
+        _output_vars.at(i)->setEvent(read_events.at(i));
+        vars->populate_async(_output_vars.at(i));
+        if(i == _output_vars.size() - 1)
+            break;
+        err_code = clReleaseEvent(read_events.at(i));
+        if(err_code != CL_SUCCESS) {
+            std::ostringstream msg;
+            msg << "Failure releasing the reading event in the tool \""
+                << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+    }
 
     return event;
 }
@@ -189,24 +222,47 @@ void Reduction::variables()
         throw std::runtime_error("Invalid variable type");
     }
     _input_var = (InputOutput::ArrayVariable *)vars->get(_input_name);
-    if(!vars->get(_output_name)){
+    _output_vars.clear();
+    _output_ptrs.clear();
+    for(auto output_name : _output_names){
+        variable(output_name);
+    }
+
+    // The scalar variable event is internally handled by the tool
+    std::vector<InputOutput::Variable*> deps = {_input_var};
+    setDependencies(deps);
+}
+
+void Reduction::variable(const std::string output_name)
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+    if(!vars->get(output_name)){
         std::stringstream msg;
         msg << "The tool \"" << name()
             << "\" is asking the undeclared output variable \""
-            << _output_name << "\"." << std::endl;
+            << output_name << "\"." << std::endl;
         LOG(L_ERROR, msg.str());
         throw std::runtime_error("Invalid variable");
     }
-    if(vars->get(_output_name)->isArray()){
+    if(vars->get(output_name)->isArray()){
         std::stringstream msg;
         msg << "The tool \"" << name()
-            << "\" is asking the output variable \"" << _output_name
+            << "\" is asking the output variable \"" << output_name
             << "\", which is an array." << std::endl;
         LOG(L_ERROR, msg.str());
         throw std::runtime_error("Invalid variable type");
     }
-    _output_var = vars->get(_output_name);
-    if(!vars->isSameType(_input_var->type(), _output_var->type())){
+    InputOutput::Variable *output_var = vars->get(output_name);
+    if(std::find(_output_vars.begin(), _output_vars.end(), output_var) !=
+       _output_vars.end()){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking several times the output variable \""
+            << output_name << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable");
+    }
+    if(!vars->isSameType(_input_var->type(), output_var->type())){
         std::stringstream msg;
         msg << "Mismatching input and output types within the tool \"" << name()
             << "\"." << std::endl;
@@ -216,44 +272,79 @@ void Reduction::variables()
             << "\" is of type \"" << _input_var->type()
             << "\"." << std::endl;
         LOG0(L_DEBUG, msg.str());
-        msg << "\tOutput variable \"" << _output_var->name()
-            << "\" is of type \"" << _output_var->type()
+        msg << "\tOutput variable \"" << output_var->name()
+            << "\" is of type \"" << output_var->type()
             << "\"." << std::endl;
         LOG0(L_DEBUG, msg.str());
         throw std::runtime_error("Invalid variable type");
     }
-
-    // The scalar variable event is internally handled by the tool
-    std::vector<InputOutput::Variable*> deps = {_input_var};
-    setDependencies(deps);
+    _output_vars.push_back(output_var);
+    // The host memory of the scalar variables is never reallocated
+    _output_ptrs.push_back(output_var->get());
 }
 
 void Reduction::setupOpenCL()
 {
+    unsigned int i;
     size_t data_size, local_size, max_local_size;
     cl_int err_code;
     cl_kernel kernel;
     CalcServer *C = CalcServer::singleton();
     InputOutput::Variables *vars = C->variables();
 
-    // Get the elements data size to can allocate local memory later
-    data_size = vars->typeToBytes(_input_var->type());
+    // Get the elements data size to can allocate local memory later. All
+    // the reductions are packed together
+    const unsigned int n_ops = _operations.size();
+    data_size = n_ops * vars->typeToBytes(_input_var->type());
 
     std::ostringstream source;
-    source << REDUCTION_INC << " #define IDENTITY " << _null_val << std::endl;
-    source << "T reduce(T a, T b) " << std::endl;
-    source << "{ " << std::endl;
-    source << "    T c; " << std::endl;
-    source << _operation << ";" << std::endl;
-    source << "    return c; " << std::endl;
-    source << "} " << std::endl;
+    source << REDUCTION_INC;
+    for(i = 0; i < n_ops; i++){
+        source << " #define IDENTITY_" << i << " " << _null_vals.at(i)
+               << std::endl;
+        source << "T reduce_" << i << "(T a, T b) " << std::endl;
+        source << "{ " << std::endl;
+        source << "    T c; " << std::endl;
+        source << _operations.at(i) << ";" << std::endl;
+        source << "    return c; " << std::endl;
+        source << "} " << std::endl;
+    }
+    if(n_ops == 1){
+        source << "typedef T TM;" << std::endl;
+        source << "TM identity() {return IDENTITY_0;}" << std::endl;
+        source << "TM broadcast(T a) {return a;}" << std::endl;
+        source << "TM reduce(TM a, TM b) {return reduce_0(a, b);}"
+               << std::endl;
+    }
+    else{
+        source << "typedef struct {" << std::endl;
+        for(i = 0; i < n_ops; i++)
+            source << "    T v" << i << ";" << std::endl;
+        source << "} TM;" << std::endl;
+        source << "TM identity() " << std::endl << "{ " << std::endl;
+        source << "    TM c; " << std::endl;
+        for(i = 0; i < n_ops; i++)
+            source << "    c.v" << i << " = IDENTITY_" << i << ";" << std::endl;
+        source << "    return c; " << std::endl << "} " << std::endl;
+        source << "TM broadcast(T a) " << std::endl << "{ " << std::endl;
+        source << "    TM c; " << std::endl;
+        for(i = 0; i < n_ops; i++)
+            source << "    c.v" << i << " = a;" << std::endl;
+        source << "    return c; " << std::endl << "} " << std::endl;
+        source << "TM reduce(TM a, TM b) " << std::endl << "{ " << std::endl;
+        source << "    TM c; " << std::endl;
+        for(i = 0; i < n_ops; i++)
+            source << "    c.v" << i << " = reduce_" << i << "(a.v" << i
+                   << ", b.v" << i << ");" << std::endl;
+        source << "    return c; " << std::endl << "} " << std::endl;
+    }
     source << REDUCTION_SRC;
 
     // Starts a dummy kernel in order to study the local size that can be used
     local_size = __CL_MAX_LOCALSIZE__;
     kernel = compile_kernel(source.str(),
                             "reduction",
-                            flags(local_size));
+                            flags(local_size, true));
     err_code = clGetKernelWorkGroupInfo(kernel,
                                         C->device(),
                                         CL_KERNEL_WORK_GROUP_SIZE,
@@ -285,8 +376,8 @@ void Reduction::setupOpenCL()
     // one
     unsigned int n = _n.at(0);
     _n.clear();
-    unsigned int i=0;
-    while(n > 1){
+    i = 0;
+    while((n > 1) || !i){
         // Get work sizes
         _n.push_back(n);
         _local_work_sizes.push_back(local_size);
@@ -297,7 +388,7 @@ void Reduction::setupOpenCL()
         // Build the output memory object
         cl_mem output = NULL;
         output = clCreateBuffer(C->context(),
-                                CL_MEM_READ_WRITE,
+                                C->memFlags(),
                                 _number_groups.at(i) * data_size,
                                 NULL,
                                 &err_code);
@@ -309,12 +400,14 @@ void Reduction::setupOpenCL()
             InputOutput::Logger::singleton()->printOpenCLError(err_code);
             throw std::runtime_error("OpenCL allocation error");
         }
-        allocatedMemory(_number_groups.at(i) * data_size + allocatedMemory());
+        std::ostringstream buffer_name;
+        buffer_name << "step " << i << " output";
+        allocatedMemory(buffer_name.str(), _number_groups.at(i) * data_size);
         _mems.push_back(output);
         // Build the kernel
         kernel = compile_kernel(source.str(),
                                 "reduction",
-                                flags(local_size));
+                                flags(local_size, i == 0));
         _kernels.push_back(kernel);
 
         err_code = clSetKernelArg(kernel,
@@ -388,16 +481,19 @@ void Reduction::setVariables()
     _mems.at(0) = _input;
 }
 
-const std::string Reduction::flags(const size_t local_size) {
+const std::string Reduction::flags(const size_t local_size,
+                                   const bool first_step) {
     std::ostringstream f;
-    if(!_output_var->type().compare("unsigned int")){
+    if(!_output_vars.front()->type().compare("unsigned int")){
         // Spaces are not a good business into definitions passed as args
         f << "-DT=uint";
     }
     else{
-        f << "-DT=" << _output_var->type();
+        f << "-DT=" << _output_vars.front()->type();
     }
     f << " -DLOCAL_WORK_SIZE=" << local_size << "u";
+    if(first_step)
+        f << " -DFIRST_STEP";
 
     return f.str();
 }
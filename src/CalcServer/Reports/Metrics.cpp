@@ -0,0 +1,226 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Live metrics exporter.
+ * (See Aqua::CalcServer::Reports::Metrics for details)
+ */
+
+#include <stdio.h>
+#include <fstream>
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <InputOutput/Writers.h>
+#include <CalcServer.h>
+#include <CalcServer/Reports/Metrics.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#include <CalcServer/MPISync.h>
+#endif
+
+namespace Aqua{ namespace CalcServer{ namespace Reports{
+
+/** @brief Escape a Prometheus label value
+ * @param value Label value
+ * @return The escaped label value
+ */
+static std::string escapeLabel(const std::string value)
+{
+    std::string escaped = replaceAllCopy(value, "\\", "\\\\");
+    replaceAll(escaped, "\"", "\\\"");
+    replaceAll(escaped, "\n", "\\n");
+    return escaped;
+}
+
+Metrics::Metrics(const std::string tool_name,
+                 const std::string output_file,
+                 float period)
+    : Report(tool_name, "dummy_fields_string")
+    , _output_file(setStrConstantsCopy(output_file))
+    , _period(period)
+    , _rank("0")
+    , _iter(0)
+    , _first(true)
+{
+    gettimeofday(&_tic, NULL);
+}
+
+Metrics::~Metrics()
+{
+}
+
+void Metrics::setup()
+{
+    std::ostringstream msg;
+    msg << "Loading the report \"" << name() << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    if(!_output_file.compare("")) {
+        msg.str("");
+        msg << "No output path for the report \"" << name() << "\"."
+            << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid path");
+    }
+
+#ifdef HAVE_MPI
+    try {
+        _rank = std::to_string(MPI::COMM_WORLD.Get_rank());
+    } catch(MPI::Exception e){
+        msg.str("");
+        msg << "Error getting the MPI rank in the report \"" << name()
+            << "\". " << std::endl
+            << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw;
+    }
+#endif
+
+    Tool::setup();
+}
+
+bool Metrics::ready(InputOutput::Variable *var)
+{
+    cl_event event = var->getEvent();
+    if(!event)
+        return true;
+    cl_int status;
+    cl_int err_code = clGetEventInfo(event,
+                                     CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                     sizeof(cl_int),
+                                     &status,
+                                     NULL);
+    return (err_code == CL_SUCCESS) && (status == CL_COMPLETE);
+}
+
+cl_event Metrics::_execute(const std::vector<cl_event> events)
+{
+    CalcServer *C = CalcServer::singleton();
+    InputOutput::Variables *vars = C->variables();
+
+    timeval tac;
+    gettimeofday(&tac, NULL);
+    float elapsed_seconds = (float)(tac.tv_sec - _tic.tv_sec);
+    elapsed_seconds += (float)(tac.tv_usec - _tic.tv_usec) * 1E-6f;
+    if(!_first && (elapsed_seconds < _period))
+        return NULL;
+
+    // Postpone the update instead of waiting for the device
+    InputOutput::Variable *t_var = vars->get("t");
+    InputOutput::Variable *iter_var = vars->get("iter");
+    InputOutput::Variable *n_var = vars->get("N");
+    if(!ready(t_var) || !ready(iter_var) || !ready(n_var))
+        return NULL;
+    const float t = *(float*)t_var->get();
+    const unsigned int iter = *(unsigned int*)iter_var->get();
+    const unsigned int N = *(unsigned int*)n_var->get();
+
+    float steps_per_second = 0.f;
+    if(!_first && (elapsed_seconds > 0.f) && (iter >= _iter))
+        steps_per_second = (iter - _iter) / elapsed_seconds;
+    _tic = tac;
+    _iter = iter;
+    _first = false;
+
+    std::vector<Tool*> tools = C->tools();
+    for(auto tool : C->unsorterTools()){
+        tools.push_back(tool);
+    }
+    size_t allocated_mem = vars->allocatedMemory();
+    for(auto tool : tools){
+        allocated_mem += tool->allocatedMemory();
+    }
+
+    const std::string rank = "rank=\"" + _rank + "\"";
+    std::ostringstream out;
+    auto metric = [&out, &rank](const std::string name,
+                                const std::string type,
+                                const std::string help,
+                                double value){
+        out << "# HELP aquagpusph_" << name << " " << help << std::endl
+            << "# TYPE aquagpusph_" << name << " " << type << std::endl
+            << "aquagpusph_" << name << "{" << rank << "} " << value
+            << std::endl;
+    };
+    metric("time_seconds", "gauge", "Simulation time.", t);
+    metric("iterations_total", "counter", "Time steps computed.", iter);
+    metric("particles", "gauge", "Number of particles.", N);
+    metric("steps_per_second", "gauge", "Time steps per wall clock second.",
+           steps_per_second);
+    metric("particles_per_second", "gauge",
+           "Particles updated per wall clock second.",
+           (double)N * steps_per_second);
+    metric("allocated_bytes", "gauge",
+           "Memory allocated in the computational device.", allocated_mem);
+
+    out << "# HELP aquagpusph_tool_seconds Average elapsed time of each tool."
+        << std::endl
+        << "# TYPE aquagpusph_tool_seconds gauge" << std::endl;
+    for(auto tool : C->tools()){
+        out << "aquagpusph_tool_seconds{" << rank << ",tool=\""
+            << escapeLabel(tool->name()) << "\"} " << tool->elapsedTime()
+            << std::endl;
+    }
+    #ifdef HAVE_GPUPROFILE
+        out << "# HELP aquagpusph_tool_device_seconds Average device time of "
+            << "each tool." << std::endl
+            << "# TYPE aquagpusph_tool_device_seconds gauge" << std::endl;
+        for(auto tool : C->tools()){
+            out << "aquagpusph_tool_device_seconds{" << rank << ",tool=\""
+                << escapeLabel(tool->name()) << "\"} "
+                << tool->deviceElapsedTime() << std::endl;
+        }
+    #endif
+
+    InputOutput::Writers *writers = InputOutput::Writers::singleton();
+    metric("writers_queued", "gauge", "Pending output tasks.",
+           writers->queued());
+    metric("writers_queued_bytes", "gauge",
+           "Host memory retained by the pending output tasks.",
+           writers->queuedMemory());
+    metric("writers_stall_seconds_total", "counter",
+           "Time blocked waiting for the output tasks.",
+           writers->stallTime());
+
+    #ifdef HAVE_MPI
+        metric("mpi_wait_seconds_total", "counter",
+               "Time waiting for the other processes.",
+               MPISync::waitTime() + C->barrierTime());
+    #endif
+
+    // Write the file in background, replacing the previous one at once
+    const std::string path = _output_file;
+    const std::string text = out.str();
+    writers->enqueue([path, text]{
+        const std::string tmp_path = path + ".tmp";
+        std::ofstream f(tmp_path.c_str(), std::ios::out);
+        f << text;
+        f.close();
+        if(f.fail() || rename(tmp_path.c_str(), path.c_str())){
+            std::ostringstream msg;
+            msg << "Failure writing the metrics file \"" << path << "\"."
+                << std::endl;
+            InputOutput::Logger::singleton()->addMessageF(L_WARNING,
+                                                          msg.str());
+        }
+    }, text.size(), this);
+
+    return NULL;
+}
+
+}}} // namespace
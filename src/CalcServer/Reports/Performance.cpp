@@ -26,21 +26,38 @@
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
 #include <CalcServer.h>
+#include <CalcServer/Kernel.h>
 #include <CalcServer/Reports/Performance.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#include <CalcServer/MPISync.h>
+#endif
 
 namespace Aqua{ namespace CalcServer{ namespace Reports{
 
+/// Number of host stall sources printed on screen
+#define PERFORMANCE_TOP_STALLS 3
+
 Performance::Performance(const std::string tool_name,
                          const std::string color,
                          bool bold,
-                         const std::string output_file)
+                         const std::string output_file,
+                         bool mpi,
+                         const std::string roofline_file)
     : Report(tool_name, "dummy_fields_string")
     , _color(color)
     , _bold(bold)
     , _output_file("")
     , _first_execution(true)
+    , _reported_memory(0)
+    , _peak_memory(0)
+    , _mpi(mpi)
+    , _roofline_file("")
+    , _peak_bandwidth(0.0)
+    , _bandwidth(0.0)
 {
     gettimeofday(&_tic, NULL);
+    gettimeofday(&_roofline_tic, NULL);
     if(output_file != "") {
         try {
             unsigned int i = 0;
@@ -52,6 +69,17 @@ Performance::Performance(const std::string tool_name,
             LOG(L_WARNING, msg.str());
         }
     }
+    if(roofline_file != "") {
+        try {
+            unsigned int i = 0;
+            _roofline_file = newFilePath(roofline_file, i, 1);
+        } catch(std::invalid_argument e) {
+            std::ostringstream msg;
+            _roofline_file = setStrConstantsCopy(roofline_file);
+            msg << "Overwriting '" << _roofline_file << "'" << std::endl;
+            LOG(L_WARNING, msg.str());
+        }
+    }
 }
 
 Performance::~Performance()
@@ -75,13 +103,156 @@ void Performance::setup()
         _f.open(_output_file.c_str(), std::ios::out);
         // Write the header
         _f << "# t elapsed average(elapsed) variance(elapsed) "
-           << "overhead average(overhead) variance(overhead) progress ETA"
-           << std::endl;
+           << "overhead average(overhead) variance(overhead) progress ETA";
+        #ifdef HAVE_GPUPROFILE
+            _f << " device average(device)";
+        #endif
+        _f << " memory peak(memory) stall";
+        #ifdef HAVE_MPI
+        if(_mpi && !MPI::COMM_WORLD.Get_rank()) {
+            _f << " imbalance(elapsed) min(N) average(N) max(N)"
+               << " imbalance(N) average(wait) max(wait)";
+            for(auto tool : CalcServer::singleton()->tools()){
+                if(this == tool)
+                    continue;
+                std::string tool_name = tool->name();
+                std::replace(tool_name.begin(), tool_name.end(), ' ', '_');
+                _f << " max(" << tool_name << ")"
+                   << " imbalance(" << tool_name << ")";
+            }
+        }
+        #endif
+        _f << std::endl;
+    }
+
+    if(_roofline_file.compare("")) {
+        #ifdef HAVE_GPUPROFILE
+            _peak_bandwidth = measurePeakBandwidth();
+            msg.str("");
+            msg << "Device peak bandwidth = " << _peak_bandwidth * 1.e-9
+                << " GB/s" << std::endl;
+            LOG(L_INFO, msg.str());
+        #else
+            LOG(L_WARNING, "The roofline table requires the GPU profiling support. It will be disabled\n");
+            _roofline_file = "";
+        #endif
     }
 
     Tool::setup();
 }
 
+/// Number of copies of the peak bandwidth benchmark
+#define PEAK_BANDWIDTH_REPS 8
+
+double Performance::measurePeakBandwidth()
+{
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    cl_ulong max_alloc;
+    err_code = clGetDeviceInfo(C->device(),
+                               CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+                               sizeof(cl_ulong),
+                               &max_alloc,
+                               NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_WARNING, "Failure getting the maximum allocation size.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        return 0.0;
+    }
+    const size_t size = min((size_t)(64 * 1024 * 1024), (size_t)max_alloc / 2);
+
+    cl_mem src = clCreateBuffer(C->context(), CL_MEM_READ_WRITE, size, NULL,
+                                &err_code);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_WARNING, "Failure allocating the bandwidth benchmark buffers.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        return 0.0;
+    }
+    cl_mem dst = clCreateBuffer(C->context(), CL_MEM_READ_WRITE, size, NULL,
+                                &err_code);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_WARNING, "Failure allocating the bandwidth benchmark buffers.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        clReleaseMemObject(src);
+        return 0.0;
+    }
+
+    // The first copy is just warming up the device
+    cl_command_queue queue = C->command_queue();
+    timeval tic, tac;
+    double elapsed = 0.0;
+    for(unsigned int i = 0; i <= PEAK_BANDWIDTH_REPS; i++) {
+        if(i == 1)
+            gettimeofday(&tic, NULL);
+        err_code = clEnqueueCopyBuffer(queue, src, dst, 0, 0, size,
+                                       0, NULL, NULL);
+        if(err_code != CL_SUCCESS)
+            break;
+    }
+    if(err_code == CL_SUCCESS)
+        err_code = clFinish(queue);
+    gettimeofday(&tac, NULL);
+    clReleaseMemObject(src);
+    clReleaseMemObject(dst);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_WARNING, "Failure running the bandwidth benchmark.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        return 0.0;
+    }
+    elapsed = (double)(tac.tv_sec - tic.tv_sec);
+    elapsed += (double)(tac.tv_usec - tic.tv_usec) * 1E-6;
+    if(elapsed <= 0.0)
+        return 0.0;
+
+    // Each copy is reading and writing the buffer
+    return 2.0 * PEAK_BANDWIDTH_REPS * size / elapsed;
+}
+
+double Performance::writeRoofline()
+{
+    CalcServer *C = CalcServer::singleton();
+
+    std::vector<Kernel*> kernels;
+    for(auto tool : C->tools()){
+        Kernel *kernel = dynamic_cast<Kernel*>(tool);
+        if(kernel && kernel->used_times())
+            kernels.push_back(kernel);
+    }
+    std::stable_sort(kernels.begin(), kernels.end(),
+                     [](const Kernel *a, const Kernel *b){
+                         return a->deviceElapsedTime() > b->deviceElapsedTime();
+                     });
+
+    std::ofstream f(_roofline_file.c_str(), std::ios::out);
+    f << "# Peak bandwidth " << _peak_bandwidth * 1.e-9 << " GB/s" << std::endl;
+    f << "# tool device bytes_read bytes_written GB/s %peak GFLOP/s flop/byte"
+      << std::endl;
+    double total_bytes = 0.0, total_time = 0.0;
+    for(auto kernel : kernels){
+        const double t = kernel->deviceElapsedTime();
+        const double read = kernel->bytesRead();
+        const double written = kernel->bytesWritten();
+        const double bytes = read + written;
+        const double bandwidth = (t > 0.0) ? bytes / t : 0.0;
+        const double flops = kernel->flops();
+        total_bytes += bytes;
+        total_time += t;
+
+        std::string tool_name = kernel->name();
+        std::replace(tool_name.begin(), tool_name.end(), ' ', '_');
+        f << tool_name << " " << t << " "
+          << (size_t)read << " " << (size_t)written << " "
+          << bandwidth * 1.e-9 << " "
+          << 100.0 * bandwidth / _peak_bandwidth << " "
+          << ((t > 0.0) ? flops / t * 1.e-9 : 0.0) << " "
+          << ((bytes > 0.0) ? flops / bytes : 0.0) << std::endl;
+    }
+    f.close();
+
+    return (total_time > 0.0) ? total_bytes / total_time : 0.0;
+}
+
 size_t Performance::computeAllocatedMemory(){
     size_t allocated_mem = 0;
     CalcServer *C = CalcServer::singleton();
@@ -92,6 +263,9 @@ size_t Performance::computeAllocatedMemory(){
 
     // Gwet the additionally allocated memory in the tools
     std::vector<Tool*> tools = C->tools();
+    for(auto tool : C->unsorterTools()){
+        tools.push_back(tool);
+    }
     for(auto tool : tools){
         allocated_mem += tool->allocatedMemory();
     }
@@ -99,19 +273,194 @@ size_t Performance::computeAllocatedMemory(){
     return allocated_mem;
 }
 
+std::vector<std::pair<std::string, size_t>> Performance::computeMemoryBreakdown()
+{
+    std::vector<std::pair<std::string, size_t>> breakdown;
+    CalcServer *C = CalcServer::singleton();
+
+    InputOutput::Variables *vars = C->variables();
+    for(auto var : vars->getAll()){
+        if(!var->isArray())
+            continue;
+        breakdown.push_back(std::make_pair(
+            "\"" + var->name() + "\"",
+            ((InputOutput::ArrayVariable*)var)->capacity()));
+    }
+    breakdown.push_back(std::make_pair("released buffers pool",
+                                       vars->pooledMemory()));
+
+    std::vector<Tool*> tools = C->tools();
+    for(auto tool : C->unsorterTools()){
+        tools.push_back(tool);
+    }
+    for(auto tool : tools){
+        size_t unnamed = tool->allocatedMemory();
+        for(auto buffer : tool->allocatedBuffers()){
+            breakdown.push_back(std::make_pair(
+                tool->name() + "::" + buffer.first, buffer.second));
+            unnamed -= buffer.second;
+        }
+        if(unnamed){
+            breakdown.push_back(std::make_pair(tool->name(), unnamed));
+        }
+        for(auto buffer : tool->allocatedHostBuffers()){
+            breakdown.push_back(std::make_pair(
+                tool->name() + "::" + buffer.first + " (host)",
+                buffer.second));
+        }
+    }
+
+    std::stable_sort(breakdown.begin(), breakdown.end(),
+                     [](const std::pair<std::string, size_t> &a,
+                        const std::pair<std::string, size_t> &b){
+                         return a.second > b.second;
+                     });
+    return breakdown;
+}
+
+void Performance::reportMemoryBreakdown()
+{
+    std::vector<std::pair<std::string, size_t>> breakdown =
+        computeMemoryBreakdown();
+    LOG(L_INFO, "Allocated memory breakdown:\n");
+    if(_f.is_open())
+        _f << "# Allocated memory breakdown:" << std::endl;
+    for(auto buffer : breakdown){
+        if(!buffer.second)
+            continue;
+        std::ostringstream msg;
+        msg << "\t" << buffer.first << " = " << buffer.second << " bytes"
+            << std::endl;
+        LOG0(L_INFO, msg.str());
+        if(_f.is_open())
+            _f << "#    " << buffer.first << " " << buffer.second << std::endl;
+    }
+}
+
+void Performance::gatherMPI(std::stringstream &data,
+                            std::stringstream &file_data)
+{
+#ifdef HAVE_MPI
+    unsigned int i, j;
+    CalcServer *C = CalcServer::singleton();
+
+    // Pack the local data
+    std::vector<Tool*> tools;
+    for(auto tool : C->tools()){
+        if(this != tool)
+            tools.push_back(tool);
+    }
+    std::vector<float> local;
+    local.push_back(elapsedTime());
+    local.push_back((float)*(unsigned int*)C->variables()->get("N")->get());
+    local.push_back((float)((MPISync::waitTime() + C->barrierTime()) /
+                            used_times()));
+    for(auto tool : tools){
+        local.push_back(tool->elapsedTime());
+    }
+    const unsigned int n = local.size();
+
+    unsigned int mpi_rank, mpi_size;
+    std::vector<float> gathered;
+    try {
+        mpi_rank = MPI::COMM_WORLD.Get_rank();
+        mpi_size = MPI::COMM_WORLD.Get_size();
+        if(!mpi_rank)
+            gathered.resize(n * mpi_size);
+        MPI::COMM_WORLD.Gather(local.data(), n, MPI::FLOAT,
+                               gathered.data(), n, MPI::FLOAT, 0);
+    } catch(MPI::Exception e){
+        std::ostringstream msg;
+        msg << "Error gathering the performance data in the report \""
+            << name() << "\". " << std::endl
+            << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw;
+    }
+    if(mpi_rank)
+        return;
+
+    std::vector<float> v_min(gathered.begin(), gathered.begin() + n);
+    std::vector<float> v_max(v_min);
+    std::vector<float> v_ave(n, 0.f);
+    for(i = 0; i < mpi_size; i++){
+        for(j = 0; j < n; j++){
+            const float v = gathered.at(i * n + j);
+            v_min.at(j) = min(v_min.at(j), v);
+            v_max.at(j) = max(v_max.at(j), v);
+            v_ave.at(j) += v / mpi_size;
+        }
+    }
+    // The imbalance factor is the ratio between the maximum and the average
+    std::vector<float> imbalance(n, 1.f);
+    for(j = 0; j < n; j++){
+        if(v_ave.at(j) > 0.f)
+            imbalance.at(j) = v_max.at(j) / v_ave.at(j);
+    }
+
+    data << std::setprecision(6)
+         << "MPI processes=" << mpi_size << std::endl
+         << "  Elapsed=" << std::setw(12) << v_ave.at(0)
+         << "s  [" << v_min.at(0) << ", " << v_max.at(0)
+         << "]  x" << imbalance.at(0) << std::endl
+         << "  N=" << std::setw(18) << v_ave.at(1)
+         << "   [" << v_min.at(1) << ", " << v_max.at(1)
+         << "]  x" << imbalance.at(1) << std::endl
+         << "  Waiting=" << std::setw(12) << v_ave.at(2)
+         << "s  [" << v_min.at(2) << ", " << v_max.at(2) << "]" << std::endl;
+
+    // The most expensive tools
+    std::vector<unsigned int> ids(tools.size());
+    for(j = 0; j < ids.size(); j++){
+        ids.at(j) = j;
+    }
+    std::stable_sort(ids.begin(), ids.end(),
+                     [&v_max](unsigned int a, unsigned int b){
+                         return v_max.at(a + 3) > v_max.at(b + 3);
+                     });
+    for(j = 0; (j < ids.size()) && (j < 5); j++){
+        const unsigned int k = ids.at(j) + 3;
+        data << "  " << tools.at(ids.at(j))->name() << "="
+             << v_ave.at(k) << "s  [" << v_min.at(k) << ", " << v_max.at(k)
+             << "]  x" << imbalance.at(k) << std::endl;
+    }
+
+    file_data << " " << imbalance.at(0) << " " << v_min.at(1) << " "
+              << v_ave.at(1) << " " << v_max.at(1) << " " << imbalance.at(1)
+              << " " << v_ave.at(2) << " " << v_max.at(2);
+    for(j = 3; j < n; j++){
+        file_data << " " << v_max.at(j) << " " << imbalance.at(j);
+    }
+#endif
+}
+
 cl_event Performance::_execute(const std::vector<cl_event> events)
 {
     CalcServer *C = CalcServer::singleton();
     std::stringstream data;
 
-    size_t allocated_MB = computeAllocatedMemory() / (1024 * 1024);
+    const size_t allocated_mem = computeAllocatedMemory();
+    if(allocated_mem != _reported_memory){
+        reportMemoryBreakdown();
+        _reported_memory = allocated_mem;
+    }
+    _peak_memory = max(_peak_memory, allocated_mem);
+    size_t allocated_MB = allocated_mem / (1024 * 1024);
+    size_t peak_MB = _peak_memory / (1024 * 1024);
     data << "Performance:" << std::endl
-         << "Memory=" << std::setw(18) << allocated_MB << "MB" << std::endl;
+         << "Memory=" << std::setw(18) << allocated_MB << "MB"
+         << "  (peak " << peak_MB << "MB)" << std::endl;
+    size_t aliased_MB = C->variables()->aliasedMemory() / (1024 * 1024);
+    if(aliased_MB){
+        data << "Aliased=" << std::setw(17) << aliased_MB << "MB" << std::endl;
+    }
 
     // Add the tools time elapsed
     std::vector<Tool*> tools = C->tools();
     float elapsed = 0.f;
     float elapsed_ave = 0.f;
+    float device_elapsed = 0.f;
+    float device_elapsed_ave = 0.f;
     for(auto tool : tools){
         // Exclude the tool itself
         if(this == tool){
@@ -119,6 +468,8 @@ cl_event Performance::_execute(const std::vector<cl_event> events)
         }
         elapsed += tool->elapsedTime(false);
         elapsed_ave += tool->elapsedTime();
+        device_elapsed += tool->deviceElapsedTime(false);
+        device_elapsed_ave += tool->deviceElapsedTime();
     }
 
     timeval tac;
@@ -140,6 +491,41 @@ cl_event Performance::_execute(const std::vector<cl_event> events)
     data << "Overhead=" << std::setw(16) << elapsedTime() - elapsed_ave
          << "s" << std::endl;
 
+    // Add the host stalls syncing the variables
+    std::vector<InputOutput::SyncStall> stalls =
+        InputOutput::Variable::stalls();
+    double stall = 0.0;
+    for(auto s : stalls){
+        stall += s.time;
+    }
+    stall /= used_times();
+    data << "Stall=" << std::setw(19) << stall << "s" << std::endl;
+    const unsigned int n_stalls = min((unsigned int)stalls.size(),
+                                      (unsigned int)PERFORMANCE_TOP_STALLS);
+    for(unsigned int i = 0; i < n_stalls; i++){
+        const InputOutput::SyncStall &s = stalls.at(i);
+        data << "  \"" << s.variable << "\" by " << s.tool << "="
+             << s.time / used_times() << "s  ("
+             << (float)s.count / used_times() << " syncs)" << std::endl;
+    }
+    #ifdef HAVE_GPUPROFILE
+        data << "Device=" << std::setw(18) << device_elapsed_ave
+             << "s" << std::endl;
+    #endif
+    if(_roofline_file.compare("") && (_peak_bandwidth > 0.0)) {
+        // The table is not rewritten each time step
+        float roofline_seconds = (float)(tac.tv_sec - _roofline_tic.tv_sec);
+        roofline_seconds += (float)(tac.tv_usec - _roofline_tic.tv_usec) * 1E-6f;
+        if((_bandwidth == 0.0) || (roofline_seconds > 10.f)) {
+            _bandwidth = writeRoofline();
+            _roofline_tic = tac;
+        }
+        data << "Bandwidth=" << std::setw(15) << _bandwidth * 1.e-9
+             << "GB/s  (" << std::setprecision(3)
+             << 100.0 * _bandwidth / _peak_bandwidth << "% of peak)"
+             << std::setprecision(6) << std::endl;
+    }
+
     // Compute the progress
     InputOutput::Variables *vars = C->variables();
     float progress = 0.f;
@@ -161,6 +547,10 @@ cl_event Performance::_execute(const std::vector<cl_event> events)
          << progress * 100.f;
     data << "   ETA=" << ETA << std::endl;
 
+    std::stringstream file_data;
+    if(_mpi)
+        gatherMPI(data, file_data);
+
     // Replace the trailing space by a line break
     if(data.str().back() == ' ') {
         data.seekp(-1, data.cur);
@@ -178,7 +568,13 @@ cl_event Performance::_execute(const std::vector<cl_event> events)
            << elapsedTimeVariance() << " "
            << elapsedTime(false) - elapsed << " "
            << elapsedTime() - elapsed_ave << " "
-           << progress * 100.f << " " << ETA << std::endl;
+           << progress * 100.f << " " << ETA;
+        #ifdef HAVE_GPUPROFILE
+            _f << " " << device_elapsed << " " << device_elapsed_ave;
+        #endif
+        _f << " " << allocated_mem << " " << _peak_memory << " " << stall;
+        _f << file_data.str();
+        _f << std::endl;
     }
 
     return NULL;
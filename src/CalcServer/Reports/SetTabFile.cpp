@@ -23,6 +23,7 @@
 
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
+#include <InputOutput/Writers.h>
 #include <CalcServer.h>
 #include <CalcServer/Reports/SetTabFile.h>
 
@@ -53,6 +54,8 @@ SetTabFile::SetTabFile(const std::string tool_name,
 
 SetTabFile::~SetTabFile()
 {
+    if(InputOutput::Writers::singleton())
+        InputOutput::Writers::singleton()->wait();
     if(_f.is_open()) _f.close();
 }
 
@@ -86,12 +89,8 @@ cl_event SetTabFile::_execute(const std::vector<cl_event> events)
         return NULL;
     }
 
-    unsigned int i, j;
-    cl_int err_code;
     CalcServer *C = CalcServer::singleton();
-
-    // Print the time instant
-    _f << C->variables()->get("t")->asString() << " ";
+    const std::string t = C->variables()->get("t")->asString();
 
     // Get the data to be printed
     std::vector<InputOutput::Variable*> vars = variables();
@@ -118,11 +117,35 @@ cl_event SetTabFile::_execute(const std::vector<cl_event> events)
     }
     std::vector<void*> data = download(vars);
 
-    // Print the data
+    std::vector<std::string> types;
+    size_t memory = 0;
+    for(auto var : vars){
+        types.push_back(var->type());
+        memory += C->variables()->typeToBytes(var->type()) *
+                  (bounds().y - bounds().x);
+    }
+
+    // Print the data in a parallel thread. The report file is appended by
+    // the tasks sequentially
+    InputOutput::Writers::singleton()->enqueue([this, t, types, data]{
+        print(t, types, data);
+    }, memory, this);
+
+    return NULL;
+}
+
+void SetTabFile::print(const std::string t,
+                       const std::vector<std::string> types,
+                       std::vector<void*> data)
+{
+    unsigned int i, j;
+
+    // Print the time instant
+    _f << t << " ";
+
     for(i = 0; i < bounds().y - bounds().x; i++){
-        for(j = 0; j < vars.size(); j++){
-            InputOutput::ArrayVariable *var = (InputOutput::ArrayVariable*)vars.at(j);
-            const std::string type_name = var->type();
+        for(j = 0; j < types.size(); j++){
+            const std::string type_name = types.at(j);
             if(!type_name.compare("int*")){
                 int* v = (int*)data.at(j);
                 _f << v[i] << " ";
@@ -233,12 +256,7 @@ cl_event SetTabFile::_execute(const std::vector<cl_event> events)
     _f << std::endl;
     _f.flush();
 
-    for(i = 0; i < vars.size(); i++){
-        free(data.at(i)); data.at(i) = NULL;
-    }
-    data.clear();
-
-    return NULL;
+    clearList(&data);
 }
 
 std::vector<void*> SetTabFile::download(std::vector<InputOutput::Variable*> vars)
@@ -249,6 +267,14 @@ std::vector<void*> SetTabFile::download(std::vector<InputOutput::Variable*> vars
     cl_int err_code;
     CalcServer *C = CalcServer::singleton();
 
+    // Gather the tracked particles of all the fields at once, without
+    // unsorting the whole arrays
+    std::vector<std::string> names;
+    for(auto var : vars){
+        names.push_back(var->name());
+    }
+    C->getUnsorters(names, bounds().x, bounds().y - bounds().x);
+
     for(auto var : vars){
         typesize = C->variables()->typeToBytes(var->type());
         len = var->size() / typesize;
@@ -262,7 +288,7 @@ std::vector<void*> SetTabFile::download(std::vector<InputOutput::Variable*> vars
             clearList(&data);
             throw std::runtime_error("Invalid variable type");
         }
-        void *store = malloc(typesize * (bounds().y - bounds().x));
+        void *store = C->allocatePinned(typesize * (bounds().y - bounds().x));
         if(!store){
             std::stringstream msg;
             msg << "Failure allocating " << typesize * (bounds().y - bounds().x)
@@ -313,9 +339,9 @@ std::vector<void*> SetTabFile::download(std::vector<InputOutput::Variable*> vars
 
 void SetTabFile::clearList(std::vector<void*> *data)
 {
+    CalcServer *C = CalcServer::singleton();
     for(auto d : *data){
-        if(d)
-            free(d);
+        C->releasePinned(d);
     }
     data->clear();
 }
@@ -0,0 +1,390 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file
+ * @brief Set several arrays with the desired values in a single launch.
+ * (See Aqua::CalcServer::SetBatch for details)
+ * @note The types header CalcServer/Set.hcl.in is internally included as a
+ * text array.
+ */
+
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <CalcServer/SetBatch.h>
+#include <CalcServer.h>
+
+namespace Aqua{ namespace CalcServer{
+
+// Defined in Set.cpp
+extern std::string SET_INC;
+
+SetBatch::SetBatch(const std::string name,
+                   const std::vector<std::string> var_names,
+                   const std::vector<std::string> values,
+                   bool once)
+    : Tool(name, once)
+    , _var_names(var_names)
+    , _values(values)
+    , _kernel(NULL)
+    , _global_work_size(0)
+    , _local_work_size(0)
+    , _n(0)
+{
+}
+
+SetBatch::~SetBatch()
+{
+    if(_kernel) clReleaseKernel(_kernel); _kernel=NULL;
+    for(auto data : _data)
+        if(data) free(data);
+    _data.clear();
+}
+
+void SetBatch::setup()
+{
+    std::ostringstream msg;
+    msg << "Loading the tool \"" << name() << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    Tool::setup();
+    variables();
+
+    for(auto var : _vars){
+        size_t typesize = InputOutput::Variables::typeToBytes(var->type());
+        void *data = malloc(typesize);
+        if(!data){
+            std::stringstream msg;
+            msg << "Failure allocating " << typesize
+                << " bytes for the variable \"" << var->name()
+                << "\" value." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::bad_alloc();
+        }
+        _data.push_back(data);
+        _inputs.push_back(*(cl_mem*)var->get());
+    }
+    solve();
+
+    // The fill pattern size shall be a power of 2, up to 128 bytes
+    for(unsigned int i = 0; i < _vars.size(); i++){
+        const size_t typesize =
+            InputOutput::Variables::typeToBytes(_vars.at(i)->type());
+        _fill.push_back(_data.at(i) &&
+                        (typesize <= 128) &&
+                        !(typesize & (typesize - 1)));
+    }
+    setupOpenCL();
+}
+
+cl_event SetBatch::_execute(const std::vector<cl_event> events)
+{
+    unsigned int i;
+    cl_int err_code;
+    cl_event event;
+    CalcServer *C = CalcServer::singleton();
+
+    solve();
+    setVariables();
+
+    cl_uint num_events_in_wait_list = events.size();
+    const cl_event *event_wait_list = events.size() ? events.data() : NULL;
+
+    std::vector<cl_event> out_events;
+    for(i = 0; i < _vars.size(); i++){
+        if(!_fill.at(i))
+            continue;
+        const size_t typesize =
+            InputOutput::Variables::typeToBytes(_vars.at(i)->type());
+        err_code = clEnqueueFillBuffer(C->command_queue(),
+                                       *(cl_mem*)_vars.at(i)->get(),
+                                       _data.at(i),
+                                       typesize,
+                                       0,
+                                       _n * typesize,
+                                       num_events_in_wait_list,
+                                       event_wait_list,
+                                       &event);
+        if(err_code != CL_SUCCESS) {
+            std::stringstream msg;
+            msg << "Failure filling the variable \"" << _vars.at(i)->name()
+                << "\" in the tool \"" << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        out_events.push_back(event);
+    }
+
+    if(_kernel){
+        err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                          _kernel,
+                                          1,
+                                          NULL,
+                                          &_global_work_size,
+                                          &_local_work_size,
+                                          num_events_in_wait_list,
+                                          event_wait_list,
+                                          &event);
+        if(err_code != CL_SUCCESS) {
+            std::stringstream msg;
+            msg << "Failure executing the tool \"" <<
+                   name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL execution error");
+        }
+        out_events.push_back(event);
+    }
+
+    if(out_events.size() == 1)
+        return out_events.front();
+
+    // Join all the commands in a single event
+    err_code = clEnqueueMarkerWithWaitList(C->command_queue(),
+                                           out_events.size(),
+                                           out_events.data(),
+                                           &event);
+    for(auto e : out_events)
+        clReleaseEvent(e);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure joining the events of the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    return event;
+}
+
+void SetBatch::variables()
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+    if((_values.size() != 1) && (_values.size() != _var_names.size())){
+        std::stringstream msg;
+        msg << "The tool \"" << name() << "\" has " << _var_names.size()
+            << " variables, but " << _values.size() << " values." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid number of values");
+    }
+    if(_values.size() == 1)
+        _values.resize(_var_names.size(), _values.front());
+
+    for(auto var_name : _var_names){
+        if(!vars->get(var_name)){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" is asking the undeclared variable \""
+                << var_name << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+        if(vars->get(var_name)->type().find('*') == std::string::npos){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" is asking the variable \"" << var_name
+                << "\", which is a scalar." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable type");
+        }
+        InputOutput::ArrayVariable *var =
+            (InputOutput::ArrayVariable *)vars->get(var_name);
+        const unsigned int n = var->size() /
+            InputOutput::Variables::typeToBytes(var->type());
+        if(_vars.size() && (n != _n)){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" is asking the variable \"" << var_name
+                << "\", with " << n << " components, while the previous ones"
+                << " have " << _n << " components." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable length");
+        }
+        _n = n;
+        _vars.push_back(var);
+    }
+
+    std::vector<InputOutput::Variable*> deps(_vars.begin(), _vars.end());
+    setDependencies(deps);
+}
+
+void SetBatch::setupOpenCL()
+{
+    unsigned int i;
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    // Generate the kernel, with an array argument per variable which is not
+    // filled, followed by its value if it is not defined
+    std::ostringstream args, body;
+    cl_uint arg_id = 1;
+    for(i = 0; i < _vars.size(); i++){
+        _arg_ids.push_back(0);
+        if(_fill.at(i))
+            continue;
+        std::string t = trimCopy(_vars.at(i)->type());
+        t.pop_back();  // Remove the asterisk
+        args << "," << std::endl
+             << "                  __global " << t << " *var" << i;
+        _arg_ids.at(i) = arg_id++;
+        if(_data.at(i)){
+            args << "," << std::endl
+                 << "                  " << t << " value" << i;
+            arg_id++;
+            body << "    var" << i << "[i] = value" << i << ";" << std::endl;
+        }
+        else{
+            body << "    var" << i << "[i] = (" << _values.at(i) << ");"
+                 << std::endl;
+        }
+    }
+    if(arg_id == 1){
+        // All the arrays are filled
+        return;
+    }
+
+    std::ostringstream source;
+    source << SET_INC << std::endl
+           << "__kernel void set(unsigned int N"
+           << args.str() << ")" << std::endl
+           << "{" << std::endl
+           << "    const unsigned int i = get_global_id(0);" << std::endl
+           << "    if(i >= N)" << std::endl
+           << "        return;" << std::endl
+           << body.str()
+           << "}" << std::endl;
+    _kernel = compile_kernel(source.str(), "set", "");
+
+    err_code = clGetKernelWorkGroupInfo(_kernel,
+                                        C->device(),
+                                        CL_KERNEL_WORK_GROUP_SIZE,
+                                        sizeof(size_t),
+                                        &_local_work_size,
+                                        NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Failure querying the work group size.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    if(_local_work_size < __CL_MIN_LOCALSIZE__){
+        LOG(L_ERROR, "insufficient local memory.\n");
+        std::stringstream msg;
+        msg << "\t" << _local_work_size
+            << " local work group size with __CL_MIN_LOCALSIZE__="
+            << __CL_MIN_LOCALSIZE__ << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("OpenCL error");
+    }
+    _global_work_size = roundUp(_n, _local_work_size);
+
+    err_code = clSetKernelArg(_kernel,
+                              0,
+                              sizeof(unsigned int),
+                              (void*)&_n);
+    for(i = 0; i < _vars.size(); i++){
+        if(!_arg_ids.at(i))
+            continue;
+        err_code |= clSetKernelArg(_kernel,
+                                   _arg_ids.at(i),
+                                   _vars.at(i)->typesize(),
+                                   _vars.at(i)->get());
+    }
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure sending the arguments to the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+}
+
+void SetBatch::solve()
+{
+    InputOutput::Variables *vars = CalcServer::singleton()->variables();
+
+    for(unsigned int i = 0; i < _vars.size(); i++){
+        if(!_data.at(i))
+            continue;
+        try {
+            vars->solve(_vars.at(i)->type(),
+                        _values.at(i),
+                        _data.at(i),
+                        _vars.at(i)->name());
+        } catch(...) {
+            if(_fill.size()){
+                // The value was already solved at setup
+                throw;
+            }
+            free(_data.at(i));
+            _data.at(i) = NULL;
+            std::stringstream msg;
+            msg << "Falling back to definition mode for the variable \""
+                << _vars.at(i)->name() << "\"..." << std::endl;
+            LOG(L_INFO, msg.str());
+        }
+    }
+}
+
+void SetBatch::setVariables()
+{
+    cl_int err_code;
+
+    if(!_kernel)
+        return;
+
+    for(unsigned int i = 0; i < _vars.size(); i++){
+        if(!_arg_ids.at(i))
+            continue;
+        InputOutput::ArrayVariable *var = _vars.at(i);
+        if(_data.at(i)) {
+            err_code = clSetKernelArg(
+                _kernel,
+                _arg_ids.at(i) + 1,
+                InputOutput::Variables::typeToBytes(var->type()),
+                _data.at(i));
+            if(err_code != CL_SUCCESS) {
+                std::stringstream msg;
+                msg << "Failure setting the value of \"" << var->name()
+                    << "\" to the tool \"" << name() << "\"." << std::endl;
+                LOG(L_ERROR, msg.str());
+                InputOutput::Logger::singleton()->printOpenCLError(err_code);
+                throw std::runtime_error("OpenCL error");
+            }
+        }
+        if(_inputs.at(i) == *(cl_mem*)var->get())
+            continue;
+        err_code = clSetKernelArg(_kernel,
+                                  _arg_ids.at(i),
+                                  var->typesize(),
+                                  var->get());
+        if(err_code != CL_SUCCESS) {
+            std::stringstream msg;
+            msg << "Failure setting the variable \"" << var->name()
+                << "\" to the tool \"" << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        _inputs.at(i) = *(cl_mem *)var->get();
+    }
+}
+
+}}  // namespaces
@@ -21,6 +21,7 @@
  * (See Aqua::CalcServer::SetScalar for details)
  */
 
+#include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
 #include <CalcServer/SetScalar.h>
 #include <CalcServer.h>
@@ -32,14 +33,18 @@ SetScalar::SetScalar(const std::string name,
                      const std::string value,
                      bool once)
     : Tool(name, once)
-    , _var_name(var_name)
-    , _value(value)
-    , _var(NULL)
 {
+    for(auto name : split(var_name, ','))
+        _var_names.push_back(trimCopy(name));
+    for(auto val : split(value, ';'))
+        _values.push_back(trimCopy(val));
 }
 
 SetScalar::~SetScalar()
 {
+    for(auto expr : _exprs)
+        delete expr;
+    _exprs.clear();
 }
 
 void SetScalar::setup()
@@ -50,6 +55,8 @@ void SetScalar::setup()
 
     Tool::setup();
     variable();
+    for(auto value : _values)
+        _exprs.push_back(CalcServer::singleton()->variables()->compile(value));
 }
 
 
@@ -57,28 +64,32 @@ cl_event SetScalar::_execute(const std::vector<cl_event> events)
 {
     InputOutput::Variables *vars = CalcServer::singleton()->variables();
 
-    void *data = malloc(_var->typesize());
-    if(!data){
-        std::stringstream msg;
-        msg << "Failure allocating " << _var->typesize()
-            << " bytes for the variable \""
-            << _var->name() << "\"." << std::endl;
-        LOG(L_ERROR, msg.str());
-        throw std::bad_alloc();
-    }
+    for(unsigned int i = 0; i < _vars.size(); i++){
+        InputOutput::Variable *var = _vars.at(i);
+        void *data = malloc(var->typesize());
+        if(!data){
+            std::stringstream msg;
+            msg << "Failure allocating " << var->typesize()
+                << " bytes for the variable \""
+                << var->name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::bad_alloc();
+        }
+
+        try {
+            vars->solve(var->type(), _exprs.at(i), data);
+        } catch(...) {
+            free(data);
+            throw;
+        }
 
-    try {
-        vars->solve(_var->type(), _value, data, _var->name());
-    } catch(...) {
+        var->set(data);
         free(data);
-        throw;
+        // Ensure that the variable is populated, so the next values can
+        // depend on it
+        vars->populate(var);
     }
 
-    _var->set(data);
-    free(data);
-    // Ensure that the variable is populated
-    vars->populate(_var);
-
     return NULL;
 }
 
@@ -86,23 +97,32 @@ void SetScalar::variable()
 {
     CalcServer *C = CalcServer::singleton();
     InputOutput::Variables *vars = C->variables();
-    if(!vars->get(_var_name)){
+    if(_values.size() != _var_names.size()){
         std::stringstream msg;
-        msg << "The tool \"" << name()
-            << "\" is asking the undeclared variable \""
-            << _var_name << "\"." << std::endl;
+        msg << "The tool \"" << name() << "\" has " << _var_names.size()
+            << " variables, but " << _values.size() << " values." << std::endl;
         LOG(L_ERROR, msg.str());
-        throw std::runtime_error("Invalid variable");
+        throw std::runtime_error("Invalid number of values");
     }
-    if(vars->get(_var_name)->type().find('*') != std::string::npos){
-        std::stringstream msg;
-        msg << "The tool \"" << name()
-            << "\" is asking the variable \"" << _var_name
-            << "\", which is an array." << std::endl;
-        LOG(L_ERROR, msg.str());
-        throw std::runtime_error("Invalid variable type");
+    for(auto var_name : _var_names){
+        if(!vars->get(var_name)){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" is asking the undeclared variable \""
+                << var_name << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+        if(vars->get(var_name)->type().find('*') != std::string::npos){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" is asking the variable \"" << var_name
+                << "\", which is an array." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable type");
+        }
+        _vars.push_back(vars->get(var_name));
     }
-    _var = vars->get(_var_name);
 }
 
 }}  // namespaces
@@ -0,0 +1,182 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Array swap tool.
+ * (see Aqua::CalcServer::Swap for details)
+ */
+
+#include <vector>
+
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <CalcServer.h>
+#include <CalcServer/Swap.h>
+
+namespace Aqua{ namespace CalcServer{
+
+Swap::Swap(const std::string name,
+           const std::string input_name,
+           const std::string output_name,
+           bool once)
+    : Tool(name, once)
+    , _input_name(input_name)
+    , _output_name(output_name)
+    , _input_var(NULL)
+    , _output_var(NULL)
+{
+}
+
+Swap::~Swap()
+{
+}
+
+void Swap::setup()
+{
+    std::ostringstream msg;
+    msg << "Loading the tool \"" << name() << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    Tool::setup();
+    variables();
+}
+
+
+cl_event Swap::_execute(const std::vector<cl_event> events)
+{
+    cl_int err_code;
+    cl_event event;
+    CalcServer *C = CalcServer::singleton();
+
+    // Since both variables are sharing the resulting event, the commands
+    // already enqueued on any of the memory objects shall be waited by the
+    // next tools, no matter the variable they are using
+    cl_uint num_events_in_wait_list = events.size();
+    const cl_event *event_wait_list = events.size() ? events.data() : NULL;
+    err_code = clEnqueueMarkerWithWaitList(C->command_queue(),
+                                           num_events_in_wait_list,
+                                           event_wait_list,
+                                           &event);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure executing the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    // The commands already enqueued are keeping their arguments, so the
+    // memory objects can be exchanged right now. ArrayVariable::set() is
+    // forgetting the length, so it is restored afterwards
+    cl_mem mem = *(cl_mem*)_input_var->get();
+    const size_t input_size = _input_var->size();
+    const size_t output_size = _output_var->size();
+    _input_var->set(_output_var->get());
+    _output_var->set((void*)&mem);
+    _input_var->resize(output_size);
+    _output_var->resize(input_size);
+
+    return event;
+}
+
+void Swap::variables()
+{
+    CalcServer *C = CalcServer::singleton();
+    InputOutput::Variables *vars = C->variables();
+    if(!vars->get(_input_name)){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking the undeclared variable \""
+            << _input_name << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable");
+    }
+    if(vars->get(_input_name)->type().find('*') == std::string::npos){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" may not use a scalar variable (\""
+            << _input_name << "\")." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable type");
+    }
+    _input_var = (InputOutput::ArrayVariable *)vars->get(_input_name);
+    if(!vars->get(_output_name)){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" is asking the undeclared variable \""
+            << _output_name << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable");
+    }
+    if(vars->get(_output_name)->type().find('*') == std::string::npos){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" may not use a scalar variable (\""
+            << _output_name << "\")." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable type");
+    }
+    _output_var = (InputOutput::ArrayVariable *)vars->get(_output_name);
+    if(_input_var == _output_var){
+        std::stringstream msg;
+        msg << "The tool \"" << name()
+            << "\" cannot swap the variable \"" << _input_name
+            << "\" with itself." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid variable");
+    }
+    if(!vars->isSameType(_input_var->type(), _output_var->type())){
+        std::stringstream msg;
+        msg << "The input and output types mismatch for the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\tInput variable \"" << _input_var->name()
+            << "\" is of type \"" << _input_var->type() << "\"" << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        msg.str("");
+        msg << "\tOutput variable \"" << _output_var->name()
+            << "\" is of type \"" << _output_var->type() << "\"" << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Incompatible types");
+    }
+    // The lengths shall match, since the arrays are exchanging their data
+    size_t n_in = _input_var->size() / vars->typeToBytes(_input_var->type());
+    size_t n_out = _output_var->size() / vars->typeToBytes(_output_var->type());
+    if(n_in != n_out){
+        std::stringstream msg;
+        msg << "Input and output lengths mismatch for the tool \""
+            << name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        msg.str("");
+        msg << "\tInput variable \"" << _input_var->name()
+            << "\" has length " << n_in << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        msg.str("");
+        msg << "\tOutput variable \"" << _output_var->name()
+            << "\" has length " << n_out << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("Incompatible lenghts");
+    }
+
+    std::vector<InputOutput::Variable*> deps = {_input_var, _output_var};
+    setDependencies(deps);
+}
+
+}}  // namespaces
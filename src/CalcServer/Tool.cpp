@@ -25,26 +25,310 @@
 #include <CalcServer/Tool.h>
 #include <CalcServer.h>
 #include <InputOutput/Logger.h>
+#include <InputOutput/Trace.h>
+#include <AuxiliarMethods.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdio.h>
 #include <queue>
+#include <mutex>
 #include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <regex>
 
 namespace Aqua{ namespace CalcServer{
 
+/** @brief Get a device information string
+ * @param device OpenCL device
+ * @param param Information to query
+ * @return The information string, empty if it cannot be queried
+ */
+std::string deviceInfoStr(cl_device_id device, cl_device_info param)
+{
+    size_t info_size;
+    if(clGetDeviceInfo(device, param, 0, NULL, &info_size) != CL_SUCCESS)
+        return "";
+    std::string info(info_size, '\0');
+    if(clGetDeviceInfo(device, param, info_size, &info[0], NULL) != CL_SUCCESS)
+        return "";
+    return info;
+}
+
+/** @brief Collect the contents of the files included by a source code
+ *
+ * The include directives are recursively resolved, first in the folder of
+ * the including file, and then in the include folders. All the directives are
+ * considered, even the ones disabled by the preprocessor, so the result is
+ * conservative. The files which cannot be found, e.g. the OpenCL compiler
+ * headers, are just ignored. The files included by means of a macro, like the
+ * kernel functions in KernelFunctions/Kernel.h, cannot be resolved, so all
+ * the files in the folder of the including file are collected instead.
+ *
+ * @param source Source code
+ * @param folder Folder of the source code file, empty if it is not a file
+ * @param folders Include folders
+ * @param visited Files already collected, which are not collected again
+ * @param contents Output stream where the paths and the contents are appended
+ */
+static void includedFiles(const std::string &source,
+                          const std::string &folder,
+                          const std::vector<std::string> &folders,
+                          std::vector<std::string> &visited,
+                          std::ostringstream &contents)
+{
+    static const std::regex directive(
+        "(^|\\n)[ \\t]*#[ \\t]*include[ \\t]*([^\\n]*)");
+    for(auto it = std::sregex_iterator(source.begin(), source.end(),
+                                       directive);
+        it != std::sregex_iterator(); it++) {
+        const std::string arg = trimCopy((*it)[2].str());
+        std::vector<std::string> candidates;
+        if(arg.size() && ((arg[0] == '"') || (arg[0] == '<'))) {
+            const size_t end = arg.find_first_of("\">", 1);
+            const std::string name = arg.substr(1, end - 1);
+            if(name[0] == '/')
+                candidates.push_back(name);
+            else {
+                if(folder != "")
+                    candidates.push_back(folder + "/" + name);
+                for(auto f : folders)
+                    candidates.push_back(f + "/" + name);
+            }
+        }
+        else if(folder != "") {
+            DIR *dir = opendir(folder.c_str());
+            struct dirent *entry;
+            while(dir && (entry = readdir(dir))) {
+                if(entry->d_name[0] != '.')
+                    candidates.push_back(folder + "/" + entry->d_name);
+            }
+            if(dir)
+                closedir(dir);
+            // The directory entries are not sorted
+            std::sort(candidates.begin(), candidates.end());
+        }
+        for(auto path : candidates) {
+            struct stat st;
+            if(stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+                continue;
+            if(std::find(visited.begin(), visited.end(),
+                         path) == visited.end()) {
+                std::ifstream f(path);
+                if(!f.is_open())
+                    continue;
+                visited.push_back(path);
+                std::string text((std::istreambuf_iterator<char>(f)),
+                                 std::istreambuf_iterator<char>());
+                contents << path << '\0' << text << '\0';
+                includedFiles(text, getFolderFromFilePath(path), folders,
+                              visited, contents);
+            }
+            // Just the first file found is included, unless it is a macro
+            if(arg.size() && ((arg[0] == '"') || (arg[0] == '<')))
+                break;
+        }
+    }
+}
+
+/** @brief Get the file where the binary of a program shall be cached
+ *
+ * The file name is a hash of the source code, the contents of the included
+ * files, the compilation flags, the AQUAgpusph version, and the device name
+ * and driver version, such that modifying any of them is triggering a new
+ * compilation.
+ *
+ * @param source Source code to be compiled
+ * @param flags Compilation flags
+ * @return The cache file path, empty if the cache is disabled
+ */
+std::string programCacheFile(const std::string source,
+                             const std::string flags)
+{
+    Aqua::CalcServer::CalcServer *C = Aqua::CalcServer::CalcServer::singleton();
+    if(C->cache_path() == "")
+        return "";
+
+    // The include folders are set with the -I flags
+    std::vector<std::string> folders;
+    std::istringstream words(flags);
+    std::string word;
+    while(words >> word) {
+        if(word.compare(0, 2, "-I"))
+            continue;
+        word = word.substr(2);
+        if((word == "") && !(words >> word))
+            break;
+        folders.push_back(word);
+    }
+    std::vector<std::string> visited;
+    std::ostringstream includes;
+    includedFiles(source, "", folders, visited, includes);
+
+    std::ostringstream key;
+    key << source << '\0' << includes.str() << '\0' << flags << '\0'
+        << PACKAGE_VERSION << '\0'
+        << deviceInfoStr(C->device(), CL_DEVICE_NAME) << '\0'
+        << deviceInfoStr(C->device(), CL_DEVICE_VERSION) << '\0'
+        << deviceInfoStr(C->device(), CL_DRIVER_VERSION);
+    std::ostringstream path;
+    path << C->cache_path() << "/" << hashString(key.str()) << ".bin";
+    return path.str();
+}
+
+/** @brief Create a program from a cached binary
+ * @param cache_file Cached binary file
+ * @return The OpenCL program, NULL if the binary cannot be loaded
+ */
+cl_program loadProgramBinary(const std::string cache_file)
+{
+    cl_int err_code, binary_status;
+    Aqua::CalcServer::CalcServer *C = Aqua::CalcServer::CalcServer::singleton();
+
+    std::ifstream f(cache_file, std::ios::in | std::ios::binary);
+    if(!f.is_open())
+        return NULL;
+    std::string binary((std::istreambuf_iterator<char>(f)),
+                       std::istreambuf_iterator<char>());
+    f.close();
+    if(!binary.size())
+        return NULL;
+
+    cl_device_id device = C->device();
+    size_t binary_size = binary.size();
+    const unsigned char* binary_data = (const unsigned char*)binary.data();
+    cl_program program = clCreateProgramWithBinary(C->context(),
+                                                   1,
+                                                   &device,
+                                                   &binary_size,
+                                                   &binary_data,
+                                                   &binary_status,
+                                                   &err_code);
+    if((err_code != CL_SUCCESS) || (binary_status != CL_SUCCESS)) {
+        std::stringstream msg;
+        msg << "Discarding the invalid cached program \"" << cache_file
+            << "\"" << std::endl;
+        LOG(L_WARNING, msg.str());
+        if(err_code == CL_SUCCESS)
+            clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+/** @brief Store the binary of a built program in the cache
+ *
+ * The binary is written in a temporary file, which is renamed afterwards, so
+ * several simultaneous instances cannot read a partially written file.
+ *
+ * @param program Built OpenCL program
+ * @param cache_file Cached binary file
+ * @note Failures are just reported as warnings, since the cache is not
+ * required to carry out the simulation.
+ */
+void saveProgramBinary(cl_program program, const std::string cache_file)
+{
+    cl_int err_code;
+    cl_uint num_devices;
+    Aqua::CalcServer::CalcServer *C = Aqua::CalcServer::CalcServer::singleton();
+
+    err_code = clGetProgramInfo(program,
+                                CL_PROGRAM_NUM_DEVICES,
+                                sizeof(cl_uint),
+                                &num_devices,
+                                NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_WARNING, "Failure getting the number of program devices\n");
+        return;
+    }
+    std::vector<cl_device_id> devices(num_devices);
+    std::vector<size_t> sizes(num_devices);
+    err_code = clGetProgramInfo(program,
+                                CL_PROGRAM_DEVICES,
+                                num_devices * sizeof(cl_device_id),
+                                devices.data(),
+                                NULL);
+    err_code |= clGetProgramInfo(program,
+                                 CL_PROGRAM_BINARY_SIZES,
+                                 num_devices * sizeof(size_t),
+                                 sizes.data(),
+                                 NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_WARNING, "Failure getting the program binary sizes\n");
+        return;
+    }
+    std::vector<std::string> binaries;
+    std::vector<unsigned char*> binaries_ptr;
+    for(auto size : sizes) {
+        binaries.push_back(std::string(size, '\0'));
+    }
+    for(auto &binary : binaries) {
+        binaries_ptr.push_back((unsigned char*)&binary[0]);
+    }
+    err_code = clGetProgramInfo(program,
+                                CL_PROGRAM_BINARIES,
+                                num_devices * sizeof(unsigned char*),
+                                binaries_ptr.data(),
+                                NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_WARNING, "Failure getting the program binaries\n");
+        return;
+    }
+
+    auto it = std::find(devices.begin(), devices.end(), C->device());
+    if(it == devices.end())
+        return;
+    const std::string binary = binaries.at(std::distance(devices.begin(), it));
+    if(!binary.size())
+        return;
+
+    std::ostringstream tmp_file;
+    tmp_file << cache_file << "." << getpid() << "." << program << ".tmp";
+    std::ofstream f(tmp_file.str(), std::ios::out | std::ios::binary);
+    if(!f.is_open()) {
+        std::stringstream msg;
+        msg << "Failure writing the cached program \"" << cache_file
+            << "\"" << std::endl;
+        LOG(L_WARNING, msg.str());
+        return;
+    }
+    f.write(binary.data(), binary.size());
+    f.close();
+    if(rename(tmp_file.str().c_str(), cache_file.c_str())) {
+        std::stringstream msg;
+        msg << "Failure writing the cached program \"" << cache_file
+            << "\"" << std::endl;
+        LOG(L_WARNING, msg.str());
+        remove(tmp_file.str().c_str());
+    }
+}
+
 Tool::Tool(const std::string tool_name, bool once)
     : _name(tool_name)
     , _once(once)
+    , _skipped(false)
     , _next_tool(NULL)
     , _allocated_memory(0)
     , _n_iters(0)
     , _elapsed_time(0.f)
     , _average_elapsed_time(0.f)
     , _squared_elapsed_time(0.f)
+    , _n_device_iters(0)
+    , _device_elapsed_time(0.f)
+    , _average_device_elapsed_time(0.f)
+    , _squared_device_elapsed_time(0.f)
+    , _profiling_event(NULL)
+    , _profiling_trace_time(-1.0)
 {
 }
 
 Tool::~Tool()
 {
+    if(_profiling_event) clReleaseEvent(_profiling_event);
+    _profiling_event = NULL;
 }
 
 void Tool::setup()
@@ -61,18 +345,46 @@ void Tool::setup()
     return;
 }
 
+/// Tool being executed by each thread, see Tool::current()
+static thread_local Tool *current_tool = NULL;
+
+/** @brief Set the tool being executed by the calling thread along a scope,
+ * restoring the previous one afterwards
+ */
+class CurrentTool
+{
+public:
+    /** @brief Constructor
+     * @param tool Tool being executed
+     */
+    CurrentTool(Tool *tool) : _parent(current_tool) {current_tool = tool;}
+    /// Destructor
+    ~CurrentTool() {current_tool = _parent;}
+private:
+    /// Previously executed tool
+    Tool *_parent;
+};
+
+Tool* Tool::current()
+{
+    return current_tool;
+}
+
 void Tool::execute()
 {
-    if(_once && (_n_iters > 0))
+    if(_skipped || (_once && (_n_iters > 0)))
         return;
 
     cl_int err_code;
     timeval tic, tac;
 
     gettimeofday(&tic, NULL);
+    InputOutput::TraceSpan span("tool", _name.c_str());
+    CurrentTool current(this);
 
     // Launch the tool
     std::vector<cl_event> events = getEvents();
+    CalcServer::singleton()->select_command_queue(events);
     cl_event event = _execute(events);
 
     if(event != NULL) {
@@ -82,6 +394,26 @@ void Tool::execute()
             (*it)->setEvent(event);
         }
 
+        #ifdef HAVE_GPUPROFILE
+            // Collect the device time of the previous execution, and keep
+            // this one to be profiled later
+            sampleDeviceElapsedTime();
+            err_code = clRetainEvent(event);
+            if(err_code != CL_SUCCESS){
+                std::stringstream msg;
+                msg << "Failure retaining the profiling event in tool \"" <<
+                    name() << "\"." << std::endl;
+                LOG(L_ERROR, msg.str());
+                InputOutput::Logger::singleton()->printOpenCLError(err_code);
+                throw std::runtime_error("OpenCL execution error");
+            }
+            _profiling_event = event;
+            InputOutput::Trace *trace = InputOutput::Trace::singleton();
+            _profiling_trace_time = -1.0;
+            if(trace && trace->recording())
+                _profiling_trace_time = trace->now();
+        #endif
+
         // Release the event now that it is retained by its users
         err_code = clReleaseEvent(event);
         if(err_code != CL_SUCCESS){
@@ -116,6 +448,15 @@ void Tool::execute()
     addElapsedTime(elapsed_seconds);
 }
 
+size_t Tool::allocatedMemory() const
+{
+    size_t allocated_mem = _allocated_memory;
+    for(auto buffer : _allocated_buffers){
+        allocated_mem += buffer.second;
+    }
+    return allocated_mem;
+}
+
 int Tool::id_in_pipeline()
 {
     std::vector<Tool*> tools = CalcServer::singleton()->tools();
@@ -140,6 +481,82 @@ void Tool::addElapsedTime(float elapsed_time)
     _squared_elapsed_time /= _n_iters;
 }
 
+void Tool::addDeviceElapsedTime(float elapsed_time)
+{
+    _device_elapsed_time = elapsed_time;
+    // Invert the average computation
+    _average_device_elapsed_time *= _n_device_iters;
+    _squared_device_elapsed_time *= _n_device_iters;
+    // Add the new data
+    _average_device_elapsed_time += elapsed_time;
+    _squared_device_elapsed_time += elapsed_time * elapsed_time;
+    // And average it again
+    _n_device_iters++;
+    _average_device_elapsed_time /= _n_device_iters;
+    _squared_device_elapsed_time /= _n_device_iters;
+}
+
+void Tool::sampleDeviceElapsedTime()
+{
+    cl_int err_code, status;
+    cl_ulong start, end;
+
+    if(!_profiling_event)
+        return;
+
+    err_code = clGetEventInfo(_profiling_event,
+                              CL_EVENT_COMMAND_EXECUTION_STATUS,
+                              sizeof(cl_int),
+                              &status,
+                              NULL);
+    // User events (e.g. the ones generated by the tools executed in the host)
+    // are not carrying profiling information
+    if((err_code == CL_SUCCESS) && (status == CL_COMPLETE)){
+        err_code = clGetEventProfilingInfo(_profiling_event,
+                                           CL_PROFILING_COMMAND_START,
+                                           sizeof(cl_ulong),
+                                           &start,
+                                           NULL);
+        if(err_code == CL_SUCCESS)
+            err_code = clGetEventProfilingInfo(_profiling_event,
+                                               CL_PROFILING_COMMAND_END,
+                                               sizeof(cl_ulong),
+                                               &end,
+                                               NULL);
+        if(err_code == CL_SUCCESS)
+            addDeviceElapsedTime((float)(end - start) * 1E-9f);
+
+        // The device clock is translated to the host one taking the time
+        // when the command was queued
+        cl_ulong queued;
+        InputOutput::Trace *trace = InputOutput::Trace::singleton();
+        if(trace && (_profiling_trace_time >= 0.0) && (err_code == CL_SUCCESS))
+            err_code = clGetEventProfilingInfo(_profiling_event,
+                                               CL_PROFILING_COMMAND_QUEUED,
+                                               sizeof(cl_ulong),
+                                               &queued,
+                                               NULL);
+        if(trace && (_profiling_trace_time >= 0.0) && (err_code == CL_SUCCESS))
+            trace->span("device",
+                        _name.c_str(),
+                        _profiling_trace_time + (start - queued) * 1E-3,
+                        _profiling_trace_time + (end - queued) * 1E-3,
+                        true);
+    }
+    _profiling_trace_time = -1.0;
+
+    err_code = clReleaseEvent(_profiling_event);
+    _profiling_event = NULL;
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure releasing the profiling event in tool \"" <<
+            name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+}
+
 void Tool::setDependencies(std::vector<std::string> var_names)
 {
     InputOutput::Variables *vars = CalcServer::singleton()->variables();
@@ -197,19 +614,51 @@ std::vector<cl_kernel> Tool::compile(const std::string source,
     #endif
     flags << " " << additional_flags;
 
-    size_t source_length = source.size();
-    const char* source_cstr = source.c_str();
-    program = clCreateProgramWithSource(C->context(),
-                                        1,
-                                        &source_cstr,
-                                        &source_length,
-                                        &err_code);
-    if(err_code != CL_SUCCESS) {
-        LOG(L_ERROR, "Failure creating the OpenCL program\n");
-        InputOutput::Logger::singleton()->printOpenCLError(err_code);
-        throw std::runtime_error("OpenCL error");
+    // Try to recover the program from the cache
+    const std::string cache_file = programCacheFile(source, flags.str());
+    program = NULL;
+    if(cache_file != "") {
+        program = loadProgramBinary(cache_file);
+        if(program) {
+            err_code = clBuildProgram(program,
+                                      0,
+                                      NULL,
+                                      flags.str().c_str(),
+                                      NULL,
+                                      NULL);
+            if(err_code != CL_SUCCESS) {
+                std::stringstream msg;
+                msg << "Discarding the invalid cached program \""
+                    << cache_file << "\"" << std::endl;
+                LOG(L_WARNING, msg.str());
+                clReleaseProgram(program);
+                program = NULL;
+            }
+        }
+    }
+
+    if(!program) {
+        size_t source_length = source.size();
+        const char* source_cstr = source.c_str();
+        program = clCreateProgramWithSource(C->context(),
+                                            1,
+                                            &source_cstr,
+                                            &source_length,
+                                            &err_code);
+        if(err_code != CL_SUCCESS) {
+            LOG(L_ERROR, "Failure creating the OpenCL program\n");
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        err_code = clBuildProgram(program,
+                                  0,
+                                  NULL,
+                                  flags.str().c_str(),
+                                  NULL,
+                                  NULL);
+        if((err_code == CL_SUCCESS) && (cache_file != ""))
+            saveProgramBinary(program, cache_file);
     }
-    err_code = clBuildProgram(program, 0, NULL, flags.str().c_str(), NULL, NULL);
     if(err_code != CL_SUCCESS) {
         LOG(L_ERROR, "Error compiling the OpenCL script\n");
         InputOutput::Logger::singleton()->printOpenCLError(err_code);
@@ -294,4 +743,121 @@ const std::vector<cl_event> Tool::getEvents()
     return _events;
 }
 
+/// Autotuned values, see Tool::getAutotuned()
+static std::map<std::string, size_t> autotuned_values;
+/// true if the records file has been already loaded in #autotuned_values
+static bool autotuned_values_loaded = false;
+/// Mutex to protect #autotuned_values
+static std::mutex autotuned_values_mutex;
+
+/** @brief Get the key of a tool in the autotuning records
+ * @param device OpenCL device
+ * @param tool_name Tool name
+ * @return Key of the tool, which is the device name and the tool name
+ * separated by a tabulator
+ */
+static std::string autotuneKey(cl_device_id device, std::string tool_name)
+{
+    char device_name[256];
+    cl_int err_code = clGetDeviceInfo(device,
+                                      CL_DEVICE_NAME,
+                                      sizeof(device_name),
+                                      device_name,
+                                      NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Failure querying the device name.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    return std::string(device_name) + "\t" + tool_name;
+}
+
+/** @brief Load the autotuning records file
+ *
+ * Each line of the file is a record, composed by the key (see
+ * autotuneKey()) and the value, separated by a tabulator.
+ * @param file_path Records file path. Nothing is done if it is empty or the
+ * file does not exist
+ * @warning #autotuned_values_mutex shall be locked by the caller
+ */
+static void loadAutotunedValues(const std::string file_path)
+{
+    if(file_path == "")
+        return;
+    std::ifstream f(file_path);
+    if(!f.is_open())
+        return;
+    std::string line;
+    while(std::getline(f, line)) {
+        size_t sep = line.rfind('\t');
+        if(sep == std::string::npos)
+            continue;
+        try {
+            autotuned_values[line.substr(0, sep)] =
+                std::stoul(line.substr(sep + 1));
+        } catch(...) {
+            std::stringstream msg;
+            msg << "Ignoring the invalid line \"" << line
+                << "\" in the autotuning records file \"" << file_path
+                << "\"" << std::endl;
+            LOG(L_WARNING, msg.str());
+        }
+    }
+}
+
+/** @brief Save the autotuning records file
+ * @param file_path Records file path. Nothing is done if it is empty
+ * @warning #autotuned_values_mutex shall be locked by the caller
+ * @see loadAutotunedValues()
+ */
+static void saveAutotunedValues(const std::string file_path)
+{
+    if(file_path == "")
+        return;
+    // Write in a temporary file first, to avoid partial reads from other
+    // instances
+    std::ostringstream tmp_file;
+    tmp_file << file_path << "." << getpid() << ".tmp";
+    std::ofstream f(tmp_file.str());
+    for(auto record : autotuned_values) {
+        f << record.first << "\t" << record.second << std::endl;
+    }
+    f.close();
+    if(f.fail() || rename(tmp_file.str().c_str(), file_path.c_str())) {
+        std::stringstream msg;
+        msg << "Failure writing the autotuning records file \"" << file_path
+            << "\"" << std::endl;
+        LOG(L_WARNING, msg.str());
+        remove(tmp_file.str().c_str());
+    }
+}
+
+
+bool Tool::getAutotuned(const std::string param, size_t &value)
+{
+    CalcServer *C = CalcServer::singleton();
+    std::string key = autotuneKey(C->device(),
+                                  param == "" ? name() : name() + "\t" + param);
+    std::lock_guard<std::mutex> lock(autotuned_values_mutex);
+    if(!autotuned_values_loaded) {
+        loadAutotunedValues(C->autotune_file());
+        autotuned_values_loaded = true;
+    }
+    auto it = autotuned_values.find(key);
+    if(it == autotuned_values.end())
+        return false;
+    value = it->second;
+    return true;
+}
+
+void Tool::setAutotuned(const std::string param, size_t value)
+{
+    CalcServer *C = CalcServer::singleton();
+    std::string key = autotuneKey(C->device(),
+                                  param == "" ? name() : name() + "\t" + param);
+    std::lock_guard<std::mutex> lock(autotuned_values_mutex);
+    autotuned_values[key] = value;
+    saveAutotunedValues(C->autotune_file());
+}
+
 }}  // namespace
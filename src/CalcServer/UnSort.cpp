@@ -54,11 +54,19 @@ UnSort::UnSort(const std::string name,
     , _global_work_size(0)
     , _local_work_size(0)
     , _n(0)
+    , _updated_event(NULL)
+    , _updated_version(0)
 {
+    _updated_bounds.x = 0;
+    _updated_bounds.y = 0;
 }
 
 UnSort::~UnSort()
 {
+    for(auto event : _readers)
+        clReleaseEvent(event);
+    _readers.clear();
+    if(_updated_event) clReleaseEvent(_updated_event); _updated_event=NULL;
     if(_output) clReleaseMemObject(_output); _output=NULL;
     if(_kernel) clReleaseKernel(_kernel); _kernel=NULL;
 }
@@ -84,8 +92,12 @@ cl_event UnSort::_execute(const std::vector<cl_event> events)
 
     setVariables();
 
-    cl_uint num_events_in_wait_list = events.size();
-    const cl_event *event_wait_list = events.size() ? events.data() : NULL;
+    // The output shall not be overwritten while it is being downloaded
+    std::vector<cl_event> wait_events(events);
+    wait_events.insert(wait_events.end(), _readers.begin(), _readers.end());
+    cl_uint num_events_in_wait_list = wait_events.size();
+    const cl_event *event_wait_list = wait_events.size() ?
+        wait_events.data() : NULL;
 
     err_code = clEnqueueNDRangeKernel(C->command_queue(),
                                       _kernel,
@@ -104,10 +116,68 @@ cl_event UnSort::_execute(const std::vector<cl_event> events)
         InputOutput::Logger::singleton()->printOpenCLError(err_code);
         throw std::runtime_error("OpenCL execution error");
     }
+    for(auto reader : _readers)
+        clReleaseEvent(reader);
+    _readers.clear();
 
     return event;
 }
 
+void UnSort::addReader(cl_event event)
+{
+    cl_int err_code = clRetainEvent(event);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure retaining the reading event in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    _readers.push_back(event);
+}
+
+std::vector<cl_event> UnSort::takeReaders()
+{
+    std::vector<cl_event> readers;
+    readers.swap(_readers);
+    return readers;
+}
+
+bool UnSort::upToDate(unsigned int version,
+                      unsigned int first,
+                      unsigned int n) const
+{
+    // The variable event is changed by any tool using it, so this is a
+    // conservative check
+    return _updated_event &&
+           (_updated_event == _var->getEvent()) &&
+           (_updated_version == version) &&
+           (_updated_bounds.x <= first) &&
+           (_updated_bounds.y >= first + n);
+}
+
+void UnSort::updated(cl_event event,
+                     unsigned int version,
+                     unsigned int first,
+                     unsigned int n)
+{
+    cl_int err_code = clRetainEvent(event);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure retaining the updating event in the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+    if(_updated_event) clReleaseEvent(_updated_event);
+    _updated_event = event;
+    _updated_version = version;
+    _updated_bounds.x = first;
+    _updated_bounds.y = first + n;
+}
+
 void UnSort::variables()
 {
     CalcServer *C = CalcServer::singleton();
@@ -178,8 +248,11 @@ void UnSort::setupMem()
         throw std::runtime_error("Invalid variable length");
     }
 
+    cl_mem_flags flags = CL_MEM_WRITE_ONLY;
+    if(C->zeroCopy())
+        flags |= CL_MEM_ALLOC_HOST_PTR;
     _output = clCreateBuffer(C->context(),
-                             CL_MEM_WRITE_ONLY,
+                             flags,
                              len_id * InputOutput::Variables::typeToBytes(_var->type()),
                              NULL,
                                &err_code);
@@ -191,7 +264,8 @@ void UnSort::setupMem()
         InputOutput::Logger::singleton()->printOpenCLError(err_code);
         throw std::runtime_error("OpenCL allocation error");
     }
-    allocatedMemory(len_id * InputOutput::Variables::typeToBytes(_var->type()));
+    allocatedMemory("output",
+                    len_id * InputOutput::Variables::typeToBytes(_var->type()));
 }
 
 void UnSort::setupOpenCL()
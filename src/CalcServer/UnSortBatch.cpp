@@ -0,0 +1,301 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Unsort several arrays in a single kernel launch.
+ * (See Aqua::CalcServer::UnSortBatch for details)
+ */
+
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+#include <CalcServer/UnSortBatch.h>
+#include <CalcServer.h>
+
+namespace Aqua{ namespace CalcServer{
+
+UnSortBatch::UnSortBatch(const std::string name,
+                         std::vector<UnSort*> unsorters)
+    : Tool(name, false)
+    , _unsorters(unsorters)
+    , _id_var(NULL)
+    , _id_input(NULL)
+    , _kernel(NULL)
+    , _global_work_size(0)
+    , _local_work_size(0)
+    , _n(0)
+    , _first(0)
+    , _n_range(0)
+{
+}
+
+UnSortBatch::~UnSortBatch()
+{
+    if(_kernel) clReleaseKernel(_kernel); _kernel=NULL;
+}
+
+void UnSortBatch::setup()
+{
+    Tool::setup();
+
+    _id_var = _unsorters.front()->permutations();
+    _n = _id_var->size() / InputOutput::Variables::typeToBytes(_id_var->type());
+    std::vector<InputOutput::Variable*> deps = {_id_var};
+    for(auto unsorter : _unsorters){
+        if(unsorter->permutations() != _id_var){
+            std::stringstream msg;
+            msg << "The tool \"" << name()
+                << "\" cannot unsort with different permutations." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+        deps.push_back(unsorter->input());
+    }
+    setDependencies(deps);
+
+    _n_range = _n;
+    setupOpenCL();
+}
+
+void UnSortBatch::range(unsigned int first, unsigned int n)
+{
+    cl_int err_code;
+    if((first == _first) && (n == _n_range))
+        return;
+    _first = first;
+    _n_range = n;
+    err_code = clSetKernelArg(_kernel,
+                              2,
+                              sizeof(unsigned int),
+                              (void*)&_first);
+    err_code |= clSetKernelArg(_kernel,
+                               3,
+                               sizeof(unsigned int),
+                               (void*)&_n_range);
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure sending the range to the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+}
+
+cl_event UnSortBatch::_execute(const std::vector<cl_event> events)
+{
+    cl_int err_code;
+    cl_event event;
+    CalcServer *C = CalcServer::singleton();
+
+    setVariables();
+
+    // The outputs shall not be overwritten while they are being downloaded
+    std::vector<cl_event> wait_events(events);
+    std::vector<cl_event> readers;
+    for(auto unsorter : _unsorters){
+        std::vector<cl_event> r = unsorter->takeReaders();
+        readers.insert(readers.end(), r.begin(), r.end());
+    }
+    wait_events.insert(wait_events.end(), readers.begin(), readers.end());
+
+    err_code = clEnqueueNDRangeKernel(C->command_queue(),
+                                      _kernel,
+                                      1,
+                                      NULL,
+                                      &_global_work_size,
+                                      &_local_work_size,
+                                      wait_events.size(),
+                                      wait_events.size() ?
+                                          wait_events.data() : NULL,
+                                      &event);
+    for(auto reader : readers)
+        clReleaseEvent(reader);
+    if(err_code != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "Failure executing the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL execution error");
+    }
+
+    return event;
+}
+
+/** @brief Get the OpenCL type of the words to copy the components of an
+ * array.
+ * @param typesize Size of each component, in bytes.
+ * @param words Number of words of each component.
+ * @return The word type.
+ */
+static const std::string wordType(size_t typesize, unsigned int &words)
+{
+    if(!(typesize % sizeof(cl_uint4))){
+        words = typesize / sizeof(cl_uint4);
+        return "uint4";
+    }
+    if(!(typesize % sizeof(cl_uint))){
+        words = typesize / sizeof(cl_uint);
+        return "uint";
+    }
+    words = typesize / sizeof(cl_ushort);
+    return "ushort";
+}
+
+void UnSortBatch::setupOpenCL()
+{
+    unsigned int i, j;
+    cl_int err_code;
+    CalcServer *C = CalcServer::singleton();
+
+    // Generate the kernel, with an input and an output argument per array
+    std::ostringstream args, body;
+    for(i = 0; i < _unsorters.size(); i++){
+        unsigned int words;
+        const std::string word = wordType(
+            InputOutput::Variables::typeToBytes(_unsorters.at(i)->input()->type()),
+            words);
+        args << "," << std::endl
+             << "                     const __global " << word
+             << " *input" << i << "," << std::endl
+             << "                     __global " << word << " *output" << i;
+        for(j = 0; j < words; j++){
+            body << "    output" << i << "[" << words << " * j + " << j
+                 << "] = input" << i << "[" << words << " * i + " << j
+                 << "];" << std::endl;
+        }
+    }
+    std::ostringstream source;
+    source << "__kernel void unsort(const __global unsigned int *id," << std::endl
+           << "                     unsigned int N," << std::endl
+           << "                     unsigned int first," << std::endl
+           << "                     unsigned int n"
+           << args.str() << ")" << std::endl
+           << "{" << std::endl
+           << "    const unsigned int i = get_global_id(0);" << std::endl
+           << "    if(i >= N)" << std::endl
+           << "        return;" << std::endl
+           << "    const unsigned int j = id[i];" << std::endl
+           << "    if((j < first) || (j - first >= n))" << std::endl
+           << "        return;" << std::endl
+           << body.str()
+           << "}" << std::endl;
+    _kernel = compile_kernel(source.str(), "unsort", "");
+
+    err_code = clGetKernelWorkGroupInfo(_kernel,
+                                        C->device(),
+                                        CL_KERNEL_WORK_GROUP_SIZE,
+                                        sizeof(size_t),
+                                        &_local_work_size,
+                                        NULL);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Failure querying the work group size.\n");
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+    if(_local_work_size < __CL_MIN_LOCALSIZE__){
+        std::stringstream msg;
+        LOG(L_ERROR, "UnSort cannot be performed.\n");
+        msg << "\t" << _local_work_size
+            << " elements can be executed, but __CL_MIN_LOCALSIZE__="
+            << __CL_MIN_LOCALSIZE__ << std::endl;
+        LOG0(L_DEBUG, msg.str());
+        throw std::runtime_error("OpenCL error");
+    }
+    _global_work_size = roundUp(_n, _local_work_size);
+
+    err_code = clSetKernelArg(_kernel,
+                              0,
+                              _id_var->typesize(),
+                              _id_var->get());
+    err_code |= clSetKernelArg(_kernel,
+                               1,
+                               sizeof(unsigned int),
+                               (void*)&_n);
+    err_code |= clSetKernelArg(_kernel,
+                               2,
+                               sizeof(unsigned int),
+                               (void*)&_first);
+    err_code |= clSetKernelArg(_kernel,
+                               3,
+                               sizeof(unsigned int),
+                               (void*)&_n_range);
+    _id_input = *(cl_mem*)_id_var->get();
+    for(i = 0; i < _unsorters.size(); i++){
+        InputOutput::ArrayVariable *var = _unsorters.at(i)->input();
+        cl_mem output = _unsorters.at(i)->output();
+        err_code |= clSetKernelArg(_kernel,
+                                   4 + 2 * i,
+                                   var->typesize(),
+                                   var->get());
+        err_code |= clSetKernelArg(_kernel,
+                                   5 + 2 * i,
+                                   sizeof(cl_mem),
+                                   (void*)&output);
+        _inputs.push_back(*(cl_mem*)var->get());
+    }
+    if(err_code != CL_SUCCESS){
+        std::stringstream msg;
+        msg << "Failure sending the arguments to the tool \"" <<
+               name() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        InputOutput::Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+}
+
+void UnSortBatch::setVariables()
+{
+    cl_int err_code;
+
+    if(_id_input != *(cl_mem*)_id_var->get()){
+        err_code = clSetKernelArg(_kernel,
+                                  0,
+                                  _id_var->typesize(),
+                                  _id_var->get());
+        if(err_code != CL_SUCCESS) {
+            std::stringstream msg;
+            msg << "Failure setting the variable \"" << _id_var->name()
+                << "\" to the tool \"" << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        _id_input = *(cl_mem *)_id_var->get();
+    }
+    for(unsigned int i = 0; i < _unsorters.size(); i++){
+        InputOutput::ArrayVariable *var = _unsorters.at(i)->input();
+        if(_inputs.at(i) == *(cl_mem*)var->get())
+            continue;
+        err_code = clSetKernelArg(_kernel,
+                                  4 + 2 * i,
+                                  var->typesize(),
+                                  var->get());
+        if(err_code != CL_SUCCESS) {
+            std::stringstream msg;
+            msg << "Failure setting the variable \"" << var->name()
+                << "\" to the tool \"" << name() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            InputOutput::Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        _inputs.at(i) = *(cl_mem *)var->get();
+    }
+}
+
+}}  // namespaces
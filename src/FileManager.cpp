@@ -25,16 +25,58 @@
 #include <InputOutput/Logger.h>
 #include <InputOutput/ASCII.h>
 #include <InputOutput/FastASCII.h>
+#include <InputOutput/Binary.h>
+#include <iomanip>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <AuxiliarMethods.h>
 #ifdef HAVE_VTK
     #include <InputOutput/VTK.h>
 #endif // HAVE_VTK
+#ifdef HAVE_HDF5
+    #include <InputOutput/HDF5.h>
+#endif // HAVE_HDF5
 
 namespace Aqua{ namespace InputOutput{
 
+/** @brief Look for the latest checkpoint file
+ * @param basename The checkpoint files base name
+ * @return The latest checkpoint file path, an empty string if none is found
+ * @see Aqua::newFilePath()
+ */
+static std::string latestCheckpoint(const std::string &basename)
+{
+    const std::string filepath = setStrConstantsCopy(
+        replaceAllCopy(basename, "%d", "{index}"));
+    if(filepath.find("{index}") == std::string::npos){
+        // The checkpoint is always overwritten
+        return isFile(filepath) ? filepath : "";
+    }
+
+    // Same indexes than newFilePath()
+    std::string latest = "";
+    for(unsigned int i = 0; ; i++){
+        std::ostringstream number_str;
+        number_str << std::setfill('0') << std::setw(5) << i;
+        const std::string path = replaceAllCopy(filepath,
+                                                "{index}",
+                                                number_str.str());
+        if(!isFile(path))
+            break;
+        latest = path;
+    }
+    return latest;
+}
+
 FileManager::FileManager()
     : _state()
     , _simulation()
     , _in_file("Input.xml")
+    , _restart(false)
+    , _writers(NULL)
+    , _trace(NULL)
+    , _checkpoint(NULL)
 {
 }
 
@@ -46,6 +88,9 @@ FileManager::~FileManager()
     for(auto saver : _savers) {
         delete saver;
     }
+    if(_checkpoint) delete _checkpoint; _checkpoint = NULL;
+    if(_writers) delete _writers; _writers = NULL;
+    if(_trace) delete _trace; _trace = NULL;
 }
 
 void FileManager::inputFile(std::string path)
@@ -64,6 +109,19 @@ CalcServer::CalcServer* FileManager::load()
         throw std::runtime_error("No particles sets");
     }
 
+    // The trace is created before the writers, so their threads can be named
+    if(_simulation.settings.trace_path != "") {
+        _trace = new Trace(_simulation.settings.trace_path,
+                           _simulation.settings.trace_start,
+                           _simulation.settings.trace_iters,
+                           _simulation.settings.trace_buffer);
+    }
+
+    // Launch the writers, used by the savers and the reports
+    _writers = new Writers(_simulation.settings.writers_threads,
+                           _simulation.settings.writers_queue,
+                           _simulation.settings.writers_memory);
+
     // Prepare the loaders/savers
     unsigned int i = 0, offset = 0;
     for(auto set : _simulation.sets){
@@ -75,6 +133,19 @@ CalcServer::CalcServer* FileManager::load()
             FastASCII *loader = new FastASCII(_simulation, i, offset, set->n());
             _loaders.push_back((Particles*)loader);
         }
+        else if(!set->inputFormat().compare("Binary")) {
+            Binary *loader = new Binary(_simulation, i, offset, set->n());
+            _loaders.push_back((Particles*)loader);
+        }
+        else if(!set->inputFormat().compare("HDF5")) {
+            #ifdef HAVE_HDF5
+                HDF5 *loader = new HDF5(_simulation, i, offset, set->n());
+                _loaders.push_back((Particles*)loader);
+            #else
+                LOG(L_ERROR, "AQUAgpusph has been compiled without HDF5 format.\n");
+                throw std::runtime_error("HDF5 support is disabled");
+            #endif // HAVE_HDF5
+        }
         else if(!set->inputFormat().compare("VTK")) {
             #ifdef HAVE_VTK
                 VTK *loader = new VTK(_simulation, i, offset, set->n());
@@ -106,6 +177,19 @@ CalcServer::CalcServer* FileManager::load()
             ASCII *saver = new ASCII(_simulation, i, offset, set->n());
             _savers.push_back((Particles*)saver);
         }
+        else if(!set->outputFormat().compare("Binary")) {
+            Binary *saver = new Binary(_simulation, i, offset, set->n());
+            _savers.push_back((Particles*)saver);
+        }
+        else if(!set->outputFormat().compare("HDF5")) {
+            #ifdef HAVE_HDF5
+                HDF5 *saver = new HDF5(_simulation, i, offset, set->n());
+                _savers.push_back((Particles*)saver);
+            #else
+                LOG(L_ERROR, "AQUAgpusph has been compiled without HDF5 format.\n");
+                throw std::runtime_error("HDF5 support is disabled");
+            #endif // HAVE_HDF5
+        }
         else if(!set->outputFormat().compare("VTK")) {
             #ifdef HAVE_VTK
                 VTK *saver = new VTK(_simulation, i, offset, set->n());
@@ -129,14 +213,84 @@ CalcServer::CalcServer* FileManager::load()
     // Build the calculation server
     CalcServer::CalcServer *C = new CalcServer::CalcServer(_simulation);
 
-    // Execute the loaders
-    for(auto loader : _loaders) {
-        loader->load();
+    // Execute the loaders, or restore everything from the checkpoint
+    _checkpoint = new Checkpoint(_simulation);
+    if(_restart) {
+        const std::string path = latestCheckpoint(
+            _simulation.settings.checkpoint_path);
+        if(path == "") {
+            LOG(L_WARNING, "No checkpoint found to restart from.\n");
+        }
+        else {
+            _simulation.settings.restart_path = path;
+        }
+    }
+    if(_simulation.settings.restart_path != "") {
+        _checkpoint->load(
+            setStrConstantsCopy(_simulation.settings.restart_path));
+        // The next saved XML files are resuming from the particles files,
+        // unless they are written with a newer checkpoint
+        _simulation.settings.restart_path = "";
+        return C;
     }
+    loadSets();
 
     return C;
 }
 
+void FileManager::loadSets()
+{
+    // The thread safe loaders are concurrently executed in a pool of threads,
+    // while the other ones are sequentially executed, in the same order in
+    // all the processes
+    std::vector<Particles*> loaders;
+    for(auto loader : _loaders) {
+        if(loader->concurrentLoad())
+            loaders.push_back(loader);
+    }
+    std::vector<std::exception_ptr> errors(_loaders.size());
+    std::atomic<unsigned int> next(0);
+    auto worker = [&loaders, &errors, &next]{
+        unsigned int i;
+        while((i = next++) < loaders.size()) {
+            try {
+                loaders.at(i)->load();
+            } catch(...) {
+                errors.at(i) = std::current_exception();
+            }
+        }
+    };
+    unsigned int n_threads = std::thread::hardware_concurrency();
+    n_threads = std::max(1u, std::min(n_threads,
+                                      (unsigned int)loaders.size()));
+    std::vector<std::thread> threads;
+    if(loaders.size()) {
+        for(unsigned int i = 0; i < n_threads; i++)
+            threads.push_back(std::thread(worker));
+    }
+
+    unsigned int i = loaders.size();
+    for(auto loader : _loaders) {
+        if(loader->concurrentLoad())
+            continue;
+        try {
+            loader->load();
+        } catch(...) {
+            errors.at(i) = std::current_exception();
+            break;
+        }
+        i++;
+    }
+
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    for(auto error : errors) {
+        if(error)
+            std::rethrow_exception(error);
+    }
+}
+
 void FileManager::save(float t)
 {
     // Execute the savers
@@ -148,12 +302,24 @@ void FileManager::save(float t)
     _state.save(_simulation, _savers);
 }
 
+void FileManager::checkpoint(float t)
+{
+    // The XML definition file is resuming from the new checkpoint
+    _simulation.settings.restart_path = _checkpoint->save(t);
+    _state.save(_simulation, _savers);
+    _simulation.settings.restart_path = "";
+}
+
 void FileManager::waitForSavers()
 {
     LOG(L_INFO, "Waiting for the writers...\n");
     for(auto saver : _savers) {
         saver->waitForSavers();
     }
+    if(_writers) {
+        _writers->wait();
+        _writers->stats();
+    }
 }
 
 }}  // namespace
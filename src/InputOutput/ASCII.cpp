@@ -24,6 +24,7 @@
 
 #include <InputOutput/ASCII.h>
 #include <InputOutput/Logger.h>
+#include <InputOutput/Writers.h>
 #include <ProblemSetup.h>
 #include <CalcServer.h>
 #include <AuxiliarMethods.h>
@@ -55,10 +56,8 @@ ASCII::~ASCII()
 void ASCII::load()
 {
     std::ifstream f;
-    cl_int err_code;
     char *pos = NULL;
     unsigned int n, N, n_fields;
-    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
 
     loadDefault();
 
@@ -88,64 +87,9 @@ void ASCII::load()
         throw std::runtime_error("Invalid number of particles in file");
     }
 
-    // Check the fields to read
+    // Check the fields to read, and setup an storage
     std::vector<std::string> fields = simData().sets.at(setId())->inputFields();
-    if(!fields.size()){
-        LOG(L_ERROR, "0 fields were set to be read from the file.\n");
-        throw std::runtime_error("No fields have to be read");
-    }
-    bool have_r = false;
-    for(auto field : fields){
-        if(!field.compare("r")){
-            have_r = true;
-            break;
-        }
-    }
-    if(!have_r){
-        LOG(L_ERROR, "\"r\" field was not set to be read from the file.\n");
-        throw std::runtime_error("Reading \"r\" field is mandatory");
-    }
-    // Setup an storage
-    std::vector<void*> data;
-    Variables *vars = C->variables();
-    n_fields = 0;
-    for(auto field : fields){
-        if(!vars->get(field)){
-            std::ostringstream msg;
-            msg << "Undeclared variable \"" << field
-                << "\" set to be read." << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::runtime_error("Invalid variable");
-        }
-        if(vars->get(field)->type().find('*') == std::string::npos){
-            std::ostringstream msg;
-            msg << "Can't read scalar variable \"" << field
-                << "\"." << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::runtime_error("Invalid variable type");
-        }
-        ArrayVariable *var = (ArrayVariable*)vars->get(field);
-        n_fields += vars->typeToN(var->type());
-        size_t typesize = vars->typeToBytes(var->type());
-        size_t len = var->size() / typesize;
-        if(len < bounds().y) {
-            std::ostringstream msg;
-            msg << "Array variable \"" << field
-                << "\" is not long enough." << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::runtime_error("Invalid variable length");
-        }
-        void *store = malloc(typesize * n);
-        if(!store){
-            std::ostringstream msg;
-            msg << "Failure allocating " << typesize * n
-                << "bytes for variable \"" << field
-                << "\"." << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::bad_alloc();
-        }
-        data.push_back(store);
-    }
+    std::vector<void*> data = allocFields(fields, n_fields);
 
     // Read the particles
     f.clear();
@@ -188,49 +132,29 @@ void ASCII::load()
     }
 
     // Send the data to the server and release it
-    i = 0;
-    for(auto field : fields){
-        ArrayVariable *var = (ArrayVariable*)vars->get(field);
-        size_t typesize = vars->typeToBytes(var->type());
-        cl_mem mem = *(cl_mem*)var->get();
-        err_code = clEnqueueWriteBuffer(C->command_queue(),
-                                        mem,
-                                        CL_TRUE,
-                                        typesize * bounds().x,
-                                        typesize * n,
-                                        data.at(i),
-                                        0,
-                                        NULL,
-                                        NULL);
-        free(data.at(i)); data.at(i) = NULL;
-        if(err_code != CL_SUCCESS){
-            std::ostringstream msg;
-            msg << "Failure sending variable \"" << field
-                << "\" to the server." << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::runtime_error("OpenCL error");
-        }
-        i++;
-    }
-    data.clear();
+    uploadFields(fields, data);
 
     f.close();
 }
 
-void ASCII::save(float t)
+/** @brief Write the data, in a parallel thread
+ * @param f_ptr File to be written. It is closed and destroyed afterwards.
+ * @param t Simulation time
+ * @param types Type of each field
+ * @param data Downloaded data of each field. It is released afterwards.
+ * @param events Download events of each field, waited before writing the
+ * data
+ * @param n Number of particles
+ */
+static void writeASCII(std::ofstream *f_ptr,
+                       float t,
+                       const std::vector<std::string> types,
+                       std::vector<void*> data,
+                       const std::vector<cl_event> events,
+                       unsigned int n)
 {
     unsigned int i, j;
-    cl_int err_code;
-    Variables *vars = CalcServer::CalcServer::singleton()->variables();
-
-    std::vector<std::string> fields = simData().sets.at(setId())->outputFields();
-    if(!fields.size()){
-        LOG(L_ERROR, "0 fields were set to be saved into the file.\n");
-        throw std::runtime_error("No fields have been set to be saved");
-    }
-
-    std::ofstream f;
-    create(f);
+    std::ofstream &f = *f_ptr;
 
     // Write a head
     f << "#########################################################" << std::endl;
@@ -251,44 +175,29 @@ void ASCII::save(float t)
     f << "#" << std::endl;
     f << "#########################################################" << std::endl;
     f << std::endl;
-    f.flush();
+
+    // All the fields are written in each line, so they are waited at once
+    bool downloaded = true;
+    for(auto event : events)
+        downloaded = Particles::waitForDownload(event) && downloaded;
+    if(!downloaded)
+        n = 0;
 
     // Set the precision as the maximum for float numbers
     const auto max_precision = std::numeric_limits<float>::digits10 + 1;
 
-    for(auto field : fields){
-        if(!vars->get(field)){
-            std::ostringstream msg;
-            msg << "Can't save undeclared variable \"" << field
-                << "\"." << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::runtime_error("Invalid variable");
-        }
-        if(vars->get(field)->type().find('*') == std::string::npos){
-            std::ostringstream msg;
-            msg << "Can't save scalar variable \"" << field
-                << "\"." << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::runtime_error("Invalid variable type");
-        }
-        ArrayVariable *var = (ArrayVariable*)vars->get(field);
-        size_t typesize = vars->typeToBytes(var->type());
-        size_t len = var->size() / typesize;
-        if(len < bounds().y){
-            std::ostringstream msg;
-            msg << "Variable \"" << field
-                << "\" is not long enough." << std::endl;
-            LOG(L_ERROR, msg.str());
-            throw std::runtime_error("Invalid variable length");
-        }
-    }
-    std::vector<void*> data = download(fields);
-
-    for(i = 0; i < bounds().y - bounds().x; i++){
-        for(j = 0; j < fields.size(); j++){
-            ArrayVariable *var = (ArrayVariable*)vars->get(fields.at(j).c_str());
-            std::string type_name = var->type();
-            if(!type_name.compare("int*")){
+    for(i = 0; i < n; i++){
+        for(j = 0; j < types.size(); j++){
+            const std::string type_name = types.at(j);
+            if(Variables::isHalfType(type_name)){
+                const unsigned int n_comps = Variables::typeToN(type_name);
+                cl_half* v = (cl_half*)data.at(j) + i * n_comps;
+                f << std::setprecision(max_precision);
+                for(unsigned int k = 0; k < n_comps; k++){
+                    f << halfToFloat(v[k]) << ((k + 1 < n_comps) ? " " : ",");
+                }
+            }
+            else if(!type_name.compare("int*")){
                 int* v = (int*)data.at(j);
                 f << v[i] << ",";
             }
@@ -377,6 +286,21 @@ void ASCII::save(float t)
                       << v[i].y << ",";
                 #endif // HAVE_3D
             }
+            else if(!type_name.compare("pvec*")){
+                // Packed components, i.e. cl_float3 cannot be used
+                #ifdef HAVE_3D
+                    float* v = (float*)data.at(j) + 3 * i;
+                    f << std::setprecision(max_precision)
+                      << v[0] << " "
+                      << v[1] << " "
+                      << v[2] << ",";
+                #else
+                    vec* v = (vec*)data.at(j);
+                    f << std::setprecision(max_precision)
+                      << v[i].x << " "
+                      << v[i].y << ",";
+                #endif // HAVE_3D
+            }
             else if(!type_name.compare("vec2*")){
                 vec2* v = (vec2*)data.at(j);
                 f << std::setprecision(max_precision)
@@ -415,15 +339,191 @@ void ASCII::save(float t)
             }
         }
         f << std::endl;
-        f.flush();
     }
 
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
     for(auto d : data){
-        free(d);
+        C->releasePinned(d);
     }
     data.clear();
 
     f.close();
+    delete f_ptr;
+}
+
+void ASCII::save(float t)
+{
+    Variables *vars = CalcServer::CalcServer::singleton()->variables();
+
+    std::vector<std::string> fields = simData().sets.at(setId())->outputFields();
+    if(!fields.size()){
+        LOG(L_ERROR, "0 fields were set to be saved into the file.\n");
+        throw std::runtime_error("No fields have been set to be saved");
+    }
+
+    for(auto field : fields){
+        if(!vars->get(field)){
+            std::ostringstream msg;
+            msg << "Can't save undeclared variable \"" << field
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+        if(vars->get(field)->type().find('*') == std::string::npos){
+            std::ostringstream msg;
+            msg << "Can't save scalar variable \"" << field
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable type");
+        }
+        ArrayVariable *var = (ArrayVariable*)vars->get(field);
+        size_t typesize = vars->typeToBytes(var->type());
+        size_t len = var->size() / typesize;
+        if(len < bounds().y){
+            std::ostringstream msg;
+            msg << "Variable \"" << field
+                << "\" is not long enough." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable length");
+        }
+    }
+    std::vector<cl_event> events;
+    std::vector<void*> data = download(fields, events);
+    std::vector<std::string> types;
+    size_t memory = 0;
+    for(auto field : fields){
+        types.push_back(vars->get(field)->type());
+        memory += vars->typeToBytes(types.back()) * nDownloaded();
+    }
+
+    std::ofstream *f = new std::ofstream();
+    try {
+        create(*f);
+    } catch(...) {
+        CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+        for(unsigned int i = 0; i < data.size(); i++){
+            waitForDownload(events.at(i));
+            C->releasePinned(data.at(i));
+        }
+        delete f;
+        throw;
+    }
+
+    const unsigned int n_parts = nDownloaded();
+    Writers::singleton()->enqueue(
+        [f, t, types, data, events, n_parts]{
+            writeASCII(f, t, types, data, events, n_parts);
+        }, memory);
+}
+
+std::vector<void*> ASCII::allocFields(const std::vector<std::string> fields,
+                                      unsigned int &n_fields)
+{
+    const unsigned int n = bounds().y - bounds().x;
+    Variables *vars = CalcServer::CalcServer::singleton()->variables();
+
+    if(!fields.size()){
+        LOG(L_ERROR, "0 fields were set to be read from the file.\n");
+        throw std::runtime_error("No fields have to be read");
+    }
+    bool have_r = false;
+    for(auto field : fields){
+        if(!field.compare("r")){
+            have_r = true;
+            break;
+        }
+    }
+    if(!have_r){
+        LOG(L_ERROR, "\"r\" field was not set to be read from the file.\n");
+        throw std::runtime_error("Reading \"r\" field is mandatory");
+    }
+    // Setup an storage
+    std::vector<void*> data;
+    n_fields = 0;
+    for(auto field : fields){
+        if(!vars->get(field)){
+            std::ostringstream msg;
+            msg << "Undeclared variable \"" << field
+                << "\" set to be read." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable");
+        }
+        if(vars->get(field)->type().find('*') == std::string::npos){
+            std::ostringstream msg;
+            msg << "Can't read scalar variable \"" << field
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable type");
+        }
+        ArrayVariable *var = (ArrayVariable*)vars->get(field);
+        n_fields += vars->typeToN(var->type());
+        size_t typesize = vars->typeToBytes(var->type());
+        size_t len = var->size() / typesize;
+        if(len < bounds().y) {
+            std::ostringstream msg;
+            msg << "Array variable \"" << field
+                << "\" is not long enough." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid variable length");
+        }
+        void *store = malloc(typesize * n);
+        if(!store){
+            std::ostringstream msg;
+            msg << "Failure allocating " << typesize * n
+                << "bytes for variable \"" << field
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::bad_alloc();
+        }
+        data.push_back(store);
+    }
+    return data;
+}
+
+void ASCII::uploadFields(const std::vector<std::string> fields,
+                         std::vector<void*> &data)
+{
+    unsigned int i;
+    cl_int err_code;
+    const unsigned int n = bounds().y - bounds().x;
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    Variables *vars = C->variables();
+
+    // All the fields are simultaneously sent
+    std::vector<cl_event> events;
+    i = 0;
+    for(auto field : fields){
+        ArrayVariable *var = (ArrayVariable*)vars->get(field);
+        size_t typesize = vars->typeToBytes(var->type());
+        cl_mem mem = *(cl_mem*)var->get();
+        cl_event event;
+        err_code = C->writeBuffer(C->command_queue(),
+                                  mem,
+                                  CL_FALSE,
+                                  typesize * bounds().x,
+                                  typesize * n,
+                                  data.at(i),
+                                  0,
+                                  NULL,
+                                  &event);
+        if(err_code != CL_SUCCESS){
+            std::ostringstream msg;
+            msg << "Failure sending variable \"" << field
+                << "\" to the server." << std::endl;
+            LOG(L_ERROR, msg.str());
+            waitForUploads(events);
+            for(auto d : data)
+                free(d);
+            data.clear();
+            throw std::runtime_error("OpenCL error");
+        }
+        events.push_back(event);
+        i++;
+    }
+    waitForUploads(events);
+    for(auto d : data)
+        free(d);
+    data.clear();
 }
 
 const unsigned int ASCII::compute_n()
@@ -450,15 +550,15 @@ unsigned int ASCII::readNParticles(std::ifstream& f)
     f.clear();
     f.seekg(0);
 
+    // Just look for a character which is not a separator before the comment
+    // start, which is way faster than formatting the line
     std::string line;
     unsigned int n=0;
     while(getline(f, line))
     {
-        formatLine(line);
-        if(line == "")
-            continue;
-
-        n++;
+        const std::string::size_type end = line.find('#');
+        if(line.find_first_not_of(" ,;()[]{}\t\r") < end)
+            n++;
     }
 
     return n;
@@ -0,0 +1,488 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Particles binary data files loader/saver.
+ * (See Aqua::InputOutput::Binary for details)
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <InputOutput/Binary.h>
+#include <InputOutput/Logger.h>
+#include <InputOutput/Writers.h>
+#include <ProblemSetup.h>
+#include <CalcServer.h>
+#include <AuxiliarMethods.h>
+
+namespace Aqua{ namespace InputOutput{
+
+/// Signature of the binary files
+static const std::string signature = "AQUAgpusph binary";
+
+/// Field described in the header of a binary file
+typedef struct {
+    /// Field name
+    std::string name;
+    /// AQUAgpusph type
+    std::string type;
+    /// Number of components
+    unsigned int n;
+    /// Size of each particle in bytes
+    size_t type_size;
+    /// Offset of the data block from the file start
+    size_t offset;
+} BinaryField;
+
+/** @brief Round up a size to a multiple of #BINARY_ALIGNMENT
+ * @param size Size in bytes
+ * @return Aligned size
+ */
+static inline size_t align(size_t size)
+{
+    return ((size + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT) * BINARY_ALIGNMENT;
+}
+
+/** @brief Get the numpy data type of the components of a type
+ * @param type AQUAgpusph type
+ * @return numpy data type, including the host endianness
+ */
+static std::string numpyType(const std::string type)
+{
+    const uint32_t one = 1;
+    const std::string endianness = (*(const char*)&one) ? "<" : ">";
+    const std::string t = trimCopy(type);
+    if(Variables::isHalfType(t))
+        return endianness + "f2";
+    if(!t.find("unsigned") || !t.find("uivec"))
+        return endianness + "u4";
+    if(!t.find("int") || !t.find("ivec"))
+        return endianness + "i4";
+    return endianness + "f4";
+}
+
+/** @brief Build the header of a binary file
+ * @param n Number of particles
+ * @param t Simulation time
+ * @param fields Fields to be written. The offsets shall be already set, if
+ * the header is not just built to know its length.
+ * @return The header text, with a length multiple of #BINARY_ALIGNMENT
+ */
+static std::string header(unsigned int n,
+                          float t,
+                          const std::vector<BinaryField> &fields)
+{
+    std::ostringstream head;
+    head << signature << std::endl;
+    head << "n " << n << std::endl;
+    head << "t " << std::setprecision(std::numeric_limits<float>::digits10 + 1)
+         << t << std::endl;
+    // The offsets have a fixed width, such that the header length does not
+    // depend on them
+    for(auto field : fields){
+        head << "field " << field.name << " " << field.n << " "
+             << field.type_size << " "
+             << std::setfill('0') << std::setw(16) << field.offset << " "
+             << std::setfill(' ') << numpyType(field.type) << " "
+             << field.type << std::endl;
+    }
+    head << "end";
+    const size_t len = head.str().size() + 1;
+    head << std::string(align(len) - len, ' ') << std::endl;
+    return head.str();
+}
+
+/** @brief Parse the header of a binary file
+ * @param text File contents
+ * @param len File length
+ * @param n Number of particles
+ * @param fields Fields stored in the file
+ * @return true if the header is valid, false otherwise
+ */
+static bool parseHeader(const char *text,
+                        size_t len,
+                        unsigned int &n,
+                        std::vector<BinaryField> &fields)
+{
+    const char *p = text, *end = text + len;
+    bool first = true;
+    n = 0;
+    while(p < end){
+        const char *eol = (const char*)memchr(p, '\n', end - p);
+        if(!eol)
+            return false;
+        const std::string line(p, eol);
+        p = eol + 1;
+        if(first){
+            if(line.compare(signature))
+                return false;
+            first = false;
+            continue;
+        }
+        std::istringstream words(line);
+        std::string key;
+        words >> key;
+        if(!key.compare("end"))
+            return true;
+        if(!key.compare("n"))
+            words >> n;
+        else if(!key.compare("field")){
+            BinaryField field;
+            std::string dtype;
+            words >> field.name >> field.n >> field.type_size >> field.offset
+                  >> dtype;
+            getline(words, field.type);
+            field.type = trimCopy(field.type);
+            if(field.name.empty() || field.type.empty() || !field.type_size)
+                return false;
+            fields.push_back(field);
+        }
+    }
+    return false;
+}
+
+Binary::Binary(ProblemSetup& sim_data,
+               unsigned int iset,
+               unsigned int first,
+               unsigned int n_in)
+    : Particles(sim_data, iset, first, n_in)
+    , _next_file_index(0)
+{
+    if(n() == 0) {
+        n(compute_n());
+    }
+}
+
+Binary::~Binary()
+{
+}
+
+void Binary::load()
+{
+    unsigned int i;
+    cl_int err_code;
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    Variables *vars = C->variables();
+
+    loadDefault();
+
+    const std::string path = simData().sets.at(setId())->inputPath();
+    std::ostringstream msg;
+    msg << "Loading particles from binary file \"" << path
+        << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    // Map the file in memory
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if((fd < 0) || fstat(fd, &st) || !st.st_size) {
+        std::ostringstream msg;
+        msg << "Failure reading the file \"" << path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        if(fd >= 0)
+            close(fd);
+        throw std::ifstream::failure(msg.str());
+    }
+    const size_t len = st.st_size;
+    char *text = (char*)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(text == MAP_FAILED) {
+        std::ostringstream msg;
+        msg << "Failure mapping the file \"" << path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::ifstream::failure(msg.str());
+    }
+
+    unsigned int N;
+    std::vector<BinaryField> file_fields;
+    if(!parseHeader(text, len, N, file_fields)){
+        std::ostringstream msg;
+        msg << "\"" << path << "\" is not a valid binary file." << std::endl;
+        LOG(L_ERROR, msg.str());
+        munmap(text, len);
+        throw std::runtime_error("Bad formatted file");
+    }
+
+    // Assert that the number of particles is right
+    const unsigned int n = bounds().y - bounds().x;
+    if(n != N){
+        std::ostringstream msg;
+        msg << "Expected " << n << " particles, but the file contains just "
+            << N << " ones." << std::endl;
+        LOG(L_ERROR, msg.str());
+        munmap(text, len);
+        throw std::runtime_error("Invalid number of particles in file");
+    }
+
+    // Check the fields to read
+    std::vector<std::string> fields = simData().sets.at(setId())->inputFields();
+    if(!fields.size()){
+        LOG(L_ERROR, "0 fields were set to be read from the file.\n");
+        munmap(text, len);
+        throw std::runtime_error("No fields have to be read");
+    }
+    bool have_r = false;
+    for(auto field : fields){
+        if(!field.compare("r")){
+            have_r = true;
+            break;
+        }
+    }
+    if(!have_r){
+        LOG(L_ERROR, "\"r\" field was not set to be read from the file.\n");
+        munmap(text, len);
+        throw std::runtime_error("Reading \"r\" field is mandatory");
+    }
+
+    // Send the blocks straight to the device. The file shall remain mapped
+    // until all of them are sent
+    std::vector<cl_event> events;
+    for(auto field : fields){
+        if(!vars->get(field) ||
+           (vars->get(field)->type().find('*') == std::string::npos)){
+            std::ostringstream msg;
+            msg << "Undeclared array variable \"" << field
+                << "\" set to be read." << std::endl;
+            LOG(L_ERROR, msg.str());
+            waitForUploads(events);
+            munmap(text, len);
+            throw std::runtime_error("Invalid variable");
+        }
+        ArrayVariable *var = (ArrayVariable*)vars->get(field);
+        size_t typesize = vars->typeToBytes(var->type());
+        if(var->size() / typesize < bounds().y) {
+            std::ostringstream msg;
+            msg << "Array variable \"" << field
+                << "\" is not long enough." << std::endl;
+            LOG(L_ERROR, msg.str());
+            waitForUploads(events);
+            munmap(text, len);
+            throw std::runtime_error("Invalid variable length");
+        }
+
+        const BinaryField *file_field = NULL;
+        for(i = 0; i < file_fields.size(); i++){
+            if(!file_fields.at(i).name.compare(field)){
+                file_field = &(file_fields.at(i));
+                break;
+            }
+        }
+        if(!file_field){
+            std::ostringstream msg;
+            msg << "The field \"" << field << "\" is not stored in the file."
+                << std::endl;
+            LOG(L_ERROR, msg.str());
+            waitForUploads(events);
+            munmap(text, len);
+            throw std::runtime_error("Missing field");
+        }
+        if((file_field->type_size != typesize) ||
+           (file_field->offset + typesize * n > len)){
+            std::ostringstream msg;
+            msg << "The field \"" << field << "\" of type \""
+                << file_field->type << "\" cannot be loaded into the variable"
+                << " of type \"" << var->type() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            waitForUploads(events);
+            munmap(text, len);
+            throw std::runtime_error("Invalid field type");
+        }
+        if(file_field->type.compare(trimCopy(var->type()))){
+            std::ostringstream msg;
+            msg << "The field \"" << field << "\" of type \""
+                << file_field->type << "\" is loaded into a variable of type \""
+                << var->type() << "\"." << std::endl;
+            LOG(L_WARNING, msg.str());
+        }
+
+        cl_mem mem = *(cl_mem*)var->get();
+        cl_event event;
+        err_code = C->writeBuffer(C->command_queue(),
+                                  mem,
+                                  CL_FALSE,
+                                  typesize * bounds().x,
+                                  typesize * n,
+                                  text + file_field->offset,
+                                  0,
+                                  NULL,
+                                  &event);
+        if(err_code != CL_SUCCESS){
+            std::ostringstream msg;
+            msg << "Failure sending variable \"" << field
+                << "\" to the server." << std::endl;
+            LOG(L_ERROR, msg.str());
+            Logger::singleton()->printOpenCLError(err_code);
+            waitForUploads(events);
+            munmap(text, len);
+            throw std::runtime_error("OpenCL error");
+        }
+        events.push_back(event);
+    }
+
+    waitForUploads(events);
+    munmap(text, len);
+}
+
+void Binary::save(float t)
+{
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    Variables *vars = C->variables();
+
+    std::vector<std::string> fields = simData().sets.at(setId())->outputFields();
+    if(!fields.size()){
+        LOG(L_ERROR, "0 fields were set to be saved into the file.\n");
+        throw std::runtime_error("No fields have been set to be saved");
+    }
+
+    // Start downloading the data. The variables are checked there
+    std::vector<cl_event> events;
+    std::vector<void*> data = download(fields, events);
+
+    // Compute the blocks offsets, which are starting after the header
+    const unsigned int n = nDownloaded();
+    std::vector<BinaryField> file_fields;
+    for(auto field : fields){
+        ArrayVariable *var = (ArrayVariable*)vars->get(field);
+        BinaryField file_field;
+        file_field.name = field;
+        file_field.type = trimCopy(var->type());
+        file_field.n = vars->typeToN(var->type());
+        file_field.type_size = vars->typeToBytes(var->type());
+        file_field.offset = 0;
+        file_fields.push_back(file_field);
+    }
+    size_t offset = header(n, t, file_fields).size();
+    for(auto& file_field : file_fields){
+        file_field.offset = offset;
+        offset += align(file_field.type_size * n);
+    }
+    const std::string head = header(n, t, file_fields);
+
+    // Write the file
+    FILE *f = NULL;
+    try {
+        f = create();
+    } catch(...) {
+        for(unsigned int i = 0; i < data.size(); i++){
+            waitForDownload(events.at(i));
+            C->releasePinned(data.at(i));
+        }
+        throw;
+    }
+    size_t memory = 0;
+    std::vector<size_t> blocks;
+    for(auto file_field : file_fields){
+        blocks.push_back(file_field.type_size * n);
+        memory += blocks.back();
+    }
+    const std::string path = file();
+    Writers::singleton()->enqueue([f, head, blocks, data, events, path]{
+        Logger *S = Logger::singleton();
+        CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+        bool failed = fwrite(head.c_str(), 1, head.size(), f) != head.size();
+        const std::vector<char> padding(BINARY_ALIGNMENT, 0);
+        for(unsigned int i = 0; i < blocks.size(); i++){
+            // Each block is written as soon as it is downloaded
+            failed = !waitForDownload(events.at(i)) || failed;
+            if(failed)
+                continue;
+            const size_t block = blocks.at(i);
+            failed = fwrite(data.at(i), 1, block, f) != block;
+            if(!failed && (align(block) != block)){
+                const size_t pad = align(block) - block;
+                failed = fwrite(padding.data(), 1, pad, f) != pad;
+            }
+        }
+        failed = fclose(f) || failed;
+
+        for(auto d : data){
+            C->releasePinned(d);
+        }
+
+        if(failed){
+            std::ostringstream msg;
+            msg << "Failure writing the file \"" << path << "\"." << std::endl;
+            S->addMessageF(L_ERROR, msg.str());
+        }
+    }, memory);
+}
+
+const unsigned int Binary::compute_n()
+{
+    std::ifstream f;
+    f.open(simData().sets.at(setId())->inputPath(), std::ios::binary);
+    if(!f) {
+        std::ostringstream msg;
+        msg << "Failure reading the file \"" <<
+               simData().sets.at(setId())->inputPath() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::ifstream::failure(msg.str());
+    }
+
+    std::string line;
+    unsigned int n = 0;
+    getline(f, line);
+    if(!line.compare(signature)){
+        while(getline(f, line)){
+            std::istringstream words(line);
+            std::string key;
+            words >> key;
+            if(!key.compare("n")){
+                words >> n;
+                break;
+            }
+            if(!key.compare("end"))
+                break;
+        }
+    }
+    f.close();
+    return (const unsigned int)n;
+}
+
+FILE* Binary::create(){
+    std::string basename = simData().sets.at(setId())->outputPath();
+    // Check that {index} scape string is present, for backward compatibility
+    if(basename.find("{index}") == std::string::npos){
+        basename += ".{index}.bin";
+    }
+    _next_file_index = file(basename, _next_file_index);
+
+    std::ostringstream msg;
+    msg << "Writing \"" << file() << "\" binary file..." << std::endl;
+    LOG(L_INFO, msg.str());
+    _next_file_index++;
+
+    FILE *f = fopen(file().c_str(), "wb");
+    if(!f){
+        std::ostringstream msg;
+        msg << "Failure creating the file \"" << file() << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::ofstream::failure(msg.str());
+    }
+    return f;
+}
+
+}}  // namespace
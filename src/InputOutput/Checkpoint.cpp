@@ -0,0 +1,369 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Simulation checkpoints writer/reader.
+ * (See Aqua::InputOutput::Checkpoint for details)
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <InputOutput/Checkpoint.h>
+#include <InputOutput/Binary.h>
+#include <InputOutput/Particles.h>
+#include <InputOutput/Logger.h>
+#include <InputOutput/Writers.h>
+#include <CalcServer.h>
+#include <AuxiliarMethods.h>
+
+namespace Aqua{ namespace InputOutput{
+
+/// Signature of the checkpoint files
+static const std::string signature = "AQUAgpusph checkpoint";
+
+/// Variable described in the header of a checkpoint file
+typedef struct {
+    /// Variable name
+    std::string name;
+    /// AQUAgpusph type
+    std::string type;
+    /// Size of the data block in bytes
+    size_t size;
+    /// Offset of the data block from the file start
+    size_t offset;
+} CheckpointBlock;
+
+/** @brief Round up a size to a multiple of #BINARY_ALIGNMENT
+ * @param size Size in bytes
+ * @return Aligned size
+ */
+static inline size_t align(size_t size)
+{
+    return ((size + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT) * BINARY_ALIGNMENT;
+}
+
+/** @brief Build the header of a checkpoint file
+ * @param t Simulation time
+ * @param blocks Variables to be written. The offsets shall be already set, if
+ * the header is not just built to know its length.
+ * @return The header text, with a length multiple of #BINARY_ALIGNMENT
+ */
+static std::string header(float t, const std::vector<CheckpointBlock> &blocks)
+{
+    std::ostringstream head;
+    head << signature << std::endl;
+    head << "t " << std::setprecision(std::numeric_limits<float>::digits10 + 1)
+         << t << std::endl;
+    // The offsets have a fixed width, such that the header length does not
+    // depend on them
+    for(auto block : blocks){
+        head << "var " << block.name << " "
+             << std::setfill('0') << std::setw(16) << block.offset << " "
+             << std::setfill(' ') << block.size << " "
+             << block.type << std::endl;
+    }
+    head << "end";
+    const size_t len = head.str().size() + 1;
+    head << std::string(align(len) - len, ' ') << std::endl;
+    return head.str();
+}
+
+/** @brief Parse the header of a checkpoint file
+ * @param text File contents
+ * @param len File length
+ * @param t Simulation time
+ * @param blocks Variables stored in the file
+ * @return true if the header is valid, false otherwise
+ */
+static bool parseHeader(const char *text,
+                        size_t len,
+                        float &t,
+                        std::vector<CheckpointBlock> &blocks)
+{
+    const char *p = text, *end = text + len;
+    bool first = true;
+    t = 0.f;
+    while(p < end){
+        const char *eol = (const char*)memchr(p, '\n', end - p);
+        if(!eol)
+            return false;
+        const std::string line(p, eol);
+        p = eol + 1;
+        if(first){
+            if(line.compare(signature))
+                return false;
+            first = false;
+            continue;
+        }
+        std::istringstream words(line);
+        std::string key;
+        words >> key;
+        if(!key.compare("end"))
+            return true;
+        if(!key.compare("t"))
+            words >> t;
+        else if(!key.compare("var")){
+            CheckpointBlock block;
+            words >> block.name >> block.offset >> block.size;
+            getline(words, block.type);
+            block.type = trimCopy(block.type);
+            if(block.name.empty() || block.type.empty() ||
+               (block.offset + block.size > len))
+                return false;
+            blocks.push_back(block);
+        }
+    }
+    return false;
+}
+
+Checkpoint::Checkpoint(ProblemSetup& sim_data)
+    : _sim_data(sim_data)
+    , _next_file_index(0)
+{
+}
+
+Checkpoint::~Checkpoint()
+{
+}
+
+std::string Checkpoint::save(float t)
+{
+    cl_int err_code;
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    Variables *vars = C->variables();
+
+    // Start downloading the arrays, and copy the scalars
+    std::vector<CheckpointBlock> blocks;
+    std::vector<void*> data;
+    std::vector<cl_event> events;
+    size_t memory = 0;
+    for(auto var : vars->getAll()){
+        const size_t size = var->size();
+        if(!size)
+            continue;
+        if(var->isArray() && !(*(cl_mem*)var->get()))
+            continue;
+        void *ptr = C->allocatePinned(size);
+        cl_event event = NULL;
+        if(var->isArray()){
+            cl_event wait_event = var->getEvent();
+            err_code = C->readBuffer(C->command_queue(),
+                                     *(cl_mem*)var->get(),
+                                     CL_FALSE,
+                                     0,
+                                     size,
+                                     ptr,
+                                     1,
+                                     &wait_event,
+                                     &event);
+            if(err_code != CL_SUCCESS){
+                std::ostringstream msg;
+                msg << "Failure downloading the variable \"" << var->name()
+                    << "\" for the checkpoint." << std::endl;
+                LOG(L_ERROR, msg.str());
+                Logger::singleton()->printOpenCLError(err_code);
+                C->releasePinned(ptr);
+                for(unsigned int i = 0; i < data.size(); i++){
+                    Particles::waitForDownload(events.at(i));
+                    C->releasePinned(data.at(i));
+                }
+                throw std::runtime_error("OpenCL error");
+            }
+            // The next tools writing the array shall wait for the download
+            var->setEvent(event);
+        }
+        else{
+            memcpy(ptr, var->get(), size);
+        }
+        CheckpointBlock block;
+        block.name = var->name();
+        block.type = trimCopy(var->type());
+        block.size = size;
+        block.offset = 0;
+        blocks.push_back(block);
+        data.push_back(ptr);
+        events.push_back(event);
+        memory += size;
+    }
+    err_code = clFlush(C->command_queue());
+    if(err_code != CL_SUCCESS){
+        LOG(L_WARNING, "Failure flushing the checkpoint downloads.\n");
+        Logger::singleton()->printOpenCLError(err_code);
+    }
+
+    // Compute the blocks offsets, which are starting after the header
+    size_t offset = header(t, blocks).size();
+    for(auto& block : blocks){
+        block.offset = offset;
+        offset += align(block.size);
+    }
+    const std::string head = header(t, blocks);
+
+    std::string path;
+    try {
+        path = newFilePath(_sim_data.settings.checkpoint_path,
+                           _next_file_index);
+    } catch(std::invalid_argument e) {
+        // No {index} in the path, so the last checkpoint is replaced
+        std::ostringstream msg;
+        _next_file_index = 0;
+        path = setStrConstantsCopy(_sim_data.settings.checkpoint_path);
+        msg << "Overwriting '" << path << "'" << std::endl;
+        LOG(L_WARNING, msg.str());
+    }
+    _next_file_index++;
+    std::ostringstream msg;
+    msg << "Writing \"" << path << "\" checkpoint..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    FILE *f = fopen(path.c_str(), "wb");
+    if(!f){
+        std::ostringstream msg;
+        msg << "Failure creating the file \"" << path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        for(unsigned int i = 0; i < data.size(); i++){
+            Particles::waitForDownload(events.at(i));
+            C->releasePinned(data.at(i));
+        }
+        throw std::ofstream::failure(msg.str());
+    }
+
+    Writers::singleton()->enqueue([f, head, blocks, data, events, path]{
+        Logger *S = Logger::singleton();
+        CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+        bool failed = fwrite(head.c_str(), 1, head.size(), f) != head.size();
+        const std::vector<char> padding(BINARY_ALIGNMENT, 0);
+        for(unsigned int i = 0; i < blocks.size(); i++){
+            failed = !Particles::waitForDownload(events.at(i)) || failed;
+            if(failed)
+                continue;
+            const size_t size = blocks.at(i).size;
+            failed = fwrite(data.at(i), 1, size, f) != size;
+            if(!failed && (align(size) != size)){
+                const size_t pad = align(size) - size;
+                failed = fwrite(padding.data(), 1, pad, f) != pad;
+            }
+        }
+        failed = fclose(f) || failed;
+
+        for(auto d : data){
+            C->releasePinned(d);
+        }
+
+        if(failed){
+            std::ostringstream msg;
+            msg << "Failure writing the checkpoint \"" << path << "\"."
+                << std::endl;
+            S->addMessageF(L_ERROR, msg.str());
+        }
+    }, memory);
+
+    return path;
+}
+
+void Checkpoint::load(const std::string path)
+{
+    cl_int err_code;
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    Variables *vars = C->variables();
+
+    std::ostringstream msg;
+    msg << "Restarting from the checkpoint \"" << path << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    // Map the file in memory
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if((fd < 0) || fstat(fd, &st) || !st.st_size) {
+        std::ostringstream msg;
+        msg << "Failure reading the file \"" << path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        if(fd >= 0)
+            close(fd);
+        throw std::ifstream::failure(msg.str());
+    }
+    const size_t len = st.st_size;
+    char *text = (char*)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(text == MAP_FAILED) {
+        std::ostringstream msg;
+        msg << "Failure mapping the file \"" << path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::ifstream::failure(msg.str());
+    }
+
+    float t;
+    std::vector<CheckpointBlock> blocks;
+    if(!parseHeader(text, len, t, blocks)){
+        std::ostringstream msg;
+        msg << "\"" << path << "\" is not a valid checkpoint file." << std::endl;
+        LOG(L_ERROR, msg.str());
+        munmap(text, len);
+        throw std::runtime_error("Bad formatted file");
+    }
+
+    for(auto block : blocks){
+        Variable *var = vars->get(block.name);
+        if(!var ||
+           block.type.compare(trimCopy(var->type())) ||
+           (block.size != var->size())){
+            std::ostringstream msg;
+            msg << "The variable \"" << block.name << "\" of type \""
+                << block.type << "\" cannot be restored. Skipped" << std::endl;
+            LOG(L_WARNING, msg.str());
+            continue;
+        }
+
+        if(!var->isArray()){
+            var->set(text + block.offset);
+            continue;
+        }
+        err_code = C->writeBuffer(C->command_queue(),
+                                  *(cl_mem*)var->get(),
+                                  CL_TRUE,
+                                  0,
+                                  block.size,
+                                  text + block.offset,
+                                  0,
+                                  NULL,
+                                  NULL);
+        if(err_code != CL_SUCCESS){
+            std::ostringstream msg;
+            msg << "Failure sending variable \"" << block.name
+                << "\" to the server." << std::endl;
+            LOG(L_ERROR, msg.str());
+            Logger::singleton()->printOpenCLError(err_code);
+            munmap(text, len);
+            throw std::runtime_error("OpenCL error");
+        }
+    }
+
+    munmap(text, len);
+
+    msg.str("");
+    msg << "Simulation restarted at t = " << t << " s" << std::endl;
+    LOG(L_INFO, msg.str());
+}
+
+}}  // namespace
@@ -22,18 +22,249 @@
  */
 
 #include <string>
+#include <charconv>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <InputOutput/FastASCII.h>
 #include <InputOutput/Logger.h>
 #include <ProblemSetup.h>
 #include <CalcServer.h>
 #include <AuxiliarMethods.h>
 
-#ifndef MAX_LINE_LEN
-    #define MAX_LINE_LEN 1024
-#endif // MAX_LINE_LEN
+#ifndef FAST_ASCII_MIN_CHUNK
+    /// Minimum size in bytes of the chunks of file parsed by each thread
+    #define FAST_ASCII_MIN_CHUNK (1 << 20)
+#endif // FAST_ASCII_MIN_CHUNK
 
 namespace Aqua{ namespace InputOutput{
 
+/// Type of the components of a field
+typedef enum {
+    UINT_FIELD,
+    INT_FIELD,
+    HALF_FIELD,
+    FLOAT_FIELD,
+} FastASCIIFieldKind;
+
+/// Field to be read
+typedef struct {
+    /// Type of the components
+    FastASCIIFieldKind kind;
+    /// Number of components
+    unsigned int n;
+    /// Size of each element in bytes
+    size_t type_size;
+    /// Host memory where the field is stored
+    char *data;
+} FastASCIIField;
+
+/// Chunk of the file, parsed by a thread
+typedef struct {
+    /// First character of the chunk
+    const char *begin;
+    /// Character after the last one of the chunk
+    const char *end;
+    /// Number of lines in the chunk
+    unsigned int n_lines;
+    /// Number of particles in the chunk, i.e. lines with data
+    unsigned int n_particles;
+    /// Error message, empty if the chunk has been successfully parsed
+    std::string error;
+} FastASCIIChunk;
+
+/** @brief Check whether a character is a fields separator
+ * @param c Character
+ * @return true if it is a separator, false otherwise
+ */
+static inline bool isSeparator(const char c)
+{
+    switch(c){
+        case ' ':
+        case ',':
+        case ';':
+        case '(':
+        case ')':
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+        case '\t':
+        case '\r':
+            return true;
+        default:
+            return false;
+    }
+}
+
+/** @brief Get the end of the data in a line, i.e. either the line end or the
+ * comment start
+ * @param p Line start
+ * @param end Chunk end
+ * @return End of the line data
+ */
+static inline const char* dataEnd(const char *p, const char *end)
+{
+    while((p < end) && (*p != '\n') && (*p != '#'))
+        p++;
+    return p;
+}
+
+/** @brief Get the next line start
+ * @param p Position in the current line
+ * @param end Chunk end
+ * @return Next line start, @p end if there are no more lines
+ */
+static inline const char* nextLine(const char *p, const char *end)
+{
+    const char *eol = (const char*)memchr(p, '\n', end - p);
+    return eol ? eol + 1 : end;
+}
+
+/** @brief Check whether a line has not data at all
+ * @param p Line start
+ * @param end Line data end, see dataEnd()
+ * @return true if there are just separators, false otherwise
+ */
+static inline bool isEmpty(const char *p, const char *end)
+{
+    for(; p < end; p++){
+        if(!isSeparator(*p))
+            return false;
+    }
+    return true;
+}
+
+/** @brief Count the lines and the particles of a chunk
+ * @param chunk Chunk of the file
+ */
+static void countChunk(FastASCIIChunk *chunk)
+{
+    chunk->n_lines = 0;
+    chunk->n_particles = 0;
+    const char *p = chunk->begin;
+    while(p < chunk->end){
+        const char *e = dataEnd(p, chunk->end);
+        if(!isEmpty(p, e))
+            chunk->n_particles++;
+        chunk->n_lines++;
+        p = nextLine(e, chunk->end);
+    }
+}
+
+/** @brief Read a number
+ * @param p Number start. It is moved to the end of the number
+ * @param end Line data end
+ * @param ptr Memory where the number shall be stored
+ * @return The std::from_chars() error code
+ */
+template<typename T>
+static inline std::errc readNumber(const char **p, const char *end, void *ptr)
+{
+    T val;
+    const std::from_chars_result res = std::from_chars(*p, end, val);
+    if(res.ec != std::errc())
+        return res.ec;
+    memcpy(ptr, &val, sizeof(T));
+    *p = res.ptr;
+    return res.ec;
+}
+
+/** @brief Parse a chunk of the file
+ * @param chunk Chunk of the file. The errors are reported in
+ * FastASCIIChunk::error
+ * @param fields Fields to be read
+ * @param n_fields Number of components of all the fields together
+ * @param i Index of the first particle of the chunk
+ * @param i_line Index of the first line of the chunk
+ */
+static void parseChunk(FastASCIIChunk *chunk,
+                       const std::vector<FastASCIIField> *fields,
+                       unsigned int n_fields,
+                       unsigned int i,
+                       unsigned int i_line)
+{
+    const char *p = chunk->begin;
+    while(p < chunk->end){
+        const char *e = dataEnd(p, chunk->end);
+        i_line++;
+        if(isEmpty(p, e)){
+            p = nextLine(e, chunk->end);
+            continue;
+        }
+
+        for(auto field : *fields){
+            char *ptr = field.data + field.type_size * i;
+            for(unsigned int k = 0; k < field.n; k++){
+                while((p < e) && isSeparator(*p))
+                    p++;
+                if(p == e){
+                    std::ostringstream msg;
+                    msg << "Line " << i_line << " has less than " << n_fields
+                        << " fields." << std::endl;
+                    chunk->error = msg.str();
+                    return;
+                }
+                const char *token = p;
+                if(*p == '+')
+                    p++;
+                std::errc ec;
+                switch(field.kind){
+                    case UINT_FIELD:
+                        ec = readNumber<unsigned int>(&p, e, ptr);
+                        break;
+                    case INT_FIELD:
+                        ec = readNumber<int>(&p, e, ptr);
+                        break;
+                    case HALF_FIELD:
+                        {
+                            float val;
+                            ec = readNumber<float>(&p, e, &val);
+                            if(ec == std::errc()){
+                                cl_half hval = floatToHalf(val);
+                                memcpy(ptr, &hval, sizeof(cl_half));
+                            }
+                        }
+                        break;
+                    default:
+                        ec = readNumber<float>(&p, e, ptr);
+                }
+                // Discard the rest of the token, e.g. the decimal part of the
+                // integer numbers
+                while((p < e) && !isSeparator(*p))
+                    p++;
+                if(ec != std::errc()){
+                    std::ostringstream msg;
+                    if(ec == std::errc::result_out_of_range)
+                        msg << "The number extracted from \""
+                            << std::string(token, p) << "\" in line "
+                            << i_line << " overflows its type." << std::endl;
+                    else
+                        msg << "Cannot extract a number from \""
+                            << std::string(token, p) << "\" in line "
+                            << i_line << "." << std::endl;
+                    chunk->error = msg.str();
+                    return;
+                }
+                ptr += field.type_size / field.n;
+            }
+        }
+
+        if(!isEmpty(p, e)){
+            std::ostringstream msg;
+            msg << "Line " << i_line << " has more than " << n_fields
+                << " fields." << std::endl;
+            chunk->error = msg.str();
+            return;
+        }
+
+        i++;
+        p = nextLine(e, chunk->end);
+    }
+}
+
 FastASCII::FastASCII(ProblemSetup& sim_data,
                      unsigned int iset,
                      unsigned int first,
@@ -46,67 +277,148 @@ FastASCII::~FastASCII()
 {
 }
 
-std::string FastASCII::readField(const std::string field,
-                                 const std::string line,
-                                 unsigned int index,
-                                 void* data)
+void FastASCII::load()
 {
-    unsigned int i;
+    unsigned int i, n_fields;
     Variables *vars = CalcServer::CalcServer::singleton()->variables();
-    ArrayVariable *var = (ArrayVariable*)vars->get(field);
-
-    // Extract the variable type data
-    unsigned int n = vars->typeToN(var->type());
-    size_t type_size = vars->typeToBytes(var->type());
-    std::string type = trimCopy(var->type());
-    if (type.back() == '*') {
-        type.pop_back();
-    }
 
-    // Point to the chunk of data to become read
-    void* ptr = (void*)((char*)data + type_size * index);
-
-    std::string remaining = line;
-    for(i = 0; i < n; i++){
-        std::string::size_type end_pos;
-        try {
-            if(!type.compare("unsigned int") ||
-            (type.find("uivec") != std::string::npos)){
-                unsigned int val = (unsigned int)std::stoul(remaining, &end_pos);
-                memcpy(ptr, &val, sizeof(unsigned int));
-            }
-            else if(!type.compare("int") ||
-            (type.find("ivec") != std::string::npos)){
-                int val = std::stoi(remaining, &end_pos);
-                memcpy(ptr, &val, sizeof(int));
-            }
-            else{
-                float val = std::stof(remaining, &end_pos);
-                memcpy(ptr, &val, sizeof(int));
-            }
-        } catch(const std::invalid_argument& e) {
+    loadDefault();
+
+    const std::string path = simData().sets.at(setId())->inputPath();
+    std::ostringstream msg;
+    msg << "Loading particles from ASCII file \"" << path
+        << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    // Map the file in memory
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if((fd < 0) || fstat(fd, &st)) {
+        std::ostringstream msg;
+        msg << "Failure reading the file \"" << path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        if(fd >= 0)
+            close(fd);
+        throw std::ifstream::failure(msg.str());
+    }
+    const size_t len = st.st_size;
+    char *text = NULL;
+    if(len) {
+        text = (char*)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(text == MAP_FAILED) {
             std::ostringstream msg;
-            msg << "Cannot extract a number from \"" << remaining
-                << "\" string." << std::endl;
+            msg << "Failure mapping the file \"" << path << "\"." << std::endl;
             LOG(L_ERROR, msg.str());
-            throw;
-        } catch(const std::out_of_range & e) {
-            std::ostringstream msg;
-            msg << "The number extracted from \"" << remaining
-                << "\" string overflows \""
-                << type << "\" type." << std::endl;
-            LOG(L_ERROR, msg.str());                
-            throw;
+            close(fd);
+            throw std::ifstream::failure(msg.str());
+        }
+        madvise(text, len, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    // Split the file in chunks of whole lines
+    unsigned int n_threads = std::thread::hardware_concurrency();
+    n_threads = max(1u, min(n_threads, (unsigned int)(len / FAST_ASCII_MIN_CHUNK)));
+    std::vector<FastASCIIChunk> chunks(n_threads);
+    for(i = 0; i < n_threads; i++){
+        const char *begin = text + i * (len / n_threads);
+        if(i)
+            begin = nextLine(max(begin - 1, chunks.at(i - 1).begin),
+                             text + len);
+        chunks.at(i).begin = begin;
+        if(i)
+            chunks.at(i - 1).end = begin;
+    }
+    chunks.back().end = text + len;
+    msg.str("");
+    msg << "\tParsing the file in " << n_threads << " threads" << std::endl;
+    LOG0(L_DEBUG, msg.str());
+
+    // Assert that the number of particles is right
+    std::vector<std::thread> threads;
+    for(i = 0; i < n_threads; i++){
+        threads.push_back(std::thread(countChunk, &chunks.at(i)));
+    }
+    unsigned int N = 0;
+    for(i = 0; i < n_threads; i++){
+        threads.at(i).join();
+        N += chunks.at(i).n_particles;
+    }
+    threads.clear();
+    const unsigned int n = bounds().y - bounds().x;
+    if(n != N){
+        std::ostringstream msg;
+        msg << "Expected " << n << " particles, but the file contains just "
+            << N << " ones." << std::endl;
+        LOG(L_ERROR, msg.str());
+        if(text)
+            munmap(text, len);
+        throw std::runtime_error("Invalid number of particles in file");
+    }
+
+    // Check the fields to read, and setup an storage
+    std::vector<std::string> names = simData().sets.at(setId())->inputFields();
+    std::vector<void*> data;
+    try {
+        data = allocFields(names, n_fields);
+    } catch (...) {
+        if(text)
+            munmap(text, len);
+        throw;
+    }
+    std::vector<FastASCIIField> fields;
+    for(i = 0; i < names.size(); i++){
+        ArrayVariable *var = (ArrayVariable*)vars->get(names.at(i));
+        std::string type = trimCopy(var->type());
+        if (type.back() == '*') {
+            type.pop_back();
         }
+        FastASCIIField field;
+        if(!type.compare("unsigned int") ||
+           (type.find("uivec") != std::string::npos))
+            field.kind = UINT_FIELD;
+        else if(!type.compare("int") ||
+                (type.find("ivec") != std::string::npos))
+            field.kind = INT_FIELD;
+        else if(Variables::isHalfType(type))
+            field.kind = HALF_FIELD;
+        else
+            field.kind = FLOAT_FIELD;
+        field.n = vars->typeToN(var->type());
+        field.type_size = vars->typeToBytes(var->type());
+        field.data = (char*)data.at(i);
+        fields.push_back(field);
+    }
 
-        // Go to the next field, we already asserted that there are fields
-        // enough, so we don't need to care about that
-        ptr = ((char*)ptr) + type_size / n;
-        remaining = remaining.substr(end_pos);
-        if (remaining.find(',') != std::string::npos)
-            remaining = remaining.substr(remaining.find(',') + 1);
+    // Parse the chunks, each one starting at its own particle and line
+    unsigned int i_first = 0, i_line = 0;
+    for(i = 0; i < n_threads; i++){
+        threads.push_back(std::thread(parseChunk,
+                                      &chunks.at(i),
+                                      &fields,
+                                      n_fields,
+                                      i_first,
+                                      i_line));
+        i_first += chunks.at(i).n_particles;
+        i_line += chunks.at(i).n_lines;
     }
-    return remaining;
+    for(auto& thread : threads){
+        thread.join();
+    }
+    if(text)
+        munmap(text, len);
+    for(auto chunk : chunks){
+        if(chunk.error == "")
+            continue;
+        LOG(L_ERROR, chunk.error);
+        for(auto d : data){
+            free(d);
+        }
+        throw std::runtime_error("Bad formatted file");
+    }
+
+    // Send the data to the server and release it
+    uploadFields(names, data);
 }
 
 }}  // namespace
@@ -0,0 +1,622 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Particles HDF5 data files loader/saver.
+ * (See Aqua::InputOutput::HDF5 for details)
+ */
+
+#include <sphPrerequisites.h>
+
+#ifdef HAVE_HDF5
+
+#include <algorithm>
+#include <mutex>
+#include <fstream>
+
+#include <InputOutput/HDF5.h>
+#include <InputOutput/Logger.h>
+#include <InputOutput/Writers.h>
+#include <ProblemSetup.h>
+#include <CalcServer.h>
+#include <AuxiliarMethods.h>
+
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+
+namespace Aqua{ namespace InputOutput{
+
+/// Field to be written in a HDF5 file
+typedef struct {
+    /// Field name
+    std::string name;
+    /// AQUAgpusph type
+    std::string type;
+    /// Number of components
+    hsize_t n;
+} HDF5Field;
+
+/** @brief Get the HDF5 type of the components of a type
+ * @param type AQUAgpusph type
+ * @return HDF5 native type
+ */
+static hid_t componentType(const std::string type)
+{
+    const std::string t = trimCopy(type);
+    if(Variables::isHalfType(t))
+        return H5T_NATIVE_UINT16;
+    if(!t.find("unsigned") || !t.find("uivec"))
+        return H5T_NATIVE_UINT;
+    if(!t.find("int") || !t.find("ivec"))
+        return H5T_NATIVE_INT;
+    return H5T_NATIVE_FLOAT;
+}
+
+/** @brief Create the file access properties
+ * @return File access properties
+ */
+static hid_t fileAccess()
+{
+    hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+#ifdef HAVE_MPI
+    H5Pset_fapl_mpio(fapl, MPI_COMM_WORLD, MPI_INFO_NULL);
+#endif
+    return fapl;
+}
+
+/** @brief Create the data transfer properties
+ * @return Data transfer properties, collective in MPI runs
+ */
+static hid_t dataTransfer()
+{
+    hid_t dxpl = H5Pcreate(H5P_DATASET_XFER);
+#ifdef HAVE_MPI
+    H5Pset_dxpl_mpio(dxpl, H5FD_MPIO_COLLECTIVE);
+#endif
+    return dxpl;
+}
+
+/** @brief Write a string attribute
+ * @param loc Object where the attribute is attached
+ * @param name Attribute name
+ * @param value Attribute value
+ * @return false if errors happened, true otherwise
+ */
+static bool writeAttribute(hid_t loc,
+                           const std::string name,
+                           const std::string value)
+{
+    hid_t type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(type, value.size() ? value.size() : 1);
+    hid_t space = H5Screate(H5S_SCALAR);
+    hid_t attr = H5Acreate2(loc, name.c_str(), type, space,
+                            H5P_DEFAULT, H5P_DEFAULT);
+    bool failed = (attr < 0) || (H5Awrite(attr, type, value.c_str()) < 0);
+    if(attr >= 0)
+        H5Aclose(attr);
+    H5Sclose(space);
+    H5Tclose(type);
+    return !failed;
+}
+
+/** @brief Read a string attribute
+ * @param loc Object where the attribute is attached
+ * @param name Attribute name
+ * @return Attribute value, an empty string if it cannot be read
+ */
+static std::string readAttribute(hid_t loc, const std::string name)
+{
+    if(H5Aexists(loc, name.c_str()) <= 0)
+        return "";
+    hid_t attr = H5Aopen(loc, name.c_str(), H5P_DEFAULT);
+    hid_t type = H5Aget_type(attr);
+    std::string value(H5Tget_size(type), '\0');
+    if(H5Aread(attr, type, &value[0]) < 0)
+        value = "";
+    H5Tclose(type);
+    H5Aclose(attr);
+    return trimCopy(value.c_str());
+}
+
+/** @brief Write a file
+ * @param path File path
+ * @param t Simulation time
+ * @param fields Fields to be written
+ * @param data Downloaded data of each field
+ * @param events Download events of each field, waited and released before
+ * writing the field
+ * @param offset First row of this process
+ * @param n Number of rows of this process
+ * @param N Total number of rows
+ * @param ranks Number of rows of each process
+ * @return false if errors happened, true otherwise
+ */
+static bool writeHDF5(const std::string path,
+                      float t,
+                      const std::vector<HDF5Field> &fields,
+                      const std::vector<void*> &data,
+                      const std::vector<cl_event> &events,
+                      hsize_t offset,
+                      hsize_t n,
+                      hsize_t N,
+                      const std::vector<unsigned int> &ranks)
+{
+    unsigned int i;
+
+    hid_t fapl = fileAccess();
+    hid_t file = H5Fcreate(path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+    H5Pclose(fapl);
+    if(file < 0){
+        for(auto event : events)
+            Particles::waitForDownload(event);
+        return false;
+    }
+
+    // Root attributes
+    hid_t space = H5Screate(H5S_SCALAR);
+    hid_t attr = H5Acreate2(file, "t", H5T_NATIVE_FLOAT, space,
+                            H5P_DEFAULT, H5P_DEFAULT);
+    bool failed = (attr < 0) || (H5Awrite(attr, H5T_NATIVE_FLOAT, &t) < 0);
+    if(attr >= 0)
+        H5Aclose(attr);
+    H5Sclose(space);
+    const hsize_t n_ranks = ranks.size();
+    space = H5Screate_simple(1, &n_ranks, NULL);
+    attr = H5Acreate2(file, "ranks", H5T_NATIVE_UINT, space,
+                      H5P_DEFAULT, H5P_DEFAULT);
+    failed = (attr < 0) ||
+             (H5Awrite(attr, H5T_NATIVE_UINT, ranks.data()) < 0) ||
+             failed;
+    if(attr >= 0)
+        H5Aclose(attr);
+    H5Sclose(space);
+
+    // Datasets, written as soon as they are downloaded
+    hid_t dxpl = dataTransfer();
+    for(i = 0; i < fields.size(); i++){
+        const HDF5Field &field = fields.at(i);
+        failed = !Particles::waitForDownload(events.at(i)) || failed;
+        const hid_t comp = componentType(field.type);
+        const hsize_t dims[2] = {N, field.n};
+        hid_t filespace = H5Screate_simple(2, dims, NULL);
+        hid_t dset = H5Dcreate2(file, field.name.c_str(), comp, filespace,
+                                H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if(dset < 0){
+            H5Sclose(filespace);
+            failed = true;
+            continue;
+        }
+        failed = !writeAttribute(dset, "type", field.type) || failed;
+
+        const hsize_t start[2] = {offset, 0};
+        const hsize_t count[2] = {n, field.n};
+        hid_t memspace = H5Screate_simple(2, count, NULL);
+        if(n){
+            H5Sselect_hyperslab(filespace, H5S_SELECT_SET,
+                                start, NULL, count, NULL);
+        }
+        else{
+            H5Sselect_none(filespace);
+            H5Sselect_none(memspace);
+        }
+        failed = (H5Dwrite(dset, comp, memspace, filespace, dxpl,
+                           data.at(i)) < 0) || failed;
+        H5Sclose(memspace);
+        H5Sclose(filespace);
+        H5Dclose(dset);
+    }
+    H5Pclose(dxpl);
+
+    failed = (H5Fclose(file) < 0) || failed;
+    return !failed;
+}
+
+/// Guard for the writing threads, since HDF5 may not be thread safe
+static std::mutex hdf5_mutex;
+
+HDF5::HDF5(ProblemSetup& sim_data,
+           unsigned int iset,
+           unsigned int first,
+           unsigned int n_in)
+    : Particles(sim_data, iset, first, n_in)
+    , _next_file_index(0)
+{
+    if(n() == 0) {
+        n(compute_n());
+    }
+}
+
+HDF5::~HDF5()
+{
+}
+
+void HDF5::load()
+{
+    cl_int err_code;
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    Variables *vars = C->variables();
+
+    loadDefault();
+
+    const std::string path = simData().sets.at(setId())->inputPath();
+    std::ostringstream msg;
+    msg << "Loading particles from HDF5 file \"" << path
+        << "\"..." << std::endl;
+    LOG(L_INFO, msg.str());
+
+    hid_t file = open(path);
+
+    // Assert that the number of particles is right
+    hsize_t offset, N;
+    slab(file, offset, N);
+    const unsigned int n = bounds().y - bounds().x;
+    if(n != N){
+        std::ostringstream msg;
+        msg << "Expected " << n << " particles, but the file contains just "
+            << N << " ones." << std::endl;
+        LOG(L_ERROR, msg.str());
+        H5Fclose(file);
+        throw std::runtime_error("Invalid number of particles in file");
+    }
+
+    // Check the fields to read
+    std::vector<std::string> fields = simData().sets.at(setId())->inputFields();
+    if(!fields.size()){
+        LOG(L_ERROR, "0 fields were set to be read from the file.\n");
+        H5Fclose(file);
+        throw std::runtime_error("No fields have to be read");
+    }
+    bool have_r = false;
+    for(auto field : fields){
+        if(!field.compare("r")){
+            have_r = true;
+            break;
+        }
+    }
+    if(!have_r){
+        LOG(L_ERROR, "\"r\" field was not set to be read from the file.\n");
+        H5Fclose(file);
+        throw std::runtime_error("Reading \"r\" field is mandatory");
+    }
+
+    hid_t dxpl = dataTransfer();
+    for(auto field : fields){
+        if(!vars->get(field) ||
+           (vars->get(field)->type().find('*') == std::string::npos)){
+            std::ostringstream msg;
+            msg << "Undeclared array variable \"" << field
+                << "\" set to be read." << std::endl;
+            LOG(L_ERROR, msg.str());
+            H5Pclose(dxpl);
+            H5Fclose(file);
+            throw std::runtime_error("Invalid variable");
+        }
+        ArrayVariable *var = (ArrayVariable*)vars->get(field);
+        size_t typesize = vars->typeToBytes(var->type());
+        if(var->size() / typesize < bounds().y) {
+            std::ostringstream msg;
+            msg << "Array variable \"" << field
+                << "\" is not long enough." << std::endl;
+            LOG(L_ERROR, msg.str());
+            H5Pclose(dxpl);
+            H5Fclose(file);
+            throw std::runtime_error("Invalid variable length");
+        }
+
+        if(H5Lexists(file, field.c_str(), H5P_DEFAULT) <= 0){
+            std::ostringstream msg;
+            msg << "The field \"" << field << "\" is not stored in the file."
+                << std::endl;
+            LOG(L_ERROR, msg.str());
+            H5Pclose(dxpl);
+            H5Fclose(file);
+            throw std::runtime_error("Missing field");
+        }
+        hid_t dset = H5Dopen2(file, field.c_str(), H5P_DEFAULT);
+        hid_t filespace = H5Dget_space(dset);
+        hsize_t dims[2] = {0, 0};
+        const hsize_t n_comps = vars->typeToN(var->type());
+        if((H5Sget_simple_extent_ndims(filespace) != 2) ||
+           (H5Sget_simple_extent_dims(filespace, dims, NULL) < 0) ||
+           (dims[1] != n_comps) ||
+           (dims[0] < offset + n)){
+            const std::string type = readAttribute(dset, "type");
+            std::ostringstream msg;
+            msg << "The field \"" << field << "\" of type \""
+                << type << "\" cannot be loaded into the variable"
+                << " of type \"" << var->type() << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            H5Sclose(filespace);
+            H5Dclose(dset);
+            H5Pclose(dxpl);
+            H5Fclose(file);
+            throw std::runtime_error("Invalid field type");
+        }
+        const std::string type = readAttribute(dset, "type");
+        if(type.compare(trimCopy(var->type()))){
+            std::ostringstream msg;
+            msg << "The field \"" << field << "\" of type \""
+                << type << "\" is loaded into a variable of type \""
+                << var->type() << "\"." << std::endl;
+            LOG(L_WARNING, msg.str());
+        }
+
+        void *store = C->allocatePinned(std::max(typesize * n, typesize));
+        if(!store){
+            std::ostringstream msg;
+            msg << "Failure allocating " << typesize * n
+                << " bytes for the field \"" << field << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            H5Sclose(filespace);
+            H5Dclose(dset);
+            H5Pclose(dxpl);
+            H5Fclose(file);
+            throw std::bad_alloc();
+        }
+        const hsize_t start[2] = {offset, 0};
+        const hsize_t count[2] = {n, n_comps};
+        hid_t memspace = H5Screate_simple(2, count, NULL);
+        if(n){
+            H5Sselect_hyperslab(filespace, H5S_SELECT_SET,
+                                start, NULL, count, NULL);
+        }
+        else{
+            H5Sselect_none(filespace);
+            H5Sselect_none(memspace);
+        }
+        const herr_t status = H5Dread(dset, componentType(var->type()),
+                                      memspace, filespace, dxpl, store);
+        H5Sclose(memspace);
+        H5Sclose(filespace);
+        H5Dclose(dset);
+        if(status < 0){
+            std::ostringstream msg;
+            msg << "Failure reading the field \"" << field << "\"."
+                << std::endl;
+            LOG(L_ERROR, msg.str());
+            C->releasePinned(store);
+            H5Pclose(dxpl);
+            H5Fclose(file);
+            throw std::ifstream::failure(msg.str());
+        }
+
+        cl_mem mem = *(cl_mem*)var->get();
+        err_code = C->writeBuffer(C->command_queue(),
+                                  mem,
+                                  CL_TRUE,
+                                  typesize * bounds().x,
+                                  typesize * n,
+                                  store,
+                                  0,
+                                  NULL,
+                                  NULL);
+        C->releasePinned(store);
+        if(err_code != CL_SUCCESS){
+            std::ostringstream msg;
+            msg << "Failure sending variable \"" << field
+                << "\" to the server." << std::endl;
+            LOG(L_ERROR, msg.str());
+            Logger::singleton()->printOpenCLError(err_code);
+            H5Pclose(dxpl);
+            H5Fclose(file);
+            throw std::runtime_error("OpenCL error");
+        }
+    }
+    H5Pclose(dxpl);
+
+    H5Fclose(file);
+}
+
+void HDF5::save(float t)
+{
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    Variables *vars = C->variables();
+
+    std::vector<std::string> fields = simData().sets.at(setId())->outputFields();
+    if(!fields.size()){
+        LOG(L_ERROR, "0 fields were set to be saved into the file.\n");
+        throw std::runtime_error("No fields have been set to be saved");
+    }
+
+    // Start downloading the data. The variables are checked there
+    std::vector<cl_event> events;
+    std::vector<void*> data = download(fields, events);
+
+    const hsize_t n = nDownloaded();
+    std::vector<HDF5Field> file_fields;
+    size_t memory = 0;
+    for(auto field : fields){
+        ArrayVariable *var = (ArrayVariable*)vars->get(field);
+        HDF5Field file_field;
+        file_field.name = field;
+        file_field.type = trimCopy(var->type());
+        file_field.n = vars->typeToN(var->type());
+        file_fields.push_back(file_field);
+        memory += vars->typeToBytes(var->type()) * n;
+    }
+
+    // Get the slab of this process
+    hsize_t offset = 0, N = n;
+    std::vector<unsigned int> ranks(1, n);
+#ifdef HAVE_MPI
+    const int mpi_size = MPI::COMM_WORLD.Get_size();
+    const int mpi_rank = MPI::COMM_WORLD.Get_rank();
+    unsigned int n_local = n;
+    ranks.resize(mpi_size);
+    MPI::COMM_WORLD.Allgather(&n_local, 1, MPI::UNSIGNED,
+                              ranks.data(), 1, MPI::UNSIGNED);
+    N = 0;
+    for(int i = 0; i < mpi_size; i++){
+        if(i < mpi_rank)
+            offset += ranks.at(i);
+        N += ranks.at(i);
+    }
+#endif
+
+    try {
+        create();
+    } catch(...) {
+        for(unsigned int i = 0; i < data.size(); i++){
+            waitForDownload(events.at(i));
+            C->releasePinned(data.at(i));
+        }
+        throw;
+    }
+    const std::string path = file();
+
+#ifdef HAVE_MPI
+    // Collective writing, which shall be carried out by all the processes
+    const bool failed = !writeHDF5(path, t, file_fields, data, events,
+                                   offset, n, N, ranks);
+    for(auto d : data){
+        C->releasePinned(d);
+    }
+    if(failed){
+        std::ostringstream msg;
+        msg << "Failure writing the file \"" << path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::ofstream::failure(msg.str());
+    }
+#else
+    Writers::singleton()->enqueue(
+        [path, t, file_fields, data, events, offset, n, N, ranks]{
+            Logger *S = Logger::singleton();
+            CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+            bool failed;
+            {
+                std::lock_guard<std::mutex> lock(hdf5_mutex);
+                failed = !writeHDF5(path, t, file_fields, data, events,
+                                    offset, n, N, ranks);
+            }
+            for(auto d : data){
+                C->releasePinned(d);
+            }
+            if(failed){
+                std::ostringstream msg;
+                msg << "Failure writing the file \"" << path << "\"."
+                    << std::endl;
+                S->addMessageF(L_ERROR, msg.str());
+            }
+        }, memory);
+#endif
+}
+
+const unsigned int HDF5::compute_n()
+{
+    hid_t file = open(simData().sets.at(setId())->inputPath());
+    hsize_t offset, n;
+    try {
+        slab(file, offset, n);
+    } catch(...) {
+        H5Fclose(file);
+        throw;
+    }
+    H5Fclose(file);
+    return (const unsigned int)n;
+}
+
+void HDF5::slab(hid_t file, hsize_t &offset, hsize_t &n)
+{
+    unsigned int i;
+    unsigned int mpi_rank = 0, mpi_size = 1;
+#ifdef HAVE_MPI
+    mpi_rank = MPI::COMM_WORLD.Get_rank();
+    mpi_size = MPI::COMM_WORLD.Get_size();
+#endif
+
+    if(H5Aexists(file, "ranks") <= 0){
+        std::ostringstream msg;
+        msg << "\"" << simData().sets.at(setId())->inputPath()
+            << "\" is not a valid AQUAgpusph HDF5 file." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Bad formatted file");
+    }
+    hid_t attr = H5Aopen(file, "ranks", H5P_DEFAULT);
+    hid_t space = H5Aget_space(attr);
+    std::vector<unsigned int> ranks(H5Sget_simple_extent_npoints(space));
+    H5Aread(attr, H5T_NATIVE_UINT, ranks.data());
+    H5Sclose(space);
+    H5Aclose(attr);
+
+    offset = 0;
+    if(ranks.size() == mpi_size){
+        for(i = 0; i < mpi_rank; i++)
+            offset += ranks.at(i);
+        n = ranks.at(mpi_rank);
+        return;
+    }
+
+    // The file was written by a different number of processes, so the
+    // particles are evenly distributed
+    hsize_t N = 0;
+    for(auto r : ranks)
+        N += r;
+    n = N / mpi_size;
+    const hsize_t remainder = N % mpi_size;
+    offset = mpi_rank * n + std::min((hsize_t)mpi_rank, remainder);
+    if(mpi_rank < remainder)
+        n++;
+}
+
+hid_t HDF5::open(const std::string path)
+{
+    hid_t fapl = fileAccess();
+    hid_t file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, fapl);
+    H5Pclose(fapl);
+    if(file < 0){
+        std::ostringstream msg;
+        msg << "Failure reading the file \"" << path << "\"." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::ifstream::failure(msg.str());
+    }
+    return file;
+}
+
+void HDF5::create(){
+    std::string basename = simData().sets.at(setId())->outputPath();
+    // Check that {index} scape string is present, for backward compatibility
+    if(basename.find("{index}") == std::string::npos){
+        basename += ".{index}.h5";
+    }
+#ifdef HAVE_MPI
+    // The first process is selecting the path, which is shared with the
+    // other ones, that would find the file already created otherwise
+    if(!MPI::COMM_WORLD.Get_rank())
+        _next_file_index = file(basename, _next_file_index);
+    std::string path = file();
+    int len = path.size();
+    MPI::COMM_WORLD.Bcast(&len, 1, MPI::INT, 0);
+    std::vector<char> buf(path.begin(), path.end());
+    buf.resize(len);
+    MPI::COMM_WORLD.Bcast(buf.data(), len, MPI::CHAR, 0);
+    MPI::COMM_WORLD.Bcast(&_next_file_index, 1, MPI::UNSIGNED, 0);
+    file(std::string(buf.begin(), buf.end()));
+#else
+    _next_file_index = file(basename, _next_file_index);
+#endif
+
+    std::ostringstream msg;
+    msg << "Writing \"" << file() << "\" HDF5 file..." << std::endl;
+    LOG(L_INFO, msg.str());
+    _next_file_index++;
+}
+
+}}  // namespace
+
+#endif // HAVE_HDF5
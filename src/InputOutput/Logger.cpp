@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
+#include <chrono>
 
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
@@ -43,50 +44,226 @@
 namespace Aqua{ namespace InputOutput{
 
 Logger::Logger()
-    : _last_row(0)
+    : _queue(NULL)
+    , _n_pushed(0)
+    , _n_processed(0)
+    , _stop(false)
+    , _dirty(false)
+    , _last_row(0)
 {
     wnd = NULL;
     open();
     gettimeofday(&_start_time, NULL);
+    _refresh_time = _start_time;
+    _thread = std::thread(&Logger::worker, this);
 }
 
 Logger::~Logger()
 {
+    _stop = true;
+    _cv_queue.notify_one();
+    if(_thread.joinable())
+        _thread.join();
     close();
 }
 
 void Logger::initNCurses()
 {
-#ifdef HAVE_NCURSES
-    if (wnd)
-        return;
+    push(RECORD_INIT_NCURSES);
+    flush();
+}
+
+void Logger::endNCurses()
+{
+    push(RECORD_END_NCURSES);
+    flush();
+}
+
+void Logger::initFrame()
+{
+    push(RECORD_INIT_FRAME);
+}
+
+void Logger::endFrame()
+{
+    push(RECORD_END_FRAME);
+}
 
-    wnd = initscr();
-    if(!wnd){
-        addMessageF(L_INFO, "Failure initializating the screen manager\n");
+void Logger::writeReport(std::string input,
+                         std::string color,
+                         bool bold)
+{
+    if(!input.size()){
         return;
     }
-    if(has_colors())
-        start_color();
-    log_wnd = NULL;        
+    push(RECORD_REPORT, L_DEBUG, input, color, bold);
+}
+
+void Logger::addMessage(TLogLevel level, std::string log, std::string func)
+{
+    int mpi_rank = 0;
+#ifdef HAVE_MPI
+    try {
+        mpi_rank = MPI::COMM_WORLD.Get_rank();
+    } catch(MPI::Exception e){
+        std::ostringstream msg;
+        msg << "Error getting MPI rank. " << std::endl
+            << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw;
+    }
 #endif
+    // Just the root process is printing the messages on screen, except the
+    // errors
+    const bool screen = (level == L_ERROR) || (mpi_rank == 0);
+    push(RECORD_MESSAGE, level, log, func, screen);
+    // The simulation will be probably aborted right after an error
+    if(level == L_ERROR)
+        flush();
 }
 
-void Logger::endNCurses()
+void Logger::flush()
 {
-#ifdef HAVE_NCURSES
-    if(!wnd)
+    // The background thread may be reporting its own errors
+    if(std::this_thread::get_id() == _thread.get_id())
         return;
+    const unsigned long n = _n_pushed;
+    std::unique_lock<std::mutex> lock(_cv_mutex);
+    _cv_queue.notify_one();
+    _cv_processed.wait(lock, [this, n]{return _n_processed >= n;});
+}
 
-    endwin();
-    // Avoid problems if endNCurses is called several times
-    wnd = NULL;
-    log_wnd = NULL;
+void Logger::push(record_kind kind,
+                  TLogLevel level,
+                  std::string text,
+                  std::string extra,
+                  bool bold)
+{
+    record *r = new record;
+    r->kind = kind;
+    r->level = level;
+    r->text = text;
+    r->extra = extra;
+    r->bold = bold;
+    r->next = _queue.load(std::memory_order_relaxed);
+    while(!_queue.compare_exchange_weak(r->next, r,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed));
+    _n_pushed++;
+    // A lost wake up is just delaying the record until the next poll
+    if(kind != RECORD_REPORT)
+        _cv_queue.notify_one();
+}
+
+void Logger::worker()
+{
+    while(true){
+        // Pop all the records at once, and revert them to the pushing order
+        record *r = _queue.exchange(NULL, std::memory_order_acquire);
+        record *fifo = NULL;
+        while(r){
+            record *next = r->next;
+            r->next = fifo;
+            fifo = r;
+            r = next;
+        }
+        unsigned long n = 0;
+        while(fifo){
+            record *next = fifo->next;
+            process(fifo);
+            delete fifo;
+            fifo = next;
+            n++;
+        }
+
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        const double elapsed = (now.tv_sec - _refresh_time.tv_sec) +
+            1.e-6 * (now.tv_usec - _refresh_time.tv_usec);
+        if(_dirty && (elapsed >= LOGGER_REFRESH_PERIOD))
+            printFrame();
+
+        std::unique_lock<std::mutex> lock(_cv_mutex);
+        _n_processed += n;
+        if(n)
+            _cv_processed.notify_all();
+        if(_queue.load())
+            continue;
+        if(_stop)
+            break;
+        _cv_queue.wait_for(lock, std::chrono::milliseconds(10));
+    }
+
+    if(_dirty)
+        printFrame();
+}
+
+void Logger::process(record *r)
+{
+    switch(r->kind){
+    case RECORD_MESSAGE:
+        printMessage(r->level, r->text, r->extra, r->bold);
+        // Show the errors as soon as possible
+        if(r->level == L_ERROR)
+            printFrame();
+        break;
+    case RECORD_REPORT:
+        if(!wnd) {
+            std::cout << r->text;
+            if(!hasSuffix(r->text, "\n")){
+                std::cout << std::endl;
+            }
+            break;
+        }
+        _frame.push_back(std::move(*r));
+        break;
+    case RECORD_INIT_FRAME:
+        _frame.clear();
+        break;
+    case RECORD_END_FRAME:
+        if(!wnd) {
+            std::cout << std::flush;
+            break;
+        }
+        _last_frame.swap(_frame);
+        _frame.clear();
+        _dirty = true;
+        break;
+    case RECORD_INIT_NCURSES:
+#ifdef HAVE_NCURSES
+        if (wnd)
+            break;
+
+        wnd = initscr();
+        if(!wnd){
+            printMessage(L_INFO,
+                         "Failure initializating the screen manager\n",
+                         __METHOD_CLASS_NAME__);
+            break;
+        }
+        if(has_colors())
+            start_color();
+        log_wnd = NULL;
 #endif
+        break;
+    case RECORD_END_NCURSES:
+#ifdef HAVE_NCURSES
+        if(!wnd)
+            break;
+
+        endwin();
+        // Avoid problems if endNCurses is called several times
+        wnd = NULL;
+        log_wnd = NULL;
+#endif
+        break;
+    }
 }
 
-void Logger::initFrame()
+void Logger::printFrame()
 {
+    gettimeofday(&_refresh_time, NULL);
+    _dirty = false;
 #ifdef HAVE_NCURSES
     // Clear the entire frame
     if(!wnd)
@@ -108,35 +285,18 @@ void Logger::initFrame()
 
     // Set the cursor at the start of the window
     _last_row = 0;
-#endif
-}
 
-void Logger::endFrame()
-{
-#ifdef HAVE_NCURSES
+    for(auto &r : _last_frame)
+        printReport(r.text, r.extra, r.bold);
     printLog();
     refreshAll();
-#else
-    std::cout << std::flush;
 #endif
 }
 
-void Logger::writeReport(std::string input,
+void Logger::printReport(std::string input,
                          std::string color,
                          bool bold)
 {
-    if(!input.size()){
-        return;
-    }
-
-    if(!wnd) {
-        std::cout << input;
-        if(!hasSuffix(input, "\n")){
-            std::cout << std::endl;
-        }
-        return;
-    }
-
 #ifdef HAVE_NCURSES
     std::string msg = rtrimCopy(input);
     if(msg == "")
@@ -148,10 +308,10 @@ void Logger::writeReport(std::string input,
         std::string remain = msg;
         while(remain.find("\n") != std::string::npos) {
             end = remain.find("\n");
-            writeReport(remain.substr(0, end), color, bold);
+            printReport(remain.substr(0, end), color, bold);
             remain = remain.substr(end + 1);
         }
-        writeReport(remain, color, bold);
+        printReport(remain, color, bold);
         return;
     }
 
@@ -172,8 +332,8 @@ void Logger::writeReport(std::string input,
             last = end;
         }
         if (last) {
-            writeReport(msg.substr(0, last), color, bold);
-            writeReport(msg.substr(last), color, bold);
+            printReport(msg.substr(0, last), color, bold);
+            printReport(msg.substr(last), color, bold);
             return;
         }
     }
@@ -205,7 +365,7 @@ void Logger::writeReport(std::string input,
     else{
         std::ostringstream err_msg;
         err_msg << "Invalid message color \"" << color << "\"" << std::endl;
-        addMessageF(L_ERROR, err_msg.str());
+        printMessage(L_ERROR, err_msg.str(), __METHOD_CLASS_NAME__);
     }
     attron(COLOR_PAIR(pair_id));
     if(bold){
@@ -225,7 +385,10 @@ void Logger::writeReport(std::string input,
 #endif
 }
 
-void Logger::addMessage(TLogLevel level, std::string log, std::string func)
+void Logger::printMessage(TLogLevel level,
+                          std::string log,
+                          std::string func,
+                          bool screen)
 {
     std::ostringstream fname;
     if (func != "")
@@ -251,19 +414,7 @@ void Logger::addMessage(TLogLevel level, std::string log, std::string func)
         _log_file.flush();
     }
 
-    int mpi_rank = 0;
-#ifdef HAVE_MPI
-    try {
-        mpi_rank = MPI::COMM_WORLD.Get_rank();
-    } catch(MPI::Exception e){
-        std::ostringstream msg;
-        msg << "Error getting MPI rank. " << std::endl
-            << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
-        LOG(L_ERROR, msg.str());
-        throw;
-    }
-#endif
-    if((level < L_ERROR) && (mpi_rank > 0))
+    if(!screen)
         return;
 
     // Just in case the Logger has been destroyed
@@ -295,8 +446,7 @@ void Logger::addMessage(TLogLevel level, std::string log, std::string func)
         _log.pop_back();
     }
 
-    printLog();
-    refreshAll();
+    _dirty = true;
 }
 
 void Logger::printDate(TLogLevel level)
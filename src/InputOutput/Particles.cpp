@@ -25,7 +25,9 @@
 
 #include <InputOutput/Particles.h>
 #include <InputOutput/Logger.h>
+#include <InputOutput/Writers.h>
 #include <CalcServer.h>
+#include <CalcServer/OutputFilter.h>
 #include <AuxiliarMethods.h>
 
 namespace Aqua{ namespace InputOutput{
@@ -34,8 +36,11 @@ Particles::Particles(ProblemSetup& sim_data,
                      unsigned int iset,
                      unsigned int first,
                      unsigned int n)
-    : _sim_data(sim_data)
+    : _n_download(n)
+    , _sim_data(sim_data)
     , _iset(iset)
+    , _filter(NULL)
+    , _filter_checked(false)
 {
     _bounds.x = first;
     _bounds.y = first + n;
@@ -43,6 +48,14 @@ Particles::Particles(ProblemSetup& sim_data,
 
 Particles::~Particles()
 {
+    waitForSavers();
+    if(_filter) delete _filter; _filter = NULL;
+}
+
+void Particles::waitForSavers()
+{
+    if(Writers::singleton())
+        Writers::singleton()->wait();
 }
 
 void Particles::loadDefault()
@@ -50,7 +63,9 @@ void Particles::loadDefault()
     unsigned int i;
     cl_int err_code;
     ArrayVariable *var;
+    cl_event event;
     cl_mem mem;
+    std::vector<cl_event> events;
     CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
 
     unsigned int n = bounds().y - bounds().x;
@@ -71,71 +86,97 @@ void Particles::loadDefault()
     mem = *(cl_mem*)var->get();
     err_code = clEnqueueWriteBuffer(C->command_queue(),
                                     mem,
-                                    CL_TRUE,
+                                    CL_FALSE,
                                     sizeof(unsigned int) * bounds().x,
                                     sizeof(unsigned int) * n,
                                     iset,
                                     0,
                                     NULL,
-                                    NULL);
+                                    &event);
     if(err_code != CL_SUCCESS){
         LOG(L_ERROR, "Failure sending variable \"iset\" to the server.\n");
         Logger::singleton()->printOpenCLError(err_code);
+        waitForUploads(events);
         throw std::runtime_error("OpenCL error");
     }
+    events.push_back(event);
     var = (ArrayVariable*)vars->get("id");
     mem = *(cl_mem*)var->get();
     err_code = clEnqueueWriteBuffer(C->command_queue(),
                                     mem,
-                                    CL_TRUE,
+                                    CL_FALSE,
                                     sizeof(unsigned int) * bounds().x,
                                     sizeof(unsigned int) * n,
                                     id,
                                     0,
                                     NULL,
-                                    NULL);
+                                    &event);
     if(err_code != CL_SUCCESS){
         LOG(L_ERROR, "Failure sending variable \"id\" to the server.\n");
         Logger::singleton()->printOpenCLError(err_code);
+        waitForUploads(events);
         throw std::runtime_error("OpenCL error");
     }
+    events.push_back(event);
     var = (ArrayVariable*)vars->get("id_sorted");
     mem = *(cl_mem*)var->get();
     err_code = clEnqueueWriteBuffer(C->command_queue(),
                                     mem,
-                                    CL_TRUE,
+                                    CL_FALSE,
                                     sizeof(unsigned int) * bounds().x,
                                     sizeof(unsigned int) * n,
                                     id,
                                     0,
                                     NULL,
-                                    NULL);
+                                    &event);
     if(err_code != CL_SUCCESS){
         LOG(L_ERROR, "Failure sending variable \"id_sorted\" to the server.\n");
         Logger::singleton()->printOpenCLError(err_code);
+        waitForUploads(events);
         throw std::runtime_error("OpenCL error");
     }
+    events.push_back(event);
     var = (ArrayVariable*)vars->get("id_unsorted");
     mem = *(cl_mem*)var->get();
     err_code = clEnqueueWriteBuffer(C->command_queue(),
                                     mem,
-                                    CL_TRUE,
+                                    CL_FALSE,
                                     sizeof(unsigned int) * bounds().x,
                                     sizeof(unsigned int) * n,
                                     id,
                                     0,
                                     NULL,
-                                    NULL);
+                                    &event);
     if(err_code != CL_SUCCESS){
         LOG(L_ERROR, "Failure sending variable \"id_unsorted\" to the server.\n");
         Logger::singleton()->printOpenCLError(err_code);
+        waitForUploads(events);
         throw std::runtime_error("OpenCL error");
     }
+    events.push_back(event);
 
+    // The host arrays shall be kept until the data is sent
+    waitForUploads(events);
     delete[] iset; iset = NULL;
     delete[] id; id = NULL;
 }
 
+void Particles::waitForUploads(std::vector<cl_event> &events)
+{
+    cl_int err_code;
+    if(!events.size())
+        return;
+    err_code = clWaitForEvents(events.size(), events.data());
+    for(auto event : events)
+        clReleaseEvent(event);
+    events.clear();
+    if(err_code != CL_SUCCESS){
+        LOG(L_ERROR, "Failure waiting for the variables upload.\n");
+        Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+}
+
 unsigned int Particles::file(const std::string basename,
                              unsigned int startindex,
                              unsigned int digits)
@@ -155,27 +196,56 @@ unsigned int Particles::file(const std::string basename,
 
 std::vector<void*> Particles::download(std::vector<std::string> fields)
 {
-    std::vector<void*> data;
     std::vector<cl_event> events;
+    std::vector<void*> data = download(fields, events);
+
+    // Wait until all the data has been downloaded
+    bool failed = false;
+    for(auto event : events){
+        failed = !waitForDownload(event) || failed;
+    }
+    if(failed){
+        clearList(&data);
+        throw std::runtime_error("OpenCL error");
+    }
+
+    return data;
+}
+
+std::vector<void*> Particles::download(std::vector<std::string> fields,
+                                       std::vector<cl_event> &events)
+{
+    std::vector<void*> data;
     size_t typesize, len;
     cl_int err_code;
     CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
     Variables *vars = C->variables();
 
+    // Unsort all the fields at once. The variables are checked afterwards
+    C->getUnsorters(fields, bounds().x, n());
+
+    // Select the particles to be saved, if a filter has been set
+    CalcServer::OutputFilter *filter = outputFilter();
+    _n_download = n();
+    if(filter){
+        filter->execute();
+        _n_download = filter->n();
+    }
+
     for(auto field : fields){
         if(!vars->get(field)){
             std::ostringstream msg;
             msg << "Can't download undeclared variable \"" << field
                 << "\"." << std::endl;
             LOG(L_ERROR, msg.str());
-            clearList(&data);
+            clearList(&data, &events);
             throw std::runtime_error("Invalid variable");
         }
         if(vars->get(field)->type().find('*') == std::string::npos){
             std::ostringstream msg;
             msg << "Variable \"" << field << "\" is a scalar." << std::endl;
             LOG(L_ERROR, msg.str());
-            clearList(&data);
+            clearList(&data, &events);
             throw std::runtime_error("Invalid variable type");
         }
         ArrayVariable *var = (ArrayVariable*)vars->get(field);
@@ -189,64 +259,161 @@ std::vector<void*> Particles::download(std::vector<std::string> fields)
             msg << "length = " << bounds().y << "is required, but just "
                 << len << " components are available." << std::endl;
             LOG0(L_DEBUG, msg.str());
-            clearList(&data);
+            clearList(&data, &events);
             throw std::runtime_error("Invalid variable length");
         }
-        void *store = malloc(typesize * (bounds().y - bounds().x));
+        void *store = C->allocatePinned(typesize * (bounds().y - bounds().x));
         if(!store){
             std::ostringstream msg;
             msg << "Failure allocating " << typesize * (bounds().y - bounds().x)
                 << "bytes for variable \"" << field << "\"." << std::endl;
             LOG(L_ERROR, msg.str());
-            clearList(&data);
+            clearList(&data, &events);
             throw std::bad_alloc();
         }
         data.push_back(store);
 
         cl_event event;
         try {
-            event = C->getUnsortedMem(
-                var->name().c_str(),
-                typesize * bounds().x,
-                typesize * (bounds().y - bounds().x),
-                store);
+            if(filter){
+                event = filter->download(var->name(), store);
+            }
+            else{
+                event = C->getUnsortedMem(
+                    var->name().c_str(),
+                    typesize * bounds().x,
+                    typesize * (bounds().y - bounds().x),
+                    store);
+            }
         } catch (...) {
-            clearList(&data);
+            clearList(&data, &events);
             throw;
         }
+        if(!event){
+            if(!_n_download){
+                // Nothing selected to be downloaded
+                events.push_back(NULL);
+                continue;
+            }
+            std::ostringstream msg;
+            msg << "Failure downloading the variable \"" << field
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            clearList(&data, &events);
+            throw std::runtime_error("OpenCL error");
+        }
 
         events.push_back(event);
     }
 
-    // Wait until all the data has been downloaded
-    err_code = clWaitForEvents(events.size(),
-                               events.data());
+    // Start the transfers right now, without waiting for them
+    err_code = clFlush(C->command_queue());
     if(err_code != CL_SUCCESS){
-        LOG(L_ERROR, "Failure waiting for the variables download.\n");
+        LOG(L_ERROR, "Failure flushing the variables download.\n");
         Logger::singleton()->printOpenCLError(err_code);
-        clearList(&data);
+        clearList(&data, &events);
         throw std::runtime_error("OpenCL error");
     }
 
-    // Destroy the events
-    for(auto event : events){
-        err_code = clReleaseEvent(event);
-        if(err_code != CL_SUCCESS){
-            LOG(L_ERROR, "Failure releasing the events.\n");
-            Logger::singleton()->printOpenCLError(err_code);
-            clearList(&data);
-            throw std::runtime_error("OpenCL error");
+    return data;
+}
+
+bool Particles::waitForDownload(cl_event event)
+{
+    cl_int err_code;
+    if(!event)
+        return true;
+    err_code = clWaitForEvents(1, &event);
+    if(err_code != CL_SUCCESS){
+        Logger::singleton()->addMessageF(L_ERROR,
+            "Failure waiting for the variables download.\n");
+        Logger::singleton()->printOpenCLError(err_code);
+    }
+    cl_int err_release = clReleaseEvent(event);
+    if(err_release != CL_SUCCESS){
+        Logger::singleton()->addMessageF(L_ERROR,
+            "Failure releasing the events.\n");
+        Logger::singleton()->printOpenCLError(err_release);
+    }
+    return (err_code == CL_SUCCESS) && (err_release == CL_SUCCESS);
+}
+
+CalcServer::OutputFilter* Particles::outputFilter()
+{
+    if(_filter_checked)
+        return _filter;
+    _filter_checked = true;
+
+    const ProblemSetup::sphParticlesSet *set = simData().sets.at(setId());
+    const std::string stride = set->outputOption("stride");
+    const std::string box_min = set->outputOption("box_min");
+    const std::string box_max = set->outputOption("box_max");
+    const std::string select = set->outputOption("select");
+    std::string select_min = set->outputOption("select_min");
+    std::string select_max = set->outputOption("select_max");
+    if(stride.empty() && box_min.empty() && box_max.empty() && select.empty())
+        return NULL;
+
+    if(box_min.empty() != box_max.empty()){
+        std::ostringstream msg;
+        msg << "Both \"box_min\" and \"box_max\" shall be set for the "
+            << "particles set " << setId() << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid output options");
+    }
+    unsigned int k = 1;
+    if(!stride.empty()){
+        try {
+            k = std::stoi(stride);
+        } catch(std::exception &e) {
+            k = 0;
+        }
+        if(!k){
+            std::ostringstream msg;
+            msg << "Invalid output stride \"" << stride
+                << "\" for the particles set " << setId() << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw std::runtime_error("Invalid output options");
         }
     }
+    if(select_min.empty())
+        select_min = "-INFINITY";
+    if(select_max.empty())
+        select_max = "INFINITY";
 
-    return data;
+    std::ostringstream name;
+    name << "__output_filter_" << setId();
+    _filter = new CalcServer::OutputFilter(name.str(),
+                                           bounds().x,
+                                           n(),
+                                           k,
+                                           box_min,
+                                           box_max,
+                                           select,
+                                           select_min,
+                                           select_max);
+    try {
+        _filter->setup();
+    } catch(...) {
+        delete _filter; _filter = NULL;
+        throw;
+    }
+    return _filter;
 }
 
-void Particles::clearList(std::vector<void*> *data)
+void Particles::clearList(std::vector<void*> *data,
+                          std::vector<cl_event> *events)
 {
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    // The pending transfers shall be finished before releasing the memory
+    if(events){
+        for(auto event : *events){
+            waitForDownload(event);
+        }
+        events->clear();
+    }
     for(auto d : *data){
-        if(d)
-            free(d);
+        C->releasePinned(d);
     }
     data->clear();
 }
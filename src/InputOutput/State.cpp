@@ -328,6 +328,172 @@ void State::parseSettings(DOMElement *root,
             sim_data.settings.base_path = xmlAttribute(s_elem, "path");
         }
 
+        s_nodes = elem->getElementsByTagName(xmlS("CommandQueues"));
+        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+            DOMNode* s_node = s_nodes->item(j);
+            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                continue;
+            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+            int n_queues = std::stoi(xmlAttribute(s_elem, "value"));
+            if(n_queues < 1){
+                std::ostringstream msg;
+                msg << "Invalid number of command queues, " << n_queues
+                    << std::endl;
+                LOG(L_ERROR, msg.str());
+                LOG0(L_DEBUG, "\tAt least 1 command queue is required\n");
+                throw std::runtime_error("Invalid number of command queues");
+            }
+            sim_data.settings.n_queues = n_queues;
+        }
+
+        s_nodes = elem->getElementsByTagName(xmlS("StepBarrier"));
+        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+            DOMNode* s_node = s_nodes->item(j);
+            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                continue;
+            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+            std::string value = toLowerCopy(xmlAttribute(s_elem, "value"));
+            if(!value.compare("none")){
+                sim_data.settings.barrier_steps = 0;
+            }
+            else if(!value.compare("output")){
+                sim_data.settings.barrier_steps = -1;
+            }
+            else{
+                int barrier_steps = std::stoi(value);
+                if(barrier_steps < 1){
+                    std::ostringstream msg;
+                    msg << "Invalid time steps barrier period, "
+                        << barrier_steps << std::endl;
+                    LOG(L_ERROR, msg.str());
+                    LOG0(L_DEBUG, "\tValid values are \"none\", \"output\" or a positive number of steps\n");
+                    throw std::runtime_error("Invalid barrier period");
+                }
+                sim_data.settings.barrier_steps = barrier_steps;
+            }
+        }
+
+        s_nodes = elem->getElementsByTagName(xmlS("ProgramsCache"));
+        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+            DOMNode* s_node = s_nodes->item(j);
+            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                continue;
+            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+            sim_data.settings.cache_path = xmlAttribute(s_elem, "path");
+        }
+
+        s_nodes = elem->getElementsByTagName(xmlS("WorkGroupsAutotune"));
+        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+            DOMNode* s_node = s_nodes->item(j);
+            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                continue;
+            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+            if(!toLowerCopy(xmlAttribute(s_elem, "value")).compare("true")){
+                sim_data.settings.autotune = true;
+            }
+            else{
+                sim_data.settings.autotune = false;
+            }
+            if(xmlHasAttribute(s_elem, "file")){
+                sim_data.settings.autotune_file = xmlAttribute(s_elem, "file");
+            }
+        }
+
+        s_nodes = elem->getElementsByTagName(xmlS("ZeroCopy"));
+        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+            DOMNode* s_node = s_nodes->item(j);
+            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                continue;
+            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+            if(!toLowerCopy(xmlAttribute(s_elem, "value")).compare("true")){
+                sim_data.settings.zero_copy = true;
+            }
+            else{
+                sim_data.settings.zero_copy = false;
+            }
+        }
+
+        s_nodes = elem->getElementsByTagName(xmlS("PipelineAnalysis"));
+        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+            DOMNode* s_node = s_nodes->item(j);
+            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                continue;
+            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+            if(!toLowerCopy(xmlAttribute(s_elem, "value")).compare("true")){
+                sim_data.settings.pipeline_analysis = true;
+            }
+            else{
+                sim_data.settings.pipeline_analysis = false;
+            }
+        }
+
+        s_nodes = elem->getElementsByTagName(xmlS("Writers"));
+        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+            DOMNode* s_node = s_nodes->item(j);
+            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                continue;
+            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+            if(xmlHasAttribute(s_elem, "threads")){
+                sim_data.settings.writers_threads = std::max(
+                    std::stoi(xmlAttribute(s_elem, "threads")), 1);
+            }
+            if(xmlHasAttribute(s_elem, "queue")){
+                sim_data.settings.writers_queue = std::max(
+                    std::stoi(xmlAttribute(s_elem, "queue")), 1);
+            }
+            if(xmlHasAttribute(s_elem, "memory")){
+                sim_data.settings.writers_memory =
+                    std::stoul(xmlAttribute(s_elem, "memory")) << 20;
+            }
+        }
+
+        s_nodes = elem->getElementsByTagName(xmlS("Checkpoint"));
+        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+            DOMNode* s_node = s_nodes->item(j);
+            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                continue;
+            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+            if(xmlHasAttribute(s_elem, "file")){
+                sim_data.settings.checkpoint_path =
+                    xmlAttribute(s_elem, "file");
+            }
+            if(xmlHasAttribute(s_elem, "interval")){
+                sim_data.settings.checkpoint_interval = std::max(
+                    std::stof(xmlAttribute(s_elem, "interval")), 0.f);
+            }
+            if(xmlHasAttribute(s_elem, "restart")){
+                sim_data.settings.restart_path =
+                    xmlAttribute(s_elem, "restart");
+            }
+            if(xmlHasAttribute(s_elem, "on_term")){
+                sim_data.settings.checkpoint_on_term = !toLowerCopy(
+                    xmlAttribute(s_elem, "on_term")).compare("true");
+            }
+        }
+
+        s_nodes = elem->getElementsByTagName(xmlS("Trace"));
+        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+            DOMNode* s_node = s_nodes->item(j);
+            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                continue;
+            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+            if(xmlHasAttribute(s_elem, "file")){
+                sim_data.settings.trace_path = xmlAttribute(s_elem, "file");
+            }
+            if(xmlHasAttribute(s_elem, "start")){
+                sim_data.settings.trace_start = std::max(
+                    std::stoi(xmlAttribute(s_elem, "start")), 0);
+            }
+            if(xmlHasAttribute(s_elem, "iters")){
+                sim_data.settings.trace_iters = std::max(
+                    std::stoi(xmlAttribute(s_elem, "iters")), 1);
+            }
+            if(xmlHasAttribute(s_elem, "buffer")){
+                sim_data.settings.trace_buffer = std::max(
+                    std::stoi(xmlAttribute(s_elem, "buffer")), 1);
+            }
+        }
+
         s_nodes = elem->getElementsByTagName(xmlS("Device"));
         for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
             DOMNode* s_node = s_nodes->item(j);
@@ -409,7 +575,8 @@ void State::parseVariables(DOMElement *root,
                 sim_data.variables.registerVariable(var_name,
                                                     xmlAttribute(s_elem, "type"),
                                                     xmlAttribute(s_elem, "length"),
-                                                    "");
+                                                    "",
+                                                    !xmlAttribute(s_elem, "scratch").compare("true"));
             }
         }
     }
@@ -843,14 +1010,26 @@ void State::parseTools(DOMElement *root,
                 else{
                     tool->set("n", xmlAttribute(s_elem, "n"));
                 }
+                if(xmlHasAttribute(s_elem, "fuse")){
+                    tool->set("fuse", xmlAttribute(s_elem, "fuse"));
+                }
+                if(xmlHasAttribute(s_elem, "constants")){
+                    tool->set("constants", xmlAttribute(s_elem, "constants"));
+                }
+                if(xmlHasAttribute(s_elem, "set")){
+                    tool->set("set", xmlAttribute(s_elem, "set"));
+                }
             }
-            else if(!xmlAttribute(s_elem, "type").compare("copy")){
+            else if(!xmlAttribute(s_elem, "type").compare("copy") ||
+                    !xmlAttribute(s_elem, "type").compare("swap")){
                 const char *atts[2] = {"in", "out"};
                 for(unsigned int k = 0; k < 2; k++){
                     if(!xmlHasAttribute(s_elem, atts[k])){
                         std::ostringstream msg;
                         msg << "Tool \"" << tool->get("name")
-                            << "\" is of type \"copy\", but \"" << atts[k]
+                            << "\" is of type \""
+                            << xmlAttribute(s_elem, "type")
+                            << "\", but \"" << atts[k]
                             << "\" is not defined." << std::endl;
                         LOG(L_ERROR, msg.str());
                         throw std::runtime_error("Missing attributes");
@@ -868,6 +1047,18 @@ void State::parseTools(DOMElement *root,
                     throw std::runtime_error("Undefined Python script path");
                 }
                 tool->set("path", xmlAttribute(s_elem, "path"));
+                if(xmlHasAttribute(s_elem, "async")){
+                    tool->set("async", xmlAttribute(s_elem, "async"));
+                }
+                else{
+                    tool->set("async", "false");
+                }
+                if(xmlHasAttribute(s_elem, "in")){
+                    tool->set("in", xmlAttribute(s_elem, "in"));
+                }
+                else{
+                    tool->set("in", "");
+                }
             }
             else if(!xmlAttribute(s_elem, "type").compare("set")){
                 const char *atts[2] = {"in", "value"};
@@ -883,6 +1074,20 @@ void State::parseTools(DOMElement *root,
                     tool->set(atts[k], xmlAttribute(s_elem, atts[k]));
                 }
             }
+            else if(!xmlAttribute(s_elem, "type").compare("compact")){
+                const char *atts[4] = {"in", "out", "n", "condition"};
+                for(unsigned int k = 0; k < 4; k++){
+                    if(!xmlHasAttribute(s_elem, atts[k])){
+                        std::ostringstream msg;
+                        msg << "Tool \"" << tool->get("name")
+                            << "\" is of type \"compact\", but \"" << atts[k]
+                            << "\" is not defined." << std::endl;
+                        LOG(L_ERROR, msg.str());
+                        throw std::runtime_error("Missing attributes");
+                    }
+                    tool->set(atts[k], xmlAttribute(s_elem, atts[k]));
+                }
+            }
             else if(!xmlAttribute(s_elem, "type").compare("set_scalar")){
                 const char *atts[2] = {"in", "value"};
                 for(unsigned int k = 0; k < 2; k++){
@@ -918,14 +1123,51 @@ void State::parseTools(DOMElement *root,
                     throw std::runtime_error("Missing reduction operation");
                 }
                 tool->set("operation", xmlS(s_elem->getTextContent()));
+                if(xmlHasAttribute(s_elem, "fuse")){
+                    tool->set("fuse", xmlAttribute(s_elem, "fuse"));
+                }
             }
             else if(!xmlAttribute(s_elem, "type").compare("link-list")){
+                if(xmlHasAttribute(s_elem, "incremental")){
+                    tool->set("incremental",
+                              toLowerCopy(xmlAttribute(s_elem, "incremental")));
+                }
+                if(xmlHasAttribute(s_elem, "sort_bits")){
+                    tool->set("sort_bits", xmlAttribute(s_elem, "sort_bits"));
+                }
+                if(xmlHasAttribute(s_elem, "margin")){
+                    tool->set("margin", xmlAttribute(s_elem, "margin"));
+                }
                 if(!xmlHasAttribute(s_elem, "in")){
                     tool->set("in", "r");
                     continue;
                 }
                 tool->set("in", xmlAttribute(s_elem, "in"));
             }
+            else if(!xmlAttribute(s_elem, "type").compare("neighbour-list")){
+                tool->set("in", "r");
+                if(xmlHasAttribute(s_elem, "in"))
+                    tool->set("in", xmlAttribute(s_elem, "in"));
+                tool->set("skin", "0");
+                if(xmlHasAttribute(s_elem, "skin"))
+                    tool->set("skin", xmlAttribute(s_elem, "skin"));
+                if(xmlHasAttribute(s_elem, "max_neighs"))
+                    tool->set("max_neighs", xmlAttribute(s_elem, "max_neighs"));
+            }
+            else if(!xmlAttribute(s_elem, "type").compare("permute")){
+                if(!xmlHasAttribute(s_elem, "fields")){
+                    std::ostringstream msg;
+                    msg << "Tool \"" << tool->get("name")
+                        << "\" is of type \"permute\", but \"fields\" is not defined."
+                        << std::endl;
+                    LOG(L_ERROR, msg.str());
+                    throw std::runtime_error("Missing attribute");
+                }
+                tool->set("fields", xmlAttribute(s_elem, "fields"));
+                tool->set("perm", "id_sorted");
+                if(xmlHasAttribute(s_elem, "perm"))
+                    tool->set("perm", xmlAttribute(s_elem, "perm"));
+            }
             else if(!xmlAttribute(s_elem, "type").compare("radix-sort")){
                 const char *atts[3] = {"in", "perm", "inv_perm"};
                 for(unsigned int k = 0; k < 3; k++){
@@ -939,6 +1181,11 @@ void State::parseTools(DOMElement *root,
                     }
                     tool->set(atts[k], xmlAttribute(s_elem, atts[k]));
                 }
+                const char *dims[4] = {"bits", "items", "groups", "splits"};
+                for(unsigned int k = 0; k < 4; k++){
+                    if(xmlHasAttribute(s_elem, dims[k]))
+                        tool->set(dims[k], xmlAttribute(s_elem, dims[k]));
+                }
             }
             else if(!xmlAttribute(s_elem, "type").compare("assert")){
                 if(!xmlHasAttribute(s_elem, "condition")){
@@ -950,6 +1197,11 @@ void State::parseTools(DOMElement *root,
                     throw std::runtime_error("Missing attribute");
                 }
                 tool->set("condition", xmlAttribute(s_elem, "condition"));
+                const char *opts[2] = {"period", "deferred"};
+                for(unsigned int k = 0; k < 2; k++){
+                    if(xmlHasAttribute(s_elem, opts[k]))
+                        tool->set(opts[k], xmlAttribute(s_elem, opts[k]));
+                }
             }
             else if(!xmlAttribute(s_elem, "type").compare("if")){
                 if(!xmlHasAttribute(s_elem, "condition")){
@@ -972,6 +1224,12 @@ void State::parseTools(DOMElement *root,
                     throw std::runtime_error("Missing attribute");
                 }
                 tool->set("condition", xmlAttribute(s_elem, "condition"));
+                if(xmlHasAttribute(s_elem, "batch")){
+                    tool->set("batch", xmlAttribute(s_elem, "batch"));
+                }
+                else{
+                    tool->set("batch", "1");
+                }
             }
             else if(!xmlAttribute(s_elem, "type").compare("endif")){
             }
@@ -993,11 +1251,47 @@ void State::parseTools(DOMElement *root,
                 }
 
                 if(xmlHasAttribute(s_elem, "processes")){
-                    tool->set("procs", xmlAttribute(s_elem, "processes"));
+                    tool->set("processes", xmlAttribute(s_elem, "processes"));
                 }
                 else {
-                    tool->set("procs", xmlAttribute(s_elem, ""));
+                    tool->set("processes", "");
+                }
+            }
+            else if(!xmlAttribute(s_elem, "type").compare("mpi-balance")){
+                const char *atts[2] = {"load", "shift"};
+                for(unsigned int k = 0; k < 2; k++){
+                    if(!xmlHasAttribute(s_elem, atts[k])){
+                        std::ostringstream msg;
+                        msg << "Tool \"" << tool->get("name")
+                            << "\" is of type \"mpi-balance\", but \"" << atts[k]
+                            << "\" is not defined." << std::endl;
+                        LOG(L_ERROR, msg.str());
+                        throw std::runtime_error("Missing attribute");
+                    }
+                    tool->set(atts[k], xmlAttribute(s_elem, atts[k]));
+                }
+                const char *opts[3] = {"period", "relax", "min_width"};
+                for(unsigned int k = 0; k < 3; k++){
+                    if(xmlHasAttribute(s_elem, opts[k]))
+                        tool->set(opts[k], xmlAttribute(s_elem, opts[k]));
+                }
+            }
+            else if(!xmlAttribute(s_elem, "type").compare("mpi-reduction")){
+                const char *atts[2] = {"in", "out"};
+                for(unsigned int k = 0; k < 2; k++){
+                    if(!xmlHasAttribute(s_elem, atts[k])){
+                        std::ostringstream msg;
+                        msg << "Tool \"" << tool->get("name")
+                            << "\" is of type \"mpi-reduction\", but \"" << atts[k]
+                            << "\" is not defined." << std::endl;
+                        LOG(L_ERROR, msg.str());
+                        throw std::runtime_error("Missing attribute");
+                    }
+                    tool->set(atts[k], xmlAttribute(s_elem, atts[k]));
                 }
+                tool->set("operation", "sum");
+                if(xmlHasAttribute(s_elem, "operation"))
+                    tool->set("operation", xmlAttribute(s_elem, "operation"));
             }
 #endif
             else if(!xmlAttribute(s_elem, "type").compare("installable")){
@@ -1106,6 +1400,18 @@ void State::parseTools(DOMElement *root,
                 else{
                     tool->set("path", "");
                 }
+                if(xmlHasAttribute(s_elem, "mpi")){
+                    tool->set("mpi", xmlAttribute(s_elem, "mpi"));
+                }
+                else{
+                    tool->set("mpi", "false");
+                }
+                if(xmlHasAttribute(s_elem, "roofline")){
+                    tool->set("roofline", xmlAttribute(s_elem, "roofline"));
+                }
+                else{
+                    tool->set("roofline", "");
+                }
             }
             else{
                 std::ostringstream msg;
@@ -1115,9 +1421,11 @@ void State::parseTools(DOMElement *root,
                 LOG0(L_DEBUG, "\tThe valid types are:\n");
                 LOG0(L_DEBUG, "\t\tkernel\n");
                 LOG0(L_DEBUG, "\t\tcopy\n");
+                LOG0(L_DEBUG, "\t\tswap\n");
                 LOG0(L_DEBUG, "\t\tpython\n");
                 LOG0(L_DEBUG, "\t\tset\n");
                 LOG0(L_DEBUG, "\t\tset_scalar\n");
+                LOG0(L_DEBUG, "\t\tcompact\n");
                 LOG0(L_DEBUG, "\t\treduction\n");
                 LOG0(L_DEBUG, "\t\tlink-list\n");
                 LOG0(L_DEBUG, "\t\tradix-sort\n");
@@ -1239,50 +1547,82 @@ void State::parseSets(DOMElement *root,
             continue;
         DOMElement* elem = dynamic_cast<xercesc::DOMElement*>(node);
 
-        ProblemSetup::sphParticlesSet *set = new ProblemSetup::sphParticlesSet();
-        // Now the number of particles can be let unknown, and will be
-        // determined later, from the input file. See FileManager::load()
-        unsigned int n = 0;
-        if(xmlHasAttribute(elem, "n")){
-            set->n(std::stoi(xmlAttribute(elem, "n")));
+        // The same set can be replicated several times, to run an ensemble
+        // of independent cases
+        unsigned int replicas = 1;
+        if(xmlHasAttribute(elem, "replicas")){
+            replicas = std::stoi(xmlAttribute(elem, "replicas"));
         }
+        for(unsigned int r = 0; r < replicas; r++){
+            const std::string replica = std::to_string(r);
+            ProblemSetup::sphParticlesSet *set =
+                new ProblemSetup::sphParticlesSet();
+            // Now the number of particles can be let unknown, and will be
+            // determined later, from the input file. See FileManager::load()
+            if(xmlHasAttribute(elem, "n")){
+                set->n(std::stoi(xmlAttribute(elem, "n")));
+            }
 
-        DOMNodeList* s_nodes = elem->getElementsByTagName(xmlS("Scalar"));
-        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
-            DOMNode* s_node = s_nodes->item(j);
-            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
-                continue;
-            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+            DOMNodeList* s_nodes = elem->getElementsByTagName(xmlS("Scalar"));
+            for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+                DOMNode* s_node = s_nodes->item(j);
+                if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                    continue;
+                DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
 
-            std::string name = xmlAttribute(s_elem, "name");
-            std::string value = xmlAttribute(s_elem, "value");
-            set->addScalar(name, value);
-        }
+                std::string name = xmlAttribute(s_elem, "name");
+                std::string value = replaceAllCopy(xmlAttribute(s_elem, "value"),
+                                                   "{replica}",
+                                                   replica);
+                set->addScalar(name, value);
+            }
 
-        s_nodes = elem->getElementsByTagName(xmlS("Load"));
-        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
-            DOMNode* s_node = s_nodes->item(j);
-            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
-                continue;
-            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
-            std::string path = xmlAttribute(s_elem, "file");
-            std::string format = xmlAttribute(s_elem, "format");
-            std::string fields = xmlAttribute(s_elem, "fields");
-            set->input(path, format, fields);
-        }
+            s_nodes = elem->getElementsByTagName(xmlS("Load"));
+            for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+                DOMNode* s_node = s_nodes->item(j);
+                if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                    continue;
+                DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+                std::string path = replaceAllCopy(xmlAttribute(s_elem, "file"),
+                                                  "{replica}",
+                                                  replica);
+                std::string format = xmlAttribute(s_elem, "format");
+                std::string fields = xmlAttribute(s_elem, "fields");
+                set->input(path, format, fields);
+            }
 
-        s_nodes = elem->getElementsByTagName(xmlS("Save"));
-        for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
-            DOMNode* s_node = s_nodes->item(j);
-            if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
-                continue;
-            DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
-            std::string path = xmlAttribute(s_elem, "file");
-            std::string format = xmlAttribute(s_elem, "format");
-            std::string fields = xmlAttribute(s_elem, "fields");
-            set->output(path, format, fields);
+            s_nodes = elem->getElementsByTagName(xmlS("Save"));
+            for(XMLSize_t j=0; j<s_nodes->getLength(); j++){
+                DOMNode* s_node = s_nodes->item(j);
+                if(s_node->getNodeType() != DOMNode::ELEMENT_NODE)
+                    continue;
+                DOMElement* s_elem = dynamic_cast<xercesc::DOMElement*>(s_node);
+                std::string path = xmlAttribute(s_elem, "file");
+                if((replicas > 1) &&
+                   (path.find("{replica}") == std::string::npos)){
+                    std::ostringstream msg;
+                    msg << "The particles set " << i << " has " << replicas
+                        << " replicas, but its output file \"" << path
+                        << "\" does not depend on \"{replica}\"." << std::endl;
+                    LOG(L_ERROR, msg.str());
+                    throw std::runtime_error("Overlapping output files");
+                }
+                path = replaceAllCopy(path, "{replica}", replica);
+                std::string format = xmlAttribute(s_elem, "format");
+                std::string fields = xmlAttribute(s_elem, "fields");
+                set->output(path, format, fields);
+                DOMNamedNodeMap *attrs = s_elem->getAttributes();
+                for(XMLSize_t k=0; k<attrs->getLength(); k++){
+                    DOMNode *attr = attrs->item(k);
+                    std::string name = xmlS(attr->getNodeName());
+                    if(!name.compare("file") || !name.compare("format") ||
+                       !name.compare("fields"))
+                        continue;
+                    set->outputOption(name, xmlS(attr->getNodeValue()));
+                }
+            }
+            sim_data.sets.push_back(set);
         }
-        sim_data.sets.push_back(set);
     }
 }
 
@@ -1413,6 +1753,34 @@ void State::parseReports(DOMElement *root,
                 else{
                     report->set("path", "");
                 }
+                if(xmlHasAttribute(s_elem, "mpi")){
+                    report->set("mpi", xmlAttribute(s_elem, "mpi"));
+                }
+                else{
+                    report->set("mpi", "false");
+                }
+                if(xmlHasAttribute(s_elem, "roofline")){
+                    report->set("roofline", xmlAttribute(s_elem, "roofline"));
+                }
+                else{
+                    report->set("roofline", "");
+                }
+            }
+            else if(!xmlAttribute(s_elem, "type").compare("metrics")){
+                if(!xmlHasAttribute(s_elem, "path")){
+                    std::ostringstream msg;
+                    msg << "Report \"" << report->get("name")
+                        << "\" is of type \"metrics\", but the output \"path\" is not defined." << std::endl;
+                    LOG(L_ERROR, msg.str());
+                    throw std::runtime_error("Missing report file path");
+                }
+                report->set("path", xmlAttribute(s_elem, "path"));
+                if(xmlHasAttribute(s_elem, "period")){
+                    report->set("period", xmlAttribute(s_elem, "period"));
+                }
+                else{
+                    report->set("period", "5.0");
+                }
             }
             else{
                 std::ostringstream msg;
@@ -1424,6 +1792,7 @@ void State::parseReports(DOMElement *root,
                 LOG0(L_DEBUG, "\t\tfile\n");
                 LOG0(L_DEBUG, "\t\tparticles\n");
                 LOG0(L_DEBUG, "\t\tperformance\n");
+                LOG0(L_DEBUG, "\t\tmetrics\n");
                 throw std::runtime_error("Invalid report type");
             }
         }
@@ -1528,6 +1897,91 @@ void State::writeSettings(xercesc::DOMDocument* doc,
     s_elem = doc->createElement(xmlS("RootPath"));
     s_elem->setAttribute(xmlS("path"), xmlS(sim_data.settings.base_path));
     elem->appendChild(s_elem);
+
+    s_elem = doc->createElement(xmlS("CommandQueues"));
+    att.str(""); att << sim_data.settings.n_queues;
+    s_elem->setAttribute(xmlS("value"), xmlS(att.str()));
+    elem->appendChild(s_elem);
+
+    s_elem = doc->createElement(xmlS("StepBarrier"));
+    att.str("");
+    if(sim_data.settings.barrier_steps == 0)
+        att << "none";
+    else if(sim_data.settings.barrier_steps < 0)
+        att << "output";
+    else
+        att << sim_data.settings.barrier_steps;
+    s_elem->setAttribute(xmlS("value"), xmlS(att.str()));
+    elem->appendChild(s_elem);
+
+    if(sim_data.settings.cache_path != "") {
+        s_elem = doc->createElement(xmlS("ProgramsCache"));
+        s_elem->setAttribute(xmlS("path"),
+                             xmlS(sim_data.settings.cache_path));
+        elem->appendChild(s_elem);
+    }
+
+    s_elem = doc->createElement(xmlS("WorkGroupsAutotune"));
+    if(sim_data.settings.autotune)
+        s_elem->setAttribute(xmlS("value"), xmlS("true"));
+    else
+        s_elem->setAttribute(xmlS("value"), xmlS("false"));
+    if(sim_data.settings.autotune_file != "") {
+        s_elem->setAttribute(xmlS("file"),
+                             xmlS(sim_data.settings.autotune_file));
+    }
+    elem->appendChild(s_elem);
+
+    s_elem = doc->createElement(xmlS("ZeroCopy"));
+    if(sim_data.settings.zero_copy)
+        s_elem->setAttribute(xmlS("value"), xmlS("true"));
+    else
+        s_elem->setAttribute(xmlS("value"), xmlS("false"));
+    elem->appendChild(s_elem);
+
+    s_elem = doc->createElement(xmlS("PipelineAnalysis"));
+    if(sim_data.settings.pipeline_analysis)
+        s_elem->setAttribute(xmlS("value"), xmlS("true"));
+    else
+        s_elem->setAttribute(xmlS("value"), xmlS("false"));
+    elem->appendChild(s_elem);
+
+    s_elem = doc->createElement(xmlS("Writers"));
+    att.str(""); att << sim_data.settings.writers_threads;
+    s_elem->setAttribute(xmlS("threads"), xmlS(att.str()));
+    att.str(""); att << sim_data.settings.writers_queue;
+    s_elem->setAttribute(xmlS("queue"), xmlS(att.str()));
+    att.str(""); att << (sim_data.settings.writers_memory >> 20);
+    s_elem->setAttribute(xmlS("memory"), xmlS(att.str()));
+    elem->appendChild(s_elem);
+
+    s_elem = doc->createElement(xmlS("Checkpoint"));
+    s_elem->setAttribute(xmlS("file"),
+                         xmlS(sim_data.settings.checkpoint_path));
+    att.str(""); att << sim_data.settings.checkpoint_interval;
+    s_elem->setAttribute(xmlS("interval"), xmlS(att.str()));
+    if(sim_data.settings.checkpoint_on_term)
+        s_elem->setAttribute(xmlS("on_term"), xmlS("true"));
+    else
+        s_elem->setAttribute(xmlS("on_term"), xmlS("false"));
+    if(sim_data.settings.restart_path != "") {
+        s_elem->setAttribute(xmlS("restart"),
+                             xmlS(sim_data.settings.restart_path));
+    }
+    elem->appendChild(s_elem);
+
+    if(sim_data.settings.trace_path != "") {
+        s_elem = doc->createElement(xmlS("Trace"));
+        s_elem->setAttribute(xmlS("file"),
+                             xmlS(sim_data.settings.trace_path));
+        att.str(""); att << sim_data.settings.trace_start;
+        s_elem->setAttribute(xmlS("start"), xmlS(att.str()));
+        att.str(""); att << sim_data.settings.trace_iters;
+        s_elem->setAttribute(xmlS("iters"), xmlS(att.str()));
+        att.str(""); att << sim_data.settings.trace_buffer;
+        s_elem->setAttribute(xmlS("buffer"), xmlS(att.str()));
+        elem->appendChild(s_elem);
+    }
     
     for(auto device : sim_data.settings.devices) {
         s_elem = doc->createElement(xmlS("Device"));
@@ -1788,6 +2242,9 @@ void State::writeSets(xercesc::DOMDocument* doc,
         s_elem->setAttribute(xmlS("file"), xmlS(sim_data.sets.at(i)->outputPath()));
         s_elem->setAttribute(xmlS("format"), xmlS(sim_data.sets.at(i)->outputFormat()));
         s_elem->setAttribute(xmlS("fields"), xmlS(fields.str()));
+        for(auto option : sim_data.sets.at(i)->outputOptions()) {
+            s_elem->setAttribute(xmlS(option.first), xmlS(option.second));
+        }
         elem->appendChild(s_elem);
     }
 }
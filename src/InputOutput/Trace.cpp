@@ -0,0 +1,239 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file
+ * @brief Timeline traces of the simulation.
+ * (See Aqua::InputOutput::Trace for details)
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <InputOutput/Trace.h>
+#include <InputOutput/Logger.h>
+#include <Variable.h>
+#include <AuxiliarMethods.h>
+
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+
+namespace Aqua{ namespace InputOutput{
+
+/// Number of host stall sources written in the trace
+#define TRACE_TOP_STALLS 10
+
+/** @brief Escape a string to be written as a JSON value
+ * @param str String to escape
+ * @return Escaped string
+ */
+static std::string jsonEscape(const std::string str)
+{
+    std::string escaped;
+    for(auto c : str){
+        if((c == '"') || (c == '\\'))
+            escaped += '\\';
+        if((unsigned char)c < 0x20)
+            continue;
+        escaped += c;
+    }
+    return escaped;
+}
+
+Trace::Trace(const std::string path,
+             unsigned int start,
+             unsigned int iters,
+             unsigned int capacity)
+    : _path(setStrConstantsCopy(path))
+    , _start(start)
+    , _iters(iters ? iters : 1)
+    , _capacity(capacity ? capacity : 1)
+    , _pid(0)
+    , _recording(false)
+    , _dumped(false)
+    , _t0(std::chrono::steady_clock::now())
+{
+#ifdef HAVE_MPI
+    try {
+        _pid = MPI::COMM_WORLD.Get_rank();
+    } catch(MPI::Exception e){
+        _pid = 0;
+    }
+#endif
+    // The trace is created by the main thread
+    threadName("main");
+}
+
+Trace::~Trace()
+{
+    _recording = false;
+    if(!_dumped)
+        dump();
+    for(auto r : _rings){
+        delete r;
+    }
+    _rings.clear();
+}
+
+void Trace::step(unsigned int iter)
+{
+    if(_dumped)
+        return;
+    if(!recording() && (iter >= _start) && (iter < _start + _iters)){
+        std::ostringstream msg;
+        msg << "Tracing " << _iters << " time steps..." << std::endl;
+        LOG(L_INFO, msg.str());
+        _recording = true;
+    }
+    else if(recording() && (iter >= _start + _iters)){
+        _recording = false;
+        dump();
+    }
+}
+
+double Trace::now() const
+{
+    return std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now() - _t0).count();
+}
+
+void Trace::span(const char *category,
+                 const char *name,
+                 double t0,
+                 double t1,
+                 bool device)
+{
+    Ring *r = ring();
+    // Just this thread is writing on the ring, so the slot can be filled
+    // before publishing it
+    const size_t i = r->head.load(std::memory_order_relaxed);
+    Span &s = r->spans.at(i % _capacity);
+    strncpy(s.name, name, sizeof(s.name) - 1);
+    s.name[sizeof(s.name) - 1] = '\0';
+    s.category = category;
+    s.t0 = t0;
+    s.t1 = t1;
+    s.device = device;
+    r->head.store(i + 1, std::memory_order_release);
+}
+
+void Trace::threadName(const std::string name)
+{
+    Ring *r = ring();
+    std::lock_guard<std::mutex> lock(_mutex);
+    r->name = name;
+}
+
+Trace::Ring* Trace::ring()
+{
+    // The rings are registered just once per thread
+    static thread_local Trace *owner = NULL;
+    static thread_local Ring *r = NULL;
+    if((owner == this) && r)
+        return r;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    r = new Ring();
+    r->spans.resize(_capacity);
+    r->head = 0;
+    // 0 is reserved for the device track
+    r->tid = _rings.size() + 1;
+    std::ostringstream name;
+    name << "thread " << r->tid;
+    r->name = name.str();
+    _rings.push_back(r);
+    owner = this;
+    return r;
+}
+
+void Trace::dump()
+{
+    _dumped = true;
+
+    std::ofstream f(_path.c_str(), std::ios::out);
+    if(!f.is_open()){
+        std::ostringstream msg;
+        msg << "Failure writing the trace file \"" << _path << "\""
+            << std::endl;
+        LOG(L_ERROR, msg.str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    f << std::fixed << std::setprecision(3);
+    f << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+    f << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << _pid
+      << ", \"tid\": 0, \"args\": {\"name\": \"rank " << _pid << "\"}}";
+    f << "," << std::endl
+      << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << _pid
+      << ", \"tid\": 0, \"args\": {\"name\": \"device\"}}";
+    size_t n_spans = 0, n_lost = 0;
+    for(auto r : _rings){
+        f << "," << std::endl
+          << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << _pid
+          << ", \"tid\": " << r->tid << ", \"args\": {\"name\": \""
+          << jsonEscape(r->name) << "\"}}";
+        const size_t head = r->head.load(std::memory_order_acquire);
+        const size_t first = (head > _capacity) ? head - _capacity : 0;
+        n_lost += first;
+        for(size_t i = first; i < head; i++){
+            const Span &s = r->spans.at(i % _capacity);
+            f << "," << std::endl
+              << "{\"name\": \"" << jsonEscape(s.name)
+              << "\", \"cat\": \"" << s.category
+              << "\", \"ph\": \"X\", \"ts\": " << s.t0
+              << ", \"dur\": " << s.t1 - s.t0
+              << ", \"pid\": " << _pid
+              << ", \"tid\": " << (s.device ? 0 : r->tid) << "}";
+        }
+        n_spans += head - first;
+    }
+    f << std::endl << "]," << std::endl;
+
+    // The top host stall sources, which are the syncs to be removed to keep
+    // the device busy
+    f << "\"otherData\": {";
+    std::vector<SyncStall> stalls = Variable::stalls();
+    const size_t n_stalls = std::min(stalls.size(), (size_t)TRACE_TOP_STALLS);
+    for(unsigned int i = 0; i < n_stalls; i++){
+        const SyncStall &stall = stalls.at(i);
+        f << (i ? ", " : "") << std::endl
+          << "\"stall " << i << "\": \"" << jsonEscape(stall.variable)
+          << " (" << jsonEscape(stall.tool) << "): " << stall.time
+          << " s in " << stall.count << " syncs\"";
+    }
+    f << std::endl << "}}" << std::endl;
+    f.close();
+
+    std::ostringstream msg;
+    msg << "Trace written in \"" << _path << "\" (" << n_spans << " spans)"
+        << std::endl;
+    LOG(L_INFO, msg.str());
+    if(n_lost){
+        msg.str("");
+        msg << n_lost << " spans have been lost, consider a larger buffer"
+            << std::endl;
+        LOG(L_WARNING, msg.str());
+    }
+}
+
+}}  // namespace
@@ -27,13 +27,25 @@
 
 #include <unistd.h>
 #include <signal.h>
+#include <stdint.h>
+#include <fstream>
 
 #include <InputOutput/VTK.h>
 #include <InputOutput/Logger.h>
+#include <InputOutput/Writers.h>
 #include <ProblemSetup.h>
 #include <CalcServer.h>
 #include <AuxiliarMethods.h>
 
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+
+#if (VTK_MAJOR_VERSION > 8) || ((VTK_MAJOR_VERSION == 8) && (VTK_MINOR_VERSION >= 2))
+    /// LZ4 compression and the compression level are available since VTK 8.2
+    #define HAVE_VTK_LZ4
+#endif
+
 #include <vector>
 static std::vector<std::string> cpp_str;
 static std::vector<XMLCh*> xml_str;
@@ -215,19 +227,34 @@ void VTK::load()
         for(j = 0; j < fields.size(); j++){
             if(!fields.at(j).compare("r")){
                 double *vect = vtk_points->GetPoint(i);
-                vec *ptr = (vec*)data.at(j);
-                ptr[i].x = vect[0];
-                ptr[i].y = vect[1];
+                // The positions may be either vec or pvec
+                const unsigned int n_r = vars->typeToN(
+                    vars->get("r")->type());
+                float *ptr = (float*)data.at(j) + i * n_r;
+                ptr[0] = vect[0];
+                ptr[1] = vect[1];
                 #ifdef HAVE_3D
-                    ptr[i].z = vect[2];
-                    ptr[i].w = 0.f;
+                    ptr[2] = vect[2];
+                    if(n_r > 3)
+                        ptr[3] = 0.f;
                 #endif
                 continue;
             }
             ArrayVariable *var = (ArrayVariable*)vars->get(fields.at(j));
             size_t type_size = vars->typeToBytes(var->type());
             unsigned int n_components = vars->typeToN(var->type());
-            if(var->type().find("unsigned int") != std::string::npos ||
+            if(Variables::isHalfType(var->type())) {
+                vtkSmartPointer<vtkFloatArray> vtk_array =
+                    (vtkFloatArray*)(vtk_data->GetArray(fields.at(j).c_str(), aux));
+                for(k = 0; k < n_components; k++){
+                    cl_half component = floatToHalf(vtk_array->GetComponent(i, k));
+                    size_t offset = type_size * i + sizeof(cl_half) * k;
+                    memcpy((char*)data.at(j) + offset,
+                           &component,
+                           sizeof(cl_half));
+                }
+            }
+            else if(var->type().find("unsigned int") != std::string::npos ||
                var->type().find("uivec") != std::string::npos) {
                 vtkSmartPointer<vtkUnsignedIntArray> vtk_array =
                     (vtkUnsignedIntArray*)(vtk_data->GetArray(fields.at(j).c_str(), aux));
@@ -276,29 +303,38 @@ void VTK::load()
     }
 
     // Send the data to the server and release it
+    std::vector<cl_event> events;
     for(i = 0; i < fields.size(); i++){
         ArrayVariable *var = (ArrayVariable*)vars->get(fields.at(i));
         size_t typesize = vars->typeToBytes(var->type());
         cl_mem mem = *(cl_mem*)var->get();
+        cl_event event;
         err_code = clEnqueueWriteBuffer(C->command_queue(),
                                         mem,
-                                        CL_TRUE,
+                                        CL_FALSE,
                                         typesize * bounds().x,
                                         typesize * n,
                                         data.at(i),
                                         0,
                                         NULL,
-                                        NULL);
-        free(data.at(i)); data.at(i) = NULL;
+                                        &event);
         if(err_code != CL_SUCCESS){
             std::ostringstream msg;
             msg << "Failure sending variable \"" << fields.at(i)
                 << "\" to the computational device." << std::endl;
             LOG(L_ERROR, msg.str());
             Logger::singleton()->printOpenCLError(err_code);
+            waitForUploads(events);
+            for(auto d : data)
+                free(d);
+            data.clear();
             throw std::runtime_error("OpenCL error");
         }
+        events.push_back(event);
     }
+    waitForUploads(events);
+    for(auto d : data)
+        free(d);
     data.clear();
 }
 
@@ -315,6 +351,8 @@ typedef struct{
     CalcServer::CalcServer *C;
     /// The data associated to each field
     std::vector<void*> data;
+    /// The download events of each field
+    std::vector<cl_event> events;
     /// The VTK file decriptor
     vtkXMLUnstructuredGridWriter *f;
 }data_pthread;
@@ -328,6 +366,21 @@ void* save_pthread(void *data_void)
     unsigned int i, j;
     data_pthread *data = (data_pthread*)data_void;
 
+    // Wait for the data, which has been downloaded while the simulation was
+    // running
+    bool downloaded = true;
+    for(auto event : data->events)
+        downloaded = Particles::waitForDownload(event) && downloaded;
+    data->events.clear();
+    if(!downloaded){
+        for(auto d : data->data)
+            data->C->releasePinned(d);
+        data->data.clear();
+        data->f->Delete();
+        delete data; data=NULL;
+        return NULL;
+    }
+
     // Create storage arrays
     std::vector< vtkSmartPointer<vtkDataArray> > vtk_arrays;
     Variables *vars = data->C->variables();
@@ -338,7 +391,7 @@ void* save_pthread(void *data_void)
                 << "\"." << std::endl;
             data->S->addMessage(L_ERROR, msg.str());
             for(auto d : data->data)
-                free(d);
+                data->C->releasePinned(d);
             data->data.clear();
             data->f->Delete();
             delete data; data=NULL;
@@ -350,7 +403,7 @@ void* save_pthread(void *data_void)
                 << "\"." << std::endl;
             data->S->addMessage(L_ERROR, msg.str());
             for(auto d : data->data)
-                free(d);
+                data->C->releasePinned(d);
             data->data.clear();
             data->f->Delete();
             delete data; data=NULL;
@@ -365,7 +418,7 @@ void* save_pthread(void *data_void)
                 << "\" is not long enough." << std::endl;
             data->S->addMessageF(L_ERROR, msg.str());
             for(auto d : data->data)
-                free(d);
+                data->C->releasePinned(d);
             data->data.clear();
             data->f->Delete();
             delete data; data=NULL;
@@ -373,7 +426,15 @@ void* save_pthread(void *data_void)
         }
 
         unsigned int n_components = vars->typeToN(var->type());
-        if(var->type().find("unsigned int") != std::string::npos ||
+        if(Variables::isHalfType(var->type())) {
+            // Saved as float, since VTK has no half precision arrays
+            vtkSmartPointer<vtkFloatArray> vtk_array =
+                vtkSmartPointer<vtkFloatArray>::New();
+            vtk_array->SetNumberOfComponents(n_components);
+            vtk_array->SetName(field.c_str());
+            vtk_arrays.push_back(vtk_array);
+        }
+        else if(var->type().find("unsigned int") != std::string::npos ||
            var->type().find("uivec") != std::string::npos) {
             vtkSmartPointer<vtkUnsignedIntArray> vtk_array =
                 vtkSmartPointer<vtkUnsignedIntArray>::New();
@@ -407,11 +468,14 @@ void* save_pthread(void *data_void)
     for(i = 0; i < data->bounds.y - data->bounds.x; i++){
         for(j = 0; j < data->fields.size(); j++){
             if(!data->fields.at(j).compare("r")){
-                vec *ptr = (vec*)(data->data.at(j));
+                // The positions may be either vec or pvec
+                const unsigned int n_r = vars->typeToN(
+                    vars->get("r")->type());
+                float *ptr = (float*)(data->data.at(j)) + i * n_r;
                 #ifdef HAVE_3D
-                    vtk_points->InsertNextPoint(ptr[i].x, ptr[i].y, ptr[i].z);
+                    vtk_points->InsertNextPoint(ptr[0], ptr[1], ptr[2]);
                 #else
-                    vtk_points->InsertNextPoint(ptr[i].x, ptr[i].y, 0.f);
+                    vtk_points->InsertNextPoint(ptr[0], ptr[1], 0.f);
                 #endif
                 continue;
             }
@@ -419,7 +483,21 @@ void* save_pthread(void *data_void)
                 vars->get(data->fields.at(j)));
             size_t typesize = vars->typeToBytes(var->type());
             unsigned int n_components = vars->typeToN(var->type());
-            if(var->type().find("unsigned int") != std::string::npos ||
+            if(Variables::isHalfType(var->type())) {
+                float vect[n_components];
+                cl_half *ptr = (cl_half*)((char*)(data->data.at(j)) +
+                                          typesize * i);
+                for(unsigned int k = 0; k < n_components; k++)
+                    vect[k] = halfToFloat(ptr[k]);
+                vtkSmartPointer<vtkFloatArray> vtk_array =
+                    (vtkFloatArray*)(vtk_arrays.at(j).GetPointer());
+                #if VTK_MAJOR_VERSION < 7
+                    vtk_array->InsertNextTupleValue(vect);
+                #else
+                    vtk_array->InsertNextTypedTuple(vect);
+                #endif // VTK_MAJOR_VERSION
+            }
+            else if(var->type().find("unsigned int") != std::string::npos ||
                var->type().find("uivec") != std::string::npos) {
                 unsigned int vect[n_components];
                 size_t offset = typesize * i;
@@ -483,7 +561,12 @@ void* save_pthread(void *data_void)
 
         ArrayVariable *var = (ArrayVariable*)(
             vars->get(data->fields.at(i)));
-        if(var->type().find("unsigned int") != std::string::npos ||
+        if(Variables::isHalfType(var->type())) {
+            vtkSmartPointer<vtkFloatArray> vtk_array =
+                (vtkFloatArray*)(vtk_arrays.at(i).GetPointer());
+            grid->GetPointData()->AddArray(vtk_array);
+        }
+        else if(var->type().find("unsigned int") != std::string::npos ||
            var->type().find("uivec") != std::string::npos) {
             vtkSmartPointer<vtkUnsignedIntArray> vtk_array =
                 (vtkUnsignedIntArray*)(vtk_arrays.at(i).GetPointer());
@@ -519,7 +602,7 @@ void* save_pthread(void *data_void)
 
     // Clean up
     for(auto d : data->data)
-        free(d);
+        data->C->releasePinned(d);
     data->data.clear();
     data->S->addMessageF(L_INFO,
         std::string("Wrote \"") + data->f->GetFileName() + "\" VTK file.\n");
@@ -531,8 +614,6 @@ void* save_pthread(void *data_void)
 
 void VTK::save(float t)
 {
-    unsigned int i;
-
     // Check the fields to write
     std::vector<std::string> fields = simData().sets.at(setId())->outputFields();
     if(!fields.size()){
@@ -554,64 +635,45 @@ void VTK::save(float t)
     // Setup the data struct for the parallel thread
     data_pthread *data = new data_pthread;
     data->fields = fields;
-    data->bounds = bounds();
     data->C = CalcServer::CalcServer::singleton();
     data->S = Logger::singleton();
-    data->data = download(fields);
+    data->data = download(fields, data->events);
+    data->bounds.x = bounds().x;
+    data->bounds.y = bounds().x + nDownloaded();
     if(!data->data.size()){
         LOG(L_ERROR, "\"r\" field was not set to be saved into the file.\n");
         throw std::runtime_error("Failure downloading data");
     }
     data->f = create();
-
-    // Launch the thread
-    pthread_t tid;
-    int err;
-    err = pthread_create(&tid, NULL, &save_pthread, (void*)data);
-    if(err){
-        LOG(L_ERROR, "Failure launching the parallel thread.\n");
-        char err_str[strlen(strerror(err)) + 2];
-        strcpy(err_str, strerror(err));
-        strcat(err_str, "\n");
-        LOG0(L_DEBUG, err_str);
-        throw std::runtime_error("Failure launching VTK saving thread");
-    }
-    _tids.push_back(tid);
-
-    // Clear the already finished threads
-    if(_tids.size() > 0){
-        i = _tids.size() - 1;
-        while(true){
-            if(pthread_kill(_tids.at(i), 0)){
-                pthread_join(_tids.at(i), NULL);
-                _tids.erase(_tids.begin() + i);
-            }
-            if(i == 0) break;
-            i--;
-        }
+    try {
+        setupWriter(data->f);
+    } catch(...) {
+        for(auto event : data->events)
+            waitForDownload(event);
+        for(auto d : data->data)
+            data->C->releasePinned(d);
+        data->f->Delete();
+        delete data;
+        throw;
     }
 
-    // Check and limit the number of active writing processes
-    if(_tids.size() > 2){
-        LOG(L_WARNING, "More than 2 active writing tasks\n");
-        LOG(L_DEBUG, "This may result in heavy performance penalties, and hard disk failures\n");
-        LOG(L_DEBUG, "Please, consider a reduction of the output printing rate\n");
-        while(_tids.size() > 2){
-            pthread_join(_tids.at(0), NULL);
-            _tids.erase(_tids.begin());
-        }
+    // Queue the writing task
+    size_t memory = 0;
+    Variables *vars = data->C->variables();
+    for(auto field : fields){
+        if(vars->get(field))
+            memory += vars->typeToBytes(vars->get(field)->type()) *
+                      nDownloaded();
     }
+    Writers::singleton()->enqueue([data]{save_pthread((void*)data);},
+                                  memory);
 
+#ifdef HAVE_MPI
+    updatePVTU(fields);
+#endif
     updatePVD(t);
 }
 
-void VTK::waitForSavers(){
-    for(auto tid : _tids){
-        pthread_join(tid, NULL);
-    }
-    _tids.clear();
-}
-
 const unsigned int VTK::compute_n()
 {
     vtkSmartPointer<vtkXMLUnstructuredGridReader> f =
@@ -698,7 +760,11 @@ void VTK::updatePVD(float t){
     s_elem->setAttribute(xmlS("timestep"), xmlS(std::to_string(t)));
     s_elem->setAttribute(xmlS("group"), xmlS(""));
     s_elem->setAttribute(xmlS("part"), xmlS("0"));
-    s_elem->setAttribute(xmlS("file"), xmlS(file()));
+    // The first process of MPI runs is referencing the whole dataset
+    if(_pvtu_file != "")
+        s_elem->setAttribute(xmlS("file"), xmlS(_pvtu_file));
+    else
+        s_elem->setAttribute(xmlS("file"), xmlS(file()));
     elem->appendChild(s_elem);
 
     // Save the XML document to a file
@@ -794,6 +860,177 @@ DOMDocument* VTK::getPVD(bool generate)
     return doc;
 }
 
+void VTK::setupWriter(vtkXMLUnstructuredGridWriter *f)
+{
+    const ProblemSetup::sphParticlesSet *set = simData().sets.at(setId());
+
+    const std::string mode = toLowerCopy(set->outputOption("mode"));
+    if(!mode.compare("appended")){
+        f->SetDataModeToAppended();
+        f->EncodeAppendedDataOff();
+    }
+    else if(!mode.compare("binary")){
+        f->SetDataModeToBinary();
+    }
+    else if(!mode.compare("ascii")){
+        f->SetDataModeToAscii();
+    }
+    else if(mode != ""){
+        std::ostringstream msg;
+        msg << "Unknown VTK data mode \"" << mode << "\"" << std::endl;
+        LOG(L_ERROR, msg.str());
+        LOG0(L_DEBUG, "\tValid modes are \"appended\", \"binary\" and \"ascii\"\n");
+        throw std::runtime_error("Invalid VTK data mode");
+    }
+
+    const std::string compressor = toLowerCopy(set->outputOption("compressor"));
+    if(!compressor.compare("none")){
+        f->SetCompressorTypeToNone();
+    }
+    else if(!compressor.compare("zlib")){
+        f->SetCompressorTypeToZLib();
+    }
+    else if(!compressor.compare("lz4")){
+        #ifdef HAVE_VTK_LZ4
+            f->SetCompressorTypeToLZ4();
+        #else
+            LOG(L_WARNING, "LZ4 compression requires VTK >= 8.2, zlib is used instead\n");
+            f->SetCompressorTypeToZLib();
+        #endif
+    }
+    else if(compressor != ""){
+        std::ostringstream msg;
+        msg << "Unknown VTK compressor \"" << compressor << "\"" << std::endl;
+        LOG(L_ERROR, msg.str());
+        LOG0(L_DEBUG, "\tValid compressors are \"none\", \"zlib\" and \"lz4\"\n");
+        throw std::runtime_error("Invalid VTK compressor");
+    }
+
+    const std::string level = set->outputOption("level");
+    if(level != ""){
+        #ifdef HAVE_VTK_LZ4
+            int compression_level = std::stoi(level);
+            if((compression_level < 1) || (compression_level > 9)){
+                std::ostringstream msg;
+                msg << "Invalid VTK compression level " << compression_level
+                    << ". It should be in the [1, 9] interval" << std::endl;
+                LOG(L_ERROR, msg.str());
+                throw std::runtime_error("Invalid VTK compression level");
+            }
+            f->SetCompressionLevel(compression_level);
+        #else
+            LOG(L_WARNING, "The compression level requires VTK >= 8.2, it is ignored\n");
+        #endif
+    }
+}
+
+#ifdef HAVE_MPI
+void VTK::updatePVTU(const std::vector<std::string> fields)
+{
+    unsigned int i;
+    _pvtu_file = "";
+    const int mpi_size = MPI::COMM_WORLD.Get_size();
+    if(mpi_size < 2)
+        return;
+    const int mpi_rank = MPI::COMM_WORLD.Get_rank();
+
+    // Collect the pieces file names in the first process
+    const std::string piece = file();
+    int len = piece.size();
+    std::vector<int> lens(mpi_size, 0), displs(mpi_size, 0);
+    MPI::COMM_WORLD.Gather(&len, 1, MPI::INT, lens.data(), 1, MPI::INT, 0);
+    int total_len = 0;
+    for(i = 0; i < (unsigned int)mpi_size; i++){
+        displs.at(i) = total_len;
+        total_len += lens.at(i);
+    }
+    std::vector<char> names(max(total_len, 1));
+    MPI::COMM_WORLD.Gatherv(piece.c_str(), len, MPI::CHAR,
+                            names.data(), lens.data(), displs.data(), MPI::CHAR,
+                            0);
+    if(mpi_rank)
+        return;
+
+    // Get the file path
+    std::string path = simData().sets.at(setId())->outputOption("pvtu");
+    if(path == ""){
+        path = piece;
+        if((path.size() > 4) && !path.compare(path.size() - 4, 4, ".vtu"))
+            path.erase(path.size() - 4);
+        path += ".pvtu";
+    }
+    else{
+        if(path.find("{index}") == std::string::npos)
+            path += ".{index}.pvtu";
+        unsigned int index = _next_file_index - 1;
+        try {
+            path = newFilePath(path, index);
+        } catch(std::invalid_argument e) {
+            std::ostringstream msg;
+            msg << "It is forbidden to overwrite the parallel file '"
+                << setStrConstantsCopy(path) << "'" << std::endl;
+            LOG(L_ERROR, msg.str());
+            throw;
+        }
+    }
+    // The pieces are referenced relative to the parallel file folder
+    std::string folder = "";
+    if(path.rfind('/') != std::string::npos)
+        folder = path.substr(0, path.rfind('/') + 1);
+
+    std::ofstream f(path);
+    if(!f.is_open()){
+        std::ostringstream msg;
+        msg << "Failure writing \"" << path << "\" PVTU file." << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Failure writing file");
+    }
+    const uint32_t one = 1;
+    f << "<?xml version=\"1.0\"?>" << std::endl;
+    f << "<VTKFile type=\"PUnstructuredGrid\" version=\"0.1\" byte_order=\""
+      << ((*(const char*)&one) ? "LittleEndian" : "BigEndian") << "\">"
+      << std::endl;
+    f << "  <PUnstructuredGrid GhostLevel=\"0\">" << std::endl;
+    f << "    <PPointData>" << std::endl;
+    Variables *vars = CalcServer::CalcServer::singleton()->variables();
+    for(auto field : fields){
+        if(!field.compare("r"))
+            continue;
+        ArrayVariable *var = (ArrayVariable*)vars->get(field);
+        // The half precision arrays are saved as float ones
+        std::string type = "Float32";
+        if(var->type().find("unsigned int") != std::string::npos ||
+                var->type().find("uivec") != std::string::npos)
+            type = "UInt32";
+        else if(var->type().find("int") != std::string::npos ||
+                var->type().find("ivec") != std::string::npos)
+            type = "Int32";
+        f << "      <PDataArray type=\"" << type << "\" Name=\"" << field
+          << "\" NumberOfComponents=\"" << vars->typeToN(var->type())
+          << "\"/>" << std::endl;
+    }
+    f << "    </PPointData>" << std::endl;
+    f << "    <PPoints>" << std::endl;
+    f << "      <PDataArray type=\"Float32\" NumberOfComponents=\"3\"/>"
+      << std::endl;
+    f << "    </PPoints>" << std::endl;
+    for(i = 0; i < (unsigned int)mpi_size; i++){
+        std::string source(names.data() + displs.at(i), lens.at(i));
+        if((folder != "") && !source.compare(0, folder.size(), folder))
+            source.erase(0, folder.size());
+        f << "    <Piece Source=\"" << source << "\"/>" << std::endl;
+    }
+    f << "  </PUnstructuredGrid>" << std::endl;
+    f << "</VTKFile>" << std::endl;
+    f.close();
+
+    std::ostringstream msg;
+    msg << "Wrote \"" << path << "\" PVTU file." << std::endl;
+    LOG(L_INFO, msg.str());
+    _pvtu_file = path;
+}
+#endif
+
 const std::string VTK::filenamePVD()
 {
     if(_namePVD == ""){
@@ -0,0 +1,189 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Asynchronous output files writers.
+ * (See Aqua::InputOutput::Writers for details)
+ */
+
+#include <chrono>
+#include <sstream>
+
+#include <InputOutput/Writers.h>
+#include <InputOutput/Logger.h>
+#include <InputOutput/Trace.h>
+
+namespace Aqua{ namespace InputOutput{
+
+Writers::Writers(unsigned int n_threads,
+                 unsigned int max_queue,
+                 size_t max_memory)
+    : _max_queue(max_queue ? max_queue : 1)
+    , _max_memory(max_memory)
+    , _n_tasks(0)
+    , _memory(0)
+    , _stop(false)
+    , _n_queued(0)
+    , _n_stalls(0)
+    , _stall_time(0.0)
+    , _peak_tasks(0)
+    , _peak_memory(0)
+{
+    if(!n_threads)
+        n_threads = 1;
+    for(unsigned int i = 0; i < n_threads; i++){
+        _threads.push_back(std::thread(&Writers::worker, this));
+    }
+}
+
+Writers::~Writers()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv_done.wait(lock, [this]{return _n_tasks == 0;});
+        _stop = true;
+    }
+    _cv_task.notify_all();
+    for(auto &thread : _threads){
+        thread.join();
+    }
+}
+
+void Writers::enqueue(std::function<void()> f,
+                      size_t memory,
+                      const void *key)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    // A single task larger than the memory budget is still accepted if
+    // nothing else is pending, otherwise it would be blocked forever
+    auto full = [&]{
+        return (_n_tasks >= _max_queue) ||
+               (_max_memory && _n_tasks && (_memory + memory > _max_memory));
+    };
+    if(full()){
+        _n_stalls++;
+        auto t0 = std::chrono::steady_clock::now();
+        _cv_done.wait(lock, [&]{return !full();});
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - t0;
+        _stall_time += elapsed.count();
+        if(_n_stalls == 1){
+            std::ostringstream msg;
+            msg << "The simulation has been blocked by the writers during "
+                << elapsed.count() << " s" << std::endl;
+            LOG(L_WARNING, msg.str());
+            LOG0(L_DEBUG, "Please, consider a reduction of the output printing rate, or more writers\n");
+        }
+    }
+
+    task t = {f, memory, key};
+    _tasks.push_back(t);
+    _n_tasks++;
+    _memory += memory;
+    _n_queued++;
+    _peak_tasks = std::max(_peak_tasks, _n_tasks);
+    _peak_memory = std::max(_peak_memory, _memory);
+    lock.unlock();
+    _cv_task.notify_one();
+}
+
+void Writers::wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv_done.wait(lock, [this]{return _n_tasks == 0;});
+}
+
+void Writers::stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::ostringstream msg;
+    msg << "Writers: " << _n_queued << " tasks, "
+        << _n_stalls << " stalls (" << _stall_time << " s), "
+        << "peak of " << _peak_tasks << " tasks and "
+        << _peak_memory / 1048576.0 << " MB" << std::endl;
+    LOG(L_INFO, msg.str());
+}
+
+unsigned int Writers::queued()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _n_tasks;
+}
+
+size_t Writers::queuedMemory()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _memory;
+}
+
+double Writers::stallTime()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stall_time;
+}
+
+void Writers::worker()
+{
+    if(Trace::singleton())
+        Trace::singleton()->threadName("writer");
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(true){
+        std::deque<task>::iterator it;
+        _cv_task.wait(lock, [&]{
+            if(_stop)
+                return true;
+            for(it = _tasks.begin(); it != _tasks.end(); it++){
+                if(!it->key || !_running_keys.count(it->key))
+                    return true;
+            }
+            return false;
+        });
+        if(_stop)
+            return;
+
+        task t = *it;
+        _tasks.erase(it);
+        if(t.key)
+            _running_keys.insert(t.key);
+        lock.unlock();
+
+        try {
+            TraceSpan span("writer", "write");
+            t.f();
+        } catch (std::exception &e) {
+            std::ostringstream msg;
+            msg << "Writing task failed: " << e.what() << std::endl;
+            Logger::singleton()->addMessageF(L_ERROR, msg.str());
+        } catch (...) {
+            Logger::singleton()->addMessageF(L_ERROR, "Writing task failed\n");
+        }
+
+        lock.lock();
+        if(t.key)
+            _running_keys.erase(t.key);
+        _n_tasks--;
+        _memory -= t.memory;
+        // A task with the same key may be unblocked now
+        if(t.key)
+            _cv_task.notify_all();
+        _cv_done.notify_all();
+    }
+}
+
+}}  // namespace
@@ -81,20 +81,58 @@ ProblemSetup::~ProblemSetup()
 ProblemSetup::sphSettings::sphSettings()
     : save_on_fail(true)
     , base_path("")
+    , n_queues(1)
+    , barrier_steps(1)
+    , cache_path("")
+    , autotune(false)
+    , autotune_file("")
+    , zero_copy(false)
+    , pipeline_analysis(false)
+    , writers_threads(1)
+    , writers_queue(2)
+    , writers_memory(0)
+    , checkpoint_path("AQUAgpusph.checkpoint.{mpi_rank}.bin")
+    , checkpoint_interval(0.f)
+    , checkpoint_on_term(false)
+    , restart_path("")
+    , trace_path("")
+    , trace_start(0)
+    , trace_iters(10)
+    , trace_buffer(65536)
 {
     save_on_fail = true;
     base_path = "";
+    n_queues = 1;
+    barrier_steps = 1;
+    cache_path = "";
+    autotune = false;
+    autotune_file = "";
+    zero_copy = false;
+    pipeline_analysis = false;
+    writers_threads = 1;
+    writers_queue = 2;
+    writers_memory = 0;
+    checkpoint_path = "AQUAgpusph.checkpoint.{mpi_rank}.bin";
+    checkpoint_interval = 0.f;
+    checkpoint_on_term = false;
+    restart_path = "";
+    trace_path = "";
+    trace_start = 0;
+    trace_iters = 10;
+    trace_buffer = 65536;
 }
 
 void ProblemSetup::sphVariables::registerVariable(std::string name,
                                                   std::string type,
                                                   std::string length,
-                                                  std::string value)
+                                                  std::string value,
+                                                  bool scratch)
 {
     names.push_back(name);
     types.push_back(type);
     lengths.push_back(length);
     values.push_back(value);
+    scratches.push_back(scratch);
 }
 
 void ProblemSetup::sphDefinitions::define(const std::string name,
@@ -25,6 +25,9 @@
 #include <TimeManager.h>
 #include <CalcServer.h>
 #include <InputOutput/Logger.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
 
 namespace Aqua{ namespace InputOutput{
 
@@ -40,6 +43,10 @@ TimeManager::TimeManager(ProblemSetup& sim_data)
     , _output_fps(-1.f)
     , _output_step(0)
     , _output_ipf(-1)
+    , _checkpoint_interval(sim_data.settings.checkpoint_interval)
+    , _checkpoint_time(std::chrono::steady_clock::now())
+    , _checkpoint_step(-1)
+    , _checkpoint_due(false)
 {
     unsigned int i;
     Variables *vars = CalcServer::CalcServer::singleton()->variables();
@@ -65,23 +72,26 @@ TimeManager::TimeManager(ProblemSetup& sim_data)
         }
     }
 
-    _time = (float *)vars->get("t")->get();
-    _dt = (float *)vars->get("dt")->get();
-    _step = (unsigned int *)vars->get("iter")->get();
-    _frame = (unsigned int *)vars->get("frame")->get();
-    _time_max = (float *)vars->get("end_t")->get();
-    _steps_max = (unsigned int *)vars->get("end_iter")->get();
-    _frames_max = (unsigned int *)vars->get("end_frame")->get();
+    _time = vars->get("t");
+    _dt = vars->get("dt");
+    _step = vars->get("iter");
+    _frame = vars->get("frame");
+    _time_max = vars->get("end_t");
+    _steps_max = vars->get("end_iter");
+    _frames_max = vars->get("end_frame");
 
     unsigned int mode = sim_data.time_opts.sim_end_mode;
     if(mode & __FRAME_MODE__) {
-        *_frames_max = sim_data.time_opts.sim_end_frame;
+        unsigned int frames_max = sim_data.time_opts.sim_end_frame;
+        _frames_max->set(&frames_max);
     }
     if(mode & __ITER_MODE__) {
-        *_steps_max = sim_data.time_opts.sim_end_step;
+        unsigned int steps_max = sim_data.time_opts.sim_end_step;
+        _steps_max->set(&steps_max);
     }
     if(mode & __TIME_MODE__) {
-        *_time_max = sim_data.time_opts.sim_end_time;
+        float time_max = sim_data.time_opts.sim_end_time;
+        _time_max->set(&time_max);
     }
 
     mode = sim_data.time_opts.output_mode;
@@ -96,8 +106,8 @@ TimeManager::TimeManager(ProblemSetup& sim_data)
         _output_fps = sim_data.time_opts.output_fps;
     }
 
-    _output_time = *_time;
-    _output_step = *_step;
+    _output_time = time();
+    _output_step = step();
 }
 
 TimeManager::~TimeManager()
@@ -154,4 +164,30 @@ bool TimeManager::mustPrintOutput()
     return false;
 }
 
+bool TimeManager::mustCheckpoint()
+{
+    if(_checkpoint_interval <= 0.f)
+        return false;
+    // Evaluated just once per time step, so all the callers, and all the
+    // processes, are getting the same answer
+    if((int)step() == _checkpoint_step)
+        return _checkpoint_due;
+    _checkpoint_step = step();
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - _checkpoint_time;
+    int due = elapsed.count() >= _checkpoint_interval;
+#ifdef HAVE_MPI
+    MPI::COMM_WORLD.Bcast(&due, 1, MPI::INT, 0);
+#endif
+    _checkpoint_due = due;
+    return _checkpoint_due;
+}
+
+void TimeManager::checkpointed()
+{
+    _checkpoint_time = std::chrono::steady_clock::now();
+    _checkpoint_due = false;
+}
+
 }}  // namespace
@@ -0,0 +1,172 @@
+/*
+ *  This file is part of AQUAgpusph, a free CFD program based on SPH.
+ *  Copyright (C) 2012  Jose Luis Cercos Pita <jl.cercos@upm.es>
+ *
+ *  AQUAgpusph is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  AQUAgpusph is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with AQUAgpusph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file
+ * @brief Compiled math expression.
+ * (See Aqua::Expression for details)
+ */
+
+#include <Tokenizer/Expression.h>
+#include <Variable.h>
+#include <AuxiliarMethods.h>
+#include <InputOutput/Logger.h>
+
+namespace Aqua{
+
+// Defined in Tokenizer.cpp
+double mod_operator(double v, double w);
+double not_operator(double v);
+
+/** @brief Report a muParser error
+ * @param e muParser exception
+ */
+static void reportError(mu::Parser::exception_type &e)
+{
+    std::ostringstream msg;
+    msg << "Error evaluating \"" << e.GetExpr() << "\"" << std::endl;
+    LOG(L_WARNING, msg.str());
+    msg.str("");
+    msg << "\t" << e.GetMsg() << std::endl;
+    LOG0(L_DEBUG, msg.str());
+    msg.str("");
+    msg << "\tToken " << e.GetToken()
+        << " in position " << e.GetPos() << std::endl;
+    LOG0(L_DEBUG, msg.str());
+}
+
+Expression::Expression(const std::string eq, InputOutput::Variables *vars)
+    : _eq(eq)
+{
+    // Same operators than Aqua::Tokenizer
+    _p.DefineOprtChars("%");
+    _p.DefineOprt("%", mod_operator, mu::prINFIX);
+    _p.DefineInfixOprt("!", not_operator, 0);
+
+    // Parse the expression, collecting the used identifiers
+    _p.SetVarFactory(factory, this);
+    try
+    {
+        _p.SetExpr(eq);
+        mu::varmap_type used = _p.GetUsedVar();
+        for(auto var : used){
+            bind(var.first, var.second, vars);
+        }
+    }
+    catch(mu::Parser::exception_type &e)
+    {
+        reportError(e);
+        throw std::runtime_error("Invalid expression");
+    }
+}
+
+Expression::~Expression()
+{
+}
+
+unsigned int Expression::solve(unsigned int n, float *v, bool sync)
+{
+    unsigned int i;
+
+    // Read the variables values. Variable::get() is waiting for the pending
+    // events, if any
+    for(i = 0; i < _bound_slots.size(); i++){
+        void *data = sync ? _bound_vars.at(i)->get() :
+                            _bound_vars.at(i)->get_async();
+        const unsigned int j = _bound_components.at(i);
+        switch(_bound_types.at(i)){
+            case INT_COMPONENT:
+                *_bound_slots.at(i) = (mu::value_type)((int*)data)[j];
+                break;
+            case UINT_COMPONENT:
+                *_bound_slots.at(i) = (mu::value_type)((unsigned int*)data)[j];
+                break;
+            default:
+                *_bound_slots.at(i) = (mu::value_type)((float*)data)[j];
+        }
+    }
+
+    int n_results;
+    mu::value_type *results;
+    try
+    {
+        results = _p.Eval(n_results);
+    }
+    catch(mu::Parser::exception_type &e)
+    {
+        reportError(e);
+        throw;
+    }
+
+    for(i = 0; (i < n) && (i < (unsigned int)n_results); i++){
+        v[i] = (float)results[i];
+    }
+    return i;
+}
+
+void Expression::bind(const std::string name,
+                      mu::value_type *slot,
+                      InputOutput::Variables *vars)
+{
+    const char* extensions[4] = {"_x", "_y", "_z", "_w"};
+
+    // Look for the variable, which may be just a component of a vector, in
+    // the same way they are registered by Variables::populate()
+    unsigned int component = 0;
+    InputOutput::Variable *var = vars->get(name);
+    if(var && (InputOutput::Variables::typeToN(var->type()) != 1))
+        var = NULL;
+    if(!var && (name.size() > 2)){
+        for(unsigned int i = 0; i < 4; i++){
+            if(name.compare(name.size() - 2, 2, extensions[i]))
+                continue;
+            var = vars->get(name.substr(0, name.size() - 2));
+            component = i;
+            if(var && (component >= InputOutput::Variables::typeToN(var->type())))
+                var = NULL;
+            break;
+        }
+    }
+    if(!var || var->isArray()){
+        std::ostringstream msg;
+        msg << "Unknown identifier \"" << name << "\" in the expression \""
+            << _eq << "\"" << std::endl;
+        LOG(L_ERROR, msg.str());
+        throw std::runtime_error("Invalid expression");
+    }
+
+    const std::string type = trimCopy(var->type());
+    component_type t = FLOAT_COMPONENT;
+    if(!type.find("unsigned") || !type.find("uivec"))
+        t = UINT_COMPONENT;
+    else if(!type.find("int") || !type.find("ivec"))
+        t = INT_COMPONENT;
+
+    _bound_slots.push_back(slot);
+    _bound_vars.push_back(var);
+    _bound_components.push_back(component);
+    _bound_types.push_back(t);
+}
+
+mu::value_type* Expression::factory(const mu::char_type *name, void *data)
+{
+    Expression *expr = (Expression*)data;
+    expr->_slots.push_back(0.0);
+    return &(expr->_slots.back());
+}
+
+}  // namespace
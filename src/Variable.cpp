@@ -25,7 +25,12 @@
 #include <Variable.h>
 #include <AuxiliarMethods.h>
 #include <InputOutput/Logger.h>
+#include <InputOutput/Trace.h>
 #include <CalcServer.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
 
 /** @def PY_ARRAY_UNIQUE_SYMBOL
  * @brief Define the extension module which this Python stuff should be linked
@@ -55,6 +60,7 @@ Variable::Variable(const std::string varname, const std::string vartype)
     , _typename(vartype)
     , _event(NULL)
     , _synced(true)
+    , _version(1)
 {
     cl_int err_code;
     CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
@@ -104,6 +110,31 @@ void Variable::setEvent(cl_event event)
     }
     _event = event;
     _synced = false;
+    // The scalar variables are changing their value when they are written by
+    // an OpenCL command (e.g. a reduction result). On the other hand, the
+    // arrays memory objects are kept
+    if(isScalar())
+        increaseVersion();
+}
+
+/// Host stalls, indexed by the variable and tool names
+static std::map<std::pair<std::string, std::string>, SyncStall> sync_stalls;
+/// Host stalls guard
+static std::mutex sync_stalls_mutex;
+
+std::vector<SyncStall> Variable::stalls()
+{
+    std::vector<SyncStall> stalls;
+    {
+        std::lock_guard<std::mutex> lock(sync_stalls_mutex);
+        for(auto stall : sync_stalls)
+            stalls.push_back(stall.second);
+    }
+    std::stable_sort(stalls.begin(), stalls.end(),
+                     [](const SyncStall &a, const SyncStall &b){
+                         return a.time > b.time;
+                     });
+    return stalls;
 }
 
 void Variable::sync()
@@ -111,7 +142,19 @@ void Variable::sync()
     if(_synced)
         return;
 
-    cl_int err_code;
+    cl_int err_code, status;
+    // Just the actually blocking syncs are considered stalls
+    err_code = clGetEventInfo(_event,
+                              CL_EVENT_COMMAND_EXECUTION_STATUS,
+                              sizeof(cl_int),
+                              &status,
+                              NULL);
+    const bool blocking = (err_code != CL_SUCCESS) || (status != CL_COMPLETE);
+    const auto tic = std::chrono::steady_clock::now();
+    Trace *trace = Trace::singleton();
+    const double trace_tic =
+        (blocking && trace && trace->recording()) ? trace->now() : -1.0;
+
     err_code = clWaitForEvents(1, &_event);
     if(err_code != CL_SUCCESS){
         std::stringstream msg;
@@ -122,6 +165,26 @@ void Variable::sync()
         throw std::runtime_error("OpenCL execution error");
     }
     _synced = true;
+    if(!blocking)
+        return;
+
+    const double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - tic).count();
+    CalcServer::Tool *tool = CalcServer::Tool::current();
+    const std::string tool_name = tool ? tool->name() : "host";
+    if(trace_tic >= 0.0){
+        const std::string span = name() + " (" + tool_name + ")";
+        trace->span("sync", span.c_str(), trace_tic, trace->now());
+    }
+    std::lock_guard<std::mutex> lock(sync_stalls_mutex);
+    SyncStall &stall = sync_stalls[std::make_pair(name(), tool_name)];
+    if(!stall.count){
+        stall.variable = name();
+        stall.tool = tool_name;
+        stall.time = 0.0;
+    }
+    stall.count++;
+    stall.time += elapsed;
 }
 
 template <class T>
@@ -320,6 +383,7 @@ bool Vec2Variable::setFromPythonObject(PyObject* obj, int i0, int n)
     vec2 *vv = (vec2*)get();
     void *data = PyArray_DATA(array_obj);
     memcpy(vv->s, data, sizeof(vec2));
+    increaseVersion();
 
     return false;
 }
@@ -356,6 +420,7 @@ bool Vec3Variable::setFromPythonObject(PyObject* obj, int i0, int n)
     vec3 *vv = (vec3*)get();
     void *data = PyArray_DATA(array_obj);
     memcpy(vv->s, data, sizeof(vec3));
+    increaseVersion();
 
     return false;
 }
@@ -393,6 +458,7 @@ bool Vec4Variable::setFromPythonObject(PyObject* obj, int i0, int n)
     vec4 *vv = (vec4*)get();
     void *data = PyArray_DATA(array_obj);
     memcpy(vv->s, data, sizeof(vec4));
+    increaseVersion();
 
     return false;
 }
@@ -428,6 +494,7 @@ bool IVec2Variable::setFromPythonObject(PyObject* obj, int i0, int n)
     ivec2 *vv = (ivec2*)get();
     void *data = PyArray_DATA(array_obj);
     memcpy(vv->s, data, sizeof(ivec2));
+    increaseVersion();
 
     return false;
 }
@@ -464,6 +531,7 @@ bool IVec3Variable::setFromPythonObject(PyObject* obj, int i0, int n)
     ivec3 *vv = (ivec3*)get();
     void *data = PyArray_DATA(array_obj);
     memcpy(vv->s, data, sizeof(ivec3));
+    increaseVersion();
 
     return false;
 }
@@ -501,6 +569,7 @@ bool IVec4Variable::setFromPythonObject(PyObject* obj, int i0, int n)
     ivec4 *vv = (ivec4*)get();
     void *data = PyArray_DATA(array_obj);
     memcpy(vv->s, data, sizeof(ivec4));
+    increaseVersion();
 
     return false;
 }
@@ -536,6 +605,7 @@ bool UIVec2Variable::setFromPythonObject(PyObject* obj, int i0, int n)
     uivec2 *vv = (uivec2*)get();
     void *data = PyArray_DATA(array_obj);
     memcpy(vv->s, data, sizeof(uivec2));
+    increaseVersion();
 
     return false;
 }
@@ -572,6 +642,7 @@ bool UIVec3Variable::setFromPythonObject(PyObject* obj, int i0, int n)
     uivec3 *vv = (uivec3*)get();
     void *data = PyArray_DATA(array_obj);
     memcpy(vv->s, data, sizeof(uivec3));
+    increaseVersion();
 
     return false;
 }
@@ -609,13 +680,52 @@ bool UIVec4Variable::setFromPythonObject(PyObject* obj, int i0, int n)
     uivec4 *vv = (uivec4*)get();
     void *data = PyArray_DATA(array_obj);
     memcpy(vv->s, data, sizeof(uivec4));
+    increaseVersion();
 
     return false;
 }
 
+/** @brief Get the NumPy type of the array components.
+ * @param type Type of the variable.
+ * @return NumPy type, -1 if the variable cannot be handled by Python.
+ */
+static int typeToNumPy(const std::string type)
+{
+    if(Variables::isHalfType(type)){
+       return NPY_FLOAT16;
+    }
+    else if(!type.compare("unsigned int") ||
+       !type.compare("unsigned int*") ||
+       !type.compare("uivec") ||
+       !type.compare("uivec*")){
+       return NPY_UINT32;
+    }
+    else if(!type.compare("int") ||
+            !type.compare("int*") ||
+            !type.compare("ivec") ||
+            !type.compare("ivec*")){
+       return NPY_INT32;
+    }
+    else if(!type.compare("float") ||
+            !type.compare("float*") ||
+            !type.compare("vec") ||
+            !type.compare("vec*") ||
+            !type.compare("pvec*")){
+       return NPY_FLOAT32;
+    }
+    return -1;
+}
+
 ArrayVariable::ArrayVariable(const std::string varname, const std::string vartype)
     : Variable(varname, vartype)
     , _value(NULL)
+    , _size(0)
+    , _view_host(NULL)
+    , _view(NULL)
+    , _view_mem(NULL)
+    , _view_size(0)
+    , _view_event(NULL)
+    , _view_mapped(false)
 {
 }
 
@@ -625,6 +735,15 @@ ArrayVariable::~ArrayVariable()
         if(object) Py_DECREF(object);
     }
     _objects.clear();
+    // The host mirrors are pinned memory, already released by the calculation
+    // server
+    if(_view) Py_DECREF(_view); _view = NULL;
+    for(auto object : _old_views){
+        Py_DECREF(object);
+    }
+    _old_views.clear();
+    _old_view_hosts.clear();
+    if(_view_event) clReleaseEvent(_view_event); _view_event = NULL;
     for(auto data : _data){
         if(data) free(data);
     }
@@ -638,6 +757,13 @@ inline bool ArrayVariable::isArray()
 }
 
 size_t ArrayVariable::size() const
+{
+    if(_size)
+        return _size;
+    return capacity();
+}
+
+size_t ArrayVariable::capacity() const
 {
     if(!_value)
         return 0;
@@ -658,6 +784,34 @@ size_t ArrayVariable::size() const
     return memsize;
 }
 
+void ArrayVariable::resize(size_t size)
+{
+    if(size <= capacity()){
+        _size = size;
+        return;
+    }
+
+    // We have no alternative, we must sync here
+    cl_event event = getEvent();
+    cl_int err_code = clWaitForEvents(1, &event);
+    if(err_code != CL_SUCCESS){
+        std::ostringstream msg;
+        msg << "Failure waiting for the variable \"" << name()
+            << "\" to be resized" << std::endl;
+        LOG(L_ERROR, msg.str());
+        Logger::singleton()->printOpenCLError(err_code);
+        throw std::runtime_error("OpenCL error");
+    }
+
+    Variables *vars = CalcServer::CalcServer::singleton()->variables();
+    const size_t grown = (size_t)(_ARRAYS_GROWTH_FACTOR * capacity());
+    cl_mem mem = vars->acquireBuffer(max(size, grown));
+    if(_value)
+        vars->releaseBuffer(_value);
+    set(&mem);
+    _size = size;
+}
+
 PyObject* ArrayVariable::getPythonObject(int i0, int n)
 {
     if(i0 < 0){
@@ -711,26 +865,8 @@ PyObject* ArrayVariable::getPythonObject(int i0, int n)
     }
     npy_intp dims[] = {static_cast<npy_intp>(len), components};
     // Get the appropiate type
-    int pytype = NPY_FLOAT32;
-    if(!type().compare("unsigned int") ||
-       !type().compare("unsigned int*") ||
-       !type().compare("uivec") ||
-       !type().compare("uivec*")){
-       pytype = NPY_UINT32;
-    }
-    else if(!type().compare("int") ||
-            !type().compare("int*") ||
-            !type().compare("ivec") ||
-            !type().compare("ivec*")){
-       pytype = NPY_INT32;
-    }
-    else if(!type().compare("float") ||
-            !type().compare("float*") ||
-            !type().compare("vec") ||
-            !type().compare("vec*")){
-       pytype = NPY_FLOAT32;
-    }
-    else{
+    const int pytype = typeToNumPy(type());
+    if(pytype < 0){
         pyerr.str("");
         pyerr << "Variable \"" << name()
             << "\" is of type \"" << type()
@@ -751,15 +887,15 @@ PyObject* ArrayVariable::getPythonObject(int i0, int n)
     _data.push_back(data);
     // Download the data
     cl_event event_wait = getEvent();
-    err_code = clEnqueueReadBuffer(C->command_queue(),
-                                   _value,
-                                   CL_TRUE,
-                                   offset * typesize,
-                                   len * typesize,
-                                   data,
-                                   1,
-                                   &event_wait,
-                                   NULL);
+    err_code = C->readBuffer(C->command_queue(),
+                             _value,
+                             CL_TRUE,
+                             offset * typesize,
+                             len * typesize,
+                             data,
+                             1,
+                             &event_wait,
+                             NULL);
     if(err_code != CL_SUCCESS){
         pyerr.str("");
         pyerr << "Failure downloading variable \"" << name()
@@ -869,15 +1005,189 @@ bool ArrayVariable::setFromPythonObject(PyObject* obj, int i0, int n)
 
     void *data = PyArray_DATA(array_obj);
     cl_event event, event_wait = getEvent();
-    err_code =  clEnqueueWriteBuffer(C->command_queue(),
-                                     _value,
-                                     CL_FALSE,
-                                     offset * typesize,
-                                     len * typesize,
-                                     data,
-                                     1,
-                                     &event_wait,
-                                     &event);
+    err_code =  C->writeBuffer(C->command_queue(),
+                               _value,
+                               CL_FALSE,
+                               offset * typesize,
+                               len * typesize,
+                               data,
+                               1,
+                               &event_wait,
+                               &event);
+    if(err_code != CL_SUCCESS){
+        pyerr.str("");
+        pyerr << "Failure uploading variable \""
+              << name() << "\"" << std::endl;
+        PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+        return true;
+    }
+    setEvent(event);
+    err_code = clReleaseEvent(event);
+    if(err_code != CL_SUCCESS){
+        pyerr.str("");
+        pyerr << "Failure releasing variable \""
+              << name() << "\" event" << std::endl;
+        PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+        return true;
+    }
+
+    return false;
+}
+
+PyObject* ArrayVariable::getPythonView(bool map)
+{
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    cl_int err_code;
+    // Clear outdated references
+    cleanMem();
+    const int pytype = typeToNumPy(type());
+    if(pytype < 0){
+        pyerr.str("");
+        pyerr << "Variable \"" << name()
+            << "\" is of type \"" << type()
+            << "\", which can't be handled by Python" << std::endl;
+        PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+        return NULL;
+    }
+    const size_t memsize = size();
+    if(!memsize){
+        pyerr.str("");
+        pyerr << "0 bytes asked to be viewed from variable \"" << name()
+            << "\"" << std::endl;
+        PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+        return NULL;
+    }
+
+    // If the device buffer has been replaced or resized, a new mirror is
+    // required. The outdated one is kept while Python is using it
+    if(_view && ((_view_mem != _value) || (_view_size != memsize))){
+        if(_view_mapped){
+            pyerr.str("");
+            pyerr << "Variable \"" << name()
+                << "\" has been resized while its view was mapped" << std::endl;
+            PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+            return NULL;
+        }
+        // Wait for any pending upload from the mirror
+        if(_view_event && (clWaitForEvents(1, &_view_event) != CL_SUCCESS)){
+            pyerr.str("");
+            pyerr << "Failure waiting for the view of variable \"" << name()
+                << "\"" << std::endl;
+            PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+            return NULL;
+        }
+        _old_views.push_back(_view);
+        _old_view_hosts.push_back(_view_host);
+        _view = NULL;
+        _view_host = NULL;
+        if(_view_event) clReleaseEvent(_view_event); _view_event = NULL;
+    }
+
+    if(!_view){
+        Variables *vars = C->variables();
+        const size_t typesize = vars->typeToBytes(type());
+        npy_intp dims[] = {static_cast<npy_intp>(memsize / typesize),
+                           vars->typeToN(type())};
+        _view_host = C->allocatePinned(memsize);
+        if(!_view_host){
+            pyerr.str("");
+            pyerr << "Failure allocating " << memsize
+                << " bytes for variable \"" << name()
+                << "\"" << std::endl;
+            PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+            return NULL;
+        }
+        _view = PyArray_SimpleNewFromData(2, dims, pytype, _view_host);
+        if(!_view){
+            C->releasePinned(_view_host);
+            _view_host = NULL;
+            pyerr.str("");
+            pyerr << "Failure creating a Python object for variable \""
+                << name() << "\"" << std::endl;
+            PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+            return NULL;
+        }
+        PyArray_CLEARFLAGS((PyArrayObject*)_view, NPY_ARRAY_WRITEABLE);
+        _view_mem = _value;
+        _view_size = memsize;
+        _view_mapped = false;
+    }
+
+    // Download the data, just if the array may have been modified since the
+    // last time. The mapped views are not downloaded, to don't lose the
+    // not already uploaded modifications
+    cl_event event_wait = getEvent();
+    if(!_view_mapped && (event_wait != _view_event)){
+        err_code = C->readBuffer(C->command_queue(),
+                                 _value,
+                                 CL_TRUE,
+                                 0,
+                                 memsize,
+                                 _view_host,
+                                 1,
+                                 &event_wait,
+                                 NULL);
+        if(err_code != CL_SUCCESS){
+            pyerr.str("");
+            pyerr << "Failure downloading variable \"" << name()
+                << "\"" << std::endl;
+            PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+            return NULL;
+        }
+        setViewEvent(event_wait);
+    }
+    else if(map && !_view_mapped){
+        // The mirror is up to date, but a previous upload from it may be
+        // still pending
+        try {
+            sync();
+        } catch(...) {
+            pyerr.str("");
+            pyerr << "Failure waiting for the view of variable \"" << name()
+                << "\"" << std::endl;
+            PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+            return NULL;
+        }
+    }
+
+    if(map){
+        PyArray_ENABLEFLAGS((PyArrayObject*)_view, NPY_ARRAY_WRITEABLE);
+        _view_mapped = true;
+    }
+
+    Py_INCREF(_view);
+    return _view;
+}
+
+bool ArrayVariable::unmapPythonView()
+{
+    if(!_view || !_view_mapped){
+        pyerr.str("");
+        pyerr << "The view of variable \"" << name()
+            << "\" is not mapped" << std::endl;
+        PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+        return true;
+    }
+    if((_view_mem != _value) || (_view_size != size())){
+        pyerr.str("");
+        pyerr << "Variable \"" << name()
+            << "\" has been resized while its view was mapped" << std::endl;
+        PyErr_SetString(PyExc_ValueError, pyerr.str().c_str());
+        return true;
+    }
+
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+    cl_int err_code;
+    cl_event event, event_wait = getEvent();
+    err_code =  C->writeBuffer(C->command_queue(),
+                               _value,
+                               CL_FALSE,
+                               0,
+                               _view_size,
+                               _view_host,
+                               1,
+                               &event_wait,
+                               &event);
     if(err_code != CL_SUCCESS){
         pyerr.str("");
         pyerr << "Failure uploading variable \""
@@ -886,6 +1196,8 @@ bool ArrayVariable::setFromPythonObject(PyObject* obj, int i0, int n)
         return true;
     }
     setEvent(event);
+    // The mirror is already synced with the device buffer
+    setViewEvent(event);
     err_code = clReleaseEvent(event);
     if(err_code != CL_SUCCESS){
         pyerr.str("");
@@ -895,9 +1207,20 @@ bool ArrayVariable::setFromPythonObject(PyObject* obj, int i0, int n)
         return true;
     }
 
+    // The mirror should not be modified while it is uploaded
+    PyArray_CLEARFLAGS((PyArrayObject*)_view, NPY_ARRAY_WRITEABLE);
+    _view_mapped = false;
+
     return false;
 }
 
+void ArrayVariable::setViewEvent(cl_event event)
+{
+    if(_view_event) clReleaseEvent(_view_event);
+    _view_event = event;
+    if(_view_event) clRetainEvent(_view_event);
+}
+
 const std::string ArrayVariable::asString()
 {
     cl_mem* val = (cl_mem*)get();
@@ -930,15 +1253,15 @@ const std::string ArrayVariable::asString(size_t i)
         return NULL;
     }
     cl_event event_wait = getEvent();
-    cl_int err_code = clEnqueueReadBuffer(C->command_queue(),
-                                          _value,
-                                          CL_TRUE,
-                                          i * type_size,
-                                          type_size,
-                                          ptr,
-                                          1,
-                                          &event_wait,
-                                          NULL);
+    cl_int err_code = C->readBuffer(C->command_queue(),
+                                    _value,
+                                    CL_TRUE,
+                                    i * type_size,
+                                    type_size,
+                                    ptr,
+                                    1,
+                                    &event_wait,
+                                    NULL);
     if(err_code != CL_SUCCESS){
         std::ostringstream msg;
         msg << "Failure downloading the variable \"" << name() << "\"" << std::endl;
@@ -1037,6 +1360,16 @@ const std::string ArrayVariable::asString(size_t i)
                               << ((float*)ptr)[1] << ")";
         #endif
     }
+    else if(!type().compare("pvec*")){
+        #ifdef HAVE_3D
+            str_stream << "(" << ((float*)ptr)[0] << ","
+                              << ((float*)ptr)[1] << ","
+                              << ((float*)ptr)[2] << ")";
+        #else
+            str_stream << "(" << ((float*)ptr)[0] << ","
+                              << ((float*)ptr)[1] << ")";
+        #endif
+    }
     else{
         std::ostringstream msg;
         msg << "Variable \"" << name()
@@ -1063,6 +1396,15 @@ void ArrayVariable::cleanMem()
             _objects.erase(_objects.begin() + i);
         }
     }
+    for(int i = _old_views.size() - 1; i >= 0; i--){
+        if(_old_views.at(i)->ob_refcnt == 1){
+            Py_DECREF(_old_views.at(i));
+            CalcServer::CalcServer::singleton()->releasePinned(
+                _old_view_hosts.at(i));
+            _old_views.erase(_old_views.begin() + i);
+            _old_view_hosts.erase(_old_view_hosts.begin() + i);
+        }
+    }
 }
 
 // ---------------------------------------------------------------------------
@@ -1070,6 +1412,7 @@ void ArrayVariable::cleanMem()
 // ---------------------------------------------------------------------------
 
 Variables::Variables()
+    : _aliased_memory(0)
 {
 }
 
@@ -1080,6 +1423,15 @@ Variables::~Variables()
         delete var;
     }
     _vars.clear();
+    // The sub-buffers have been already released by the arrays
+    for(auto mem : _aliased_mems){
+        clReleaseMemObject(mem);
+    }
+    _aliased_mems.clear();
+    for(auto mem : _pool){
+        clReleaseMemObject(mem);
+    }
+    _pool.clear();
 }
 
 void Variables::registerVariable(const std::string name,
@@ -1087,6 +1439,10 @@ void Variables::registerVariable(const std::string name,
                                  const std::string length,
                                  const std::string value)
 {
+    // The tokenizer may require the variables values, and the queued
+    // variables may be removed below
+    populatePending();
+
     // Look for an already existing variable with the same name
     for(unsigned int i = 0; i < _vars.size(); i++){
         if(!_vars.at(i)->name().compare(name)){
@@ -1128,9 +1484,137 @@ size_t Variables::allocatedMemory(){
         if(var->type().find('*') == std::string::npos){
             continue;
         }
-        allocated_mem += var->size();
+        allocated_mem += ((ArrayVariable*)var)->capacity();
+    }
+    return allocated_mem + pooledMemory() - _aliased_memory;
+}
+
+size_t Variables::pooledMemory()
+{
+    size_t pooled_mem = 0;
+    for(auto mem : _pool){
+        size_t memsize = 0;
+        clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(size_t), &memsize, NULL);
+        pooled_mem += memsize;
+    }
+    return pooled_mem;
+}
+
+cl_mem Variables::acquireBuffer(size_t size)
+{
+    cl_int err_code;
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+
+    // Look for the smallest released buffer large enough
+    auto best = _pool.end();
+    size_t best_size = 0;
+    for(auto it = _pool.begin(); it != _pool.end(); it++){
+        size_t memsize = 0;
+        clGetMemObjectInfo(*it, CL_MEM_SIZE, sizeof(size_t), &memsize, NULL);
+        if((memsize < size) || ((best != _pool.end()) && (memsize >= best_size)))
+            continue;
+        best = it;
+        best_size = memsize;
+    }
+    if(best != _pool.end()){
+        cl_mem mem = *best;
+        _pool.erase(best);
+        return mem;
+    }
+
+    cl_mem mem = clCreateBuffer(C->context(),
+                                C->memFlags(),
+                                size,
+                                NULL,
+                                &err_code);
+    if((err_code != CL_SUCCESS) && _pool.size()){
+        // Give the released buffers back and try again
+        for(auto pool_mem : _pool){
+            clReleaseMemObject(pool_mem);
+        }
+        _pool.clear();
+        mem = clCreateBuffer(C->context(),
+                             C->memFlags(),
+                             size,
+                             NULL,
+                             &err_code);
+    }
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Allocation failure.\n");
+        Logger::singleton()->printOpenCLError(err_code);
+        throw std::bad_alloc();
     }
-    return allocated_mem;
+    return mem;
+}
+
+void Variables::releaseBuffer(cl_mem mem)
+{
+    if(mem)
+        _pool.push_back(mem);
+}
+
+void Variables::alias(std::vector<ArrayVariable*> vars)
+{
+    cl_int err_code;
+    CalcServer::CalcServer *C = CalcServer::CalcServer::singleton();
+
+    if(vars.size() < 2)
+        return;
+
+    size_t max_size = 0, total_size = 0;
+    for(auto var : vars){
+        max_size = max(max_size, var->size());
+        total_size += var->size();
+    }
+
+    cl_mem mem = clCreateBuffer(C->context(),
+                                C->memFlags(),
+                                max_size,
+                                NULL,
+                                &err_code);
+    if(err_code != CL_SUCCESS) {
+        LOG(L_ERROR, "Allocation failure.\n");
+        Logger::singleton()->printOpenCLError(err_code);
+        throw std::bad_alloc();
+    }
+    _aliased_mems.push_back(mem);
+
+    for(auto var : vars){
+        cl_buffer_region region;
+        region.origin = 0;
+        region.size = var->size();
+        cl_mem sub_mem = clCreateSubBuffer(mem,
+                                           CL_MEM_READ_WRITE,
+                                           CL_BUFFER_CREATE_TYPE_REGION,
+                                           &region,
+                                           &err_code);
+        if(err_code != CL_SUCCESS) {
+            std::ostringstream msg;
+            msg << "Failure aliasing the array \"" << var->name()
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        // Wait for the pending operations before releasing the old memory
+        cl_event event = var->getEvent();
+        err_code = clWaitForEvents(1, &event);
+        if(err_code != CL_SUCCESS) {
+            std::ostringstream msg;
+            msg << "Failure waiting for the array \"" << var->name()
+                << "\"." << std::endl;
+            LOG(L_ERROR, msg.str());
+            Logger::singleton()->printOpenCLError(err_code);
+            throw std::runtime_error("OpenCL error");
+        }
+        cl_mem old_mem = *(cl_mem*)var->get();
+        clReleaseMemObject(old_mem);
+        // The new version will let the kernels know they should set the
+        // argument again
+        var->set(&sub_mem);
+    }
+
+    _aliased_memory += total_size - max_size;
 }
 
 size_t Variables::typeToBytes(const std::string type)
@@ -1138,7 +1622,10 @@ size_t Variables::typeToBytes(const std::string type)
     unsigned int n = typeToN(type);
     size_t type_size = 0;
 
-    if(type.find("unsigned int") != std::string::npos ||
+    if(isHalfType(type)) {
+        type_size = sizeof(cl_half);
+    }
+    else if(type.find("unsigned int") != std::string::npos ||
        type.find("uivec") != std::string::npos) {
         type_size = sizeof(unsigned int);
     }
@@ -1172,6 +1659,13 @@ unsigned int Variables::typeToN(const std::string type)
     else if(type.find("vec4") != std::string::npos) {
         n = 4;
     }
+    else if(type.find("pvec") != std::string::npos) {
+        #ifdef HAVE_3D
+            n = 3;
+        #else
+            n = 2;
+        #endif // HAVE_3D
+    }
     else if(type.find("vec") != std::string::npos) {
         #ifdef HAVE_3D
             n = 4;
@@ -1189,6 +1683,12 @@ unsigned int Variables::typeToN(const std::string type)
     return n;
 }
 
+bool Variables::isHalfType(const std::string type)
+{
+    return (type.find("half") != std::string::npos) ||
+           (type.find("hvec") != std::string::npos);
+}
+
 bool Variables::isSameType(const std::string type_a,
                            const std::string type_b,
                            bool ignore_asterisk)
@@ -1239,6 +1739,33 @@ void Variables::solve(const std::string type_name,
                       void *data,
                       const std::string name)
 {
+    populatePending();
+    solve(type_name, value, NULL, data, name);
+}
+
+void Variables::solve(const std::string type_name,
+                      Expression *expr,
+                      void *data)
+{
+    solve(type_name, expr->expression(), expr, data, "NULL");
+}
+
+Expression* Variables::compile(const std::string value)
+{
+    if(!value.compare("")){
+        LOG(L_ERROR, "Empty value received\n");
+        throw std::runtime_error("Empty value string");
+    }
+    return new Expression(value, this);
+}
+
+void Variables::solve(const std::string type_name,
+                      const std::string value,
+                      Expression *expr,
+                      void *data,
+                      const std::string name)
+{
+
     size_t typesize = typeToBytes(type_name);
     if(!typesize){
         throw std::runtime_error("0 bytes size");
@@ -1253,30 +1780,39 @@ void Variables::solve(const std::string type_name,
     if(type.back() == '*')
         type.pop_back();
 
-    if(!type.compare("int")){
+    if(isHalfType(type)){
+        const unsigned int n = typeToN(type);
+        float auxval[4];
+        cl_half val[4];
+        readComponents(name, value, expr, n, auxval);
+        for(unsigned int i = 0; i < n; i++)
+            val[i] = floatToHalf(auxval[i]);
+        memcpy(data, val, typesize);
+    }
+    else if(!type.compare("int")){
         int val;
         float auxval;
-        readComponents(name, value, 1, &auxval);
+        readComponents(name, value, expr, 1, &auxval);
         val = round(auxval);
         memcpy(data, &val, typesize);
     }
     else if(!type.compare("unsigned int")){
         unsigned int val;
         float auxval;
-        readComponents(name, value, 1, &auxval);
+        readComponents(name, value, expr, 1, &auxval);
         val = (unsigned int)round(auxval);
         memcpy(data, &val, typesize);
     }
     else if(!type.compare("float")){
         float val;
-        readComponents(name, value, 1, &val);
+        readComponents(name, value, expr, 1, &val);
         memcpy(data, &val, typesize);
     }
     else if(!type.compare("vec")){
         vec val;
         #ifdef HAVE_3D
             float auxval[4];
-            readComponents(name, value, 4, auxval);
+            readComponents(name, value, expr, 4, auxval);
             val.x = auxval[0];
             val.y = auxval[1];
             val.z = auxval[2];
@@ -1284,7 +1820,7 @@ void Variables::solve(const std::string type_name,
             memcpy(data, &val, typesize);
         #else
             float auxval[2];
-            readComponents(name, value, 2, auxval);
+            readComponents(name, value, expr, 2, auxval);
             val.x = auxval[0];
             val.y = auxval[1];
         #endif
@@ -1293,7 +1829,7 @@ void Variables::solve(const std::string type_name,
     else if(!type.compare("vec2")){
         vec2 val;
         float auxval[2];
-        readComponents(name, value, 2, auxval);
+        readComponents(name, value, expr, 2, auxval);
         val.x = auxval[0];
         val.y = auxval[1];
         memcpy(data, &val, typesize);
@@ -1301,7 +1837,7 @@ void Variables::solve(const std::string type_name,
     else if(!type.compare("vec3")){
         vec3 val;
         float auxval[3];
-        readComponents(name, value, 3, auxval);
+        readComponents(name, value, expr, 3, auxval);
         val.x = auxval[0];
         val.y = auxval[1];
         val.z = auxval[2];
@@ -1310,7 +1846,7 @@ void Variables::solve(const std::string type_name,
     else if(!type.compare("vec4")){
         vec4 val;
         float auxval[4];
-        readComponents(name, value, 4, auxval);
+        readComponents(name, value, expr, 4, auxval);
         val.x = auxval[0];
         val.y = auxval[1];
         val.z = auxval[2];
@@ -1321,7 +1857,7 @@ void Variables::solve(const std::string type_name,
         ivec val;
         #ifdef HAVE_3D
             float auxval[4];
-            readComponents(name, value, 4, auxval);
+            readComponents(name, value, expr, 4, auxval);
             val.x = round(auxval[0]);
             val.y = round(auxval[1]);
             val.z = round(auxval[2]);
@@ -1329,7 +1865,7 @@ void Variables::solve(const std::string type_name,
             memcpy(data, &val, typesize);
         #else
             float auxval[2];
-            readComponents(name, value, 2, auxval);
+            readComponents(name, value, expr, 2, auxval);
             val.x = round(auxval[0]);
             val.y = round(auxval[1]);
         #endif
@@ -1338,7 +1874,7 @@ void Variables::solve(const std::string type_name,
     else if(!type.compare("ivec2")){
         ivec2 val;
         float auxval[2];
-        readComponents(name, value, 2, auxval);
+        readComponents(name, value, expr, 2, auxval);
         val.x = round(auxval[0]);
         val.y = round(auxval[1]);
         memcpy(data, &val, typesize);
@@ -1346,7 +1882,7 @@ void Variables::solve(const std::string type_name,
     else if(!type.compare("ivec3")){
         ivec3 val;
         float auxval[3];
-        readComponents(name, value, 3, auxval);
+        readComponents(name, value, expr, 3, auxval);
         val.x = round(auxval[0]);
         val.y = round(auxval[1]);
         val.z = round(auxval[2]);
@@ -1355,7 +1891,7 @@ void Variables::solve(const std::string type_name,
     else if(!type.compare("ivec4")){
         ivec4 val;
         float auxval[4];
-        readComponents(name, value, 4, auxval);
+        readComponents(name, value, expr, 4, auxval);
         val.x = round(auxval[0]);
         val.y = round(auxval[1]);
         val.z = round(auxval[2]);
@@ -1366,7 +1902,7 @@ void Variables::solve(const std::string type_name,
         uivec val;
         #ifdef HAVE_3D
             float auxval[4];
-            readComponents(name, value, 4, auxval);
+            readComponents(name, value, expr, 4, auxval);
             val.x = (unsigned int)round(auxval[0]);
             val.y = (unsigned int)round(auxval[1]);
             val.z = (unsigned int)round(auxval[2]);
@@ -1374,7 +1910,7 @@ void Variables::solve(const std::string type_name,
             memcpy(data, &val, typesize);
         #else
             float auxval[2];
-            readComponents(name, value, 2, auxval);
+            readComponents(name, value, expr, 2, auxval);
             val.x = (unsigned int)round(auxval[0]);
             val.y = (unsigned int)round(auxval[1]);
         #endif
@@ -1383,7 +1919,7 @@ void Variables::solve(const std::string type_name,
     else if(!type.compare("uivec2")){
         uivec2 val;
         float auxval[2];
-        readComponents(name, value, 2, auxval);
+        readComponents(name, value, expr, 2, auxval);
         val.x = (unsigned int)round(auxval[0]);
         val.y = (unsigned int)round(auxval[1]);
         memcpy(data, &val, typesize);
@@ -1391,7 +1927,7 @@ void Variables::solve(const std::string type_name,
     else if(!type.compare("uivec3")){
         uivec3 val;
         float auxval[3];
-        readComponents(name, value, 3, auxval);
+        readComponents(name, value, expr, 3, auxval);
         val.x = (unsigned int)round(auxval[0]);
         val.y = (unsigned int)round(auxval[1]);
         val.z = (unsigned int)round(auxval[2]);
@@ -1400,7 +1936,7 @@ void Variables::solve(const std::string type_name,
     else if(!type.compare("uivec4")){
         uivec4 val;
         float auxval[4];
-        readComponents(name, value, 4, auxval);
+        readComponents(name, value, expr, 4, auxval);
         val.x = (unsigned int)round(auxval[0]);
         val.y = (unsigned int)round(auxval[1]);
         val.z = (unsigned int)round(auxval[2]);
@@ -1433,6 +1969,23 @@ void Variables::populate(const std::string name)
     }
 }
 
+void Variables::populate_async(Variable* var)
+{
+    if(std::find(_pending_vars.begin(), _pending_vars.end(), var) ==
+       _pending_vars.end())
+        _pending_vars.push_back(var);
+}
+
+void Variables::populatePending()
+{
+    // Move the list first, since populate() may end up calling solve()
+    std::vector<Variable*> vars;
+    vars.swap(_pending_vars);
+    for(auto var : vars){
+        populate(var);
+    }
+}
+
 void Variables::populate(Variable* var)
 {
     std::ostringstream name;
@@ -1647,14 +2200,14 @@ void Variables::registerScalar(const std::string name,
             vec val;
             #ifdef HAVE_3D
                 float auxval[4];
-                readComponents(name, value, 4, auxval);
+                readComponents(name, value, NULL, 4, auxval);
                 val.x = auxval[0];
                 val.y = auxval[1];
                 val.z = auxval[2];
                 val.w = auxval[3];
             #else
                 float auxval[2];
-                readComponents(name, value, 2, auxval);
+                readComponents(name, value, NULL, 2, auxval);
                 val.x = auxval[0];
                 val.y = auxval[1];
             #endif // HAVE_3D
@@ -1667,7 +2220,7 @@ void Variables::registerScalar(const std::string name,
         if(value.compare("")){
             vec2 val;
             float auxval[2];
-            readComponents(name, value, 2, auxval);
+            readComponents(name, value, NULL, 2, auxval);
             val.x = auxval[0];
             val.y = auxval[1];
             var->set(&val);
@@ -1679,7 +2232,7 @@ void Variables::registerScalar(const std::string name,
         if(value.compare("")){
             vec3 val;
             float auxval[3];
-            readComponents(name, value, 3, auxval);
+            readComponents(name, value, NULL, 3, auxval);
             val.x = auxval[0];
             val.y = auxval[1];
             val.z = auxval[2];
@@ -1692,7 +2245,7 @@ void Variables::registerScalar(const std::string name,
         if(value.compare("")){
             vec4 val;
             float auxval[4];
-            readComponents(name, value, 4, auxval);
+            readComponents(name, value, NULL, 4, auxval);
             val.x = auxval[0];
             val.y = auxval[1];
             val.z = auxval[2];
@@ -1707,14 +2260,14 @@ void Variables::registerScalar(const std::string name,
             ivec val;
             #ifdef HAVE_3D
                 float auxval[4];
-                readComponents(name, value, 4, auxval);
+                readComponents(name, value, NULL, 4, auxval);
                 val.x = round(auxval[0]);
                 val.y = round(auxval[1]);
                 val.z = round(auxval[2]);
                 val.w = round(auxval[3]);
             #else
                 float auxval[2];
-                readComponents(name, value, 2, auxval);
+                readComponents(name, value, NULL, 2, auxval);
                 val.x = round(auxval[0]);
                 val.y = round(auxval[1]);
             #endif // HAVE_3D
@@ -1727,7 +2280,7 @@ void Variables::registerScalar(const std::string name,
         if(value.compare("")){
             ivec2 val;
             float auxval[2];
-            readComponents(name, value, 2, auxval);
+            readComponents(name, value, NULL, 2, auxval);
             val.x = round(auxval[0]);
             val.y = round(auxval[1]);
             var->set(&val);
@@ -1739,7 +2292,7 @@ void Variables::registerScalar(const std::string name,
         if(value.compare("")){
             ivec3 val;
             float auxval[3];
-            readComponents(name, value, 3, auxval);
+            readComponents(name, value, NULL, 3, auxval);
             val.x = round(auxval[0]);
             val.y = round(auxval[1]);
             val.z = round(auxval[2]);
@@ -1752,7 +2305,7 @@ void Variables::registerScalar(const std::string name,
         if(value.compare("")){
             ivec4 val;
             float auxval[4];
-            readComponents(name, value, 4, auxval);
+            readComponents(name, value, NULL, 4, auxval);
             val.x = round(auxval[0]);
             val.y = round(auxval[1]);
             val.z = round(auxval[2]);
@@ -1767,14 +2320,14 @@ void Variables::registerScalar(const std::string name,
             uivec val;
             #ifdef HAVE_3D
                 float auxval[4];
-                readComponents(name, value, 4, auxval);
+                readComponents(name, value, NULL, 4, auxval);
                 val.x = (unsigned int)round(auxval[0]);
                 val.y = (unsigned int)round(auxval[1]);
                 val.z = (unsigned int)round(auxval[2]);
                 val.w = (unsigned int)round(auxval[3]);
             #else
                 float auxval[2];
-                readComponents(name, value, 2, auxval);
+                readComponents(name, value, NULL, 2, auxval);
                 val.x = (unsigned int)round(auxval[0]);
                 val.y = (unsigned int)round(auxval[1]);
             #endif // HAVE_3D
@@ -1787,7 +2340,7 @@ void Variables::registerScalar(const std::string name,
         if(value.compare("")){
             uivec2 val;
             float auxval[2];
-            readComponents(name, value, 2, auxval);
+            readComponents(name, value, NULL, 2, auxval);
             val.x = (unsigned int)round(auxval[0]);
             val.y = (unsigned int)round(auxval[1]);
             var->set(&val);
@@ -1799,7 +2352,7 @@ void Variables::registerScalar(const std::string name,
         if(value.compare("")){
             uivec3 val;
             float auxval[3];
-            readComponents(name, value, 3, auxval);
+            readComponents(name, value, NULL, 3, auxval);
             val.x = (unsigned int)round(auxval[0]);
             val.y = (unsigned int)round(auxval[1]);
             val.z = (unsigned int)round(auxval[2]);
@@ -1812,7 +2365,7 @@ void Variables::registerScalar(const std::string name,
         if(value.compare("")){
             uivec4 val;
             float auxval[4];
-            readComponents(name, value, 4, auxval);
+            readComponents(name, value, NULL, 4, auxval);
             val.x = (unsigned int)round(auxval[0]);
             val.y = (unsigned int)round(auxval[1]);
             val.z = (unsigned int)round(auxval[2]);
@@ -1869,6 +2422,7 @@ void Variables::registerClMem(const std::string name,
         LOG0(L_DEBUG, "\tvec2*\n");
         LOG0(L_DEBUG, "\tvec3*\n");
         LOG0(L_DEBUG, "\tvec4*\n");
+        LOG0(L_DEBUG, "\tpvec*\n");
         LOG0(L_DEBUG, "\tivec*\n");
         LOG0(L_DEBUG, "\tivec2*\n");
         LOG0(L_DEBUG, "\tivec3*\n");
@@ -1878,6 +2432,11 @@ void Variables::registerClMem(const std::string name,
         LOG0(L_DEBUG, "\tuivec3*\n");
         LOG0(L_DEBUG, "\tuivec4*\n");
         LOG0(L_DEBUG, "\tmatrix*\n");
+        LOG0(L_DEBUG, "\thalf*\n");
+        LOG0(L_DEBUG, "\thvec*\n");
+        LOG0(L_DEBUG, "\thvec2*\n");
+        LOG0(L_DEBUG, "\thvec3*\n");
+        LOG0(L_DEBUG, "\thvec4*\n");
         throw std::runtime_error("Invalid array variable type");
     }
 
@@ -1914,7 +2473,7 @@ void Variables::registerClMem(const std::string name,
     cl_int status;
     cl_mem mem;
     mem = clCreateBuffer(C->context(),
-                            CL_MEM_READ_WRITE,
+                            C->memFlags(),
                             n * typesize,
                             NULL,
                             &status);
@@ -1930,6 +2489,7 @@ void Variables::registerClMem(const std::string name,
 
 void Variables::readComponents(const std::string name,
                                const std::string value,
+                               Expression *expr,
                                unsigned int n,
                                float* v)
 {
@@ -1951,6 +2511,31 @@ void Variables::readComponents(const std::string name,
         throw std::runtime_error("5+ components variable registration");
     }
 
+    if(expr){
+        // The expression has been already parsed, so it can be directly
+        // evaluated
+        try {
+            i = expr->solve(n, v);
+        }
+        catch(...){
+            std::ostringstream msg;
+            msg << "evaluating \"" << value << "\"" << std::endl;
+            LOG0(L_DEBUG, msg.str());
+            throw std::runtime_error("Expression evaluation error");
+        }
+        if (i != n) {
+            std::ostringstream msg;
+            msg << "Failure evaluating \"" << value << "\"" << std::endl;
+            LOG(L_ERROR, msg.str());
+            msg.str("");
+            msg << n << " fields expected, "
+                << i << " received" << std::endl;
+            LOG0(L_DEBUG, msg.str());
+            throw std::runtime_error("Invalid number of fields");
+        }
+        return;
+    }
+
     // Split and parse subexpressions
     std::vector<std::string> value_strs = split_formulae(value);
     const char* extensions[4] = {"_x", "_y", "_z", "_w"};
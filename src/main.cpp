@@ -109,8 +109,11 @@ int main(int argc, char *argv[])
 {
     std::ostringstream msg;
 #ifdef HAVE_MPI
+    // The mpi-sync and mpi-reduction tools are calling MPI from OpenCL
+    // callbacks and auxiliar threads
+    int mpi_thread_support;
     try {
-        MPI::Init(argc, argv);
+        mpi_thread_support = MPI::Init_thread(argc, argv, MPI::THREAD_MULTIPLE);
     } catch(MPI::Exception e){
         LOG(L_INFO, "MPI cannot be initialized\n");
         msg << e.Get_error_code() << ": " << e.Get_error_string() << std::endl;
@@ -118,6 +121,9 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
     MPI::COMM_WORLD.Set_errhandler(MPI::ERRORS_THROW_EXCEPTIONS);
+    if(mpi_thread_support < MPI::THREAD_MULTIPLE) {
+        LOG(L_WARNING, "MPI does not support MPI_THREAD_MULTIPLE\n");
+    }
 #endif
 
     InputOutput::Logger *logger = new InputOutput::Logger();
@@ -171,8 +177,20 @@ int main(int argc, char *argv[])
     while(!t_manager.mustStop())
     {
         try {
+            const unsigned int frame = t_manager.frame();
             calc_server->update(t_manager);
-            file_manager.save(t_manager.time());
+            // The loop may be also interrupted to write a checkpoint
+            if((t_manager.frame() != frame) || t_manager.mustStop())
+                file_manager.save(t_manager.time());
+            if(t_manager.mustCheckpoint()) {
+                file_manager.checkpoint(t_manager.time());
+                t_manager.checkpointed();
+            }
+        } catch (const Aqua::CalcServer::termination_request& e) {
+            // The job is being preempted, so just the checkpoint is written,
+            // to resume it later as fast as possible
+            file_manager.checkpoint(t_manager.time());
+            break;
         } catch (const Aqua::CalcServer::user_interruption& e) {
             // The user has interrupted the simulation, just exit normally
 #ifndef HAVE_MPI